@@ -0,0 +1,358 @@
+// Benchmarks of the kernel's hot-path primitives, run on the host (make
+// bench-host): memcpy, the Internet checksum, kmalloc, memory pools, the
+// SPSC ring and the order book, in ns/op and throughput, across sizes and
+// across threads contending for one allocator or pool.
+#include "host.h"
+#include "mm/memory.h"
+#include "proc/ipc.h"
+#include "proc/book.h"
+#include "net/net.h"
+#include "arch/cpu.h"
+
+#define BENCH_MIN_NS            100000000ull    // A measurement runs at least this long
+#define BENCH_POOL_BLOCKS       4096
+#define BENCH_POOL_BURST        32              // Blocks a thread holds at once
+#define BENCH_RING_SIZE         1024
+#define BENCH_RING_BATCH        32
+#define BENCH_CROSS_MESSAGES    4000000
+#define BENCH_THREAD_OPS        2000000         // Per thread, contention runs
+#define BENCH_BOOK_ORDERS       16384
+
+static uint32_t rng_state = 2463534242u;
+
+static inline uint32_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void heading(const char* title) {
+    host_printf("\n=== %s ===\n", title);
+}
+
+static void report(const char* what, uint64_t ops, uint64_t bytes, uint64_t ns) {
+    double per_op = (double)ns / (double)ops;
+    host_printf("  %-32s %9.1f ns/op %9.2f Mops/s", what, per_op, (double)ops * 1000.0 / (double)ns);
+    if (bytes) {
+        host_printf(" %8.2f GB/s", (double)bytes / (double)ns);
+    }
+    host_printf("\n");
+}
+
+// Doubles the iterations until one run lasts BENCH_MIN_NS
+static void measure(const char* what, void (*run)(void* ctx, uint64_t iters), void* ctx,
+                    uint64_t bytes_per_op) {
+    uint64_t iters = 1024;
+    for (;;) {
+        uint64_t start = host_now_ns();
+        run(ctx, iters);
+        uint64_t ns = host_now_ns() - start;
+        if (ns >= BENCH_MIN_NS || iters >= (1ull << 40)) {
+            report(what, iters, iters * bytes_per_op, ns);
+            return;
+        }
+        iters = ns < BENCH_MIN_NS / 16 ? iters * 8 : iters * 2;
+    }
+}
+
+// Thread counts to contend with: 1, 2, 4, 8 while the host has the CPUs
+static uint32_t thread_levels(uint32_t levels[4]) {
+    uint32_t cpus = host_online_cpus(), count = 0;
+    for (uint32_t n = 1; n <= HOST_MAX_THREADS && n <= cpus; n *= 2) {
+        levels[count++] = n;
+    }
+    return count;
+}
+
+static volatile uint32_t threads_ready;
+
+// All threads of a run start together
+static void start_barrier(uint32_t threads) {
+    __sync_fetch_and_add(&threads_ready, 1);
+    while (load_acquire(&threads_ready) < threads) {
+        cpu_relax();
+    }
+}
+
+static void measure_threads(const char* what, uint32_t threads, uint64_t ops_per_thread,
+                            void (*fn)(uint32_t index, void* arg), void* arg) {
+    threads_ready = 0;
+    uint64_t start = host_now_ns();
+    host_run_threads(threads, fn, arg);
+    report(what, ops_per_thread * threads, 0, host_now_ns() - start);
+}
+
+// --- memcpy and checksum ---
+
+typedef struct {
+    uint8_t* src;
+    uint8_t* dst;
+    uint32_t size;
+} copy_ctx_t;
+
+static void run_memcpy(void* ctx, uint64_t iters) {
+    copy_ctx_t* c = ctx;
+    for (uint64_t i = 0; i < iters; i++) {
+        memcpy(c->dst, c->src, c->size);
+        compiler_barrier();
+    }
+}
+
+static volatile uint16_t checksum_sink;
+
+static void run_checksum(void* ctx, uint64_t iters) {
+    copy_ctx_t* c = ctx;
+    for (uint64_t i = 0; i < iters; i++) {
+        checksum_sink = net_checksum(c->src, c->size);
+    }
+}
+
+static void bench_copy(void) {
+    static const uint32_t sizes[] = { 64, 256, 1024, 4096, 65536, 1048576 };
+    static const uint32_t csum_sizes[] = { 64, 576, 1500, 9000, 65536 };
+    copy_ctx_t c;
+    c.src = kmalloc_aligned(1048576, CACHE_LINE_SIZE);
+    c.dst = kmalloc_aligned(1048576, CACHE_LINE_SIZE);
+    if (!c.src || !c.dst) host_fatal("copy buffers");
+    memset(c.src, 0x5A, 1048576);
+
+    char what[40];
+    heading("memcpy");
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        c.size = sizes[i];
+        host_snprintf(what, sizeof(what), "%u bytes", sizes[i]);
+        measure(what, run_memcpy, &c, sizes[i]);
+    }
+
+    heading("net_checksum");
+    for (uint32_t i = 0; i < sizeof(csum_sizes) / sizeof(csum_sizes[0]); i++) {
+        c.size = csum_sizes[i];
+        host_snprintf(what, sizeof(what), "%u bytes", csum_sizes[i]);
+        measure(what, run_checksum, &c, csum_sizes[i]);
+    }
+
+    kfree_aligned(c.src);
+    kfree_aligned(c.dst);
+}
+
+// --- kmalloc ---
+
+static void run_kmalloc(void* ctx, uint64_t iters) {
+    uint32_t size = *(uint32_t*)ctx;
+    for (uint64_t i = 0; i < iters; i++) {
+        void* p = _kmalloc_debug(size, __FILE__, __LINE__);
+        compiler_barrier();
+        kfree(p);
+    }
+}
+
+static void kmalloc_thread(uint32_t index, void* arg) {
+    uint32_t threads = *(uint32_t*)arg;
+    host_cpu_enter(index);
+    start_barrier(threads);
+    for (uint32_t i = 0; i < BENCH_THREAD_OPS; i++) {
+        void* p = kmalloc(64 + (i & 3) * 64);
+        compiler_barrier();
+        kfree(p);
+    }
+}
+
+static void bench_kmalloc(void) {
+    static const uint32_t sizes[] = { 16, 64, 256, 1024, 4096, 16384 };
+    char what[40];
+    heading("kmalloc + kfree");
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint32_t size = sizes[i];
+        host_snprintf(what, sizeof(what), "%u bytes", size);
+        measure(what, run_kmalloc, &size, 0);
+    }
+
+    uint32_t levels[4], count = thread_levels(levels);
+    for (uint32_t i = 0; i < count; i++) {
+        host_snprintf(what, sizeof(what), "64-256 bytes, %u CPU(s)", levels[i]);
+        measure_threads(what, levels[i], BENCH_THREAD_OPS, kmalloc_thread, &levels[i]);
+    }
+}
+
+// --- memory pools ---
+
+typedef struct {
+    memory_pool_t* pool;
+    uint32_t threads;
+} pool_ctx_t;
+
+static void run_pool(void* ctx, uint64_t iters) {
+    memory_pool_t* pool = ((pool_ctx_t*)ctx)->pool;
+    for (uint64_t i = 0; i < iters; i++) {
+        void* p = pool_alloc(pool);
+        compiler_barrier();
+        pool_free(pool, p);
+    }
+}
+
+// A burst at a time, so the magazines empty and refill from the depot
+static void pool_thread(uint32_t index, void* arg) {
+    pool_ctx_t* c = arg;
+    void* held[BENCH_POOL_BURST];
+    host_cpu_enter(index);
+    start_barrier(c->threads);
+    for (uint32_t i = 0; i < BENCH_THREAD_OPS / BENCH_POOL_BURST; i++) {
+        uint32_t got = 0;
+        while (got < BENCH_POOL_BURST && (held[got] = pool_alloc(c->pool))) got++;
+        while (got) pool_free(c->pool, held[--got]);
+    }
+}
+
+static void bench_pool(void) {
+    static const uint32_t sizes[] = { 64, 256, 1024 };
+    char what[40];
+    heading("pool_alloc + pool_free");
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        pool_ctx_t c = { create_memory_pool(sizes[i], BENCH_POOL_BLOCKS / 4), 1 };
+        if (!c.pool) host_fatal("pool");
+        host_snprintf(what, sizeof(what), "%u-byte blocks", sizes[i]);
+        measure(what, run_pool, &c, 0);
+        destroy_memory_pool(c.pool);
+    }
+
+    uint32_t levels[4], count = thread_levels(levels);
+    for (uint32_t i = 0; i < count; i++) {
+        pool_ctx_t c = { create_memory_pool(64, BENCH_POOL_BLOCKS), levels[i] };
+        if (!c.pool) host_fatal("pool");
+        host_snprintf(what, sizeof(what), "bursts of %u, %u CPU(s)", BENCH_POOL_BURST, levels[i]);
+        measure_threads(what, levels[i], (BENCH_THREAD_OPS / BENCH_POOL_BURST) * BENCH_POOL_BURST,
+                        pool_thread, &c);
+        destroy_memory_pool(c.pool);
+    }
+}
+
+// --- SPSC ring ---
+
+typedef struct {
+    lockfree_ringbuf_t ring;
+    uint8_t element[256];
+    uint8_t batch[BENCH_RING_BATCH * 64];
+} ring_ctx_t;
+
+static void run_ring(void* ctx, uint64_t iters) {
+    ring_ctx_t* c = ctx;
+    for (uint64_t i = 0; i < iters; i++) {
+        ringbuf_push(&c->ring, c->element);
+        ringbuf_pop(&c->ring, c->element);
+    }
+}
+
+static void run_ring_batch(void* ctx, uint64_t iters) {
+    ring_ctx_t* c = ctx;
+    for (uint64_t i = 0; i < iters; i += BENCH_RING_BATCH) {
+        ringbuf_push_n(&c->ring, c->batch, BENCH_RING_BATCH);
+        ringbuf_pop_n(&c->ring, c->batch, BENCH_RING_BATCH);
+    }
+}
+
+// Index 0 consumes, 1 produces, on CPUs of their own
+static void ring_cross_thread(uint32_t index, void* arg) {
+    ring_ctx_t* c = arg;
+    uint8_t element[64] = { 0 };
+    host_cpu_enter(index);
+    start_barrier(2);
+    for (uint32_t i = 0; i < BENCH_CROSS_MESSAGES; i++) {
+        if (index) {
+            while (ringbuf_push(&c->ring, element) != 0) cpu_relax();
+        } else {
+            while (ringbuf_pop(&c->ring, element) != 0) cpu_relax();
+        }
+    }
+}
+
+static void bench_ring(void) {
+    static const uint32_t sizes[] = { 8, 64, 256 };
+    static ring_ctx_t c;
+    char what[40];
+    heading("ringbuf (SPSC)");
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (ringbuf_init(&c.ring, BENCH_RING_SIZE, sizes[i]) != 0) host_fatal("ring");
+        host_snprintf(what, sizeof(what), "push + pop, %u bytes", sizes[i]);
+        measure(what, run_ring, &c, sizes[i]);
+        ringbuf_destroy(&c.ring);
+    }
+
+    if (ringbuf_init(&c.ring, BENCH_RING_SIZE, 64) != 0) host_fatal("ring");
+    host_snprintf(what, sizeof(what), "push_n + pop_n of %u, 64 B", BENCH_RING_BATCH);
+    measure(what, run_ring_batch, &c, 64);
+    if (host_online_cpus() >= 2) {
+        measure_threads("cross-thread, 64 bytes", 2, BENCH_CROSS_MESSAGES / 2,
+                        ring_cross_thread, &c);
+    }
+    ringbuf_destroy(&c.ring);
+}
+
+// --- order book ---
+
+typedef struct {
+    order_book_t* book;
+    uint32_t resting;           // Orders left in the book between operations
+    uint32_t next_id;
+} book_ctx_t;
+
+// Near the touch: within the array window on either side of 10000
+static int32_t book_tick(uint8_t side) {
+    int32_t offset = (int32_t)(rng_next() % (BOOK_WINDOW / 2));
+    return side == BOOK_BID ? 9999 - offset : 10001 + offset;
+}
+
+static void run_book_add_cancel(void* ctx, uint64_t iters) {
+    book_ctx_t* c = ctx;
+    for (uint64_t i = 0; i < iters; i++) {
+        uint8_t side = (uint8_t)(i & 1);
+        uint32_t id = c->next_id++;
+        book_add(c->book, id, side, book_tick(side), 100, i, 1);
+        book_cancel(c->book, id);
+    }
+}
+
+static void run_book_add_execute(void* ctx, uint64_t iters) {
+    book_ctx_t* c = ctx;
+    for (uint64_t i = 0; i < iters; i++) {
+        uint8_t side = (uint8_t)(i & 1);
+        uint32_t id = c->next_id++;
+        book_add(c->book, id, side, book_tick(side), 100, i, 1);
+        book_execute(c->book, id, 40);
+        book_execute(c->book, id, 60);
+    }
+}
+
+static void bench_book(void) {
+    static const uint32_t depths[] = { 0, 1000, 8000 };
+    char what[48];
+    heading("order book");
+    for (uint32_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+        book_ctx_t c = { book_create(1, 0.01, BENCH_BOOK_ORDERS), depths[i], 1 };
+        if (!c.book) host_fatal("book");
+        for (uint32_t n = 0; n < c.resting; n++) {
+            uint8_t side = (uint8_t)(n & 1);
+            book_add(c.book, c.next_id++, side, book_tick(side), 100, n, 1);
+        }
+
+        host_snprintf(what, sizeof(what), "add + cancel, %u resting", c.resting);
+        measure(what, run_book_add_cancel, &c, 0);
+        host_snprintf(what, sizeof(what), "add + 2 executes, %u resting", c.resting);
+        measure(what, run_book_add_execute, &c, 0);
+        book_destroy(c.book);
+    }
+}
+
+int bench_main(void) {
+    host_cpu_enter(0);
+    memory_init();
+    host_printf("TradeKernel host benchmarks, %u CPUs, %llu ms a measurement\n",
+                host_online_cpus(), BENCH_MIN_NS / 1000000);
+
+    bench_copy();
+    bench_kmalloc();
+    bench_pool();
+    bench_ring();
+    bench_book();
+    return 0;
+}
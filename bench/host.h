@@ -0,0 +1,32 @@
+#ifndef BENCH_HOST_H
+#define BENCH_HOST_H
+
+#include "types.h"
+
+// Host-side build of kernel modules (make bench-host). The modules and the
+// benchmarks are compiled as kernel code (kernel headers, -nostdinc,
+// KERNEL_HOST), host_libc.c is the one file built against the host's libc,
+// and this is all they share: kernel types only, no libc headers.
+//
+// Each benchmark thread is a CPU of its own. host_cpu_enter points its GS
+// base at cpus[id], so this_cpu() and the per-CPU magazines work as in the
+// kernel, and irq_save only reads the flags (arch/cpu.h).
+#define HOST_MAX_THREADS        8           // MAX_CPUS
+
+uint64_t host_now_ns(void);                 // CLOCK_MONOTONIC
+int host_printf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+int host_snprintf(char* buf, size_t size, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+void host_fatal(const char* what) __attribute__((noreturn));
+uint32_t host_online_cpus(void);
+
+// GS base of the calling thread
+void host_set_gs(void* base);
+
+// Run fn(index, arg) on 'count' threads, index 0 to count - 1, and join
+// them; an index is the kernel CPU the thread enters
+void host_run_threads(uint32_t count, void (*fn)(uint32_t index, void* arg), void* arg);
+
+// Kernel side (host_shim.c): this thread becomes CPU 'id'
+void host_cpu_enter(uint32_t id);
+
+#endif // BENCH_HOST_H
@@ -0,0 +1,88 @@
+// The host end of the shim: the only file built against libc. It may not
+// include kernel headers, so the few prototypes it shares with host.h are
+// repeated here with libc types of the same width.
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <asm/prctl.h>
+#include <sys/syscall.h>
+
+#define HOST_MAX_THREADS 8
+
+int bench_main(void);
+
+uint64_t host_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int host_printf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vprintf(fmt, args);
+    va_end(args);
+    fflush(stdout);
+    return n;
+}
+
+int host_snprintf(char* buf, size_t size, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return n;
+}
+
+void host_fatal(const char* what) {
+    fprintf(stderr, "bench-host: %s\n", what);
+    exit(1);
+}
+
+uint32_t host_online_cpus(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint32_t)n : 1;
+}
+
+void host_set_gs(void* base) {
+    if (syscall(SYS_arch_prctl, ARCH_SET_GS, (unsigned long)base) != 0) {
+        host_fatal("arch_prctl(ARCH_SET_GS) failed");
+    }
+}
+
+typedef struct {
+    void (*fn)(uint32_t index, void* arg);
+    void* arg;
+    uint32_t index;
+} host_thread_t;
+
+static void* host_thread_main(void* p) {
+    host_thread_t* t = p;
+    t->fn(t->index, t->arg);
+    return NULL;
+}
+
+void host_run_threads(uint32_t count, void (*fn)(uint32_t index, void* arg), void* arg) {
+    pthread_t threads[HOST_MAX_THREADS];
+    host_thread_t args[HOST_MAX_THREADS];
+    if (count == 0 || count > HOST_MAX_THREADS) host_fatal("thread count");
+
+    for (uint32_t i = 0; i < count; i++) {
+        args[i] = (host_thread_t){ fn, arg, i };
+        if (pthread_create(&threads[i], NULL, host_thread_main, &args[i]) != 0) {
+            host_fatal("pthread_create failed");
+        }
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+int main(void) {
+    return bench_main();
+}
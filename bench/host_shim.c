@@ -0,0 +1,119 @@
+// The kernel end of the shim: what the benchmarked modules call outside
+// themselves, built as kernel code. IPC entry points the host's libc also
+// names (msgctl, semop...) are kept by the link although nothing here calls
+// them, so the wait primitives behind them exist too, and trap.
+#include "host.h"
+#include "mm/memory.h"
+#include "mm/memprof.h"
+#include "arch/fpu.h"
+#include "arch/tsc.h"
+#include "proc/process.h"
+#include "proc/futex.h"
+#include "proc/mutex.h"
+#include "proc/poll.h"
+#include "proc/klog.h"
+
+cpu_t cpus[MAX_CPUS];
+
+// memory_init puts the heap here, as past the kernel image
+char _kernel_end[KERNEL_HEAP_SIZE + PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+void host_cpu_enter(uint32_t id) {
+    if (id >= MAX_CPUS) host_fatal("cpu id");
+    cpus[id].self = &cpus[id];
+    cpus[id].id = id;
+    cpus[id].online = true;
+    host_set_gs(&cpus[id]);
+}
+
+// SSE needs no saving in a host thread
+bool fpu_kernel_begin(uint32_t* flags) {
+    *flags = 0;
+    return true;
+}
+
+void fpu_kernel_end(uint32_t flags) {
+    (void)flags;
+}
+
+volatile uint32_t memprof_rate = 0;
+volatile uint32_t memprof_live_count = 0;
+
+bool memprof_tick(size_t size) {
+    (void)size;
+    return false;
+}
+
+void memprof_record(void* ptr, size_t size, void* site) {
+    (void)ptr; (void)size; (void)site;
+}
+
+void memprof_free(void* ptr) {
+    (void)ptr;
+}
+
+void klog_write(uint32_t level, const char* fmt, uint32_t nargs, ...) {
+    (void)level; (void)nargs;
+    host_printf("klog: %s", fmt);
+}
+
+void print_dec(uint32_t value) {
+    host_printf("%u", value);
+}
+
+void print_hex(uint32_t value) {
+    host_printf("0x%08X", value);
+}
+
+uint64_t ktime_ns(void) {
+    return host_now_ns();
+}
+
+uint32_t get_current_time_ms(void) {
+    return (uint32_t)(host_now_ns() / 1000000);
+}
+
+// Blocking has no place in a benchmark thread
+int futex_wait(volatile uint32_t* addr, uint32_t expected, uint32_t timeout_ms) {
+    (void)addr; (void)expected; (void)timeout_ms;
+    host_fatal("futex_wait");
+}
+
+bool futex_spin(volatile uint32_t* addr, uint32_t expected) {
+    (void)addr; (void)expected;
+    host_fatal("futex_spin");
+}
+
+uint32_t futex_wake(volatile uint32_t* addr, uint32_t count) {
+    (void)addr; (void)count;
+    return 0;
+}
+
+uint32_t pi_lock_irqsave(void) {
+    host_fatal("pi_lock_irqsave");
+}
+
+void pi_unlock_irqrestore(uint32_t flags) {
+    (void)flags;
+}
+
+bool pi_wait(pi_object_t* obj, uint32_t* flags, uint32_t timeout_ms) {
+    (void)obj; (void)flags; (void)timeout_ms;
+    host_fatal("pi_wait");
+}
+
+void pi_wake_all(pi_object_t* obj) {
+    (void)obj;
+}
+
+void pi_set_owner(pi_object_t* obj, struct process* owner) {
+    (void)obj; (void)owner;
+}
+
+void poll_wake(poll_head_t* head, uint32_t events) {
+    (void)head; (void)events;
+}
+
+void poll_head_release(poll_head_t* head) {
+    (void)head;
+}
@@ -0,0 +1,183 @@
+#include "acpi.h"
+#include "apic.h"
+#include "../mm/memory.h"
+
+static platform_info_t platform;
+static bool platform_valid = false;
+
+static bool checksum_ok(const void* data, uint32_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+static bool signature_is(const char* field, const char* signature, uint32_t length) {
+    return memcmp(field, signature, length) == 0;
+}
+
+// Firmware structures sit on 16-byte boundaries inside the BIOS areas
+static const void* scan_for(const char* signature, uint32_t sig_len, uint32_t start,
+                            uint32_t length, uint32_t struct_len) {
+    for (uint32_t addr = start; addr + struct_len <= start + length; addr += 16) {
+        const char* candidate = (const char*)addr;
+        if (signature_is(candidate, signature, sig_len) && checksum_ok(candidate, struct_len)) {
+            return candidate;
+        }
+    }
+    return NULL;
+}
+
+static const void* bios_search(const char* signature, uint32_t sig_len, uint32_t struct_len) {
+    uint32_t ebda = (uint32_t)(*(volatile uint16_t*)BIOS_EBDA_SEGMENT_PTR) << 4;
+    const void* found = NULL;
+
+    if (ebda) {
+        found = scan_for(signature, sig_len, ebda, 1024, struct_len);
+    }
+    if (!found) {
+        found = scan_for(signature, sig_len, BASE_MEM_LAST_KB, 1024, struct_len);
+    }
+    if (!found) {
+        found = scan_for(signature, sig_len, BIOS_ROM_START, BIOS_ROM_END - BIOS_ROM_START, struct_len);
+    }
+    return found;
+}
+
+static void add_cpu(platform_info_t* info, uint8_t apic_id) {
+    if (info->cpu_count < MAX_CPUS) {
+        info->cpu_apic_ids[info->cpu_count++] = apic_id;
+    }
+}
+
+static void add_ioapic(platform_info_t* info, uint8_t id, uint32_t address, uint32_t gsi_base) {
+    if (info->ioapic_count < MAX_IOAPICS) {
+        info->ioapics[info->ioapic_count].id = id;
+        info->ioapics[info->ioapic_count].address = address;
+        info->ioapics[info->ioapic_count].gsi_base = gsi_base;
+        info->ioapic_count++;
+    }
+}
+
+static bool acpi_parse_madt(platform_info_t* info) {
+    const acpi_rsdp_t* rsdp = bios_search("RSD PTR ", 8, sizeof(acpi_rsdp_t));
+    if (!rsdp || !rsdp->rsdt_address) return false;
+
+    const acpi_header_t* rsdt = (const acpi_header_t*)rsdp->rsdt_address;
+    if (!signature_is(rsdt->signature, "RSDT", 4) || !checksum_ok(rsdt, rsdt->length)) {
+        return false;
+    }
+
+    const uint32_t* tables = (const uint32_t*)(rsdt + 1);
+    uint32_t table_count = (rsdt->length - sizeof(acpi_header_t)) / 4;
+    const acpi_header_t* madt = NULL;
+    for (uint32_t i = 0; i < table_count; i++) {
+        const acpi_header_t* table = (const acpi_header_t*)tables[i];
+        if (signature_is(table->signature, "APIC", 4) && checksum_ok(table, table->length)) {
+            madt = table;
+            break;
+        }
+    }
+    if (!madt) return false;
+
+    // Header, then the local APIC address and flags, then variable entries
+    const uint8_t* body = (const uint8_t*)(madt + 1);
+    const uint8_t* end = (const uint8_t*)madt + madt->length;
+    info->lapic_address = *(const uint32_t*)body;
+
+    for (const uint8_t* entry = body + 8; entry + 2 <= end && entry[1] >= 2; entry += entry[1]) {
+        switch (entry[0]) {
+            case MADT_LOCAL_APIC:
+                // processor id, apic id, flags
+                if (*(const uint32_t*)(entry + 4) & MADT_LAPIC_ENABLED) {
+                    add_cpu(info, entry[3]);
+                }
+                break;
+            case MADT_IO_APIC:
+                add_ioapic(info, entry[2], *(const uint32_t*)(entry + 4), *(const uint32_t*)(entry + 8));
+                break;
+            case MADT_IRQ_OVERRIDE:
+                if (info->override_count < MAX_IRQ_OVERRIDES) {
+                    irq_override_t* ovr = &info->overrides[info->override_count++];
+                    ovr->source_irq = entry[3];
+                    ovr->gsi = *(const uint32_t*)(entry + 4);
+                    ovr->flags = *(const uint16_t*)(entry + 8);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    info->source = "ACPI MADT";
+    return info->cpu_count > 0;
+}
+
+static bool mp_parse_table(platform_info_t* info) {
+    const mp_floating_t* mpf = bios_search("_MP_", 4, sizeof(mp_floating_t));
+    if (!mpf || !mpf->config_table) return false;
+
+    const mp_config_t* config = (const mp_config_t*)mpf->config_table;
+    if (!signature_is(config->signature, "PCMP", 4) || !checksum_ok(config, config->base_length)) {
+        return false;
+    }
+    info->lapic_address = config->lapic_address;
+
+    const uint8_t* entry = (const uint8_t*)(config + 1);
+    for (uint16_t i = 0; i < config->entry_count; i++) {
+        switch (entry[0]) {
+            case MP_ENTRY_PROCESSOR:
+                if (entry[3] & MP_CPU_ENABLED) {
+                    add_cpu(info, entry[1]);
+                }
+                entry += 20;
+                break;
+            case MP_ENTRY_IOAPIC:
+                if (entry[3] & 0x1) {
+                    add_ioapic(info, entry[1], *(const uint32_t*)(entry + 4), 0);
+                }
+                entry += 8;
+                break;
+            case MP_ENTRY_BUS:
+            case MP_ENTRY_IO_INTERRUPT:
+            case MP_ENTRY_LOCAL_INTERRUPT:
+                entry += 8;
+                break;
+            default:
+                return info->cpu_count > 0; // Unknown entry, length unknown
+        }
+    }
+
+    info->source = "MP table";
+    return info->cpu_count > 0;
+}
+
+// Fill in the processor and I/O APIC layout. Without either table the
+// machine is treated as a single CPU at the current local APIC id.
+bool acpi_discover(platform_info_t* info) {
+    memset(&platform, 0, sizeof(platform));
+
+    bool found = acpi_parse_madt(&platform);
+    if (!found) {
+        memset(&platform, 0, sizeof(platform));
+        found = mp_parse_table(&platform);
+    }
+    if (!found) {
+        memset(&platform, 0, sizeof(platform));
+        platform.source = "none";
+        platform.lapic_address = LAPIC_DEFAULT_BASE;
+        add_cpu(&platform, (uint8_t)lapic_id());
+    }
+
+    platform_valid = true;
+    if (info) {
+        *info = platform;
+    }
+    return found;
+}
+
+const platform_info_t* acpi_platform(void) {
+    return platform_valid ? &platform : NULL;
+}
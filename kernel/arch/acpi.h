@@ -0,0 +1,112 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "../types.h"
+#include "smp.h"
+
+// Firmware platform discovery: the ACPI MADT, falling back to the Intel
+// MultiProcessor Specification table on machines without ACPI
+#define MAX_IOAPICS             4
+#define MAX_IRQ_OVERRIDES       16
+
+// BIOS areas scanned for the RSDP / MP floating pointer
+#define BIOS_EBDA_SEGMENT_PTR   0x40E
+#define BIOS_ROM_START          0xE0000
+#define BIOS_ROM_END            0x100000
+#define BASE_MEM_LAST_KB        0x9FC00
+
+// MADT entry types
+#define MADT_LOCAL_APIC         0
+#define MADT_IO_APIC            1
+#define MADT_IRQ_OVERRIDE       2
+#define MADT_LAPIC_ENABLED      0x1
+
+// MP configuration table entry types
+#define MP_ENTRY_PROCESSOR      0
+#define MP_ENTRY_BUS            1
+#define MP_ENTRY_IOAPIC         2
+#define MP_ENTRY_IO_INTERRUPT   3
+#define MP_ENTRY_LOCAL_INTERRUPT 4
+#define MP_CPU_ENABLED          0x1
+#define MP_CPU_BSP              0x2
+
+// ACPI table header
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+// Root System Description Pointer (ACPI 1.0 part)
+typedef struct {
+    char signature[8];              // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+} __attribute__((packed)) acpi_rsdp_t;
+
+// MP floating pointer structure
+typedef struct {
+    char signature[4];              // "_MP_"
+    uint32_t config_table;
+    uint8_t length;                 // In 16-byte units
+    uint8_t revision;
+    uint8_t checksum;
+    uint8_t features[5];
+} __attribute__((packed)) mp_floating_t;
+
+// MP configuration table header
+typedef struct {
+    char signature[4];              // "PCMP"
+    uint16_t base_length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t lapic_address;
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+} __attribute__((packed)) mp_config_t;
+
+// I/O APIC found by discovery
+typedef struct {
+    uint8_t id;
+    uint32_t address;
+    uint32_t gsi_base;
+} ioapic_info_t;
+
+// ISA IRQ to global system interrupt override
+typedef struct {
+    uint8_t source_irq;
+    uint32_t gsi;
+    uint16_t flags;                 // Polarity and trigger mode (MPS INTI flags)
+} irq_override_t;
+
+// What the firmware told us about the machine
+typedef struct {
+    const char* source;             // "ACPI MADT", "MP table" or "none"
+    uint32_t lapic_address;
+    uint32_t cpu_count;
+    uint8_t cpu_apic_ids[MAX_CPUS];  // Enabled processors, in firmware order
+    uint32_t ioapic_count;
+    ioapic_info_t ioapics[MAX_IOAPICS];
+    uint32_t override_count;
+    irq_override_t overrides[MAX_IRQ_OVERRIDES];
+} platform_info_t;
+
+// Platform discovery
+bool acpi_discover(platform_info_t* info);
+const platform_info_t* acpi_platform(void);
+
+#endif // ACPI_H
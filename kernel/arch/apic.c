@@ -0,0 +1,171 @@
+#include "apic.h"
+#include "cpu.h"
+#include "pit.h"
+#include "../drivers/vga.h"
+
+static volatile uint32_t* lapic_base = NULL;
+static uint32_t lapic_ticks_ms = 0;     // Timer ticks per millisecond (calibrated)
+static bool lapic_tsc_deadline = false; // CPU supports TSC-deadline timer mode
+
+uint32_t lapic_read(uint32_t reg) {
+    return lapic_base[reg >> 2];
+}
+
+void lapic_write(uint32_t reg, uint32_t value) {
+    lapic_base[reg >> 2] = value;
+    (void)lapic_base[LAPIC_REG_ID >> 2]; // Read back to post the write
+}
+
+bool lapic_available(void) {
+    return lapic_base != NULL && lapic_ticks_ms != 0;
+}
+
+uint32_t lapic_id(void) {
+    return lapic_base ? (lapic_read(LAPIC_REG_ID) >> 24) : 0;
+}
+
+void lapic_eoi(void) {
+    lapic_base[LAPIC_REG_EOI >> 2] = 0;
+}
+
+// Measure the timer rate against PIT channel 2
+static void lapic_timer_calibrate(void) {
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_ONESHOT | LAPIC_TIMER_VECTOR);
+
+    pit_calibration_start(LAPIC_CALIBRATION_MS);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0xFFFFFFFF);
+    while (!pit_calibration_expired()) {
+        cpu_relax();
+    }
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_REG_TIMER_CURRENT);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0);
+
+    lapic_ticks_ms = elapsed / LAPIC_CALIBRATION_MS;
+}
+
+// Enable the local APIC and calibrate its timer. Returns false if the CPU
+// has no APIC, in which case the PIT stays the only timer source.
+bool lapic_init(void) {
+    uint32_t ecx, edx;
+    cpuid(1, NULL, NULL, &ecx, &edx);
+    if (!(edx & CPUID_EDX_APIC) || !(edx & CPUID_EDX_MSR)) {
+        vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
+        vga_write_string("No local APIC found, using PIT\n");
+        return false;
+    }
+
+    lapic_tsc_deadline = (ecx & CPUID_ECX_TSC_DEADLINE) != 0;
+    
+    uint64_t base = rdmsr(MSR_IA32_APIC_BASE);
+    wrmsr(MSR_IA32_APIC_BASE, base | LAPIC_BASE_ENABLE);
+    lapic_base = (volatile uint32_t*)((uint32_t)base & 0xFFFFF000);
+
+    // Software enable, accept all priorities
+    lapic_write(LAPIC_REG_TPR, 0);
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+
+    lapic_timer_calibrate();
+    if (lapic_ticks_ms == 0) {
+        vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
+        vga_write_string("LAPIC timer calibration failed, using PIT\n");
+        return false;
+    }
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    vga_write_string("Local APIC timer: ");
+    print_dec(lapic_ticks_ms);
+    vga_write_string(" ticks/ms\n");
+    return true;
+}
+
+// Bring up the local APIC of an application processor. All LAPICs share
+// the bus clock, so the boot CPU's calibration applies unchanged.
+void lapic_init_ap(void) {
+    uint64_t base = rdmsr(MSR_IA32_APIC_BASE);
+    wrmsr(MSR_IA32_APIC_BASE, base | LAPIC_BASE_ENABLE);
+
+    lapic_write(LAPIC_REG_TPR, 0);
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+}
+
+static void lapic_icr_wait(void) {
+    while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING) {
+        cpu_relax();
+    }
+}
+
+static void lapic_send_icr(uint32_t apic_id, uint32_t command) {
+    uint32_t flags = irq_save();
+    lapic_icr_wait();
+    lapic_write(LAPIC_REG_ICR_HIGH, apic_id << LAPIC_ICR_DEST_SHIFT);
+    lapic_write(LAPIC_REG_ICR_LOW, command); // Writing the low half sends it
+    lapic_icr_wait();
+    irq_restore(flags);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    lapic_send_icr(apic_id, LAPIC_ICR_FIXED | LAPIC_ICR_ASSERT | vector);
+}
+
+void lapic_send_init(uint32_t apic_id) {
+    lapic_send_icr(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT | LAPIC_ICR_LEVEL);
+}
+
+// Start the AP in real mode at page * 4KB
+void lapic_send_startup(uint32_t apic_id, uint32_t page) {
+    lapic_send_icr(apic_id, LAPIC_ICR_STARTUP | (page & 0xFF));
+}
+
+// Start a one-shot countdown; the timer interrupt fires when it hits zero
+void lapic_timer_arm(uint32_t count) {
+    if (count == 0) count = 1;
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_ONESHOT | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, count);
+}
+
+void lapic_timer_stop(void) {
+    if (lapic_tsc_deadline) {
+        wrmsr(MSR_IA32_TSC_DEADLINE, 0);
+    }
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_INITIAL, 0);
+}
+
+bool lapic_timer_has_tsc_deadline(void) {
+    return lapic_tsc_deadline;
+}
+
+// Fire when the TSC reaches the given value (no counter to overflow)
+void lapic_timer_arm_deadline(uint64_t tsc_deadline) {
+    if (tsc_deadline == 0) tsc_deadline = 1; // 0 would disarm
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_TSC_DEADLINE | LAPIC_TIMER_VECTOR);
+    // The LVT mode switch must be visible before the deadline MSR write
+    __asm__ volatile ("mfence" : : : "memory");
+    wrmsr(MSR_IA32_TSC_DEADLINE, tsc_deadline);
+}
+
+uint32_t lapic_timer_remaining(void) {
+    return lapic_read(LAPIC_REG_TIMER_CURRENT);
+}
+
+uint32_t lapic_timer_ticks_per_ms(void) {
+    return lapic_ticks_ms;
+}
+
+// Conversions are split into whole and fractional milliseconds so the
+// intermediate products stay within 32 bits
+uint32_t lapic_ticks_to_us(uint32_t ticks) {
+    if (lapic_ticks_ms == 0) return 0;
+    return (ticks / lapic_ticks_ms) * 1000 + ((ticks % lapic_ticks_ms) * 1000) / lapic_ticks_ms;
+}
+
+uint32_t lapic_us_to_ticks(uint32_t us) {
+    uint32_t whole_ms = us / 1000;
+    if (lapic_ticks_ms && whole_ms > 0xFFFFFFFF / lapic_ticks_ms) {
+        return 0xFFFFFFFF;
+    }
+    return whole_ms * lapic_ticks_ms + ((us % 1000) * lapic_ticks_ms) / 1000;
+}
@@ -0,0 +1,70 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include "../types.h"
+
+// Local APIC (xAPIC MMIO interface)
+#define LAPIC_DEFAULT_BASE      0xFEE00000
+
+// Register offsets
+#define LAPIC_REG_ID            0x020
+#define LAPIC_REG_VERSION       0x030
+#define LAPIC_REG_TPR           0x080
+#define LAPIC_REG_EOI           0x0B0
+#define LAPIC_REG_SVR           0x0F0
+#define LAPIC_REG_ICR_LOW       0x300
+#define LAPIC_REG_ICR_HIGH      0x310
+#define LAPIC_REG_LVT_TIMER     0x320
+#define LAPIC_REG_TIMER_INITIAL 0x380
+#define LAPIC_REG_TIMER_CURRENT 0x390
+#define LAPIC_REG_TIMER_DIVIDE  0x3E0
+
+// Register bits
+#define LAPIC_BASE_ENABLE       (1 << 11)   // IA32_APIC_BASE global enable
+#define LAPIC_SVR_ENABLE        0x100
+#define LAPIC_LVT_MASKED        0x10000
+#define LAPIC_TIMER_ONESHOT     0x00000
+#define LAPIC_TIMER_PERIODIC    0x20000
+#define LAPIC_TIMER_TSC_DEADLINE 0x40000
+#define LAPIC_TIMER_DIVIDE_16   0x3
+
+// Interrupt command register
+#define LAPIC_ICR_FIXED         0x00000
+#define LAPIC_ICR_INIT          0x00500
+#define LAPIC_ICR_STARTUP       0x00600
+#define LAPIC_ICR_PENDING       0x01000     // Delivery status
+#define LAPIC_ICR_ASSERT        0x04000
+#define LAPIC_ICR_LEVEL         0x08000
+#define LAPIC_ICR_DEST_SHIFT    24
+
+// Interrupt vectors
+#define LAPIC_TIMER_VECTOR      0x30
+#define LAPIC_SPURIOUS_VECTOR   0xFF
+
+#define LAPIC_CALIBRATION_MS    10
+
+// Local APIC functions
+bool lapic_init(void);
+void lapic_init_ap(void);           // Enable an AP's LAPIC, reusing the BSP calibration
+bool lapic_available(void);
+uint32_t lapic_read(uint32_t reg);
+void lapic_write(uint32_t reg, uint32_t value);
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+
+// Inter-processor interrupts
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+void lapic_send_init(uint32_t apic_id);
+void lapic_send_startup(uint32_t apic_id, uint32_t page);
+
+// Local APIC timer (one-shot mode, counts down at bus clock / 16)
+void lapic_timer_arm(uint32_t count);
+void lapic_timer_stop(void);
+bool lapic_timer_has_tsc_deadline(void);
+void lapic_timer_arm_deadline(uint64_t tsc_deadline);
+uint32_t lapic_timer_remaining(void);
+uint32_t lapic_timer_ticks_per_ms(void);
+uint32_t lapic_ticks_to_us(uint32_t ticks);
+uint32_t lapic_us_to_ticks(uint32_t us);
+
+#endif // APIC_H
@@ -1,34 +1,128 @@
 ; Simple bootloader for TradeKernel OS
 ; This bootloader will be loaded by QEMU and transition to 32-bit protected mode
+;
+; The kernel image is the flat binary of kernel.bin from the sector after
+; this one. The Makefile assembles this file after the kernel link with
+; its size, entry point and end: it reads with INT 13h extensions, up to
+; LOAD_CHUNK sectors a call into a low buffer, copied up to KERNEL_LOAD
+; from unreal mode (4 GB data segments left over from protected mode).
+; The loader header is built at LOADER_HEADER, outside this sector, and
+; goes to the kernel in EBX, with EAX holding LOADER_MAGIC (as a multiboot
+; loader does). Everything here must fit in 510 bytes: the Makefile checks
+; the sector with check-boot.
 
 [BITS 16]
 [ORG 0x7C00]
 
+%ifndef KERNEL_SECTORS
+%define KERNEL_SECTORS 0
+%endif
+%ifndef KERNEL_ENTRY
+%define KERNEL_ENTRY 0x100000
+%endif
+%ifndef KERNEL_END
+%define KERNEL_END 0x100000
+%endif
+
+LOADER_MAGIC    equ 0x444C4B54      ; "TKLD", BOOT_LOADER_MAGIC in bootgraph.h
+LOADER_HEADER   equ 0x0500          ; boot_loader_header_t, BOOT_LOADER_HEADER
+HEADER_SECTORS  equ LOADER_HEADER
+HEADER_READS    equ LOADER_HEADER + 4
+HEADER_START    equ LOADER_HEADER + 8   ; TSC before the first read
+HEADER_END      equ LOADER_HEADER + 16  ; TSC with the image in place
+HEADER_SIZE     equ 24
+KERNEL_LOAD     equ 0x100000        ; kernel.ld
+LOAD_BUFFER_SEG equ 0x1000          ; 0x10000, below the 0x90000 stack
+LOAD_CHUNK      equ 127             ; Sectors per read; some BIOSes take no more
+
 start:
     ; Initialize segments
+    cli
     xor ax, ax
     mov ds, ax
     mov es, ax
     mov ss, ax
     mov sp, 0x7C00
+    sti
+    cld
+    mov [boot_drive], dl    ; From the BIOS
+
+    ; The header, zeroed, and rdtsc before the first read: the load time
+    ; is the loader's
+    mov di, LOADER_HEADER
+    mov cx, HEADER_SIZE / 2
+    rep stosw
+    mov dword [HEADER_SECTORS], KERNEL_SECTORS
+    rdtsc
+    mov [HEADER_START], eax
+    mov [HEADER_START + 4], edx
 
     ; Print boot message
     mov si, boot_msg
     call print_string
 
+    ; INT 13h extensions, with the packet interface (CX bit 0)
+    mov ah, 0x41
+    mov bx, 0x55AA
+    mov dl, [boot_drive]
+    int 0x13
+    jc disk_error
+    cmp bx, 0xAA55
+    jne disk_error
+    test cx, 1
+    jz disk_error
+
+    ; A20 through the system control port
+    in al, 0x92
+    or al, 2
+    and al, 0xFE
+    out 0x92, al
+
+    ; Progress in memory: BIOSes need not keep the high register halves
+load_next:
+    mov eax, [remaining]
+    test eax, eax
+    jz load_done
+    cmp eax, LOAD_CHUNK
+    jbe .count
+    mov eax, LOAD_CHUNK
+.count:
+    mov [dap.count], ax
+
     ; Load kernel from disk
-    mov ah, 0x02        ; Read sectors function
-    mov al, 30          ; Number of sectors to read (kernel size)
-    mov ch, 0           ; Cylinder
-    mov cl, 2           ; Sector (start from sector 2, sector 1 is bootloader)
-    mov dh, 0           ; Head
-    mov dl, 0x80        ; Drive number (first hard disk)
-    mov bx, 0x1000      ; Load kernel at 0x1000:0x0000
-    mov es, bx
-    mov bx, 0
+    mov si, dap
+    mov ah, 0x42        ; Extended read
+    mov dl, [boot_drive]
     int 0x13            ; BIOS disk interrupt
-
     jc disk_error       ; If carry flag is set, disk read failed
+    inc dword [HEADER_READS]
+
+    ; The BIOS may have reloaded the segments: unreal mode again for the copy
+    call enter_unreal
+    movzx ecx, word [dap.count]
+    add [dap.lba], ecx
+    sub [remaining], ecx
+    shl ecx, 7          ; Sectors to dwords
+    mov esi, LOAD_BUFFER_SEG << 4
+    mov edi, [load_dest]
+    a32 rep movsd
+    mov [load_dest], edi
+    jmp load_next
+
+load_done:
+    call enter_unreal
+    mov edi, [load_dest]
+    ; .bss, past the last sector read
+    mov ecx, KERNEL_END
+    sub ecx, edi
+    jbe .zeroed
+    shr ecx, 2
+    xor eax, eax
+    a32 rep stosd
+.zeroed:
+    rdtsc
+    mov [HEADER_END], eax
+    mov [HEADER_END + 4], edx
 
     ; Print success message
     mov si, kernel_loaded_msg
@@ -37,7 +131,7 @@ start:
     ; Enter protected mode
     cli                 ; Disable interrupts
     lgdt [gdt_descriptor]
-    
+
     mov eax, cr0
     or eax, 1           ; Set protected mode bit
     mov cr0, eax
@@ -45,10 +139,34 @@ start:
     ; Far jump to flush instruction pipeline and enter 32-bit mode
     jmp 0x08:protected_mode
 
+; DS and ES with 4 GB limits, back in real mode with base 0
+enter_unreal:
+    cli
+    push ds
+    push es
+    lgdt [gdt_descriptor]
+    mov eax, cr0
+    or al, 1
+    mov cr0, eax
+    jmp $ + 2
+    mov bx, 0x10
+    mov ds, bx
+    mov es, bx
+    and al, 0xFE
+    mov cr0, eax
+    pop es
+    pop ds
+    sti
+    ret
+
+; No INT 13h extensions, or a read failed
 disk_error:
     mov si, disk_error_msg
     call print_string
+halt:
+    cli
     hlt
+    jmp halt
 
 ; 16-bit print string function
 print_string:
@@ -72,11 +190,10 @@ protected_mode:
     mov ss, ax
     mov esp, 0x90000    ; Set stack pointer
 
-    ; Call kernel main function
-    call 0x10000        ; Jump to kernel entry point
-
-    ; If kernel returns, halt
-    hlt
+    ; Jump to the kernel entry point (_start), which keeps EAX and EBX
+    mov eax, LOADER_MAGIC
+    mov ebx, LOADER_HEADER
+    jmp KERNEL_ENTRY
 
 ; Global Descriptor Table
 gdt_start:
@@ -105,11 +222,25 @@ gdt_descriptor:
     dw gdt_end - gdt_start - 1  ; GDT size
     dd gdt_start                ; GDT address
 
+; INT 13h AH=42h disk address packet
+align 4
+dap:
+    db 0x10, 0          ; Packet size, reserved
+.count:
+    dw 0                ; Sectors this read
+    dw 0, LOAD_BUFFER_SEG   ; Buffer offset, segment
+.lba:
+    dq 1                ; The kernel starts after this sector
+
+load_dest dd KERNEL_LOAD
+remaining dd KERNEL_SECTORS
+boot_drive db 0
+
 ; Boot messages
 boot_msg db 'TradeKernel OS Booting...', 0x0D, 0x0A, 0
 kernel_loaded_msg db 'Kernel loaded successfully!', 0x0D, 0x0A, 0
-disk_error_msg db 'Disk read error!', 0x0D, 0x0A, 0
+disk_error_msg db 'Disk error!', 0x0D, 0x0A, 0
 
 ; Fill remaining space and add boot signature
 times 510-($-$$) db 0
-dw 0xAA55               ; Boot signature
\ No newline at end of file
+dw 0xAA55               ; Boot signature
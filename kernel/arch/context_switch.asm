@@ -5,115 +5,78 @@ global context_switch
 global save_context_asm
 global restore_context_asm
 
-; void context_switch(process_t* old_process, process_t* new_process)
-; This function performs a complete context switch between processes
+; Offsets into process_t (checked by static asserts in process.c)
+PROCESS_CONTEXT_ESP     equ 76      ; context.esp
+PROCESS_CONTEXT_EIP     equ 84      ; context.eip
+PROCESS_CONTEXT_CR3     equ 104     ; context.cr3
+
+extern scheduler_finish_switch
+extern process_thread_exit
+
+global process_entry_trampoline
+
+; process_t* context_switch(process_t* old_process, process_t* new_process)
+; Callee-saved registers and EFLAGS go on the old process's own stack, so
+; only its stack pointer and resume address have to live in the context.
+; Returns, on the new stack, the process that was switched away from so
+; the caller can finish the switch (scheduler_finish_switch).
 context_switch:
+    mov eax, [esp + 4]      ; old_process
+    mov edx, [esp + 8]      ; new_process
+    
     push ebp
-    mov ebp, esp
     push ebx
     push esi
     push edi
-    
-    ; Get parameters
-    mov eax, [ebp + 8]      ; old_process
-    mov ebx, [ebp + 12]     ; new_process
+    pushfd
     
     ; Save old process context if not null
     test eax, eax
-    jz .restore_new
-    
-    ; Save registers to old process context structure
-    ; Offset 20 is start of cpu_context_t in process_t
-    mov [eax + 20], eax     ; Save EAX (will be overwritten)
-    mov [eax + 24], ebx     ; Save EBX
-    mov [eax + 28], ecx     ; Save ECX
-    mov [eax + 32], edx     ; Save EDX
-    mov [eax + 36], esi     ; Save ESI
-    mov [eax + 40], edi     ; Save EDI
-    
-    ; Save stack pointers
-    mov [eax + 44], esp     ; Save ESP
-    mov [eax + 48], ebp     ; Save EBP
+    jz .load_new
+    mov [eax + PROCESS_CONTEXT_ESP], esp
+    mov dword [eax + PROCESS_CONTEXT_EIP], .resume
     
-    ; Save instruction pointer (return address)
-    mov ecx, [ebp + 4]      ; Get return address from stack
-    mov [eax + 52], ecx     ; Save EIP
-    
-    ; Save flags
-    pushf
-    pop ecx
-    mov [eax + 56], ecx     ; Save EFLAGS
-    
-    ; Save segment registers
-    mov cx, cs
-    mov [eax + 60], cx      ; Save CS
-    mov cx, ds
-    mov [eax + 62], cx      ; Save DS
-    mov cx, es
-    mov [eax + 64], cx      ; Save ES
-    mov cx, fs
-    mov [eax + 66], cx      ; Save FS
-    mov cx, gs
-    mov [eax + 68], cx      ; Save GS
-    mov cx, ss
-    mov [eax + 70], cx      ; Save SS
-    
-    ; Save CR3 (page directory)
-    mov ecx, cr3
-    mov [eax + 72], ecx     ; Save CR3
-
-.restore_new:
-    ; Restore new process context
-    test ebx, ebx
-    jz .done
-    
-    ; Restore CR3 (page directory) first
-    mov ecx, [ebx + 72]
+.load_new:
+    ; Switch address space only when it actually changes
+    mov ecx, [edx + PROCESS_CONTEXT_CR3]
     test ecx, ecx
     jz .skip_cr3
+    mov ebx, cr3
+    cmp ebx, ecx
+    je .skip_cr3
     mov cr3, ecx
-
-.skip_cr3:
-    ; Restore segment registers
-    mov cx, [ebx + 62]      ; Restore DS
-    mov ds, cx
-    mov cx, [ebx + 64]      ; Restore ES
-    mov es, cx
-    mov cx, [ebx + 66]      ; Restore FS
-    mov fs, cx
-    mov cx, [ebx + 68]      ; Restore GS
-    mov gs, cx
-    mov cx, [ebx + 70]      ; Restore SS
-    mov ss, cx
-    
-    ; Restore general purpose registers
-    mov eax, [ebx + 20]     ; Restore EAX
-    mov ecx, [ebx + 28]     ; Restore ECX
-    mov edx, [ebx + 32]     ; Restore EDX
-    mov esi, [ebx + 36]     ; Restore ESI
-    mov edi, [ebx + 40]     ; Restore EDI
     
-    ; Restore stack pointers
-    mov esp, [ebx + 44]     ; Restore ESP
-    mov ebp, [ebx + 48]     ; Restore EBP
-    
-    ; Restore flags
-    mov ecx, [ebx + 56]     ; Get EFLAGS
-    push ecx
-    popf
+.skip_cr3:
+    ; EAX still holds old_process: it becomes the return value on the
+    ; new stack, or the argument for a freshly created process
+    mov esp, [edx + PROCESS_CONTEXT_ESP]
+    jmp [edx + PROCESS_CONTEXT_EIP]
     
-    ; Restore EBX last and jump to new EIP
-    push dword [ebx + 52]   ; Push new EIP onto stack
-    mov ebx, [ebx + 24]     ; Restore EBX
-    ret                     ; Jump to new EIP
-
-.done:
+.resume:
+    popfd
     pop edi
     pop esi
     pop ebx
     pop ebp
     ret
 
+; First instruction of every new process. process_create leaves the entry
+; point on top of the new stack; EAX is the process we switched away from.
+process_entry_trampoline:
+    push eax
+    call scheduler_finish_switch
+    add esp, 4
+    sti                     ; Switches happen with interrupts off
+    
+    pop eax                 ; Entry point
+    call eax
+    
+    push eax                ; Returning from the entry point exits
+    call process_thread_exit
+.hang:
+    hlt
+    jmp .hang
+
 ; void save_context_asm(cpu_context_t* context)
 ; Save current CPU context to the provided structure
 save_context_asm:
@@ -166,10 +129,13 @@ save_context_asm:
 restore_context_asm:
     mov eax, [esp + 4]      ; Get context pointer (no frame setup needed)
     
-    ; Restore CR3 first
+    ; Restore CR3 first; reloading the live one would only flush the TLB
     mov ebx, [eax + 52]
     test ebx, ebx
     jz .skip_cr3_restore
+    mov ecx, cr3
+    cmp ecx, ebx
+    je .skip_cr3_restore
     mov cr3, ebx
 
 .skip_cr3_restore:
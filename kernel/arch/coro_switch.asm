@@ -0,0 +1,25 @@
+; Coroutine switch: callee-saved registers only
+section .text
+
+global coro_switch
+
+; void coro_switch(uint32_t* save_esp, uint32_t load_esp)
+; Coroutines only switch at calls, so EAX/ECX/EDX are already dead and
+; EFLAGS and the FPU state belong to the one process running them all.
+; A new stack is laid out as four zero registers, then the entry address.
+coro_switch:
+    mov eax, [esp + 4]      ; save_esp
+    mov edx, [esp + 8]      ; load_esp
+    
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax], esp
+    
+    mov esp, edx
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
@@ -0,0 +1,137 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include "../types.h"
+
+// CPUID feature bits (leaf 1)
+#define CPUID_EDX_FPU           (1 << 0)
+#define CPUID_EDX_PSE           (1 << 3)
+#define CPUID_EDX_TSC           (1 << 4)
+#define CPUID_EDX_MSR           (1 << 5)
+#define CPUID_EDX_APIC          (1 << 9)
+#define CPUID_EDX_SEP           (1 << 11)
+#define CPUID_EDX_PGE           (1 << 13)
+#define CPUID_EDX_FXSR          (1 << 24)
+#define CPUID_EDX_SSE           (1 << 25)
+#define CPUID_EDX_SSE2          (1 << 26)
+#define CPUID_ECX_TSC_DEADLINE  (1 << 24)
+
+// CPUID extended feature bits (leaf 0x80000007)
+#define CPUID_EXT_EDX_INVARIANT_TSC (1 << 8)
+
+// CPUID extended feature bits (leaf 0x80000001)
+#define CPUID_EXT_EDX_RDTSCP    (1 << 27)
+
+// Model specific registers
+#define MSR_IA32_APIC_BASE      0x1B
+#define MSR_IA32_TSC_DEADLINE   0x6E0
+#define MSR_IA32_SYSENTER_CS    0x174
+#define MSR_IA32_SYSENTER_ESP   0x175
+#define MSR_IA32_SYSENTER_EIP   0x176
+#define MSR_IA32_TSC_AUX        0xC0000103
+
+#define EFLAGS_IF               0x200
+
+// Control register bits
+#define CR0_MP                  (1 << 1)    // WAIT/FWAIT honour TS
+#define CR0_EM                  (1 << 2)    // No FPU: trap every FP instruction
+#define CR0_TS                  (1 << 3)    // Task switched: next FP use traps (#NM)
+#define CR0_NE                  (1 << 5)    // Native FP error reporting
+#define CR0_WP                  (1 << 16)   // Read-only pages fault in ring 0 too
+#define CR0_PG                  (1u << 31)  // Paging enabled
+#define CR4_PSE                 (1 << 4)    // 4MB pages in page directory entries
+#define CR4_PGE                 (1 << 7)    // Global pages survive CR3 reloads
+#define CR4_PCE                 (1 << 8)    // rdpmc allowed in ring 3
+#define CR4_OSFXSR              (1 << 9)    // FXSAVE/FXRSTOR and SSE enabled
+#define CR4_OSXMMEXCPT          (1 << 10)   // Unmasked SSE exceptions raise #XM
+
+static inline uint32_t read_cr0(void) {
+    uintptr_t value;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(value));
+    return (uint32_t)value;
+}
+
+static inline void write_cr0(uint32_t value) {
+    __asm__ volatile ("mov %0, %%cr0" : : "r"((uintptr_t)value) : "memory");
+}
+
+static inline uint32_t read_cr3(void) {
+    uintptr_t value;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(value));
+    return (uint32_t)value;
+}
+
+static inline uint32_t read_cr4(void) {
+    uintptr_t value;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(value));
+    return (uint32_t)value;
+}
+
+static inline void write_cr4(uint32_t value) {
+    __asm__ volatile ("mov %0, %%cr4" : : "r"((uintptr_t)value) : "memory");
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    uint32_t a, b, c, d;
+    __asm__ volatile ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(leaf), "c"(0));
+    if (eax) *eax = a;
+    if (ebx) *ebx = b;
+    if (ecx) *ecx = c;
+    if (edx) *edx = d;
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t low, high;
+    __asm__ volatile ("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+// Disable interrupts, returning the previous EFLAGS for irq_restore().
+// KERNEL_HOST (make bench-host) runs in ring 3, where cli faults: each
+// thread there is a CPU of its own, and the flags come back with IF clear.
+static inline uint32_t irq_save(void) {
+    uintptr_t flags;
+#ifdef KERNEL_HOST
+    __asm__ volatile ("pushf; pop %0" : "=r"(flags) : : "memory");
+    flags &= ~(uintptr_t)EFLAGS_IF;
+#else
+    __asm__ volatile ("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+#endif
+    return (uint32_t)flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    if (flags & EFLAGS_IF) {
+        __asm__ volatile ("sti" : : : "memory");
+    }
+}
+
+static inline void cpu_relax(void) {
+    __asm__ volatile ("pause" : : : "memory");
+}
+
+// Compiler-only fence. x86 keeps stores ordered with stores and loads
+// with loads, which is all a single-producer single-consumer queue needs.
+static inline void compiler_barrier(void) {
+    __asm__ volatile ("" : : : "memory");
+}
+
+// Acquire load and release store of an aligned word: later accesses stay
+// after the load, earlier ones before the store. Plain x86 moves already
+// order this way, so only the compiler has to be held back.
+static inline uint32_t load_acquire(const volatile uint32_t* ptr) {
+    uint32_t value = *ptr;
+    compiler_barrier();
+    return value;
+}
+
+static inline void store_release(volatile uint32_t* ptr, uint32_t value) {
+    compiler_barrier();
+    *ptr = value;
+}
+
+#endif // CPU_H
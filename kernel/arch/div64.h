@@ -0,0 +1,35 @@
+#ifndef DIV64_H
+#define DIV64_H
+
+#include "../types.h"
+
+// 64-bit arithmetic helpers for a freestanding i386 build. We do not link
+// libgcc, so plain 64-bit '/' and '%' would leave __udivdi3/__umoddi3
+// unresolved; multiplication and shifts are open-coded by the compiler.
+
+// Divide a 64-bit value by a 32-bit divisor using two 'divl' steps
+static inline uint64_t div_u64_u32(uint64_t dividend, uint32_t divisor, uint32_t* remainder) {
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t low = (uint32_t)dividend;
+    uint32_t q_high = high / divisor;
+    uint32_t q_low, rem;
+
+    high %= divisor;
+    __asm__ ("divl %4" : "=a"(q_low), "=d"(rem) : "a"(low), "d"(high), "rm"(divisor));
+
+    if (remainder) *remainder = rem;
+    return ((uint64_t)q_high << 32) | q_low;
+}
+
+// (value * mult) >> shift without losing the bits above 64 (shift <= 32)
+static inline uint64_t mul_u64_u32_shr(uint64_t value, uint32_t mult, uint32_t shift) {
+    uint64_t low = (uint64_t)(uint32_t)value * mult;
+    uint64_t high = (uint64_t)(uint32_t)(value >> 32) * mult;
+
+    if (shift == 0) {
+        return low + (high << 32);
+    }
+    return (low >> shift) + (high << (32 - shift));
+}
+
+#endif // DIV64_H
@@ -0,0 +1,221 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "smp.h"
+#include "../proc/process.h"
+#include "../mm/memory.h"
+#include "../drivers/vga.h"
+
+static bool fpu_enabled = false;
+static bool fpu_fxsr = false;       // FXSAVE/FXRSTOR, else FNSAVE/FRSTOR
+static bool fpu_sse = false;
+static bool fpu_sse2 = false;
+static uint32_t fpu_traps = 0;
+
+bool fpu_available(void) {
+    return fpu_enabled;
+}
+
+uint32_t fpu_trap_count(void) {
+    return fpu_traps;
+}
+
+static inline void clts(void) {
+    __asm__ volatile ("clts" : : : "memory");
+}
+
+static inline void stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+// The save area is over-allocated; FXSAVE needs 16 byte alignment
+static inline uint8_t* fpu_area(process_t* process) {
+    return (uint8_t*)(((uint32_t)process->fpu_state + FPU_STATE_ALIGN - 1) &
+                      ~(uint32_t)(FPU_STATE_ALIGN - 1));
+}
+
+static void fpu_save(process_t* process) {
+    if (fpu_fxsr) {
+        __asm__ volatile ("fxsave %0" : "=m"(*(uint8_t (*)[FPU_STATE_SIZE])fpu_area(process)));
+    } else {
+        __asm__ volatile ("fnsave %0; fwait" : "=m"(*(uint8_t (*)[FPU_STATE_SIZE])fpu_area(process)));
+    }
+}
+
+static void fpu_restore(process_t* process) {
+    if (fpu_fxsr) {
+        __asm__ volatile ("fxrstor %0" : : "m"(*(uint8_t (*)[FPU_STATE_SIZE])fpu_area(process)));
+    } else {
+        __asm__ volatile ("frstor %0" : : "m"(*(uint8_t (*)[FPU_STATE_SIZE])fpu_area(process)));
+    }
+}
+
+// Write this CPU's live FP registers back to their owner (interrupts off)
+static void fpu_save_owner(cpu_t* cpu) {
+    process_t* owner = cpu->fpu_owner;
+    if (!owner) return;
+
+    clts();
+    fpu_save(owner);
+    __sync_synchronize();
+    cpu->fpu_owner = NULL;
+    owner->fpu_cpu = -1;
+}
+
+void fpu_init_cpu(void) {
+    if (!fpu_enabled) return;
+
+    uint32_t cr0 = read_cr0();
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+
+    if (fpu_fxsr) {
+        uint32_t cr4 = read_cr4() | CR4_OSFXSR;
+        if (fpu_sse) cr4 |= CR4_OSXMMEXCPT;
+        write_cr4(cr4);
+    }
+
+    __asm__ volatile ("fninit");
+    this_cpu()->fpu_owner = NULL;
+
+    // Nobody owns the registers yet: the first FP instruction traps
+    stts();
+}
+
+bool fpu_init(void) {
+    uint32_t edx;
+    cpuid(1, NULL, NULL, NULL, &edx);
+    if (!(edx & CPUID_EDX_FPU)) {
+        vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
+        vga_write_string("No FPU, floating point is unavailable\n");
+        return false;
+    }
+
+    fpu_fxsr = (edx & CPUID_EDX_FXSR) != 0;
+    fpu_sse = fpu_fxsr && (edx & CPUID_EDX_SSE) != 0;
+    fpu_sse2 = fpu_sse && (edx & CPUID_EDX_SSE2) != 0;
+    fpu_enabled = true;
+    fpu_init_cpu();
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    vga_write_string("Lazy FPU switching: ");
+    vga_write_string(fpu_sse ? "x87 + SSE (FXSAVE)\n" : fpu_fxsr ? "x87 (FXSAVE)\n" : "x87 (FNSAVE)\n");
+    return true;
+}
+
+// Called with interrupts off right before switching stacks. State only
+// stays in the registers if 'prev' can only ever run here again; anything
+// that may be stolen or migrated is written back now.
+void fpu_switch(process_t* prev, process_t* next) {
+    if (!fpu_enabled) return;
+    cpu_t* cpu = this_cpu();
+
+    if (cpu->fpu_owner == prev && prev->pinned_cpu != (int32_t)cpu->id) {
+        fpu_save_owner(cpu);
+    }
+
+    if (cpu->fpu_owner == next) {
+        clts();
+    } else {
+        stts();
+    }
+}
+
+// Another CPU wants the state of a process whose registers live here
+// (it was repinned while switched out)
+void fpu_flush_requests(void) {
+    cpu_t* cpu = this_cpu();
+    if (!cpu->fpu_flush) return;
+    cpu->fpu_flush = false;
+
+    fpu_save_owner(cpu);
+    if (cpu->fpu_owner != cpu->current) {
+        stts();
+    }
+}
+
+// First FP instruction since this CPU last switched processes
+void fpu_handle_nm(void) {
+    cpu_t* cpu = this_cpu();
+    process_t* current = cpu->current;
+    fpu_traps++;
+
+    clts();
+    if (!current || cpu->fpu_owner == current) {
+        return;
+    }
+    fpu_save_owner(cpu);
+
+    // Its state is still in another CPU's registers: have it written back
+    int32_t holder = current->fpu_cpu;
+    if (holder >= 0 && holder != (int32_t)cpu->id) {
+        cpus[holder].fpu_flush = true;
+        smp_send_resched(holder);
+        while (current->fpu_cpu >= 0) {
+            fpu_flush_requests();   // Never wait on a CPU that waits on us
+            cpu_relax();
+        }
+        clts();
+    }
+
+    if (!current->fpu_state) {
+        current->fpu_state = kmalloc(FPU_STATE_SIZE + FPU_STATE_ALIGN - 1);
+        if (!current->fpu_state) {
+            vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+            vga_write_string("FPU: no memory for state, terminating ");
+            vga_write_string(current->name);
+            vga_write_string("\n");
+            stts();
+            process_exit(current, -1);
+            return;
+        }
+        // First use: clean x87 state and default MXCSR
+        __asm__ volatile ("fninit");
+        if (fpu_sse) {
+            uint32_t mxcsr = FPU_MXCSR_DEFAULT;
+            __asm__ volatile ("ldmxcsr %0" : : "m"(mxcsr));
+        }
+    } else {
+        fpu_restore(current);
+    }
+
+    current->fpu_cpu = (int32_t)cpu->id;
+    cpu->fpu_owner = current;
+}
+
+bool fpu_kernel_begin(uint32_t* flags) {
+    if (!fpu_sse2) return false;
+
+    *flags = irq_save();
+    fpu_save_owner(this_cpu());
+    clts();
+    return true;
+}
+
+bool fpu_kernel_begin_x87(uint32_t* flags) {
+    if (!fpu_enabled) return false;
+
+    *flags = irq_save();
+    fpu_save_owner(this_cpu());
+    clts();
+    __asm__ volatile ("fninit");
+    return true;
+}
+
+void fpu_kernel_end(uint32_t flags) {
+    stts();
+    irq_restore(flags);
+}
+
+// Drop a dying process's FP state without saving it
+void fpu_release(process_t* process) {
+    int32_t holder = process->fpu_cpu;
+    if (holder >= 0) {
+        __sync_bool_compare_and_swap(&cpus[holder].fpu_owner, process, NULL);
+        process->fpu_cpu = -1;
+    }
+    if (process->fpu_state) {
+        kfree(process->fpu_state);
+        process->fpu_state = NULL;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "../types.h"
+
+// x87/SSE state is switched lazily: CR0.TS is set whenever a CPU runs a
+// process that does not own its FPU registers, and the first FP instruction
+// traps (#NM) to save the previous owner and load the new one. Processes
+// that never use the FPU never allocate or switch any FP state.
+#define FPU_STATE_SIZE          512     // FXSAVE area (FNSAVE needs 108)
+#define FPU_STATE_ALIGN         16
+#define FPU_NM_VECTOR           7       // Device not available
+#define FPU_MXCSR_DEFAULT       0x1F80  // All SSE exceptions masked
+
+struct process;
+
+bool fpu_init(void);                // Detect and enable on the boot CPU
+void fpu_init_cpu(void);            // Per CPU enable (also run on each AP)
+bool fpu_available(void);
+void fpu_handle_nm(void);           // #NM handler
+void fpu_switch(struct process* prev, struct process* next); // Before context_switch
+void fpu_flush_requests(void);      // Reschedule IPI: hand state to another CPU
+void fpu_release(struct process* process);  // Process destroyed
+uint32_t fpu_trap_count(void);
+
+// Kernel use of the XMM registers (large memcpy/memset). begin writes back
+// whoever owns this CPU's FP registers, so their state survives, and keeps
+// interrupts off until end, so sections never nest; false without SSE2, and
+// then nothing changes. end sets CR0.TS again: the owner reloads on its
+// next FP instruction.
+bool fpu_kernel_begin(uint32_t* flags);
+void fpu_kernel_end(uint32_t flags);
+
+// The same for x87 code, such as double arithmetic in interrupt context:
+// needs only an FPU, and starts from fninit. End with fpu_kernel_end.
+bool fpu_kernel_begin_x87(uint32_t* flags);
+
+#endif // FPU_H
@@ -0,0 +1,74 @@
+#include "gdt.h"
+
+static gdt_entry_t gdt[GDT_ENTRIES];
+static gdt_descriptor_t gdt_desc;
+static tss_t tss[MAX_CPUS];
+
+static void gdt_set_entry(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    gdt[num].limit_low = limit & 0xFFFF;
+    gdt[num].base_low = base & 0xFFFF;
+    gdt[num].base_middle = (base >> 16) & 0xFF;
+    gdt[num].access = access;
+    gdt[num].granularity = (flags & 0xF0) | ((limit >> 16) & 0x0F);
+    gdt[num].base_high = (base >> 24) & 0xFF;
+}
+
+void gdt_init(void) {
+    gdt_desc.limit = sizeof(gdt) - 1;
+    gdt_desc.base = (uint32_t)&gdt;
+
+    // Flat 4GB segments, same layout the boot loader used
+    gdt_set_entry(0, 0, 0, 0, 0);
+    gdt_set_entry(1, 0, 0xFFFFF, 0x9A, 0xC0);  // Kernel code
+    gdt_set_entry(2, 0, 0xFFFFF, 0x92, 0xC0);  // Kernel data
+    gdt_set_entry(3, 0, 0xFFFFF, 0xFA, 0xC0);  // User code
+    gdt_set_entry(4, 0, 0xFFFFF, 0xF2, 0xC0);  // User data
+    for (int i = 0; i < MAX_CPUS; i++) {
+        gdt_set_entry(GDT_PERCPU_FIRST + i, 0, 0, 0, 0);
+        gdt_set_entry(GDT_TSS_FIRST + i, 0, 0, 0, 0);
+    }
+
+    gdt_load();
+}
+
+void gdt_load(void) {
+    __asm__ volatile (
+        "lgdt %0\n\t"
+        "ljmp $0x08, $1f\n"
+        "1:\n\t"
+        "movw $0x10, %%ax\n\t"
+        "movw %%ax, %%ds\n\t"
+        "movw %%ax, %%es\n\t"
+        "movw %%ax, %%fs\n\t"
+        "movw %%ax, %%ss\n\t"
+        : : "m"(gdt_desc) : "eax", "memory");
+}
+
+// Byte-granular data segment covering exactly the per-CPU area
+void gdt_set_percpu(uint32_t cpu, uint32_t base, uint32_t size) {
+    if (cpu >= MAX_CPUS || size == 0) return;
+    gdt_set_entry(GDT_PERCPU_FIRST + cpu, base, size - 1, 0x92, 0x40);
+}
+
+void gdt_load_percpu(uint32_t cpu) {
+    uint16_t selector = GDT_PERCPU_SELECTOR(cpu);
+    __asm__ volatile ("movw %0, %%gs" : : "r"(selector) : "memory");
+}
+
+// Available 32-bit TSS; ltr marks it busy, so each CPU loads its own once
+void gdt_load_tss(uint32_t cpu, uint32_t esp0) {
+    if (cpu >= MAX_CPUS) return;
+
+    tss_t* task = &tss[cpu];
+    uint8_t* bytes = (uint8_t*)task;
+    for (uint32_t i = 0; i < sizeof(tss_t); i++) {
+        bytes[i] = 0;
+    }
+    task->ss0 = GDT_KERNEL_DATA;
+    task->esp0 = esp0;
+    task->iomap_base = sizeof(tss_t);   // Past the limit: no I/O bitmap
+
+    gdt_set_entry(GDT_TSS_FIRST + cpu, (uint32_t)task, sizeof(tss_t) - 1, 0x89, 0x00);
+    uint16_t selector = GDT_TSS_SELECTOR(cpu);
+    __asm__ volatile ("ltr %0" : : "r"(selector) : "memory");
+}
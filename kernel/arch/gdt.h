@@ -0,0 +1,65 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include "../types.h"
+#include "smp.h"
+
+// Segment selectors
+#define GDT_KERNEL_CODE         0x08
+#define GDT_KERNEL_DATA         0x10
+#define GDT_USER_CODE           0x1B        // Index 3, RPL 3
+#define GDT_USER_DATA           0x23        // Index 4, RPL 3
+
+// One data segment per CPU whose base is that CPU's cpu_t, loaded into GS
+#define GDT_PERCPU_FIRST        5
+#define GDT_PERCPU_SELECTOR(cpu) ((GDT_PERCPU_FIRST + (cpu)) << 3)
+
+// One TSS per CPU: it only supplies the ring 0 stack for entries from ring 3
+#define GDT_TSS_FIRST           (GDT_PERCPU_FIRST + MAX_CPUS)
+#define GDT_TSS_SELECTOR(cpu)   ((GDT_TSS_FIRST + (cpu)) << 3)
+#define GDT_ENTRIES             (GDT_TSS_FIRST + MAX_CPUS)
+
+// GDT entry
+typedef struct {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_middle;
+    uint8_t access;
+    uint8_t granularity;            // Flags in the high nibble, limit 16..19 in the low
+    uint8_t base_high;
+} __attribute__((packed)) gdt_entry_t;
+
+// GDT descriptor
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) gdt_descriptor_t;
+
+// 32-bit task state segment (no hardware task switching, no I/O bitmap)
+typedef struct {
+    uint32_t prev_task;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t esp1;
+    uint32_t ss1;
+    uint32_t esp2;
+    uint32_t ss2;
+    uint32_t cr3;
+    uint32_t eip;
+    uint32_t eflags;
+    uint32_t eax, ecx, edx, ebx;
+    uint32_t esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+
+// GDT management
+void gdt_init(void);                // Build the table and load it on the boot CPU
+void gdt_load(void);                // Load the (already built) table on this CPU
+void gdt_set_percpu(uint32_t cpu, uint32_t base, uint32_t size);
+void gdt_load_percpu(uint32_t cpu); // Point GS at this CPU's per-CPU segment
+void gdt_load_tss(uint32_t cpu, uint32_t esp0);    // Install and load this CPU's TSS
+
+#endif // GDT_H
@@ -6,16 +6,31 @@
 extern timer_handler
 extern keyboard_handler
 extern page_fault_interrupt_handler
-extern network_handler
+extern pci_line_handler
+extern msi_handler
+extern disk_handler
+extern lapic_timer_handler
+extern smp_resched_handler
+extern fpu_handle_nm
 
 global timer_interrupt_wrapper
 global keyboard_interrupt_wrapper
 global page_fault_interrupt_wrapper
-global network_interrupt_wrapper
+global pci_line_wrappers
+global msi_wrappers
+global disk_interrupt_wrapper
+global lapic_timer_interrupt_wrapper
+global spurious_interrupt_wrapper
+global resched_ipi_wrapper
+global fpu_nm_wrapper
 
+; The timers pass their C handler the saved registers (irq_regs_t), with
+; the interrupted EIP above them, for the profiler
 timer_interrupt_wrapper:
     pusha                   ; Save all general-purpose registers
+    push esp                ; irq_regs_t*
     call timer_handler      ; Call C handler
+    add esp, 4
     popa                   ; Restore all general-purpose registers
     iret                   ; Return from interrupt
 
@@ -32,8 +47,67 @@ page_fault_interrupt_wrapper:
     add esp, 4             ; Remove error code from stack
     iret                   ; Return from interrupt
 
-network_interrupt_wrapper:
+; One stub per PCI line and per MSI vector, each calling its C handler
+; with the line or slot number
+%macro IRQ_STUB 3
+%1:
     pusha                   ; Save all general-purpose registers
-    call network_handler    ; Call C handler
+    push dword %3           ; Line or slot
+    call %2                 ; Call C handler
+    add esp, 4
+    popa                    ; Restore all general-purpose registers
+    iret                    ; Return from interrupt
+%endmacro
+
+IRQ_STUB pci_line9_wrapper, pci_line_handler, 9
+IRQ_STUB pci_line10_wrapper, pci_line_handler, 10
+IRQ_STUB pci_line11_wrapper, pci_line_handler, 11
+
+IRQ_STUB msi0_wrapper, msi_handler, 0
+IRQ_STUB msi1_wrapper, msi_handler, 1
+IRQ_STUB msi2_wrapper, msi_handler, 2
+IRQ_STUB msi3_wrapper, msi_handler, 3
+IRQ_STUB msi4_wrapper, msi_handler, 4
+IRQ_STUB msi5_wrapper, msi_handler, 5
+IRQ_STUB msi6_wrapper, msi_handler, 6
+IRQ_STUB msi7_wrapper, msi_handler, 7
+
+disk_interrupt_wrapper:
+    pusha                   ; Save all general-purpose registers
+    call disk_handler       ; Call C handler
+    popa                   ; Restore all general-purpose registers
+    iret                   ; Return from interrupt
+
+lapic_timer_interrupt_wrapper:
+    pusha                   ; Save all general-purpose registers
+    push esp                ; irq_regs_t*
+    call lapic_timer_handler ; Call C handler
+    add esp, 4
+    popa                   ; Restore all general-purpose registers
+    iret                   ; Return from interrupt
+
+resched_ipi_wrapper:
+    pusha                   ; Save all general-purpose registers
+    call smp_resched_handler ; Call C handler
+    popa                   ; Restore all general-purpose registers
+    iret                   ; Return from interrupt
+
+fpu_nm_wrapper:
+    pusha                   ; Save all general-purpose registers
+    call fpu_handle_nm      ; Load this process's FPU state
     popa                   ; Restore all general-purpose registers
-    iret                   ; Return from interrupt
\ No newline at end of file
+    iret                   ; Retry the faulting FP instruction
+
+spurious_interrupt_wrapper:
+    iret                   ; Spurious LAPIC interrupts need no EOI
+
+section .data
+
+; IRQ_PCI_FIRST to IRQ_PCI_LAST
+pci_line_wrappers:
+    dd pci_line9_wrapper, pci_line10_wrapper, pci_line11_wrapper
+
+; IRQ_MSI_VECTORS
+msi_wrappers:
+    dd msi0_wrapper, msi1_wrapper, msi2_wrapper, msi3_wrapper
+    dd msi4_wrapper, msi5_wrapper, msi6_wrapper, msi7_wrapper
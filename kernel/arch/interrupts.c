@@ -3,21 +3,35 @@
 #include "../shell.h"
 #include "../gui.h"
 #include "../proc/scheduler.h"
+#include "../proc/tick.h"
+#include "../proc/profile.h"
+#include "apic.h"
+#include "ioapic.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "tsc.h"
+#include "div64.h"
+#include "fpu.h"
+#include "sysenter.h"
 #include "../proc/syscalls.h" // System calls enabled
 #include "../net/eth.h" // Network interrupts and I/O functions
+#include "../net/virtio_net.h"
+#include "../fs/disk.h"
+#include "../fs/ahci.h"
+#include "../mm/memory.h"
 
 // Interrupt handler extern declarations
 extern void timer_interrupt_wrapper(void);
 extern void keyboard_interrupt_wrapper(void);
 extern void page_fault_interrupt_wrapper(void);
-extern void network_interrupt_wrapper(void);
-
-// Simple tick counter for timing
-static volatile uint32_t system_ticks = 0;
-
-uint32_t get_ticks(void) {
-    return system_ticks;
-}
+extern uint32_t pci_line_wrappers[IRQ_PCI_LAST - IRQ_PCI_FIRST + 1];
+extern uint32_t msi_wrappers[IRQ_MSI_VECTORS];
+extern void disk_interrupt_wrapper(void);
+extern void lapic_timer_interrupt_wrapper(void);
+extern void spurious_interrupt_wrapper(void);
+extern void resched_ipi_wrapper(void);
+extern void fpu_nm_wrapper(void);
+extern void bench_ring3_exit(void);
 
 #define IDT_SIZE 256
 #define PIC1_COMMAND 0x20
@@ -28,6 +42,34 @@ uint32_t get_ticks(void) {
 static idt_entry_t idt[IDT_SIZE];
 static idt_descriptor_t idt_desc;
 
+// Routing. The masks, affinities and I/O APIC programming change under
+// irq_lock; the handlers read only apic_mode.
+typedef struct {
+    pci_device_t dev;
+    uint32_t entry;
+    irq_handler_t handler;
+    void* ctx;
+} msi_slot_t;
+
+static spinlock_t irq_lock = SPINLOCK_INIT;
+static volatile bool apic_mode = false;
+static uint16_t irq_enabled = 0;            // Legacy lines unmasked
+static uint16_t irq_pci = 0;                // Lines routed as PCI (level)
+static uint32_t irq_gsi[IRQ_LEGACY];
+static uint8_t irq_cpu[IRQ_COUNT];
+static msi_slot_t msi_slots[IRQ_MSI_VECTORS];
+
+// Accounting, per CPU: written only by that CPU with interrupts off, read
+// as it stands. Handlers do not nest, so one open entry is enough.
+typedef struct {
+    uint64_t entry_tsc;
+    uint32_t source;
+    irq_hist_t handler[IRQ_SOURCES];
+    irq_hist_t delivery[IRQ_SOURCES];
+} __cacheline_aligned irq_cpu_stats_t;
+
+static irq_cpu_stats_t irq_stats[MAX_CPUS];
+
 // I/O port access functions are now in eth.h
 
 void set_idt_entry(int num, uint32_t handler, uint16_t selector, uint8_t flags) {
@@ -38,7 +80,8 @@ void set_idt_entry(int num, uint32_t handler, uint16_t selector, uint8_t flags)
     idt[num].type_attr = flags;
 }
 
-// Initialize the PIC (Programmable Interrupt Controller)
+// Initialize the PIC (Programmable Interrupt Controller), every line masked
+// until a driver asks for it
 static void init_pic(void) {
     // Initialize PIC1
     outb(PIC1_COMMAND, 0x11); // Start initialization
@@ -52,9 +95,19 @@ static void init_pic(void) {
     outb(PIC2_DATA, 0x02);    // PIC2 is slave
     outb(PIC2_DATA, 0x01);    // 8086 mode
     
-    // Enable keyboard, timer, and network interrupts
-    outb(PIC1_DATA, 0xE4); // Enable IRQ 0 (timer), IRQ 1 (keyboard), disable others on PIC1
-    outb(PIC2_DATA, 0xFB); // Enable IRQ 11 (network) on PIC2, disable others
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
+
+// Mask/unmask a single legacy IRQ line
+static void pic_mask_irq(uint8_t irq) {
+    uint16_t port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) | (1 << (irq & 7)));
+}
+
+static void pic_unmask_irq(uint8_t irq) {
+    uint16_t port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) & ~(1 << (irq & 7)));
 }
 
 void interrupts_init(void) {
@@ -71,29 +124,53 @@ void interrupts_init(void) {
     set_idt_entry(0x20, (uint32_t)timer_interrupt_wrapper, 0x08, 0x8E); // Timer
     set_idt_entry(0x21, (uint32_t)keyboard_interrupt_wrapper, 0x08, 0x8E); // Keyboard
     set_idt_entry(0x0E, (uint32_t)page_fault_interrupt_wrapper, 0x08, 0x8E); // Page fault
+    set_idt_entry(FPU_NM_VECTOR, (uint32_t)fpu_nm_wrapper, 0x08, 0x8E); // Device not available (lazy FPU)
     set_idt_entry(0x80, (uint32_t)syscall_interrupt_handler, 0x08, 0xEE); // System calls (user callable)
-    set_idt_entry(0x2B, (uint32_t)network_interrupt_wrapper, 0x08, 0x8E); // Network (RTL8139)
+    set_idt_entry(SYSCALL_BENCH_EXIT_VECTOR, (uint32_t)bench_ring3_exit, 0x08, 0xEE); // sysbench ring 3 exit
+    set_idt_entry(IRQ_VECTOR_BASE + ATA_IRQ_PRIMARY, (uint32_t)disk_interrupt_wrapper, 0x08, 0x8E); // Primary ATA (DMA completion)
+    set_idt_entry(LAPIC_TIMER_VECTOR, (uint32_t)lapic_timer_interrupt_wrapper, 0x08, 0x8E); // LAPIC timer
+    set_idt_entry(LAPIC_SPURIOUS_VECTOR, (uint32_t)spurious_interrupt_wrapper, 0x08, 0x8E); // LAPIC spurious
+    set_idt_entry(IRQ_VECTOR_BASE + 7, (uint32_t)spurious_interrupt_wrapper, 0x08, 0x8E); // PIC spurious, once masked
+    set_idt_entry(RESCHED_IPI_VECTOR, (uint32_t)resched_ipi_wrapper, 0x08, 0x8E); // Reschedule IPI
+    for (int i = 0; i < IRQ_MSI_VECTORS; i++) {
+        set_idt_entry(IRQ_MSI_VECTOR + i, msi_wrappers[i], 0x08, 0x8E); // MSI-X, as allocated
+    }
     
-    // Initialize PIC
+    // Initialize PIC: the PIT ticks until the tick code says otherwise
     init_pic();
+    irq_unmask(IRQ_TIMER);
+    irq_unmask(IRQ_KEYBOARD);
     
     // Load IDT
-    __asm__ volatile ("lidt %0" : : "m"(idt_desc));
+    interrupts_load_idt();
     
     // Enable interrupts
     __asm__ volatile ("sti");
 }
 
-// Timer interrupt handler
-void timer_handler(void) {
-    // Increment system tick counter
-    system_ticks++;
+// Application processors share the boot CPU's IDT
+void interrupts_load_idt(void) {
+    __asm__ volatile ("lidt %0" : : "m"(idt_desc));
+}
+
+// Timer interrupt handler (PIT, periodic mode)
+void timer_handler(const irq_regs_t* regs) {
+    irq_enter(IRQ_TIMER);
+    profile_sample(regs->eip);
     
-    // Update scheduler tick for process scheduling
-    scheduler_tick();
+    // Acknowledge first: the tick may switch to another process
+    irq_eoi(IRQ_TIMER);
     
-    // Send End of Interrupt to PIC
-    outb(PIC1_COMMAND, 0x20);
+    tick_handle_interrupt();
+}
+
+// Local APIC timer interrupt handler (one-shot, tickless mode)
+void lapic_timer_handler(const irq_regs_t* regs) {
+    irq_enter(IRQ_SRC_LAPIC_TIMER);
+    profile_sample(regs->eip);
+    irq_local_eoi(IRQ_SRC_LAPIC_TIMER);
+    
+    tick_handle_interrupt();
 }
 
 // Page fault interrupt handler (interrupt 14)
@@ -112,6 +189,7 @@ void page_fault_interrupt_handler(void) {
 
 // Keyboard interrupt handler
 void keyboard_handler(void) {
+    irq_enter(IRQ_KEYBOARD);
     uint8_t scancode = inb(0x60);
     
     // Simple scancode to ASCII mapping (only for basic keys)
@@ -126,7 +204,7 @@ void keyboard_handler(void) {
     // Only handle key press events (not key release)
     if (!(scancode & 0x80)) {
         if (gui_handle_scancode(scancode)) {
-            outb(PIC1_COMMAND, 0x20);
+            irq_eoi(IRQ_KEYBOARD);
             return;
         }
 
@@ -138,15 +216,390 @@ void keyboard_handler(void) {
         }
     }
     
-    // Send End of Interrupt to PIC
-    outb(PIC1_COMMAND, 0x20);
+    irq_eoi(IRQ_KEYBOARD);
 }
 
-// Network interrupt handler (RTL8139)
-void network_handler(void) {
-    // Handle network interrupt
+// PCI line handler: every device on the line checks its own status
+void pci_line_handler(uint32_t irq) {
+    irq_enter(irq);
     rtl8139_interrupt_handler();
+    virtio_net_interrupt_handler();
+    ahci_interrupt_handler();
+    
+    irq_eoi((uint8_t)irq);
+}
+
+// Primary ATA channel, unmasked by disk_init once it uses DMA
+void disk_handler(void) {
+    irq_enter(ATA_IRQ_PRIMARY);
+    disk_interrupt_handler();
+    
+    irq_eoi(ATA_IRQ_PRIMARY);
+}
+
+void msi_handler(uint32_t slot) {
+    msi_slot_t* msi = &msi_slots[slot];
+    irq_enter(IRQ_MSI_BASE + slot);
+    if (msi->handler) {
+        msi->handler(msi->ctx);
+    }
+    irq_local_eoi(IRQ_MSI_BASE + slot);
+}
+
+// Accounting
+
+static void irq_hist_add(irq_hist_t* hist, uint64_t cycles) {
+    uint32_t value = cycles > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)cycles;
+    uint32_t bucket = value ? 32 - (uint32_t)__builtin_clz(value) : 0;
+    if (bucket >= IRQ_HIST_BUCKETS) bucket = IRQ_HIST_BUCKETS - 1;
+    hist->count++;
+    hist->total_cycles += value;
+    if (value > hist->max_cycles) hist->max_cycles = value;
+    hist->buckets[bucket]++;
+}
+
+void irq_enter(uint32_t source) {
+    irq_cpu_stats_t* st = &irq_stats[this_cpu()->id];
+    st->source = source;
+    st->entry_tsc = rdtsc();
+}
+
+// Entry to now, for the source entered last
+static void irq_account(uint32_t source) {
+    irq_cpu_stats_t* st = &irq_stats[this_cpu()->id];
+    if (source >= IRQ_SOURCES) return;
+    irq_hist_add(&st->handler[source], st->source == source ? rdtsc() - st->entry_tsc : 0);
+}
+
+uint32_t irq_current(void) {
+    return irq_stats[this_cpu()->id].source;
+}
+
+uint64_t irq_entry_tsc(void) {
+    return irq_stats[this_cpu()->id].entry_tsc;
+}
+
+void irq_note_delivery(uint32_t source, uint64_t irq_tsc) {
+    if (source >= IRQ_SOURCES || !irq_tsc) return;
+    uint32_t flags = irq_save();
+    uint64_t now = rdtsc();
+    irq_hist_add(&irq_stats[this_cpu()->id].delivery[source], now > irq_tsc ? now - irq_tsc : 0);
+    irq_restore(flags);
+}
+
+static void irq_hist_merge(irq_hist_t* sum, const irq_hist_t* hist) {
+    sum->count += hist->count;
+    sum->total_cycles += hist->total_cycles;
+    if (hist->max_cycles > sum->max_cycles) sum->max_cycles = hist->max_cycles;
+    for (uint32_t i = 0; i < IRQ_HIST_BUCKETS; i++) {
+        sum->buckets[i] += hist->buckets[i];
+    }
+}
+
+void irq_get_stats(uint32_t source, uint32_t cpu, irq_hist_t* handler, irq_hist_t* delivery) {
+    memset(handler, 0, sizeof(*handler));
+    memset(delivery, 0, sizeof(*delivery));
+    if (source >= IRQ_SOURCES) return;
+    for (uint32_t c = 0; c < MAX_CPUS; c++) {
+        if (cpu != MAX_CPUS && c != cpu) continue;
+        irq_hist_merge(handler, &irq_stats[c].handler[source]);
+        irq_hist_merge(delivery, &irq_stats[c].delivery[source]);
+    }
+}
+
+// Counts racing the reset may survive it
+void irq_reset_stats(void) {
+    for (uint32_t c = 0; c < MAX_CPUS; c++) {
+        memset(irq_stats[c].handler, 0, sizeof(irq_stats[c].handler));
+        memset(irq_stats[c].delivery, 0, sizeof(irq_stats[c].delivery));
+    }
+}
+
+void irq_local_eoi(uint32_t source) {
+    irq_account(source);
+    lapic_eoi();
+}
+
+void irq_eoi(uint8_t irq) {
+    irq_account(irq);
+    if (apic_mode) {
+        lapic_eoi();
+        return;
+    }
+    if (irq >= 8) {
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+// MPS flags to redirection entry bits; a PCI line left to the bus default
+// is level triggered, active low
+static uint32_t irq_ioapic_flags(uint8_t irq) {
+    uint16_t mps;
+    irq_gsi[irq] = ioapic_isa_gsi(irq, &mps);
+    bool pci = (irq_pci >> irq) & 1;
+
+    uint32_t flags = 0;
+    uint32_t polarity = mps & MPS_POLARITY_MASK;
+    uint32_t trigger = mps & MPS_TRIGGER_MASK;
+    if (polarity == MPS_POLARITY_LOW || (polarity == 0 && pci)) flags |= IOAPIC_ACTIVE_LOW;
+    if (trigger == MPS_TRIGGER_LEVEL || (trigger == 0 && pci)) flags |= IOAPIC_LEVEL;
+    return flags;
+}
+
+// irq_lock held
+static void irq_program(uint8_t irq) {
+    ioapic_route(irq_gsi[irq], IRQ_VECTOR_BASE + irq, irq_ioapic_flags(irq),
+                 (uint8_t)cpus[irq_cpu[irq]].apic_id);
+    if ((irq_enabled >> irq) & 1) {
+        ioapic_unmask(irq_gsi[irq]);
+    }
+}
+
+void interrupts_init_apic(void) {
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    if (!lapic_available() || !ioapic_init()) {
+        vga_write_string("Interrupts: 8259 PIC, boot CPU only\n");
+        return;
+    }
+
+    // The mode first: an entry unmasked below may fire on another CPU at
+    // once, and must be acknowledged to its local APIC. Affinities set
+    // before now take effect here.
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+    apic_mode = true;
+    for (uint8_t irq = 0; irq < IRQ_LEGACY; irq++) {
+        if (irq == IRQ_CASCADE) continue;
+        irq_program(irq);
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+
+    vga_write_string("Interrupts: I/O APIC, ");
+    print_dec(ioapic_gsi_count());
+    vga_write_string(" inputs, network to CPU ");
+    print_dec(irq_feed_cpu());
+    vga_write_string("\n");
+}
+
+bool interrupts_apic_mode(void) {
+    return apic_mode;
+}
+
+void irq_mask(uint8_t irq) {
+    if (irq >= IRQ_LEGACY) return;
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    irq_enabled &= ~(1u << irq);
+    if (apic_mode) {
+        ioapic_mask(irq_gsi[irq]);
+    } else {
+        pic_mask_irq(irq);
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+}
+
+// A PIC2 line also needs the cascade
+void irq_unmask(uint8_t irq) {
+    if (irq >= IRQ_LEGACY) return;
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    irq_enabled |= 1u << irq;
+    if (apic_mode) {
+        ioapic_unmask(irq_gsi[irq]);
+    } else {
+        pic_unmask_irq(irq);
+        if (irq >= 8) pic_unmask_irq(IRQ_CASCADE);
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+}
+
+int irq_set_affinity(uint32_t irq, uint32_t cpu) {
+    if (irq >= IRQ_COUNT || !smp_cpu_online(cpu)) return -1;
+
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    int result = 0;
+    if (irq >= IRQ_MSI_BASE) {
+        msi_slot_t* msi = &msi_slots[irq - IRQ_MSI_BASE];
+        if (msi->handler) {
+            irq_cpu[irq] = (uint8_t)cpu;
+            result = pci_msix_set(&msi->dev, msi->entry, (uint8_t)(IRQ_MSI_VECTOR + irq - IRQ_MSI_BASE),
+                                  (uint8_t)cpus[cpu].apic_id);
+        } else {
+            result = -1;
+        }
+    } else {
+        irq_cpu[irq] = (uint8_t)cpu;
+        if (apic_mode) {
+            ioapic_set_destination(irq_gsi[irq], (uint8_t)cpus[cpu].apic_id);
+        }
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+    return result;
+}
+
+uint32_t irq_affinity(uint32_t irq) {
+    return irq < IRQ_COUNT ? irq_cpu[irq] : BOOT_CPU;
+}
+
+uint32_t irq_feed_cpu(void) {
+    for (uint32_t cpu = BOOT_CPU + 1; cpu < MAX_CPUS; cpu++) {
+        if (smp_cpu_online(cpu) && !smp_cpu_isolated(cpu)) return cpu;
+    }
+    return BOOT_CPU;
+}
+
+// PCI interrupts land on PIC2 lines (the PIIX wires them to the I/O APIC
+// input of the same number), sharing one handler
+int interrupts_route_pci(uint8_t irq, uint32_t cpu) {
+    if (irq < IRQ_PCI_FIRST || irq > IRQ_PCI_LAST || !smp_cpu_online(cpu)) return -1;
     
-    // Send End of Interrupt to PIC2 (since network is on PIC2)
-    outb(PIC2_COMMAND, 0x20);
-}
\ No newline at end of file
+    set_idt_entry(IRQ_VECTOR_BASE + irq, pci_line_wrappers[irq - IRQ_PCI_FIRST], 0x08, 0x8E);
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    irq_pci |= 1u << irq;
+    irq_cpu[irq] = (uint8_t)cpu;
+    if (apic_mode) {
+        irq_program(irq);
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+    irq_unmask(irq);
+    return 0;
+}
+
+int irq_alloc_msix(const pci_device_t* dev, uint32_t entry, uint32_t cpu,
+                   irq_handler_t handler, void* ctx) {
+    if (!lapic_available() || !handler || !smp_cpu_online(cpu)) return -1;
+
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    int irq = -1;
+    for (uint32_t i = 0; i < IRQ_MSI_VECTORS; i++) {
+        msi_slot_t* msi = &msi_slots[i];
+        if (msi->handler) continue;
+        if (pci_msix_set(dev, entry, (uint8_t)(IRQ_MSI_VECTOR + i), (uint8_t)cpus[cpu].apic_id) != 0) break;
+        msi->dev = *dev;
+        msi->entry = entry;
+        msi->ctx = ctx;
+        msi->handler = handler;
+        irq = (int)(IRQ_MSI_BASE + i);
+        irq_cpu[irq] = (uint8_t)cpu;
+        break;
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+    return irq;
+}
+
+void irq_free(uint32_t irq) {
+    if (irq < IRQ_MSI_BASE || irq >= IRQ_COUNT) return;
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    msi_slots[irq - IRQ_MSI_BASE].handler = NULL;
+    spin_unlock_irqrestore(&irq_lock, flags);
+}
+
+void interrupts_print_info(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Interrupts ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string(apic_mode ? "Controller: I/O APIC, EOI to the local APIC\n" :
+                                 "Controller: 8259 PIC, boot CPU only\n");
+    vga_write_string("IRQ  VECTOR  TYPE   CPU  COUNT (per CPU)\n");
+    for (uint32_t irq = 0; irq < IRQ_COUNT; irq++) {
+        bool msi = irq >= IRQ_MSI_BASE;
+        if (msi ? !msi_slots[irq - IRQ_MSI_BASE].handler : !((irq_enabled >> irq) & 1)) continue;
+
+        print_dec(irq);
+        vga_write_string(irq < 10 ? "    " : "   ");
+        print_dec(msi ? IRQ_MSI_VECTOR + irq - IRQ_MSI_BASE : IRQ_VECTOR_BASE + irq);
+        vga_write_string(msi ? "      msi-x  " : ((irq_pci >> irq) & 1) ? "      pci    " : "      isa    ");
+        print_dec(irq_cpu[irq]);
+        vga_write_string("    ");
+        for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+            if (!smp_cpu_online(cpu)) continue;
+            print_dec(irq_stats[cpu].handler[irq].count);
+            vga_write_string(" ");
+        }
+        vga_write_string("\n");
+    }
+}
+
+static const char* irq_source_name(uint32_t source) {
+    switch (source) {
+        case IRQ_TIMER:             return "pit    ";
+        case IRQ_KEYBOARD:          return "kbd    ";
+        case IRQ_MOUSE:             return "mouse  ";
+        case ATA_IRQ_PRIMARY:       return "ata    ";
+        case IRQ_SRC_LAPIC_TIMER:   return "lapic  ";
+        case IRQ_SRC_RESCHED:       return "resched";
+    }
+    if (source >= IRQ_MSI_BASE) return "msi-x  ";
+    return ((irq_pci >> source) & 1) ? "pci    " : "isa    ";
+}
+
+static uint32_t irq_source_vector(uint32_t source) {
+    if (source == IRQ_SRC_LAPIC_TIMER) return LAPIC_TIMER_VECTOR;
+    if (source == IRQ_SRC_RESCHED) return RESCHED_IPI_VECTOR;
+    if (source >= IRQ_MSI_BASE) return IRQ_MSI_VECTOR + source - IRQ_MSI_BASE;
+    return IRQ_VECTOR_BASE + source;
+}
+
+static void print_cycles(uint64_t cycles) {
+    print_duration_ns(tsc_cycles_to_ns(cycles));
+}
+
+static uint64_t irq_hist_percentile(const irq_hist_t* hist, uint32_t per_mille) {
+    return log2_hist_percentile(hist->buckets, IRQ_HIST_BUCKETS, hist->count, per_mille);
+}
+
+static void irq_print_hist(const char* what, const irq_hist_t* hist) {
+    vga_write_string(what);
+    print_dec(hist->count);
+    vga_write_string("  ");
+    print_cycles(div_u64_u32(hist->total_cycles, hist->count, NULL));
+    vga_write_string("  <");
+    print_cycles(irq_hist_percentile(hist, 500));
+    vga_write_string("  <");
+    print_cycles(irq_hist_percentile(hist, 990));
+    vga_write_string("  ");
+    print_cycles(hist->max_cycles);
+    vga_write_string("\n");
+}
+
+void interrupts_print_stats(uint32_t cpu) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Interrupt Latency ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    if (!tsc_available()) {
+        vga_write_string("Needs a calibrated TSC\n");
+        return;
+    }
+    vga_write_string(cpu == MAX_CPUS ? "All CPUs" : "CPU ");
+    if (cpu != MAX_CPUS) print_dec(cpu);
+    vga_write_string("; entry to EOI, delivery: entry to first frame\n");
+    vga_write_string("IRQ SOURCE  VEC  COUNT    AVG    P50    P99    MAX\n");
+
+    uint32_t shown = 0;
+    for (uint32_t source = 0; source < IRQ_SOURCES; source++) {
+        irq_hist_t handler, delivery;
+        irq_get_stats(source, cpu, &handler, &delivery);
+        if (handler.count == 0) continue;
+
+        if (source < IRQ_COUNT) {
+            print_dec(source);
+            vga_write_string(source < 10 ? "   " : "  ");
+        } else {
+            vga_write_string("-   ");
+        }
+        vga_write_string(irq_source_name(source));
+        vga_write_string(" ");
+        print_dec(irq_source_vector(source));
+        vga_write_string("  ");
+        irq_print_hist("", &handler);
+        if (delivery.count) {
+            irq_print_hist("    delivery     ", &delivery);
+        }
+        shown++;
+    }
+    if (!shown) {
+        vga_write_string("No interrupts taken\n");
+    }
+}
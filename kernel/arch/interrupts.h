@@ -2,6 +2,7 @@
 #define INTERRUPTS_H
 
 #include "../types.h"
+#include "../drivers/pci.h"
 
 // IDT entry structure
 typedef struct {
@@ -27,13 +28,117 @@ typedef struct {
     uint32_t ss;
 } interrupt_frame_t;
 
+// What a handler wrapper's pusha leaves, and the CPU's frame above it
+// (no stack switch: interrupts come from ring 0, or the ring 3 stack
+// words follow)
+typedef struct {
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
+    uint32_t eip, cs, eflags;
+} irq_regs_t;
+
+// Device interrupts. IRQ n, a legacy line, is vector 0x20 + n. At boot
+// the lines come through the 8259 pair, which only reaches the boot CPU
+// and wants one or two port writes per EOI. interrupts_init_apic moves
+// them to the I/O APIC where there is one: each line is a redirection
+// entry sent to the CPU of its affinity, and the EOI is one write to the
+// local APIC. The PICs stay masked from then on.
+//
+// MSI-X interrupts (IRQ_MSI_BASE up) are written by the device straight
+// to a local APIC; they need no I/O APIC, only the local one. Moving one
+// rewrites its table entry.
+//
+// By default the housekeeping lines (timer, keyboard, mouse, disks) go to
+// the boot CPU and the network cards to the feed CPU: the first
+// application processor that is not isolated, or the boot CPU alone.
+#define IRQ_LEGACY              16
+#define IRQ_VECTOR_BASE         0x20
+#define IRQ_MSI_BASE            IRQ_LEGACY
+#define IRQ_MSI_VECTORS         8
+#define IRQ_MSI_VECTOR          0x40        // Of the first MSI IRQ
+#define IRQ_COUNT               (IRQ_MSI_BASE + IRQ_MSI_VECTORS)
+#define IRQ_PCI_FIRST           9           // PCI lines the shared handler takes
+#define IRQ_PCI_LAST            11
+
+#define IRQ_TIMER               0
+#define IRQ_KEYBOARD            1
+#define IRQ_CASCADE             2
+#define IRQ_MOUSE               12
+
+#define PIC_EOI                 0x20
+
+// Accounting. Every handler opens with irq_enter(source), which takes the
+// TSC on its CPU, and its EOI closes the measurement: a count and an
+// entry-to-EOI histogram per source and CPU, in log2 cycle buckets. Those
+// from the local APIC have no IRQ of their own and take the sources after
+// IRQ_COUNT. The timers acknowledge before they tick, so theirs is the
+// cost of getting in; the tick itself shows in schedlat.
+//
+// For a NIC, irq_note_delivery adds the gap from the handler's entry to
+// the first frame handed to the stack, which includes the wakeup of the
+// receive task where one does the work.
+#define IRQ_SRC_LAPIC_TIMER     IRQ_COUNT
+#define IRQ_SRC_RESCHED         (IRQ_COUNT + 1)
+#define IRQ_SOURCES             (IRQ_COUNT + 2)
+#define IRQ_HIST_BUCKETS        32          // Bucket b: under 2^b cycles
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+    uint32_t buckets[IRQ_HIST_BUCKETS];
+} irq_hist_t;
+
+typedef void (*irq_handler_t)(void* ctx);
+
 // Function prototypes
 void interrupts_init(void);
+void interrupts_load_idt(void);
 void set_idt_entry(int num, uint32_t handler, uint16_t selector, uint8_t flags);
 
+// Once the CPUs are up and the platform tables read (smp_boot_aps)
+void interrupts_init_apic(void);
+bool interrupts_apic_mode(void);
+
+// Every handler of a line ends with its EOI, which also accounts it
+void irq_enter(uint32_t source);
+void irq_eoi(uint8_t irq);
+void irq_local_eoi(uint32_t source);         // Local APIC sources and MSI-X
+void irq_mask(uint8_t irq);
+void irq_unmask(uint8_t irq);
+
+// Under the PIC every line lands on the boot CPU; the affinity is kept and
+// takes effect with the I/O APIC. -1 for a CPU that is not online or an
+// IRQ not in use.
+int irq_set_affinity(uint32_t irq, uint32_t cpu);
+uint32_t irq_affinity(uint32_t irq);
+uint32_t irq_feed_cpu(void);
+
+// A PCI line to the shared handler, for 'cpu'; -1 unusable. The line is
+// shared, so the last caller sets where it goes.
+int interrupts_route_pci(uint8_t irq, uint32_t cpu);
+
+// MSI-X table entry 'entry' of 'dev' to handler(ctx) on 'cpu': the IRQ,
+// or -1 with no vector left or no local APIC. The caller turns MSI-X on.
+int irq_alloc_msix(const pci_device_t* dev, uint32_t entry, uint32_t cpu,
+                   irq_handler_t handler, void* ctx);
+void irq_free(uint32_t irq);
+
+// The source being handled on this CPU, and when its handler began
+uint32_t irq_current(void);
+uint64_t irq_entry_tsc(void);
+void irq_note_delivery(uint32_t source, uint64_t irq_tsc);
+
+// One CPU's histograms, or all CPUs' summed for cpu == MAX_CPUS
+void irq_get_stats(uint32_t source, uint32_t cpu, irq_hist_t* handler, irq_hist_t* delivery);
+void irq_reset_stats(void);
+
+void interrupts_print_info(void);
+void interrupts_print_stats(uint32_t cpu);
+
 // Interrupt handlers
 void keyboard_handler(void);
-void timer_handler(void);
+void timer_handler(const irq_regs_t* regs);
+void lapic_timer_handler(const irq_regs_t* regs);
 void page_fault_interrupt_handler(void);
 
 // External page fault handler (from paging.c)
@@ -45,7 +150,6 @@ extern void timer_interrupt_wrapper(void);
 extern void page_fault_interrupt_wrapper(void);
 extern void syscall_interrupt_handler(void);
 
-// Timing functions
-uint32_t get_ticks(void);
+// Timing functions are in proc/tick.h
 
 #endif // INTERRUPTS_H
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include "ioapic.h"
+#include "acpi.h"
+#include "spinlock.h"
+
+typedef struct {
+    volatile uint32_t* base;
+    uint32_t gsi_base;
+    uint32_t entries;
+} ioapic_t;
+
+static ioapic_t ioapics[MAX_IOAPICS];
+static uint32_t ioapic_count = 0;
+static spinlock_t ioapic_lock = SPINLOCK_INIT;  // REGSEL then WINDOW
+
+static uint32_t ioapic_read(ioapic_t* io, uint32_t reg) {
+    io->base[IOAPIC_REGSEL >> 2] = reg;
+    return io->base[IOAPIC_WINDOW >> 2];
+}
+
+static void ioapic_write(ioapic_t* io, uint32_t reg, uint32_t value) {
+    io->base[IOAPIC_REGSEL >> 2] = reg;
+    io->base[IOAPIC_WINDOW >> 2] = value;
+}
+
+// The I/O APIC serving a GSI, and the input on it
+static ioapic_t* ioapic_for(uint32_t gsi, uint32_t* pin) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        ioapic_t* io = &ioapics[i];
+        if (gsi >= io->gsi_base && gsi < io->gsi_base + io->entries) {
+            *pin = gsi - io->gsi_base;
+            return io;
+        }
+    }
+    return NULL;
+}
+
+bool ioapic_init(void) {
+    const platform_info_t* platform = acpi_platform();
+    if (!platform) return false;
+
+    ioapic_count = 0;
+    for (uint32_t i = 0; i < platform->ioapic_count && i < MAX_IOAPICS; i++) {
+        ioapic_t* io = &ioapics[ioapic_count];
+        io->base = (volatile uint32_t*)platform->ioapics[i].address;
+        io->gsi_base = platform->ioapics[i].gsi_base;
+        io->entries = ((ioapic_read(io, IOAPIC_REG_VERSION) >> IOAPIC_MAX_ENTRIES_SHIFT) & 0xFF) + 1;
+        for (uint32_t pin = 0; pin < io->entries; pin++) {
+            ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2, IOAPIC_MASKED);
+            ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2 + 1, 0);
+        }
+        ioapic_count++;
+    }
+    return ioapic_count > 0;
+}
+
+bool ioapic_available(void) {
+    return ioapic_count > 0;
+}
+
+uint32_t ioapic_gsi_count(void) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        uint32_t end = ioapics[i].gsi_base + ioapics[i].entries;
+        if (end > count) count = end;
+    }
+    return count;
+}
+
+uint32_t ioapic_isa_gsi(uint8_t irq, uint16_t* flags) {
+    const platform_info_t* platform = acpi_platform();
+    *flags = 0;
+    if (platform) {
+        for (uint32_t i = 0; i < platform->override_count; i++) {
+            if (platform->overrides[i].source_irq == irq) {
+                *flags = platform->overrides[i].flags;
+                return platform->overrides[i].gsi;
+            }
+        }
+    }
+    return irq;
+}
+
+int ioapic_route(uint32_t gsi, uint8_t vector, uint32_t flags, uint8_t apic_id) {
+    uint32_t pin;
+    ioapic_t* io = ioapic_for(gsi, &pin);
+    if (!io) return -1;
+
+    uint32_t irq_flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2, IOAPIC_MASKED);
+    ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2 + 1, (uint32_t)apic_id << IOAPIC_DEST_SHIFT);
+    ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2, IOAPIC_MASKED | flags | vector);
+    spin_unlock_irqrestore(&ioapic_lock, irq_flags);
+    return 0;
+}
+
+static void ioapic_update(uint32_t gsi, uint32_t clear, uint32_t set) {
+    uint32_t pin;
+    ioapic_t* io = ioapic_for(gsi, &pin);
+    if (!io) return;
+
+    uint32_t irq_flags = spin_lock_irqsave(&ioapic_lock);
+    uint32_t low = ioapic_read(io, IOAPIC_REG_REDTBL + pin * 2);
+    ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2, (low & ~clear) | set);
+    spin_unlock_irqrestore(&ioapic_lock, irq_flags);
+}
+
+void ioapic_mask(uint32_t gsi) {
+    ioapic_update(gsi, 0, IOAPIC_MASKED);
+}
+
+void ioapic_unmask(uint32_t gsi) {
+    ioapic_update(gsi, IOAPIC_MASKED, 0);
+}
+
+// The next interrupt goes to the new CPU; one already in flight completes
+// where it was sent
+void ioapic_set_destination(uint32_t gsi, uint8_t apic_id) {
+    uint32_t pin;
+    ioapic_t* io = ioapic_for(gsi, &pin);
+    if (!io) return;
+
+    uint32_t irq_flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2 + 1, (uint32_t)apic_id << IOAPIC_DEST_SHIFT);
+    spin_unlock_irqrestore(&ioapic_lock, irq_flags);
+}
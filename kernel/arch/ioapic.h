@@ -0,0 +1,50 @@
+#ifndef IOAPIC_H
+#define IOAPIC_H
+
+#include "../types.h"
+
+// I/O APICs as the platform tables list them. Each input (a global system
+// interrupt, GSI) has a redirection entry: vector, trigger, polarity, mask
+// and the local APIC it is delivered to. Entries start masked; the
+// interrupt layer (interrupts.h) programs the ones it uses.
+#define IOAPIC_REGSEL           0x00
+#define IOAPIC_WINDOW           0x10
+
+#define IOAPIC_REG_ID           0x00
+#define IOAPIC_REG_VERSION      0x01
+#define IOAPIC_REG_REDTBL       0x10        // Two registers per entry
+
+#define IOAPIC_MAX_ENTRIES_SHIFT 16         // Version register: entries - 1
+
+// Redirection entry, low dword
+#define IOAPIC_ACTIVE_LOW       (1u << 13)
+#define IOAPIC_LEVEL            (1u << 15)
+#define IOAPIC_MASKED           (1u << 16)
+#define IOAPIC_DEST_SHIFT       24          // High dword: destination APIC id
+
+// MPS INTI flags, as in interrupt source overrides
+#define MPS_POLARITY_MASK       0x3
+#define MPS_POLARITY_HIGH       0x1
+#define MPS_POLARITY_LOW        0x3
+#define MPS_TRIGGER_MASK        0xC
+#define MPS_TRIGGER_EDGE        0x4
+#define MPS_TRIGGER_LEVEL       0xC
+
+// Map the I/O APICs from acpi_platform() and mask every entry; false if
+// there are none
+bool ioapic_init(void);
+bool ioapic_available(void);
+
+// Inputs across all I/O APICs
+uint32_t ioapic_gsi_count(void);
+
+// The GSI an ISA IRQ arrives on, and its MPS flags (0: bus default)
+uint32_t ioapic_isa_gsi(uint8_t irq, uint16_t* flags);
+
+// 'flags' are IOAPIC_ACTIVE_LOW / IOAPIC_LEVEL; the entry is left masked
+int ioapic_route(uint32_t gsi, uint8_t vector, uint32_t flags, uint8_t apic_id);
+void ioapic_mask(uint32_t gsi);
+void ioapic_unmask(uint32_t gsi);
+void ioapic_set_destination(uint32_t gsi, uint8_t apic_id);
+
+#endif // IOAPIC_H
@@ -21,6 +21,10 @@ _start:
     ; Set up stack
     mov esp, stack_top
     
+    ; Keep the multiboot handoff (command line) for kernel_main
+    mov [multiboot_magic], eax
+    mov [multiboot_info], ebx
+    
     ; Call kernel main
     call kernel_main
     
@@ -29,6 +33,12 @@ _start:
     hlt
     jmp $
 
+section .data
+global multiboot_magic
+global multiboot_info
+multiboot_magic: dd 0
+multiboot_info: dd 0
+
 section .bss
 align 16
 stack_bottom:
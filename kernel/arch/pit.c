@@ -0,0 +1,37 @@
+#include "pit.h"
+#include "../net/eth.h" // I/O port access functions
+
+// Program channel 0 as a rate generator (mode 2) firing IRQ0
+void pit_init(uint32_t frequency) {
+    if (frequency == 0) return;
+
+    uint32_t divisor = PIT_BASE_FREQUENCY / frequency;
+    if (divisor > 0xFFFF) divisor = 0xFFFF;
+    if (divisor < 1) divisor = 1;
+
+    outb(PIT_COMMAND, 0x34);                    // Channel 0, lobyte/hibyte, mode 2
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+}
+
+// Arm channel 2 in mode 0 (interrupt on terminal count) with the speaker
+// disconnected; its output goes high once the count reaches zero
+void pit_calibration_start(uint32_t ms) {
+    if (ms > PIT_MAX_CALIBRATION_MS) ms = PIT_MAX_CALIBRATION_MS;
+    uint32_t count = (PIT_BASE_FREQUENCY / 1000) * ms;
+
+    // Gate low, speaker off
+    uint8_t gate = inb(PIT_GATE_PORT) & ~0x03;
+    outb(PIT_GATE_PORT, gate);
+
+    outb(PIT_COMMAND, 0xB0);                    // Channel 2, lobyte/hibyte, mode 0
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, (count >> 8) & 0xFF);
+
+    // Rising edge on the gate starts the countdown
+    outb(PIT_GATE_PORT, gate | 0x01);
+}
+
+bool pit_calibration_expired(void) {
+    return (inb(PIT_GATE_PORT) & 0x20) ? true : false;
+}
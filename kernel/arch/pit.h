@@ -0,0 +1,23 @@
+#ifndef PIT_H
+#define PIT_H
+
+#include "../types.h"
+
+// 8253/8254 Programmable Interval Timer
+#define PIT_BASE_FREQUENCY  1193182
+#define PIT_CHANNEL0        0x40
+#define PIT_CHANNEL2        0x42
+#define PIT_COMMAND         0x43
+#define PIT_GATE_PORT       0x61    // Channel 2 gate (bit 0) and output (bit 5)
+
+#define PIT_MAX_CALIBRATION_MS  50  // 16-bit counter limit is ~54.9ms
+
+// Periodic IRQ0 at the given frequency
+void pit_init(uint32_t frequency);
+
+// Channel 2 one-shot used as a reference clock for calibrating other timers.
+// Start it, then spin on pit_calibration_expired().
+void pit_calibration_start(uint32_t ms);
+bool pit_calibration_expired(void);
+
+#endif // PIT_H
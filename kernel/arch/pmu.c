@@ -0,0 +1,303 @@
+#include "pmu.h"
+#include "cpu.h"
+#include "smp.h"
+#include "tsc.h"
+#include "div64.h"
+#include "../proc/process.h"
+#include "../mm/memory.h"
+#include "../drivers/vga.h"
+
+// Where each event is counted, and what it is selected with
+typedef struct {
+    int32_t rdpmc;              // ECX for rdpmc, -1: not counted
+    uint32_t evtsel;            // Programmable counters only
+} pmu_slot_t;
+
+// Per CPU: the raw counts last folded, and fold requests from other CPUs
+typedef struct {
+    uint64_t last[PMU_EVENTS];
+    volatile uint32_t fold_request;
+    volatile uint32_t fold_seq;
+} __cacheline_aligned pmu_cpu_t;
+
+static bool pmu_enabled = false;
+static uint32_t pmu_version = 0;
+static uint32_t pmu_gp_counters = 0;
+static uint32_t pmu_fixed_counters = 0;
+static uint64_t pmu_gp_mask = 0;            // Counter width
+static uint64_t pmu_fixed_mask = 0;
+static uint32_t pmu_gp_used = 0;
+static pmu_slot_t pmu_slots[PMU_EVENTS];
+static pmu_cpu_t pmu_cpus[MAX_CPUS];
+
+static const char* pmu_event_names[PMU_EVENTS] = {
+    "cycles", "instructions", "llc-misses", "branch-misses", "dtlb-misses"
+};
+
+bool pmu_available(void) {
+    return pmu_enabled;
+}
+
+bool pmu_event_supported(pmu_event_t event) {
+    return pmu_enabled && event < PMU_EVENTS && pmu_slots[event].rdpmc >= 0;
+}
+
+const char* pmu_event_name(pmu_event_t event) {
+    return event < PMU_EVENTS ? pmu_event_names[event] : "?";
+}
+
+int32_t pmu_rdpmc_index(pmu_event_t event) {
+    return pmu_event_supported(event) ? pmu_slots[event].rdpmc : -1;
+}
+
+static inline uint64_t rdpmc(uint32_t index) {
+    uint32_t low, high;
+    __asm__ volatile ("rdpmc" : "=a"(low), "=d"(high) : "c"(index));
+    return ((uint64_t)high << 32) | low;
+}
+
+static void pmu_read_raw(uint64_t raw[PMU_EVENTS]) {
+    for (uint32_t e = 0; e < PMU_EVENTS; e++) {
+        int32_t index = pmu_slots[e].rdpmc;
+        raw[e] = index >= 0 ? rdpmc((uint32_t)index) : 0;
+    }
+}
+
+// What the counters advanced since the last fold, to 'process' (interrupts off)
+static void pmu_fold(pmu_cpu_t* pc, process_t* process) {
+    uint64_t raw[PMU_EVENTS];
+    pmu_read_raw(raw);
+    for (uint32_t e = 0; e < PMU_EVENTS; e++) {
+        uint64_t mask = (pmu_slots[e].rdpmc & PMU_RDPMC_FIXED) ? pmu_fixed_mask : pmu_gp_mask;
+        if (process) process->pmu_counts[e] += (raw[e] - pc->last[e]) & mask;
+        pc->last[e] = raw[e];
+    }
+}
+
+// A free programmable counter for 'evtsel', if any
+static void pmu_assign_gp(pmu_event_t event, uint32_t evtsel) {
+    if (pmu_gp_used >= pmu_gp_counters) return;
+    pmu_slots[event].rdpmc = (int32_t)pmu_gp_used++;
+    pmu_slots[event].evtsel = evtsel;
+}
+
+static void pmu_assign_fixed(pmu_event_t event, uint32_t fixed, uint32_t evtsel) {
+    if (fixed < pmu_fixed_counters) {
+        pmu_slots[event].rdpmc = (int32_t)(PMU_RDPMC_FIXED | fixed);
+    } else {
+        pmu_assign_gp(event, evtsel);
+    }
+}
+
+void pmu_init_cpu(void) {
+    if (!pmu_enabled) return;
+
+    if (pmu_version >= 2) {
+        wrmsr(MSR_IA32_PERF_GLOBAL_CTRL, 0);
+    }
+    for (uint32_t i = 0; i < pmu_gp_counters; i++) {
+        wrmsr(MSR_IA32_PERFEVTSEL0 + i, 0);
+        wrmsr(MSR_IA32_PMC0 + i, 0);
+    }
+
+    uint64_t global = 0;
+    uint32_t fixed_ctrl = 0;
+    for (uint32_t e = 0; e < PMU_EVENTS; e++) {
+        int32_t index = pmu_slots[e].rdpmc;
+        if (index < 0) continue;
+        if (index & PMU_RDPMC_FIXED) {
+            uint32_t fixed = (uint32_t)index & ~PMU_RDPMC_FIXED;
+            wrmsr(MSR_IA32_FIXED_CTR0 + fixed, 0);
+            fixed_ctrl |= PMU_FIXED_OS_USR << (fixed * 4);
+            global |= 1ULL << (PMU_GLOBAL_FIXED_SHIFT + fixed);
+        } else {
+            wrmsr(MSR_IA32_PERFEVTSEL0 + (uint32_t)index,
+                  pmu_slots[e].evtsel | PMU_EVTSEL_USR | PMU_EVTSEL_OS | PMU_EVTSEL_EN);
+            global |= 1ULL << index;
+        }
+    }
+    if (pmu_version >= 2) {
+        wrmsr(MSR_IA32_FIXED_CTR_CTRL, fixed_ctrl);
+        wrmsr(MSR_IA32_PERF_GLOBAL_CTRL, global);
+    }
+
+    write_cr4(read_cr4() | CR4_PCE);
+    pmu_cpu_t* pc = &pmu_cpus[this_cpu()->id];
+    pc->fold_request = 0;
+    pmu_fold(pc, NULL);
+}
+
+bool pmu_init(void) {
+    uint32_t max_leaf, ebx, ecx, edx, eax;
+    for (uint32_t e = 0; e < PMU_EVENTS; e++) {
+        pmu_slots[e].rdpmc = -1;
+    }
+
+    cpuid(0, &max_leaf, &ebx, &ecx, &edx);
+    bool intel = ebx == 0x756E6547 && edx == 0x49656E69 && ecx == 0x6C65746E;    // GenuineIntel
+    if (intel && max_leaf >= CPUID_LEAF_PMU) {
+        cpuid(CPUID_LEAF_PMU, &eax, &ebx, &ecx, &edx);
+        pmu_version = eax & 0xFF;
+    }
+    if (pmu_version == 0) {
+        vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
+        vga_write_string("No architectural PMU, hardware counters unavailable\n");
+        return false;
+    }
+
+    pmu_gp_counters = (eax >> 8) & 0xFF;
+    pmu_gp_mask = (1ULL << ((eax >> 16) & 0xFF)) - 1;
+    uint32_t known = (eax >> 24) & 0xFF;          // EBX bits that are meaningful
+    uint32_t absent = ebx | (known < 32 ? ~((1u << known) - 1) : 0);
+    if (pmu_version >= 2) {
+        pmu_fixed_counters = edx & 0x1F;
+        pmu_fixed_mask = (1ULL << ((edx >> 5) & 0xFF)) - 1;
+    }
+
+    if (!(absent & PMU_EBX_INSTR_NA)) pmu_assign_fixed(PMU_INSTRUCTIONS, 0, PMU_INSTR_EVENT);
+    if (!(absent & PMU_EBX_CYCLES_NA)) pmu_assign_fixed(PMU_CYCLES, 1, PMU_CYCLES_EVENT);
+    if (!(absent & PMU_EBX_LLC_MISS_NA)) pmu_assign_gp(PMU_LLC_MISSES, PMU_LLC_MISS_EVENT);
+    if (!(absent & PMU_EBX_BRANCH_MISS_NA)) pmu_assign_gp(PMU_BRANCH_MISSES, PMU_BRANCH_MISS_EVENT);
+    cpuid(1, &eax, NULL, NULL, NULL);
+    if (((eax >> 8) & 0xF) == 6) pmu_assign_gp(PMU_DTLB_MISSES, PMU_DTLB_EVENT);
+
+    pmu_enabled = true;
+    pmu_init_cpu();
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    vga_write_string("PMU: version ");
+    print_dec(pmu_version);
+    vga_write_string(", ");
+    print_dec(pmu_gp_counters);
+    vga_write_string(" programmable + ");
+    print_dec(pmu_fixed_counters);
+    vga_write_string(" fixed counters\n");
+    return true;
+}
+
+// Charge the outgoing process for its slice
+void pmu_switch(process_t* prev) {
+    if (!pmu_enabled) return;
+    pmu_fold(&pmu_cpus[this_cpu()->id], prev);
+}
+
+void pmu_flush_requests(void) {
+    if (!pmu_enabled) return;
+    pmu_cpu_t* pc = &pmu_cpus[this_cpu()->id];
+    if (!pc->fold_request) return;
+    pc->fold_request = 0;
+
+    pmu_fold(pc, current_process);
+    __sync_fetch_and_add(&pc->fold_seq, 1);
+}
+
+void pmu_read_process(process_t* process, uint64_t counts[PMU_EVENTS]) {
+    if (pmu_enabled && process->on_cpu) {
+        uint32_t flags = irq_save();
+        uint32_t cpu = process->cpu;
+        if (cpu == this_cpu()->id) {
+            pmu_fold(&pmu_cpus[cpu], current_process);
+            irq_restore(flags);
+        } else {
+            // Its CPU folds at the IPI; an isolated core takes that hit
+            // only when someone asks
+            irq_restore(flags);
+            pmu_cpu_t* pc = &pmu_cpus[cpu];
+            uint32_t seq = pc->fold_seq;
+            pc->fold_request = 1;
+            smp_send_resched(cpu);
+            uint64_t deadline = ktime_ns() + (uint64_t)PMU_FOLD_TIMEOUT_US * NSEC_PER_USEC;
+            while (pc->fold_seq == seq && ktime_ns() < deadline) {
+                cpu_relax();
+            }
+        }
+    }
+    for (uint32_t e = 0; e < PMU_EVENTS; e++) {
+        counts[e] = process->pmu_counts[e];
+    }
+}
+
+void pmu_print_info(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Performance Counters ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    if (!pmu_enabled) {
+        vga_write_string("No architectural PMU (Intel, CPUID leaf 0xA)\n");
+        return;
+    }
+    vga_write_string("Version ");
+    print_dec(pmu_version);
+    vga_write_string(", ");
+    print_dec(pmu_gp_counters);
+    vga_write_string(" programmable, ");
+    print_dec(pmu_fixed_counters);
+    vga_write_string(" fixed; rdpmc allowed in ring 3\n");
+    vga_write_string("EVENT          COUNTER  ECX\n");
+    for (uint32_t e = 0; e < PMU_EVENTS; e++) {
+        vga_write_string(pmu_event_names[e]);
+        for (uint32_t n = strlen(pmu_event_names[e]); n < 15; n++) vga_write_string(" ");
+        int32_t index = pmu_slots[e].rdpmc;
+        if (index < 0) {
+            vga_write_string("-\n");
+            continue;
+        }
+        vga_write_string(index & PMU_RDPMC_FIXED ? "fixed " : "pmc   ");
+        print_dec((uint32_t)index & ~PMU_RDPMC_FIXED);
+        vga_write_string("    ");
+        print_hex((uint32_t)index);
+        vga_write_string("\n");
+    }
+}
+
+// To three decimals; large counts are scaled down together
+static void print_ratio(uint64_t num, uint64_t den) {
+    while (num > 0xFFFFFFFFu || den > 0xFFFFFFFFu) {
+        num >>= 1;
+        den >>= 1;
+    }
+    if (den == 0) {
+        vga_write_string("-");
+        return;
+    }
+    uint32_t milli = (uint32_t)div_u64_u32(num * 1000, (uint32_t)den, NULL);
+    print_dec(milli / 1000);
+    vga_write_string(".");
+    if (milli % 1000 < 100) vga_write_string("0");
+    if (milli % 1000 < 10) vga_write_string("0");
+    print_dec(milli % 1000);
+}
+
+void pmu_print_process(process_t* process) {
+    if (!pmu_enabled) {
+        vga_write_string("No hardware counters\n");
+        return;
+    }
+
+    uint64_t counts[PMU_EVENTS];
+    pmu_read_process(process, counts);
+    for (uint32_t e = 0; e < PMU_EVENTS; e++) {
+        if (!pmu_event_supported((pmu_event_t)e)) continue;
+        vga_write_string(pmu_event_names[e]);
+        vga_write_string(": ");
+        print_dec((uint32_t)div_u64_u32(counts[e], 1000, NULL));
+        vga_write_string("k\n");
+    }
+
+    // Rates over the slices it ran
+    if (pmu_event_supported(PMU_INSTRUCTIONS) && pmu_event_supported(PMU_CYCLES)) {
+        vga_write_string("IPC: ");
+        print_ratio(counts[PMU_INSTRUCTIONS], counts[PMU_CYCLES]);
+        vga_write_string("\n");
+    }
+    if (counts[PMU_INSTRUCTIONS] >= 1000) {
+        uint64_t kilo = div_u64_u32(counts[PMU_INSTRUCTIONS], 1000, NULL);
+        for (uint32_t e = PMU_LLC_MISSES; e < PMU_EVENTS; e++) {
+            if (!pmu_event_supported((pmu_event_t)e)) continue;
+            vga_write_string(pmu_event_names[e]);
+            vga_write_string(" per 1k instructions: ");
+            print_ratio(counts[e], kilo);
+            vga_write_string("\n");
+        }
+    }
+}
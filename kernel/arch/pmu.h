@@ -0,0 +1,82 @@
+#ifndef PMU_H
+#define PMU_H
+
+#include "../types.h"
+
+// Hardware performance counters, Intel architectural PMU (CPUID leaf 0xA).
+// Every CPU counts the same PMU_EVENTS in ring 0 and ring 3 from boot on:
+// instructions and cycles on the fixed counters where there are any, the
+// rest on programmable ones. Events the CPU does not report, or that do
+// not fit the counters it has, read as zero and are shown as absent.
+//
+// The counters run free. Each switch folds what they advanced since the
+// last one into the outgoing process (pmu_counts in process_t), so a
+// process is charged for its own slices only. A process still running on
+// another CPU is folded there on request (reschedule IPI), as for the FPU.
+//
+// CR4.PCE lets ring 3 use rdpmc on the raw counters: pmu_rdpmc_index()
+// gives the ECX for an event. Raw values are per CPU, not per process, so
+// they time a stretch of code between two reads in the same slice.
+//
+// dTLB misses have no architectural event; PMU_DTLB_EVENT is the
+// load-walk encoding of the Nehalem to Skylake cores and counts something
+// else, or nothing, elsewhere.
+typedef enum {
+    PMU_CYCLES = 0,             // Unhalted core cycles
+    PMU_INSTRUCTIONS,           // Instructions retired
+    PMU_LLC_MISSES,             // Last level cache misses
+    PMU_BRANCH_MISSES,          // Mispredicted branches retired
+    PMU_DTLB_MISSES,            // dTLB load misses causing a page walk
+    PMU_EVENTS
+} pmu_event_t;
+
+// CPUID.0AH
+#define CPUID_LEAF_PMU          0x0A
+#define PMU_EBX_CYCLES_NA       (1 << 0)    // Set: the architectural event is absent
+#define PMU_EBX_INSTR_NA        (1 << 1)
+#define PMU_EBX_LLC_MISS_NA     (1 << 4)
+#define PMU_EBX_BRANCH_MISS_NA  (1 << 6)
+
+// Event select (event | umask << 8)
+#define PMU_CYCLES_EVENT        0x003C
+#define PMU_INSTR_EVENT         0x00C0
+#define PMU_LLC_MISS_EVENT      0x412E
+#define PMU_BRANCH_MISS_EVENT   0x00C5
+#define PMU_DTLB_EVENT          0x0108
+
+#define PMU_EVTSEL_USR          (1 << 16)
+#define PMU_EVTSEL_OS           (1 << 17)
+#define PMU_EVTSEL_EN           (1 << 22)
+
+#define MSR_IA32_PMC0           0xC1
+#define MSR_IA32_PERFEVTSEL0    0x186
+#define MSR_IA32_FIXED_CTR0     0x309       // Instructions; CTR1 cycles
+#define MSR_IA32_FIXED_CTR_CTRL 0x38D       // 4 bits per fixed counter
+#define MSR_IA32_PERF_GLOBAL_CTRL 0x38F     // Version 2 on
+#define PMU_FIXED_OS_USR        0x3
+#define PMU_GLOBAL_FIXED_SHIFT  32
+
+#define PMU_RDPMC_FIXED         (1u << 30)  // rdpmc ECX: fixed counter bank
+#define PMU_FOLD_TIMEOUT_US     1000        // Waiting on another CPU's fold
+
+struct process;
+
+bool pmu_init(void);                // Detect and program the boot CPU
+void pmu_init_cpu(void);            // Per CPU (also run on each AP)
+bool pmu_available(void);
+bool pmu_event_supported(pmu_event_t event);
+const char* pmu_event_name(pmu_event_t event);
+
+// rdpmc ECX for an event, or -1 where it is not counted
+int32_t pmu_rdpmc_index(pmu_event_t event);
+
+void pmu_switch(struct process* prev);      // Before context_switch, interrupts off
+void pmu_flush_requests(void);              // Reschedule IPI: fold for another CPU
+
+// A process's counts to date, its running slice included
+void pmu_read_process(struct process* process, uint64_t counts[PMU_EVENTS]);
+
+void pmu_print_info(void);
+void pmu_print_process(struct process* process);
+
+#endif // PMU_H
@@ -0,0 +1,46 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include "../types.h"
+#include "cpu.h"
+
+// Sequence count for data with one writer and any number of readers. The
+// writer makes the count odd, updates the data in place and makes it even
+// again; a reader copies the data between two reads of the count and
+// retries if it was odd or moved. Readers store nothing, so they neither
+// block the writer nor bounce its line between CPUs.
+//
+// The writer must be alone (or hold a lock of its own) and must not be
+// interrupted by a reader on its CPU, which would spin forever. x86 keeps
+// stores in order and loads in order, so only the compiler needs fencing.
+typedef struct {
+    volatile uint32_t sequence;
+} seqcount_t;
+
+#define SEQCOUNT_INIT { 0 }
+
+static inline void write_seqcount_begin(seqcount_t* s) {
+    s->sequence = s->sequence + 1;
+    compiler_barrier();
+}
+
+static inline void write_seqcount_end(seqcount_t* s) {
+    store_release(&s->sequence, s->sequence + 1);
+}
+
+// Waits out a writer in progress; pass the result to read_seqcount_retry
+static inline uint32_t read_seqcount_begin(const seqcount_t* s) {
+    uint32_t sequence;
+    while ((sequence = load_acquire(&s->sequence)) & 1) {
+        cpu_relax();
+    }
+    return sequence;
+}
+
+// True if what was read since read_seqcount_begin may be torn
+static inline bool read_seqcount_retry(const seqcount_t* s, uint32_t start) {
+    compiler_barrier();
+    return s->sequence != start;
+}
+
+#endif // SEQLOCK_H
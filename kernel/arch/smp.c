@@ -0,0 +1,235 @@
+#include "smp.h"
+#include "acpi.h"
+#include "apic.h"
+#include "gdt.h"
+#include "tsc.h"
+#include "cpu.h"
+#include "interrupts.h"
+#include "fpu.h"
+#include "pmu.h"
+#include "sysenter.h"
+#include "../proc/process.h"
+#include "../proc/tick.h"
+#include "../proc/vdso.h"
+#include "../mm/memory.h"
+#include "../mm/paging.h"
+#include "../drivers/vga.h"
+
+// Trampoline blob and its mailboxes (smp_trampoline.asm)
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint32_t smp_trampoline_stack;
+extern uint32_t smp_trampoline_cpu;
+
+// Per-CPU areas, reached through GS on each processor
+cpu_t cpus[MAX_CPUS];
+
+static const char* platform_source = "none";
+
+// Address of a trampoline mailbox in the copy at SMP_TRAMPOLINE_BASE
+static volatile uint32_t* trampoline_slot(uint32_t* symbol) {
+    return (volatile uint32_t*)(SMP_TRAMPOLINE_BASE +
+                                ((uint32_t)symbol - (uint32_t)smp_trampoline_start));
+}
+
+void smp_init_bsp(void) {
+    memset(cpus, 0, sizeof(cpus));
+
+    gdt_init();
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        cpus[i].self = &cpus[i];
+        cpus[i].id = i;
+        gdt_set_percpu(i, (uint32_t)&cpus[i], sizeof(cpu_t));
+    }
+    gdt_load_percpu(BOOT_CPU);
+    cpus[BOOT_CPU].online = true;
+}
+
+// C entry of an application processor, on its own boot stack
+void smp_ap_entry(uint32_t cpu_id) {
+    cpu_t* cpu = &cpus[cpu_id];
+
+    gdt_load();
+    gdt_load_percpu(cpu_id);
+    interrupts_load_idt();
+    lapic_init_ap();
+    fpu_init_cpu();
+    pmu_init_cpu();
+    paging_init_cpu();
+    sysenter_init_cpu();
+    vdso_init_cpu();
+    tick_init_ap();
+
+    __sync_synchronize();
+    cpu->online = true;
+
+    // This loop is the CPU's idle process until the first switch away
+    __asm__ volatile ("sti");
+    while (1) {
+        __asm__ volatile ("hlt");
+    }
+}
+
+static int smp_start_ap(uint32_t id, uint8_t apic_id) {
+    cpu_t* cpu = &cpus[id];
+    cpu->apic_id = apic_id;
+    scheduler_init_cpu(cpu);
+
+    void* stack = kmalloc(SMP_AP_STACK_SIZE);
+    process_t* idle = stack ? process_create_idle(id) : NULL;
+    if (!idle) {
+        if (stack) kfree(stack);
+        return -1;
+    }
+
+    // The idle process lives on the AP's boot stack; its slab stack stays
+    // with the table slot
+    idle->stack_base = (uint32_t)stack;
+    idle->stack_size = SMP_AP_STACK_SIZE;
+
+    *trampoline_slot(&smp_trampoline_stack) = (uint32_t)stack + SMP_AP_STACK_SIZE;
+    *trampoline_slot(&smp_trampoline_cpu) = id;
+
+    // INIT-SIPI-SIPI
+    lapic_send_init(apic_id);
+    tsc_delay_us(SMP_INIT_DELAY_US);
+    for (int attempt = 0; attempt < 2 && !cpu->online; attempt++) {
+        lapic_send_startup(apic_id, SMP_TRAMPOLINE_BASE >> 12);
+        tsc_delay_us(SMP_SIPI_DELAY_US);
+    }
+
+    for (uint32_t waited = 0; !cpu->online && waited < SMP_AP_TIMEOUT_US; waited += 100) {
+        tsc_delay_us(100);
+    }
+    if (cpu->online) {
+        return 0;
+    }
+
+    cpu->idle = NULL;
+    cpu->current = NULL;
+    process_destroy(idle);
+    return -1;
+}
+
+void smp_boot_aps(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("Starting application processors...\n");
+
+    platform_info_t info;
+    acpi_discover(&info);
+    platform_source = info.source;
+    cpus[BOOT_CPU].apic_id = lapic_id();
+
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("Platform tables: ");
+    vga_write_string(info.source);
+    vga_write_string(", ");
+    print_dec(info.cpu_count);
+    vga_write_string(" processor(s)\n");
+
+    if (info.cpu_count > 1 && (!lapic_available() || !tsc_available())) {
+        vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
+        vga_write_string("SMP needs the LAPIC timer and TSC clocksource, staying uniprocessor\n");
+        return;
+    }
+
+    if (info.cpu_count > 1) {
+        memcpy((void*)SMP_TRAMPOLINE_BASE, smp_trampoline_start,
+               (uint32_t)smp_trampoline_end - (uint32_t)smp_trampoline_start);
+    }
+
+    uint32_t next_id = BOOT_CPU + 1;
+    for (uint32_t i = 0; i < info.cpu_count && next_id < MAX_CPUS; i++) {
+        uint8_t apic_id = info.cpu_apic_ids[i];
+        if (apic_id == cpus[BOOT_CPU].apic_id) continue;
+
+        if (smp_start_ap(next_id, apic_id) == 0) {
+            next_id++;
+        } else {
+            vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+            vga_write_string("CPU with APIC ID ");
+            print_dec(apic_id);
+            vga_write_string(" did not start\n");
+        }
+    }
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    print_dec(smp_cpu_count());
+    vga_write_string(" CPU(s) online\n");
+}
+
+uint32_t smp_cpu_count(void) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (cpus[i].online) count++;
+    }
+    return count;
+}
+
+bool smp_cpu_online(uint32_t cpu) {
+    return cpu < MAX_CPUS && cpus[cpu].online;
+}
+
+void smp_send_resched(uint32_t cpu) {
+    if (!smp_cpu_online(cpu) || cpu == this_cpu()->id) return;
+    lapic_send_ipi(cpus[cpu].apic_id, RESCHED_IPI_VECTOR);
+}
+
+void smp_resched_handler(void) {
+    irq_enter(IRQ_SRC_RESCHED);
+    irq_local_eoi(IRQ_SRC_RESCHED);
+
+    this_cpu()->resched_ipis++;
+    fpu_flush_requests();
+    pmu_flush_requests();
+    tick_handle_resched();
+}
+
+int smp_set_isolated(uint32_t cpu, bool isolated) {
+    if (cpu == BOOT_CPU || !smp_cpu_online(cpu)) return -1;
+
+    cpus[cpu].isolated = isolated;
+    if (isolated) {
+        scheduler_evict_unpinned(&cpus[cpu]);
+    }
+    // Switches its tick between nohz full and the global mode
+    smp_send_resched(cpu);
+    return 0;
+}
+
+bool smp_cpu_isolated(uint32_t cpu) {
+    return cpu < MAX_CPUS && cpus[cpu].isolated;
+}
+
+void smp_print_info(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== CPU Information ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string("Platform tables: ");
+    vga_write_string(platform_source);
+    vga_write_string("\nCPU  APIC  STATE     READY  SWITCHES  IPIS  STEALS  CURRENT\n");
+
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        cpu_t* cpu = &cpus[i];
+        if (!cpu->online) continue;
+
+        print_dec(i);
+        vga_write_string("    ");
+        print_dec(cpu->apic_id);
+        vga_write_string("     ");
+        vga_write_string(cpu->isolated ? "isolated  " : "online    ");
+        print_dec(cpu->nr_ready);
+        vga_write_string("      ");
+        print_dec(cpu->context_switches);
+        vga_write_string("         ");
+        print_dec(cpu->resched_ipis);
+        vga_write_string("     ");
+        print_dec(cpu->steals);
+        vga_write_string("/");
+        print_dec(cpu->steal_attempts);
+        vga_write_string("  ");
+        vga_write_string(cpu->current ? cpu->current->name : "-");
+        vga_write_string("\n");
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "../types.h"
+
+#define MAX_CPUS                8
+#define BOOT_CPU                0           // Logical id of the bootstrap processor
+
+// Application processor startup
+#define SMP_TRAMPOLINE_BASE     0x8000      // Real-mode entry page for the SIPI
+#define SMP_AP_STACK_SIZE       (16 * 1024)
+#define SMP_INIT_DELAY_US       10000       // INIT assert to first SIPI
+#define SMP_SIPI_DELAY_US       200         // Between the two SIPIs
+#define SMP_AP_TIMEOUT_US       100000      // How long to wait for an AP to report in
+
+#define RESCHED_IPI_VECTOR      0x31
+
+// SMP management
+void smp_init_bsp(void);            // Per-CPU area and GDT for the boot CPU, call first
+void smp_boot_aps(void);            // Discover and start the other processors
+uint32_t smp_cpu_count(void);       // Processors online
+bool smp_cpu_online(uint32_t cpu);
+void smp_send_resched(uint32_t cpu);
+void smp_resched_handler(void);     // RESCHED_IPI_VECTOR handler
+
+// Isolated cores run only their pinned tasks: no tick, no balancing and no
+// device interrupts. The boot CPU keeps the housekeeping and cannot be isolated.
+int smp_set_isolated(uint32_t cpu, bool isolated);
+bool smp_cpu_isolated(uint32_t cpu);
+void smp_print_info(void);
+
+#endif // SMP_H
@@ -0,0 +1,67 @@
+; Application processor startup trampoline
+; smp_boot_aps() copies this blob to SMP_TRAMPOLINE_BASE and sends the
+; startup IPI. The AP starts here in real mode with CS:IP = 0x0800:0000.
+
+section .text
+
+extern smp_ap_entry
+
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_stack
+global smp_trampoline_cpu
+
+TRAMPOLINE_BASE equ 0x8000
+
+; Runtime address of a label inside the copied blob
+%define TADDR(label) (TRAMPOLINE_BASE + (label) - smp_trampoline_start)
+
+[BITS 16]
+smp_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    
+    ; Temporary flat GDT living inside the blob
+    o32 lgdt [TADDR(tramp_gdt_desc)]
+    mov eax, cr0
+    or eax, 1               ; Protection enable
+    mov cr0, eax
+    jmp dword 0x08:TADDR(tramp_protected)
+
+[BITS 32]
+tramp_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    
+    ; Stack and logical CPU id were filled in by the boot CPU
+    mov esp, [TADDR(smp_trampoline_stack)]
+    push dword [TADDR(smp_trampoline_cpu)]
+    mov eax, smp_ap_entry   ; Absolute kernel address
+    call eax                ; Never returns
+    
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+align 8
+tramp_gdt:
+    dq 0x0000000000000000   ; Null descriptor
+    dq 0x00CF9A000000FFFF   ; Code segment (0x08)
+    dq 0x00CF92000000FFFF   ; Data segment (0x10)
+tramp_gdt_desc:
+    dw tramp_gdt_desc - tramp_gdt - 1
+    dd TADDR(tramp_gdt)
+
+align 4
+smp_trampoline_stack:
+    dd 0                    ; Top of this AP's boot stack
+smp_trampoline_cpu:
+    dd 0                    ; Logical CPU id
+smp_trampoline_end:
@@ -0,0 +1,48 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "../types.h"
+#include "cpu.h"
+
+// Test-and-test-and-set spinlock. Locks that interrupt handlers also take
+// must be held with interrupts off (spin_lock_irqsave) or the handler can
+// spin forever on its own CPU.
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_lock_init(spinlock_t* lock) {
+    lock->locked = 0;
+}
+
+static inline void spin_lock(spinlock_t* lock) {
+    while (__sync_lock_test_and_set(&lock->locked, 1)) {
+        // Spin on a plain read so the line stays shared until it is released
+        while (lock->locked) {
+            cpu_relax();
+        }
+    }
+}
+
+static inline bool spin_trylock(spinlock_t* lock) {
+    return __sync_lock_test_and_set(&lock->locked, 1) == 0;
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    __sync_lock_release(&lock->locked);
+}
+
+static inline uint32_t spin_lock_irqsave(spinlock_t* lock) {
+    uint32_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif // SPINLOCK_H
@@ -3,6 +3,10 @@ section .text
 
 extern syscall_handler
 global syscall_interrupt_handler
+global sysenter_entry
+global sysenter_call
+global syscall_bench_ring3
+global bench_ring3_exit
 
 ; System call interrupt handler (int 0x80)
 ; Arguments are passed in registers: EAX=syscall_num, EBX=arg1, ECX=arg2, EDX=arg3, ESI=arg4
@@ -22,12 +26,18 @@ syscall_interrupt_handler:
     push fs
     push gs
     
-    ; Set up kernel data segments
-    mov ax, 0x10    ; Kernel data segment
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
+    ; Set up kernel data segments (EDI is saved, EAX still holds the number)
+    mov di, 0x10    ; Kernel data segment
+    mov ds, di
+    mov es, di
+    mov fs, di
+    
+    ; From ring 3 GS was nulled on the way out: the TSS stack top holds
+    ; this CPU's per-CPU selector, just above the 64 byte frame
+    test byte [esp + 48], 3
+    jz .kernel_gs
+    mov gs, word [esp + 64]
+.kernel_gs:
     
     ; Prepare arguments for syscall_handler
     ; Arguments are already in the right registers from user space
@@ -62,4 +72,132 @@ syscall_interrupt_handler:
     pop ebp
     
     ; Return to user space
-    iret
\ No newline at end of file
+    iret
+
+; SYSENTER entry (ring 3 only, see sysenter_call)
+; CPU loaded CS=0x08, SS=0x10, ESP=this CPU's entry stack top, IF=0.
+; EBP points at the caller's frame: [ebp]=eflags, +4 ebp, +8 edx, +12 ecx
+sysenter_entry:
+    push ds
+    push es
+    push fs
+    push gs
+    mov gs, word [esp + 16]     ; Per-CPU selector at the stack top
+    push ss
+    pop ds
+    push ss
+    pop es
+    push ss
+    pop fs
+    
+    push esi                    ; arg4
+    push dword [ebp + 8]        ; arg3 (EDX)
+    push dword [ebp + 12]       ; arg2 (ECX)
+    push ebx                    ; arg1
+    push eax                    ; syscall_num
+    call syscall_handler
+    add esp, 20
+    
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    
+    mov edx, sysenter_return    ; SYSEXIT: EIP=EDX, ESP=ECX
+    mov ecx, ebp
+    test dword [ebp], 0x200     ; Caller had interrupts on?
+    jz .exit
+    sti                         ; Takes effect after sysexit
+.exit:
+    sysexit
+
+; Ring 3 side of SYSENTER: registers as for int 0x80, only EAX changes
+sysenter_call:
+    push ecx
+    push edx
+    push ebp
+    pushfd
+    mov ebp, esp
+    sysenter
+sysenter_return:
+    popfd
+    pop ebp
+    pop edx
+    pop ecx
+    ret
+
+; uint64_t syscall_bench_ring3(uint32_t iterations, uint32_t use_sysenter)
+; Drops to ring 3 with interrupts off, times 'iterations' SYS_GETPID calls
+; and comes back through int 0x81 with the cycle count in EDX:EAX
+syscall_bench_ring3:
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov esi, [esp + 20]         ; iterations
+    mov edi, [esp + 24]         ; use_sysenter
+    mov [bench_saved_esp], esp
+    mov [bench_saved_gs], gs
+    
+    mov ax, 0x23                ; User data
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    push dword 0x23             ; SS
+    push dword bench_user_stack_top
+    push dword 0x002            ; EFLAGS: IF clear
+    push dword 0x1B             ; CS: user code
+    push dword bench_user_loop
+    iret
+
+bench_user_loop:
+    rdtsc
+    mov ebx, eax
+    mov ebp, edx
+.loop:
+    test esi, esi
+    jz .done
+    mov eax, 5                  ; SYS_GETPID
+    test edi, edi
+    jnz .fast
+    int 0x80
+    jmp .next
+.fast:
+    call sysenter_call
+.next:
+    dec esi
+    jmp .loop
+.done:
+    rdtsc
+    sub eax, ebx
+    sbb edx, ebp
+    int 0x81
+
+; int 0x81: leave the ring 3 benchmark (EDX:EAX preserved)
+bench_ring3_exit:
+    cmp dword [ss:bench_saved_esp], 0
+    jne .resume
+    iret                        ; Nobody is waiting for it
+.resume:
+    mov cx, 0x10
+    mov ds, cx
+    mov es, cx
+    mov fs, cx
+    mov gs, word [bench_saved_gs]
+    mov esp, [bench_saved_esp]
+    mov dword [bench_saved_esp], 0
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+
+section .data
+bench_saved_esp: dd 0
+bench_saved_gs:  dd 0
+
+section .bss
+align 16
+bench_user_stack:
+    resb 4096
+bench_user_stack_top:
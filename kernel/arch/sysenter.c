@@ -0,0 +1,128 @@
+#include "sysenter.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "smp.h"
+#include "tsc.h"
+#include "div64.h"
+#include "../proc/process.h"
+#include "../proc/syscalls.h"
+#include "../proc/vdso.h"
+#include "../drivers/vga.h"
+
+bool syscall_sysenter_enabled = false;     // Read by syscall() in syscalls.h
+
+static uint8_t entry_stacks[MAX_CPUS][SYSCALL_ENTRY_STACK_SIZE] __attribute__((aligned(16)));
+
+extern void sysenter_entry(void);
+extern uint64_t syscall_bench_ring3(uint32_t iterations, uint32_t use_sysenter);
+
+bool sysenter_available(void) {
+    return syscall_sysenter_enabled;
+}
+
+// Early Pentium Pro parts report SEP without implementing it
+static bool sep_supported(void) {
+    uint32_t eax, edx;
+    cpuid(1, &eax, NULL, NULL, &edx);
+    if (!(edx & CPUID_EDX_SEP)) return false;
+
+    uint32_t family = (eax >> 8) & 0xF;
+    uint32_t model = (eax >> 4) & 0xF;
+    uint32_t stepping = eax & 0xF;
+    return !(family == 6 && model < 3 && stepping < 3);
+}
+
+void sysenter_init_cpu(void) {
+    uint32_t cpu = this_cpu()->id;
+
+    // The word at the stack top tells both entry paths which GS to load
+    uint32_t* top = (uint32_t*)&entry_stacks[cpu][SYSCALL_ENTRY_STACK_SIZE - 16];
+    *top = GDT_PERCPU_SELECTOR(cpu);
+    gdt_load_tss(cpu, (uint32_t)top);
+
+    if (syscall_sysenter_enabled) {
+        wrmsr(MSR_IA32_SYSENTER_CS, GDT_KERNEL_CODE);
+        wrmsr(MSR_IA32_SYSENTER_ESP, (uint32_t)top);
+        wrmsr(MSR_IA32_SYSENTER_EIP, (uint32_t)sysenter_entry);
+    }
+}
+
+bool sysenter_init(void) {
+    syscall_sysenter_enabled = sep_supported();
+    sysenter_init_cpu();
+
+    if (syscall_sysenter_enabled) {
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_write_string("Fast system calls: SYSENTER/SYSEXIT\n");
+    } else {
+        vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
+        vga_write_string("No SYSENTER, system calls use int 0x80\n");
+    }
+    return syscall_sysenter_enabled;
+}
+
+static void bench_report(const char* label, uint64_t cycles, uint32_t iterations) {
+    vga_write_string(label);
+    print_dec((uint32_t)div_u64_u32(cycles, iterations, NULL));
+    vga_write_string(" cycles  ");
+    print_dec((uint32_t)div_u64_u32(tsc_cycles_to_ns(cycles), iterations, NULL));
+    vga_write_string(" ns\n");
+}
+
+void syscall_bench(uint32_t iterations) {
+    if (!tsc_available()) {
+        vga_write_string("sysbench needs a calibrated TSC\n");
+        return;
+    }
+    if (iterations == 0) iterations = SYSCALL_BENCH_ITERATIONS;
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== System Call Cost (SYS_GETPID x ");
+    print_dec(iterations);
+    vga_write_string(") ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    // Interrupts off throughout: only the entry paths are measured
+    uint32_t flags = irq_save();
+
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint32_t result;
+        __asm__ volatile ("int $0x80" : "=a"(result) : "a"(SYS_GETPID), "b"(0), "c"(0), "d"(0), "S"(0) : "memory");
+    }
+    uint64_t trap_ring0 = rdtsc() - start;
+
+    start = rdtsc();
+    for (uint32_t i = 0; i < iterations; i++) {
+        syscall(SYS_GETPID, 0, 0, 0, 0);
+    }
+    uint64_t direct = rdtsc() - start;
+
+    start = rdtsc();
+    for (uint32_t i = 0; i < iterations; i++) {
+        vdso_getpid();
+    }
+    uint64_t page_pid = rdtsc() - start;
+
+    start = rdtsc();
+    for (uint32_t i = 0; i < iterations; i++) {
+        vdso_time_ns();
+    }
+    uint64_t page_time = rdtsc() - start;
+
+    uint64_t trap_ring3 = syscall_bench_ring3(iterations, 0);
+    uint64_t fast_ring3 = syscall_sysenter_enabled ? syscall_bench_ring3(iterations, 1) : 0;
+
+    irq_restore(flags);
+
+    bench_report("int 0x80, ring 0:   ", trap_ring0, iterations);
+    bench_report("direct, ring 0:     ", direct, iterations);
+    bench_report("int 0x80, ring 3:   ", trap_ring3, iterations);
+    if (syscall_sysenter_enabled) {
+        bench_report("sysenter, ring 3:   ", fast_ring3, iterations);
+    } else {
+        vga_write_string("sysenter, ring 3:   unsupported\n");
+    }
+    bench_report("data page getpid:   ", page_pid, iterations);
+    bench_report("data page time_ns:  ", page_time, iterations);
+}
@@ -0,0 +1,25 @@
+#ifndef SYSENTER_H
+#define SYSENTER_H
+
+#include "../types.h"
+
+#define SYSCALL_ENTRY_STACK_SIZE 4096   // Per CPU ring 0 stack for entries from ring 3
+#define SYSCALL_BENCH_ITERATIONS 10000
+#define SYSCALL_BENCH_EXIT_VECTOR 0x81  // Ring 3 benchmark loop returns through this
+
+// Fast system call entry. Every CPU gets a TSS and the SYSENTER MSRs; ring 3
+// code enters through sysenter_call (see syscall() in syscalls.h) and falls
+// back to int 0x80 when the CPU lacks SEP. Both entry paths find the per-CPU
+// GS selector stored at the top of the CPU's entry stack.
+//
+// Processes still run in ring 0, so the entry stack is only ever used by
+// one caller at a time (the benchmark); a ring 3 process model needs the
+// TSS ring 0 stack switched per process.
+bool sysenter_init(void);           // Boot CPU: detect SEP, set up this CPU
+void sysenter_init_cpu(void);       // Every CPU: TSS, and MSRs if SEP works
+bool sysenter_available(void);
+
+// Null system call cost through every entry path
+void syscall_bench(uint32_t iterations);
+
+#endif // SYSENTER_H
@@ -0,0 +1,162 @@
+#include "tsc.h"
+#include "cpu.h"
+#include "pit.h"
+#include "div64.h"
+#include "../proc/tick.h"
+#include "../drivers/vga.h"
+
+static bool tsc_enabled = false;
+static bool tsc_invariant = false;
+static uint64_t tsc_base = 0;       // TSC value that maps to ktime 0
+static uint32_t tsc_khz = 0;
+static uint32_t tsc_mult = 0;       // ns = (cycles * tsc_mult) >> tsc_shift
+static uint32_t tsc_shift = 0;
+static uint64_t tsc_max_ns = 0;     // Largest ns that converts back without overflow
+
+bool tsc_available(void) {
+    return tsc_enabled;
+}
+
+bool tsc_is_invariant(void) {
+    return tsc_invariant;
+}
+
+uint32_t tsc_get_khz(void) {
+    return tsc_khz;
+}
+
+// Count TSC cycles across one PIT channel 2 window
+static uint64_t tsc_measure_window(void) {
+    uint32_t flags = irq_save();
+    pit_calibration_start(TSC_CALIBRATION_MS);
+    uint64_t start = rdtsc();
+    while (!pit_calibration_expired()) {
+        cpu_relax();
+    }
+    uint64_t end = rdtsc();
+    irq_restore(flags);
+    return end - start;
+}
+
+bool tsc_init(void) {
+    uint32_t eax, edx;
+
+    cpuid(1, NULL, NULL, NULL, &edx);
+    if (!(edx & CPUID_EDX_TSC)) {
+        vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
+        vga_write_string("No TSC, ktime falls back to the tick clock\n");
+        return false;
+    }
+
+    cpuid(0x80000000, &eax, NULL, NULL, NULL);
+    if (eax >= 0x80000007) {
+        cpuid(0x80000007, NULL, NULL, NULL, &edx);
+        tsc_invariant = (edx & CPUID_EXT_EDX_INVARIANT_TSC) != 0;
+    }
+
+    // Take the shortest of several windows: SMIs and emulator exits only
+    // ever make a window look longer
+    uint64_t best = 0;
+    for (int i = 0; i < TSC_CALIBRATION_RUNS; i++) {
+        uint64_t cycles = tsc_measure_window();
+        if (best == 0 || cycles < best) {
+            best = cycles;
+        }
+    }
+
+    uint64_t khz = div_u64_u32(best, TSC_CALIBRATION_MS, NULL);
+    if (khz == 0 || (khz >> 32) != 0) {
+        vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
+        vga_write_string("TSC calibration failed\n");
+        return false;
+    }
+    tsc_khz = (uint32_t)khz;
+
+    // Largest shift whose multiplier still fits in 32 bits gives the best
+    // precision: mult = (NSEC_PER_MSEC << shift) / khz
+    for (tsc_shift = 32; tsc_shift > 0; tsc_shift--) {
+        uint64_t mult = div_u64_u32((uint64_t)NSEC_PER_MSEC << tsc_shift, tsc_khz, NULL);
+        if ((mult >> 32) == 0) {
+            tsc_mult = (uint32_t)mult;
+            break;
+        }
+    }
+
+    tsc_max_ns = div_u64_u32(0xFFFFFFFFFFFFFFFFULL, tsc_khz, NULL);
+    tsc_base = rdtsc();
+    tsc_enabled = true;
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    vga_write_string("TSC clocksource: ");
+    print_dec(tsc_khz / 1000);
+    vga_write_string(" MHz");
+    vga_write_string(tsc_invariant ? " (invariant)\n" : " (not invariant)\n");
+    return true;
+}
+
+uint64_t tsc_cycles_to_ns(uint64_t cycles) {
+    return mul_u64_u32_shr(cycles, tsc_mult, tsc_shift);
+}
+
+uint64_t tsc_ns_to_cycles(uint64_t ns) {
+    if (tsc_khz == 0) return 0;
+    if (ns > tsc_max_ns) {
+        return 0xFFFFFFFFFFFFFFFFULL;
+    }
+    return div_u64_u32(ns * tsc_khz, NSEC_PER_MSEC, NULL);
+}
+
+// What ktime_ns() converts with, for readers outside the kernel
+void tsc_get_calibration(uint64_t* base, uint32_t* mult, uint32_t* shift) {
+    *base = tsc_base;
+    *mult = tsc_mult;
+    *shift = tsc_shift;
+}
+
+void tsc_delay_us(uint32_t us) {
+    if (!tsc_enabled) return;
+    uint64_t end = rdtsc() + tsc_ns_to_cycles((uint64_t)us * NSEC_PER_USEC);
+    while ((int64_t)(rdtsc() - end) < 0) {
+        cpu_relax();
+    }
+}
+
+uint64_t ktime_ns(void) {
+    if (!tsc_enabled) {
+        return (uint64_t)tick_get_time_ms() * NSEC_PER_MSEC;
+    }
+    return tsc_cycles_to_ns(rdtsc() - tsc_base);
+}
+
+uint64_t ktime_from_tsc(uint64_t tsc) {
+    if (!tsc_enabled || tsc < tsc_base) {
+        return ktime_ns();
+    }
+    return tsc_cycles_to_ns(tsc - tsc_base);
+}
+
+void print_duration_ns(uint64_t ns) {
+    if (ns < 10000) {
+        print_dec((uint32_t)ns);
+        vga_write_string("ns");
+    } else if (ns < 10000000) {
+        print_dec((uint32_t)div_u64_u32(ns, NSEC_PER_USEC, NULL));
+        vga_write_string("us");
+    } else {
+        print_dec((uint32_t)div_u64_u32(ns, NSEC_PER_MSEC, NULL));
+        vga_write_string("ms");
+    }
+}
+
+uint64_t log2_hist_percentile(const uint32_t* buckets, uint32_t bucket_count, uint32_t count,
+                              uint32_t per_mille) {
+    uint32_t target = (uint32_t)div_u64_u32((uint64_t)count * per_mille + 999, 1000, NULL);
+    uint32_t seen = 0;
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        seen += buckets[i];
+        if (seen >= target) {
+            return 1ULL << i;
+        }
+    }
+    return 1ULL << (bucket_count - 1);
+}
@@ -0,0 +1,42 @@
+#ifndef TSC_H
+#define TSC_H
+
+#include "../types.h"
+
+#define TSC_CALIBRATION_MS      10
+#define TSC_CALIBRATION_RUNS    3
+
+#define NSEC_PER_USEC           1000
+#define NSEC_PER_MSEC           1000000
+
+// TSC clocksource
+bool tsc_init(void);
+bool tsc_available(void);
+bool tsc_is_invariant(void);
+uint32_t tsc_get_khz(void);
+
+// Monotonic nanoseconds since TSC calibration (falls back to the tick
+// clock at millisecond resolution when no usable TSC is present)
+uint64_t ktime_ns(void);
+uint64_t ktime_from_tsc(uint64_t tsc);      // A TSC reading on the ktime_ns scale
+uint64_t tsc_cycles_to_ns(uint64_t cycles);
+uint64_t tsc_ns_to_cycles(uint64_t ns);
+void tsc_get_calibration(uint64_t* base, uint32_t* mult, uint32_t* shift);
+void tsc_delay_us(uint32_t us);     // Busy wait (needs a calibrated TSC)
+
+// Compact duration: ns below 10us, us below 10ms, ms beyond
+void print_duration_ns(uint64_t ns);
+
+// Latency histograms with log2 buckets, bucket i counting values below
+// 2^i: the upper edge of the bucket holding the given fraction (per mille)
+// of 'count' samples
+uint64_t log2_hist_percentile(const uint32_t* buckets, uint32_t bucket_count, uint32_t count,
+                              uint32_t per_mille);
+
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    __asm__ volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+#endif // TSC_H
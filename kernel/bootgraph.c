@@ -0,0 +1,255 @@
+#include "bootgraph.h"
+#include "drivers/vga.h"
+#include "mm/memory.h"
+#include "proc/process.h"
+#include "proc/scheduler.h"
+#include "proc/futex.h"
+#include "arch/cpu.h"
+#include "arch/smp.h"
+#include "arch/tsc.h"
+#include "arch/div64.h"
+#include "arch/interrupts.h"
+
+typedef struct {
+    volatile uint32_t state;    // boot_state_t
+    int32_t result;
+    uint32_t cpu;
+    uint64_t start_tsc;
+    uint64_t end_tsc;
+} boot_record_t;
+
+static const boot_stage_t* boot_stages = NULL;
+static uint32_t boot_count = 0;
+static boot_record_t boot_records[BOOT_MAX_STAGES];
+static uint64_t boot_entry_tsc = 0;
+static uint64_t boot_ready_tsc = 0;         // Critical path through
+static volatile uint32_t boot_sealed = 0;   // Every stage reached
+static volatile uint32_t boot_progress = 0; // Bumped at each stage change
+static uint32_t boot_workers = 0;
+static boot_loader_header_t boot_loader;
+static bool boot_from_disk = false;
+
+void boot_begin(void) {
+    boot_entry_tsc = rdtsc();
+}
+
+void boot_note_loader(const boot_loader_header_t* header) {
+    if (header) {
+        boot_loader = *header;
+        boot_from_disk = true;
+    }
+}
+
+static void boot_set_state(uint32_t stage, boot_state_t state) {
+    store_release(&boot_records[stage].state, state);
+    __sync_fetch_and_add(&boot_progress, 1);
+    if (boot_workers) {
+        futex_wake(&boot_progress, BOOT_WORKERS);
+    }
+}
+
+// 1: all done, 0: not yet, -1: one failed or was skipped
+static int boot_deps(uint32_t stage) {
+    uint32_t after = boot_stages[stage].after;
+    int ready = 1;
+    for (uint32_t d = 0; d < boot_count; d++) {
+        if (!(after & BOOT_AFTER(d))) continue;
+        uint32_t state = load_acquire(&boot_records[d].state);
+        if (state == BOOT_FAILED || state == BOOT_SKIPPED) return -1;
+        if (state != BOOT_DONE) ready = 0;
+    }
+    return ready;
+}
+
+static void boot_execute(uint32_t stage) {
+    boot_record_t* record = &boot_records[stage];
+    record->cpu = this_cpu()->id;
+    record->start_tsc = rdtsc();
+    record->result = boot_stages[stage].init();
+    record->end_tsc = rdtsc();
+    boot_set_state(stage, record->result == 0 ? BOOT_DONE : BOOT_FAILED);
+}
+
+// Claim one deferred stage that can go, and run it; false if none can
+static bool boot_run_one(void) {
+    for (uint32_t i = 0; i < boot_count; i++) {
+        if (load_acquire(&boot_records[i].state) != BOOT_READY) continue;
+        int deps = boot_deps(i);
+        if (deps == 0) continue;
+
+        uint32_t next = deps < 0 ? BOOT_SKIPPED : BOOT_RUNNING;
+        if (!__sync_bool_compare_and_swap(&boot_records[i].state, BOOT_READY, next)) continue;
+        if (deps < 0) {
+            boot_set_state(i, BOOT_SKIPPED);
+        } else {
+            boot_execute(i);
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool boot_settled(void) {
+    if (!load_acquire(&boot_sealed)) return false;
+    for (uint32_t i = 0; i < boot_count; i++) {
+        if (load_acquire(&boot_records[i].state) < BOOT_DONE) return false;
+    }
+    return true;
+}
+
+// Runs what it can, sleeps until a stage changes, and is gone once every
+// stage has finished
+static void boot_worker(void) {
+    for (;;) {
+        uint32_t seen = load_acquire(&boot_progress);
+        if (boot_run_one()) continue;
+        if (boot_settled()) return;
+        futex_wait(&boot_progress, seen, BOOT_WAIT_MS);
+    }
+}
+
+static void boot_spawn(uint32_t cpu) {
+    process_t* task = process_create("bootwork", boot_worker, PRIORITY_LOW);
+    if (!task) return;
+    scheduler_set_affinity(task, (int32_t)cpu);
+    boot_workers++;
+    scheduler_add_process(task);
+}
+
+// Free application processors from the top down; the boot CPU only when
+// 'boot_cpu' says the critical path is through
+static void boot_start_workers(bool boot_cpu) {
+    if (boot_workers) return;
+
+    uint32_t feed = irq_feed_cpu(), spare = 0;
+    for (uint32_t cpu = BOOT_CPU + 1; cpu < MAX_CPUS; cpu++) {
+        if (smp_cpu_online(cpu) && !smp_cpu_isolated(cpu)) spare++;
+    }
+    for (uint32_t cpu = MAX_CPUS - 1; cpu > BOOT_CPU && boot_workers < BOOT_WORKERS; cpu--) {
+        if (!smp_cpu_online(cpu) || smp_cpu_isolated(cpu)) continue;
+        if (cpu == feed && spare > 1) continue;
+        boot_spawn(cpu);
+    }
+    if (!boot_workers && boot_cpu) {
+        boot_spawn(BOOT_CPU);
+    }
+}
+
+void boot_run(const boot_stage_t* stages, uint32_t count) {
+    boot_stages = stages;
+    boot_count = count < BOOT_MAX_STAGES ? count : BOOT_MAX_STAGES;
+
+    for (uint32_t i = 0; i < boot_count; i++) {
+        if (stages[i].deferred) {
+            // Before the APs are up nobody takes it yet
+            boot_set_state(i, BOOT_READY);
+            boot_start_workers(false);
+            continue;
+        }
+
+        // Nothing to wait with on the boot path: a need not met skips it
+        if (boot_deps(i) <= 0) {
+            boot_set_state(i, BOOT_SKIPPED);
+            continue;
+        }
+        boot_set_state(i, BOOT_RUNNING);
+        boot_execute(i);
+    }
+
+    boot_ready_tsc = rdtsc();
+    store_release(&boot_sealed, 1);
+    boot_start_workers(true);
+    if (boot_workers) {
+        futex_wake(&boot_progress, BOOT_WORKERS);
+    }
+}
+
+static int boot_find(const char* name) {
+    for (uint32_t i = 0; i < boot_count; i++) {
+        if (strcmp(boot_stages[i].name, name) == 0) return (int)i;
+    }
+    return -1;
+}
+
+boot_state_t boot_stage_state(const char* name) {
+    int i = boot_find(name);
+    return i < 0 ? BOOT_PENDING : (boot_state_t)load_acquire(&boot_records[i].state);
+}
+
+// The workers get the CPU at the next interrupt if they share it
+bool boot_wait(const char* name) {
+    int i = boot_find(name);
+    if (i < 0) return true;
+    while (load_acquire(&boot_records[i].state) < BOOT_DONE) {
+        __asm__ volatile ("hlt");
+    }
+    return boot_records[i].state == BOOT_DONE;
+}
+
+static void print_since_entry(uint64_t tsc) {
+    print_duration_ns(tsc_cycles_to_ns(tsc - boot_entry_tsc));
+}
+
+static void pad(uint32_t written, uint32_t width) {
+    while (written++ < width) vga_write_string(" ");
+}
+
+void boot_print_info(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Boot ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    if (!tsc_available()) {
+        vga_write_string("Needs a calibrated TSC\n");
+        return;
+    }
+
+    if (boot_from_disk && boot_loader.end_tsc > boot_loader.start_tsc) {
+        vga_write_string("Loaded from disk: ");
+        print_dec(boot_loader.sectors / 2);
+        vga_write_string(" KB in ");
+        print_dec(boot_loader.reads);
+        vga_write_string(" reads, ");
+        print_duration_ns(tsc_cycles_to_ns(boot_loader.end_tsc - boot_loader.start_tsc));
+        vga_write_string(", kernel entry ");
+        print_duration_ns(tsc_cycles_to_ns(boot_entry_tsc - boot_loader.end_tsc));
+        vga_write_string(" later\n");
+    }
+
+    vga_write_string("STAGE          CPU  START    TOOK\n");
+    uint64_t last_end = boot_ready_tsc;
+    for (uint32_t i = 0; i < boot_count; i++) {
+        const boot_record_t* record = &boot_records[i];
+        uint32_t state = load_acquire(&record->state);
+        vga_write_string(boot_stages[i].name);
+        pad(strlen(boot_stages[i].name), 15);
+
+        if (state == BOOT_DONE || state == BOOT_FAILED) {
+            print_dec(record->cpu);
+            vga_write_string(boot_stages[i].deferred ? "*   " : "    ");
+            print_since_entry(record->start_tsc);
+            vga_write_string("  ");
+            print_duration_ns(tsc_cycles_to_ns(record->end_tsc - record->start_tsc));
+            if (record->end_tsc > last_end) last_end = record->end_tsc;
+        }
+        switch (state) {
+            case BOOT_FAILED:
+                vga_write_string("  failed (");
+                if (record->result < 0) vga_write_string("-");
+                print_dec((uint32_t)(record->result < 0 ? -record->result : record->result));
+                vga_write_string(")");
+                break;
+            case BOOT_SKIPPED: vga_write_string("skipped, a dependency failed"); break;
+            case BOOT_RUNNING: vga_write_string("running"); break;
+            case BOOT_READY: vga_write_string("waiting"); break;
+            case BOOT_PENDING: vga_write_string("not reached"); break;
+        }
+        vga_write_string("\n");
+    }
+
+    vga_write_string("* deferred. Critical path through at ");
+    print_since_entry(boot_ready_tsc);
+    vga_write_string(boot_settled() ? ", everything by " : ", deferred work still going at ");
+    print_since_entry(last_end);
+    vga_write_string("\n");
+}
@@ -0,0 +1,73 @@
+#ifndef BOOTGRAPH_H
+#define BOOTGRAPH_H
+
+#include "types.h"
+
+// Boot as a dependency graph of stages. kernel_main hands boot_run its
+// table in order: synchronous stages run there and then, on the boot CPU,
+// and make up the critical path to a usable kernel (network, IPC, the
+// order journal). Deferred stages go to background workers as soon as
+// what they need is done, so the console, GUI and filesystem check come
+// up while the trading path is already live.
+//
+// The workers are PRIORITY_LOW tasks, one per application processor that
+// is free (not isolated, not the feed CPU while another is left), up to
+// BOOT_WORKERS. With a single CPU they start only once the critical path
+// is through: the boot code runs as the idle process, and would otherwise
+// lose the CPU to them at the first tick.
+//
+// Every stage is timed with the TSC from kernel entry (boot_begin); the
+// 'boot' command lists the stages, where they ran and how long they took.
+#define BOOT_MAX_STAGES         32
+#define BOOT_WORKERS            3
+#define BOOT_WAIT_MS            10          // Workers recheck at least this often
+
+#define BOOT_AFTER(stage)       (1u << (stage))
+
+// Booting from disk, arch/boot.asm hands over its header the way a
+// multiboot loader does (EAX magic, EBX pointer), with the load timed. The
+// header is built at BOOT_LOADER_HEADER, free memory past the BIOS data
+// area, as the boot sector has no room for it.
+#define BOOT_LOADER_MAGIC       0x444C4B54  // "TKLD"
+#define BOOT_LOADER_HEADER      0x0500
+
+typedef struct {
+    uint32_t sectors;           // Kernel image, from LBA 1
+    uint32_t reads;             // INT 13h extended reads
+    uint64_t start_tsc;         // Before the first read
+    uint64_t end_tsc;           // Image in place, .bss zeroed
+} __attribute__((packed)) boot_loader_header_t;
+
+typedef enum {
+    BOOT_PENDING = 0,           // Not reached yet
+    BOOT_READY,                 // Deferred, waiting for a worker or its dependencies
+    BOOT_RUNNING,
+    BOOT_DONE,
+    BOOT_FAILED,                // init returned nonzero
+    BOOT_SKIPPED                // A dependency failed or was skipped
+} boot_state_t;
+
+typedef struct {
+    const char* name;
+    int (*init)(void);          // 0 on success
+    uint32_t after;             // BOOT_AFTER() of earlier stages it needs
+    bool deferred;
+} boot_stage_t;
+
+// TSC at kernel entry, before anything else
+void boot_begin(void);
+
+// Keep the disk loader's header; it sits in memory the kernel reuses
+void boot_note_loader(const boot_loader_header_t* header);
+
+// Run the table; a synchronous stage may only need synchronous stages
+void boot_run(const boot_stage_t* stages, uint32_t count);
+
+// Wait until a stage has finished, one way or the other; true if done,
+// or if there is no such stage
+bool boot_wait(const char* name);
+boot_state_t boot_stage_state(const char* name);
+
+void boot_print_info(void);
+
+#endif // BOOTGRAPH_H
@@ -0,0 +1,271 @@
+#include "dashboard.h"
+#include "bootgraph.h"
+#include "mm/memory.h"
+#include "proc/process.h"
+#include "proc/scheduler.h"
+#include "proc/futex.h"
+#include "proc/ipc.h"
+#include "proc/portfolio.h"
+#include "proc/sched_trace.h"
+#include "arch/tsc.h"
+#include "arch/div64.h"
+
+// Widget rows in the window
+#define DASH_ROW_HEADER     0
+#define DASH_ROW_QUOTES     1
+#define DASH_ROW_TOTALS     (DASH_ROW_QUOTES + DASH_SYMBOLS + 1)
+#define DASH_ROW_LATENCY    (DASH_ROW_TOTALS + 3)
+#define DASH_ROW_STATUS     (DASH_ROW_LATENCY + SCHED_LAT_KINDS + 1)
+
+// A quoted symbol's row and the last snapshot read of it
+typedef struct {
+    uint16_t symbol;
+    uint16_t used;
+    md_snapshot_t snapshot;
+} dash_row_t;
+
+static window_t* dash_window = NULL;
+static widget_t* quote_labels[DASH_SYMBOLS];
+static widget_t* totals_labels[2];
+static widget_t* latency_labels[SCHED_LAT_KINDS];
+static widget_t* status_label = NULL;
+
+static dash_row_t rows[DASH_SYMBOLS];
+static uint32_t quote_cursor = 0;
+static uint32_t quotes_seen = 0;
+static uint32_t refreshes = 0;
+static volatile uint32_t dash_kick = 0;
+
+static const char* latency_names[SCHED_LAT_KINDS] = { "Wakeup", "Run queue" };
+
+// Formatting into a line of DASH_LINE_MAX
+
+static char line[DASH_LINE_MAX];
+
+static uint32_t put(uint32_t n, char c) {
+    if (n < DASH_LINE_MAX - 1) line[n++] = c;
+    return n;
+}
+
+static uint32_t puts_at(uint32_t n, const char* s) {
+    while (*s) n = put(n, *s++);
+    return n;
+}
+
+static uint32_t put_dec(uint32_t n, uint32_t value) {
+    char digits[10];
+    uint32_t count = 0;
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (count) n = put(n, digits[--count]);
+    return n;
+}
+
+// Whole units, signed
+static uint32_t put_amount(uint32_t n, double value) {
+    if (value < 0) {
+        n = put(n, '-');
+        value = -value;
+    }
+    return put_dec(n, (uint32_t)(value + 0.5));
+}
+
+// Hundredths, for prices
+static uint32_t put_price(uint32_t n, double value) {
+    uint32_t cents = (uint32_t)(value * 100 + 0.5);
+    n = put_dec(n, cents / 100);
+    n = put(n, '.');
+    n = put(n, (char)('0' + cents % 100 / 10));
+    return put(n, (char)('0' + cents % 10));
+}
+
+static uint32_t put_duration(uint32_t n, uint64_t ns) {
+    if (ns < 10000) {
+        return puts_at(put_dec(n, (uint32_t)ns), "ns");
+    } else if (ns < 10000000) {
+        return puts_at(put_dec(n, (uint32_t)div_u64_u32(ns, NSEC_PER_USEC, NULL)), "us");
+    }
+    return puts_at(put_dec(n, (uint32_t)div_u64_u32(ns, NSEC_PER_MSEC, NULL)), "ms");
+}
+
+// Right-align what was written since 'start' to end at column 'end'
+static uint32_t align(uint32_t start, uint32_t n, uint32_t end) {
+    if (n >= end || end >= DASH_LINE_MAX) return n;
+    uint32_t shift = end - n;
+    for (uint32_t i = n; i > start; i--) line[i - 1 + shift] = line[i - 1];
+    for (uint32_t i = start; i < start + shift; i++) line[i] = ' ';
+    return end;
+}
+
+static uint32_t pad(uint32_t n, uint32_t column) {
+    while (n < column) n = put(n, ' ');
+    return n;
+}
+
+// Lines
+
+static void format_quote(const dash_row_t* row) {
+    position_t position;
+    uint32_t n = 0, start;
+    if (!row->used) {
+        line[0] = '\0';
+        return;
+    }
+    n = put_dec(n, row->symbol);
+    start = n; n = put_price(n, row->snapshot.bid);   n = align(start, n, 16);
+    start = n; n = put_price(n, row->snapshot.ask);   n = align(start, n, 27);
+    start = n; n = put_price(n, row->snapshot.last);  n = align(start, n, 38);
+    if (portfolio_position(row->symbol, &position) == 0) {
+        start = n; n = put_amount(n, (double)position.quantity);   n = align(start, n, 47);
+        start = n; n = put_amount(n, position.unrealized_pnl);     n = align(start, n, 58);
+    }
+    line[n] = '\0';
+}
+
+static void format_totals(uint32_t which, const portfolio_totals_t* totals) {
+    uint32_t n;
+    if (which == 0) {
+        n = put_dec(puts_at(0, "Positions "), totals->positions);
+        n = put_amount(puts_at(pad(n, 16), "Realised "), totals->realized_pnl);
+        n = put_amount(puts_at(pad(n, 36), "Unrealised "), totals->unrealized_pnl);
+    } else {
+        n = put_amount(puts_at(0, "Exposure  net "), totals->net_exposure);
+        n = put_amount(puts_at(pad(n, 36), "Gross "), totals->gross_exposure);
+    }
+    line[n] = '\0';
+}
+
+// All priority bands summed
+static void format_latency(uint32_t kind) {
+    sched_lat_hist_t sum;
+    memset(&sum, 0, sizeof(sum));
+    for (uint32_t b = 0; b < SCHED_TRACE_BANDS; b++) {
+        sched_lat_hist_t hist;
+        sched_trace_get_hist((sched_lat_kind_t)kind, b, &hist);
+        sum.count += hist.count;
+        if (hist.max_ns > sum.max_ns) sum.max_ns = hist.max_ns;
+        for (uint32_t i = 0; i < SCHED_TRACE_BUCKETS; i++) {
+            sum.buckets[i] += hist.buckets[i];
+        }
+    }
+
+    uint32_t n = pad(puts_at(0, latency_names[kind]), 10);
+    if (sum.count == 0) {
+        n = puts_at(n, sched_trace_enabled() ? "no samples" : "tracing off (schedlat on)");
+    } else {
+        n = put_dec(puts_at(n, "n "), sum.count);
+        n = put_duration(puts_at(pad(n, 21), "p50 <"), sched_trace_percentile_ns(&sum, 500));
+        n = put_duration(puts_at(pad(n, 33), "p99 <"), sched_trace_percentile_ns(&sum, 990));
+        n = put_duration(puts_at(pad(n, 45), "max "), sum.max_ns);
+    }
+    line[n] = '\0';
+}
+
+// Refresh
+
+// A changed symbol keeps its row, or takes the first free one
+static void on_quote(uint16_t symbol, const md_snapshot_t* snapshot, void* ctx) {
+    (void)ctx;
+    quotes_seen++;
+    for (uint32_t i = 0; i < DASH_SYMBOLS; i++) {
+        dash_row_t* row = &rows[i];
+        if (!row->used || row->symbol == symbol) {
+            row->used = 1;
+            row->symbol = symbol;
+            row->snapshot = *snapshot;
+            return;
+        }
+    }
+}
+
+static uint32_t replace(widget_t* widget) {
+    return (uint32_t)gui_replace_widget_text(widget, dash_window, line);
+}
+
+// Read everything with the GUI unlocked, then swap in the lines that differ
+// and compose them in one frame. A row's position may move without a quote,
+// so every row is reformatted; the label only changes if its text does.
+static void dashboard_refresh(void) {
+    static char lines[DASH_SYMBOLS + 2 + SCHED_LAT_KINDS + 1][DASH_LINE_MAX];
+    uint32_t count = 0;
+
+    market_snapshot_conflate(&quote_cursor, on_quote, NULL);
+    for (uint32_t i = 0; i < DASH_SYMBOLS; i++) {
+        format_quote(&rows[i]);
+        strcpy(lines[count++], line);
+    }
+
+    portfolio_totals_t totals;
+    portfolio_totals(&totals);
+    for (uint32_t i = 0; i < 2; i++) {
+        format_totals(i, &totals);
+        strcpy(lines[count++], line);
+    }
+
+    for (uint32_t k = 0; k < SCHED_LAT_KINDS; k++) {
+        format_latency(k);
+        strcpy(lines[count++], line);
+    }
+
+    uint32_t n = put_dec(puts_at(0, "Every "), DASH_REFRESH_MS);
+    n = put_dec(puts_at(n, "ms: "), quotes_seen);
+    n = put_dec(puts_at(n, " quotes read, refresh "), ++refreshes);
+    line[n] = '\0';
+    strcpy(lines[count++], line);
+
+    uint32_t flags = gui_lock();
+    if (gui_is_desktop_active() && dash_window->visible) {
+        uint32_t changed = 0;
+        widget_t** labels[] = { quote_labels, totals_labels, latency_labels, &status_label };
+        uint32_t sizes[] = { DASH_SYMBOLS, 2, SCHED_LAT_KINDS, 1 };
+        count = 0;
+        for (uint32_t g = 0; g < 4; g++) {
+            for (uint32_t i = 0; i < sizes[g]; i++) {
+                strcpy(line, lines[count++]);
+                changed += replace(labels[g][i]);
+            }
+        }
+        if (changed) gui_compose();
+    }
+    gui_unlock(flags);
+}
+
+static void dashboard_task(void) {
+    for (;;) {
+        // Hidden or behind the shell: skip the reads as well
+        if (gui_is_desktop_active() && dash_window->visible) {
+            dashboard_refresh();
+        }
+        futex_wait(&dash_kick, 0, DASH_REFRESH_MS);
+    }
+}
+
+window_t* dashboard_create_window(void) {
+    if (dash_window) return dash_window;
+    if (!boot_wait("gui")) return NULL;     // Deferred at boot
+
+    window_t* window = gui_create_window(6, 3, 68, 20, "Market Dashboard");
+    if (!window) return NULL;
+
+    gui_create_label(window, 2, DASH_ROW_HEADER,
+                     "SYMBOL       BID        ASK       LAST      POS     UNREAL");
+    for (uint32_t i = 0; i < DASH_SYMBOLS; i++) {
+        quote_labels[i] = gui_create_label(window, 2, DASH_ROW_QUOTES + i, "");
+    }
+    for (uint32_t i = 0; i < 2; i++) {
+        totals_labels[i] = gui_create_label(window, 2, DASH_ROW_TOTALS + i, "");
+    }
+    for (uint32_t k = 0; k < SCHED_LAT_KINDS; k++) {
+        latency_labels[k] = gui_create_label(window, 2, DASH_ROW_LATENCY + k, "");
+    }
+    status_label = gui_create_label(window, 2, DASH_ROW_STATUS, "Waiting for the first refresh");
+
+    dash_window = window;
+    process_t* task = process_create("dashboard", dashboard_task, PRIORITY_LOW);
+    if (task) {
+        scheduler_add_process(task);
+    }
+    return window;
+}
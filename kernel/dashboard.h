@@ -0,0 +1,25 @@
+#ifndef DASHBOARD_H
+#define DASHBOARD_H
+
+#include "types.h"
+#include "gui.h"
+
+// Market dashboard, a desktop window: top of book and position for the
+// first DASH_SYMBOLS symbols quoted, the portfolio totals, and wakeup and
+// run queue latency percentiles from the scheduler's histograms.
+//
+// It is refreshed by a PRIORITY_LOW task at most every DASH_REFRESH_MS,
+// and only while it is on screen, so watching the book never takes time
+// from the path that trades it. Quotes come from the seqlocked snapshot
+// table, just the symbols changed since the last refresh (conflated: a
+// symbol quoted a hundred times in between costs one read). Each line is
+// a label of its own, rewritten only when its text differs, so a refresh
+// repaints the lines that changed and nothing else.
+#define DASH_SYMBOLS        8
+#define DASH_REFRESH_MS     250
+#define DASH_LINE_MAX       64
+
+// The window, created on first call and its refresh task started with it
+window_t* dashboard_create_window(void);
+
+#endif // DASHBOARD_H
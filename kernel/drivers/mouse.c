@@ -104,6 +104,7 @@ void mouse_init(void) {
 
 // Handle mouse interrupt
 void mouse_interrupt_handler(void) {
+    irq_enter(IRQ_MOUSE);
     uint8_t data = inb(MOUSE_DATA_PORT);
 
     switch (mouse_cycle) {
@@ -141,9 +142,7 @@ void mouse_interrupt_handler(void) {
             break;
     }
 
-    // Send EOI
-    outb(0x20, 0x20);
-    outb(0xA0, 0x20);
+    irq_eoi(IRQ_MOUSE);
 }
 
 // Get current mouse state
@@ -0,0 +1,159 @@
+#include "pci.h"
+#include "../net/eth.h"
+
+static uint32_t pci_address(const pci_device_t* dev, uint8_t offset) {
+    return 0x80000000u | ((uint32_t)dev->bus << 16) | ((uint32_t)dev->device << 11) |
+           ((uint32_t)dev->function << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_read32(const pci_device_t* dev, uint8_t offset) {
+    outl(PCI_CONFIG_ADDRESS, pci_address(dev, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint16_t pci_read16(const pci_device_t* dev, uint8_t offset) {
+    return (uint16_t)(pci_read32(dev, offset) >> ((offset & 2) * 8));
+}
+
+uint8_t pci_read8(const pci_device_t* dev, uint8_t offset) {
+    return (uint8_t)(pci_read32(dev, offset) >> ((offset & 3) * 8));
+}
+
+void pci_write32(const pci_device_t* dev, uint8_t offset, uint32_t value) {
+    outl(PCI_CONFIG_ADDRESS, pci_address(dev, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+void pci_write16(const pci_device_t* dev, uint8_t offset, uint16_t value) {
+    outl(PCI_CONFIG_ADDRESS, pci_address(dev, offset));
+    outw(PCI_CONFIG_DATA + (offset & 2), value);
+}
+
+// Every function present, in bus order, until 'match' takes one
+static int pci_scan(bool (*match)(const pci_device_t*, uint32_t, uint32_t), uint32_t a, uint32_t b,
+                    pci_device_t* out) {
+    pci_device_t dev;
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint32_t device = 0; device < 32; device++) {
+            for (uint32_t function = 0; function < 8; function++) {
+                dev.bus = (uint8_t)bus;
+                dev.device = (uint8_t)device;
+                dev.function = (uint8_t)function;
+                uint32_t id = pci_read32(&dev, PCI_VENDOR_ID);
+                if ((id & 0xFFFF) == PCI_NO_VENDOR) {
+                    if (function == 0) break;       // No device in this slot
+                    continue;
+                }
+
+                dev.vendor_id = (uint16_t)id;
+                dev.device_id = (uint16_t)(id >> 16);
+                if (match(&dev, a, b)) {
+                    uint8_t line = pci_read8(&dev, PCI_INTERRUPT_LINE);
+                    dev.irq = line < 16 ? line : 0xFF;
+                    *out = dev;
+                    return 0;
+                }
+                if (function == 0 && !(pci_read8(&dev, PCI_HEADER_TYPE) & PCI_HEADER_MULTI)) break;
+            }
+        }
+    }
+    return -1;
+}
+
+static bool pci_match_id(const pci_device_t* dev, uint32_t vendor_id, uint32_t device_id) {
+    return dev->vendor_id == vendor_id && (device_id == 0xFFFF || dev->device_id == device_id);
+}
+
+static bool pci_match_class(const pci_device_t* dev, uint32_t class_code, uint32_t subclass) {
+    return pci_read8(dev, PCI_CLASS) == class_code && pci_read8(dev, PCI_SUBCLASS) == subclass;
+}
+
+int pci_find_device(uint16_t vendor_id, uint16_t device_id, pci_device_t* out) {
+    return pci_scan(pci_match_id, vendor_id, device_id, out);
+}
+
+int pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t* out) {
+    return pci_scan(pci_match_class, class_code, subclass, out);
+}
+
+uint32_t pci_bar_address(const pci_device_t* dev, int bar) {
+    if (bar < 0 || bar >= PCI_BARS) return 0;
+
+    uint32_t value = pci_read32(dev, PCI_BAR0 + bar * 4);
+    if (value & 1) return 0;                        // I/O space
+    if ((value & 0x6) == 0x4) {
+        // 64-bit: the upper half must be clear to be reachable
+        if (bar + 1 >= PCI_BARS || pci_read32(dev, PCI_BAR0 + (bar + 1) * 4) != 0) return 0;
+    }
+    return value & ~0xFu;
+}
+
+uint16_t pci_bar_port(const pci_device_t* dev, int bar) {
+    if (bar < 0 || bar >= PCI_BARS) return 0;
+
+    uint32_t value = pci_read32(dev, PCI_BAR0 + bar * 4);
+    if (!(value & 1)) return 0;                     // Memory space
+    return (uint16_t)(value & ~0x3u);
+}
+
+uint8_t pci_find_capability(const pci_device_t* dev, uint8_t id, uint8_t from) {
+    if (!(pci_read16(dev, PCI_STATUS) & PCI_STATUS_CAP_LIST)) return 0;
+
+    uint8_t offset = from ? pci_read8(dev, from + 1) : pci_read8(dev, PCI_CAP_PTR);
+    // Bounded, in case a broken list loops
+    for (uint32_t i = 0; i < 48 && offset >= 0x40; i++) {
+        offset &= 0xFC;
+        if (pci_read8(dev, offset) == id) return offset;
+        offset = pci_read8(dev, offset + 1);
+    }
+    return 0;
+}
+
+uint32_t pci_msix_count(const pci_device_t* dev) {
+    uint8_t cap = pci_find_capability(dev, PCI_CAP_ID_MSIX, 0);
+    if (!cap) return 0;
+    return (pci_read16(dev, cap + PCI_MSIX_CONTROL) & PCI_MSIX_SIZE_MASK) + 1;
+}
+
+int pci_msix_set(const pci_device_t* dev, uint32_t entry, uint8_t vector, uint8_t apic_id) {
+    uint8_t cap = pci_find_capability(dev, PCI_CAP_ID_MSIX, 0);
+    if (!cap || entry > (pci_read16(dev, cap + PCI_MSIX_CONTROL) & PCI_MSIX_SIZE_MASK)) return -1;
+
+    uint32_t table = pci_read32(dev, cap + PCI_MSIX_TABLE);
+    uint32_t base = pci_bar_address(dev, table & 0x7);
+    if (!base) return -1;
+
+    // Masked while the address and data change
+    volatile uint32_t* slot = (volatile uint32_t*)(base + (table & ~0x7u) + entry * PCI_MSIX_ENTRY_SIZE);
+    slot[3] |= PCI_MSIX_VECTOR_MASKED;
+    slot[0] = MSI_ADDRESS_BASE | ((uint32_t)apic_id << MSI_ADDRESS_DEST_SHIFT);
+    slot[1] = 0;
+    slot[2] = vector;
+    slot[3] &= ~PCI_MSIX_VECTOR_MASKED;
+    return 0;
+}
+
+void pci_msix_enable(const pci_device_t* dev, bool enable) {
+    uint8_t cap = pci_find_capability(dev, PCI_CAP_ID_MSIX, 0);
+    if (!cap) return;
+
+    uint16_t control = pci_read16(dev, cap + PCI_MSIX_CONTROL) & ~PCI_MSIX_FUNCTION_MASK;
+    uint16_t command = pci_read16(dev, PCI_COMMAND);
+    if (enable) {
+        pci_write16(dev, cap + PCI_MSIX_CONTROL, control | PCI_MSIX_ENABLE);
+        pci_write16(dev, PCI_COMMAND, command | PCI_COMMAND_INTX_OFF);
+    } else {
+        pci_write16(dev, cap + PCI_MSIX_CONTROL, control & ~PCI_MSIX_ENABLE);
+        pci_write16(dev, PCI_COMMAND, command & ~PCI_COMMAND_INTX_OFF);
+    }
+}
+
+void pci_enable_device(const pci_device_t* dev) {
+    uint16_t command = pci_read16(dev, PCI_COMMAND);
+    pci_write16(dev, PCI_COMMAND, command | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+}
+
+void pci_enable_io_device(const pci_device_t* dev) {
+    uint16_t command = pci_read16(dev, PCI_COMMAND);
+    pci_write16(dev, PCI_COMMAND, command | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+}
@@ -0,0 +1,101 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include "../types.h"
+
+// PCI configuration space through the legacy 0xCF8/0xCFC mechanism. Only
+// what drivers need to find their device: a scan for an id, its memory
+// BARs and its capability list. Paging is off, so a BAR's physical address
+// is used as it is.
+#define PCI_CONFIG_ADDRESS      0xCF8
+#define PCI_CONFIG_DATA         0xCFC
+
+// Configuration header
+#define PCI_VENDOR_ID           0x00
+#define PCI_DEVICE_ID           0x02
+#define PCI_COMMAND             0x04
+#define PCI_STATUS              0x06
+#define PCI_PROG_IF             0x09
+#define PCI_SUBCLASS            0x0A
+#define PCI_CLASS               0x0B
+#define PCI_HEADER_TYPE         0x0E
+#define PCI_BAR0                0x10
+#define PCI_CAP_PTR             0x34
+#define PCI_INTERRUPT_LINE      0x3C
+
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_MASTER      0x0004      // Device may DMA
+#define PCI_COMMAND_INTX_OFF    0x0400
+#define PCI_STATUS_CAP_LIST     0x0010
+#define PCI_HEADER_MULTI        0x80        // Functions beyond 0
+
+#define PCI_CAP_ID_VENDOR       0x09
+#define PCI_CAP_ID_MSIX         0x11
+
+// MSI-X capability and table. A message is a write of the vector to the
+// local APIC of the CPU it is for, so moving one rewrites its address.
+#define PCI_MSIX_CONTROL        0x02        // From the capability
+#define PCI_MSIX_TABLE          0x04        // Offset, BAR in bits 0-2
+#define PCI_MSIX_SIZE_MASK      0x07FF      // Entries - 1
+#define PCI_MSIX_FUNCTION_MASK  0x4000
+#define PCI_MSIX_ENABLE         0x8000
+#define PCI_MSIX_ENTRY_SIZE     16
+#define PCI_MSIX_VECTOR_MASKED  0x1         // Entry's vector control word
+#define MSI_ADDRESS_BASE        0xFEE00000
+#define MSI_ADDRESS_DEST_SHIFT  12
+
+#define PCI_BARS                6
+#define PCI_NO_VENDOR           0xFFFF
+
+typedef struct {
+    uint8_t bus;
+    uint8_t device;
+    uint8_t function;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t irq;                // Legacy interrupt line, 0xFF none
+} pci_device_t;
+
+uint32_t pci_read32(const pci_device_t* dev, uint8_t offset);
+uint16_t pci_read16(const pci_device_t* dev, uint8_t offset);
+uint8_t pci_read8(const pci_device_t* dev, uint8_t offset);
+void pci_write32(const pci_device_t* dev, uint8_t offset, uint32_t value);
+void pci_write16(const pci_device_t* dev, uint8_t offset, uint16_t value);
+
+// First function with this id, any device id if device_id is 0xFFFF; 0,
+// or -1 if there is none
+int pci_find_device(uint16_t vendor_id, uint16_t device_id, pci_device_t* out);
+
+// First function of this class and subclass, likewise
+int pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t* out);
+
+// Base of a 32-bit or 64-bit memory BAR below 4 GB; 0 for an I/O BAR, an
+// unused one or one out of reach
+uint32_t pci_bar_address(const pci_device_t* dev, int bar);
+
+// Port base of an I/O BAR; 0 for a memory BAR or an unused one
+uint16_t pci_bar_port(const pci_device_t* dev, int bar);
+
+// Offset of the next capability with this id after 'from' (0 to start at
+// the head of the list), or 0
+uint8_t pci_find_capability(const pci_device_t* dev, uint8_t id, uint8_t from);
+
+// Entries in the MSI-X table, 0 without one
+uint32_t pci_msix_count(const pci_device_t* dev);
+
+// Point an entry at a vector on a local APIC and unmask it; the same to
+// move it to another CPU. -1 past the table.
+int pci_msix_set(const pci_device_t* dev, uint32_t entry, uint8_t vector, uint8_t apic_id);
+
+// Turn MSI-X on or off for the function; the legacy line is off while it
+// is on
+void pci_msix_enable(const pci_device_t* dev, bool enable);
+
+// Decode memory BARs and let the device master the bus
+void pci_enable_device(const pci_device_t* dev);
+
+// Likewise for I/O BARs
+void pci_enable_io_device(const pci_device_t* dev);
+
+#endif // PCI_H
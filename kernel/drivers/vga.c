@@ -1,9 +1,30 @@
 #include "vga.h"
+#include "../proc/process.h"
+#include "../proc/scheduler.h"
+#include "../proc/futex.h"
+
+#define VGA_ALL_LINES ((1u << VGA_HEIGHT) - 1)
+
+_Static_assert(VGA_HEIGHT < 32, "VGA_HEIGHT");
 
 static volatile uint16_t* vga_buffer = (uint16_t*)VGA_MEMORY;
+
+// The console lives in RAM. Screen row r is shadow line (shadow_top + r)
+// mod VGA_HEIGHT, so a scroll moves the top instead of the text; rows
+// written since the last flush are set in vga_dirty.
+static uint16_t shadow[VGA_HEIGHT][VGA_WIDTH];
+static size_t shadow_top = 0;
+static volatile uint32_t vga_dirty = 0;
+static volatile uint32_t vga_flusher = 0;       // Task started: writes no longer flush
+static volatile uint32_t vga_kick = 0;
 static size_t vga_row = 0;
 static size_t vga_column = 0;
 static uint8_t vga_color = 0;
+static uint16_t vga_mirror_port = 0;
+
+static inline void vga_outb(uint16_t port, uint8_t value) {
+    __asm__ volatile ("outb %0, %1" : : "a"(value), "Nd"(port));
+}
 
 static inline uint8_t vga_entry_color(vga_color_t fg, vga_color_t bg) {
     return fg | bg << 4;
@@ -13,6 +34,49 @@ static inline uint16_t vga_entry(unsigned char uc, uint8_t color) {
     return (uint16_t)uc | (uint16_t)color << 8;
 }
 
+static inline uint16_t* shadow_line(size_t row) {
+    size_t line = shadow_top + row;
+    return shadow[line < VGA_HEIGHT ? line : line - VGA_HEIGHT];
+}
+
+static inline void mark_dirty(uint32_t rows) {
+    __sync_fetch_and_or(&vga_dirty, rows);
+}
+
+// Copy the dirty rows out in 32-bit stores, two cells each. A row written
+// while it is copied is marked again and goes next time.
+void vga_flush(void) {
+    uint32_t dirty = __sync_lock_test_and_set(&vga_dirty, 0);
+    for (size_t row = 0; dirty; row++, dirty >>= 1) {
+        if (!(dirty & 1)) continue;
+        const uint32_t* src = (const uint32_t*)shadow_line(row);
+        volatile uint32_t* dst = (volatile uint32_t*)(vga_buffer + row * VGA_WIDTH);
+        for (size_t i = 0; i < VGA_WIDTH / 2; i++) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+static void vga_flusher_task(void) {
+    for (;;) {
+        vga_flush();
+        futex_wait(&vga_kick, 0, VGA_FLUSH_MS);
+    }
+}
+
+void vga_start_flusher(void) {
+    if (vga_flusher) return;
+    process_t* task = process_create("vga_flush", vga_flusher_task, PRIORITY_LOW);
+    if (!task) return;
+    scheduler_add_process(task);
+    vga_flusher = 1;
+}
+
+// Until the task runs, whoever writes flushes
+static inline void flush_if_synchronous(void) {
+    if (!vga_flusher) vga_flush();
+}
+
 void vga_init(void) {
     vga_row = 0;
     vga_column = 0;
@@ -23,12 +87,14 @@ void vga_init(void) {
 void vga_clear(void) {
     for (size_t y = 0; y < VGA_HEIGHT; y++) {
         for (size_t x = 0; x < VGA_WIDTH; x++) {
-            const size_t index = y * VGA_WIDTH + x;
-            vga_buffer[index] = vga_entry(' ', vga_color);
+            shadow[y][x] = vga_entry(' ', vga_color);
         }
     }
+    shadow_top = 0;
     vga_row = 0;
     vga_column = 0;
+    mark_dirty(VGA_ALL_LINES);
+    flush_if_synchronous();
 }
 
 void vga_set_color(vga_color_t fg, vga_color_t bg) {
@@ -42,27 +108,40 @@ void vga_set_cursor(size_t x, size_t y) {
     }
 }
 
+// The old top line becomes the new bottom one, cleared; every row shows
+// different text now
 static void vga_scroll(void) {
-    // Move all lines up by one
-    for (size_t y = 0; y < VGA_HEIGHT - 1; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
-            const size_t src_index = (y + 1) * VGA_WIDTH + x;
-            const size_t dst_index = y * VGA_WIDTH + x;
-            vga_buffer[dst_index] = vga_buffer[src_index];
-        }
-    }
-    
-    // Clear the last line
+    uint16_t* line = shadow[shadow_top];
     for (size_t x = 0; x < VGA_WIDTH; x++) {
-        const size_t index = (VGA_HEIGHT - 1) * VGA_WIDTH + x;
-        vga_buffer[index] = vga_entry(' ', vga_color);
+        line[x] = vga_entry(' ', vga_color);
     }
+    shadow_top = shadow_top + 1 < VGA_HEIGHT ? shadow_top + 1 : 0;
+    mark_dirty(VGA_ALL_LINES);
     
     vga_row = VGA_HEIGHT - 1;
     vga_column = 0;
 }
 
-void vga_putchar(char c) {
+void vga_put_cells(size_t x, size_t y, const uint16_t* cells, size_t count) {
+    if (x >= VGA_WIDTH || y >= VGA_HEIGHT) return;
+    if (count > VGA_WIDTH - x) count = VGA_WIDTH - x;
+    uint16_t* line = shadow_line(y);
+    for (size_t i = 0; i < count; i++) {
+        line[x + i] = cells[i];
+    }
+    mark_dirty(1u << y);
+    flush_if_synchronous();
+}
+
+void vga_set_mirror_port(uint16_t port) {
+    vga_mirror_port = port;
+}
+
+static void vga_put(char c) {
+    if (vga_mirror_port) {
+        vga_outb(vga_mirror_port, (uint8_t)c);
+    }
+    
     if (c == '\n') {
         vga_column = 0;
         if (++vga_row == VGA_HEIGHT) {
@@ -80,16 +159,15 @@ void vga_putchar(char c) {
         // Backspace handling
         if (vga_column > 0) {
             vga_column--;
-            const size_t index = vga_row * VGA_WIDTH + vga_column;
-            vga_buffer[index] = vga_entry(' ', vga_color);
+            shadow_line(vga_row)[vga_column] = vga_entry(' ', vga_color);
+            mark_dirty(1u << vga_row);
         } else if (vga_row > 0) {
             // Move to previous line if at beginning of line
             vga_row--;
             vga_column = VGA_WIDTH - 1;
             // Find the last non-space character on the previous line
             while (vga_column > 0) {
-                const size_t index = vga_row * VGA_WIDTH + vga_column;
-                if ((vga_buffer[index] & 0xFF) != ' ') {
+                if ((shadow_line(vga_row)[vga_column] & 0xFF) != ' ') {
                     vga_column++;
                     break;
                 }
@@ -110,8 +188,8 @@ void vga_putchar(char c) {
         return;
     }
     
-    const size_t index = vga_row * VGA_WIDTH + vga_column;
-    vga_buffer[index] = vga_entry(c, vga_color);
+    shadow_line(vga_row)[vga_column] = vga_entry(c, vga_color);
+    mark_dirty(1u << vga_row);
     
     if (++vga_column == VGA_WIDTH) {
         vga_column = 0;
@@ -121,8 +199,14 @@ void vga_putchar(char c) {
     }
 }
 
+void vga_putchar(char c) {
+    vga_put(c);
+    flush_if_synchronous();
+}
+
 void vga_write_string(const char* str) {
     while (*str) {
-        vga_putchar(*str++);
+        vga_put(*str++);
     }
-}
\ No newline at end of file
+    flush_if_synchronous();
+}
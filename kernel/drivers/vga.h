@@ -8,6 +8,12 @@
 #define VGA_HEIGHT 25
 #define VGA_MEMORY 0xB8000
 
+// Text is written to a copy in RAM and the rows that changed are copied
+// to VGA_MEMORY: by the writer itself until vga_start_flusher, then by a
+// low priority task every VGA_FLUSH_MS, so printing on a busy path costs
+// plain stores and never waits on the uncached frame buffer.
+#define VGA_FLUSH_MS 20
+
 // VGA colors
 typedef enum {
     VGA_COLOR_BLACK = 0,
@@ -36,4 +42,16 @@ void vga_write_string(const char* str);
 void vga_set_color(vga_color_t fg, vga_color_t bg);
 void vga_set_cursor(size_t x, size_t y);
 
+// Replace 'count' cells (character | attribute << 8) of row y from column
+// x, clipped to the row; the cursor stays where it is
+void vga_put_cells(size_t x, size_t y, const uint16_t* cells, size_t count);
+
+// Bring the screen up to date now (before halting, say)
+void vga_flush(void);
+void vga_start_flusher(void);
+
+// Also write every character to an I/O port (QEMU's debug console, for
+// headless runs); 0 turns it off
+void vga_set_mirror_port(uint16_t port);
+
 #endif // VGA_H
\ No newline at end of file
@@ -0,0 +1,552 @@
+#include "ahci.h"
+#include "../mm/memory.h"
+#include "../arch/cpu.h"
+#include "../arch/tsc.h"
+#include "../arch/spinlock.h"
+#include "../arch/interrupts.h"
+#include "../arch/smp.h"
+#include "../drivers/pci.h"
+#include "../drivers/vga.h"
+#include "../proc/process.h"
+#include "../proc/scheduler.h"
+#include "../proc/futex.h"
+
+#define AHCI_TABLE_STRIDE       256         // A command table with its PRD, 128-byte aligned
+#define AHCI_SPIN_TIMEOUT_NS    500000000ull
+
+typedef struct {
+    volatile uint8_t* regs;
+    uint8_t index;
+    bool ncq;
+    uint32_t depth;                         // Slots used
+    uint32_t total_sectors;
+    ahci_cmd_header_t* cmd_list;
+    uint8_t* fis;
+    uint8_t* tables;
+    spinlock_t lock;
+    uint32_t issued;                        // Slots with a command out
+    bool exclusive;                         // The one out is not queued
+    disk_io_t* slot_io[AHCI_MAX_SLOTS];
+    uint64_t slot_deadline[AHCI_MAX_SLOTS]; // ktime_ns
+    disk_io_t* pending_head;                // Waiting for a slot, in order
+    disk_io_t* pending_tail;
+} ahci_port_t;
+
+static volatile uint8_t* hba;
+static ahci_port_t* ports[AHCI_MAX_PORTS];
+static ahci_port_t* ahci_disk;              // The first disk found
+static uint32_t slots_supported;
+static bool irq_wired;
+static uint8_t irq_line = 0xFF;
+static ahci_stats_t ahci_stats;
+static volatile uint32_t poll_kick;
+static volatile uint32_t poller_idle;
+
+static inline uint32_t hba_read(uint32_t reg) {
+    return *(volatile uint32_t*)(hba + reg);
+}
+
+static inline void hba_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(hba + reg) = value;
+}
+
+static inline uint32_t port_read(ahci_port_t* p, uint32_t reg) {
+    return *(volatile uint32_t*)(p->regs + reg);
+}
+
+static inline void port_write(ahci_port_t* p, uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(p->regs + reg) = value;
+}
+
+static inline ahci_cmd_table_t* slot_table(ahci_port_t* p, uint32_t slot) {
+    return (ahci_cmd_table_t*)(p->tables + slot * AHCI_TABLE_STRIDE);
+}
+
+// Spin until (register & mask) == value, up to AHCI_SPIN_TIMEOUT_NS
+static bool port_wait(ahci_port_t* p, uint32_t reg, uint32_t mask, uint32_t value) {
+    uint64_t deadline = ktime_ns() + AHCI_SPIN_TIMEOUT_NS;
+    while ((port_read(p, reg) & mask) != value) {
+        if (ktime_ns() > deadline) return false;
+        cpu_relax();
+    }
+    return true;
+}
+
+static void port_stop(ahci_port_t* p) {
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) & ~AHCI_PxCMD_ST);
+    port_wait(p, AHCI_PxCMD, AHCI_PxCMD_CR, 0);
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) & ~AHCI_PxCMD_FRE);
+    port_wait(p, AHCI_PxCMD, AHCI_PxCMD_FR, 0);
+}
+
+static bool port_start(ahci_port_t* p) {
+    if (!port_wait(p, AHCI_PxTFD, ATA_STATUS_BSY | ATA_STATUS_DRQ, 0)) return false;
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) | AHCI_PxCMD_FRE);
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) | AHCI_PxCMD_ST);
+    return true;
+}
+
+// Slot 'slot' set up for one command; buffer NULL for none
+static void fill_command(ahci_port_t* p, uint32_t slot, uint8_t command, uint64_t lba,
+                         uint32_t count, void* buffer, uint32_t bytes, bool write) {
+    ahci_cmd_header_t* header = &p->cmd_list[slot];
+    ahci_cmd_table_t* table = slot_table(p, slot);
+    memset(table, 0, sizeof(ahci_cmd_table_t));
+
+    fis_reg_h2d_t* fis = (fis_reg_h2d_t*)table->cfis;
+    fis->type = FIS_TYPE_REG_H2D;
+    fis->flags = FIS_H2D_COMMAND;
+    fis->command = command;
+    fis->lba0 = (uint8_t)lba;
+    fis->lba1 = (uint8_t)(lba >> 8);
+    fis->lba2 = (uint8_t)(lba >> 16);
+    fis->lba3 = (uint8_t)(lba >> 24);
+    fis->lba4 = (uint8_t)(lba >> 32);
+    fis->lba5 = (uint8_t)(lba >> 40);
+    if (command == ATA_CMD_READ_FPDMA || command == ATA_CMD_WRITE_FPDMA) {
+        // The count moves to the features; the count field carries the tag
+        fis->feature_low = (uint8_t)count;
+        fis->feature_high = (uint8_t)(count >> 8);
+        fis->count_low = (uint8_t)(slot << 3);
+        fis->device = ATA_DEVICE_LBA;
+    } else if (command != ATA_CMD_IDENTIFY) {
+        fis->count_low = (uint8_t)count;
+        fis->count_high = (uint8_t)(count >> 8);
+        fis->device = command == ATA_CMD_FLUSH_CACHE_EXT ? 0 : ATA_DEVICE_LBA;
+    }
+
+    header->flags = (uint16_t)(sizeof(fis_reg_h2d_t) / 4) | (write ? AHCI_CMD_WRITE : 0);
+    header->prdtl = 0;
+    header->prdbc = 0;
+    if (buffer) {
+        table->prdt[0].dba = (uint32_t)buffer;
+        table->prdt[0].dbau = 0;
+        table->prdt[0].dbc = bytes - 1;
+        header->prdtl = 1;
+    }
+}
+
+// All below until ahci_submit: port lock held
+
+// Issue what is pending while slots allow: queued commands up to the
+// depth, the others alone
+static void port_kick(ahci_port_t* p) {
+    while (p->pending_head && !p->exclusive) {
+        disk_io_t* io = p->pending_head;
+        bool queued = p->ncq && io->op != DISK_IO_FLUSH;
+        if (!queued && p->issued) break;            // Wait for the queue to drain
+
+        uint32_t slot = 0;
+        while (slot < p->depth && (p->issued & (1u << slot))) slot++;
+        if (slot == p->depth) break;
+
+        p->pending_head = io->next;
+        if (!p->pending_head) p->pending_tail = NULL;
+        io->next = NULL;
+
+        bool write = io->op == DISK_IO_WRITE;
+        uint8_t command;
+        if (io->op == DISK_IO_FLUSH) {
+            command = ATA_CMD_FLUSH_CACHE_EXT;
+        } else if (queued) {
+            command = write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA;
+        } else {
+            command = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+        }
+        void* buffer = io->op == DISK_IO_FLUSH ? NULL : io->buffer;
+        fill_command(p, slot, command, io->lba, io->count, buffer, io->count * SECTOR_SIZE, write);
+
+        p->slot_io[slot] = io;
+        p->slot_deadline[slot] = ktime_ns() + (uint64_t)AHCI_TIMEOUT_MS * 1000000;
+        p->issued |= 1u << slot;
+        p->exclusive = !queued;
+        if (queued) port_write(p, AHCI_PxSACT, 1u << slot);
+        port_write(p, AHCI_PxCI, 1u << slot);
+
+        ahci_stats.commands++;
+        if (queued) ahci_stats.ncq_commands++;
+        ahci_stats.sectors += io->op == DISK_IO_FLUSH ? 0 : io->count;
+        uint32_t out = 0;
+        for (uint32_t bits = p->issued; bits; bits &= bits - 1) out++;
+        if (out > ahci_stats.max_outstanding) ahci_stats.max_outstanding = out;
+    }
+}
+
+// Every command out fails with 'result'; the port is restarted. Failed
+// requests are added to *done.
+static void port_recover(ahci_port_t* p, int result, disk_io_t** done) {
+    port_stop(p);
+    for (uint32_t slot = 0; slot < p->depth; slot++) {
+        if (!(p->issued & (1u << slot))) continue;
+        disk_io_t* io = p->slot_io[slot];
+        io->result = result;
+        io->next = *done;
+        *done = io;
+        p->slot_io[slot] = NULL;
+    }
+    p->issued = 0;
+    p->exclusive = false;
+    port_write(p, AHCI_PxSERR, 0xFFFFFFFF);
+    port_write(p, AHCI_PxIS, 0xFFFFFFFF);
+    port_start(p);
+    ahci_stats.resets++;
+    if (result == DISK_TIMEOUT_ERR) ahci_stats.timeouts++;
+    else ahci_stats.errors++;
+}
+
+// Collect what the port has finished and issue more; the callbacks are
+// the caller's to run, outside the lock
+static disk_io_t* port_complete(ahci_port_t* p, bool check_timeouts) {
+    disk_io_t* done = NULL;
+    uint32_t is = port_read(p, AHCI_PxIS);
+    port_write(p, AHCI_PxIS, is);
+
+    if ((is & AHCI_PxIS_ERRORS) || (p->issued && (port_read(p, AHCI_PxTFD) & ATA_STATUS_ERR))) {
+        port_recover(p, DISK_ERROR, &done);
+    } else if (p->issued) {
+        uint32_t finished = p->issued & ~(port_read(p, AHCI_PxSACT) | port_read(p, AHCI_PxCI));
+        for (uint32_t slot = 0; slot < p->depth; slot++) {
+            if (!(finished & (1u << slot))) continue;
+            disk_io_t* io = p->slot_io[slot];
+            io->result = DISK_SUCCESS;
+            io->next = done;
+            done = io;
+            p->slot_io[slot] = NULL;
+        }
+        p->issued &= ~finished;
+        if (!p->issued) p->exclusive = false;
+
+        if (check_timeouts && p->issued) {
+            uint64_t now = ktime_ns();
+            for (uint32_t slot = 0; slot < p->depth; slot++) {
+                if ((p->issued & (1u << slot)) && now > p->slot_deadline[slot]) {
+                    port_recover(p, DISK_TIMEOUT_ERR, &done);
+                    break;
+                }
+            }
+        }
+    }
+    port_kick(p);
+    return done;
+}
+
+static void run_callbacks(disk_io_t* done) {
+    while (done) {
+        disk_io_t* next = done->next;
+        done->next = NULL;
+        done->done(done);
+        done = next;
+    }
+}
+
+static uint32_t service_port(ahci_port_t* p, bool check_timeouts) {
+    uint32_t flags = spin_lock_irqsave(&p->lock);
+    disk_io_t* done = port_complete(p, check_timeouts);
+    spin_unlock_irqrestore(&p->lock, flags);
+
+    uint32_t count = 0;
+    for (disk_io_t* io = done; io; io = io->next) count++;
+    run_callbacks(done);
+    return count;
+}
+
+void ahci_interrupt_handler(void) {
+    if (!hba) return;
+    uint32_t is = hba_read(AHCI_IS);
+    if (!is) return;
+    __sync_fetch_and_add(&ahci_stats.interrupts, 1);
+    for (uint32_t i = 0; i < AHCI_MAX_PORTS; i++) {
+        if ((is & (1u << i)) && ports[i]) service_port(ports[i], false);
+    }
+    hba_write(AHCI_IS, is);
+}
+
+void ahci_poll(void) {
+    if (!hba) return;
+    for (uint32_t i = 0; i < AHCI_MAX_PORTS; i++) {
+        if (ports[i]) {
+            uint32_t found = service_port(ports[i], true);
+            if (found) __sync_fetch_and_add(&ahci_stats.polled, found);
+        }
+    }
+}
+
+int ahci_submit(disk_io_t* io) {
+    ahci_port_t* p = ahci_disk;
+    if (!p || !io || !io->done || io->op > DISK_IO_FLUSH) return DISK_ERROR;
+    if (io->op != DISK_IO_FLUSH) {
+        if (io->count == 0 || io->count > AHCI_MAX_SECTORS || ((uint32_t)io->buffer & 1) ||
+            io->lba >= p->total_sectors || io->count > p->total_sectors - io->lba) {
+            return DISK_ERROR;
+        }
+    }
+    io->next = NULL;
+    io->result = DISK_SUCCESS;
+
+    uint32_t flags = spin_lock_irqsave(&p->lock);
+    if (p->pending_tail) p->pending_tail->next = io;
+    else p->pending_head = io;
+    p->pending_tail = io;
+    port_kick(p);
+    if (p->pending_tail == io) ahci_stats.queued++;
+    spin_unlock_irqrestore(&p->lock, flags);
+
+    // The poller watches for timeouts (and, unwired, completions)
+    store_release(&poll_kick, 1);
+    if (load_acquire(&poller_idle)) futex_wake(&poll_kick, 1);
+    return DISK_SUCCESS;
+}
+
+typedef struct {
+    disk_io_t io;
+    volatile uint32_t done;
+} ahci_waiter_t;
+
+static void ahci_wake(disk_io_t* io) {
+    ahci_waiter_t* waiter = (ahci_waiter_t*)io->data;
+    store_release(&waiter->done, 1);
+    futex_wake(&waiter->done, 1);
+}
+
+int ahci_io(uint32_t lba, uint32_t count, void* buffer, uint8_t op) {
+    uint32_t flags = irq_save();
+    irq_restore(flags);
+    bool sleep = flags & EFLAGS_IF;
+
+    char* buf = (char*)buffer;
+    do {
+        uint32_t run = count > AHCI_MAX_SECTORS ? AHCI_MAX_SECTORS : count;
+        ahci_waiter_t waiter;
+        waiter.io.lba = lba;
+        waiter.io.count = run;
+        waiter.io.buffer = buf;
+        waiter.io.op = op;
+        waiter.io.done = ahci_wake;
+        waiter.io.data = &waiter;
+        waiter.done = 0;
+        int result = ahci_submit(&waiter.io);
+        if (result != DISK_SUCCESS) return result;
+
+        // Asleep until the interrupt where we may; polling either way, in
+        // case it is held up on a CPU with interrupts off
+        while (!load_acquire(&waiter.done)) {
+            ahci_poll();
+            if (load_acquire(&waiter.done)) break;
+            if (!sleep || futex_wait(&waiter.done, 0, irq_wired ? DISK_DMA_WAIT_MS : AHCI_POLL_MS) < 0) {
+                cpu_relax();
+            }
+        }
+        if (waiter.io.result != DISK_SUCCESS) return waiter.io.result;
+        buf += run * SECTOR_SIZE;
+        lba += run;
+        count -= run;
+    } while (count > 0);
+    return DISK_SUCCESS;
+}
+
+// While commands are out: completions when no interrupt comes, and
+// timeouts either way
+static void ahci_poller_task(void) {
+    for (;;) {
+        store_release(&poll_kick, 0);
+        ahci_poll();
+        bool busy = false;
+        for (uint32_t i = 0; i < AHCI_MAX_PORTS; i++) {
+            if (ports[i] && (ports[i]->issued || ports[i]->pending_head)) busy = true;
+        }
+        if (busy) {
+            futex_wait(&poll_kick, 0, irq_wired ? AHCI_TIMEOUT_MS / 4 : AHCI_POLL_MS);
+        } else {
+            store_release(&poller_idle, 1);
+            futex_wait(&poll_kick, 0, FUTEX_WAIT_FOREVER);
+            store_release(&poller_idle, 0);
+        }
+    }
+}
+
+// IDENTIFY through slot 0, polled, before the port takes requests
+static bool port_identify(ahci_port_t* p, uint16_t* identify) {
+    fill_command(p, 0, ATA_CMD_IDENTIFY, 0, 0, identify, SECTOR_SIZE, false);
+    port_write(p, AHCI_PxCI, 1);
+    if (!port_wait(p, AHCI_PxCI, 1, 0)) return false;
+    return !(port_read(p, AHCI_PxTFD) & ATA_STATUS_ERR);
+}
+
+static bool port_setup(uint32_t index) {
+    volatile uint8_t* regs = hba + AHCI_PORT_BASE + index * AHCI_PORT_SIZE;
+    uint32_t ssts = *(volatile uint32_t*)(regs + AHCI_PxSSTS);
+    uint32_t sig = *(volatile uint32_t*)(regs + AHCI_PxSIG);
+    if ((ssts & 0x0F) != AHCI_SSTS_DET_PRESENT || ((ssts >> 8) & 0x0F) != AHCI_SSTS_IPM_ACTIVE ||
+        sig != AHCI_SIG_ATA) {
+        return false;
+    }
+
+    ahci_port_t* p = (ahci_port_t*)kmalloc(sizeof(ahci_port_t));
+    if (!p) return false;
+    memset(p, 0, sizeof(ahci_port_t));
+    p->regs = regs;
+    p->index = (uint8_t)index;
+    spin_lock_init(&p->lock);
+    p->cmd_list = (ahci_cmd_header_t*)kmalloc_aligned(AHCI_MAX_SLOTS * sizeof(ahci_cmd_header_t), 1024);
+    p->fis = (uint8_t*)kmalloc_aligned(256, 256);
+    p->tables = (uint8_t*)kmalloc_aligned(AHCI_MAX_SLOTS * AHCI_TABLE_STRIDE, 128);
+    uint16_t* identify = (uint16_t*)kmalloc_aligned(SECTOR_SIZE, 2);
+    if (!p->cmd_list || !p->fis || !p->tables || !identify) {
+        if (p->cmd_list) kfree_aligned(p->cmd_list);
+        if (p->fis) kfree_aligned(p->fis);
+        if (p->tables) kfree_aligned(p->tables);
+        if (identify) kfree_aligned(identify);
+        kfree(p);
+        return false;
+    }
+
+    port_stop(p);
+    memset(p->cmd_list, 0, AHCI_MAX_SLOTS * sizeof(ahci_cmd_header_t));
+    memset(p->fis, 0, 256);
+    for (uint32_t slot = 0; slot < AHCI_MAX_SLOTS; slot++) {
+        p->cmd_list[slot].ctba = (uint32_t)slot_table(p, slot);
+        p->cmd_list[slot].ctbau = 0;
+    }
+    port_write(p, AHCI_PxCLB, (uint32_t)p->cmd_list);
+    port_write(p, AHCI_PxCLBU, 0);
+    port_write(p, AHCI_PxFB, (uint32_t)p->fis);
+    port_write(p, AHCI_PxFBU, 0);
+    port_write(p, AHCI_PxSERR, 0xFFFFFFFF);
+    port_write(p, AHCI_PxIS, 0xFFFFFFFF);
+    port_write(p, AHCI_PxIE, 0);
+    bool ok = port_start(p) && port_identify(p, identify);
+    if (ok) {
+        if (identify[ATA_ID_CMD_SET_2] & ATA_ID_LBA48) {
+            p->total_sectors = (uint32_t)identify[ATA_ID_LBA48_SECTORS] |
+                               ((uint32_t)identify[ATA_ID_LBA48_SECTORS + 1] << 16);
+            if (identify[ATA_ID_LBA48_SECTORS + 2] || identify[ATA_ID_LBA48_SECTORS + 3]) {
+                p->total_sectors = 0xFFFFFFFF;      // Past 2 TB: what we can address
+            }
+        } else {
+            p->total_sectors = (uint32_t)identify[ATA_ID_LBA_SECTORS] |
+                               ((uint32_t)identify[ATA_ID_LBA_SECTORS + 1] << 16);
+        }
+        p->ncq = (hba_read(AHCI_CAP) & AHCI_CAP_SNCQ) && (identify[ATA_ID_SATA_CAP] & ATA_ID_SATA_NCQ);
+        p->depth = 1;
+        if (p->ncq) {
+            p->depth = (identify[ATA_ID_QUEUE_DEPTH] & 0x1F) + 1u;
+            if (p->depth > slots_supported) p->depth = slots_supported;
+        }
+    }
+    kfree_aligned(identify);
+    if (!ok || p->total_sectors == 0) {
+        port_stop(p);
+        kfree_aligned(p->cmd_list);
+        kfree_aligned(p->fis);
+        kfree_aligned(p->tables);
+        kfree(p);
+        return false;
+    }
+
+    port_write(p, AHCI_PxIS, 0xFFFFFFFF);
+    port_write(p, AHCI_PxIE, AHCI_PxIS_ERRORS | AHCI_PxIS_DHRS | AHCI_PxIS_SDBS | AHCI_PxIS_DSS | AHCI_PxIS_PSS);
+    ports[index] = p;
+    if (!ahci_disk) ahci_disk = p;
+    return true;
+}
+
+int ahci_init(void) {
+    pci_device_t dev;
+    if (pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_SATA, &dev) != 0 ||
+        pci_read8(&dev, PCI_PROG_IF) != PCI_PROG_IF_AHCI) {
+        return -1;
+    }
+    uint32_t abar = pci_bar_address(&dev, AHCI_ABAR);
+    if (!abar) return -1;
+    pci_enable_device(&dev);
+
+    hba = (volatile uint8_t*)abar;
+    hba_write(AHCI_GHC, hba_read(AHCI_GHC) | AHCI_GHC_AE);
+    slots_supported = ((hba_read(AHCI_CAP) >> AHCI_CAP_NCS_SHIFT) & 0x1F) + 1;
+    memset(&ahci_stats, 0, sizeof(ahci_stats));
+
+    uint32_t implemented = hba_read(AHCI_PI);
+    for (uint32_t i = 0; i < AHCI_MAX_PORTS; i++) {
+        if (implemented & (1u << i)) port_setup(i);
+    }
+    if (!ahci_disk) {
+        hba = NULL;
+        return -1;
+    }
+
+    hba_write(AHCI_IS, 0xFFFFFFFF);
+    irq_line = dev.irq;
+    irq_wired = dev.irq != 0xFF && interrupts_route_pci(dev.irq, BOOT_CPU) == 0;
+    if (irq_wired) {
+        hba_write(AHCI_GHC, hba_read(AHCI_GHC) | AHCI_GHC_IE);
+    }
+
+    process_t* task = process_create("ahci_poll", ahci_poller_task, PRIORITY_LOW);
+    if (task) scheduler_add_process(task);
+    return 0;
+}
+
+bool ahci_present(void) {
+    return ahci_disk != NULL;
+}
+
+uint32_t ahci_total_sectors(void) {
+    return ahci_disk ? ahci_disk->total_sectors : 0;
+}
+
+void ahci_get_stats(ahci_stats_t* stats) {
+    if (stats) *stats = ahci_stats;
+}
+
+void ahci_print_info(void) {
+    ahci_stats_t stats;
+    ahci_get_stats(&stats);
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== AHCI ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    if (!ahci_disk) {
+        vga_write_string("No AHCI disk\n");
+        return;
+    }
+    for (uint32_t i = 0; i < AHCI_MAX_PORTS; i++) {
+        ahci_port_t* p = ports[i];
+        if (!p) continue;
+        vga_write_string("Port ");
+        print_dec(i);
+        vga_write_string(": ");
+        print_dec(p->total_sectors);
+        vga_write_string(" sectors, ");
+        if (p->ncq) {
+            vga_write_string("NCQ depth ");
+            print_dec(p->depth);
+        } else {
+            vga_write_string("no NCQ");
+        }
+        vga_write_string(p == ahci_disk ? " (in use)\n" : "\n");
+    }
+    vga_write_string(irq_wired ? "Completions on IRQ " : "Completions polled, no IRQ");
+    if (irq_wired) print_dec(irq_line);
+    vga_write_string("\nCommands: ");
+    print_dec(stats.commands);
+    vga_write_string(" (NCQ: ");
+    print_dec(stats.ncq_commands);
+    vga_write_string(")  Sectors: ");
+    print_dec(stats.sectors);
+    vga_write_string("\nMost outstanding: ");
+    print_dec(stats.max_outstanding);
+    vga_write_string("  Waited for a slot: ");
+    print_dec(stats.queued);
+    vga_write_string("\nInterrupts: ");
+    print_dec(stats.interrupts);
+    vga_write_string("  Found polling: ");
+    print_dec(stats.polled);
+    vga_write_string("\nErrors: ");
+    print_dec(stats.errors);
+    vga_write_string("  Timeouts: ");
+    print_dec(stats.timeouts);
+    vga_write_string("  Port resets: ");
+    print_dec(stats.resets);
+    vga_write_string("\n");
+}
@@ -0,0 +1,179 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include "../types.h"
+#include "disk.h"
+
+// AHCI SATA host controller (PCI class 01h/06h, interface 01h), its
+// registers in memory at BAR5. Every port with a disk gets its own
+// command list of up to 32 slots, a received-FIS area and one command
+// table per slot. Requests (disk_io_t) are queued per port and issued as
+// slots free up. A drive that supports it takes them as NCQ commands
+// (READ/WRITE FPDMA QUEUED), tagged by slot, up to its queue depth, and
+// completes them in whatever order suits it. Otherwise they go as
+// READ/WRITE DMA EXT, one at a time. A flush is not queued: it waits for
+// everything submitted before it and holds back everything after.
+//
+// Completion is found by the slots that left both PxCI and PxSACT. The
+// interrupt does that, on a PCI line shared with the network cards. A
+// waiter polls as well, and so does a low priority task while requests
+// are out and no interrupt is wired. A task file error or a timeout fails
+// every command the port had outstanding and restarts the port.
+#define AHCI_MAX_PORTS          32
+#define AHCI_MAX_SLOTS          32
+#define AHCI_MAX_SECTORS        8192        // Per command: one 4 MB PRD
+#define AHCI_TIMEOUT_MS         2000
+#define AHCI_POLL_MS            1
+
+#define PCI_SUBCLASS_SATA       0x06
+#define PCI_PROG_IF_AHCI        0x01
+#define AHCI_ABAR               5
+
+// HBA registers
+#define AHCI_CAP                0x00
+#define AHCI_GHC                0x04
+#define AHCI_IS                 0x08
+#define AHCI_PI                 0x0C
+#define AHCI_VS                 0x10
+#define AHCI_CAP_NCS_SHIFT      8           // Slots - 1, 5 bits
+#define AHCI_CAP_SNCQ           (1u << 30)
+#define AHCI_GHC_IE             (1u << 1)
+#define AHCI_GHC_AE             (1u << 31)
+
+// Port registers, 0x80 apart from 0x100
+#define AHCI_PORT_BASE          0x100
+#define AHCI_PORT_SIZE          0x80
+#define AHCI_PxCLB              0x00
+#define AHCI_PxCLBU             0x04
+#define AHCI_PxFB               0x08
+#define AHCI_PxFBU              0x0C
+#define AHCI_PxIS               0x10
+#define AHCI_PxIE               0x14
+#define AHCI_PxCMD              0x18
+#define AHCI_PxTFD              0x20
+#define AHCI_PxSIG              0x24
+#define AHCI_PxSSTS             0x28
+#define AHCI_PxSERR             0x30
+#define AHCI_PxSACT             0x34
+#define AHCI_PxCI               0x38
+
+#define AHCI_PxCMD_ST           (1u << 0)
+#define AHCI_PxCMD_SUD          (1u << 1)
+#define AHCI_PxCMD_POD          (1u << 2)
+#define AHCI_PxCMD_FRE          (1u << 4)
+#define AHCI_PxCMD_FR           (1u << 14)
+#define AHCI_PxCMD_CR           (1u << 15)
+
+#define AHCI_PxIS_DHRS          (1u << 0)   // D2H register FIS
+#define AHCI_PxIS_PSS           (1u << 1)   // PIO setup FIS
+#define AHCI_PxIS_DSS           (1u << 2)   // DMA setup FIS
+#define AHCI_PxIS_SDBS          (1u << 3)   // Set device bits (NCQ done)
+#define AHCI_PxIS_IFS           (1u << 27)
+#define AHCI_PxIS_HBDS          (1u << 28)
+#define AHCI_PxIS_HBFS          (1u << 29)
+#define AHCI_PxIS_TFES          (1u << 30)
+#define AHCI_PxIS_ERRORS        (AHCI_PxIS_IFS | AHCI_PxIS_HBDS | AHCI_PxIS_HBFS | AHCI_PxIS_TFES)
+
+#define AHCI_SSTS_DET_PRESENT   0x3         // Device there, link up
+#define AHCI_SSTS_IPM_ACTIVE    0x1
+#define AHCI_SIG_ATA            0x00000101
+
+// ATA commands AHCI uses
+#define ATA_CMD_READ_DMA_EXT    0x25
+#define ATA_CMD_WRITE_DMA_EXT   0x35
+#define ATA_CMD_READ_FPDMA      0x60
+#define ATA_CMD_WRITE_FPDMA     0x61
+#define ATA_CMD_FLUSH_CACHE_EXT 0xEA
+
+// IDENTIFY words
+#define ATA_ID_QUEUE_DEPTH      75          // Bits 0-4: depth - 1
+#define ATA_ID_SATA_CAP         76
+#define ATA_ID_SATA_NCQ         0x0100
+#define ATA_ID_CMD_SET_2        83
+#define ATA_ID_LBA48            0x0400
+#define ATA_ID_LBA48_SECTORS    100
+
+#define FIS_TYPE_REG_H2D        0x27
+#define FIS_H2D_COMMAND         0x80
+#define ATA_DEVICE_LBA          0x40
+
+// Command header, 32 per port
+typedef struct {
+    uint16_t flags;             // FIS length in dwords, W (bit 6), C (bit 10)
+    uint16_t prdtl;             // PRD entries
+    volatile uint32_t prdbc;    // Bytes moved
+    uint32_t ctba;              // Command table
+    uint32_t ctbau;
+    uint32_t reserved[4];
+} __attribute__((packed)) ahci_cmd_header_t;
+
+#define AHCI_CMD_WRITE          (1 << 6)
+#define AHCI_CMD_CLEAR_BUSY     (1 << 10)
+
+typedef struct {
+    uint32_t dba;               // Data, 2-byte aligned
+    uint32_t dbau;
+    uint32_t reserved;
+    uint32_t dbc;               // Bytes - 1 (22 bits), bit 31: interrupt
+} __attribute__((packed)) ahci_prd_t;
+
+#define AHCI_PRD_MAX            (4u << 20)
+
+// Command table: 128-byte aligned
+typedef struct {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t reserved[48];
+    ahci_prd_t prdt[1];
+} __attribute__((packed)) ahci_cmd_table_t;
+
+typedef struct {
+    uint8_t type;               // FIS_TYPE_REG_H2D
+    uint8_t flags;              // FIS_H2D_COMMAND
+    uint8_t command;
+    uint8_t feature_low;
+    uint8_t lba0, lba1, lba2;
+    uint8_t device;
+    uint8_t lba3, lba4, lba5;
+    uint8_t feature_high;
+    uint8_t count_low;
+    uint8_t count_high;
+    uint8_t icc;
+    uint8_t control;
+    uint8_t reserved[4];
+} __attribute__((packed)) fis_reg_h2d_t;
+
+typedef struct {
+    uint32_t commands;
+    uint32_t ncq_commands;      // Of them, queued
+    uint32_t sectors;
+    uint32_t queued;            // Had to wait for a slot (or a flush)
+    uint32_t max_outstanding;
+    uint32_t interrupts;
+    uint32_t polled;            // Completions found by polling
+    uint32_t errors;
+    uint32_t timeouts;
+    uint32_t resets;
+} ahci_stats_t;
+
+// Finds the controller and brings up its ports; 0 if a disk was found
+int ahci_init(void);
+
+// The first disk
+bool ahci_present(void);
+uint32_t ahci_total_sectors(void);
+
+// As disk_submit
+int ahci_submit(disk_io_t* io);
+
+// Submit and wait, asleep where the caller may sleep
+int ahci_io(uint32_t lba, uint32_t count, void* buffer, uint8_t op);
+
+// From the shared PCI interrupt, and from pollers
+void ahci_interrupt_handler(void);
+void ahci_poll(void);
+
+void ahci_get_stats(ahci_stats_t* stats);
+void ahci_print_info(void);
+
+#endif // AHCI_H
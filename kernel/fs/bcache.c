@@ -0,0 +1,336 @@
+#include "bcache.h"
+#include "disk.h"
+#include "lru.h"
+#include "../mm/memory.h"
+#include "../arch/cpu.h"
+#include "../arch/div64.h"
+#include "../proc/process.h"
+#include "../proc/scheduler.h"
+#include "../proc/futex.h"
+#include "../proc/mutex.h"
+#include "../drivers/vga.h"
+
+#define BCACHE_NONE             (-1)
+#define BCACHE_SECTORS          (BLOCK_SIZE / SECTOR_SIZE)
+
+_Static_assert((BCACHE_HASH_SIZE & (BCACHE_HASH_SIZE - 1)) == 0, "BCACHE_HASH_SIZE");
+
+typedef struct {
+    uint32_t block;
+    int16_t hash_next;
+    bool valid;
+    bool dirty;
+} bcache_entry_t;
+
+static bcache_entry_t entries[BCACHE_BLOCKS];
+static uint8_t* data;                       // BCACHE_BLOCKS blocks, NULL: uncached
+static int16_t hash[BCACHE_HASH_SIZE];
+static lru_link_t lru_links[BCACHE_BLOCKS];
+static lru_list_t lru = LRU_LIST_INIT(lru_links);
+static kmutex_t bcache_lock = KMUTEX_INIT("bcache");
+static bcache_stats_t bcache_stats;
+static volatile uint32_t flusher_kick;
+
+static inline uint8_t* slot_data(int16_t i) {
+    return data + (uint32_t)i * BLOCK_SIZE;
+}
+
+static inline uint32_t hash_of(uint32_t block) {
+    return block & (BCACHE_HASH_SIZE - 1);
+}
+
+// All below: lock held
+
+static int16_t lookup(uint32_t block) {
+    for (int16_t i = hash[hash_of(block)]; i != BCACHE_NONE; i = entries[i].hash_next) {
+        if (entries[i].block == block) return i;
+    }
+    return BCACHE_NONE;
+}
+
+static void hash_remove(int16_t i) {
+    int16_t* link = &hash[hash_of(entries[i].block)];
+    while (*link != i) link = &entries[*link].hash_next;
+    *link = entries[i].hash_next;
+}
+
+static int write_back(int16_t i) {
+    int result = disk_write_sectors(entries[i].block * BCACHE_SECTORS, BCACHE_SECTORS, slot_data(i));
+    if (result != DISK_SUCCESS) {
+        bcache_stats.errors++;
+        return result;
+    }
+    entries[i].dirty = false;
+    bcache_stats.dirty--;
+    bcache_stats.write_backs++;
+    return DISK_SUCCESS;
+}
+
+// The least recently used slot, emptied (written back first if dirty) and
+// taken out of the hash
+static int16_t evict(int* result) {
+    int16_t i = lru.tail;
+    bcache_entry_t* e = &entries[i];
+    *result = DISK_SUCCESS;
+    if (!e->valid) return i;
+    if (e->dirty) {
+        *result = write_back(i);
+        if (*result != DISK_SUCCESS) return BCACHE_NONE;
+        bcache_stats.dirty_evictions++;
+    }
+    hash_remove(i);
+    e->valid = false;
+    bcache_stats.evictions++;
+    bcache_stats.cached--;
+    return i;
+}
+
+// Forget a clean block; its slot is the next to be reused
+static void drop(int16_t i) {
+    hash_remove(i);
+    entries[i].valid = false;
+    bcache_stats.cached--;
+    lru_demote(&lru, i);
+}
+
+static void insert(int16_t i, uint32_t block) {
+    bcache_entry_t* e = &entries[i];
+    e->block = block;
+    e->valid = true;
+    e->dirty = false;
+    e->hash_next = hash[hash_of(block)];
+    hash[hash_of(block)] = i;
+    lru_touch(&lru, i);
+    bcache_stats.cached++;
+}
+
+int bcache_read(uint32_t block, void* buffer) {
+    if (!data) return disk_read_sectors(block * BCACHE_SECTORS, BCACHE_SECTORS, buffer);
+
+    kmutex_lock(&bcache_lock);
+    int16_t i = lookup(block);
+    int result = DISK_SUCCESS;
+    if (i != BCACHE_NONE) {
+        bcache_stats.hits++;
+        lru_touch(&lru, i);
+    } else {
+        bcache_stats.misses++;
+        i = evict(&result);
+        if (i != BCACHE_NONE) {
+            result = disk_read_sectors(block * BCACHE_SECTORS, BCACHE_SECTORS, slot_data(i));
+            if (result == DISK_SUCCESS) {
+                insert(i, block);
+            } else {
+                bcache_stats.errors++;
+                i = BCACHE_NONE;
+            }
+        }
+    }
+    if (i != BCACHE_NONE) memcpy(buffer, slot_data(i), BLOCK_SIZE);
+    kmutex_unlock(&bcache_lock);
+    return result;
+}
+
+int bcache_write(uint32_t block, const void* buffer) {
+    if (!data) return disk_write_sectors(block * BCACHE_SECTORS, BCACHE_SECTORS, buffer);
+
+    kmutex_lock(&bcache_lock);
+    int16_t i = lookup(block);
+    int result = DISK_SUCCESS;
+    if (i != BCACHE_NONE) {
+        lru_touch(&lru, i);
+    } else {
+        // The whole block is replaced: nothing to read first
+        i = evict(&result);
+        if (i != BCACHE_NONE) insert(i, block);
+    }
+    if (i != BCACHE_NONE) {
+        memcpy(slot_data(i), buffer, BLOCK_SIZE);
+        if (!entries[i].dirty) {
+            entries[i].dirty = true;
+            bcache_stats.dirty++;
+        }
+        bcache_stats.writes++;
+    }
+    bool kick = bcache_stats.dirty >= BCACHE_DIRTY_HIGH;
+    kmutex_unlock(&bcache_lock);
+
+    if (kick) {
+        store_release(&flusher_kick, 1);
+        futex_wake(&flusher_kick, FUTEX_WAKE_ALL);
+    }
+    return result;
+}
+
+int bcache_read_run(uint32_t block, uint32_t count, void* buffer) {
+    if (!data) return disk_read_sectors(block * BCACHE_SECTORS, count * BCACHE_SECTORS, buffer);
+
+    // The disk up to date for what it is about to return
+    kmutex_lock(&bcache_lock);
+    int result = DISK_SUCCESS;
+    for (uint32_t n = 0; n < count && result == DISK_SUCCESS; n++) {
+        int16_t i = lookup(block + n);
+        if (i != BCACHE_NONE && entries[i].dirty) result = write_back(i);
+    }
+    bcache_stats.run_reads++;
+    kmutex_unlock(&bcache_lock);
+    if (result != DISK_SUCCESS) return result;
+
+    result = disk_read_sectors(block * BCACHE_SECTORS, count * BCACHE_SECTORS, buffer);
+    if (result != DISK_SUCCESS) {
+        __sync_fetch_and_add(&bcache_stats.errors, 1);
+    }
+    return result;
+}
+
+int bcache_write_run(uint32_t block, uint32_t count, const void* buffer) {
+    if (!data) return disk_write_sectors(block * BCACHE_SECTORS, count * BCACHE_SECTORS, buffer);
+
+    // Cached copies take the new data as clean, so no older dirty copy can
+    // be written back after it
+    kmutex_lock(&bcache_lock);
+    for (uint32_t n = 0; n < count; n++) {
+        int16_t i = lookup(block + n);
+        if (i == BCACHE_NONE) continue;
+        memcpy(slot_data(i), (const uint8_t*)buffer + n * BLOCK_SIZE, BLOCK_SIZE);
+        if (entries[i].dirty) {
+            entries[i].dirty = false;
+            bcache_stats.dirty--;
+        }
+    }
+    bcache_stats.run_writes++;
+    kmutex_unlock(&bcache_lock);
+
+    int result = disk_write_sectors(block * BCACHE_SECTORS, count * BCACHE_SECTORS, buffer);
+    if (result != DISK_SUCCESS) {
+        // The disk kept what it had: so must the cache
+        kmutex_lock(&bcache_lock);
+        for (uint32_t n = 0; n < count; n++) {
+            int16_t i = lookup(block + n);
+            if (i != BCACHE_NONE && !entries[i].dirty) drop(i);
+        }
+        bcache_stats.errors++;
+        kmutex_unlock(&bcache_lock);
+    }
+    return result;
+}
+
+// Oldest first, one block per hold of the lock so readers get in between;
+// the number written, or -1 if one failed
+static int write_back_all(void) {
+    int written = 0;
+    for (;;) {
+        kmutex_lock(&bcache_lock);
+        int16_t i = lru.tail;
+        while (i != LRU_NONE && !(entries[i].valid && entries[i].dirty)) {
+            i = lru_links[i].prev;
+        }
+        if (i == LRU_NONE) {
+            kmutex_unlock(&bcache_lock);
+            return written;
+        }
+        int result = write_back(i);
+        kmutex_unlock(&bcache_lock);
+        if (result != DISK_SUCCESS) return -1;
+        written++;
+    }
+}
+
+static void bcache_flusher_task(void) {
+    for (;;) {
+        futex_wait(&flusher_kick, 0, BCACHE_FLUSH_MS);
+        store_release(&flusher_kick, 0);
+        if (write_back_all() > 0) {
+            bcache_stats.flushes++;
+        }
+    }
+}
+
+int bcache_sync(void) {
+    if (data && write_back_all() < 0) return DISK_ERROR;
+    return disk_flush();
+}
+
+int bcache_init(void) {
+    for (int i = 0; i < BCACHE_HASH_SIZE; i++) {
+        hash[i] = BCACHE_NONE;
+    }
+    for (int16_t i = 0; i < BCACHE_BLOCKS; i++) {
+        entries[i].valid = false;
+        entries[i].dirty = false;
+        entries[i].hash_next = BCACHE_NONE;
+    }
+    lru_reset(&lru, BCACHE_BLOCKS);
+    memset(&bcache_stats, 0, sizeof(bcache_stats));
+
+    data = (uint8_t*)kmalloc(BCACHE_BLOCKS * BLOCK_SIZE);
+    if (!data) {
+        vga_write_string("Block cache: no memory, filesystem uncached\n");
+        return -1;
+    }
+    process_t* task = process_create("bcache_flush", bcache_flusher_task, PRIORITY_LOW);
+    if (!task) {
+        // Nobody to write back: stay write-through
+        kfree(data);
+        data = NULL;
+        return -1;
+    }
+    scheduler_add_process(task);
+    return 0;
+}
+
+void bcache_get_stats(bcache_stats_t* stats) {
+    if (!stats) return;
+    kmutex_lock(&bcache_lock);
+    *stats = bcache_stats;
+    kmutex_unlock(&bcache_lock);
+}
+
+void bcache_print_info(void) {
+    bcache_stats_t stats;
+    bcache_get_stats(&stats);
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Block Cache ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    if (!data) {
+        vga_write_string("Off: every block goes to the disk\n");
+        return;
+    }
+    vga_write_string("Blocks: ");
+    print_dec(stats.cached);
+    vga_write_string(" of ");
+    print_dec(BCACHE_BLOCKS);
+    vga_write_string(" cached, ");
+    print_dec(stats.dirty);
+    vga_write_string(" dirty\n");
+
+    vga_write_string("Hits: ");
+    print_dec(stats.hits);
+    vga_write_string("  Misses: ");
+    print_dec(stats.misses);
+    uint32_t lookups = stats.hits + stats.misses;
+    if (lookups) {
+        vga_write_string("  (");
+        print_dec((uint32_t)div_u64_u32((uint64_t)stats.hits * 100, lookups, NULL));
+        vga_write_string("% hit)");
+    }
+    vga_write_string("\nWrites: ");
+    print_dec(stats.writes);
+    vga_write_string("  Written back: ");
+    print_dec(stats.write_backs);
+    vga_write_string("  Flusher rounds: ");
+    print_dec(stats.flushes);
+    vga_write_string("\nEvictions: ");
+    print_dec(stats.evictions);
+    vga_write_string(" (dirty: ");
+    print_dec(stats.dirty_evictions);
+    vga_write_string(")  Runs read/written: ");
+    print_dec(stats.run_reads);
+    vga_write_string("/");
+    print_dec(stats.run_writes);
+    vga_write_string("\nErrors: ");
+    print_dec(stats.errors);
+    vga_write_string("\n");
+}
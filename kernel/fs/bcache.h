@@ -0,0 +1,61 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "../types.h"
+#include "fs.h"
+
+// Block cache between the filesystem and the disk. Single blocks (the
+// superblock, inodes, bitmaps, directories, pointer tables, partial data
+// blocks) are kept in BCACHE_BLOCKS slots found by a hash on the block
+// number and recycled least recently used first, so path lookups and
+// listings read each block from the disk once. Writes only mark the slot
+// dirty: a low priority flusher writes dirty blocks back every
+// BCACHE_FLUSH_MS, or sooner once BCACHE_DIRTY_HIGH of them are waiting,
+// and a dirty block chosen for eviction is written first. bcache_sync
+// writes everything and flushes the drive's own cache.
+//
+// Runs of whole data blocks bypass the cache, so one large file does not
+// push out all the metadata. The lock is a mutex held across single-block
+// transfers, so a block is never written back out of order while the
+// caller sleeps on the disk with interrupts on, but not across runs: a run
+// read first writes back the dirty copies it covers, and a run write
+// replaces the cached copies before it goes out (dropping them if it
+// fails). Process context only.
+#define BCACHE_BLOCKS           256         // 128 KB
+#define BCACHE_HASH_SIZE        64          // Power of two
+#define BCACHE_FLUSH_MS         1000
+#define BCACHE_DIRTY_HIGH       (BCACHE_BLOCKS / 2)
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t writes;            // Blocks dirtied
+    uint32_t write_backs;       // Dirty blocks written
+    uint32_t evictions;
+    uint32_t dirty_evictions;   // Had to be written first
+    uint32_t run_reads;         // Bypassing transfers
+    uint32_t run_writes;
+    uint32_t flushes;           // Flusher rounds that wrote something
+    uint32_t errors;
+    uint32_t cached;            // Blocks held now
+    uint32_t dirty;             // Of them, not yet on disk
+} bcache_stats_t;
+
+// After disk_init: allocates the slots and starts the flusher
+int bcache_init(void);
+
+// One block: DISK_SUCCESS or the disk's error
+int bcache_read(uint32_t block, void* buffer);
+int bcache_write(uint32_t block, const void* buffer);
+
+// count consecutive blocks in one transfer, outside the cache
+int bcache_read_run(uint32_t block, uint32_t count, void* buffer);
+int bcache_write_run(uint32_t block, uint32_t count, const void* buffer);
+
+// Every dirty block to the disk, then the drive's cache
+int bcache_sync(void);
+
+void bcache_get_stats(bcache_stats_t* stats);
+void bcache_print_info(void);
+
+#endif // BCACHE_H
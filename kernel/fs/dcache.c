@@ -0,0 +1,182 @@
+#include "dcache.h"
+#include "lru.h"
+#include "../mm/memory.h"
+#include "../arch/spinlock.h"
+#include "../arch/div64.h"
+#include "../drivers/vga.h"
+
+#define DCACHE_NONE             (-1)
+
+_Static_assert((DCACHE_HASH_SIZE & (DCACHE_HASH_SIZE - 1)) == 0, "DCACHE_HASH_SIZE");
+
+typedef struct {
+    uint32_t dir;
+    uint32_t inode_num;         // 0: negative
+    uint32_t hash;              // Of the name
+    int16_t hash_next;
+    uint8_t len;
+    bool valid;
+    char name[MAX_FILENAME_LENGTH];
+} dcache_entry_t;
+
+static dcache_entry_t entries[DCACHE_ENTRIES];
+static int16_t hash[DCACHE_HASH_SIZE];
+static lru_link_t lru_links[DCACHE_ENTRIES];
+static lru_list_t lru = LRU_LIST_INIT(lru_links);
+static spinlock_t dcache_lock = SPINLOCK_INIT;
+static dcache_stats_t dcache_stats;
+
+uint32_t dcache_hash_name(const char* name, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static inline uint32_t bucket_of(uint32_t dir, uint32_t name_hash) {
+    return (name_hash ^ (dir * 2654435761u)) & (DCACHE_HASH_SIZE - 1);
+}
+
+// All below: lock held
+
+static int16_t lookup(uint32_t dir, uint32_t name_hash, const char* name, size_t len) {
+    for (int16_t i = hash[bucket_of(dir, name_hash)]; i != DCACHE_NONE; i = entries[i].hash_next) {
+        dcache_entry_t* e = &entries[i];
+        if (e->dir == dir && e->hash == name_hash && e->len == len && memcmp(e->name, name, len) == 0) {
+            return i;
+        }
+    }
+    return DCACHE_NONE;
+}
+
+static void hash_remove(int16_t i) {
+    int16_t* link = &hash[bucket_of(entries[i].dir, entries[i].hash)];
+    while (*link != i) link = &entries[*link].hash_next;
+    *link = entries[i].hash_next;
+}
+
+// Forget an entry; its slot is the next to be reused
+static void drop(int16_t i) {
+    hash_remove(i);
+    entries[i].valid = false;
+    dcache_stats.cached--;
+    lru_demote(&lru, i);
+}
+
+int dcache_lookup(uint32_t dir, const char* name, uint32_t* inode_num) {
+    size_t len = strlen(name);
+    if (len >= MAX_FILENAME_LENGTH) return DCACHE_MISS;
+    uint32_t name_hash = dcache_hash_name(name, len);
+
+    uint32_t flags = spin_lock_irqsave(&dcache_lock);
+    int16_t i = lookup(dir, name_hash, name, len);
+    int result = DCACHE_MISS;
+    if (i == DCACHE_NONE) {
+        dcache_stats.misses++;
+    } else {
+        lru_touch(&lru, i);
+        dcache_stats.hits++;
+        if (entries[i].inode_num) {
+            *inode_num = entries[i].inode_num;
+            result = FS_SUCCESS;
+        } else {
+            dcache_stats.negative_hits++;
+            result = FS_ERROR_NOT_FOUND;
+        }
+    }
+    spin_unlock_irqrestore(&dcache_lock, flags);
+    return result;
+}
+
+void dcache_enter(uint32_t dir, const char* name, size_t len, uint32_t inode_num) {
+    if (len >= MAX_FILENAME_LENGTH) return;
+    uint32_t name_hash = dcache_hash_name(name, len);
+
+    uint32_t flags = spin_lock_irqsave(&dcache_lock);
+    int16_t i = lookup(dir, name_hash, name, len);
+    if (i == DCACHE_NONE) {
+        i = lru.tail;
+        dcache_entry_t* e = &entries[i];
+        if (e->valid) {
+            hash_remove(i);
+            dcache_stats.evictions++;
+        } else {
+            dcache_stats.cached++;
+        }
+        e->dir = dir;
+        e->hash = name_hash;
+        e->len = (uint8_t)len;
+        memcpy(e->name, name, len);
+        e->valid = true;
+        e->hash_next = hash[bucket_of(dir, name_hash)];
+        hash[bucket_of(dir, name_hash)] = i;
+    }
+    entries[i].inode_num = inode_num;
+    lru_touch(&lru, i);
+    spin_unlock_irqrestore(&dcache_lock, flags);
+}
+
+void dcache_forget_dir(uint32_t dir) {
+    uint32_t flags = spin_lock_irqsave(&dcache_lock);
+    for (int16_t i = 0; i < DCACHE_ENTRIES; i++) {
+        if (entries[i].valid && entries[i].dir == dir) drop(i);
+    }
+    spin_unlock_irqrestore(&dcache_lock, flags);
+}
+
+void dcache_clear(void) {
+    uint32_t flags = spin_lock_irqsave(&dcache_lock);
+    for (int i = 0; i < DCACHE_HASH_SIZE; i++) {
+        hash[i] = DCACHE_NONE;
+    }
+    for (int16_t i = 0; i < DCACHE_ENTRIES; i++) {
+        entries[i].valid = false;
+        entries[i].hash_next = DCACHE_NONE;
+    }
+    lru_reset(&lru, DCACHE_ENTRIES);
+    dcache_stats.cached = 0;
+    spin_unlock_irqrestore(&dcache_lock, flags);
+}
+
+void dcache_init(void) {
+    memset(&dcache_stats, 0, sizeof(dcache_stats));
+    dcache_clear();
+}
+
+void dcache_get_stats(dcache_stats_t* stats) {
+    if (!stats) return;
+    uint32_t flags = spin_lock_irqsave(&dcache_lock);
+    *stats = dcache_stats;
+    spin_unlock_irqrestore(&dcache_lock, flags);
+}
+
+void dcache_print_info(void) {
+    dcache_stats_t stats;
+    dcache_get_stats(&stats);
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Name Cache ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string("Names: ");
+    print_dec(stats.cached);
+    vga_write_string(" of ");
+    print_dec(DCACHE_ENTRIES);
+    vga_write_string(" cached\nHits: ");
+    print_dec(stats.hits);
+    vga_write_string(" (negative: ");
+    print_dec(stats.negative_hits);
+    vga_write_string(")  Misses: ");
+    print_dec(stats.misses);
+    uint32_t lookups = stats.hits + stats.misses;
+    if (lookups) {
+        vga_write_string("  (");
+        print_dec((uint32_t)div_u64_u32((uint64_t)stats.hits * 100, lookups, NULL));
+        vga_write_string("% hit)");
+    }
+    vga_write_string("\nEvictions: ");
+    print_dec(stats.evictions);
+    vga_write_string("\n");
+}
@@ -0,0 +1,49 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include "../types.h"
+#include "fs.h"
+
+// Name lookup cache: (directory inode, name) to the inode the name stands
+// for, so resolving a path touches no directory block once its components
+// have been seen. Names looked up and not found are kept too, as negative
+// entries (inode 0): create checks that the name is free first, and a
+// capture job probing for today's file should not scan the directory each
+// time. DCACHE_ENTRIES entries, found by a hash on both keys and recycled
+// least recently used first.
+//
+// The filesystem keeps it exact: adding a name enters it, removing one
+// turns it negative, and a directory removed takes all its names along.
+#define DCACHE_ENTRIES          512
+#define DCACHE_HASH_SIZE        128         // Power of two
+
+#define DCACHE_MISS             1           // Not known either way
+
+typedef struct {
+    uint32_t hits;
+    uint32_t negative_hits;     // Of them, names known to be absent
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t cached;            // Entries held now
+} dcache_stats_t;
+
+void dcache_init(void);
+
+// FS_SUCCESS with *inode_num, FS_ERROR_NOT_FOUND if known absent, or
+// DCACHE_MISS
+int dcache_lookup(uint32_t dir, const char* name, uint32_t* inode_num);
+
+// inode_num 0: the name is known not to be there
+void dcache_enter(uint32_t dir, const char* name, size_t len, uint32_t inode_num);
+
+// Every name in a directory, or all names
+void dcache_forget_dir(uint32_t dir);
+void dcache_clear(void);
+
+// 32-bit FNV-1a of a name, shared with hashed directories
+uint32_t dcache_hash_name(const char* name, size_t len);
+
+void dcache_get_stats(dcache_stats_t* stats);
+void dcache_print_info(void);
+
+#endif // DCACHE_H
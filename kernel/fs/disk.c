@@ -1,7 +1,29 @@
 #include "disk.h"
+#include "ahci.h"
+#include "../mm/memory.h"
+#include "../arch/cpu.h"
+#include "../arch/tsc.h"
+#include "../arch/interrupts.h"
+#include "../drivers/pci.h"
+#include "../drivers/vga.h"
+#include "../proc/futex.h"
 
 static disk_t primary_disk;
 
+// One command in flight. The channel is claimed with interrupts off, so
+// its holder is never preempted with it: a PIO command and its data phase
+// run as one unit, and a DMA command is released by whoever sees it
+// complete (the interrupt, the waiter or a poller), not by the issuer.
+static volatile uint32_t disk_busy;
+
+typedef struct {
+    volatile uint32_t done;
+    int result;
+} disk_request_t;
+
+static disk_request_t* volatile dma_request;    // The DMA command in flight
+static disk_stats_t disk_stats;
+
 // I/O port access functions
 static inline void outb(uint16_t port, uint8_t value) {
     __asm__ volatile ("outb %0, %1" : : "a"(value), "Nd"(port));
@@ -13,6 +35,10 @@ static inline uint8_t inb(uint16_t port) {
     return ret;
 }
 
+static inline void outl(uint16_t port, uint32_t value) {
+    __asm__ volatile ("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
 static inline void insw(uint16_t port, void* buffer, uint32_t count) {
     __asm__ volatile ("rep insw" : "+D"(buffer), "+c"(count) : "d"(port) : "memory");
 }
@@ -62,6 +88,86 @@ static uint8_t _disk_read_status(uint16_t base_port) {
     return inb(base_port + ATA_REG_STATUS);
 }
 
+static void disk_dma_poll(void);
+
+// Interrupts off on return, until disk_release; the caller's EFLAGS
+static uint32_t disk_claim(void) {
+    bool waited = false;
+    for (;;) {
+        uint32_t flags = irq_save();
+        if (__sync_bool_compare_and_swap(&disk_busy, 0, 1)) {
+            if (waited) __sync_fetch_and_add(&disk_stats.channel_waits, 1);
+            return flags;
+        }
+        irq_restore(flags);
+        waited = true;
+        // A DMA command may be done with its interrupt held up on a CPU
+        // that has them off (perhaps this one): finish it here
+        disk_dma_poll();
+        if (!(flags & EFLAGS_IF) || futex_wait(&disk_busy, 1, DISK_DMA_WAIT_MS) < 0) {
+            cpu_relax();
+        }
+    }
+}
+
+static void disk_unclaim(void) {
+    store_release(&disk_busy, 0);
+    futex_wake(&disk_busy, 1);
+}
+
+static void disk_release(uint32_t flags) {
+    disk_unclaim();
+    irq_restore(flags);
+}
+
+// The drive's multiple mode: the most sectors per DRQ block it takes, up
+// to ATA_MAX_MULTIPLE (a power of two); 1 leaves it off
+static void _disk_set_multiple(const uint16_t* identify) {
+    uint32_t most = identify[ATA_ID_MULTIPLE] & 0xFF;
+    uint32_t count = 1;
+    while (count * 2 <= most && count * 2 <= ATA_MAX_MULTIPLE) {
+        count *= 2;
+    }
+    primary_disk.multiple = 1;
+    if (count == 1) return;
+
+    uint16_t base = primary_disk.base_port;
+    _disk_select_drive(base, primary_disk.drive_num);
+    if (_disk_wait_ready(base) != DISK_SUCCESS) return;
+    outb(base + ATA_REG_SECCOUNT, (uint8_t)count);
+    outb(base + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+    if (_disk_wait_ready(base) == DISK_SUCCESS && !(_disk_read_status(base) & ATA_STATUS_ERR)) {
+        primary_disk.multiple = (uint8_t)count;
+    }
+}
+
+// The IDE controller's bus master, if the drive does DMA and the
+// controller is one that can
+static void _disk_setup_dma(const uint16_t* identify) {
+    primary_disk.bm_port = 0;
+    if (!(identify[ATA_ID_CAPABILITIES] & ATA_ID_CAP_DMA)) return;
+
+    pci_device_t ide;
+    if (pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &ide) != 0 ||
+        !(pci_read8(&ide, PCI_PROG_IF) & PCI_IDE_BUS_MASTER)) {
+        return;
+    }
+    uint16_t bm = pci_bar_port(&ide, PCI_IDE_BM_BAR);
+    if (!bm) return;
+    // 64-byte aligned and smaller than that: never across 64 KB
+    primary_disk.prdt = (ata_prd_t*)kmalloc_aligned(DISK_PRD_ENTRIES * sizeof(ata_prd_t), 64);
+    if (!primary_disk.prdt) return;
+
+    pci_enable_io_device(&ide);
+    outb(bm + ATA_BM_COMMAND, 0);
+    outb(bm + ATA_BM_STATUS, ATA_BM_STATUS_ERROR | ATA_BM_STATUS_IRQ);
+
+    // Completion interrupts from the drive
+    outb(primary_disk.ctrl_port, 0);
+    irq_unmask(ATA_IRQ_PRIMARY);
+    primary_disk.bm_port = bm;
+}
+
 int disk_init(void) {
     // Initialize primary disk
     primary_disk.base_port = ATA_PRIMARY_BASE;
@@ -69,6 +175,17 @@ int disk_init(void) {
     primary_disk.drive_num = 0;  // Master drive
     primary_disk.present = false;
     primary_disk.total_sectors = 0;
+    primary_disk.multiple = 1;
+    primary_disk.bm_port = 0;
+    primary_disk.ahci = false;
+    
+    // A SATA disk behind AHCI is used in preference
+    if (ahci_init() == 0) {
+        primary_disk.ahci = true;
+        primary_disk.total_sectors = ahci_total_sectors();
+        primary_disk.present = true;
+        return DISK_SUCCESS;
+    }
     
     // Select the primary master drive
     _disk_select_drive(primary_disk.base_port, primary_disk.drive_num);
@@ -97,18 +214,22 @@ int disk_init(void) {
     insw(primary_disk.base_port + ATA_REG_DATA, identify_data, 256);
     
     // Extract total sectors (assuming LBA28 for simplicity)
-    primary_disk.total_sectors = (uint32_t)identify_data[60] | ((uint32_t)identify_data[61] << 16);
+    primary_disk.total_sectors = (uint32_t)identify_data[ATA_ID_LBA_SECTORS] |
+                                 ((uint32_t)identify_data[ATA_ID_LBA_SECTORS + 1] << 16);
     primary_disk.present = true;
     
+    _disk_set_multiple(identify_data);
+    _disk_setup_dma(identify_data);
     return DISK_SUCCESS;
 }
 
-int disk_read_sector(uint32_t lba, void* buffer) {
+// Issue a transfer command for 'count' sectors (1 to ATA_MAX_SECTORS)
+static int _disk_command(uint32_t lba, uint32_t count, uint8_t command) {
     if (!primary_disk.present) {
         return DISK_ERROR;
     }
     
-    if (lba >= primary_disk.total_sectors) {
+    if (lba >= primary_disk.total_sectors || count > primary_disk.total_sectors - lba) {
         return DISK_ERROR;
     }
     
@@ -121,92 +242,238 @@ int disk_read_sector(uint32_t lba, void* buffer) {
     _disk_select_drive(primary_disk.base_port, primary_disk.drive_num);
     outb(primary_disk.base_port + ATA_REG_DRIVE, 0xE0 | (primary_disk.drive_num << 4) | ((lba >> 24) & 0x0F));
     
-    // Set sector count and LBA
-    outb(primary_disk.base_port + ATA_REG_SECCOUNT, 1);
+    // Set sector count (0 means 256) and LBA
+    outb(primary_disk.base_port + ATA_REG_SECCOUNT, (uint8_t)count);
     outb(primary_disk.base_port + ATA_REG_LBA_LOW, lba & 0xFF);
     outb(primary_disk.base_port + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
     outb(primary_disk.base_port + ATA_REG_LBA_HIGH, (lba >> 16) & 0xFF);
     
-    // Send read command
-    outb(primary_disk.base_port + ATA_REG_COMMAND, ATA_CMD_READ_SECTORS);
-    
-    // Wait for data to be ready
-    if (_disk_wait_data(primary_disk.base_port) != DISK_SUCCESS) {
-        return DISK_ERROR;
-    }
-    
-    // Read the sector data
-    insw(primary_disk.base_port + ATA_REG_DATA, buffer, SECTOR_SIZE / 2);
-    
+    outb(primary_disk.base_port + ATA_REG_COMMAND, command);
     return DISK_SUCCESS;
 }
 
-int disk_write_sector(uint32_t lba, const void* buffer) {
-    if (!primary_disk.present) {
-        return DISK_ERROR;
+// The DMA command in flight is over: stop the engine, collect the drive's
+// status (which also clears its interrupt) and hand the result over.
+// Once only, whoever gets here first.
+static void _disk_dma_finish(disk_request_t* request, uint8_t bm_status, int result) {
+    if (!__sync_bool_compare_and_swap(&dma_request, request, NULL)) return;
+
+    uint16_t bm = primary_disk.bm_port;
+    outb(bm + ATA_BM_COMMAND, 0);
+    uint8_t status = _disk_read_status(primary_disk.base_port);
+    outb(bm + ATA_BM_STATUS, ATA_BM_STATUS_ERROR | ATA_BM_STATUS_IRQ);
+    if (result == DISK_SUCCESS &&
+        ((bm_status & ATA_BM_STATUS_ERROR) || (status & (ATA_STATUS_ERR | ATA_STATUS_DF)))) {
+        result = DISK_ERROR;
     }
-    
-    if (lba >= primary_disk.total_sectors) {
-        return DISK_ERROR;
+    if (result != DISK_SUCCESS) {
+        __sync_fetch_and_add(result == DISK_TIMEOUT_ERR ? &disk_stats.dma_timeouts : &disk_stats.dma_errors, 1);
     }
-    
-    // Wait for drive to be ready
-    if (_disk_wait_ready(primary_disk.base_port) != DISK_SUCCESS) {
-        return DISK_TIMEOUT_ERR;
+
+    request->result = result;
+    store_release(&request->done, 1);
+    disk_unclaim();
+    futex_wake(&request->done, 1);
+}
+
+static void disk_dma_poll(void) {
+    disk_request_t* request = dma_request;
+    if (!request) return;
+    uint8_t bm_status = inb(primary_disk.bm_port + ATA_BM_STATUS);
+    if (bm_status & ATA_BM_STATUS_IRQ) {
+        _disk_dma_finish(request, bm_status, DISK_SUCCESS);
     }
-    
-    // Select drive and set LBA mode
-    _disk_select_drive(primary_disk.base_port, primary_disk.drive_num);
-    outb(primary_disk.base_port + ATA_REG_DRIVE, 0xE0 | (primary_disk.drive_num << 4) | ((lba >> 24) & 0x0F));
-    
-    // Set sector count and LBA
-    outb(primary_disk.base_port + ATA_REG_SECCOUNT, 1);
-    outb(primary_disk.base_port + ATA_REG_LBA_LOW, lba & 0xFF);
-    outb(primary_disk.base_port + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
-    outb(primary_disk.base_port + ATA_REG_LBA_HIGH, (lba >> 16) & 0xFF);
-    
-    // Send write command
-    outb(primary_disk.base_port + ATA_REG_COMMAND, ATA_CMD_WRITE_SECTORS);
-    
-    // Wait for drive to be ready for data
-    if (_disk_wait_data(primary_disk.base_port) != DISK_SUCCESS) {
-        return DISK_ERROR;
+}
+
+void disk_interrupt_handler(void) {
+    if (!primary_disk.present) return;
+    __sync_fetch_and_add(&disk_stats.interrupts, 1);
+    if (dma_request) {
+        disk_dma_poll();
+    } else {
+        // A PIO command: reading the status is the acknowledgement
+        _disk_read_status(primary_disk.base_port);
+    }
+}
+
+// The buffer as PRDs, split at 64 KB boundaries; false if it does not fit
+static bool _disk_build_prdt(const void* buffer, uint32_t bytes) {
+    uint32_t address = (uint32_t)buffer;
+    uint32_t entry = 0;
+    while (bytes) {
+        if (entry == DISK_PRD_ENTRIES) return false;
+        uint32_t length = ATA_PRD_MAX - (address & (ATA_PRD_MAX - 1));
+        if (length > bytes) length = bytes;
+        primary_disk.prdt[entry].address = address;
+        primary_disk.prdt[entry].bytes = (uint16_t)length;     // 64 KB wraps to 0
+        primary_disk.prdt[entry].flags = 0;
+        address += length;
+        bytes -= length;
+        entry++;
+    }
+    primary_disk.prdt[entry - 1].flags = ATA_PRD_EOT;
+    return true;
+}
+
+// One run by DMA; DISK_NOT_READY if this buffer cannot go that way
+static int _disk_dma(uint32_t lba, uint32_t count, void* buffer, bool write) {
+    if (((uint32_t)buffer & 1)) return DISK_NOT_READY;
+
+    disk_request_t request;
+    request.done = 0;
+    request.result = DISK_SUCCESS;
+
+    uint32_t flags = disk_claim();
+    if (!_disk_build_prdt(buffer, count * SECTOR_SIZE)) {
+        disk_release(flags);
+        return DISK_NOT_READY;
+    }
+    uint16_t bm = primary_disk.bm_port;
+    uint8_t direction = write ? 0 : ATA_BM_CMD_READ;
+    outb(bm + ATA_BM_COMMAND, 0);
+    outb(bm + ATA_BM_STATUS, ATA_BM_STATUS_ERROR | ATA_BM_STATUS_IRQ);
+    outl(bm + ATA_BM_PRDT, (uint32_t)primary_disk.prdt);
+    outb(bm + ATA_BM_COMMAND, direction);
+    int result = _disk_command(lba, count, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    if (result != DISK_SUCCESS) {
+        disk_release(flags);
+        return result;
+    }
+    dma_request = &request;
+    outb(bm + ATA_BM_COMMAND, direction | ATA_BM_CMD_START);
+    irq_restore(flags);
+
+    // Asleep until the interrupt where we may, else polling
+    bool sleep = flags & EFLAGS_IF;
+    __sync_fetch_and_add(sleep ? &disk_stats.dma_sleeps : &disk_stats.dma_polled, 1);
+    uint64_t deadline = ktime_ns() + (uint64_t)DISK_DMA_TIMEOUT_MS * 1000000;
+    while (!load_acquire(&request.done)) {
+        disk_dma_poll();
+        if (load_acquire(&request.done)) break;
+        if (ktime_ns() > deadline) {
+            _disk_dma_finish(&request, 0, DISK_TIMEOUT_ERR);
+            continue;           // Or it finished meanwhile: done either way
+        }
+        if (!sleep || futex_wait(&request.done, 0, DISK_DMA_WAIT_MS) < 0) {
+            cpu_relax();
+        }
+    }
+    __sync_fetch_and_add(&disk_stats.dma_commands, 1);
+    __sync_fetch_and_add(&disk_stats.dma_sectors, count);
+    return request.result;
+}
+
+// One run by PIO, a DRQ block of primary_disk.multiple sectors at a time
+static int _disk_pio(uint32_t lba, uint32_t count, void* buffer, bool write) {
+    uint32_t block = primary_disk.multiple;
+    uint8_t command = block > 1 ? (write ? ATA_CMD_WRITE_MULTIPLE : ATA_CMD_READ_MULTIPLE) :
+                                  (write ? ATA_CMD_WRITE_SECTORS : ATA_CMD_READ_SECTORS);
+    uint16_t data_port = primary_disk.base_port + ATA_REG_DATA;
+    char* buf = (char*)buffer;
+
+    uint32_t flags = disk_claim();
+    int result = _disk_command(lba, count, command);
+    for (uint32_t done = 0; done < count && result == DISK_SUCCESS; done += block) {
+        uint32_t sectors = count - done < block ? count - done : block;
+        if (_disk_wait_data(primary_disk.base_port) != DISK_SUCCESS) {
+            result = DISK_ERROR;
+            break;
+        }
+        if (write) {
+            outsw(data_port, buf, sectors * SECTOR_SIZE / 2);
+        } else {
+            insw(data_port, buf, sectors * SECTOR_SIZE / 2);
+        }
+        buf += sectors * SECTOR_SIZE;
     }
-    
-    // Write the sector data
-    outsw(primary_disk.base_port + ATA_REG_DATA, buffer, SECTOR_SIZE / 2);
     
     // Wait for write to complete
-    if (_disk_wait_ready(primary_disk.base_port) != DISK_SUCCESS) {
-        return DISK_ERROR;
+    if (write && result == DISK_SUCCESS && _disk_wait_ready(primary_disk.base_port) != DISK_SUCCESS) {
+        result = DISK_ERROR;
     }
-    
-    return DISK_SUCCESS;
+    disk_release(flags);
+    __sync_fetch_and_add(&disk_stats.pio_commands, 1);
+    __sync_fetch_and_add(&disk_stats.pio_sectors, count);
+    return result;
 }
 
-int disk_read_sectors(uint32_t lba, uint32_t count, void* buffer) {
+static int _disk_transfer(uint32_t lba, uint32_t count, void* buffer, bool write) {
+    if (primary_disk.ahci) {
+        return ahci_io(lba, count, buffer, write ? DISK_IO_WRITE : DISK_IO_READ);
+    }
     char* buf = (char*)buffer;
     
-    for (uint32_t i = 0; i < count; i++) {
-        int result = disk_read_sector(lba + i, buf + (i * SECTOR_SIZE));
+    while (count > 0) {
+        uint32_t run = count > ATA_MAX_SECTORS ? ATA_MAX_SECTORS : count;
+        int result = DISK_NOT_READY;
+        if (primary_disk.bm_port && run >= DISK_DMA_MIN_SECTORS) {
+            result = _disk_dma(lba, run, buf, write);
+        }
+        if (result == DISK_NOT_READY) {
+            result = _disk_pio(lba, run, buf, write);
+        }
         if (result != DISK_SUCCESS) {
             return result;
         }
+        buf += run * SECTOR_SIZE;
+        lba += run;
+        count -= run;
     }
     
     return DISK_SUCCESS;
 }
 
+int disk_read_sector(uint32_t lba, void* buffer) {
+    return disk_read_sectors(lba, 1, buffer);
+}
+
+int disk_write_sector(uint32_t lba, const void* buffer) {
+    return disk_write_sectors(lba, 1, buffer);
+}
+
+int disk_read_sectors(uint32_t lba, uint32_t count, void* buffer) {
+    return _disk_transfer(lba, count, buffer, false);
+}
+
 int disk_write_sectors(uint32_t lba, uint32_t count, const void* buffer) {
-    const char* buf = (const char*)buffer;
+    return _disk_transfer(lba, count, (void*)buffer, true);
+}
+
+// Written sectors can sit in the drive's cache until this returns
+int disk_flush(void) {
+    if (!primary_disk.present) {
+        return DISK_ERROR;
+    }
+    if (primary_disk.ahci) {
+        return ahci_io(0, 0, NULL, DISK_IO_FLUSH);
+    }
     
-    for (uint32_t i = 0; i < count; i++) {
-        int result = disk_write_sector(lba + i, buf + (i * SECTOR_SIZE));
-        if (result != DISK_SUCCESS) {
-            return result;
-        }
+    uint32_t flags = disk_claim();
+    int result = _disk_wait_ready(primary_disk.base_port);
+    if (result == DISK_SUCCESS) {
+        _disk_select_drive(primary_disk.base_port, primary_disk.drive_num);
+        outb(primary_disk.base_port + ATA_REG_COMMAND, ATA_CMD_FLUSH_CACHE);
+        result = _disk_wait_ready(primary_disk.base_port);
+    }
+    disk_release(flags);
+    return result;
+}
+
+int disk_submit(disk_io_t* io) {
+    if (!io || !io->done || io->op > DISK_IO_FLUSH || !primary_disk.present) {
+        return DISK_ERROR;
+    }
+    if (primary_disk.ahci) {
+        return ahci_submit(io);
     }
     
+    // The IDE channel takes one command at a time: done here and now
+    if (io->op == DISK_IO_FLUSH) {
+        io->result = disk_flush();
+    } else {
+        io->result = _disk_transfer(io->lba, io->count, io->buffer, io->op == DISK_IO_WRITE);
+    }
+    io->done(io);
     return DISK_SUCCESS;
 }
 
@@ -216,4 +483,58 @@ uint32_t disk_get_total_sectors(void) {
 
 bool disk_is_present(void) {
     return primary_disk.present;
-}
\ No newline at end of file
+}
+
+void disk_get_stats(disk_stats_t* stats) {
+    if (stats) *stats = disk_stats;
+}
+
+void disk_print_info(void) {
+    disk_stats_t stats;
+    disk_get_stats(&stats);
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Disk ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    if (!primary_disk.present) {
+        vga_write_string("No disk\n");
+        return;
+    }
+    if (primary_disk.ahci) {
+        ahci_print_info();
+        return;
+    }
+    vga_write_string("Primary master: ");
+    print_dec(primary_disk.total_sectors);
+    vga_write_string(" sectors, PIO ");
+    if (primary_disk.multiple > 1) {
+        vga_write_string("multiple ");
+        print_dec(primary_disk.multiple);
+    } else {
+        vga_write_string("single sector");
+    }
+    vga_write_string(primary_disk.bm_port ? ", bus master DMA\n" : ", no DMA\n");
+
+    vga_write_string("PIO: ");
+    print_dec(stats.pio_commands);
+    vga_write_string(" commands, ");
+    print_dec(stats.pio_sectors);
+    vga_write_string(" sectors\nDMA: ");
+    print_dec(stats.dma_commands);
+    vga_write_string(" commands, ");
+    print_dec(stats.dma_sectors);
+    vga_write_string(" sectors (slept ");
+    print_dec(stats.dma_sleeps);
+    vga_write_string(", polled ");
+    print_dec(stats.dma_polled);
+    vga_write_string(")\nErrors: ");
+    print_dec(stats.dma_errors);
+    vga_write_string("  Timeouts: ");
+    print_dec(stats.dma_timeouts);
+    vga_write_string("  Interrupts: ");
+    print_dec(stats.interrupts);
+    vga_write_string("  Channel waits: ");
+    print_dec(stats.channel_waits);
+    vga_write_string("\n");
+}
@@ -3,9 +3,39 @@
 
 #include "../types.h"
 
+// Primary master ATA disk. A transfer is one command per run of up to
+// ATA_MAX_SECTORS. With PIO the drive is switched to READ/WRITE MULTIPLE
+// where it can, so it raises DRQ once per block of sectors rather than per
+// sector; the words are still moved by the CPU, interrupts off for the
+// run. Where the IDE controller can master the bus, runs of
+// DISK_DMA_MIN_SECTORS and more go by DMA instead: the buffer is described
+// in a PRD table, the controller moves it, and the caller sleeps until the
+// completion interrupt (IRQ 14). A caller that may not sleep (interrupts
+// off, or the idle context) polls the controller instead, and so does any
+// caller waiting for the channel, so a completion is never stuck behind a
+// CPU with interrupts off.
+//
+// Memory is identity mapped, so buffer addresses are physical; a PRD may
+// not cross a 64 KB boundary, so a run is split at them.
+//
+// When an AHCI controller has a SATA disk (ahci.h), that disk is the one
+// used instead, and requests no longer take turns: disk_submit queues one
+// and returns, and its completion callback runs when the drive is done,
+// with up to 32 commands outstanding (NCQ). The synchronous calls submit
+// and wait. Without AHCI, disk_submit does the transfer there and then and
+// calls back before it returns.
+
 // Disk constants
 #define SECTOR_SIZE 512
 #define DISK_TIMEOUT 1000000  // Timeout for disk operations
+#define ATA_MAX_SECTORS 256   // Per command (a sector count of 0)
+#define DISK_JOURNAL_SECTORS 8192  // The last sectors, outside the filesystem
+#define ATA_MAX_MULTIPLE    16    // Sectors per DRQ block we ask for
+#define DISK_DMA_MIN_SECTORS 8    // Shorter runs are cheaper by PIO
+#define DISK_PRD_ENTRIES    8     // A run splits at most in three
+#define DISK_DMA_TIMEOUT_MS 2000
+#define DISK_DMA_WAIT_MS    10    // Sleeps between polls, in case the interrupt is lost
+#define ATA_IRQ_PRIMARY     14
 
 // Disk status codes
 #define DISK_SUCCESS    0
@@ -31,16 +61,78 @@
 #define ATA_REG_STATUS     0x07
 #define ATA_REG_COMMAND    0x07
 
+// Device control register (ctrl_port)
+#define ATA_CTRL_NIEN      0x02  // Interrupts off
+
 // ATA status register bits
 #define ATA_STATUS_BSY     0x80  // Busy
 #define ATA_STATUS_DRDY    0x40  // Drive ready
+#define ATA_STATUS_DF      0x20  // Device fault
 #define ATA_STATUS_DRQ     0x08  // Data request
 #define ATA_STATUS_ERR     0x01  // Error
 
 // ATA commands
 #define ATA_CMD_READ_SECTORS  0x20
 #define ATA_CMD_WRITE_SECTORS 0x30
+#define ATA_CMD_READ_MULTIPLE 0xC4
+#define ATA_CMD_WRITE_MULTIPLE 0xC5
+#define ATA_CMD_SET_MULTIPLE  0xC6
+#define ATA_CMD_READ_DMA      0xC8
+#define ATA_CMD_WRITE_DMA     0xCA
 #define ATA_CMD_IDENTIFY      0xEC
+#define ATA_CMD_FLUSH_CACHE   0xE7
+
+// IDENTIFY words
+#define ATA_ID_MULTIPLE       47    // Low byte: most sectors per DRQ block
+#define ATA_ID_CAPABILITIES   49
+#define ATA_ID_CAP_DMA        0x0100
+#define ATA_ID_LBA_SECTORS    60
+
+// IDE bus master registers, primary channel (PCI BAR4)
+#define ATA_BM_COMMAND        0x00
+#define ATA_BM_STATUS         0x02
+#define ATA_BM_PRDT           0x04
+#define ATA_BM_CMD_START      0x01
+#define ATA_BM_CMD_READ       0x08  // Device to memory
+#define ATA_BM_STATUS_ACTIVE  0x01
+#define ATA_BM_STATUS_ERROR   0x02
+#define ATA_BM_STATUS_IRQ     0x04
+#define ATA_PRD_EOT           0x8000
+#define ATA_PRD_MAX           0x10000
+
+#define PCI_CLASS_STORAGE     0x01
+#define PCI_SUBCLASS_IDE      0x01
+#define PCI_IDE_BUS_MASTER    0x80  // Programming interface bit
+#define PCI_IDE_BM_BAR        4
+
+// Physical Region Descriptor: one contiguous piece of the buffer
+typedef struct {
+    uint32_t address;
+    uint16_t bytes;           // 0: 64 KB
+    uint16_t flags;           // ATA_PRD_EOT on the last
+} __attribute__((packed)) ata_prd_t;
+
+// Asynchronous requests
+#define DISK_IO_READ        0
+#define DISK_IO_WRITE       1
+#define DISK_IO_FLUSH       2     // After everything submitted before it
+
+typedef struct disk_io disk_io_t;
+
+// Called once per request, often from the completion interrupt: may wake
+// but not sleep. The request is the caller's again from then on.
+typedef void (*disk_io_done_t)(disk_io_t* io);
+
+struct disk_io {
+    uint32_t lba;
+    uint32_t count;           // Sectors
+    void* buffer;             // 2-byte aligned, identity mapped
+    uint8_t op;               // DISK_IO_*
+    int result;               // DISK_SUCCESS or an error, set before done
+    disk_io_done_t done;
+    void* data;               // The caller's
+    disk_io_t* next;          // The driver's while queued
+};
 
 // Disk structure
 typedef struct {
@@ -49,18 +141,44 @@ typedef struct {
     uint8_t drive_num;        // Drive number (0 = master, 1 = slave)
     uint32_t total_sectors;   // Total number of sectors
     bool present;             // Whether disk is present
+    uint8_t multiple;         // Sectors per DRQ block, 1 without READ/WRITE MULTIPLE
+    uint16_t bm_port;         // Bus master registers, 0 without DMA
+    ata_prd_t* prdt;
+    bool ahci;                // The disk is on the AHCI controller instead
 } disk_t;
 
+typedef struct {
+    uint32_t pio_commands;
+    uint32_t pio_sectors;
+    uint32_t dma_commands;
+    uint32_t dma_sectors;
+    uint32_t dma_sleeps;      // Waited for the interrupt asleep
+    uint32_t dma_polled;      // Waited polling: could not sleep
+    uint32_t dma_errors;
+    uint32_t dma_timeouts;
+    uint32_t interrupts;
+    uint32_t channel_waits;   // Found another command in flight
+} disk_stats_t;
+
 // Function prototypes
 int disk_init(void);
 int disk_read_sector(uint32_t lba, void* buffer);
 int disk_write_sector(uint32_t lba, const void* buffer);
 int disk_read_sectors(uint32_t lba, uint32_t count, void* buffer);
 int disk_write_sectors(uint32_t lba, uint32_t count, const void* buffer);
+int disk_flush(void);
+
+// Queue a request: DISK_SUCCESS and io->done will be called, or an error
+// at once (bad range or buffer) and it will not be
+int disk_submit(disk_io_t* io);
+
 uint32_t disk_get_total_sectors(void);
 bool disk_is_present(void);
 
-// Internal helper functions (defined in disk.c)
+// IRQ 14
+void disk_interrupt_handler(void);
 
+void disk_get_stats(disk_stats_t* stats);
+void disk_print_info(void);
 
 #endif // DISK_H
\ No newline at end of file
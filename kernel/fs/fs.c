@@ -1,10 +1,15 @@
 #include "fs.h"
 #include "disk.h"
+#include "bcache.h"
+#include "dcache.h"
 #include "../mm/memory.h"
 #include "../drivers/vga.h"
 
 // File system constants
 #define FS_MAGIC 0x54524144  // "TRAD" - TradeKernel filesystem magic
+#define DIRECT_BLOCKS    12
+#define PTRS_PER_BLOCK   (BLOCK_SIZE / sizeof(uint32_t))
+#define BITMAP_BITS      (BLOCK_SIZE * 8)   // Per bitmap block
 
 // Global file system state
 static bool fs_mounted = false;
@@ -13,46 +18,82 @@ static file_descriptor_t file_descriptors[MAX_OPEN_FILES];
 static uint8_t* block_bitmap = NULL;    // Block allocation bitmap
 static uint8_t* inode_bitmap = NULL;    // Inode allocation bitmap
 
+// Bitmap blocks changed since the last fs_sync_allocation, as a range of
+// each bitmap (first > last: none)
+static uint32_t block_bitmap_first, block_bitmap_last;
+static uint32_t inode_bitmap_first, inode_bitmap_last;
+
+// Next fit: searches start where the last allocation ended, so a run of
+// allocations (a file being appended to) neither rescans the full front
+// of the disk nor scatters; a file that already has blocks moves the
+// cursor behind its last one first
+static uint32_t block_cursor;
+static uint32_t inode_cursor = 1;
+
+// Block pointer tables last used, one per level (0: double indirect, 1:
+// tables of data blocks), so sequential access reads each table once.
+// Updates stay here until map_flush.
+static uint32_t map_block[2];
+static bool map_dirty[2];
+static uint32_t map_table[2][PTRS_PER_BLOCK];
+
 // Forward declarations for internal functions
 static int find_directory_entry(uint32_t dir_inode_num, const char* name, directory_entry_t* entry);
 static int resolve_path(const char* path, uint32_t* inode_num);
 static int add_directory_entry(uint32_t dir_inode_num, const char* name, uint32_t entry_inode_num, uint8_t file_type);
+static int lookup_name(uint32_t dir_inode_num, const char* name, uint32_t* inode_num);
 
-// Helper function to convert block number to LBA
-static uint32_t block_to_lba(uint32_t block_num) {
-    return block_num * (BLOCK_SIZE / SECTOR_SIZE);
+static bool block_range_valid(uint32_t block_num, uint32_t count) {
+    return block_num < superblock.total_blocks && count <= superblock.total_blocks - block_num;
+}
+
+// Read consecutive blocks from disk in one transfer, past the block cache
+static int read_blocks(uint32_t block_num, uint32_t count, void* buffer) {
+    if (!block_range_valid(block_num, count)) {
+        return FS_ERROR_INVALID;
+    }
+    return bcache_read_run(block_num, count, buffer);
 }
 
-// Read a block from disk
+// Write consecutive blocks to disk in one transfer, past the block cache
+static int write_blocks(uint32_t block_num, uint32_t count, const void* buffer) {
+    if (!block_range_valid(block_num, count)) {
+        return FS_ERROR_INVALID;
+    }
+    return bcache_write_run(block_num, count, buffer);
+}
+
+// Read a block through the block cache
 static int read_block(uint32_t block_num, void* buffer) {
-    if (block_num >= superblock.total_blocks) {
+    if (!block_range_valid(block_num, 1)) {
         return FS_ERROR_INVALID;
     }
-    
-    uint32_t lba = block_to_lba(block_num);
-    uint32_t sectors = BLOCK_SIZE / SECTOR_SIZE;
-    
-    return disk_read_sectors(lba, sectors, buffer);
+    return bcache_read(block_num, buffer);
 }
 
-// Write a block to disk
+// Write a block into the block cache; the flusher writes it back
 static int write_block(uint32_t block_num, const void* buffer) {
-    if (block_num >= superblock.total_blocks) {
+    if (!block_range_valid(block_num, 1)) {
         return FS_ERROR_INVALID;
     }
-    
-    uint32_t lba = block_to_lba(block_num);
-    uint32_t sectors = BLOCK_SIZE / SECTOR_SIZE;
-    
-    return disk_write_sectors(lba, sectors, buffer);
+    return bcache_write(block_num, buffer);
 }
 
+// The superblock is smaller than its block: go through a whole one
 int _fs_read_superblock(superblock_t* sb) {
-    return read_block(0, sb);
+    uint8_t block_buffer[BLOCK_SIZE];
+    if (read_block(0, block_buffer) != DISK_SUCCESS) {
+        return FS_ERROR_INVALID;
+    }
+    memcpy(sb, block_buffer, sizeof(superblock_t));
+    return FS_SUCCESS;
 }
 
 int _fs_write_superblock(const superblock_t* sb) {
-    return write_block(0, sb);
+    uint8_t block_buffer[BLOCK_SIZE];
+    memset(block_buffer, 0, BLOCK_SIZE);
+    memcpy(block_buffer, sb, sizeof(superblock_t));
+    return write_block(0, block_buffer);
 }
 
 int _fs_read_inode(uint32_t inode_num, inode_t* inode) {
@@ -104,25 +145,141 @@ int _fs_write_inode(uint32_t inode_num, const inode_t* inode) {
     return write_block(block_num, block_buffer);
 }
 
+// Older disks record no bitmap sizes: one block each
+static uint32_t block_bitmap_blocks(void) {
+    return superblock.block_bitmap_blocks ? superblock.block_bitmap_blocks : 1;
+}
+
+static uint32_t inode_bitmap_blocks(void) {
+    return superblock.inode_bitmap_blocks ? superblock.inode_bitmap_blocks : 1;
+}
+
+static uint32_t block_bitmap_start(void) {
+    return 1 + superblock.inode_blocks;
+}
+
+static uint32_t inode_bitmap_start(void) {
+    return block_bitmap_start() + block_bitmap_blocks();
+}
+
+static void bitmap_dirty(uint32_t* first, uint32_t* last, uint32_t bit) {
+    uint32_t block = bit / BITMAP_BITS;
+    if (*first > *last) {
+        *first = *last = block;
+    } else if (block < *first) {
+        *first = block;
+    } else if (block > *last) {
+        *last = block;
+    }
+}
+
+static inline bool block_in_use(uint32_t block) {
+    return block_bitmap[block / 8] & (1 << (block % 8));
+}
+
+static void block_mark(uint32_t block, bool used) {
+    if (used) {
+        block_bitmap[block / 8] |= (1 << (block % 8));
+        superblock.free_blocks--;
+    } else {
+        block_bitmap[block / 8] &= ~(1 << (block % 8));
+        superblock.free_blocks++;
+    }
+    bitmap_dirty(&block_bitmap_first, &block_bitmap_last, block);
+}
+
+// First clear bit at or after 'from' in the first 'total' bits of a
+// bitmap, wrapping around; whole words, then bytes, of used entries are
+// skipped at once
+static int bitmap_find_clear(const uint8_t* bitmap, uint32_t total, uint32_t from) {
+    if (from >= total) from = 0;
+    for (uint32_t pass = 0; pass < 2; pass++) {
+        uint32_t end = pass ? from : total;
+        uint32_t i = pass ? 0 : from;
+        while (i < end) {
+            if ((i & 31) == 0 && i + 32 <= end && *(const uint32_t*)(bitmap + i / 8) == 0xFFFFFFFF) {
+                i += 32;
+                continue;
+            }
+            if ((i & 7) == 0 && bitmap[i / 8] == 0xFF) {
+                i += 8;
+                continue;
+            }
+            if (!(bitmap[i / 8] & (1 << (i % 8)))) return (int)i;
+            i++;
+        }
+    }
+    return FS_ERROR_NO_SPACE;
+}
+
+static int find_free_block(uint32_t from) {
+    return bitmap_find_clear(block_bitmap, superblock.total_blocks, from);
+}
+
 int _fs_allocate_block(void) {
     if (!block_bitmap) {
         return FS_ERROR_INVALID;
     }
     
-    // Find first free block
-    for (uint32_t i = 0; i < superblock.total_blocks; i++) {
-        uint32_t byte_index = i / 8;
-        uint32_t bit_index = i % 8;
-        
-        if (!(block_bitmap[byte_index] & (1 << bit_index))) {
-            // Mark block as used
-            block_bitmap[byte_index] |= (1 << bit_index);
-            superblock.free_blocks--;
-            return i;
+    // Find the next free block from the cursor
+    int block = find_free_block(block_cursor);
+    if (block >= 0) {
+        block_mark((uint32_t)block, true);
+        block_cursor = (uint32_t)block + 1;
+    }
+    return block;
+}
+
+// Up to 'max' consecutive blocks, at 'goal' if it is free (so a file grows
+// in place), else from the first free block after it; the first block,
+// the count in *count
+static int allocate_run(uint32_t goal, uint32_t max, uint32_t* count) {
+    if (!block_bitmap) {
+        return FS_ERROR_INVALID;
+    }
+    int start = find_free_block(goal);
+    if (start < 0) {
+        return start;
+    }
+    uint32_t n = 0;
+    while (n < max && (uint32_t)start + n < superblock.total_blocks && !block_in_use((uint32_t)start + n)) {
+        block_mark((uint32_t)start + n, true);
+        n++;
+    }
+    block_cursor = (uint32_t)start + n;
+    *count = n;
+    return start;
+}
+
+// Where the first run of 'want' free blocks at or after 'from' starts,
+// wrapping around, or the longest run there is if none is that long
+static uint32_t find_free_span(uint32_t from, uint32_t want) {
+    uint32_t total = superblock.total_blocks;
+    if (from >= total) from = 0;
+    uint32_t best = from, best_length = 0;
+    for (uint32_t pass = 0; pass < 2; pass++) {
+        uint32_t end = pass ? from : total;
+        uint32_t i = pass ? 0 : from;
+        uint32_t run_start = i, run = 0;
+        while (i < end) {
+            if (run == 0 && (i & 7) == 0 && i + 8 <= end && block_bitmap[i / 8] == 0xFF) {
+                i += 8;
+                continue;
+            }
+            if (block_in_use(i)) {
+                run = 0;
+            } else {
+                if (run++ == 0) run_start = i;
+                if (run > best_length) {
+                    best = run_start;
+                    best_length = run;
+                    if (run >= want) return best;
+                }
+            }
+            i++;
         }
     }
-    
-    return FS_ERROR_NO_SPACE;
+    return best;
 }
 
 int _fs_free_block(uint32_t block_num) {
@@ -130,13 +287,8 @@ int _fs_free_block(uint32_t block_num) {
         return FS_ERROR_INVALID;
     }
     
-    uint32_t byte_index = block_num / 8;
-    uint32_t bit_index = block_num % 8;
-    
     // Mark block as free
-    block_bitmap[byte_index] &= ~(1 << bit_index);
-    superblock.free_blocks++;
-    
+    block_mark(block_num, false);
     return FS_SUCCESS;
 }
 
@@ -145,20 +297,20 @@ int _fs_allocate_inode(void) {
         return FS_ERROR_INVALID;
     }
     
-    // Find first free inode (starting from 1, since 0 is invalid)
-    for (uint32_t i = 1; i <= superblock.total_inodes; i++) {
-        uint32_t byte_index = i / 8;
-        uint32_t bit_index = i % 8;
-        
-        if (!(inode_bitmap[byte_index] & (1 << bit_index))) {
-            // Mark inode as used
-            inode_bitmap[byte_index] |= (1 << bit_index);
-            superblock.free_inodes--;
-            return i;
-        }
+    // Next free inode from the cursor (0 is invalid: held set in memory)
+    uint32_t limit = inode_bitmap_blocks() * BITMAP_BITS;
+    if (limit > superblock.total_inodes + 1) limit = superblock.total_inodes + 1;
+    int i = bitmap_find_clear(inode_bitmap, limit, inode_cursor);
+    if (i < 0) {
+        return FS_ERROR_NO_SPACE;
     }
     
-    return FS_ERROR_NO_SPACE;
+    // Mark inode as used
+    inode_bitmap[i / 8] |= (1 << (i % 8));
+    superblock.free_inodes--;
+    bitmap_dirty(&inode_bitmap_first, &inode_bitmap_last, (uint32_t)i);
+    inode_cursor = (uint32_t)i + 1;
+    return i;
 }
 
 int _fs_free_inode(uint32_t inode_num) {
@@ -172,42 +324,395 @@ int _fs_free_inode(uint32_t inode_num) {
     // Mark inode as free
     inode_bitmap[byte_index] &= ~(1 << bit_index);
     superblock.free_inodes++;
+    bitmap_dirty(&inode_bitmap_first, &inode_bitmap_last, inode_num);
     
     return FS_SUCCESS;
 }
 
-int fs_init(void) {
-    // Initialize disk
-    vga_write_string("Initializing disk...\n");
-    if (disk_init() != DISK_SUCCESS) {
-        vga_write_string("Disk initialization failed!\n");
+// Bitmaps and free counts are kept in memory; write back the bitmap
+// blocks that changed once allocation has
+static void fs_sync_allocation(void) {
+    for (uint32_t b = block_bitmap_first; b <= block_bitmap_last; b++) {
+        write_block(block_bitmap_start() + b, block_bitmap + b * BLOCK_SIZE);
+    }
+    for (uint32_t b = inode_bitmap_first; b <= inode_bitmap_last; b++) {
+        write_block(inode_bitmap_start() + b, inode_bitmap + b * BLOCK_SIZE);
+    }
+    block_bitmap_first = inode_bitmap_first = 1;
+    block_bitmap_last = inode_bitmap_last = 0;
+    _fs_write_superblock(&superblock);
+}
+
+static void map_invalidate(void) {
+    for (int level = 0; level < 2; level++) {
+        map_block[level] = 0;
+        map_dirty[level] = false;
+    }
+}
+
+static int map_flush(void) {
+    for (int level = 0; level < 2; level++) {
+        if (map_dirty[level]) {
+            if (write_block(map_block[level], map_table[level]) != DISK_SUCCESS) {
+                return FS_ERROR_INVALID;
+            }
+            map_dirty[level] = false;
+        }
+    }
+    return FS_SUCCESS;
+}
+
+// Pointer table 'block' in the cache slot of its level
+static uint32_t* map_load(uint32_t block, int level) {
+    if (map_block[level] == block) {
+        return map_table[level];
+    }
+    if (map_dirty[level] && write_block(map_block[level], map_table[level]) != DISK_SUCCESS) {
+        return NULL;
+    }
+    map_dirty[level] = false;
+    if (read_block(block, map_table[level]) != DISK_SUCCESS) {
+        map_block[level] = 0;
+        return NULL;
+    }
+    map_block[level] = block;
+    return map_table[level];
+}
+
+// Follow one pointer, which sits in the inode (level -1) or in the cached
+// table of 'level'. An empty one gets a fresh block when allocating; a
+// fresh pointer table (table_level >= 0) starts out zeroed.
+static int map_slot(uint32_t* slot, int level, bool allocate, int table_level, uint32_t* block) {
+    if (*slot || !allocate) {
+        *block = *slot;
+        return FS_SUCCESS;
+    }
+    
+    int fresh = _fs_allocate_block();
+    if (fresh < 0) {
+        return fresh;
+    }
+    if (table_level >= 0) {
+        if (map_dirty[table_level]) {
+            if (write_block(map_block[table_level], map_table[table_level]) != DISK_SUCCESS) {
+                _fs_free_block((uint32_t)fresh);
+                return FS_ERROR_INVALID;
+            }
+        }
+        memset(map_table[table_level], 0, BLOCK_SIZE);
+        map_block[table_level] = (uint32_t)fresh;
+        map_dirty[table_level] = true;
+    }
+    
+    *slot = (uint32_t)fresh;
+    if (level >= 0) {
+        map_dirty[level] = true;
+    }
+    *block = (uint32_t)fresh;
+    return FS_SUCCESS;
+}
+
+// Disk block holding block 'index' of a file: direct, single and double
+// indirect pointers. 0 for a hole unless allocating.
+static int file_map(inode_t* inode, uint32_t index, bool allocate, uint32_t* block) {
+    *block = 0;
+    if (index < DIRECT_BLOCKS) {
+        return map_slot(&inode->direct_blocks[index], -1, allocate, -1, block);
+    }
+    
+    uint32_t table;
+    int result;
+    index -= DIRECT_BLOCKS;
+    if (index < PTRS_PER_BLOCK) {
+        result = map_slot(&inode->indirect_block, -1, allocate, 1, &table);
+    } else {
+        index -= PTRS_PER_BLOCK;
+        if (index >= PTRS_PER_BLOCK * PTRS_PER_BLOCK) {
+            return FS_ERROR_NO_SPACE;
+        }
+        
+        uint32_t top;
+        result = map_slot(&inode->double_indirect, -1, allocate, 0, &top);
+        if (result != FS_SUCCESS || !top) {
+            return result;
+        }
+        uint32_t* tables = map_load(top, 0);
+        if (!tables) {
+            return FS_ERROR_INVALID;
+        }
+        result = map_slot(&tables[index / PTRS_PER_BLOCK], 0, allocate, 1, &table);
+        index %= PTRS_PER_BLOCK;
+    }
+    if (result != FS_SUCCESS || !table) {
+        return result;
+    }
+    
+    uint32_t* blocks = map_load(table, 1);
+    if (!blocks) {
+        return FS_ERROR_INVALID;
+    }
+    return map_slot(&blocks[index], 1, allocate, -1, block);
+}
+
+// Extent i of a file; past the inode's own they sit in the overflow block,
+// held in the level 1 map table slot (which extent files never use for
+// pointers). NULL if that block cannot be read.
+static fs_extent_t* extent_at(inode_t* inode, uint32_t i) {
+    if (i < FS_INODE_EXTENTS) {
+        return &inode->extents[i];
+    }
+    fs_extent_t* table = (fs_extent_t*)map_load(inode->extent_block, 1);
+    return table ? &table[i - FS_INODE_EXTENTS] : NULL;
+}
+
+// Changed one: the inode is written by the caller, the overflow block with
+// map_flush
+static void extent_dirty(uint32_t i) {
+    if (i >= FS_INODE_EXTENTS) {
+        map_dirty[1] = true;
+    }
+}
+
+// Disk block of file block 'index' and the blocks after it in the same
+// extent; FS_ERROR_NOT_FOUND past the last, with the blocks mapped in *run
+static int extent_map(inode_t* inode, uint32_t index, uint32_t* block, uint32_t* run) {
+    uint32_t base = 0;
+    for (uint32_t i = 0; i < inode->extent_count; i++) {
+        fs_extent_t* extent = extent_at(inode, i);
+        if (!extent) {
+            return FS_ERROR_INVALID;
+        }
+        if (index < base + extent->length) {
+            *block = extent->start + (index - base);
+            *run = extent->length - (index - base);
+            return FS_SUCCESS;
+        }
+        base += extent->length;
+    }
+    *block = 0;
+    *run = base;
+    return FS_ERROR_NOT_FOUND;
+}
+
+// Up to 'want' more blocks at the end of the file, where the last extent
+// ends if they are free, else as a new extent where the free space has
+// room for all of them
+static int extent_grow(inode_t* inode, uint32_t want, uint32_t* block, uint32_t* got) {
+    uint32_t count = inode->extent_count;
+    fs_extent_t* last = count ? extent_at(inode, count - 1) : NULL;
+    if (count && !last) {
         return FS_ERROR_INVALID;
     }
-    vga_write_string("Disk initialized successfully.\n");
+    uint32_t goal = last ? last->start + last->length : block_cursor;
+    if (!last || goal >= superblock.total_blocks || block_in_use(goal)) {
+        // A new extent: somewhere to put it first
+        if (count == FS_MAX_EXTENTS) {
+            return FS_ERROR_NO_SPACE;
+        }
+        if (count == FS_INODE_EXTENTS) {
+            uint32_t table;
+            int result = map_slot(&inode->extent_block, -1, true, 1, &table);
+            if (result != FS_SUCCESS) {
+                return result;
+            }
+        }
+        if (want > 1) {
+            goal = find_free_span(goal, want);
+        }
+    }
+    
+    uint32_t n;
+    int start = allocate_run(goal, want, &n);
+    if (start < 0) {
+        return start;
+    }
+    if (last && (uint32_t)start == last->start + last->length) {
+        last->length += n;
+        extent_dirty(count - 1);
+    } else {
+        fs_extent_t* extent = extent_at(inode, count);
+        if (!extent) {
+            for (uint32_t i = 0; i < n; i++) _fs_free_block((uint32_t)start + i);
+            return FS_ERROR_INVALID;
+        }
+        extent->start = (uint32_t)start;
+        extent->length = n;
+        extent_dirty(count);
+        inode->extent_count++;
+    }
+    *block = (uint32_t)start;
+    *got = n;
+    return FS_SUCCESS;
+}
+
+// Blocks an extent file has
+static int extent_blocks(inode_t* inode, uint32_t* blocks) {
+    uint32_t block;
+    int result = extent_map(inode, 0xFFFFFFFF, &block, blocks);
+    return result == FS_ERROR_NOT_FOUND ? FS_SUCCESS : FS_ERROR_INVALID;
+}
+
+// Free the blocks of an extent file past its first 'keep', and the
+// overflow block once the inode holds every extent left
+static int extent_trim(inode_t* inode, uint32_t keep) {
+    uint32_t base = 0;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < inode->extent_count; i++) {
+        fs_extent_t* extent = extent_at(inode, i);
+        if (!extent) {
+            return FS_ERROR_INVALID;
+        }
+        uint32_t from = base >= keep ? 0 : keep - base;
+        base += extent->length;
+        if (from >= extent->length) {
+            count = i + 1;
+            continue;
+        }
+        for (uint32_t b = from; b < extent->length; b++) {
+            _fs_free_block(extent->start + b);
+        }
+        extent->length = from;
+        extent_dirty(i);
+        if (from) count = i + 1;
+    }
+    inode->extent_count = count;
+    if (count <= FS_INODE_EXTENTS && inode->extent_block) {
+        if (map_block[1] == inode->extent_block) {
+            map_block[1] = 0;
+            map_dirty[1] = false;
+        }
+        _fs_free_block(inode->extent_block);
+        inode->extent_block = 0;
+    }
+    return FS_SUCCESS;
+}
+
+// Disk block of file block 'index' and how many of the next 'want' file
+// blocks follow it on disk (at least 1), so they go in one transfer. A
+// hole is block 0, one block long, unless allocating.
+static int file_run(inode_t* inode, uint32_t index, uint32_t want, bool allocate, uint32_t* block, uint32_t* run) {
+    if (inode->flags & INODE_EXTENTS) {
+        int result = extent_map(inode, index, block, run);
+        if (result == FS_SUCCESS) {
+            if (*run > want) *run = want;
+            return FS_SUCCESS;
+        }
+        // No holes: a file only grows by the block after its last
+        if (result != FS_ERROR_NOT_FOUND || !allocate || index != *run) {
+            return FS_ERROR_INVALID;
+        }
+        return extent_grow(inode, want, block, run);
+    }
+    
+    // Blocks a block-mapped file gets go after its last one if they can
+    uint32_t prev;
+    if (allocate && index > 0 && file_map(inode, index - 1, false, &prev) == FS_SUCCESS && prev) {
+        block_cursor = prev + 1;
+    }
+    int result = file_map(inode, index, allocate, block);
+    if (result != FS_SUCCESS) {
+        return result;
+    }
+    *run = 1;
+    uint32_t next;
+    while (*block && *run < want && file_map(inode, index + *run, allocate, &next) == FS_SUCCESS &&
+           next == *block + *run) {
+        (*run)++;
+    }
+    return FS_SUCCESS;
+}
+
+// Free every block of a file, pointer tables included
+static void file_free_blocks(inode_t* inode) {
+    uint32_t table[PTRS_PER_BLOCK];
+    uint32_t tables[PTRS_PER_BLOCK];
+    
+    if (inode->flags & INODE_EXTENTS) {
+        for (uint32_t i = 0; i < inode->extent_count; i++) {
+            fs_extent_t* extent = extent_at(inode, i);
+            if (!extent) break;
+            for (uint32_t b = 0; b < extent->length; b++) {
+                _fs_free_block(extent->start + b);
+            }
+        }
+        if (inode->extent_block) {
+            _fs_free_block(inode->extent_block);
+        }
+        map_invalidate();
+        return;
+    }
+    
+    for (uint32_t i = 0; i < DIRECT_BLOCKS; i++) {
+        if (inode->direct_blocks[i] != 0) {
+            _fs_free_block(inode->direct_blocks[i]);
+        }
+    }
+    
+    if (inode->indirect_block && read_block(inode->indirect_block, table) == DISK_SUCCESS) {
+        for (uint32_t i = 0; i < PTRS_PER_BLOCK; i++) {
+            if (table[i]) _fs_free_block(table[i]);
+        }
+        _fs_free_block(inode->indirect_block);
+    }
+    
+    if (inode->double_indirect && read_block(inode->double_indirect, tables) == DISK_SUCCESS) {
+        for (uint32_t t = 0; t < PTRS_PER_BLOCK; t++) {
+            if (!tables[t] || read_block(tables[t], table) != DISK_SUCCESS) continue;
+            for (uint32_t i = 0; i < PTRS_PER_BLOCK; i++) {
+                if (table[i]) _fs_free_block(table[i]);
+            }
+            _fs_free_block(tables[t]);
+        }
+        _fs_free_block(inode->double_indirect);
+    }
+    map_invalidate();
+}
+
+int fs_init(void) {
+    // Initialize disk, unless the boot did already
+    if (!disk_is_present()) {
+        vga_write_string("Initializing disk...\n");
+        if (disk_init() != DISK_SUCCESS) {
+            vga_write_string("Disk initialization failed!\n");
+            return FS_ERROR_INVALID;
+        }
+        vga_write_string("Disk initialized successfully.\n");
+    }
+    bcache_init();
+    dcache_init();
     
     // Initialize file descriptor table
     for (int i = 0; i < MAX_OPEN_FILES; i++) {
         file_descriptors[i].in_use = false;
+        file_descriptors[i].ra_buffer = NULL;
     }
+    map_invalidate();
     
-    // Try to read existing superblock
-    if (_fs_read_superblock(&superblock) == DISK_SUCCESS && 
+    // Try to read existing superblock; until it is read, the disk bounds
+    // the blocks there are
+    superblock.total_blocks = disk_get_total_sectors() / (BLOCK_SIZE / SECTOR_SIZE);
+    if (_fs_read_superblock(&superblock) == FS_SUCCESS && 
         superblock.magic == FS_MAGIC) {
         
         // Valid filesystem found, load bitmaps
-        uint32_t bitmap_blocks = (superblock.total_blocks + 7) / 8 / BLOCK_SIZE + 1;
-        
-        block_bitmap = (uint8_t*)kmalloc(bitmap_blocks * BLOCK_SIZE);
-        inode_bitmap = (uint8_t*)kmalloc(bitmap_blocks * BLOCK_SIZE);
+        block_bitmap = (uint8_t*)kmalloc(block_bitmap_blocks() * BLOCK_SIZE);
+        inode_bitmap = (uint8_t*)kmalloc(inode_bitmap_blocks() * BLOCK_SIZE);
         
         if (!block_bitmap || !inode_bitmap) {
             return FS_ERROR_NO_MEMORY;
         }
         
-        // Read bitmaps from disk (simplified - assume they follow inode blocks)
-        uint32_t bitmap_start = 1 + superblock.inode_blocks;
-        read_block(bitmap_start, block_bitmap);
-        read_block(bitmap_start + 1, inode_bitmap);
+        for (uint32_t b = 0; b < block_bitmap_blocks(); b++) {
+            read_block(block_bitmap_start() + b, block_bitmap + b * BLOCK_SIZE);
+        }
+        for (uint32_t b = 0; b < inode_bitmap_blocks(); b++) {
+            read_block(inode_bitmap_start() + b, inode_bitmap + b * BLOCK_SIZE);
+        }
+        block_bitmap_first = inode_bitmap_first = 1;
+        block_bitmap_last = inode_bitmap_last = 0;
+        inode_bitmap[0] |= 1;
+        block_cursor = 0;
+        inode_cursor = 1;
         
         fs_mounted = true;
         return FS_SUCCESS;
@@ -239,12 +744,19 @@ int fs_format(void) {
         return FS_ERROR_INVALID;
     }
     
+    // The order journal keeps the tail of the disk for itself
+    if (total_sectors > 2 * DISK_JOURNAL_SECTORS) {
+        total_sectors -= DISK_JOURNAL_SECTORS;
+    }
+    
     // Calculate filesystem layout
     uint32_t total_blocks = total_sectors / (BLOCK_SIZE / SECTOR_SIZE);
     uint32_t inodes_per_block = BLOCK_SIZE / sizeof(inode_t);
     uint32_t total_inodes = total_blocks / 4;  // 25% of blocks for inodes
     uint32_t inode_blocks = (total_inodes + inodes_per_block - 1) / inodes_per_block;
-    uint32_t bitmap_blocks = 2;  // One for block bitmap, one for inode bitmap
+    uint32_t block_bitmaps = (total_blocks + BITMAP_BITS - 1) / BITMAP_BITS;
+    uint32_t inode_bitmaps = (total_inodes + 1 + BITMAP_BITS - 1) / BITMAP_BITS;   // Inode 0 unused
+    uint32_t bitmap_blocks = block_bitmaps + inode_bitmaps;
     uint32_t data_blocks = total_blocks - 1 - inode_blocks - bitmap_blocks;  // Subtract superblock
     
     // Initialize superblock
@@ -258,23 +770,27 @@ int fs_format(void) {
     superblock.total_inodes = total_inodes;
     superblock.free_inodes = total_inodes - 1;  // Reserve root directory inode
     superblock.root_inode = ROOT_INODE;
+    superblock.block_bitmap_blocks = block_bitmaps;
+    superblock.inode_bitmap_blocks = inode_bitmaps;
     
     // Write superblock
-    if (_fs_write_superblock(&superblock) != DISK_SUCCESS) {
+    map_invalidate();
+    dcache_clear();
+    if (_fs_write_superblock(&superblock) != FS_SUCCESS) {
         return FS_ERROR_INVALID;
     }
     
     // Initialize and allocate bitmaps
-    block_bitmap = (uint8_t*)kmalloc(BLOCK_SIZE);
-    inode_bitmap = (uint8_t*)kmalloc(BLOCK_SIZE);
+    block_bitmap = (uint8_t*)kmalloc(block_bitmaps * BLOCK_SIZE);
+    inode_bitmap = (uint8_t*)kmalloc(inode_bitmaps * BLOCK_SIZE);
     
     if (!block_bitmap || !inode_bitmap) {
         return FS_ERROR_NO_MEMORY;
     }
     
     // Clear bitmaps
-    memset(block_bitmap, 0, BLOCK_SIZE);
-    memset(inode_bitmap, 0, BLOCK_SIZE);
+    memset(block_bitmap, 0, block_bitmaps * BLOCK_SIZE);
+    memset(inode_bitmap, 0, inode_bitmaps * BLOCK_SIZE);
     
     // Mark system blocks as used
     for (uint32_t i = 0; i < 1 + inode_blocks + bitmap_blocks; i++) {
@@ -283,13 +799,17 @@ int fs_format(void) {
         block_bitmap[byte_index] |= (1 << bit_index);
     }
     
-    // Mark root inode as used
+    // Mark root inode as used, and inode 0 which nothing may get
     inode_bitmap[ROOT_INODE / 8] |= (1 << (ROOT_INODE % 8));
+    inode_bitmap[0] |= 1;
+    block_cursor = 1 + inode_blocks + bitmap_blocks;
+    inode_cursor = ROOT_INODE + 1;
     
     // Write bitmaps to disk
-    uint32_t bitmap_start = 1 + inode_blocks;
-    write_block(bitmap_start, block_bitmap);
-    write_block(bitmap_start + 1, inode_bitmap);
+    block_bitmap_first = inode_bitmap_first = 0;
+    block_bitmap_last = block_bitmaps - 1;
+    inode_bitmap_last = inode_bitmaps - 1;
+    fs_sync_allocation();
     
     // Create root directory inode
     inode_t root_inode;
@@ -306,6 +826,29 @@ int fs_format(void) {
     return FS_SUCCESS;
 }
 
+// Everything written so far onto the disk, past the block cache and the
+// drive's own
+int fs_sync(void) {
+    if (!fs_mounted) {
+        return FS_ERROR_INVALID;
+    }
+    int result = FS_SUCCESS;
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        file_descriptor_t* file = &file_descriptors[i];
+        if (file->in_use && file->size_dirty) {
+            if (_fs_write_inode(file->inode_num, &file->inode_cache) == FS_SUCCESS) {
+                file->size_dirty = false;
+            } else {
+                result = FS_ERROR_INVALID;
+            }
+        }
+    }
+    if (bcache_sync() != DISK_SUCCESS) {
+        result = FS_ERROR_INVALID;
+    }
+    return result;
+}
+
 uint32_t fs_get_free_space(void) {
     if (!fs_mounted) {
         return 0;
@@ -322,6 +865,59 @@ int fs_exists(const char* path) {
     return fs_stat(path, &inode) == FS_SUCCESS;
 }
 
+// Directory block 'i', through the block map (hashed directories outgrow
+// the direct blocks)
+static int dir_read_block(inode_t* dir, uint32_t i, uint32_t* block, uint8_t* buffer) {
+    if (file_map(dir, i, false, block) != FS_SUCCESS || *block == 0) {
+        return FS_ERROR_NOT_FOUND;
+    }
+    return read_block(*block, buffer) == DISK_SUCCESS ? FS_SUCCESS : FS_ERROR_INVALID;
+}
+
+// Blocks holding entries: linear directories only ever used direct blocks
+static uint32_t dir_block_count(const inode_t* dir) {
+    if (dir->flags & INODE_HASHED) {
+        return dir->blocks_used;
+    }
+    return dir->blocks_used < DIRECT_BLOCKS ? dir->blocks_used : DIRECT_BLOCKS;
+}
+
+static inline bool entry_named(const directory_entry_t* entry, const char* name, size_t len) {
+    return entry->inode_num && entry->name_length == len && memcmp(entry->name, name, len) == 0;
+}
+
+// Never used since the directory was built; a hashed lookup ends there
+static inline bool entry_unused(const directory_entry_t* entry) {
+    return entry->inode_num == 0 && entry->name_length == 0;
+}
+
+// The block and slot holding 'name', left in 'buffer'
+static int dir_search(inode_t* dir, const char* name, uint32_t* block, uint32_t* slot, uint8_t* buffer) {
+    size_t len = strlen(name);
+    directory_entry_t* entries = (directory_entry_t*)buffer;
+    uint32_t count = dir_block_count(dir);
+    bool hashed = (dir->flags & INODE_HASHED) != 0;
+    uint32_t first = hashed ? dcache_hash_name(name, len) & (count - 1) : 0;
+    
+    for (uint32_t probe = 0; probe < count; probe++) {
+        uint32_t i = hashed ? (first + probe) & (count - 1) : probe;
+        int result = dir_read_block(dir, i, block, buffer);
+        if (result == FS_ERROR_NOT_FOUND) continue;
+        if (result != FS_SUCCESS) return result;
+        
+        bool unused = false;
+        for (uint32_t j = 0; j < FS_DIR_ENTRIES_PER_BLOCK; j++) {
+            if (entry_named(&entries[j], name, len)) {
+                *slot = j;
+                return FS_SUCCESS;
+            }
+            unused |= entry_unused(&entries[j]);
+        }
+        if (hashed && unused) break;
+    }
+    return FS_ERROR_NOT_FOUND;
+}
+
 // Helper function to find a directory entry by name
 static int find_directory_entry(uint32_t dir_inode_num, const char* name, directory_entry_t* entry) {
     inode_t dir_inode;
@@ -333,41 +929,32 @@ static int find_directory_entry(uint32_t dir_inode_num, const char* name, direct
         return FS_ERROR_INVALID;
     }
     
-    // Read directory blocks and search for the entry
     uint8_t block_buffer[BLOCK_SIZE];
-    uint32_t entries_per_block = BLOCK_SIZE / sizeof(directory_entry_t);
-    
-    for (uint32_t i = 0; i < dir_inode.blocks_used; i++) {
-        if (i >= 12) break; // Only handle direct blocks for now
-        
-        uint32_t block_num = dir_inode.direct_blocks[i];
-        if (block_num == 0) continue;
-        
-        if (read_block(block_num, block_buffer) != DISK_SUCCESS) {
-            continue;
-        }
-        
-        directory_entry_t* entries = (directory_entry_t*)block_buffer;
-        for (uint32_t j = 0; j < entries_per_block; j++) {
-            if (entries[j].inode_num == 0) continue; // Empty entry
-            
-            // Compare names (simple string comparison)
-            int match = 1;
-            for (int k = 0; k < MAX_FILENAME_LENGTH && name[k] && entries[j].name[k]; k++) {
-                if (name[k] != entries[j].name[k]) {
-                    match = 0;
-                    break;
-                }
-            }
-            
-            if (match && name[entries[j].name_length] == '\0') {
-                *entry = entries[j];
-                return FS_SUCCESS;
-            }
-        }
+    uint32_t block, slot;
+    int result = dir_search(&dir_inode, name, &block, &slot, block_buffer);
+    if (result == FS_SUCCESS) {
+        *entry = ((directory_entry_t*)block_buffer)[slot];
     }
-    
-    return FS_ERROR_NOT_FOUND;
+    return result;
+}
+
+// A name in a directory, through the name cache; what the disk says is
+// remembered, absent names included
+static int lookup_name(uint32_t dir_inode_num, const char* name, uint32_t* inode_num) {
+    int result = dcache_lookup(dir_inode_num, name, inode_num);
+    if (result != DCACHE_MISS) {
+        return result;
+    }
+    
+    directory_entry_t entry;
+    result = find_directory_entry(dir_inode_num, name, &entry);
+    if (result == FS_SUCCESS) {
+        *inode_num = entry.inode_num;
+        dcache_enter(dir_inode_num, name, strlen(name), entry.inode_num);
+    } else if (result == FS_ERROR_NOT_FOUND) {
+        dcache_enter(dir_inode_num, name, strlen(name), 0);
+    }
+    return result;
 }
 
 // Simple path resolution - handles paths like "/", "/dir", "/dir/file"
@@ -404,13 +991,10 @@ static int resolve_path(const char* path, uint32_t* inode_num) {
         name[len] = '\0';
         
         // Find directory entry
-        directory_entry_t entry;
-        if (find_directory_entry(current_inode, name, &entry) != FS_SUCCESS) {
+        if (lookup_name(current_inode, name, &current_inode) != FS_SUCCESS) {
             return FS_ERROR_NOT_FOUND;
         }
         
-        current_inode = entry.inode_num;
-        
         // Move to next component
         component = end;
         if (*component == '/') component++;
@@ -497,8 +1081,8 @@ int fs_create_directory(const char* path) {
     }
     
     // Check if directory already exists
-    directory_entry_t existing_entry;
-    if (find_directory_entry(parent_inode_num, dir_name, &existing_entry) == FS_SUCCESS) {
+    uint32_t existing;
+    if (lookup_name(parent_inode_num, dir_name, &existing) == FS_SUCCESS) {
         return FS_ERROR_EXISTS;
     }
     
@@ -527,6 +1111,86 @@ int fs_create_directory(const char* path) {
     return add_directory_entry(parent_inode_num, dir_name, new_inode_num, FILE_TYPE_DIRECTORY);
 }
 
+// Into the bucket the name hashes to or the next one with a free slot
+static int hashed_insert(inode_t* dir, const directory_entry_t* entry, uint8_t* buffer) {
+    directory_entry_t* entries = (directory_entry_t*)buffer;
+    uint32_t count = dir->blocks_used;
+    uint32_t first = dcache_hash_name(entry->name, entry->name_length) & (count - 1);
+    
+    for (uint32_t probe = 0; probe < count; probe++) {
+        uint32_t block;
+        int result = dir_read_block(dir, (first + probe) & (count - 1), &block, buffer);
+        if (result != FS_SUCCESS) {
+            return FS_ERROR_INVALID;
+        }
+        for (uint32_t j = 0; j < FS_DIR_ENTRIES_PER_BLOCK; j++) {
+            if (entries[j].inode_num == 0) {
+                entries[j] = *entry;
+                return write_block(block, buffer) == DISK_SUCCESS ? FS_SUCCESS : FS_ERROR_INVALID;
+            }
+        }
+    }
+    return FS_ERROR_NO_SPACE;
+}
+
+// Rebuild a directory hashed into 'buckets' fresh blocks, tombstones left
+// behind; the old blocks are freed once every entry has moved
+static int dir_rehash(inode_t* dir, uint32_t buckets) {
+    uint8_t* buffers = (uint8_t*)kmalloc(2 * BLOCK_SIZE);
+    if (!buffers) {
+        return FS_ERROR_NO_MEMORY;
+    }
+    uint8_t* from = buffers;
+    uint8_t* to = buffers + BLOCK_SIZE;
+    
+    inode_t fresh = *dir;
+    memset(fresh.direct_blocks, 0, sizeof(fresh.direct_blocks));
+    fresh.indirect_block = 0;
+    fresh.double_indirect = 0;
+    fresh.flags |= INODE_HASHED;
+    fresh.blocks_used = buckets;
+    
+    int result = FS_SUCCESS;
+    memset(to, 0, BLOCK_SIZE);
+    for (uint32_t i = 0; i < buckets && result == FS_SUCCESS; i++) {
+        uint32_t block;
+        result = file_map(&fresh, i, true, &block);
+        if (result == FS_SUCCESS && write_block(block, to) != DISK_SUCCESS) {
+            result = FS_ERROR_INVALID;
+        }
+    }
+    
+    uint32_t count = dir_block_count(dir);
+    directory_entry_t* entries = (directory_entry_t*)from;
+    for (uint32_t i = 0; i < count && result == FS_SUCCESS; i++) {
+        uint32_t block;
+        int read = dir_read_block(dir, i, &block, from);
+        if (read == FS_ERROR_NOT_FOUND) continue;
+        if (read != FS_SUCCESS) {
+            result = read;
+            break;
+        }
+        for (uint32_t j = 0; j < FS_DIR_ENTRIES_PER_BLOCK && result == FS_SUCCESS; j++) {
+            if (entries[j].inode_num) {
+                result = hashed_insert(&fresh, &entries[j], to);
+            }
+        }
+    }
+    kfree(buffers);
+    
+    if (result == FS_SUCCESS) {
+        result = map_flush();
+    }
+    if (result != FS_SUCCESS) {
+        map_flush();
+        file_free_blocks(&fresh);
+        return result;
+    }
+    file_free_blocks(dir);
+    *dir = fresh;
+    return FS_SUCCESS;
+}
+
 // Helper function to add a directory entry
 static int add_directory_entry(uint32_t dir_inode_num, const char* name, uint32_t entry_inode_num, uint8_t file_type) {
     inode_t dir_inode;
@@ -538,74 +1202,109 @@ static int add_directory_entry(uint32_t dir_inode_num, const char* name, uint32_
         return FS_ERROR_INVALID;
     }
     
-    // Find a free slot in existing blocks or allocate a new block
-    uint8_t block_buffer[BLOCK_SIZE];
-    uint32_t entries_per_block = BLOCK_SIZE / sizeof(directory_entry_t);
+    directory_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.inode_num = entry_inode_num;
+    while (name[entry.name_length] && entry.name_length < MAX_FILENAME_LENGTH - 1) {
+        entry.name[entry.name_length] = name[entry.name_length];
+        entry.name_length++;
+    }
+    entry.file_type = file_type;
     
-    // Search existing blocks for free slot
-    for (uint32_t i = 0; i < dir_inode.blocks_used && i < 12; i++) {
-        uint32_t block_num = dir_inode.direct_blocks[i];
-        if (block_num == 0) continue;
-        
-        if (read_block(block_num, block_buffer) != DISK_SUCCESS) {
-            continue;
+    uint8_t block_buffer[BLOCK_SIZE];
+    directory_entry_t* entries = (directory_entry_t*)block_buffer;
+    uint32_t free_before = superblock.free_blocks;
+    uint32_t live = dir_inode.size / sizeof(directory_entry_t);
+    int result = FS_ERROR_NO_SPACE;
+    
+    if (!(dir_inode.flags & INODE_HASHED)) {
+        // Search existing blocks for free slot
+        for (uint32_t i = 0; i < dir_block_count(&dir_inode) && result == FS_ERROR_NO_SPACE; i++) {
+            uint32_t block_num;
+            if (dir_read_block(&dir_inode, i, &block_num, block_buffer) != FS_SUCCESS) {
+                continue;
+            }
+            for (uint32_t j = 0; j < FS_DIR_ENTRIES_PER_BLOCK; j++) {
+                if (entries[j].inode_num == 0) { // Free slot found
+                    entries[j] = entry;
+                    result = write_block(block_num, block_buffer) == DISK_SUCCESS ? FS_SUCCESS : FS_ERROR_INVALID;
+                    break;
+                }
+            }
         }
         
-        directory_entry_t* entries = (directory_entry_t*)block_buffer;
-        for (uint32_t j = 0; j < entries_per_block; j++) {
-            if (entries[j].inode_num == 0) { // Free slot found
-                entries[j].inode_num = entry_inode_num;
-                entries[j].name_length = 0;
-                while (name[entries[j].name_length] && entries[j].name_length < MAX_FILENAME_LENGTH - 1) {
-                    entries[j].name[entries[j].name_length] = name[entries[j].name_length];
-                    entries[j].name_length++;
-                }
-                entries[j].name[entries[j].name_length] = '\0';
-                entries[j].file_type = file_type;
-                
-                // Write block back
-                write_block(block_num, block_buffer);
-                dir_inode.size += sizeof(directory_entry_t);
-                _fs_write_inode(dir_inode_num, &dir_inode);
-                return FS_SUCCESS;
+        if (result == FS_ERROR_NO_SPACE && dir_inode.blocks_used < FS_DIR_LINEAR_BLOCKS) {
+            int new_block = _fs_allocate_block();
+            if (new_block < 0) {
+                return new_block;
+            }
+            memset(block_buffer, 0, BLOCK_SIZE);
+            entries[0] = entry;
+            write_block(new_block, block_buffer);
+            dir_inode.direct_blocks[dir_inode.blocks_used] = new_block;
+            dir_inode.blocks_used++;
+            result = FS_SUCCESS;
+        } else if (result == FS_ERROR_NO_SPACE) {
+            // Outgrown the list
+            result = dir_rehash(&dir_inode, FS_DIR_HASH_MIN_BUCKETS);
+            if (result == FS_SUCCESS) {
+                result = FS_ERROR_NO_SPACE;
             }
         }
     }
     
-    // Need to allocate a new block
-    if (dir_inode.blocks_used >= 12) {
-        return FS_ERROR_NO_SPACE; // Directory full (no indirect blocks yet)
+    if (result == FS_ERROR_NO_SPACE && (dir_inode.flags & INODE_HASHED)) {
+        uint32_t slots = dir_inode.blocks_used * FS_DIR_ENTRIES_PER_BLOCK;
+        result = FS_SUCCESS;
+        if ((live + 1) * 4 > slots * 3) {
+            result = dir_rehash(&dir_inode, dir_inode.blocks_used * 2);
+        }
+        if (result == FS_SUCCESS) {
+            result = hashed_insert(&dir_inode, &entry, block_buffer);
+        }
     }
     
-    int new_block = _fs_allocate_block();
-    if (new_block < 0) {
-        return new_block;
+    if (result == FS_SUCCESS) {
+        dir_inode.size += sizeof(directory_entry_t);
+        dcache_enter(dir_inode_num, entry.name, entry.name_length, entry_inode_num);
     }
-    
-    // Initialize new block
-    memset(block_buffer, 0, BLOCK_SIZE);
-    directory_entry_t* entries = (directory_entry_t*)block_buffer;
-    
-    // Add the entry
-    entries[0].inode_num = entry_inode_num;
-    entries[0].name_length = 0;
-    while (name[entries[0].name_length] && entries[0].name_length < MAX_FILENAME_LENGTH - 1) {
-        entries[0].name[entries[0].name_length] = name[entries[0].name_length];
-        entries[0].name_length++;
+    // A rebuild moved the directory even if the entry did not go in
+    if (_fs_write_inode(dir_inode_num, &dir_inode) != FS_SUCCESS && result == FS_SUCCESS) {
+        result = FS_ERROR_INVALID;
+    }
+    if (superblock.free_blocks != free_before) {
+        fs_sync_allocation();
+    }
+    return result;
+}
+
+// Take a name out of a directory: the slot of a hashed one is left as a
+// tombstone
+static int remove_directory_entry(uint32_t dir_inode_num, const char* name) {
+    inode_t dir_inode;
+    if (_fs_read_inode(dir_inode_num, &dir_inode) != FS_SUCCESS ||
+        dir_inode.file_type != FILE_TYPE_DIRECTORY) {
+        return FS_ERROR_INVALID;
     }
-    entries[0].name[entries[0].name_length] = '\0';
-    entries[0].file_type = file_type;
-    
-    // Write the new block
-    write_block(new_block, block_buffer);
     
-    // Update directory inode
-    dir_inode.direct_blocks[dir_inode.blocks_used] = new_block;
-    dir_inode.blocks_used++;
-    dir_inode.size += sizeof(directory_entry_t);
-    _fs_write_inode(dir_inode_num, &dir_inode);
+    uint8_t block_buffer[BLOCK_SIZE];
+    uint32_t block, slot;
+    int result = dir_search(&dir_inode, name, &block, &slot, block_buffer);
+    if (result != FS_SUCCESS) {
+        return result;
+    }
+    directory_entry_t* entry = &((directory_entry_t*)block_buffer)[slot];
+    entry->inode_num = 0;
+    if (!(dir_inode.flags & INODE_HASHED)) {
+        memset(entry, 0, sizeof(directory_entry_t));
+    }
+    if (write_block(block, block_buffer) != DISK_SUCCESS) {
+        return FS_ERROR_INVALID;
+    }
+    dcache_enter(dir_inode_num, name, strlen(name), 0);
     
-    return FS_SUCCESS;
+    dir_inode.size -= sizeof(directory_entry_t);
+    return _fs_write_inode(dir_inode_num, &dir_inode);
 }
 
 int fs_list_directory(const char* path, directory_entry_t* entries, uint32_t max_entries) {
@@ -629,19 +1328,16 @@ int fs_list_directory(const char* path, directory_entry_t* entries, uint32_t max
     
     uint32_t entry_count = 0;
     uint8_t block_buffer[BLOCK_SIZE];
-    uint32_t entries_per_block = BLOCK_SIZE / sizeof(directory_entry_t);
     
     // Read all directory blocks
-    for (uint32_t i = 0; i < dir_inode.blocks_used && i < 12; i++) {
-        uint32_t block_num = dir_inode.direct_blocks[i];
-        if (block_num == 0) continue;
-        
-        if (read_block(block_num, block_buffer) != DISK_SUCCESS) {
+    for (uint32_t i = 0; i < dir_block_count(&dir_inode) && entry_count < max_entries; i++) {
+        uint32_t block_num;
+        if (dir_read_block(&dir_inode, i, &block_num, block_buffer) != FS_SUCCESS) {
             continue;
         }
         
         directory_entry_t* block_entries = (directory_entry_t*)block_buffer;
-        for (uint32_t j = 0; j < entries_per_block && entry_count < max_entries; j++) {
+        for (uint32_t j = 0; j < FS_DIR_ENTRIES_PER_BLOCK && entry_count < max_entries; j++) {
             if (block_entries[j].inode_num != 0) { // Valid entry
                 entries[entry_count] = block_entries[j];
                 entry_count++;
@@ -652,15 +1348,8 @@ int fs_list_directory(const char* path, directory_entry_t* entries, uint32_t max
     return entry_count;
 }
 
-int fs_create_file(const char* path, uint8_t file_type) {
-    if (!fs_mounted || !path) {
-        return FS_ERROR_INVALID;
-    }
-    
-    // Parse path to get parent directory and filename
-    char parent_path[MAX_PATH_LENGTH];
-    char filename[MAX_FILENAME_LENGTH];
-    
+// "/dir/name" into "/dir" and "name" (truncated to MAX_FILENAME_LENGTH - 1)
+static int split_path(const char* path, char* parent_path, char* name) {
     int path_len = 0;
     while (path[path_len]) path_len++;
     
@@ -672,7 +1361,7 @@ int fs_create_file(const char* path, uint8_t file_type) {
         }
     }
     
-    if (last_slash == -1) {
+    if (last_slash == -1 || last_slash >= MAX_PATH_LENGTH) {
         return FS_ERROR_INVALID;
     }
     
@@ -690,9 +1379,23 @@ int fs_create_file(const char* path, uint8_t file_type) {
     // Copy filename
     int name_len = 0;
     for (int i = last_slash + 1; path[i] && name_len < MAX_FILENAME_LENGTH - 1; i++) {
-        filename[name_len++] = path[i];
+        name[name_len++] = path[i];
+    }
+    name[name_len] = '\0';
+    return name_len ? FS_SUCCESS : FS_ERROR_INVALID;
+}
+
+int fs_create_file(const char* path, uint8_t file_type) {
+    if (!fs_mounted || !path) {
+        return FS_ERROR_INVALID;
+    }
+    
+    // Parse path to get parent directory and filename
+    char parent_path[MAX_PATH_LENGTH];
+    char filename[MAX_FILENAME_LENGTH];
+    if (split_path(path, parent_path, filename) != FS_SUCCESS) {
+        return FS_ERROR_INVALID;
     }
-    filename[name_len] = '\0';
     
     // Get parent directory inode
     uint32_t parent_inode_num;
@@ -701,8 +1404,8 @@ int fs_create_file(const char* path, uint8_t file_type) {
     }
     
     // Check if file already exists
-    directory_entry_t existing_entry;
-    if (find_directory_entry(parent_inode_num, filename, &existing_entry) == FS_SUCCESS) {
+    uint32_t existing;
+    if (lookup_name(parent_inode_num, filename, &existing) == FS_SUCCESS) {
         return FS_ERROR_EXISTS;
     }
     
@@ -720,6 +1423,9 @@ int fs_create_file(const char* path, uint8_t file_type) {
     file_inode.permissions = PERM_READ | PERM_WRITE;
     file_inode.size = 0;
     file_inode.blocks_used = 0;
+    if (file_type == FILE_TYPE_REGULAR) {
+        file_inode.flags = INODE_EXTENTS;
+    }
     
     // Write the new inode
     if (_fs_write_inode(new_inode_num, &file_inode) != FS_SUCCESS) {
@@ -736,8 +1442,15 @@ int fs_delete_file(const char* path) {
         return FS_ERROR_INVALID;
     }
     
-    uint32_t inode_num;
-    if (resolve_path(path, &inode_num) != FS_SUCCESS) {
+    char parent_path[MAX_PATH_LENGTH];
+    char name[MAX_FILENAME_LENGTH];
+    if (split_path(path, parent_path, name) != FS_SUCCESS) {
+        return FS_ERROR_INVALID;
+    }
+    
+    uint32_t parent_inode_num, inode_num;
+    if (resolve_path(parent_path, &parent_inode_num) != FS_SUCCESS ||
+        lookup_name(parent_inode_num, name, &inode_num) != FS_SUCCESS) {
         return FS_ERROR_NOT_FOUND;
     }
     
@@ -745,19 +1458,23 @@ int fs_delete_file(const char* path) {
     if (_fs_read_inode(inode_num, &inode) != FS_SUCCESS) {
         return FS_ERROR_INVALID;
     }
+    if (inode.file_type == FILE_TYPE_DIRECTORY && inode.size != 0) {
+        return FS_ERROR_INVALID;    // Only empty directories go
+    }
+    
+    if (remove_directory_entry(parent_inode_num, name) != FS_SUCCESS) {
+        return FS_ERROR_INVALID;
+    }
+    if (inode.file_type == FILE_TYPE_DIRECTORY) {
+        dcache_forget_dir(inode_num);   // Its negative entries
+    }
     
     // Free all blocks used by the file
-    for (uint32_t i = 0; i < inode.blocks_used && i < 12; i++) {
-        if (inode.direct_blocks[i] != 0) {
-            _fs_free_block(inode.direct_blocks[i]);
-        }
-    }
+    file_free_blocks(&inode);
     
     // Free the inode
     _fs_free_inode(inode_num);
-    
-    // TODO: Remove directory entry from parent directory
-    // This would require additional logic to find and remove the entry
+    fs_sync_allocation();
     
     return FS_SUCCESS;
 }
@@ -795,6 +1512,11 @@ int fs_open(const char* path, uint8_t flags) {
     file_descriptors[fd].inode_num = inode_num;
     file_descriptors[fd].position = 0;
     file_descriptors[fd].flags = flags;
+    file_descriptors[fd].ra_next = 0;
+    file_descriptors[fd].ra_window = FS_RA_MIN_BLOCKS;
+    file_descriptors[fd].ra_start = 0;
+    file_descriptors[fd].ra_length = 0;
+    file_descriptors[fd].size_dirty = false;
     file_descriptors[fd].in_use = true;
     
     return fd;
@@ -805,32 +1527,229 @@ int fs_close(int fd) {
         return FS_ERROR_INVALID;
     }
     
+    int result = FS_SUCCESS;
+    if (file_descriptors[fd].size_dirty) {
+        result = _fs_write_inode(file_descriptors[fd].inode_num, &file_descriptors[fd].inode_cache);
+    }
     file_descriptors[fd].in_use = false;
+    if (file_descriptors[fd].ra_buffer) {
+        kfree(file_descriptors[fd].ra_buffer);
+        file_descriptors[fd].ra_buffer = NULL;
+    }
+    return result;
+}
+
+// Read-ahead of every descriptor on the file is stale after a write
+static void readahead_invalidate(uint32_t inode_num) {
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        if (file_descriptors[i].in_use && file_descriptors[i].inode_num == inode_num) {
+            file_descriptors[i].ra_length = 0;
+        }
+    }
+}
+
+// Fill the read-ahead buffer with up to ra_window blocks from file block
+// 'index', in as few transfers as the layout allows, then widen the window
+static int readahead_fill(file_descriptor_t* file, uint32_t index) {
+    inode_t* inode = &file->inode_cache;
+    if (!file->ra_buffer) {
+        file->ra_buffer = (uint8_t*)kmalloc(FS_RA_MAX_BLOCKS * BLOCK_SIZE);
+        if (!file->ra_buffer) {
+            return FS_ERROR_NO_MEMORY;
+        }
+    }
+    
+    uint32_t end = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t count = file->ra_window;
+    if (count > end - index) count = end - index;
+    
+    uint32_t filled = 0;
+    while (filled < count) {
+        uint32_t block, run;
+        if (file_run(inode, index + filled, count - filled, false, &block, &run) != FS_SUCCESS) {
+            break;
+        }
+        uint8_t* to = file->ra_buffer + filled * BLOCK_SIZE;
+        if (!block) {
+            memset(to, 0, run * BLOCK_SIZE);               // Hole
+        } else if (read_blocks(block, run, to) != DISK_SUCCESS) {
+            break;
+        }
+        filled += run;
+    }
+    if (!filled) {
+        file->ra_length = 0;
+        return FS_ERROR_INVALID;
+    }
+    
+    file->ra_start = index * BLOCK_SIZE;
+    file->ra_length = filled * BLOCK_SIZE;
+    if (file->ra_length > inode->size - file->ra_start) {
+        file->ra_length = inode->size - file->ra_start;
+    }
+    if (file->ra_window < FS_RA_MIN_BLOCKS) {
+        file->ra_window = FS_RA_MIN_BLOCKS;
+    } else if (file->ra_window < FS_RA_MAX_BLOCKS) {
+        file->ra_window *= 2;
+    }
     return FS_SUCCESS;
 }
 
+// Whole blocks go straight into the caller's buffer, runs of consecutive
+// disk blocks in one transfer; the rest is served from the read-ahead
+// buffer, which grows while the reads stay sequential
 int fs_read(int fd, void* buffer, uint32_t size) {
-    (void)size; // TODO: Implement actual file reading
-    
     if (fd < 0 || fd >= MAX_OPEN_FILES || !file_descriptors[fd].in_use || !buffer) {
         return FS_ERROR_INVALID;
     }
     
-    // TODO: Implement actual file reading
-    // For now, return 0 (no data read)
-    return 0;
+    file_descriptor_t* file = &file_descriptors[fd];
+    inode_t* inode = &file->inode_cache;
+    if (size == 0 || file->position >= inode->size) {
+        return 0;
+    }
+    if (size > inode->size - file->position) {
+        size = inode->size - file->position;
+    }
+    if (file->position != file->ra_next) {
+        file->ra_window = 1;        // Not where the last read stopped
+    }
+    
+    uint8_t* out = (uint8_t*)buffer;
+    uint32_t done = 0;
+    int error = FS_SUCCESS;
+    while (done < size) {
+        uint32_t index = file->position / BLOCK_SIZE;
+        uint32_t offset = file->position % BLOCK_SIZE;
+        uint32_t length;
+        
+        if (file->ra_length && file->position >= file->ra_start &&
+            file->position - file->ra_start < file->ra_length) {
+            uint32_t from = file->position - file->ra_start;
+            length = file->ra_length - from;
+            if (length > size - done) length = size - done;
+            memcpy(out + done, file->ra_buffer + from, length);
+        } else if (offset == 0 && size - done >= BLOCK_SIZE) {
+            uint32_t block, run;
+            error = file_run(inode, index, (size - done) / BLOCK_SIZE, false, &block, &run);
+            if (error != FS_SUCCESS) break;
+            if (!block) {
+                memset(out + done, 0, run * BLOCK_SIZE);   // Hole
+            } else if (read_blocks(block, run, out + done) != DISK_SUCCESS) {
+                error = FS_ERROR_IO;
+                break;
+            }
+            length = run * BLOCK_SIZE;
+        } else if (readahead_fill(file, index) == FS_SUCCESS) {
+            continue;
+        } else {
+            // No memory for read-ahead: one block at a time
+            uint8_t block_buffer[BLOCK_SIZE];
+            uint32_t block, run;
+            error = file_run(inode, index, 1, false, &block, &run);
+            if (error != FS_SUCCESS) break;
+            if (!block) {
+                memset(block_buffer, 0, BLOCK_SIZE);       // Hole
+            } else if (read_block(block, block_buffer) != DISK_SUCCESS) {
+                error = FS_ERROR_IO;
+                break;
+            }
+            length = BLOCK_SIZE - offset;
+            if (length > size - done) length = size - done;
+            memcpy(out + done, block_buffer + offset, length);
+        }
+        done += length;
+        file->position += length;
+    }
+    file->ra_next = file->position;
+    
+    // What was read before a failure, else the failure
+    return done ? (int)done : error;
 }
 
+// Blocks are allocated as the file grows, extents next to where the file
+// ends, so a file written front to back lands on consecutive blocks and
+// reads back in runs. An append that allocated nothing leaves the inode
+// to fs_close or fs_sync.
 int fs_write(int fd, const void* buffer, uint32_t size) {
-    (void)size; // TODO: Implement actual file writing
-    
     if (fd < 0 || fd >= MAX_OPEN_FILES || !file_descriptors[fd].in_use || !buffer) {
         return FS_ERROR_INVALID;
     }
     
-    // TODO: Implement actual file writing
-    // For now, return 0 (no data written)
-    return 0;
+    file_descriptor_t* file = &file_descriptors[fd];
+    inode_t* inode = &file->inode_cache;
+    const uint8_t* in = (const uint8_t*)buffer;
+    uint32_t free_before = superblock.free_blocks;
+    uint32_t done = 0;
+    int result = FS_SUCCESS;
+    readahead_invalidate(file->inode_num);
+    if (file->flags & FS_OPEN_APPEND) {
+        file->position = inode->size;
+    }
+    
+    while (done < size) {
+        uint32_t index = file->position / BLOCK_SIZE;
+        uint32_t offset = file->position % BLOCK_SIZE;
+        uint32_t whole = offset == 0 ? (size - done) / BLOCK_SIZE : 0;
+        uint32_t block, run;
+        result = file_run(inode, index, whole ? whole : 1, true, &block, &run);
+        if (result != FS_SUCCESS) {
+            break;
+        }
+        
+        uint32_t length;
+        if (whole) {
+            if (write_blocks(block, run, in + done) != DISK_SUCCESS) {
+                result = FS_ERROR_INVALID;
+                break;
+            }
+            length = run * BLOCK_SIZE;
+        } else {
+            // Keep what the block already holds; one past the end holds nothing
+            uint8_t block_buffer[BLOCK_SIZE];
+            if (index * BLOCK_SIZE < inode->size) {
+                if (read_block(block, block_buffer) != DISK_SUCCESS) {
+                    result = FS_ERROR_INVALID;
+                    break;
+                }
+            } else {
+                memset(block_buffer, 0, BLOCK_SIZE);
+            }
+            length = BLOCK_SIZE - offset;
+            if (length > size - done) length = size - done;
+            memcpy(block_buffer + offset, in + done, length);
+            if (write_block(block, block_buffer) != DISK_SUCCESS) {
+                result = FS_ERROR_INVALID;
+                break;
+            }
+        }
+        done += length;
+        file->position += length;
+        if (file->position > inode->size) {
+            inode->size = file->position;
+        }
+    }
+    
+    // Blocks preallocated past the size count as used
+    uint32_t size_blocks = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (inode->blocks_used < size_blocks || !(inode->flags & INODE_EXTENTS)) {
+        inode->blocks_used = size_blocks;
+    }
+    bool allocated = superblock.free_blocks != free_before;
+    if (map_flush() != FS_SUCCESS) {
+        result = FS_ERROR_INVALID;
+    } else if ((file->flags & FS_OPEN_APPEND) && !allocated) {
+        file->size_dirty = true;
+    } else if (_fs_write_inode(file->inode_num, inode) != FS_SUCCESS) {
+        result = FS_ERROR_INVALID;
+    } else {
+        file->size_dirty = false;
+    }
+    if (allocated) {
+        fs_sync_allocation();
+    }
+    
+    return done ? (int)done : result;
 }
 
 int fs_seek(int fd, uint32_t position) {
@@ -844,4 +1763,48 @@ int fs_seek(int fd, uint32_t position) {
     
     file_descriptors[fd].position = position;
     return FS_SUCCESS;
+}
+
+int fs_preallocate(int fd, uint32_t length) {
+    if (fd < 0 || fd >= MAX_OPEN_FILES || !file_descriptors[fd].in_use) {
+        return FS_ERROR_INVALID;
+    }
+    
+    file_descriptor_t* file = &file_descriptors[fd];
+    inode_t* inode = &file->inode_cache;
+    if (!(inode->flags & INODE_EXTENTS)) {
+        return FS_ERROR_INVALID;
+    }
+    if (length < inode->size) {
+        length = inode->size;
+    }
+    uint32_t target = (uint32_t)(((uint64_t)length + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    uint32_t mapped = 0;
+    int result = extent_blocks(inode, &mapped);
+    
+    uint32_t free_before = superblock.free_blocks;
+    while (result == FS_SUCCESS && mapped < target) {
+        uint32_t block, got;
+        result = extent_grow(inode, target - mapped, &block, &got);
+        if (result == FS_SUCCESS) {
+            mapped += got;
+        }
+    }
+    if (result == FS_SUCCESS && mapped > target) {
+        result = extent_trim(inode, target);
+        mapped = target;
+    }
+    if (superblock.free_blocks == free_before) {
+        return result;
+    }
+    
+    inode->blocks_used = mapped;
+    readahead_invalidate(file->inode_num);
+    if (map_flush() != FS_SUCCESS || _fs_write_inode(file->inode_num, inode) != FS_SUCCESS) {
+        result = FS_ERROR_INVALID;
+    } else {
+        file->size_dirty = false;
+    }
+    fs_sync_allocation();
+    return result;
 }
\ No newline at end of file
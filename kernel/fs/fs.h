@@ -10,6 +10,48 @@
 #define MAX_OPEN_FILES       32      // Maximum number of open files
 #define ROOT_INODE          1        // Root directory inode number
 
+// Regular files are mapped by extents, runs of consecutive blocks:
+// FS_INODE_EXTENTS in the inode, then up to FS_EXTENTS_PER_BLOCK more in
+// one overflow block. A growing file is extended where its last extent
+// ends whenever those blocks are free, so a file written front to back is
+// usually one extent and reads back in transfers as long as the caller's.
+// Directories (and files from before extents) keep the direct and
+// indirect block pointers.
+#define FS_INODE_EXTENTS     6
+#define FS_EXTENTS_PER_BLOCK (BLOCK_SIZE / sizeof(fs_extent_t))
+#define FS_MAX_EXTENTS       (FS_INODE_EXTENTS + FS_EXTENTS_PER_BLOCK)
+
+// Sequential read-ahead: reads smaller than a block or unaligned are
+// served from a per-descriptor buffer filled FS_RA_MIN_BLOCKS at a time,
+// doubling while the reads stay sequential up to FS_RA_MAX_BLOCKS; a seek
+// elsewhere starts again from one block
+#define FS_RA_MIN_BLOCKS     8       // 4 KB
+#define FS_RA_MAX_BLOCKS     128     // 64 KB
+
+// Directories start as a plain list of entries in up to
+// FS_DIR_LINEAR_BLOCKS blocks. One that outgrows them is rebuilt hashed:
+// blocks_used is then a power of two of buckets, a name lives in the
+// bucket its hash selects or, when that is full, the next one with room
+// (a lookup stops at the first bucket with a never used slot), and a
+// removed entry stays behind as a tombstone (inode 0, name kept) so the
+// names probed past it are still found. Beyond three quarters full the
+// directory is rebuilt with twice the buckets.
+#define FS_DIR_LINEAR_BLOCKS    4
+#define FS_DIR_HASH_MIN_BUCKETS 16
+#define FS_DIR_ENTRIES_PER_BLOCK (BLOCK_SIZE / sizeof(directory_entry_t))
+
+// fs_open flags. An append descriptor writes at the end of the file
+// whatever its position. When a write lands in blocks already allocated
+// (see fs_preallocate) it touches nothing but those blocks: the inode
+// with the new size goes out on fs_close or fs_sync, or with the next
+// write that does allocate, so a crash before then loses the tail.
+#define FS_OPEN_WRITE        0x01
+#define FS_OPEN_APPEND       0x02
+
+// inode_t.flags
+#define INODE_EXTENTS        0x0001
+#define INODE_HASHED         0x0002  // Directory in hashed buckets
+
 // File types
 #define FILE_TYPE_REGULAR   0x01
 #define FILE_TYPE_DIRECTORY 0x02
@@ -26,6 +68,7 @@
 #define FS_ERROR_INVALID    -3
 #define FS_ERROR_EXISTS     -4
 #define FS_ERROR_NO_MEMORY  -5
+#define FS_ERROR_IO         -6      // The disk failed a transfer
 
 // Superblock structure - describes the file system
 typedef struct {
@@ -39,21 +82,37 @@ typedef struct {
     uint32_t total_inodes;    // Total number of inodes
     uint32_t free_inodes;     // Number of free inodes
     uint32_t root_inode;      // Root directory inode number
+    uint32_t block_bitmap_blocks;   // After the inodes; 0 on older disks: 1
+    uint32_t inode_bitmap_blocks;   // After the block bitmap; likewise
 } __attribute__((packed)) superblock_t;
 
+typedef struct {
+    uint32_t start;           // First block
+    uint32_t length;          // Blocks
+} __attribute__((packed)) fs_extent_t;
+
 // Inode structure - describes a file or directory
 typedef struct {
     uint32_t inode_num;       // Inode number
     uint8_t file_type;        // File type (regular file, directory, etc.)
     uint8_t permissions;      // File permissions
-    uint16_t reserved;        // Reserved for alignment
+    uint16_t flags;           // INODE_EXTENTS, INODE_HASHED
     uint32_t size;            // File size in bytes
     uint32_t blocks_used;     // Number of blocks used by this file
     uint32_t created_time;    // Creation timestamp (placeholder)
     uint32_t modified_time;   // Last modification timestamp (placeholder)
-    uint32_t direct_blocks[12]; // Direct block pointers
-    uint32_t indirect_block;  // Single indirect block pointer
-    uint32_t double_indirect; // Double indirect block pointer (for large files)
+    union {
+        struct {
+            uint32_t direct_blocks[12]; // Direct block pointers
+            uint32_t indirect_block;  // Single indirect block pointer
+            uint32_t double_indirect; // Double indirect block pointer (for large files)
+        };
+        struct {
+            fs_extent_t extents[FS_INODE_EXTENTS];
+            uint32_t extent_count;
+            uint32_t extent_block;    // The rest of the extents, 0 until needed
+        };
+    };
 } __attribute__((packed)) inode_t;
 
 // Directory entry structure
@@ -72,6 +131,12 @@ typedef struct {
     uint8_t flags;            // Open flags (read, write, etc.)
     uint8_t in_use;           // Whether this descriptor is in use
     inode_t inode_cache;      // Cached inode data
+    uint32_t ra_next;         // Where a sequential read would start
+    uint32_t ra_window;       // Blocks the next read-ahead fills
+    uint32_t ra_start;        // File offset of ra_buffer
+    uint32_t ra_length;       // Bytes valid in it, 0: empty
+    uint8_t* ra_buffer;       // FS_RA_MAX_BLOCKS, allocated on first use
+    bool size_dirty;          // inode_cache newer than the disk's
 } file_descriptor_t;
 
 // File system interface functions
@@ -87,6 +152,12 @@ int fs_read(int fd, void* buffer, uint32_t size);
 int fs_write(int fd, const void* buffer, uint32_t size);
 int fs_seek(int fd, uint32_t position);
 
+// Allocate the blocks of an extent file's first 'length' bytes now, in as
+// few extents as the free space allows, without changing its size; a
+// length below what is allocated releases the blocks past it (and past
+// the size). FS_ERROR_NO_SPACE keeps what could be had.
+int fs_preallocate(int fd, uint32_t length);
+
 // Directory operations
 int fs_create_directory(const char* path);
 int fs_list_directory(const char* path, directory_entry_t* entries, uint32_t max_entries);
@@ -95,6 +166,7 @@ int fs_list_directory(const char* path, directory_entry_t* entries, uint32_t max
 int fs_stat(const char* path, inode_t* stat_info);
 int fs_exists(const char* path);
 uint32_t fs_get_free_space(void);
+int fs_sync(void);                      // Block cache and drive cache to disk
 
 // Internal functions (not exposed to user)
 int _fs_read_superblock(superblock_t* sb);
@@ -0,0 +1,69 @@
+#ifndef LRU_H
+#define LRU_H
+
+#include "../types.h"
+
+// LRU order for the fixed-size caches (bcache, dcache): a doubly linked
+// list of slot indices, slot i's links in links[i] beside the cache's own
+// entry array. The caller holds the cache lock.
+#define LRU_NONE                (-1)
+
+typedef struct {
+    int16_t prev;               // Towards the most recently used
+    int16_t next;
+} lru_link_t;
+
+typedef struct {
+    lru_link_t* links;
+    int16_t head;               // Most recently used
+    int16_t tail;
+} lru_list_t;
+
+#define LRU_LIST_INIT(links)    { (links), LRU_NONE, LRU_NONE }
+
+static inline void lru_unlink(lru_list_t* lru, int16_t i) {
+    lru_link_t* link = &lru->links[i];
+    if (link->prev != LRU_NONE) lru->links[link->prev].next = link->next;
+    else lru->head = link->next;
+    if (link->next != LRU_NONE) lru->links[link->next].prev = link->prev;
+    else lru->tail = link->prev;
+}
+
+static inline void lru_push_head(lru_list_t* lru, int16_t i) {
+    lru->links[i].prev = LRU_NONE;
+    lru->links[i].next = lru->head;
+    if (lru->head != LRU_NONE) lru->links[lru->head].prev = i;
+    lru->head = i;
+    if (lru->tail == LRU_NONE) lru->tail = i;
+}
+
+static inline void lru_push_tail(lru_list_t* lru, int16_t i) {
+    lru->links[i].next = LRU_NONE;
+    lru->links[i].prev = lru->tail;
+    if (lru->tail != LRU_NONE) lru->links[lru->tail].next = i;
+    lru->tail = i;
+    if (lru->head == LRU_NONE) lru->head = i;
+}
+
+// Most recently used now
+static inline void lru_touch(lru_list_t* lru, int16_t i) {
+    if (lru->head == i) return;
+    lru_unlink(lru, i);
+    lru_push_head(lru, i);
+}
+
+// Next to be reused
+static inline void lru_demote(lru_list_t* lru, int16_t i) {
+    lru_unlink(lru, i);
+    lru_push_tail(lru, i);
+}
+
+// Slots 0 to count - 1, slot 0 the first to be reused
+static inline void lru_reset(lru_list_t* lru, int16_t count) {
+    lru->head = lru->tail = LRU_NONE;
+    for (int16_t i = 0; i < count; i++) {
+        lru_push_head(lru, i);
+    }
+}
+
+#endif // LRU_H
@@ -1,7 +1,13 @@
 #include "framebuffer.h"
+#include "../mm/memory.h"
 
 static framebuffer_info_t g_fb_info;
 
+// Drawing goes to the back buffer when there is one; the damaged box is
+// what fb_present copies out (x1 <= x0: nothing)
+static uint8_t* back_buffer = NULL;
+static uint32_t damage_x0, damage_y0, damage_x1, damage_y1;
+
 static inline volatile uint8_t* fb_base_u8(void) {
     return (volatile uint8_t*)(uintptr_t)g_fb_info.phys_addr;
 }
@@ -16,6 +22,38 @@ void fb_init_scaffold(void) {
     g_fb_info.bpp = 0;
 }
 
+static inline bool fb_drawable(void) {
+    return g_fb_info.available && (g_fb_info.bpp == 8 || g_fb_info.bpp == 32);
+}
+
+static inline uint8_t* fb_target(void) {
+    return back_buffer ? back_buffer : (uint8_t*)fb_base_u8();
+}
+
+static void fb_damage(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+    if (damage_x1 <= damage_x0) {
+        damage_x0 = x0;
+        damage_y0 = y0;
+        damage_x1 = x1;
+        damage_y1 = y1;
+        return;
+    }
+    if (x0 < damage_x0) damage_x0 = x0;
+    if (y0 < damage_y0) damage_y0 = y0;
+    if (x1 > damage_x1) damage_x1 = x1;
+    if (y1 > damage_y1) damage_y1 = y1;
+}
+
+// 'count' pixels of one row from 'dst': memset's rep stosd and SSE tiers
+// for 8 bpp, rep stosd of the colour for 32
+static void fb_fill_span(uint8_t* dst, uint32_t count, uint32_t color) {
+    if (g_fb_info.bpp == 8) {
+        memset(dst, (int)(color & 0xFF), count);
+    } else {
+        __asm__ volatile ("rep stosl" : "+D"(dst), "+c"(count) : "a"(color) : "memory");
+    }
+}
+
 void fb_register_linear_framebuffer(uint32_t phys_addr, uint32_t width, uint32_t height, uint32_t pitch, uint32_t bpp) {
     g_fb_info.available = true;
     g_fb_info.backend = FB_BACKEND_LINEAR;
@@ -46,64 +84,102 @@ int fb_is_available(void) {
     return g_fb_info.available ? 1 : 0;
 }
 
-void fb_clear(uint32_t color) {
-    if (!g_fb_info.available || g_fb_info.bpp != 8) {
-        return;
+int fb_set_back_buffer(bool enabled) {
+    if (!enabled || !fb_drawable()) {
+        if (back_buffer) kfree(back_buffer);
+        back_buffer = NULL;
+        return enabled ? -1 : 0;
     }
+    if (back_buffer) return 0;
+    back_buffer = (uint8_t*)kmalloc(g_fb_info.pitch * g_fb_info.height);
+    if (!back_buffer) return -1;
+    // Start from what is on the screen
+    memcpy(back_buffer, (const void*)fb_base_u8(), g_fb_info.pitch * g_fb_info.height);
+    damage_x0 = damage_x1 = 0;
+    return 0;
+}
 
-    volatile uint8_t* base = fb_base_u8();
-    uint8_t value = (uint8_t)(color & 0xFF);
-
-    for (uint32_t y = 0; y < g_fb_info.height; y++) {
-        uint32_t row_offset = y * g_fb_info.pitch;
-        for (uint32_t x = 0; x < g_fb_info.width; x++) {
-            base[row_offset + x] = value;
+// One copy of the damaged box, a single one when it spans whole rows
+void fb_present(void) {
+    if (damage_x1 <= damage_x0) return;
+    if (back_buffer) {
+        uint32_t bytes = g_fb_info.bpp / 8;
+        uint8_t* front = (uint8_t*)fb_base_u8();
+        uint32_t offset = damage_y0 * g_fb_info.pitch + damage_x0 * bytes;
+        uint32_t length = (damage_x1 - damage_x0) * bytes;
+        if (length == g_fb_info.pitch) {
+            memcpy(front + offset, back_buffer + offset, length * (damage_y1 - damage_y0));
+        } else {
+            for (uint32_t y = damage_y0; y < damage_y1; y++, offset += g_fb_info.pitch) {
+                memcpy(front + offset, back_buffer + offset, length);
+            }
         }
     }
+    damage_x0 = damage_x1 = 0;
+}
+
+void fb_clear(uint32_t color) {
+    fb_fill_rect(0, 0, g_fb_info.width, g_fb_info.height, color);
 }
 
 void fb_putpixel(uint32_t x, uint32_t y, uint32_t color) {
-    if (!g_fb_info.available || g_fb_info.bpp != 8) {
+    if (!fb_drawable()) {
         return;
     }
     if (x >= g_fb_info.width || y >= g_fb_info.height) {
         return;
     }
 
-    volatile uint8_t* base = fb_base_u8();
-    base[y * g_fb_info.pitch + x] = (uint8_t)(color & 0xFF);
+    uint8_t* row = fb_target() + y * g_fb_info.pitch;
+    if (g_fb_info.bpp == 8) {
+        row[x] = (uint8_t)(color & 0xFF);
+    } else {
+        ((uint32_t*)row)[x] = color;
+    }
+    fb_damage(x, y, x + 1, y + 1);
 }
 
 void fb_fill_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t color) {
-    if (!g_fb_info.available || g_fb_info.bpp != 8) {
+    if (!fb_drawable() || x >= g_fb_info.width || y >= g_fb_info.height) {
         return;
     }
 
-    uint32_t x_end = x + width;
-    uint32_t y_end = y + height;
-
-    if (x_end > g_fb_info.width) x_end = g_fb_info.width;
-    if (y_end > g_fb_info.height) y_end = g_fb_info.height;
+    uint32_t x_end = width > g_fb_info.width - x ? g_fb_info.width : x + width;
+    uint32_t y_end = height > g_fb_info.height - y ? g_fb_info.height : y + height;
+    if (x_end == x || y_end == y) {
+        return;
+    }
 
-    for (uint32_t py = y; py < y_end; py++) {
-        for (uint32_t px = x; px < x_end; px++) {
-            fb_putpixel(px, py, color);
-        }
+    uint32_t bytes = g_fb_info.bpp / 8;
+    uint8_t* row = fb_target() + y * g_fb_info.pitch + x * bytes;
+    for (uint32_t py = y; py < y_end; py++, row += g_fb_info.pitch) {
+        fb_fill_span(row, x_end - x, color);
     }
+    fb_damage(x, y, x_end, y_end);
 }
 
 void fb_demo_gradient(void) {
-    if (!g_fb_info.available || g_fb_info.bpp != 8) {
+    if (!fb_drawable()) {
         return;
     }
 
+    // Drawn off screen when memory allows, then shown in one copy
+    fb_set_back_buffer(true);
+    uint8_t* base = fb_target();
     for (uint32_t y = 0; y < g_fb_info.height; y++) {
+        uint8_t* row = base + y * g_fb_info.pitch;
         for (uint32_t x = 0; x < g_fb_info.width; x++) {
             uint8_t c = (uint8_t)(((x * 32) / g_fb_info.width) + ((y * 8) / g_fb_info.height));
-            fb_putpixel(x, y, c);
+            if (g_fb_info.bpp == 8) {
+                row[x] = c;
+            } else {
+                ((uint32_t*)row)[x] = c * 0x00010101u;
+            }
         }
     }
+    fb_damage(0, 0, g_fb_info.width, g_fb_info.height);
 
     fb_fill_rect(20, 20, 100, 30, 60);
     fb_fill_rect(30, 30, 80, 10, 10);
+    fb_present();
 }
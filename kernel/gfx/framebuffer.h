@@ -26,6 +26,12 @@ void fb_try_enable_mode13_scaffold(void);
 const framebuffer_info_t* fb_get_info(void);
 int fb_is_available(void);
 
+// 8 and 32 bpp. With a back buffer, drawing lands in RAM and the box it
+// touched goes to the screen in one copy on fb_present; without one it
+// goes straight to the screen and fb_present has nothing to do.
+int fb_set_back_buffer(bool enabled);   // -1: no memory, drawing stays direct
+void fb_present(void);
+
 void fb_clear(uint32_t color);
 void fb_putpixel(uint32_t x, uint32_t y, uint32_t color);
 void fb_fill_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t color);
@@ -1,101 +1,128 @@
 #include "gui.h"
 #include "mm/memory.h"
 #include "shell.h"
+#include "dashboard.h"
+#include "arch/spinlock.h"
 
 // Global GUI state
 static gui_state_t gui_state;
 static int desktop_active = 0;
 static int launcher_open = 0;
 static int launcher_selection = 0;
-static window_t* app_windows[4] = {NULL, NULL, NULL, NULL};
+static spinlock_t gui_spinlock = SPINLOCK_INIT;
 
-static const char* launcher_apps[4] = {
+#define LAUNCHER_APPS 5
+
+static window_t* app_windows[LAUNCHER_APPS] = {NULL, NULL, NULL, NULL, NULL};
+
+static const char* launcher_apps[LAUNCHER_APPS] = {
     "Terminal",
     "System Monitor",
     "Network",
-    "About TradeKernel"
+    "About TradeKernel",
+    "Market Dashboard"
 };
 
-static void gui_draw_desktop(void) {
-    vga_set_color(GUI_COLOR_DESKTOP_FG, GUI_COLOR_DESKTOP_BG);
-    for (int y = 0; y < VGA_HEIGHT; y++) {
-        for (int x = 0; x < VGA_WIDTH; x++) {
-            vga_set_cursor(x, y);
-            vga_putchar(' ');
-        }
+#define LAUNCHER_X 2
+#define LAUNCHER_Y 2
+#define LAUNCHER_W 34
+#define LAUNCHER_H 13
+
+// Back buffer, and the clip of the rectangle being repainted
+static uint16_t back[VGA_HEIGHT][VGA_WIDTH];
+static gui_rect_t damage[GUI_MAX_DAMAGE];
+static int damage_count = 0;
+static gui_rect_t clip;
+static uint8_t paint_color = 0;
+
+static void paint_set_color(vga_color_t fg, vga_color_t bg) {
+    paint_color = fg | bg << 4;
+}
+
+static inline void paint_char(int x, int y, char c) {
+    if (x >= clip.x0 && x < clip.x1 && y >= clip.y0 && y < clip.y1) {
+        back[y][x] = (uint16_t)(uint8_t)c | (uint16_t)paint_color << 8;
     }
+}
 
-    // Subtle text-mode texture every 4 columns to avoid a flat background.
-    vga_set_color(VGA_COLOR_LIGHT_BLUE, GUI_COLOR_DESKTOP_BG);
-    for (int y = 2; y < VGA_HEIGHT; y += 2) {
-        for (int x = 0; x < VGA_WIDTH; x += 4) {
-            vga_set_cursor(x, y);
-            vga_putchar('.');
+// Only the part inside the clip is visited
+static void paint_fill(int x, int y, int width, int height, char c) {
+    int x0 = x > clip.x0 ? x : clip.x0;
+    int y0 = y > clip.y0 ? y : clip.y0;
+    int x1 = x + width < clip.x1 ? x + width : clip.x1;
+    int y1 = y + height < clip.y1 ? y + height : clip.y1;
+    uint16_t cell = (uint16_t)(uint8_t)c | (uint16_t)paint_color << 8;
+    for (int py = y0; py < y1; py++) {
+        for (int px = x0; px < x1; px++) {
+            back[py][px] = cell;
         }
     }
 }
 
-static void gui_draw_top_panel(void) {
-    vga_set_color(GUI_COLOR_PANEL_FG, GUI_COLOR_PANEL_BG);
-    vga_set_cursor(0, 0);
-    for (int x = 0; x < VGA_WIDTH; x++) {
-        vga_putchar(' ');
+static void paint_text(int x, int y, const char* text) {
+    if (y < clip.y0 || y >= clip.y1) return;
+    while (text && *text) {
+        paint_char(x++, y, *text++);
     }
+}
 
-    vga_set_cursor(1, 0);
-    vga_write_string("TradeKernel  [F1] Launcher  [F2] Shell");
+static inline bool rect_overlaps(const gui_rect_t* r, int x, int y, int width, int height) {
+    return x < r->x1 && x + width > r->x0 && y < r->y1 && y + height > r->y0;
+}
 
-    vga_set_cursor(VGA_WIDTH - 18, 0);
-    if (launcher_open) {
-        vga_write_string("Launcher: Open");
-    } else {
-        vga_write_string("Launcher: Closed");
+static void paint_desktop(void) {
+    paint_set_color(GUI_COLOR_DESKTOP_FG, GUI_COLOR_DESKTOP_BG);
+    paint_fill(0, 0, VGA_WIDTH, VGA_HEIGHT, ' ');
+
+    // Subtle text-mode texture every 4 columns to avoid a flat background.
+    paint_set_color(VGA_COLOR_LIGHT_BLUE, GUI_COLOR_DESKTOP_BG);
+    for (int y = 2 + ((clip.y0 > 2 ? clip.y0 - 2 : 0) & ~1); y < clip.y1; y += 2) {
+        for (int x = clip.x0 & ~3; x < clip.x1; x += 4) {
+            paint_char(x, y, '.');
+        }
     }
 }
 
-static void gui_draw_launcher_menu(void) {
-    if (!launcher_open) {
+static void paint_top_panel(void) {
+    if (clip.y0 > 0) return;
+    paint_set_color(GUI_COLOR_PANEL_FG, GUI_COLOR_PANEL_BG);
+    paint_fill(0, 0, VGA_WIDTH, 1, ' ');
+    paint_text(1, 0, "TradeKernel  [F1] Launcher  [F2] Shell");
+    paint_text(VGA_WIDTH - 18, 0, launcher_open ? "Launcher: Open" : "Launcher: Closed");
+}
+
+static void paint_launcher_menu(void) {
+    if (!launcher_open || !rect_overlaps(&clip, LAUNCHER_X, LAUNCHER_Y, LAUNCHER_W, LAUNCHER_H)) {
         return;
     }
 
-    const int menu_x = 2;
-    const int menu_y = 2;
-    const int menu_w = 34;
-    const int menu_h = 11;
+    paint_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    paint_fill(LAUNCHER_X, LAUNCHER_Y, LAUNCHER_W, LAUNCHER_H, ' ');
 
-    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-    for (int y = 0; y < menu_h; y++) {
-        for (int x = 0; x < menu_w; x++) {
-            vga_set_cursor(menu_x + x, menu_y + y);
-            vga_putchar(' ');
-        }
-    }
+    paint_set_color(VGA_COLOR_WHITE, VGA_COLOR_DARK_GREY);
+    paint_fill(LAUNCHER_X, LAUNCHER_Y, LAUNCHER_W, 1, ' ');
+    paint_text(LAUNCHER_X + 1, LAUNCHER_Y, "Applications");
 
-    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_DARK_GREY);
-    for (int x = 0; x < menu_w; x++) {
-        vga_set_cursor(menu_x + x, menu_y);
-        vga_putchar(' ');
-    }
-    vga_set_cursor(menu_x + 1, menu_y);
-    vga_write_string("Applications");
-
-    for (int i = 0; i < 4; i++) {
-        vga_set_cursor(menu_x + 2, menu_y + 2 + i * 2);
+    for (int i = 0; i < LAUNCHER_APPS; i++) {
+        int row = LAUNCHER_Y + 2 + i * 2;
         if (launcher_selection == i) {
-            vga_set_color(VGA_COLOR_BLACK, VGA_COLOR_LIGHT_GREEN);
+            paint_set_color(VGA_COLOR_BLACK, VGA_COLOR_LIGHT_GREEN);
         } else {
-            vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+            paint_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
         }
-        vga_write_string("                                ");
-        vga_set_cursor(menu_x + 3, menu_y + 2 + i * 2);
-        vga_putchar('1' + i);
-        vga_write_string(". ");
-        vga_write_string(launcher_apps[i]);
+        paint_fill(LAUNCHER_X + 2, row, 32, 1, ' ');
+        paint_char(LAUNCHER_X + 3, row, '1' + i);
+        paint_text(LAUNCHER_X + 4, row, ". ");
+        paint_text(LAUNCHER_X + 6, row, launcher_apps[i]);
     }
 
-    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
-    vga_set_cursor(menu_x + 2, menu_y + menu_h - 1);
-    vga_write_string("Use arrows + Enter, Esc to close");
+    paint_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    paint_text(LAUNCHER_X + 2, LAUNCHER_Y + LAUNCHER_H - 1, "Use arrows + Enter, Esc to close");
+}
+
+static void damage_launcher(void) {
+    gui_damage(LAUNCHER_X, LAUNCHER_Y, LAUNCHER_W, LAUNCHER_H);
+    gui_damage(0, 0, VGA_WIDTH, 1);     // Its state is on the panel
 }
 
 static void gui_open_app(int app_index) {
@@ -135,6 +162,9 @@ static void gui_open_app(int app_index) {
                     gui_create_label(app, 2, 5, "Now includes a panel and app launcher");
                 }
                 break;
+            case 4:
+                app = dashboard_create_window();
+                break;
             default:
                 break;
         }
@@ -151,6 +181,7 @@ static void gui_open_app(int app_index) {
 
 // Initialize GUI system
 void gui_init(void) {
+    spin_lock_init(&gui_spinlock);
     memset(&gui_state, 0, sizeof(gui_state_t));
     gui_state.next_window_id = 1;
 }
@@ -210,23 +241,24 @@ void gui_show_window(window_t* window) {
     if (!window) return;
     window->visible = 1;
     gui_focus_window(window);
-    gui_draw_window(window);
 }
 
 // Hide a window
 void gui_hide_window(window_t* window) {
     if (!window) return;
     window->visible = 0;
-    gui_redraw_all();
+    gui_invalidate_window(window);
+    gui_compose();
 }
 
 // Focus a window
 void gui_focus_window(window_t* window) {
     if (!window) return;
     
-    // Unfocus all windows
+    // Unfocus all windows; the one that had focus changes its title bar
     window_t* w = gui_state.windows;
     while (w) {
+        if (w->focused) gui_invalidate_window(w);
         w->focused = 0;
         w = w->next;
     }
@@ -257,7 +289,8 @@ void gui_focus_window(window_t* window) {
         }
     }
     
-    gui_redraw_all();
+    gui_invalidate_window(window);
+    gui_compose();
 }
 
 // Create a button widget
@@ -332,136 +365,91 @@ widget_t* gui_create_checkbox(window_t* window, int x, int y, const char* text,
     return widget;
 }
 
-// Draw a window
-void gui_draw_window(window_t* window) {
-    if (!window || !window->visible) return;
-    
+// Paint a window into the back buffer, within the clip
+static void paint_widget(widget_t* widget, window_t* window);
+
+static void paint_window(window_t* window) {
     int x = window->x;
     int y = window->y;
     int width = window->width;
     int height = window->height;
+    if (!rect_overlaps(&clip, x, y, width + 1, height + 1)) return;
     
     // Draw title bar with focused/unfocused visual state.
     vga_color_t title_fg = window->focused ? GUI_COLOR_TITLE_BAR_FG : GUI_COLOR_TITLE_BAR_UNFOCUSED_FG;
     vga_color_t title_bg = window->focused ? GUI_COLOR_TITLE_BAR_BG : GUI_COLOR_TITLE_BAR_UNFOCUSED_BG;
 
-    vga_set_color(title_fg, title_bg);
-    for (int i = 0; i < width; i++) {
-        vga_set_cursor(x + i, y);
-        vga_putchar(' ');
-    }
-    vga_set_cursor(x + 1, y);
-    vga_write_string(window->title);
+    paint_set_color(title_fg, title_bg);
+    paint_fill(x, y, width, 1, ' ');
+    paint_text(x + 1, y, window->title);
 
     if (width > 14) {
-        vga_set_cursor(x + width - 12, y);
-        vga_write_string("[_][#][X]");
+        paint_text(x + width - 12, y, "[_][#][X]");
     }
     
     // Draw window border
-    vga_set_color(GUI_COLOR_BORDER_FG, GUI_COLOR_WINDOW_BG);
-    for (int i = 0; i < width; i++) {
-        vga_set_cursor(x + i, y + height - 1);
-        vga_putchar('-');
-    }
-    for (int i = 1; i < height - 1; i++) {
-        vga_set_cursor(x, y + i);
-        vga_putchar('|');
-        vga_set_cursor(x + width - 1, y + i);
-        vga_putchar('|');
-    }
-    vga_set_cursor(x, y);
-    vga_putchar('+');
-    vga_set_cursor(x + width - 1, y);
-    vga_putchar('+');
-    vga_set_cursor(x, y + height - 1);
-    vga_putchar('+');
-    vga_set_cursor(x + width - 1, y + height - 1);
-    vga_putchar('+');
+    paint_set_color(GUI_COLOR_BORDER_FG, GUI_COLOR_WINDOW_BG);
+    paint_fill(x, y + height - 1, width, 1, '-');
+    paint_fill(x, y + 1, 1, height - 2, '|');
+    paint_fill(x + width - 1, y + 1, 1, height - 2, '|');
+    paint_char(x, y, '+');
+    paint_char(x + width - 1, y, '+');
+    paint_char(x, y + height - 1, '+');
+    paint_char(x + width - 1, y + height - 1, '+');
 
     // Draw a simple shadow to improve depth perception.
-    vga_set_color(VGA_COLOR_DARK_GREY, VGA_COLOR_BLACK);
-    if (x + width < VGA_WIDTH) {
-        for (int i = 1; i < height; i++) {
-            vga_set_cursor(x + width, y + i);
-            vga_putchar(' ');
-        }
-    }
-    if (y + height < VGA_HEIGHT) {
-        for (int i = 1; i <= width; i++) {
-            if (x + i < VGA_WIDTH) {
-                vga_set_cursor(x + i, y + height);
-                vga_putchar(' ');
-            }
-        }
-    }
+    paint_set_color(VGA_COLOR_DARK_GREY, VGA_COLOR_BLACK);
+    paint_fill(x + width, y + 1, 1, height - 1, ' ');
+    paint_fill(x + 1, y + height, width, 1, ' ');
     
     // Clear window interior
-    vga_set_color(GUI_COLOR_WINDOW_FG, GUI_COLOR_WINDOW_BG);
-    for (int i = 1; i < height - 1; i++) {
-        for (int j = 1; j < width - 1; j++) {
-            vga_set_cursor(x + j, y + i);
-            vga_putchar(' ');
-        }
-    }
+    paint_set_color(GUI_COLOR_WINDOW_FG, GUI_COLOR_WINDOW_BG);
+    paint_fill(x + 1, y + 1, width - 2, height - 2, ' ');
     
     // Draw widgets
     widget_t* widget = window->widgets;
     while (widget) {
-        gui_draw_widget(widget, window);
+        paint_widget(widget, window);
         widget = widget->next;
     }
 }
 
-// Draw a widget
-void gui_draw_widget(widget_t* widget, window_t* window) {
-    if (!widget || !window) return;
-    
+static void paint_widget(widget_t* widget, window_t* window) {
     int wx = window->x + widget->x + 1; // +1 for border
     int wy = window->y + widget->y + GUI_TITLE_BAR_HEIGHT + 1; // +1 for title bar +1 for border
+    if (!rect_overlaps(&clip, wx, wy, widget->width, widget->height)) return;
     
     switch (widget->type) {
         case WIDGET_BUTTON: {
             vga_color_t fg = widget->active ? GUI_COLOR_BUTTON_ACTIVE_FG : GUI_COLOR_BUTTON_FG;
             vga_color_t bg = widget->active ? GUI_COLOR_BUTTON_ACTIVE_BG : GUI_COLOR_BUTTON_BG;
-            vga_set_color(fg, bg);
+            paint_set_color(fg, bg);
             
             // Draw button border
-            for (int i = 0; i < widget->width; i++) {
-                vga_set_cursor(wx + i, wy);
-                vga_putchar(' ');
-                vga_set_cursor(wx + i, wy + widget->height - 1);
-                vga_putchar(' ');
-            }
-            for (int i = 0; i < widget->height; i++) {
-                vga_set_cursor(wx, wy + i);
-                vga_putchar(' ');
-                vga_set_cursor(wx + widget->width - 1, wy + i);
-                vga_putchar(' ');
-            }
+            paint_fill(wx, wy, widget->width, 1, ' ');
+            paint_fill(wx, wy + widget->height - 1, widget->width, 1, ' ');
+            paint_fill(wx, wy, 1, widget->height, ' ');
+            paint_fill(wx + widget->width - 1, wy, 1, widget->height, ' ');
             
             // Draw button text
-            int text_x = wx + (widget->width - strlen(widget->text)) / 2;
+            int text_x = wx + (widget->width - (int)strlen(widget->text)) / 2;
             int text_y = wy + widget->height / 2;
-            vga_set_cursor(text_x, text_y);
-            vga_write_string(widget->text);
+            paint_text(text_x, text_y, widget->text);
             break;
         }
         
         case WIDGET_LABEL:
-            vga_set_color(GUI_COLOR_WINDOW_FG, GUI_COLOR_WINDOW_BG);
-            vga_set_cursor(wx, wy);
-            vga_write_string(widget->text);
+            paint_set_color(GUI_COLOR_WINDOW_FG, GUI_COLOR_WINDOW_BG);
+            paint_text(wx, wy, widget->text);
             break;
             
         case WIDGET_CHECKBOX:
-            vga_set_color(GUI_COLOR_WINDOW_FG, GUI_COLOR_WINDOW_BG);
-            vga_set_cursor(wx, wy);
-            vga_putchar('[');
-            vga_putchar(widget->active ? 'X' : ' ');
-            vga_putchar(']');
-            vga_putchar(' ');
-            vga_write_string(widget->text);
+            paint_set_color(GUI_COLOR_WINDOW_FG, GUI_COLOR_WINDOW_BG);
+            paint_char(wx, wy, '[');
+            paint_char(wx + 1, wy, widget->active ? 'X' : ' ');
+            paint_char(wx + 2, wy, ']');
+            paint_char(wx + 3, wy, ' ');
+            paint_text(wx + 4, wy, widget->text);
             break;
             
         default:
@@ -469,21 +457,133 @@ void gui_draw_widget(widget_t* widget, window_t* window) {
     }
 }
 
-// Redraw all visible windows
-void gui_redraw_all(void) {
-    gui_draw_desktop();
-    gui_draw_top_panel();
+// Add a rectangle of screen cells to the damage; one overlapping or
+// touching a rectangle already there grows that one, and when all slots
+// are taken the last absorbs it
+void gui_damage(int x, int y, int width, int height) {
+    gui_rect_t r = { x < 0 ? 0 : x, y < 0 ? 0 : y,
+                     x + width > VGA_WIDTH ? VGA_WIDTH : x + width,
+                     y + height > VGA_HEIGHT ? VGA_HEIGHT : y + height };
+    if (r.x0 >= r.x1 || r.y0 >= r.y1) return;
+    
+    int i;
+    for (i = 0; i < damage_count; i++) {
+        gui_rect_t* d = &damage[i];
+        if (r.x0 <= d->x1 && r.x1 >= d->x0 && r.y0 <= d->y1 && r.y1 >= d->y0) break;
+    }
+    if (i == damage_count) {
+        if (damage_count < GUI_MAX_DAMAGE) {
+            damage[damage_count++] = r;
+            return;
+        }
+        i = damage_count - 1;
+    }
+    gui_rect_t* d = &damage[i];
+    if (r.x0 < d->x0) d->x0 = r.x0;
+    if (r.y0 < d->y0) d->y0 = r.y0;
+    if (r.x1 > d->x1) d->x1 = r.x1;
+    if (r.y1 > d->y1) d->y1 = r.y1;
+}
+
+// The window and its shadow
+void gui_invalidate_window(window_t* window) {
+    if (!window) return;
+    gui_damage(window->x, window->y, window->width + 1, window->height + 1);
+}
+
+void gui_invalidate_widget(widget_t* widget, window_t* window) {
+    if (!widget || !window) return;
+    gui_damage(window->x + widget->x + 1, window->y + widget->y + GUI_TITLE_BAR_HEIGHT + 1,
+               widget->width, widget->height);
+}
+
+// Repaint every damaged rectangle bottom up: desktop, panel, windows in
+// stacking order, launcher. Then copy out each row's damaged span.
+void gui_compose(void) {
+    if (damage_count == 0) return;
     
-    // Draw all visible windows (in order, focused window last).
-    window_t* window = gui_state.windows;
-    while (window) {
-        if (window->visible) {
-            gui_draw_window(window);
+    for (int i = 0; i < damage_count; i++) {
+        clip = damage[i];
+        paint_desktop();
+        paint_top_panel();
+        for (window_t* window = gui_state.windows; window; window = window->next) {
+            if (window->visible) {
+                paint_window(window);
+            }
         }
-        window = window->next;
+        paint_launcher_menu();
+    }
+    
+    for (int y = 0; y < VGA_HEIGHT; y++) {
+        int x0 = VGA_WIDTH, x1 = 0;
+        for (int i = 0; i < damage_count; i++) {
+            if (y < damage[i].y0 || y >= damage[i].y1) continue;
+            if (damage[i].x0 < x0) x0 = damage[i].x0;
+            if (damage[i].x1 > x1) x1 = damage[i].x1;
+        }
+        if (x0 < x1) {
+            vga_put_cells(x0, y, &back[y][x0], x1 - x0);
+        }
+    }
+    damage_count = 0;
+}
+
+void gui_draw_window(window_t* window) {
+    if (!window || !window->visible) return;
+    gui_invalidate_window(window);
+    gui_compose();
+}
+
+void gui_draw_widget(widget_t* widget, window_t* window) {
+    if (!widget || !window) return;
+    gui_invalidate_widget(widget, window);
+    gui_compose();
+}
+
+void gui_redraw_all(void) {
+    gui_damage(0, 0, VGA_WIDTH, VGA_HEIGHT);
+    gui_compose();
+}
+
+uint32_t gui_lock(void) {
+    return spin_lock_irqsave(&gui_spinlock);
+}
+
+void gui_unlock(uint32_t flags) {
+    spin_unlock_irqrestore(&gui_spinlock, flags);
+}
+
+void gui_set_widget_text(widget_t* widget, window_t* window, const char* text) {
+    if (gui_replace_widget_text(widget, window, text) && window->visible) {
+        gui_compose();
     }
+}
 
-    gui_draw_launcher_menu();
+// Labels take the width of their text: damage the old and the new extent
+int gui_replace_widget_text(widget_t* widget, window_t* window, const char* text) {
+    if (!widget || !window || !text) return 0;
+    if (widget->text && strcmp(widget->text, text) == 0) return 0;
+    char* copy = kmalloc(strlen(text) + 1);
+    if (!copy) return 0;
+    strcpy(copy, text);
+    
+    gui_invalidate_widget(widget, window);
+    if (widget->text) kfree(widget->text);
+    widget->text = copy;
+    if (widget->type == WIDGET_LABEL) {
+        widget->width = strlen(text);
+    } else if (widget->type == WIDGET_CHECKBOX) {
+        widget->width = strlen(text) + 4;
+    }
+    gui_invalidate_widget(widget, window);
+    return 1;
+}
+
+void gui_set_widget_active(widget_t* widget, window_t* window, int active) {
+    if (!widget || !window || widget->active == active) return;
+    widget->active = active;
+    gui_invalidate_widget(widget, window);
+    if (window->visible) gui_compose();
 }
 
 // Handle keyboard input for GUI
@@ -511,14 +611,24 @@ int gui_is_desktop_active(void) {
     return desktop_active;
 }
 
+static int handle_scancode(uint8_t scancode);
+
 int gui_handle_scancode(uint8_t scancode) {
+    uint32_t flags = gui_lock();
+    int handled = handle_scancode(scancode);
+    gui_unlock(flags);
+    return handled;
+}
+
+static int handle_scancode(uint8_t scancode) {
     // F1 opens desktop launcher from shell mode, or toggles launcher in desktop mode.
     if (scancode == 0x3B) {
         if (!desktop_active) {
             gui_enter_desktop();
         } else {
             launcher_open = !launcher_open;
-            gui_redraw_all();
+            damage_launcher();
+            gui_compose();
         }
         return 1;
     }
@@ -536,7 +646,8 @@ int gui_handle_scancode(uint8_t scancode) {
     if (scancode == 0x01) {
         if (launcher_open) {
             launcher_open = 0;
-            gui_redraw_all();
+            damage_launcher();
+            gui_compose();
         } else {
             gui_exit_desktop();
         }
@@ -545,34 +656,40 @@ int gui_handle_scancode(uint8_t scancode) {
 
     if (scancode == 0x48 && launcher_open) {
         if (launcher_selection > 0) launcher_selection--;
-        gui_redraw_all();
+        gui_damage(LAUNCHER_X, LAUNCHER_Y, LAUNCHER_W, LAUNCHER_H);
+        gui_compose();
         return 1;
     }
 
     if (scancode == 0x50 && launcher_open) {
-        if (launcher_selection < 3) launcher_selection++;
-        gui_redraw_all();
+        if (launcher_selection < LAUNCHER_APPS - 1) launcher_selection++;
+        gui_damage(LAUNCHER_X, LAUNCHER_Y, LAUNCHER_W, LAUNCHER_H);
+        gui_compose();
         return 1;
     }
 
-    if ((scancode >= 0x02 && scancode <= 0x05) && launcher_open) {
+    if ((scancode >= 0x02 && scancode < 0x02 + LAUNCHER_APPS) && launcher_open) {
+        // Closed first, so the launcher and the window go in one frame
         launcher_selection = scancode - 0x02;
-        gui_open_app(launcher_selection);
         launcher_open = 0;
-        gui_redraw_all();
+        damage_launcher();
+        gui_open_app(launcher_selection);
+        gui_compose();
         return 1;
     }
 
     if (scancode == 0x1C && launcher_open) {
-        gui_open_app(launcher_selection);
         launcher_open = 0;
-        gui_redraw_all();
+        damage_launcher();
+        gui_open_app(launcher_selection);
+        gui_compose();
         return 1;
     }
 
     if (scancode == 0x39) {
         launcher_open = !launcher_open;
-        gui_redraw_all();
+        damage_launcher();
+        gui_compose();
         return 1;
     }
 
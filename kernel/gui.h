@@ -4,6 +4,16 @@
 #include "types.h"
 #include "drivers/vga.h"
 
+// The GUI is composed in a back buffer of text cells. A change marks the
+// screen rectangles it affects as damaged (a window with its shadow, a
+// widget, the launcher, the panel); composing repaints the scene clipped
+// to each damaged rectangle, so untouched cells cost nothing, and hands
+// the changed cells to the console in one pass, a span per row.
+//
+// The keyboard interrupt drives the GUI under gui_lock; anything else that
+// changes it (a task refreshing a window) holds the lock around that.
+#define GUI_MAX_DAMAGE 8    // Rectangles kept apart before they are merged
+
 // GUI constants
 #define GUI_MAX_WINDOWS 8
 #define GUI_MAX_WIDGETS 32
@@ -58,6 +68,11 @@ typedef struct window {
     struct window* next;
 } window_t;
 
+// Screen cells [x0, x1) x [y0, y1)
+typedef struct {
+    int x0, y0, x1, y1;
+} gui_rect_t;
+
 // GUI state
 typedef struct {
     window_t* windows;
@@ -77,10 +92,26 @@ widget_t* gui_create_button(window_t* window, int x, int y, int width, int heigh
 widget_t* gui_create_label(window_t* window, int x, int y, const char* text);
 widget_t* gui_create_checkbox(window_t* window, int x, int y, const char* text, int checked);
 
+// Repaint a window or widget (damage it and compose), or everything
 void gui_draw_window(window_t* window);
 void gui_draw_widget(widget_t* widget, window_t* window);
 void gui_redraw_all(void);
 
+// Damage without composing, for several changes in one frame
+void gui_damage(int x, int y, int width, int height);
+void gui_invalidate_window(window_t* window);
+void gui_invalidate_widget(widget_t* widget, window_t* window);
+void gui_compose(void);
+
+// Change a widget and repaint just it. The replace variant only damages,
+// and returns 0 when the text was already that.
+void gui_set_widget_text(widget_t* widget, window_t* window, const char* text);
+int gui_replace_widget_text(widget_t* widget, window_t* window, const char* text);
+void gui_set_widget_active(widget_t* widget, window_t* window, int active);
+
+uint32_t gui_lock(void);
+void gui_unlock(uint32_t flags);
+
 void gui_handle_input(char c);
 int gui_handle_scancode(uint8_t scancode);
 void gui_enter_desktop(void);
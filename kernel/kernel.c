@@ -10,12 +10,25 @@
 #include "proc/ipc.h" // IPC enabled
 #include "net/net.h"
 #include "net/eth.h"
+#include "net/virtio_net.h"
 #include "net/ip.h"
 #include "net/tcp.h"
 #include "net/socket.h"
 #include "net/websocket.h"
 #include "gui.h" // GUI frameworkdrivers/vga.h"
 #include "gfx/framebuffer.h"
+#include "proc/tick.h"
+#include "proc/vdso.h"
+#include "proc/coro.h"
+#include "arch/smp.h"
+#include "arch/fpu.h"
+#include "arch/pmu.h"
+#include "arch/sysenter.h"
+#include "proc/bench.h"
+#include "proc/journal.h"
+#include "proc/klog.h"
+#include "fs/disk.h"
+#include "bootgraph.h"
 #include "mm/memory.h"
 #include "mm/paging.h"
 #include "arch/interrupts.h"
@@ -26,6 +39,62 @@
 #include "proc/syscalls.h" // System calls enabled
 #include "proc/ipc.h" // IPC enabled
 
+// Saved by kernel_entry.asm
+extern uint32_t multiboot_magic;
+extern uint32_t multiboot_info;
+
+#define MULTIBOOT_BOOTLOADER_MAGIC  0x2BADB002
+#define MULTIBOOT_INFO_CMDLINE      0x4
+#define KERNEL_CMDLINE_SIZE         256
+
+typedef struct {
+    uint32_t flags;
+    uint32_t mem_lower;
+    uint32_t mem_upper;
+    uint32_t boot_device;
+    uint32_t cmdline;
+} multiboot_info_t;
+
+static char kernel_cmdline[KERNEL_CMDLINE_SIZE];
+
+// The loader leaves the command line just past the kernel image, where the
+// heap goes: copy it before memory_init. Booting from disk gives none, only
+// the disk loader's header.
+static void kernel_cmdline_save(void) {
+    if (multiboot_magic == BOOT_LOADER_MAGIC && multiboot_info) {
+        boot_note_loader((const boot_loader_header_t*)multiboot_info);
+        return;
+    }
+    if (multiboot_magic != MULTIBOOT_BOOTLOADER_MAGIC || !multiboot_info) return;
+
+    const multiboot_info_t* info = (const multiboot_info_t*)multiboot_info;
+    if (!(info->flags & MULTIBOOT_INFO_CMDLINE) || !info->cmdline) return;
+
+    const char* cmdline = (const char*)info->cmdline;
+    for (uint32_t i = 0; i < KERNEL_CMDLINE_SIZE - 1 && cmdline[i]; i++) {
+        kernel_cmdline[i] = cmdline[i];
+    }
+}
+
+// What follows "name=" on the command line, "" for a bare "name", or NULL
+// if the option is not there
+static const char* kernel_cmdline_option(const char* name) {
+    const char* p = kernel_cmdline;
+    while (*p) {
+        while (*p == ' ') p++;
+        const char* n = name;
+        while (*n && *p == *n) {
+            p++;
+            n++;
+        }
+        if (!*n && (*p == '=' || *p == ' ' || *p == '\0')) {
+            return *p == '=' ? p + 1 : "";
+        }
+        while (*p && *p != ' ') p++;
+    }
+    return NULL;
+}
+
 // Simple string formatting functions
 void print_hex(uint32_t value) {
     char hex_chars[] = "0123456789ABCDEF";
@@ -100,54 +169,125 @@ void display_loading_screen(void) {
         vga_write_string(".");
     }
     vga_write_string("]\n");
-    
-    // Brief delay (busy wait)
-    for (volatile int i = 0; i < 1000000; i++) {
-        // Busy wait for visual effect
-    }
 }
 
-// Kernel main function - called from bootloader
-void kernel_main(void) {
-    // Display loading screen
+// Boot stages, in the order boot_run reaches them (bootgraph.h)
+static int boot_console(void) {
     display_loading_screen();
-    
-    // Initialize VGA text mode
     vga_init();
-    
-    // Initialize memory management
+    return 0;
+}
+
+static int boot_memory(void) {
     memory_init();
-    
-    // Initialize interrupts first
+    return 0;
+}
+
+static int boot_interrupts(void) {
     interrupts_init();
-    
-    // Initialize paging system (after interrupts for page fault handling)
+    fpu_init(); // Lazy x87/SSE state switching (#NM)
+    pmu_init(); // Hardware counters, per process from here on
+    sysenter_init(); // TSS and SYSENTER MSRs, before the APs copy them
+    return 0;
+}
+
+// After interrupts for page fault handling
+static int boot_paging(void) {
     vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
     vga_write_string("Initializing virtual memory...\n");
     paging_init();
     // Note: Not enabling paging yet - keeping identity mapping for stability
-    
-    // Initialize process management
+    return 0;
+}
+
+static int boot_scheduler(void) {
     vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
     vga_write_string("Initializing process management...\n");
     process_init();
     scheduler_init();
+    tick_init(); // Tickless LAPIC timer, PIT fallback
+    vdso_init(); // Kernel data page, needs the TSC calibration
+    return 0;
+}
+
+static int boot_smp(void) {
+    smp_boot_aps(); // Needs the calibrated LAPIC and TSC
+    interrupts_init_apic(); // I/O APIC routing, now the CPUs are known
+    return 0;
+}
+
+static int boot_gui(void) {
+    gui_init();
+    return 0;
+}
+
+// Graphics backend abstraction; text mode until a mode is set
+static int boot_framebuffer(void) {
+    fb_init_scaffold();
+    return 0;
+}
+
+static int boot_ipc(void) {
     syscalls_init(); // System calls enabled
     ipc_init(); // IPC enabled
-    
-    // Initialize GUI framework
-    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
-    vga_write_string("Initializing GUI framework...\n");
-    gui_init();
+    coro_init(); // Coroutine stack pool
+    return 0;
+}
 
-    // Initialize framebuffer scaffolding (graphics backend abstraction).
+static int boot_network(void) {
     vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
-    vga_write_string("Initializing framebuffer scaffold...\n");
-    fb_init_scaffold();
+    vga_write_string("Initializing network stack...\n");
     vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-    vga_write_string("Framebuffer backend: none (text mode fallback active)\n");
+    // virtio-net where there is one (QEMU/KVM), else the RTL8139
+    int result = NET_SUCCESS;
+    if (virtio_net_init() == NET_SUCCESS) {
+        vga_write_string("virtio-net driver initialized successfully!\n");
+    } else if (rtl8139_init(0xC000) == NET_SUCCESS) {
+        interrupts_route_pci(11, irq_feed_cpu());
+        vga_write_string("Ethernet driver initialized successfully!\n");
+    } else {
+        vga_write_string("Ethernet driver initialization failed!\n");
+        result = NET_ERROR;
+    }
+    
+    if (ipv4_init() == NET_SUCCESS) {
+        vga_write_string("IPv4 protocol initialized successfully!\n");
+    } else {
+        vga_write_string("IPv4 protocol initialization failed!\n");
+        result = NET_ERROR;
+    }
     
-    vga_write_string("Initializing file system...\n");
+    if (tcp_init() == NET_SUCCESS) {
+        vga_write_string("TCP protocol initialized successfully!\n");
+    } else {
+        vga_write_string("TCP protocol initialization failed!\n");
+        result = NET_ERROR;
+    }
+    return result;
+}
+
+// The journal needs the drive; the filesystem on it can wait
+static int boot_disk(void) {
+    vga_write_string("Initializing disk...\n");
+    if (disk_init() != DISK_SUCCESS) {
+        vga_write_string("Disk initialization failed!\n");
+        return DISK_ERROR;
+    }
+    vga_write_string("Disk initialized successfully.\n");
+    return DISK_SUCCESS;
+}
+
+static void print_fs_error(int fs_result) {
+    vga_write_string("(error: ");
+    if (fs_result < 0) {
+        vga_write_string("-");
+        fs_result = -fs_result;
+    }
+    print_dec((uint32_t)fs_result);
+    vga_write_string(")\n");
+}
+
+static int boot_filesystem(void) {
     int fs_result = fs_init();
     if (fs_result == FS_ERROR_NOT_FOUND) {
         vga_write_string("No filesystem found. Formatting disk...\n");
@@ -155,65 +295,108 @@ void kernel_main(void) {
         if (fs_result == FS_SUCCESS) {
             vga_write_string("Filesystem created successfully!\n");
         } else {
-            vga_write_string("Failed to create filesystem (error: ");
-            // Print error code
-            char code_str[10];
-            int temp = fs_result;
-            if (temp < 0) temp = -temp;
-            int i = 0;
-            do {
-                code_str[i++] = '0' + (temp % 10);
-                temp /= 10;
-            } while (temp > 0 && i < 9);
-            if (fs_result < 0) {
-                vga_write_string("-");
-            }
-            while (i > 0) {
-                vga_putchar(code_str[--i]);
-            }
-            vga_write_string(")\n");
+            vga_write_string("Failed to create filesystem ");
+            print_fs_error(fs_result);
         }
     } else if (fs_result == FS_SUCCESS) {
         vga_write_string("Existing filesystem mounted successfully!\n");
     } else {
-        vga_write_string("Filesystem initialization failed (error: ");
-        // Print error code
-        char code_str[10];
-        int temp = fs_result;
-        if (temp < 0) temp = -temp;
-        int i = 0;
-        do {
-            code_str[i++] = '0' + (temp % 10);
-            temp /= 10;
-        } while (temp > 0 && i < 9);
-        if (fs_result < 0) {
-            vga_write_string("-");
-        }
-        while (i > 0) {
-            vga_putchar(code_str[--i]);
-        }
-        vga_write_string(")\n");
+        vga_write_string("Filesystem initialization failed ");
+        print_fs_error(fs_result);
     }
+    return fs_result;
+}
+
+// Order journal at the tail of the disk: the last run's fills come back
+// into the portfolio before anything trades
+static int boot_journal(void) {
+    vga_write_string("Recovering order journal...\n");
+    return journal_init();
+}
+
+// Kernel messages printed as they came until now; from here the klog
+// task drains them and another copies the console out to the screen.
+// Last on the critical path: both would take the CPU from the boot code.
+static int boot_log(void) {
+    klog_start();
+    vga_start_flusher();
+    return 0;
+}
+
+enum {
+    STAGE_CONSOLE, STAGE_MEMORY, STAGE_INTERRUPTS, STAGE_PAGING, STAGE_SCHEDULER,
+    STAGE_SMP, STAGE_GUI, STAGE_FRAMEBUFFER, STAGE_IPC, STAGE_NETWORK,
+    STAGE_DISK, STAGE_FILESYSTEM, STAGE_JOURNAL, STAGE_LOG
+};
+
+#define AFTER_CORE (BOOT_AFTER(STAGE_MEMORY) | BOOT_AFTER(STAGE_INTERRUPTS) | \
+                    BOOT_AFTER(STAGE_SCHEDULER))
+
+static const boot_stage_t boot_stages[] = {
+    [STAGE_CONSOLE]     = {"console",     boot_console,     0, false},
+    [STAGE_MEMORY]      = {"memory",      boot_memory,      0, false},
+    [STAGE_INTERRUPTS]  = {"interrupts",  boot_interrupts,  BOOT_AFTER(STAGE_MEMORY), false},
+    [STAGE_PAGING]      = {"paging",      boot_paging,      BOOT_AFTER(STAGE_INTERRUPTS), false},
+    [STAGE_SCHEDULER]   = {"scheduler",   boot_scheduler,   BOOT_AFTER(STAGE_INTERRUPTS), false},
+    [STAGE_SMP]         = {"smp",         boot_smp,         BOOT_AFTER(STAGE_SCHEDULER), false},
+    [STAGE_GUI]         = {"gui",         boot_gui,         AFTER_CORE, true},
+    [STAGE_FRAMEBUFFER] = {"framebuffer", boot_framebuffer, AFTER_CORE, true},
+    [STAGE_IPC]         = {"ipc",         boot_ipc,         AFTER_CORE, false},
+    [STAGE_NETWORK]     = {"network",     boot_network,     AFTER_CORE | BOOT_AFTER(STAGE_SMP), false},
+    [STAGE_DISK]        = {"disk",        boot_disk,        AFTER_CORE | BOOT_AFTER(STAGE_SMP), false},
+    [STAGE_FILESYSTEM]  = {"filesystem",  boot_filesystem,  BOOT_AFTER(STAGE_DISK), true},
+    [STAGE_JOURNAL]     = {"journal",     boot_journal,     BOOT_AFTER(STAGE_DISK), false},
+    [STAGE_LOG]         = {"log",         boot_log,         BOOT_AFTER(STAGE_SCHEDULER), false},
+};
+
+// The GUI demo window, on request ("guidemo"): it holds the console
+static void gui_demo(void) {
+    if (!boot_wait("gui")) return;
     
-    // Initialize network stack
-    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
-    vga_write_string("Initializing network stack...\n");
-    if (rtl8139_init(0xC000) == NET_SUCCESS) {
-        vga_write_string("Ethernet driver initialized successfully!\n");
-    } else {
-        vga_write_string("Ethernet driver initialization failed!\n");
+    // Clear screen for GUI demo
+    vga_clear();
+    
+    window_t* demo_window = gui_create_window(10, 8, 50, 15, "TradeKernel GUI Demo");
+    if (demo_window) {
+        gui_create_label(demo_window, 2, 1, "Welcome to TradeKernel OS!");
+        gui_create_label(demo_window, 2, 3, "This demonstrates the GUI framework.");
+        gui_create_button(demo_window, 15, 6, 20, 3, "OK", NULL);
+        gui_create_checkbox(demo_window, 2, 10, "Enable advanced features", 1);
+        gui_show_window(demo_window);
     }
     
-    if (ipv4_init() == NET_SUCCESS) {
-        vga_write_string("IPv4 protocol initialized successfully!\n");
-    } else {
-        vga_write_string("IPv4 protocol initialization failed!\n");
+    // Brief delay to show GUI
+    for (volatile int i = 0; i < 5000000; i++) {
+        // Busy wait to show GUI
     }
     
-    if (tcp_init() == NET_SUCCESS) {
-        vga_write_string("TCP protocol initialized successfully!\n");
-    } else {
-        vga_write_string("TCP protocol initialization failed!\n");
+    // Clear screen again for shell
+    vga_clear();
+    
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    vga_write_string("GUI demo completed. Starting shell...\n\n");
+}
+
+// Kernel main function - called from bootloader
+void kernel_main(void) {
+    boot_begin();
+    kernel_cmdline_save();
+    
+    // Per-CPU area first: current_process and friends live there
+    smp_init_bsp();
+    
+    boot_run(boot_stages, sizeof(boot_stages) / sizeof(boot_stages[0]));
+    
+    // "bench[=samples]": tick-to-trade benchmark, leaving QEMU after it
+    // when it has an exit device (make bench)
+    const char* bench = kernel_cmdline_option("bench");
+    if (bench) {
+        uint32_t samples = 0;
+        while (*bench >= '0' && *bench <= '9') {
+            samples = samples * 10 + (uint32_t)(*bench++ - '0');
+        }
+        boot_wait("filesystem"); // Deferred work off the CPUs first
+        bench_boot(samples);
     }
     
     // Set colors for a nice welcome screen
@@ -266,33 +449,11 @@ void kernel_main(void) {
     vga_write_string("Interactive shell enabled! Type 'help' for available commands.\n");
     vga_write_string("Timer interrupts are working in the background.\n\n");
     
-    // GUI Demo - Create a sample window
-    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
-    vga_write_string("GUI Framework Demo:\n");
-    
-    // Clear screen for GUI demo
-    vga_clear();
-    
-    window_t* demo_window = gui_create_window(10, 8, 50, 15, "TradeKernel GUI Demo");
-    if (demo_window) {
-        gui_create_label(demo_window, 2, 1, "Welcome to TradeKernel OS!");
-        gui_create_label(demo_window, 2, 3, "This demonstrates the GUI framework.");
-        gui_create_button(demo_window, 15, 6, 20, 3, "OK", NULL);
-        gui_create_checkbox(demo_window, 2, 10, "Enable advanced features", 1);
-        gui_show_window(demo_window);
-    }
-    
-    // Brief delay to show GUI
-    for (volatile int i = 0; i < 5000000; i++) {
-        // Busy wait to show GUI
+    // "guidemo": the GUI framework's demo window before the shell
+    if (kernel_cmdline_option("guidemo")) {
+        gui_demo();
     }
     
-    // Clear screen again for shell
-    vga_clear();
-    
-    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
-    vga_write_string("GUI demo completed. Starting shell...\n\n");
-    
     // Initialize and start the shell
     shell_init();
     
@@ -0,0 +1,162 @@
+#include "arena.h"
+#include "frame.h"
+#include "memory.h"
+#include "paging.h"
+#include "../arch/spinlock.h"
+#include "../proc/process.h"
+#include "../drivers/vga.h"
+
+// Header before the first chunk's data: the chunk, then the arena itself
+#define ARENA_FIRST_HEADER      (sizeof(arena_chunk_t) + sizeof(arena_t))
+#define ARENA_MAX_ALLOC         (PAGE_SIZE << FRAME_MAX_ORDER)
+
+static spinlock_t arenas_lock = SPINLOCK_INIT;
+static arena_t* arenas = NULL;
+static arena_t* scratch[MAX_CPUS];
+
+// 2^order frames whose data starts 'header' bytes in
+static arena_chunk_t* chunk_create(uint32_t order, uint32_t header) {
+    uint32_t addr = frame_alloc_pages(order);
+    if (!addr) return NULL;
+
+    arena_chunk_t* chunk = (arena_chunk_t*)addr;
+    chunk->next = NULL;
+    chunk->data = (uint8_t*)addr + header;
+    chunk->end = (uint8_t*)addr + (PAGE_SIZE << order);
+    chunk->order = order;
+    return chunk;
+}
+
+static bool chunk_fits(arena_chunk_t* chunk, size_t size, size_t align) {
+    uint8_t* ptr = (uint8_t*)(((uint32_t)chunk->data + align - 1) & ~(uint32_t)(align - 1));
+    return ptr <= chunk->end && size <= (size_t)(chunk->end - ptr);
+}
+
+arena_t* arena_create(const char* name, uint32_t chunk_size) {
+    uint32_t order = frame_order(chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK);
+    if (order > FRAME_MAX_ORDER) return NULL;
+
+    arena_chunk_t* chunk = chunk_create(order, ARENA_FIRST_HEADER);
+    if (!chunk) return NULL;
+
+    arena_t* arena = (arena_t*)(chunk + 1);
+    memset(arena, 0, sizeof(arena_t));
+    arena->first = chunk;
+    arena->current = chunk;
+    arena->cur = chunk->data;
+    arena->end = chunk->end;
+    arena->chunk_order = order;
+    arena->chunks = 1;
+    arena->bytes = PAGE_SIZE << order;
+    arena->name = name;
+
+    uint32_t flags = spin_lock_irqsave(&arenas_lock);
+    arena->next = arenas;
+    arenas = arena;
+    spin_unlock_irqrestore(&arenas_lock, flags);
+    return arena;
+}
+
+void arena_destroy(arena_t* arena) {
+    if (!arena) return;
+
+    uint32_t flags = spin_lock_irqsave(&arenas_lock);
+    for (arena_t** link = &arenas; *link; link = &(*link)->next) {
+        if (*link == arena) {
+            *link = arena->next;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&arenas_lock, flags);
+
+    // The first chunk holds the arena: free it last
+    arena_chunk_t* first = arena->first;
+    arena_chunk_t* chunk = first->next;
+    while (chunk) {
+        arena_chunk_t* next = chunk->next;
+        frame_free_pages((uint32_t)chunk, chunk->order);
+        chunk = next;
+    }
+    frame_free_pages((uint32_t)first, first->order);
+}
+
+// Chunks after the current one are unused since the last reset or restore:
+// move to the first that fits, or link in a new one right after the current
+// chunk, big enough for the request
+void* arena_alloc_slow(arena_t* arena, size_t size, size_t align) {
+    if (size > ARENA_MAX_ALLOC || align > ARENA_MAX_ALLOC) {
+        arena->failed++;
+        return NULL;
+    }
+
+    arena_chunk_t* chunk = arena->current->next;
+    while (chunk && !chunk_fits(chunk, size, align)) {
+        chunk = chunk->next;
+    }
+
+    if (!chunk) {
+        uint32_t order = frame_order(size + align + sizeof(arena_chunk_t));
+        if (order < arena->chunk_order) order = arena->chunk_order;
+        if (order > FRAME_MAX_ORDER ||
+            !(chunk = chunk_create(order, sizeof(arena_chunk_t)))) {
+            arena->failed++;
+            return NULL;
+        }
+        chunk->next = arena->current->next;
+        arena->current->next = chunk;
+        arena->chunks++;
+        arena->bytes += PAGE_SIZE << order;
+    }
+
+    arena->current = chunk;
+    arena->cur = chunk->data;
+    arena->end = chunk->end;
+    return arena_alloc_aligned(arena, size, align);
+}
+
+arena_t* arena_scratch_begin(arena_scratch_t* scope) {
+    scope->flags = irq_save();
+    uint32_t cpu = this_cpu()->id;
+    if (!scratch[cpu]) {
+        scratch[cpu] = arena_create("scratch", ARENA_SCRATCH_CHUNK);
+        if (!scratch[cpu]) {
+            irq_restore(scope->flags);
+            return NULL;
+        }
+    }
+    scope->arena = scratch[cpu];
+    scope->mark = arena_save(scope->arena);
+    return scope->arena;
+}
+
+void arena_scratch_end(arena_scratch_t* scope) {
+    arena_restore(scope->arena, scope->mark);
+    irq_restore(scope->flags);
+}
+
+void arena_print_stats(void) {
+    uint32_t flags = spin_lock_irqsave(&arenas_lock);
+    if (!arenas) {
+        spin_unlock_irqrestore(&arenas_lock, flags);
+        return;
+    }
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Arenas ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    for (arena_t* arena = arenas; arena; arena = arena->next) {
+        vga_write_string(arena->name);
+        vga_write_string(": ");
+        print_dec(arena->chunks);
+        vga_write_string(" chunks, ");
+        print_dec(arena->bytes);
+        vga_write_string(" B  Allocs ");
+        print_dec(arena->allocs);
+        vga_write_string("  Resets ");
+        print_dec(arena->resets);
+        vga_write_string("  Failed ");
+        print_dec(arena->failed);
+        vga_write_string("\n");
+    }
+    spin_unlock_irqrestore(&arenas_lock, flags);
+}
@@ -0,0 +1,106 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "../types.h"
+
+// Region (arena) allocator for objects that all die together: everything
+// carved from a packet or a batch goes at once with arena_reset, in O(1)
+// however many objects there were. Memory comes in chunks of page frames
+// from frame_alloc_pages; the arena header lives in its first chunk. Chunks
+// are kept across resets and reused in order, so a steady workload stops
+// touching the frame allocator after its first batch. Allocation is a
+// bump of one pointer, inline; only moving to the next chunk calls out.
+//
+// An arena has a single owner and no lock. arena_save/arena_restore free
+// back to a mark, for nested lifetimes inside one batch.
+#define ARENA_ALIGN             8                   // Default alignment
+#define ARENA_DEFAULT_CHUNK     (16 * 1024)
+#define ARENA_SCRATCH_CHUNK     (64 * 1024)         // Per-CPU scratch arenas
+
+typedef struct arena_chunk {
+    struct arena_chunk* next;   // Later chunks are all unused
+    uint8_t* data;              // First usable byte
+    uint8_t* end;
+    uint32_t order;             // frame_alloc_pages order
+} __cacheline_aligned arena_chunk_t;
+
+typedef struct arena {
+    arena_chunk_t* current;     // Chunk being carved from
+    uint8_t* cur;               // Next free byte in it
+    uint8_t* end;
+    arena_chunk_t* first;
+    uint32_t chunk_order;       // Order of chunks added as it grows
+    uint32_t allocs;
+    uint32_t resets;
+    uint32_t chunks;
+    uint32_t bytes;             // Chunk memory held
+    uint32_t failed;
+    const char* name;
+    struct arena* next;         // All arenas, for arena_print_stats
+} __cacheline_aligned arena_t;
+
+typedef struct {
+    arena_chunk_t* chunk;
+    uint8_t* cur;
+} arena_mark_t;
+
+// Scope of a per-CPU scratch arena: see arena_scratch_begin
+typedef struct {
+    arena_t* arena;
+    arena_mark_t mark;
+    uint32_t flags;
+} arena_scratch_t;
+
+// NULL when no chunk of that size is free (4 MB at most)
+arena_t* arena_create(const char* name, uint32_t chunk_size);
+void arena_destroy(arena_t* arena);
+
+// Slow path: the current chunk is full
+void* arena_alloc_slow(arena_t* arena, size_t size, size_t align);
+
+// 'align' is a power of two; CACHE_LINE_SIZE keeps objects from sharing lines
+static inline void* arena_alloc_aligned(arena_t* arena, size_t size, size_t align) {
+    uint8_t* ptr = (uint8_t*)(((uintptr_t)arena->cur + align - 1) & ~(uintptr_t)(align - 1));
+    if (ptr > arena->end || size > (size_t)(arena->end - ptr)) {
+        return arena_alloc_slow(arena, size, align);
+    }
+    arena->cur = ptr + size;
+    arena->allocs++;
+    return ptr;
+}
+
+static inline void* arena_alloc(arena_t* arena, size_t size) {
+    return arena_alloc_aligned(arena, size, ARENA_ALIGN);
+}
+
+// Free everything, keeping the chunks for the next batch
+static inline void arena_reset(arena_t* arena) {
+    arena->current = arena->first;
+    arena->cur = arena->first->data;
+    arena->end = arena->first->end;
+    arena->resets++;
+}
+
+static inline arena_mark_t arena_save(arena_t* arena) {
+    arena_mark_t mark = { arena->current, arena->cur };
+    return mark;
+}
+
+// Free everything allocated since the mark
+static inline void arena_restore(arena_t* arena, arena_mark_t mark) {
+    arena->current = mark.chunk;
+    arena->cur = mark.cur;
+    arena->end = mark.chunk->end;
+}
+
+// This CPU's scratch arena, for short work that does not block (building
+// or checksumming one packet). Interrupts stay off until arena_scratch_end,
+// which frees everything allocated in between; scopes nest. NULL if the
+// arena cannot be created, with interrupts left as they were.
+arena_t* arena_scratch_begin(arena_scratch_t* scope);
+void arena_scratch_end(arena_scratch_t* scope);
+
+// One line per arena, from print_heap_stats
+void arena_print_stats(void);
+
+#endif // ARENA_H
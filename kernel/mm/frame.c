@@ -0,0 +1,332 @@
+#include "frame.h"
+#include "memory.h"
+#include "../arch/spinlock.h"
+#include "../proc/process.h"
+#include "../drivers/vga.h"
+
+#define FRAME_SHIFT         12
+#define FRAME_NOT_FREE      0xFF        // block_order[]: not the head of a free block
+
+typedef struct frame_block {
+    struct frame_block* next;
+    struct frame_block* prev;
+} frame_block_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t frames[FRAME_PCP_HIGH];
+} __cacheline_aligned frame_pcp_t;
+
+static spinlock_t frame_lock = SPINLOCK_INIT;   // Buddy lists, bitmap, block_order
+static frame_block_t* free_area[FRAME_ORDERS];
+static uint32_t* frame_bitmap = NULL;
+static uint8_t* block_order = NULL;
+static uint16_t* frame_refcount = NULL;         // Extra references: 0 = one owner
+static uint32_t base_pfn = 0;
+static uint32_t end_pfn = 0;
+static frame_pcp_t frame_pcp[MAX_CPUS];
+static frame_stats_t frame_stats;
+
+static inline frame_block_t* pfn_block(uint32_t pfn) {
+    return (frame_block_t*)(pfn << FRAME_SHIFT);
+}
+
+static inline bool frame_in_use(uint32_t pfn) {
+    uint32_t i = pfn - base_pfn;
+    return frame_bitmap[i / 32] & (1u << (i % 32));
+}
+
+// Mark 'count' frames from pfn in use or free, a word at a time where possible
+static void bitmap_set(uint32_t pfn, uint32_t count, bool used) {
+    uint32_t i = pfn - base_pfn;
+    while (count) {
+        if ((i % 32) == 0 && count >= 32) {
+            frame_bitmap[i / 32] = used ? 0xFFFFFFFF : 0;
+            i += 32;
+            count -= 32;
+            continue;
+        }
+        if (used) {
+            frame_bitmap[i / 32] |= 1u << (i % 32);
+        } else {
+            frame_bitmap[i / 32] &= ~(1u << (i % 32));
+        }
+        i++;
+        count--;
+    }
+}
+
+static void area_insert(uint32_t pfn, uint32_t order) {
+    frame_block_t* block = pfn_block(pfn);
+    block->prev = NULL;
+    block->next = free_area[order];
+    if (free_area[order]) free_area[order]->prev = block;
+    free_area[order] = block;
+    block_order[pfn - base_pfn] = (uint8_t)order;
+    frame_stats.free_blocks[order]++;
+}
+
+static void area_remove(uint32_t pfn, uint32_t order) {
+    frame_block_t* block = pfn_block(pfn);
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        free_area[order] = block->next;
+    }
+    if (block->next) block->next->prev = block->prev;
+    block_order[pfn - base_pfn] = FRAME_NOT_FREE;
+    frame_stats.free_blocks[order]--;
+}
+
+void frame_init(uint32_t start, uint32_t end) {
+    uint32_t first = (start + PAGE_SIZE - 1) >> FRAME_SHIFT;
+    uint32_t last = end >> FRAME_SHIFT;
+    if (last <= first) return;
+
+    base_pfn = first;
+    end_pfn = last;
+    uint32_t frames = last - first;
+
+    // Bitmap, reference counts and order bytes take the first frames of the region
+    uint32_t bitmap_bytes = ((frames + 31) / 32) * sizeof(uint32_t);
+    uint32_t ref_bytes = frames * sizeof(uint16_t);
+    uint32_t meta_frames = (bitmap_bytes + ref_bytes + frames + PAGE_SIZE - 1) >> FRAME_SHIFT;
+    frame_bitmap = (uint32_t*)(first << FRAME_SHIFT);
+    frame_refcount = (uint16_t*)((uint8_t*)frame_bitmap + bitmap_bytes);
+    block_order = (uint8_t*)frame_refcount + ref_bytes;
+    memset(frame_bitmap, 0, bitmap_bytes);
+    memset(frame_refcount, 0, ref_bytes);
+    memset(block_order, FRAME_NOT_FREE, frames);
+    bitmap_set(first, meta_frames, true);
+
+    // Hand the rest out as the largest aligned blocks that fit
+    uint32_t pfn = first + meta_frames;
+    while (pfn < last) {
+        uint32_t order = FRAME_MAX_ORDER;
+        while ((pfn & ((1u << order) - 1)) || pfn + (1u << order) > last) {
+            order--;
+        }
+        area_insert(pfn, order);
+        pfn += 1u << order;
+    }
+
+    frame_stats.total_frames = frames;
+    frame_stats.free_frames = frames - meta_frames;
+}
+
+// frame_lock held
+static uint32_t buddy_alloc(uint32_t order) {
+    uint32_t k = order;
+    while (k <= FRAME_MAX_ORDER && !free_area[k]) {
+        k++;
+    }
+    if (k > FRAME_MAX_ORDER) return 0;
+
+    uint32_t pfn = (uint32_t)free_area[k] >> FRAME_SHIFT;
+    area_remove(pfn, k);
+
+    // Split down, returning the upper halves
+    while (k > order) {
+        k--;
+        area_insert(pfn + (1u << k), k);
+        frame_stats.splits++;
+    }
+
+    bitmap_set(pfn, 1u << order, true);
+    frame_stats.free_frames -= 1u << order;
+    return pfn << FRAME_SHIFT;
+}
+
+// frame_lock held
+static void buddy_free(uint32_t pfn, uint32_t order) {
+    bitmap_set(pfn, 1u << order, false);
+    frame_stats.free_frames += 1u << order;
+
+    while (order < FRAME_MAX_ORDER) {
+        uint32_t buddy = pfn ^ (1u << order);
+        if (buddy < base_pfn || buddy + (1u << order) > end_pfn ||
+            block_order[buddy - base_pfn] != order) {
+            break;
+        }
+        area_remove(buddy, order);
+        pfn &= ~(1u << order);
+        order++;
+        frame_stats.merges++;
+    }
+    area_insert(pfn, order);
+}
+
+uint32_t frame_alloc_pages(uint32_t order) {
+    if (order == 0) return frame_alloc();
+    if (order > FRAME_MAX_ORDER || !frame_bitmap) return 0;
+
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+    uint32_t addr = buddy_alloc(order);
+    spin_unlock_irqrestore(&frame_lock, flags);
+    __sync_fetch_and_add(addr ? &frame_stats.allocs : &frame_stats.failed, 1);
+    return addr;
+}
+
+// Reject frames outside the region, misaligned blocks and double frees
+static bool frame_check(uint32_t pfn, uint32_t order) {
+    if (pfn < base_pfn || pfn + (1u << order) > end_pfn ||
+        (pfn & ((1u << order) - 1)) || !frame_in_use(pfn)) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("frame_free: bad or free frame\n");
+        return false;
+    }
+    return true;
+}
+
+void frame_free_pages(uint32_t addr, uint32_t order) {
+    if (order == 0) {
+        frame_free(addr);
+        return;
+    }
+    uint32_t pfn = addr >> FRAME_SHIFT;
+    if (order > FRAME_MAX_ORDER || !frame_bitmap) return;
+
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+    bool valid = frame_check(pfn, order);
+    if (valid) buddy_free(pfn, order);
+    spin_unlock_irqrestore(&frame_lock, flags);
+    if (valid) __sync_fetch_and_add(&frame_stats.frees, 1);
+}
+
+uint32_t frame_alloc(void) {
+    if (!frame_bitmap) return 0;
+
+    uint32_t flags = irq_save();
+    frame_pcp_t* pcp = &frame_pcp[this_cpu()->id];
+    if (pcp->count == 0) {
+        spin_lock(&frame_lock);
+        while (pcp->count < FRAME_PCP_BATCH) {
+            uint32_t addr = buddy_alloc(0);
+            if (!addr) break;
+            pcp->frames[pcp->count++] = addr;
+        }
+        spin_unlock(&frame_lock);
+    } else {
+        __sync_fetch_and_add(&frame_stats.pcp_hits, 1);
+    }
+
+    uint32_t addr = 0;
+    if (pcp->count) {
+        addr = pcp->frames[--pcp->count];
+        __sync_fetch_and_add(&frame_stats.allocs, 1);
+    } else {
+        __sync_fetch_and_add(&frame_stats.failed, 1);
+    }
+    irq_restore(flags);
+    return addr;
+}
+
+void frame_free(uint32_t addr) {
+    uint32_t pfn = addr >> FRAME_SHIFT;
+    if (!frame_bitmap || pfn < base_pfn || pfn >= end_pfn || (addr & (PAGE_SIZE - 1)) ||
+        !frame_in_use(pfn)) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("frame_free: bad or free frame\n");
+        return;
+    }
+
+    uint32_t flags = irq_save();
+    frame_pcp_t* pcp = &frame_pcp[this_cpu()->id];
+    if (pcp->count == FRAME_PCP_HIGH) {
+        // Trim a batch back into the buddy lists so it can merge again
+        spin_lock(&frame_lock);
+        for (uint32_t i = 0; i < FRAME_PCP_BATCH; i++) {
+            buddy_free(pcp->frames[--pcp->count] >> FRAME_SHIFT, 0);
+        }
+        spin_unlock(&frame_lock);
+    }
+    pcp->frames[pcp->count++] = addr;
+    __sync_fetch_and_add(&frame_stats.frees, 1);
+    irq_restore(flags);
+}
+
+// Only the first frame of a block carries its count. Callers hold a
+// reference themselves, so the frame cannot be freed underneath them.
+static bool frame_ref_valid(uint32_t pfn) {
+    return frame_bitmap && pfn >= base_pfn && pfn < end_pfn && frame_in_use(pfn);
+}
+
+void frame_ref(uint32_t addr) {
+    uint32_t pfn = addr >> FRAME_SHIFT;
+    if (!frame_ref_valid(pfn)) return;
+    __sync_fetch_and_add(&frame_refcount[pfn - base_pfn], 1);
+}
+
+bool frame_unref(uint32_t addr) {
+    uint32_t pfn = addr >> FRAME_SHIFT;
+    if (!frame_ref_valid(pfn)) return true;
+
+    // Drop an extra reference if there is one; otherwise the caller was the owner
+    uint16_t* count = &frame_refcount[pfn - base_pfn];
+    uint16_t old = *count;
+    while (old && !__sync_bool_compare_and_swap(count, old, old - 1)) {
+        old = *count;
+    }
+    return old == 0;
+}
+
+uint32_t frame_refs(uint32_t addr) {
+    uint32_t pfn = addr >> FRAME_SHIFT;
+    if (!frame_ref_valid(pfn)) return 0;
+    return frame_refcount[pfn - base_pfn] + 1u;
+}
+
+// Frames parked on the per-CPU stacks still count as free
+static uint32_t pcp_cached(void) {
+    uint32_t cached = 0;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        cached += frame_pcp[i].count;
+    }
+    return cached;
+}
+
+void frame_get_stats(frame_stats_t* stats) {
+    if (!stats) return;
+    *stats = frame_stats;
+    stats->free_frames += pcp_cached();
+}
+
+void frame_print_info(void) {
+    frame_stats_t stats;
+    frame_get_stats(&stats);
+    uint32_t cached = pcp_cached();
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Physical Frames ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("Region: ");
+    print_hex(base_pfn << FRAME_SHIFT);
+    vga_write_string(" - ");
+    print_hex(end_pfn << FRAME_SHIFT);
+    vga_write_string("  Frames: ");
+    print_dec(stats.total_frames);
+    vga_write_string("  Free: ");
+    print_dec(stats.free_frames);
+    vga_write_string(" (");
+    print_dec(cached);
+    vga_write_string(" per-CPU)\n");
+
+    vga_write_string("Allocs: ");
+    print_dec(stats.allocs);
+    vga_write_string("  Frees: ");
+    print_dec(stats.frees);
+    vga_write_string("  Per-CPU hits: ");
+    print_dec(stats.pcp_hits);
+    vga_write_string("  Splits: ");
+    print_dec(stats.splits);
+    vga_write_string("  Merges: ");
+    print_dec(stats.merges);
+    vga_write_string("  Failed: ");
+    print_dec(stats.failed);
+    vga_write_string("\nFree blocks by order:");
+    for (uint32_t order = 0; order < FRAME_ORDERS; order++) {
+        vga_write_string(" ");
+        print_dec(stats.free_blocks[order]);
+    }
+    vga_write_string("\n");
+}
@@ -0,0 +1,67 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "../types.h"
+
+// Physical frame allocator: a binary buddy system over the memory above
+// the kernel heap. A boot-time bitmap (one bit per frame, set = in use),
+// a 16-bit reference count per frame and a byte per frame naming the order
+// of the free block starting there live in the first frames of the region.
+// Blocks of 2^order frames are naturally aligned, found in O(log n) by
+// walking up the free lists and merged with their buddy on free, so
+// multi-frame allocations are physically contiguous (DMA buffers). Single frames come from a per-CPU
+// stack refilled and trimmed in batches, without the buddy lock.
+//
+// Paging is off, so free-list links are written straight into the frames.
+#define FRAME_MAX_ORDER         10          // Largest block: 1024 frames, 4 MB
+#define FRAME_ORDERS            (FRAME_MAX_ORDER + 1)
+#define FRAME_PCP_HIGH          32          // Per-CPU frames kept at most
+#define FRAME_PCP_BATCH         8           // Frames moved per refill or trim
+#define FRAME_MEMORY_END        0x1000000   // Assume 16MB until memory is detected
+
+typedef struct {
+    uint32_t total_frames;      // Managed, metadata included
+    uint32_t free_frames;       // In the buddy lists or on a per-CPU stack
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t pcp_hits;          // Single frames served from a per-CPU stack
+    uint32_t splits;
+    uint32_t merges;
+    uint32_t failed;
+    uint32_t free_blocks[FRAME_ORDERS];
+} frame_stats_t;
+
+// Manage [start, end); both are rounded inwards to whole frames
+void frame_init(uint32_t start, uint32_t end);
+
+// 2^order contiguous frames aligned to their size; returns the physical
+// address or 0 when nothing that large is free
+uint32_t frame_alloc_pages(uint32_t order);
+void frame_free_pages(uint32_t addr, uint32_t order);
+
+// One frame, normally without touching the buddy lists
+uint32_t frame_alloc(void);
+void frame_free(uint32_t addr);
+
+// Reference counts for frames mapped by more than one address space
+// (copy-on-write after fork). An allocated frame starts with one reference,
+// its owner; frame_ref adds one and frame_unref drops one, returning true
+// when the caller held the last, who then frees the frame with the order
+// it was allocated with. Counts live on the first frame of a block.
+void frame_ref(uint32_t addr);
+bool frame_unref(uint32_t addr);
+uint32_t frame_refs(uint32_t addr);        // 0 if not an allocated frame
+
+// Smallest order holding 'bytes' (above FRAME_MAX_ORDER if none does)
+static inline uint32_t frame_order(uint32_t bytes) {
+    uint32_t order = 0;
+    while (order <= FRAME_MAX_ORDER && (4096u << order) < bytes) {
+        order++;
+    }
+    return order;
+}
+
+void frame_get_stats(frame_stats_t* stats);
+void frame_print_info(void);
+
+#endif // FRAME_H
@@ -0,0 +1,206 @@
+#include "magazine.h"
+#include "memory.h"
+#include "../proc/process.h"
+#include "../drivers/vga.h"
+
+static spinlock_t caches_lock = SPINLOCK_INIT;
+static mag_cache_t* caches = NULL;
+
+mag_cache_t* mag_cache_create(const char* name, uint32_t object_size,
+                              mag_alloc_fn backend_alloc, mag_free_fn backend_free,
+                              void* backend) {
+    mag_cache_t* cache = kmalloc_aligned(sizeof(mag_cache_t), CACHE_LINE_SIZE);
+    if (!cache) return NULL;
+
+    memset(cache, 0, sizeof(mag_cache_t));
+    spin_lock_init(&cache->depot_lock);
+    cache->backend_alloc = backend_alloc;
+    cache->backend_free = backend_free;
+    cache->backend = backend;
+    cache->name = name;
+    cache->object_size = object_size;
+
+    uint32_t flags = spin_lock_irqsave(&caches_lock);
+    cache->next = caches;
+    caches = cache;
+    spin_unlock_irqrestore(&caches_lock, flags);
+    return cache;
+}
+
+// Give a magazine's objects back to the pool and free it
+static void mag_release(mag_cache_t* cache, magazine_t* mag) {
+    if (!mag) return;
+    while (mag->rounds) {
+        cache->backend_free(cache->backend, mag->round[--mag->rounds]);
+    }
+    kfree(mag);
+}
+
+void mag_cache_destroy(mag_cache_t* cache) {
+    if (!cache) return;
+
+    uint32_t flags = spin_lock_irqsave(&caches_lock);
+    for (mag_cache_t** link = &caches; *link; link = &(*link)->next) {
+        if (*link == cache) {
+            *link = cache->next;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&caches_lock, flags);
+
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        mag_release(cache, cache->cpu[i].loaded);
+        mag_release(cache, cache->cpu[i].previous);
+    }
+    while (cache->full) {
+        magazine_t* mag = cache->full;
+        cache->full = mag->next;
+        mag_release(cache, mag);
+    }
+    while (cache->empty) {
+        magazine_t* mag = cache->empty;
+        cache->empty = mag->next;
+        kfree(mag);
+    }
+    kfree_aligned(cache);
+}
+
+void* mag_alloc(mag_cache_t* cache) {
+    uint32_t flags = irq_save();
+    mag_cpu_t* cpu = &cache->cpu[this_cpu()->id];
+    void* object;
+
+    // Fast path: this CPU's magazines, no lock
+    if (!cpu->loaded || cpu->loaded->rounds == 0) {
+        if (cpu->previous && cpu->previous->rounds) {
+            magazine_t* mag = cpu->loaded;
+            cpu->loaded = cpu->previous;
+            cpu->previous = mag;
+        }
+    }
+    if (cpu->loaded && cpu->loaded->rounds) {
+        object = cpu->loaded->round[--cpu->loaded->rounds];
+        cpu->allocs++;
+        irq_restore(flags);
+        return object;
+    }
+
+    // Both empty: trade the older one for a full magazine, or go to the pool
+    spin_lock(&cache->depot_lock);
+    magazine_t* full = cache->full;
+    if (full) {
+        cache->full = full->next;
+        cache->full_count--;
+        cache->depot_allocs++;
+        if (cpu->previous) {
+            cpu->previous->next = cache->empty;
+            cache->empty = cpu->previous;
+            cache->empty_count++;
+        }
+        cpu->previous = cpu->loaded;
+        cpu->loaded = full;
+        object = full->round[--full->rounds];
+    } else {
+        object = cache->backend_alloc(cache->backend);
+        if (object) cache->backend_allocs++;
+    }
+    spin_unlock(&cache->depot_lock);
+
+    irq_restore(flags);
+    return object;
+}
+
+void mag_free(mag_cache_t* cache, void* object) {
+    uint32_t flags = irq_save();
+    mag_cpu_t* cpu = &cache->cpu[this_cpu()->id];
+
+    // Fast path: room in this CPU's magazines, no lock
+    if (!cpu->loaded || cpu->loaded->rounds == MAG_ROUNDS) {
+        if (cpu->previous && cpu->previous->rounds == 0) {
+            magazine_t* mag = cpu->loaded;
+            cpu->loaded = cpu->previous;
+            cpu->previous = mag;
+        }
+    }
+    if (cpu->loaded && cpu->loaded->rounds < MAG_ROUNDS) {
+        cpu->loaded->round[cpu->loaded->rounds++] = object;
+        cpu->frees++;
+        irq_restore(flags);
+        return;
+    }
+
+    // Both full: hand the older one to the depot for an empty magazine
+    spin_lock(&cache->depot_lock);
+    magazine_t* empty = cache->empty;
+    if (empty) {
+        cache->empty = empty->next;
+        cache->empty_count--;
+    } else {
+        empty = kmalloc(sizeof(magazine_t));
+        if (empty) {
+            empty->rounds = 0;
+            cache->magazines++;
+        }
+    }
+
+    if (!empty) {
+        cache->backend_free(cache->backend, object);
+        cache->backend_frees++;
+    } else {
+        if (cpu->previous) {
+            cpu->previous->next = cache->full;
+            cache->full = cpu->previous;
+            cache->full_count++;
+            cache->depot_frees++;
+        }
+        cpu->previous = cpu->loaded;
+        cpu->loaded = empty;
+        empty->round[empty->rounds++] = object;
+    }
+    spin_unlock(&cache->depot_lock);
+
+    irq_restore(flags);
+}
+
+void mag_print_stats(void) {
+    uint32_t flags = spin_lock_irqsave(&caches_lock);
+    if (!caches) {
+        spin_unlock_irqrestore(&caches_lock, flags);
+        return;
+    }
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Magazine Caches ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    for (mag_cache_t* cache = caches; cache; cache = cache->next) {
+        uint32_t allocs = 0, frees = 0;
+        for (uint32_t i = 0; i < MAX_CPUS; i++) {
+            allocs += cache->cpu[i].allocs;
+            frees += cache->cpu[i].frees;
+        }
+
+        vga_write_string(cache->name);
+        vga_write_string(" (");
+        print_dec(cache->object_size);
+        vga_write_string(" B): CPU allocs ");
+        print_dec(allocs);
+        vga_write_string(" frees ");
+        print_dec(frees);
+        vga_write_string("  Depot out ");
+        print_dec(cache->depot_allocs);
+        vga_write_string(" in ");
+        print_dec(cache->depot_frees);
+        vga_write_string("  Pool allocs ");
+        print_dec(cache->backend_allocs);
+        vga_write_string(" frees ");
+        print_dec(cache->backend_frees);
+        vga_write_string("\n  Magazines ");
+        print_dec(cache->magazines);
+        vga_write_string(" (full ");
+        print_dec(cache->full_count);
+        vga_write_string(", empty ");
+        print_dec(cache->empty_count);
+        vga_write_string(")\n");
+    }
+    spin_unlock_irqrestore(&caches_lock, flags);
+}
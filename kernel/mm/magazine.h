@@ -0,0 +1,70 @@
+#ifndef MAGAZINE_H
+#define MAGAZINE_H
+
+#include "../types.h"
+#include "../arch/smp.h"
+#include "../arch/spinlock.h"
+
+// Per-CPU magazine layer in front of an object pool (Bonwick's slab
+// magazines). Each CPU keeps a loaded and a previous magazine, small stacks
+// of free objects, and allocates and frees against them with interrupts
+// off and no lock. Only when both are empty (alloc) or both full (free)
+// does it take the depot lock and swap a whole magazine for a full or an
+// empty one, so the pool behind is touched once per MAG_ROUNDS objects at
+// most; it is only ever called with the depot lock held.
+//
+// Up to 2 * MAG_ROUNDS objects per CPU can sit in that CPU's magazines
+// while another CPU finds the pool empty.
+#define MAG_ROUNDS              14          // magazine_t fills one cache line
+
+typedef struct magazine {
+    struct magazine* next;      // Depot list link
+    uint32_t rounds;            // Objects held
+    void* round[MAG_ROUNDS];
+} magazine_t;
+
+typedef struct {
+    magazine_t* loaded;
+    magazine_t* previous;       // Full or empty, never partly used
+    uint32_t allocs;            // Served without the depot
+    uint32_t frees;
+} __cacheline_aligned mag_cpu_t;
+
+typedef void* (*mag_alloc_fn)(void* backend);
+typedef void (*mag_free_fn)(void* backend, void* object);
+
+typedef struct mag_cache {
+    mag_cpu_t cpu[MAX_CPUS];
+    spinlock_t depot_lock;      // Depot lists, counters below and the backend
+    magazine_t* full;
+    magazine_t* empty;
+    uint32_t full_count;
+    uint32_t empty_count;
+    uint32_t depot_allocs;      // Full magazines handed to a CPU
+    uint32_t depot_frees;       // Full magazines taken back
+    uint32_t backend_allocs;    // Objects that came straight from the pool
+    uint32_t backend_frees;
+    uint32_t magazines;         // Magazines allocated
+    mag_alloc_fn backend_alloc;
+    mag_free_fn backend_free;
+    void* backend;
+    const char* name;
+    uint32_t object_size;
+    struct mag_cache* next;     // All caches, for mag_print_stats
+} mag_cache_t;
+
+// NULL if out of memory; the caller then uses its pool directly
+mag_cache_t* mag_cache_create(const char* name, uint32_t object_size,
+                              mag_alloc_fn backend_alloc, mag_free_fn backend_free,
+                              void* backend);
+
+// Returns every cached object to the pool; nobody may use the cache meanwhile
+void mag_cache_destroy(mag_cache_t* cache);
+
+void* mag_alloc(mag_cache_t* cache);
+void mag_free(mag_cache_t* cache, void* object);
+
+// One line per cache, from print_heap_stats
+void mag_print_stats(void);
+
+#endif // MAGAZINE_H
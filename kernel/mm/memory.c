@@ -1,204 +1,370 @@
 #include "memory.h"
 #include "../drivers/vga.h"
+#include "memprof.h"
+#include "magazine.h"
+#include "arena.h"
+#include "../arch/spinlock.h"
+#include "../arch/cpu.h"
+#include "../arch/fpu.h"
+#include "../arch/tsc.h"
+#include "../arch/div64.h"
+#include "frame.h"
+#include "../proc/klog.h"
 
-static mem_block_t* heap_start = NULL;
+// Large block layout: heap_tag_t, payload, then a footer word repeating
+// the size with HEAP_FOOTER_FREE set while free. Free blocks keep their
+// bin links at the start of the payload.
+#define HEAP_TAG_SIZE       sizeof(heap_tag_t)
+#define HEAP_FOOTER_SIZE    sizeof(uint32_t)
+#define HEAP_FOOTER_FREE    1
+#define HEAP_MIN_BLOCK      32
+
+typedef struct free_block {
+    heap_tag_t tag;
+    struct free_block* next;
+    struct free_block* prev;
+} free_block_t;
+
+// Small objects on a class free list: the link follows the tag
+typedef struct small_object {
+    heap_tag_t tag;
+    struct small_object* next;
+} small_object_t;
+
+extern char _kernel_end[];      // kernel.ld
+
+static const uint16_t class_sizes[HEAP_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+static uint8_t size_to_class[HEAP_SMALL_MAX / 16 + 1];     // Indexed by (size + 15) / 16
+static small_object_t* class_free[HEAP_CLASSES];
+
+static free_block_t* bins[HEAP_BINS];
+static uint32_t bin_bitmap = 0;     // Bit n set = bins[n] non-empty
+static uint8_t* heap_base = NULL;
+static uint8_t* heap_end = NULL;
+
+static spinlock_t heap_lock = SPINLOCK_INIT;   // Heap is shared by all CPUs
 static heap_stats_t heap_stats = {0};
+#ifdef MEMORY_DEBUG
 static allocation_info_t allocations[MAX_ALLOCATIONS];
 static uint32_t next_alloc_id = 1;
+#endif
+
+static inline uint32_t* block_footer(heap_tag_t* tag) {
+    return (uint32_t*)((uint8_t*)tag + tag->size - HEAP_FOOTER_SIZE);
+}
+
+static inline uint32_t bin_index(uint32_t size) {
+    uint32_t bin = 31 - __builtin_clz(size) - 5;
+    return bin < HEAP_BINS ? bin : HEAP_BINS - 1;
+}
+
+static void bin_insert(free_block_t* block, uint32_t size) {
+    block->tag.magic = MEMORY_FREE_MAGIC;
+    block->tag.size = size;
+    *block_footer(&block->tag) = size | HEAP_FOOTER_FREE;
+
+    uint32_t bin = bin_index(size);
+    block->prev = NULL;
+    block->next = bins[bin];
+    if (bins[bin]) bins[bin]->prev = block;
+    bins[bin] = block;
+    bin_bitmap |= 1u << bin;
+}
+
+static void bin_remove(free_block_t* block) {
+    uint32_t bin = bin_index(block->tag.size);
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        bins[bin] = block->next;
+    }
+    if (block->next) block->next->prev = block->prev;
+    if (!bins[bin]) bin_bitmap &= ~(1u << bin);
+}
 
 void memory_init(void) {
-    heap_start = (mem_block_t*)KERNEL_HEAP_START;
-    heap_start->magic = MEMORY_GUARD_MAGIC;
-    heap_start->size = KERNEL_HEAP_SIZE - sizeof(mem_block_t);
-    heap_start->free = 1;
-    heap_start->file = "system";
-    heap_start->line = 0;
-    heap_start->alloc_id = 0;
-    heap_start->next = NULL;
-    heap_start->prev = NULL;
+    // Start past the kernel image (its .bss included), on a page boundary
+    uintptr_t base = (uintptr_t)_kernel_end;
+    if (base < KERNEL_HEAP_START) base = KERNEL_HEAP_START;
+    base = (base + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+    heap_base = (uint8_t*)base;
+    heap_end = heap_base + KERNEL_HEAP_SIZE;
+
+    for (uint32_t i = 0; i <= HEAP_SMALL_MAX / 16; i++) {
+        uint32_t size = i * 16;
+        uint8_t class = 0;
+        while (class_sizes[class] < size) class++;
+        size_to_class[i] = class;
+    }
+
+    bin_insert((free_block_t*)heap_base, KERNEL_HEAP_SIZE);
     
     // Initialize heap statistics
     heap_stats.total_memory = KERNEL_HEAP_SIZE;
-    heap_stats.used_memory = sizeof(mem_block_t);
-    heap_stats.free_memory = KERNEL_HEAP_SIZE - sizeof(mem_block_t);
-    heap_stats.total_allocations = 0;
-    heap_stats.active_allocations = 0;
-    heap_stats.failed_allocations = 0;
-    heap_stats.free_operations = 0;
-    heap_stats.coalesce_operations = 0;
-    heap_stats.largest_free_block = heap_start->size;
-    heap_stats.fragmentation_ratio = 0;
+    heap_stats.used_memory = 0;
+    heap_stats.free_memory = KERNEL_HEAP_SIZE;
+    heap_stats.largest_free_block = KERNEL_HEAP_SIZE;
     
+#ifdef MEMORY_DEBUG
     // Clear allocation tracking
     memset(allocations, 0, sizeof(allocations));
+#endif
 }
 
-void* kmalloc(size_t size) {
-    return _kmalloc_debug(size, "unknown", 0);
+// Carve a block of at least 'size' bytes (tags included) from the bins
+// (heap_lock held)
+static heap_tag_t* large_alloc(uint32_t size) {
+    size = (size + HEAP_ALIGN - 1) & ~(uint32_t)(HEAP_ALIGN - 1);
+    if (size < HEAP_MIN_BLOCK) size = HEAP_MIN_BLOCK;
+
+    // Any block in a higher bin fits; only the bin of 'size' itself
+    // needs a first-fit look, and only once nothing bigger is left
+    uint32_t bin = bin_index(size);
+    free_block_t* block = bins[bin];
+    uint32_t higher = bin_bitmap & ~((2u << bin) - 1);
+    if (!block || block->tag.size < size) {
+        if (higher) {
+            block = bins[__builtin_ctz(higher)];
+        } else {
+            while (block && block->tag.size < size) block = block->next;
+        }
+    }
+    if (!block) return NULL;
+    bin_remove(block);
+
+    uint32_t remainder = block->tag.size - size;
+    if (remainder >= HEAP_MIN_BLOCK) {
+        bin_insert((free_block_t*)((uint8_t*)block + size), remainder);
+    } else {
+        size = block->tag.size;
+    }
+
+    heap_tag_t* tag = &block->tag;
+    tag->magic = MEMORY_GUARD_MAGIC;
+    tag->size = size;
+    *block_footer(tag) = size;
+    heap_stats.used_memory += size;
+    heap_stats.free_memory -= size;
+    return tag;
 }
 
-void* _kmalloc_debug(size_t size, const char* file, int line) {
-    if (size == 0) return NULL;
-    
-    // Align size to 8-byte boundary
-    size = (size + 7) & ~7;
-    
-    mem_block_t* current = heap_start;
-    mem_block_t* best_fit = NULL;
-    
-    // Best-fit allocation algorithm
-    while (current != NULL) {
-        // Check magic number for corruption detection
-        if (current->magic != MEMORY_GUARD_MAGIC) {
-            vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-            vga_write_string("Heap corruption detected in kmalloc!\n");
-            return NULL;
+// Return a block, merging with free neighbours found through the
+// footer before it and the tag after it (heap_lock held)
+static void large_free(heap_tag_t* tag) {
+    uint8_t* start = (uint8_t*)tag;
+    uint32_t size = tag->size;
+    heap_stats.used_memory -= size;
+    heap_stats.free_memory += size;
+
+    uint8_t* next = start + size;
+    if (next < heap_end && ((heap_tag_t*)next)->magic == MEMORY_FREE_MAGIC) {
+        free_block_t* neighbour = (free_block_t*)next;
+        bin_remove(neighbour);
+        size += neighbour->tag.size;
+        heap_stats.coalesce_operations++;
+    }
+    if (start > heap_base) {
+        uint32_t prev_footer = *(uint32_t*)(start - HEAP_FOOTER_SIZE);
+        if (prev_footer & HEAP_FOOTER_FREE) {
+            free_block_t* neighbour = (free_block_t*)(start - (prev_footer & ~HEAP_FOOTER_FREE));
+            bin_remove(neighbour);
+            size += neighbour->tag.size;
+            start = (uint8_t*)neighbour;
+            heap_stats.coalesce_operations++;
         }
-        
-        if (current->free && current->size >= size) {
-            if (best_fit == NULL || current->size < best_fit->size) {
-                best_fit = current;
-            }
+    }
+    tag->magic = MEMORY_FREE_MAGIC;
+    bin_insert((free_block_t*)start, size);
+}
+
+// Refill a class list with one slab chunk (heap_lock held). Chunks stay
+// with their class for good.
+static bool small_refill(uint32_t class) {
+    heap_tag_t* chunk = large_alloc(HEAP_SLAB_SIZE);
+    if (!chunk) return false;
+
+    uint32_t stride = HEAP_TAG_SIZE + class_sizes[class];
+    uint8_t* object = (uint8_t*)(chunk + 1);
+    uint8_t* limit = (uint8_t*)block_footer(chunk);
+    while (object + stride <= limit) {
+        small_object_t* free_object = (small_object_t*)object;
+        free_object->tag.magic = MEMORY_SMALL_FREE;
+        free_object->tag.size = class;
+        free_object->next = class_free[class];
+        class_free[class] = free_object;
+        object += stride;
+    }
+    return true;
+}
+
+// 'site' is the caller of the public allocation call, for the profiler
+static void* heap_alloc(size_t size, void* site) {
+    if (size == 0 || size > KERNEL_HEAP_SIZE) return NULL;
+
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    bool sampled = memprof_sample(size);
+    heap_tag_t* tag;
+    if (size <= HEAP_SMALL_MAX) {
+        uint32_t class = size_to_class[(size + 15) >> 4];
+        if (!class_free[class] && !small_refill(class)) {
+            tag = NULL;
+        } else {
+            small_object_t* object = class_free[class];
+            class_free[class] = object->next;
+            tag = &object->tag;
+            tag->magic = MEMORY_SMALL_MAGIC;
         }
-        current = current->next;
+    } else {
+        tag = large_alloc(size + HEAP_TAG_SIZE + HEAP_FOOTER_SIZE);
     }
-    
-    if (best_fit == NULL) {
+
+    if (!tag) {
         heap_stats.failed_allocations++;
+        spin_unlock_irqrestore(&heap_lock, flags);
         return NULL; // Out of memory
     }
-    
-    // Split block if it's much larger than needed
-    if (best_fit->size > size + sizeof(mem_block_t) + 16) {
-        mem_block_t* new_block = (mem_block_t*)((char*)best_fit + sizeof(mem_block_t) + size);
-        new_block->magic = MEMORY_GUARD_MAGIC;
-        new_block->size = best_fit->size - size - sizeof(mem_block_t);
-        new_block->free = 1;
-        new_block->file = "split";
-        new_block->line = 0;
-        new_block->alloc_id = 0;
-        new_block->next = best_fit->next;
-        new_block->prev = best_fit;
-        
-        if (best_fit->next) {
-            best_fit->next->prev = new_block;
-        }
-        
-        best_fit->size = size;
-        best_fit->next = new_block;
-    }
-    
-    best_fit->free = 0;
-    best_fit->file = file;
-    best_fit->line = line;
-    best_fit->alloc_id = next_alloc_id++;
-    
-    // Update statistics
-    heap_stats.used_memory += best_fit->size;
-    heap_stats.free_memory -= best_fit->size;
     heap_stats.total_allocations++;
     heap_stats.active_allocations++;
-    
-    // Track allocation
+    spin_unlock_irqrestore(&heap_lock, flags);
+
+    if (sampled) memprof_record(tag + 1, size, site);
+    return tag + 1;
+}
+
+// Bytes the caller may use at ptr
+static size_t heap_usable_size(heap_tag_t* tag) {
+    if (tag->magic == MEMORY_SMALL_MAGIC) {
+        return class_sizes[tag->size];
+    }
+    return tag->size - HEAP_TAG_SIZE - HEAP_FOOTER_SIZE;
+}
+
+static int heap_free(void* ptr) {
+    heap_tag_t* tag = (heap_tag_t*)ptr - 1;
+    if (memprof_live_count) memprof_free(ptr);
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+
+    if (tag->magic == MEMORY_SMALL_MAGIC && tag->size < HEAP_CLASSES) {
+        small_object_t* object = (small_object_t*)tag;
+        tag->magic = MEMORY_SMALL_FREE;
+        object->next = class_free[tag->size];
+        class_free[tag->size] = object;
+    } else if (tag->magic == MEMORY_GUARD_MAGIC) {
+        large_free(tag);
+    } else {
+        spin_unlock_irqrestore(&heap_lock, flags);
+        klog(KLOG_ERR, (tag->magic == MEMORY_FREE_MAGIC || tag->magic == MEMORY_SMALL_FREE) ?
+             "Double free of %x detected!\n" : "Double free or corruption of %x detected in kfree!\n",
+             (uint32_t)ptr);
+        return -1;
+    }
+
+    heap_stats.free_operations++;
+    heap_stats.active_allocations--;
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return 0;
+}
+
+#ifdef MEMORY_DEBUG
+static void track_allocation(void* ptr, const char* file, int line) {
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
     for (int i = 0; i < MAX_ALLOCATIONS; i++) {
         if (allocations[i].ptr == NULL) {
-            allocations[i].ptr = (char*)best_fit + sizeof(mem_block_t);
-            allocations[i].size = best_fit->size;
+            allocations[i].ptr = ptr;
+            allocations[i].size = heap_usable_size((heap_tag_t*)ptr - 1);
             allocations[i].file = file;
             allocations[i].line = line;
-            allocations[i].alloc_id = best_fit->alloc_id;
+            allocations[i].alloc_id = next_alloc_id++;
             allocations[i].timestamp = heap_stats.total_allocations;
             break;
         }
     }
-    
-    return (char*)best_fit + sizeof(mem_block_t);
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
-void kfree(void* ptr) {
-    _kfree_debug(ptr, "unknown", 0);
-}
-
-void _kfree_debug(void* ptr, const char* file, int line) {
-    (void)file; (void)line; // Suppress unused parameter warnings
-    if (ptr == NULL) return;
-    
-    mem_block_t* block = (mem_block_t*)((char*)ptr - sizeof(mem_block_t));
-    
-    // Check magic number for corruption detection
-    if (block->magic != MEMORY_GUARD_MAGIC) {
-        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-        vga_write_string("Double free or corruption detected in kfree!\n");
-        return;
-    }
-    
-    if (block->free) {
-        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-        vga_write_string("Double free detected!\n");
-        return;
-    }
-    
-    block->free = 1;
-    block->magic = MEMORY_FREE_MAGIC;  // Mark as freed
-    
-    // Update statistics
-    heap_stats.used_memory -= block->size;
-    heap_stats.free_memory += block->size;
-    heap_stats.free_operations++;
-    heap_stats.active_allocations--;
-    
-    // Remove from allocation tracking
+static void untrack_allocation(void* ptr) {
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
     for (int i = 0; i < MAX_ALLOCATIONS; i++) {
         if (allocations[i].ptr == ptr) {
             allocations[i].ptr = NULL;
             break;
         }
     }
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+#endif
+
+#ifndef MEMORY_DEBUG
+void* kmalloc(size_t size) {
+    return heap_alloc(size, __builtin_return_address(0));
+}
+
+void kfree(void* ptr) {
+    if (ptr == NULL) return;
+    heap_free(ptr);
+}
+#endif
+
+// File and line are only recorded in MEMORY_DEBUG builds
+static void* kmalloc_at(size_t size, const char* file, int line, void* site) {
+    void* ptr = heap_alloc(size, site);
+#ifdef MEMORY_DEBUG
+    if (ptr) track_allocation(ptr, file, line);
+#else
+    (void)file; (void)line;
+#endif
+    return ptr;
+}
+
+void* _kmalloc_debug(size_t size, const char* file, int line) {
+    return kmalloc_at(size, file, line, __builtin_return_address(0));
+}
+
+void _kfree_debug(void* ptr, const char* file, int line) {
+    (void)file; (void)line; // Suppress unused parameter warnings
+    if (ptr == NULL) return;
     
-    // Coalesce with next block if it's free
-    if (block->next && block->next->free) {
-        block->size += block->next->size + sizeof(mem_block_t);
-        if (block->next->next) {
-            block->next->next->prev = block;
-        }
-        block->next = block->next->next;
-        heap_stats.coalesce_operations++;
-    }
-    
-    // Coalesce with previous block if it's free
-    if (block->prev && block->prev->free) {
-        block->prev->size += block->size + sizeof(mem_block_t);
-        block->prev->next = block->next;
-        if (block->next) {
-            block->next->prev = block->prev;
-        }
-        heap_stats.coalesce_operations++;
-    }
-    
-    // Clear the memory content for security
-    memset(ptr, 0xDD, block->size);
+#ifdef MEMORY_DEBUG
+    // Poison freed memory so stale users show up
+    size_t size = heap_usable_size((heap_tag_t*)ptr - 1);
+    if (heap_free(ptr) == 0) {
+        untrack_allocation(ptr);
+        uint8_t* body = (uint8_t*)ptr;
+        uint32_t skip = sizeof(void*);     // Free list link
+        if (size > skip) memset(body + skip, 0xDD, size - skip);
+    }
+#else
+    heap_free(ptr);
+#endif
 }
 
 // Enhanced calloc implementation
-void* _kcalloc_debug(size_t count, size_t size, const char* file, int line) {
+static void* kcalloc_at(size_t count, size_t size, const char* file, int line, void* site) {
+    if (count == 0) return NULL;
     size_t total_size = count * size;
     if (total_size / count != size) return NULL; // Overflow check
     
-    void* ptr = _kmalloc_debug(total_size, file, line);
+    void* ptr = kmalloc_at(total_size, file, line, site);
     if (ptr) {
         memset(ptr, 0, total_size);
     }
     return ptr;
 }
 
+void* _kcalloc_debug(size_t count, size_t size, const char* file, int line) {
+    return kcalloc_at(count, size, file, line, __builtin_return_address(0));
+}
+
 void* _kcalloc(size_t count, size_t size) {
-    return _kcalloc_debug(count, size, "unknown", 0);
+    return kcalloc_at(count, size, "unknown", 0, __builtin_return_address(0));
 }
 
 // Enhanced realloc implementation
-void* _krealloc_debug(void* ptr, size_t size, const char* file, int line) {
+static void* krealloc_at(void* ptr, size_t size, const char* file, int line, void* site) {
     if (ptr == NULL) {
-        return _kmalloc_debug(size, file, line);
+        return kmalloc_at(size, file, line, site);
     }
     
     if (size == 0) {
@@ -206,27 +372,61 @@ void* _krealloc_debug(void* ptr, size_t size, const char* file, int line) {
         return NULL;
     }
     
-    mem_block_t* block = (mem_block_t*)((char*)ptr - sizeof(mem_block_t));
-    if (block->magic != MEMORY_GUARD_MAGIC) {
+    heap_tag_t* tag = (heap_tag_t*)ptr - 1;
+    if (tag->magic != MEMORY_GUARD_MAGIC && tag->magic != MEMORY_SMALL_MAGIC) {
         return NULL; // Corrupted block
     }
     
-    if (block->size >= size) {
+    size_t old_size = heap_usable_size(tag);
+    if (old_size >= size) {
         return ptr; // Current block is large enough
     }
     
     // Allocate new block and copy data
-    void* new_ptr = _kmalloc_debug(size, file, line);
+    void* new_ptr = kmalloc_at(size, file, line, site);
     if (new_ptr) {
-        memcpy(new_ptr, ptr, block->size < size ? block->size : size);
+        memcpy(new_ptr, ptr, old_size);
         _kfree_debug(ptr, file, line);
     }
     
     return new_ptr;
 }
 
+void* _krealloc_debug(void* ptr, size_t size, const char* file, int line) {
+    return krealloc_at(ptr, size, file, line, __builtin_return_address(0));
+}
+
 void* _krealloc(void* ptr, size_t size) {
-    return _krealloc_debug(ptr, size, "unknown", 0);
+    return krealloc_at(ptr, size, "unknown", 0, __builtin_return_address(0));
+}
+
+void* kmalloc_aligned(size_t size, size_t align) {
+    if (align < sizeof(void*) || (align & (align - 1))) return NULL;
+    uint8_t* raw = kmalloc_at(size + align + sizeof(void*), "unknown", 0,
+                              __builtin_return_address(0));
+    if (!raw) return NULL;
+
+    uintptr_t aligned = ((uintptr_t)raw + sizeof(void*) + align - 1) & ~(uintptr_t)(align - 1);
+    ((void**)aligned)[-1] = raw;
+    return (void*)aligned;
+}
+
+void* kmalloc_coloured(size_t size) {
+    static uint32_t next_colour = 0;
+    uint32_t colour = __sync_fetch_and_add(&next_colour, 1) % HEAP_COLOURS;
+    uint8_t* raw = kmalloc_at(size + (HEAP_COLOURS + 1) * CACHE_LINE_SIZE, "unknown", 0,
+                              __builtin_return_address(0));
+    if (!raw) return NULL;
+
+    uintptr_t aligned = (((uintptr_t)raw + sizeof(void*) + CACHE_LINE_SIZE - 1) &
+                         ~(uintptr_t)(CACHE_LINE_SIZE - 1)) + colour * CACHE_LINE_SIZE;
+    ((void**)aligned)[-1] = raw;
+    return (void*)aligned;
+}
+
+void kfree_aligned(void* ptr) {
+    if (ptr == NULL) return;
+    kfree(((void**)ptr)[-1]);
 }
 
 size_t get_free_memory(void) {
@@ -237,16 +437,23 @@ size_t get_total_memory(void) {
     return heap_stats.total_memory;
 }
 
+uint32_t get_heap_end(void) {
+    return (uint32_t)heap_end;
+}
+
 void get_heap_stats(heap_stats_t* stats) {
     if (stats) {
-        // Update largest free block
+        uint32_t flags = spin_lock_irqsave(&heap_lock);
+
+        // The largest free block sits in the highest non-empty bin
         heap_stats.largest_free_block = 0;
-        mem_block_t* current = heap_start;
-        while (current) {
-            if (current->free && current->size > heap_stats.largest_free_block) {
-                heap_stats.largest_free_block = current->size;
+        if (bin_bitmap) {
+            uint32_t bin = 31 - __builtin_clz(bin_bitmap);
+            for (free_block_t* block = bins[bin]; block; block = block->next) {
+                if (block->tag.size > heap_stats.largest_free_block) {
+                    heap_stats.largest_free_block = block->tag.size;
+                }
             }
-            current = current->next;
         }
         
         // Calculate fragmentation ratio
@@ -256,6 +463,7 @@ void get_heap_stats(heap_stats_t* stats) {
         }
         
         *stats = heap_stats;
+        spin_unlock_irqrestore(&heap_lock, flags);
     }
 }
 
@@ -288,12 +496,16 @@ void print_heap_stats(void) {
     vga_write_string("Largest Free Block: ");
     print_number(stats.largest_free_block);
     vga_write_string(" bytes\n");
+    
+    mag_print_stats();
+    arena_print_stats();
 }
 
 void print_allocation_list(void) {
     vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
     vga_write_string("=== Active Allocations ===\n");
     
+#ifdef MEMORY_DEBUG
     for (int i = 0; i < MAX_ALLOCATIONS; i++) {
         if (allocations[i].ptr != NULL) {
             vga_write_string("ID: ");
@@ -305,35 +517,47 @@ void print_allocation_list(void) {
             vga_write_string("\n");
         }
     }
+#else
+    vga_write_string("Per-allocation tracking needs MEMORY_DEBUG; active: ");
+    print_number(heap_stats.active_allocations);
+    vga_write_string("\n");
+#endif
 }
 
+// Walk every large block from the heap base: each must carry a valid
+// magic and a footer that agrees with its tag
 int check_heap_integrity(void) {
-    mem_block_t* current = heap_start;
     int errors = 0;
-    
-    while (current) {
-        if (current->free && current->magic != MEMORY_GUARD_MAGIC) {
-            if (current->magic != MEMORY_FREE_MAGIC) {
-                vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-                vga_write_string("Heap corruption detected!\n");
-                errors++;
-            }
-        } else if (!current->free && current->magic != MEMORY_GUARD_MAGIC) {
-            vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-            vga_write_string("Allocated block corruption detected!\n");
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    
+    uint8_t* current = heap_base;
+    while (current && current < heap_end) {
+        heap_tag_t* tag = (heap_tag_t*)current;
+        bool is_free = tag->magic == MEMORY_FREE_MAGIC;
+        if ((!is_free && tag->magic != MEMORY_GUARD_MAGIC) ||
+            tag->size < HEAP_MIN_BLOCK || tag->size > (uint32_t)(heap_end - current)) {
+            klog(KLOG_ERR, "Heap corruption detected at %x!\n", (uint32_t)tag);
+            errors++;
+            break;      // Sizes can no longer be trusted
+        }
+        if (*block_footer(tag) != (tag->size | (is_free ? HEAP_FOOTER_FREE : 0))) {
+            klog(KLOG_ERR, is_free ? "Free block footer corruption detected at %x!\n" :
+                                     "Allocated block corruption detected at %x!\n", (uint32_t)tag);
             errors++;
         }
-        current = current->next;
+        current += tag->size;
     }
     
+    spin_unlock_irqrestore(&heap_lock, flags);
     return errors;
 }
 
 void detect_memory_leaks(void) {
-    int leaks = 0;
     vga_set_color(VGA_COLOR_LIGHT_MAGENTA, VGA_COLOR_BLACK);
     vga_write_string("=== Memory Leak Detection ===\n");
     
+#ifdef MEMORY_DEBUG
+    int leaks = 0;
     for (int i = 0; i < MAX_ALLOCATIONS; i++) {
         if (allocations[i].ptr != NULL) {
             vga_write_string("LEAK: ");
@@ -355,6 +579,11 @@ void detect_memory_leaks(void) {
         print_number(leaks);
         vga_write_string("\n");
     }
+#else
+    vga_write_string("Leak sites need MEMORY_DEBUG; live allocations: ");
+    print_number(heap_stats.active_allocations);
+    vga_write_string("\n");
+#endif
 }
 
 // Helper function to print numbers
@@ -377,27 +606,133 @@ void print_number(uint32_t num) {
     }
 }
 
-// Memory utility functions
+// Memory utility functions. Three tiers by size: byte moves below
+// MEM_WORD_MIN, rep movsd/stosd with the destination dword aligned up to
+// MEM_NT_MIN, and above that 64-byte SSE2 blocks with non-temporal stores,
+// which do not drag a buffer bigger than the cache through it. The SSE
+// path runs in MEM_NT_CHUNK pieces so interrupts are never off for long.
+typedef uint32_t __attribute__((may_alias)) mem_word_t;
+
+// 'blocks' 64-byte blocks; dest 16-byte aligned, inside fpu_kernel_begin.
+// Only these two are built for SSE2, so nothing else touches XMM registers.
+__attribute__((target("sse2")))
+static void copy_blocks_nt(uint8_t* dest, const uint8_t* src, size_t blocks) {
+    __asm__ volatile (
+        "1:\n\t"
+        "movdqu (%1), %%xmm0\n\t"
+        "movdqu 16(%1), %%xmm1\n\t"
+        "movdqu 32(%1), %%xmm2\n\t"
+        "movdqu 48(%1), %%xmm3\n\t"
+        "movntdq %%xmm0, (%0)\n\t"
+        "movntdq %%xmm1, 16(%0)\n\t"
+        "movntdq %%xmm2, 32(%0)\n\t"
+        "movntdq %%xmm3, 48(%0)\n\t"
+        "add $64, %1\n\t"
+        "add $64, %0\n\t"
+        "dec %2\n\t"
+        "jnz 1b\n\t"
+        "sfence"
+        : "+r"(dest), "+r"(src), "+r"(blocks)
+        :
+        : "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3");
+}
+
+__attribute__((target("sse2")))
+static void set_blocks_nt(uint8_t* dest, uint32_t pattern, size_t blocks) {
+    __asm__ volatile (
+        "movd %2, %%xmm0\n\t"
+        "pshufd $0, %%xmm0, %%xmm0\n\t"
+        "1:\n\t"
+        "movntdq %%xmm0, (%0)\n\t"
+        "movntdq %%xmm0, 16(%0)\n\t"
+        "movntdq %%xmm0, 32(%0)\n\t"
+        "movntdq %%xmm0, 48(%0)\n\t"
+        "add $64, %0\n\t"
+        "dec %1\n\t"
+        "jnz 1b\n\t"
+        "sfence"
+        : "+r"(dest), "+r"(blocks)
+        : "r"(pattern)
+        : "memory", "cc", "xmm0");
+}
+
 void* memset(void* dest, int val, size_t count) {
-    unsigned char* ptr = (unsigned char*)dest;
-    while (count--) {
-        *ptr++ = (unsigned char)val;
+    uint8_t* ptr = (uint8_t*)dest;
+    uint32_t pattern = (uint8_t)val * 0x01010101u;
+    
+    if (count >= MEM_NT_MIN) {
+        size_t head = (0u - (uintptr_t)ptr) & 15;
+        memset_inline(ptr, val, head);
+        ptr += head;
+        count -= head;
+        while (count >= 64) {
+            uint32_t flags;
+            if (!fpu_kernel_begin(&flags)) break;
+            size_t chunk = count < MEM_NT_CHUNK ? count & ~(size_t)63 : MEM_NT_CHUNK;
+            set_blocks_nt(ptr, pattern, chunk / 64);
+            fpu_kernel_end(flags);
+            ptr += chunk;
+            count -= chunk;
+        }
+    }
+    if (count >= MEM_WORD_MIN) {
+        size_t head = (0u - (uintptr_t)ptr) & 3;
+        memset_inline(ptr, val, head);
+        ptr += head;
+        count -= head;
+        size_t words = count / 4;
+        __asm__ volatile ("rep stosl" : "+D"(ptr), "+c"(words) : "a"(pattern) : "memory");
+        count &= 3;
     }
+    memset_inline(ptr, val, count);
     return dest;
 }
 
 void* memcpy(void* dest, const void* src, size_t count) {
-    unsigned char* dst = (unsigned char*)dest;
-    const unsigned char* source = (const unsigned char*)src;
-    while (count--) {
-        *dst++ = *source++;
+    uint8_t* dst = (uint8_t*)dest;
+    const uint8_t* source = (const uint8_t*)src;
+    
+    if (count >= MEM_NT_MIN) {
+        size_t head = (0u - (uintptr_t)dst) & 15;
+        memcpy_inline(dst, source, head);
+        dst += head;
+        source += head;
+        count -= head;
+        while (count >= 64) {
+            uint32_t flags;
+            if (!fpu_kernel_begin(&flags)) break;
+            size_t chunk = count < MEM_NT_CHUNK ? count & ~(size_t)63 : MEM_NT_CHUNK;
+            copy_blocks_nt(dst, source, chunk / 64);
+            fpu_kernel_end(flags);
+            dst += chunk;
+            source += chunk;
+            count -= chunk;
+        }
     }
+    if (count >= MEM_WORD_MIN) {
+        // Align the stores; misaligned loads cost less than split stores
+        size_t head = (0u - (uintptr_t)dst) & 3;
+        memcpy_inline(dst, source, head);
+        dst += head;
+        source += head;
+        count -= head;
+        size_t words = count / 4;
+        __asm__ volatile ("rep movsl" : "+D"(dst), "+S"(source), "+c"(words) : : "memory");
+        count &= 3;
+    }
+    memcpy_inline(dst, source, count);
     return dest;
 }
 
+// Skip matching dwords; the first differing byte then decides
 int memcmp(const void* ptr1, const void* ptr2, size_t count) {
     const unsigned char* p1 = (const unsigned char*)ptr1;
     const unsigned char* p2 = (const unsigned char*)ptr2;
+    while (count >= 4 && *(const mem_word_t*)p1 == *(const mem_word_t*)p2) {
+        p1 += 4;
+        p2 += 4;
+        count -= 4;
+    }
     while (count--) {
         if (*p1 != *p2) {
             return *p1 - *p2;
@@ -408,6 +743,70 @@ int memcmp(const void* ptr1, const void* ptr2, size_t count) {
     return 0;
 }
 
+// Byte-at-a-time reference for mem_bench
+static void copy_bytes(uint8_t* dest, const uint8_t* src, size_t count) {
+    while (count--) {
+        *dest++ = *src++;
+    }
+}
+
+void mem_bench(void) {
+    static const uint32_t sizes[] = { 16, 64, 256, 1024, 4096, 65536, 262144, MEM_BENCH_MAX };
+    
+    if (!tsc_available()) {
+        vga_write_string("membench needs a calibrated TSC\n");
+        return;
+    }
+    uint32_t order = frame_order(MEM_BENCH_MAX);
+    uint8_t* src = (uint8_t*)frame_alloc_pages(order);
+    uint8_t* dst = (uint8_t*)frame_alloc_pages(order);
+    if (!src || !dst) {
+        vga_write_string("membench: no contiguous frames for the buffers\n");
+        if (src) frame_free_pages((uint32_t)src, order);
+        if (dst) frame_free_pages((uint32_t)dst, order);
+        return;
+    }
+    for (uint32_t i = 0; i < MEM_BENCH_MAX; i++) {
+        src[i] = (uint8_t)i;
+    }
+    
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    vga_write_string("Bytes      MB/s: bytes  memcpy  memset  memcmp\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint32_t size = sizes[s];
+        uint32_t rounds = MEM_BENCH_BYTES / size;
+        uint64_t cycles[4];
+        
+        for (uint32_t test = 0; test < 4; test++) {
+            if (test == 3) memcpy(dst, src, size); // memcmp scans equal buffers to the end
+            uint64_t start = rdtsc();
+            for (uint32_t r = 0; r < rounds; r++) {
+                switch (test) {
+                    case 0: copy_bytes(dst, src, size); break;
+                    case 1: memcpy(dst, src, size); break;
+                    case 2: memset(dst, (int)r, size); break;
+                    case 3: memcmp(dst, src, size); break;
+                }
+            }
+            cycles[test] = rdtsc() - start;
+        }
+        
+        print_dec(size);
+        vga_write_string("    ");
+        for (uint32_t test = 0; test < 4; test++) {
+            // bytes per microsecond is MB/s
+            uint32_t us = (uint32_t)div_u64_u32(tsc_cycles_to_ns(cycles[test]), 1000, NULL);
+            print_dec((uint32_t)div_u64_u32((uint64_t)rounds * size, us ? us : 1, NULL));
+            vga_write_string("  ");
+        }
+        vga_write_string("\n");
+    }
+    
+    frame_free_pages((uint32_t)src, order);
+    frame_free_pages((uint32_t)dst, order);
+}
+
 size_t strlen(const char* str) {
     size_t len = 0;
     while (str[len]) len++;
@@ -440,17 +839,61 @@ int strcmp(const char* str1, const char* str2) {
 }
 
 // Memory pool allocator implementation
+// Pool side of the magazine layer (depot lock held, or no cache)
+static void* pool_take(void* backend) {
+    memory_pool_t* pool = (memory_pool_t*)backend;
+    void** block = (void**)pool->free_list;
+    if (!block) return NULL;
+    
+    pool->free_list = *block;
+    pool->free_blocks--;
+    
+    // Mark block as used
+    size_t i = ((char*)block - (char*)pool->pool_start) / pool->block_size;
+    pool->free_bitmap[i / 32] &= ~(1u << (i % 32));
+    
+    *block = NULL;
+    return block;
+}
+
+static void pool_put(void* backend, void* ptr) {
+    memory_pool_t* pool = (memory_pool_t*)backend;
+    size_t block_index = ((char*)ptr - (char*)pool->pool_start) / pool->block_size;
+    uint32_t word_index = block_index / 32;
+    uint32_t bit = 1u << (block_index % 32);
+    if (pool->free_bitmap[word_index] & bit) return; // Already free
+    
+    pool->free_bitmap[word_index] |= bit;
+    *(void**)ptr = pool->free_list;
+    pool->free_list = ptr;
+    pool->free_blocks++;
+}
+
+static memory_pool_t* pool_create(size_t block_size, size_t block_count, size_t align, bool cached);
+
 memory_pool_t* create_memory_pool(size_t block_size, size_t block_count) {
-    memory_pool_t* pool = (memory_pool_t*)kmalloc(sizeof(memory_pool_t));
+    return pool_create(block_size, block_count, 0, true);
+}
+
+memory_pool_t* create_memory_pool_aligned(size_t block_size, size_t block_count, size_t align) {
+    return pool_create(block_size, block_count, align, true);
+}
+
+memory_pool_t* create_memory_pool_uncached(size_t block_size, size_t block_count) {
+    return pool_create(block_size, block_count, 0, false);
+}
+
+static memory_pool_t* pool_create(size_t block_size, size_t block_count, size_t align, bool cached) {
+    if (block_size == 0 || block_count == 0 || (align & (align - 1))) return NULL;
+    memory_pool_t* pool = (memory_pool_t*)kmalloc_aligned(sizeof(memory_pool_t), CACHE_LINE_SIZE);
     if (!pool) return NULL;
     
-    // Align block size to 8-byte boundary
-    block_size = (block_size + 7) & ~7;
+    block_size = pool_stride(block_size, align);
     
     // Allocate pool memory
-    pool->pool_start = kmalloc(block_size * block_count);
+    pool->pool_start = kmalloc_coloured(block_size * block_count);
     if (!pool->pool_start) {
-        kfree(pool);
+        kfree_aligned(pool);
         return NULL;
     }
     
@@ -462,36 +905,28 @@ memory_pool_t* create_memory_pool(size_t block_size, size_t block_count) {
     size_t bitmap_size = (block_count + 31) / 32; // Round up to 32-bit boundaries
     pool->free_bitmap = (uint32_t*)kmalloc(bitmap_size * sizeof(uint32_t));
     if (!pool->free_bitmap) {
-        kfree(pool->pool_start);
-        kfree(pool);
+        kfree_aligned(pool->pool_start);
+        kfree_aligned(pool);
         return NULL;
     }
     
-    // Initialize all blocks as free
+    // Initialize all blocks as free, chained in address order
     memset(pool->free_bitmap, 0xFF, bitmap_size * sizeof(uint32_t));
+    pool->free_list = NULL;
+    for (size_t i = block_count; i-- > 0;) {
+        void** block = (void**)((char*)pool->pool_start + i * block_size);
+        *block = pool->free_list;
+        pool->free_list = block;
+    }
     
+    pool->cache = cached ? mag_cache_create("pool", block_size, pool_take, pool_put, pool) : NULL;
     return pool;
 }
 
 void* pool_alloc(memory_pool_t* pool) {
-    if (!pool || pool->free_blocks == 0) return NULL;
-    
-    // Find first free block
-    for (size_t i = 0; i < pool->block_count; i++) {
-        uint32_t word_index = i / 32;
-        uint32_t bit_index = i % 32;
-        
-        if (pool->free_bitmap[word_index] & (1 << bit_index)) {
-            // Mark block as used
-            pool->free_bitmap[word_index] &= ~(1 << bit_index);
-            pool->free_blocks--;
-            
-            // Return pointer to block
-            return (char*)pool->pool_start + (i * pool->block_size);
-        }
-    }
-    
-    return NULL; // Should not happen if free_blocks > 0
+    if (!pool) return NULL;
+    if (pool->cache) return mag_alloc(pool->cache);
+    return pool_take(pool);
 }
 
 void pool_free(memory_pool_t* pool, void* ptr) {
@@ -504,21 +939,85 @@ void pool_free(memory_pool_t* pool, void* ptr) {
     size_t block_index = offset / pool->block_size;
     if (block_index >= pool->block_count) return; // Out of range
     
-    uint32_t word_index = block_index / 32;
-    uint32_t bit_index = block_index % 32;
-    
-    // Mark block as free
-    pool->free_bitmap[word_index] |= (1 << bit_index);
-    pool->free_blocks++;
-    
     // Clear block content for security
     memset(ptr, 0, pool->block_size);
+    if (pool->cache) {
+        mag_free(pool->cache, ptr);
+    } else {
+        pool_put(pool, ptr);
+    }
 }
 
 void destroy_memory_pool(memory_pool_t* pool) {
     if (!pool) return;
     
+    mag_cache_destroy(pool->cache);
     kfree(pool->free_bitmap);
-    kfree(pool->pool_start);
-    kfree(pool);
-}
\ No newline at end of file
+    kfree_aligned(pool->pool_start);
+    kfree_aligned(pool);
+}
+
+spsc_pool_t* spsc_pool_create(size_t block_size, size_t block_count) {
+    if (block_size == 0 || block_count == 0 || block_count > 0x40000000) return NULL;
+    spsc_pool_t* pool = (spsc_pool_t*)kmalloc_aligned(sizeof(spsc_pool_t), CACHE_LINE_SIZE);
+    if (!pool) return NULL;
+    
+    block_size = pool_stride(block_size, 0);
+    
+    // The ring holds every block at once, so it can never overflow
+    uint32_t ring_size = 1;
+    while (ring_size < block_count) {
+        ring_size <<= 1;
+    }
+    
+    pool->pool_start = (uint8_t*)kmalloc_coloured(block_size * block_count);
+    pool->ring = (void**)kmalloc_aligned(ring_size * sizeof(void*), CACHE_LINE_SIZE);
+    if (!pool->pool_start || !pool->ring) {
+        kfree_aligned(pool->pool_start);
+        kfree_aligned(pool->ring);
+        kfree_aligned(pool);
+        return NULL;
+    }
+    
+    pool->block_size = block_size;
+    pool->block_count = block_count;
+    pool->mask = ring_size - 1;
+    for (uint32_t i = 0; i < block_count; i++) {
+        pool->ring[i] = pool->pool_start + i * block_size;
+    }
+    pool->head = 0;
+    pool->tail = block_count;
+    return pool;
+}
+
+void* spsc_pool_alloc(spsc_pool_t* pool) {
+    uint32_t head = pool->head;
+    if (head == pool->tail) return NULL;   // Empty
+    
+    compiler_barrier();                     // Slot read after the tail
+    void* block = pool->ring[head & pool->mask];
+    compiler_barrier();                     // Slot read before it is handed back
+    pool->head = head + 1;
+    return block;
+}
+
+void spsc_pool_free(spsc_pool_t* pool, void* ptr) {
+    if (!ptr) return;
+    size_t offset = (uint8_t*)ptr - pool->pool_start;
+    if (offset % pool->block_size != 0 || offset / pool->block_size >= pool->block_count) {
+        return; // Invalid pointer
+    }
+    
+    uint32_t tail = pool->tail;
+    pool->ring[tail & pool->mask] = ptr;
+    compiler_barrier();                     // Slot written before the tail
+    pool->tail = tail + 1;
+}
+
+void spsc_pool_destroy(spsc_pool_t* pool) {
+    if (!pool) return;
+    
+    kfree_aligned(pool->ring);
+    kfree_aligned(pool->pool_start);
+    kfree_aligned(pool);
+}
@@ -5,30 +5,36 @@
 
 // Memory layout constants
 #define KERNEL_START      0x10000   // 64KB - where kernel is loaded
-#define KERNEL_HEAP_START 0x100000  // 1MB - start of kernel heap
+#define KERNEL_HEAP_START 0x100000  // 1MB - lowest heap start (moved past the kernel image)
 #define KERNEL_HEAP_SIZE  0x400000  // 4MB - size of kernel heap
 
 // Page size
 #define PAGE_SIZE 4096
 
 // Memory debugging constants
-#define MEMORY_GUARD_MAGIC    0xDEADBEEF
-#define MEMORY_FREE_MAGIC     0xFEEDFACE
-#define MAX_ALLOCATIONS       1024
-
-// Memory block structure for enhanced heap allocator
-typedef struct mem_block {
-    uint32_t magic;         // Guard magic number
-    size_t size;            // Size of the block
-    int free;               // Free flag
-    const char* file;       // File where allocated (for debugging)
-    int line;               // Line number where allocated
-    uint32_t alloc_id;      // Unique allocation ID
-    struct mem_block* next; // Next block
-    struct mem_block* prev; // Previous block (for faster coalescing)
-} mem_block_t;
-
-// Allocation tracking structure
+#define MEMORY_GUARD_MAGIC    0xDEADBEEF    // Large block in use
+#define MEMORY_FREE_MAGIC     0xFEEDFACE    // Large block free
+#define MEMORY_SMALL_MAGIC    0x5A11C0DE    // Size-class object in use
+#define MEMORY_SMALL_FREE     0x5A11F4EE    // Size-class object free
+#define MAX_ALLOCATIONS       1024          // Tracked allocations (MEMORY_DEBUG)
+
+// Segregated-fit heap. Requests up to HEAP_SMALL_MAX bytes are rounded to
+// one of HEAP_CLASSES size classes and served from per-class free lists,
+// refilled a HEAP_SLAB_SIZE chunk at a time. Larger requests get
+// boundary-tagged blocks from power-of-two bins, so splitting and
+// coalescing need no list walk. Every allocation starts with a heap_tag_t.
+#define HEAP_SMALL_MAX        2048
+#define HEAP_CLASSES          14
+#define HEAP_SLAB_SIZE        16384         // Chunk carved into small objects
+#define HEAP_BINS             24            // Large free bins, bin n holds [2^(n+5), 2^(n+6))
+#define HEAP_ALIGN            8
+
+typedef struct heap_tag {
+    uint32_t magic;         // One of the magics above
+    uint32_t size;          // Large: whole block incl. tags; small: class index
+} heap_tag_t;
+
+// Allocation tracking structure (MEMORY_DEBUG builds only)
 typedef struct allocation_info {
     void* ptr;
     size_t size;
@@ -66,11 +72,12 @@ typedef struct heap_stats {
 // Function prototypes
 void memory_init(void);
 
-// Basic allocation functions
+// Basic allocation functions (macros in MEMORY_DEBUG builds; kcalloc and
+// krealloc are always macros over the functions below)
+#ifndef MEMORY_DEBUG
 void* kmalloc(size_t size);
-void* kcalloc(size_t count, size_t size);
-void* krealloc(void* ptr, size_t size);
 void kfree(void* ptr);
+#endif
 
 // Debug allocation functions
 void* _kmalloc_debug(size_t size, const char* file, int line);
@@ -85,6 +92,7 @@ void* _krealloc(void* ptr, size_t size);
 // Memory statistics and debugging
 size_t get_free_memory(void);
 size_t get_total_memory(void);
+uint32_t get_heap_end(void);        // First address past the heap
 void get_heap_stats(heap_stats_t* stats);
 void print_heap_stats(void);
 void print_allocation_list(void);
@@ -92,27 +100,111 @@ int check_heap_integrity(void);
 void detect_memory_leaks(void);
 void print_number(uint32_t num);
 
-// Memory utility functions
+// Memory utility functions (memcpy/memset pick byte, rep movsd/stosd or
+// SSE2 non-temporal moves by size)
+#define MEM_WORD_MIN        16              // rep movsd/stosd from here
+#define MEM_NT_MIN          (64 * 1024)     // SSE2 streaming stores from here
+#define MEM_NT_CHUNK        (16 * 1024)     // Copied per interrupts-off section
+#define MEM_BENCH_MAX       (1024 * 1024)   // Largest size mem_bench times
+#define MEM_BENCH_BYTES     (4 * 1024 * 1024)   // Moved per size and function
+
 void* memset(void* dest, int val, size_t count);
 void* memcpy(void* dest, const void* src, size_t count);
 int memcmp(const void* ptr1, const void* ptr2, size_t count);
+void mem_bench(void);               // Throughput by size, against a byte loop
+
+// Inline variants for small, mostly fixed-size copies (structs, headers):
+// no call and no size dispatch, just the string instruction
+static inline void memcpy_inline(void* dest, const void* src, size_t count) {
+    __asm__ volatile ("rep movsb" : "+D"(dest), "+S"(src), "+c"(count) : : "memory");
+}
+
+static inline void memset_inline(void* dest, int val, size_t count) {
+    __asm__ volatile ("rep stosb" : "+D"(dest), "+c"(count) : "a"(val) : "memory");
+}
+
+// *dst = *src for objects of the same size, through memcpy_inline
+#define COPY_STRUCT(dst, src) \
+    memcpy_inline((dst), (src), sizeof(char[sizeof(*(dst)) == sizeof(*(src)) ? sizeof(*(dst)) : -1]))
 size_t strlen(const char* str);
 char* strcpy(char* dest, const char* src);
 char* strncpy(char* dest, const char* src, size_t n);
 int strcmp(const char* str1, const char* str2);
 
-// Memory pool allocator for fixed-size blocks
+// Cache-line (or other power-of-two) aligned allocations; free them with
+// kfree_aligned. The original pointer sits in the word below the block.
+void* kmalloc_aligned(size_t size, size_t align);
+void kfree_aligned(void* ptr);
+
+// Line-aligned like kmalloc_aligned(size, CACHE_LINE_SIZE), but each call
+// starts up to HEAP_COLOURS - 1 lines further in than the last, so the first
+// (hottest) elements of different pools land in different cache sets rather
+// than all on the first set of a page. Free with kfree_aligned.
+#define HEAP_COLOURS    8
+void* kmalloc_coloured(size_t size);
+
+// Element stride of a pool: room for the free list link, 8-byte aligned,
+// whole lines from half a line up. A nonzero 'align' (a power of two) rounds
+// up to it instead: CACHE_LINE_SIZE gives every element a line of its own,
+// for records that different CPUs write.
+static inline size_t pool_stride(size_t size, size_t align) {
+    if (size < sizeof(void*)) size = sizeof(void*);
+    if (!align) align = size >= CACHE_LINE_SIZE / 2 ? CACHE_LINE_SIZE : 8;
+    return (size + align - 1) & ~(align - 1);
+}
+
+// Memory pool allocator for fixed-size blocks. Free blocks are chained
+// through their first word, most recently freed (and likely still cached)
+// first, so pool_alloc and pool_free are O(1); the bitmap only lets
+// pool_free reject foreign pointers and double frees. Pool and blocks start
+// on a cache line, coloured (kmalloc_coloured), and blocks of half a line or
+// more are padded to whole lines so two blocks never share one; the
+// _aligned variant pads to any stride (pool_stride).
+//
+// A per-CPU magazine cache (magazine.h) sits in front, so any CPU may call
+// in and most calls stay on the local CPU; the free list and bitmap are
+// then only touched under the cache's depot lock, and double frees are
+// caught once the block reaches them. Without a cache (out of memory at
+// creation, or the _uncached variant) the pool is not locked: one user at
+// a time, but every free block is in the pool for whichever CPU asks, so a
+// user that never holds more than block_count cannot find it empty.
+struct mag_cache;
+
 typedef struct memory_pool {
     void* pool_start;
     size_t block_size;
     size_t block_count;
-    uint32_t* free_bitmap;
+    uint32_t* free_bitmap;      // Bit set = block in the pool (not in use or cached)
     uint32_t free_blocks;
+    void* free_list;            // Next free block, or NULL
+    struct mag_cache* cache;    // Per-CPU magazines, or NULL
 } memory_pool_t;
 
 memory_pool_t* create_memory_pool(size_t block_size, size_t block_count);
+memory_pool_t* create_memory_pool_aligned(size_t block_size, size_t block_count, size_t align);
+memory_pool_t* create_memory_pool_uncached(size_t block_size, size_t block_count);
 void* pool_alloc(memory_pool_t* pool);
 void pool_free(memory_pool_t* pool, void* ptr);
 void destroy_memory_pool(memory_pool_t* pool);
 
+// Pool shared by exactly two cores: one allocates, the other frees (say a
+// strategy creating orders and the gateway retiring them). Free blocks
+// travel through a ring of pointers; the allocating core consumes at head
+// and the freeing core produces at tail, each index on its own cache line,
+// so neither side takes a lock or a locked instruction.
+typedef struct spsc_pool {
+    volatile uint32_t head __cacheline_aligned;     // Allocating core only
+    volatile uint32_t tail __cacheline_aligned;     // Freeing core only
+    void** ring __cacheline_aligned;                // Power of two >= block_count
+    uint32_t mask;
+    uint8_t* pool_start;
+    size_t block_size;
+    size_t block_count;
+} spsc_pool_t;
+
+spsc_pool_t* spsc_pool_create(size_t block_size, size_t block_count);
+void* spsc_pool_alloc(spsc_pool_t* pool);               // Allocating core
+void spsc_pool_free(spsc_pool_t* pool, void* ptr);      // Freeing core
+void spsc_pool_destroy(spsc_pool_t* pool);
+
 #endif // MEMORY_H
\ No newline at end of file
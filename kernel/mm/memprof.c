@@ -0,0 +1,223 @@
+#include "memprof.h"
+#include "../arch/spinlock.h"
+#include "../drivers/vga.h"
+
+#define SITE_MASK   (MEMPROF_SITES - 1)
+#define LIVE_MASK   (MEMPROF_LIVE - 1)
+
+typedef struct {
+    void* ptr;                  // NULL = empty slot
+    uint16_t site;              // Index into sites[]
+    uint32_t weight;
+} memprof_live_t;
+
+volatile uint32_t memprof_rate = 0;
+volatile uint32_t memprof_live_count = 0;
+
+static int32_t countdown = 0;           // heap_lock held
+static uint32_t rng_state = 2463534242u;
+
+static spinlock_t memprof_lock = SPINLOCK_INIT;
+static memprof_site_t sites[MEMPROF_SITES];
+static memprof_live_t live[MEMPROF_LIVE];
+static memprof_stats_t memprof_stats;
+
+static inline uint32_t ptr_hash(void* ptr, uint32_t bits) {
+    return ((uint32_t)ptr * 2654435761u) >> (32 - bits);
+}
+
+// Uniform over [1, 2*rate]: the mean interval is the rate
+static int32_t next_interval(uint32_t rate) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return (int32_t)(rng_state % (2 * rate) + 1);
+}
+
+void memprof_enable(uint32_t rate) {
+    countdown = rate ? next_interval(rate) : 0;
+    memprof_rate = rate;
+}
+
+void memprof_reset(void) {
+    uint32_t flags = spin_lock_irqsave(&memprof_lock);
+    for (uint32_t i = 0; i < MEMPROF_SITES; i++) {
+        sites[i].site = NULL;
+    }
+    for (uint32_t i = 0; i < MEMPROF_LIVE; i++) {
+        live[i].ptr = NULL;
+    }
+    memprof_stats.samples = 0;
+    memprof_stats.site_overflow = 0;
+    memprof_stats.live_overflow = 0;
+    memprof_stats.live_samples = 0;
+    memprof_live_count = 0;
+    spin_unlock_irqrestore(&memprof_lock, flags);
+}
+
+bool memprof_tick(size_t size) {
+    countdown -= (int32_t)size;
+    if (countdown > 0) return false;
+
+    uint32_t rate = memprof_rate;
+    countdown = rate ? next_interval(rate) : 0;
+    return rate != 0;
+}
+
+// Site slot for a return address, claimed if new (memprof_lock held)
+static int site_lookup(void* site) {
+    uint32_t i = ptr_hash(site, MEMPROF_SITE_BITS);
+    for (uint32_t probe = 0; probe < MEMPROF_SITES; probe++, i = (i + 1) & SITE_MASK) {
+        if (sites[i].site == site) return (int)i;
+        if (!sites[i].site) {
+            sites[i].site = site;
+            sites[i].samples = 0;
+            sites[i].alloc_bytes = 0;
+            sites[i].live_bytes = 0;
+            sites[i].live_samples = 0;
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void memprof_record(void* ptr, size_t size, void* site) {
+    uint32_t rate = memprof_rate;
+    uint32_t weight = size > rate ? size : rate;
+
+    uint32_t flags = spin_lock_irqsave(&memprof_lock);
+    memprof_stats.samples++;
+    int index = site_lookup(site);
+    if (index < 0) {
+        memprof_stats.site_overflow++;
+        spin_unlock_irqrestore(&memprof_lock, flags);
+        return;
+    }
+
+    memprof_site_t* entry = &sites[index];
+    entry->samples++;
+    entry->alloc_bytes = entry->alloc_bytes + weight < entry->alloc_bytes ?
+                         0xFFFFFFFF : entry->alloc_bytes + weight;
+
+    // Keep at least one slot empty so lookups always terminate
+    if (memprof_live_count >= MEMPROF_LIVE - 1) {
+        memprof_stats.live_overflow++;
+        spin_unlock_irqrestore(&memprof_lock, flags);
+        return;
+    }
+    uint32_t i = ptr_hash(ptr, MEMPROF_LIVE_BITS);
+    while (live[i].ptr) {
+        i = (i + 1) & LIVE_MASK;
+    }
+    live[i].ptr = ptr;
+    live[i].site = (uint16_t)index;
+    live[i].weight = weight;
+    entry->live_bytes += weight;
+    entry->live_samples++;
+    memprof_stats.live_samples++;
+    memprof_live_count++;
+    spin_unlock_irqrestore(&memprof_lock, flags);
+}
+
+// Linear probing with backward-shift deletion: pull later entries of the
+// same probe run into the hole so no tombstones build up
+static void live_remove(uint32_t hole) {
+    uint32_t i = hole;
+    for (;;) {
+        i = (i + 1) & LIVE_MASK;
+        if (!live[i].ptr) break;
+        uint32_t home = ptr_hash(live[i].ptr, MEMPROF_LIVE_BITS);
+        if (((i - home) & LIVE_MASK) >= ((i - hole) & LIVE_MASK)) {
+            live[hole] = live[i];
+            hole = i;
+        }
+    }
+    live[hole].ptr = NULL;
+}
+
+// Called before the block goes back to the heap, so it cannot have been
+// handed out (and sampled) again yet
+void memprof_free(void* ptr) {
+    uint32_t flags = spin_lock_irqsave(&memprof_lock);
+    uint32_t i = ptr_hash(ptr, MEMPROF_LIVE_BITS);
+    while (live[i].ptr && live[i].ptr != ptr) {
+        i = (i + 1) & LIVE_MASK;
+    }
+    if (live[i].ptr) {
+        memprof_site_t* entry = &sites[live[i].site];
+        entry->live_bytes -= live[i].weight;
+        entry->live_samples--;
+        memprof_stats.live_samples--;
+        memprof_live_count--;
+        live_remove(i);
+    }
+    spin_unlock_irqrestore(&memprof_lock, flags);
+}
+
+void memprof_get_stats(memprof_stats_t* stats) {
+    if (!stats) return;
+    *stats = memprof_stats;
+}
+
+void memprof_print(void) {
+    memprof_site_t top[MEMPROF_TOP];
+    uint32_t count = 0;
+    uint32_t total_live = 0;
+
+    // Keep the MEMPROF_TOP heaviest allocators, heaviest first
+    uint32_t flags = spin_lock_irqsave(&memprof_lock);
+    for (uint32_t i = 0; i < MEMPROF_SITES; i++) {
+        if (!sites[i].site) continue;
+        total_live += sites[i].live_bytes;
+
+        uint32_t pos = count < MEMPROF_TOP ? count++ : MEMPROF_TOP;
+        while (pos > 0 && top[pos - 1].alloc_bytes < sites[i].alloc_bytes) {
+            if (pos < MEMPROF_TOP) top[pos] = top[pos - 1];
+            pos--;
+        }
+        if (pos < MEMPROF_TOP) top[pos] = sites[i];
+    }
+    memprof_stats_t stats = memprof_stats;
+    spin_unlock_irqrestore(&memprof_lock, flags);
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Heap Profile ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    if (memprof_rate) {
+        vga_write_string("Sampling 1 in ");
+        print_dec(memprof_rate);
+        vga_write_string(" bytes");
+    } else {
+        vga_write_string("Sampling off");
+    }
+    vga_write_string("  Samples: ");
+    print_dec(stats.samples);
+    vga_write_string("  Live est: ");
+    print_dec(total_live);
+    vga_write_string(" bytes\n");
+    if (stats.site_overflow || stats.live_overflow) {
+        vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
+        vga_write_string("Dropped: ");
+        print_dec(stats.site_overflow);
+        vga_write_string(" (site table full)  Not tracked live: ");
+        print_dec(stats.live_overflow);
+        vga_write_string("\n");
+    }
+
+    vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    vga_write_string("Site        Samples  Alloc est   Live est\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    for (uint32_t i = 0; i < count; i++) {
+        print_hex((uint32_t)top[i].site);
+        vga_write_string("  ");
+        print_dec(top[i].samples);
+        vga_write_string("  ");
+        print_dec(top[i].alloc_bytes);
+        vga_write_string("  ");
+        print_dec(top[i].live_bytes);
+        vga_write_string("\n");
+    }
+    if (count == 0) {
+        vga_write_string("(no samples)\n");
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef MEMPROF_H
+#define MEMPROF_H
+
+#include "../types.h"
+
+// Sampled heap profiler. While enabled, kmalloc counts allocated bytes down
+// from a random interval averaging 'rate' bytes and records the allocation
+// that crosses zero, so roughly one byte in 'rate' is sampled and large or
+// frequent allocators are caught in proportion to their volume. Each sample
+// stands for max(size, rate) bytes; samples are summed per call site and
+// kept in a live table until freed, so the estimate covers both churn and
+// what is still held. Disabled, the allocator pays one predictable branch.
+#define MEMPROF_DEFAULT_RATE    4096        // Mean bytes between samples
+#define MEMPROF_SITE_BITS       8
+#define MEMPROF_SITES           (1 << MEMPROF_SITE_BITS)
+#define MEMPROF_LIVE_BITS       10
+#define MEMPROF_LIVE            (1 << MEMPROF_LIVE_BITS)
+#define MEMPROF_TOP             10          // Sites listed by memprof_print
+
+typedef struct {
+    void* site;                 // Return address into the caller of kmalloc
+    uint32_t samples;
+    uint32_t alloc_bytes;       // Estimated bytes allocated here (saturates)
+    uint32_t live_bytes;        // Estimated bytes allocated here and not freed
+    uint32_t live_samples;
+} memprof_site_t;
+
+typedef struct {
+    uint32_t samples;
+    uint32_t site_overflow;     // Samples dropped: site table full
+    uint32_t live_overflow;     // Samples not tracked to their free: live table full
+    uint32_t live_samples;
+} memprof_stats_t;
+
+// Read by the allocator on every call; 0 means off
+extern volatile uint32_t memprof_rate;
+extern volatile uint32_t memprof_live_count;
+
+void memprof_enable(uint32_t rate);     // rate 0 disables
+void memprof_reset(void);
+
+// Allocator hooks. memprof_tick runs under heap_lock and says whether this
+// allocation is the sampled one; record and free run outside it.
+bool memprof_tick(size_t size);
+void memprof_record(void* ptr, size_t size, void* site);
+void memprof_free(void* ptr);
+
+static inline bool memprof_sample(size_t size) {
+    return __builtin_expect(memprof_rate != 0, 0) && memprof_tick(size);
+}
+
+void memprof_get_stats(memprof_stats_t* stats);
+void memprof_print(void);
+
+#endif // MEMPROF_H
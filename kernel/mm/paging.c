@@ -1,18 +1,20 @@
 #include "paging.h"
 #include "memory.h"
+#include "frame.h"
+#include "../arch/cpu.h"
+#include "../arch/tsc.h"
+#include "../arch/div64.h"
+#include "../proc/process.h"
 #include "../drivers/vga.h"
 
 // Global page directory and current directory
 page_directory_t* kernel_page_directory = NULL;
 page_directory_t* current_page_directory = NULL;
 
-// Physical page frame allocator
-static page_frame_t* free_page_frames = NULL;
-static uint32_t next_page_frame = 0x200000; // Start allocating after 2MB
-static uint32_t max_memory = 0x1000000;     // Assume 16MB for now
-
 // Memory statistics
 static memory_stats_t mem_stats = {0};
+static bool pse_enabled = false;
+static bool pge_enabled = false;
 
 // External assembly functions (defined in paging.asm)
 extern void load_page_directory(uint32_t physical_addr);
@@ -24,9 +26,18 @@ void paging_init(void) {
     vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
     vga_write_string("Initializing paging system...\n");
     
+    // Physical frames: everything between the kernel heap and the end of memory
+    frame_init(get_heap_end(), FRAME_MEMORY_END);
+    
+    // 4MB and global pages take effect once paging is on; CR4 can be set now
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    pse_enabled = (edx & CPUID_EDX_PSE) != 0;
+    pge_enabled = (edx & CPUID_EDX_PGE) != 0;
+    paging_init_cpu();
+    
     // Calculate total pages available
-    mem_stats.total_pages = max_memory / PAGE_SIZE;
-    mem_stats.free_pages = mem_stats.total_pages - (next_page_frame / PAGE_SIZE);
+    mem_stats.total_pages = FRAME_MEMORY_END / PAGE_SIZE;
     mem_stats.used_pages = 0;
     mem_stats.kernel_pages = 0;
     mem_stats.user_pages = 0;
@@ -42,6 +53,14 @@ void paging_init(void) {
     vga_write_string("Paging system initialized (disabled for stability)\n");
 }
 
+// CR4 is per CPU: the boot CPU sets it here, APs from smp_ap_entry
+void paging_init_cpu(void) {
+    uint32_t cr4 = read_cr4();
+    if (pse_enabled) cr4 |= CR4_PSE;
+    if (pge_enabled) cr4 |= CR4_PGE;
+    write_cr4(cr4);
+}
+
 // Enable paging
 void enable_paging(void) {
     if (!kernel_page_directory) {
@@ -54,31 +73,45 @@ void enable_paging(void) {
     uint32_t page_dir_phys = (uint32_t)kernel_page_directory;
     load_page_directory(page_dir_phys);
     
-    // Enable paging in CR0
+    // Enable paging in CR0, with kernel writes to read-only (copy-on-write)
+    // pages faulting as well
+    write_cr0(read_cr0() | CR0_WP);
     enable_paging_asm();
     
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     vga_write_string("Paging enabled successfully\n");
 }
 
-// Switch to a different page directory
+// Switch to a different page directory. Reloading CR3 flushes every
+// non-global TLB entry, so it is skipped when the directory is already live.
 void switch_page_directory(page_directory_t* dir) {
     if (!dir) return;
     
     current_page_directory = dir;
+    if (read_cr3() == (uint32_t)dir) return;
     uint32_t page_dir_phys = (uint32_t)dir;
     load_page_directory(page_dir_phys);
 }
 
 // Create a new page directory
 page_directory_t* create_page_directory(void) {
-    // Allocate memory for page directory
-    page_directory_t* dir = (page_directory_t*)kmalloc(sizeof(page_directory_t));
+    // Allocate memory for page directory (the CPU wants it page aligned)
+    page_directory_t* dir = (page_directory_t*)kmalloc_aligned(sizeof(page_directory_t), PAGE_SIZE);
     if (!dir) return NULL;
     
     // Clear the page directory
     memset(dir, 0, sizeof(page_directory_t));
     
+    // Every address space maps the kernel, heap included, at its identity
+    // address: four 4MB pages with PSE, global with PGE so their TLB entries
+    // survive the CR3 reload on every process switch
+    uint32_t kernel_flags = PAGE_PRESENT | PAGE_WRITABLE | PAGE_SHARED;
+    if (pge_enabled) kernel_flags |= PAGE_GLOBAL;
+    if (map_region(dir, 0, 0, FRAME_MEMORY_END, kernel_flags) != 0) {
+        destroy_page_directory(dir);
+        return NULL;
+    }
+    
     return dir;
 }
 
@@ -88,25 +121,233 @@ void destroy_page_directory(page_directory_t* dir) {
     
     // Free all page tables
     for (int i = 0; i < PAGE_DIRECTORY_SIZE; i++) {
-        if (dir->entries[i].present) {
+        if (dir->entries[i].present && dir->entries[i].page_size) {
+            if (!(dir->entries[i].available & 1)) {
+                free_huge_frame(dir->entries[i].page_table << 12);
+            }
+            mem_stats.huge_pages--;
+            mem_stats.used_pages -= HUGE_PAGE_FRAMES;
+        } else if (dir->entries[i].present) {
             uint32_t page_table_phys = dir->entries[i].page_table << 12;
             page_table_t* page_table = (page_table_t*)page_table_phys;
             
             // Free all pages in this table
             for (int j = 0; j < PAGE_ENTRIES; j++) {
-                if (page_table->entries[j].present) {
+                if (page_table->entries[j].present && !(page_table->entries[j].available & 1)) {
                     uint32_t page_phys = page_table->entries[j].page_frame << 12;
                     free_page_frame(page_phys);
                 }
             }
             
             // Free the page table itself
-            kfree(page_table);
+            kfree_aligned(page_table);
         }
     }
     
     // Free the page directory
-    kfree(dir);
+    kfree_aligned(dir);
+}
+
+// Raw entry mapping an address: the directory entry of a 4MB page or the
+// table entry of a 4KB one, NULL if no page table covers it. Directory and
+// table entries keep the bits used here (PAGE_*) in the same place.
+static uint32_t* lookup_entry(page_directory_t* dir, uint32_t virtual_addr, uint32_t* size) {
+    page_directory_entry_t* pde = &dir->entries[virtual_to_page_index(virtual_addr)];
+    if (!pde->present) return NULL;
+    if (pde->page_size) {
+        *size = HUGE_PAGE_SIZE;
+        return (uint32_t*)pde;
+    }
+    page_table_t* table = (page_table_t*)(pde->page_table << 12);
+    *size = PAGE_SIZE;
+    return (uint32_t*)&table->entries[virtual_to_table_index(virtual_addr)];
+}
+
+// A private copy of a frame (identity mapped), or 0 when out of memory
+static uint32_t copy_frame(uint32_t frame, uint32_t size) {
+    uint32_t copy = size == HUGE_PAGE_SIZE ? allocate_huge_frame() : allocate_page_frame();
+    if (copy) {
+        memcpy((void*)copy, (void*)frame, size);
+    }
+    return copy;
+}
+
+// Give a copy-on-write mapping a private, writable frame: copy it, or keep
+// it if every other sharer has already copied or gone. Two sharers breaking
+// together may both copy; the reference count still frees the original once.
+static bool break_cow(uint32_t* entry, uint32_t size, uint32_t virtual_addr) {
+    uint32_t frame = *entry & ~(size - 1);
+    uint32_t refs = frame_refs(frame);
+    if (refs == 1) {
+        mem_stats.cow_reused++;
+    } else {
+        uint32_t copy = copy_frame(frame, size);
+        if (!copy) return false;
+        
+        // Frames outside the allocator (refs == 0) are never freed here
+        if (refs) {
+            if (size == HUGE_PAGE_SIZE) {
+                free_huge_frame(frame);
+            } else {
+                free_page_frame(frame);
+            }
+        }
+        *entry = copy | (*entry & (size - 1));
+        mem_stats.cow_copies++;
+    }
+    *entry = (*entry & ~PAGE_COW) | PAGE_WRITABLE;
+    __asm__ volatile ("invlpg (%0)" : : "r" (virtual_addr) : "memory");
+    return true;
+}
+
+// The clone's view of one parent mapping. Private frames are shared with one
+// more reference and, if writable, made copy-on-write on both sides. Locked
+// frames must never fault in the parent, so the child gets its own copy now,
+// unlocked. Returns false when that copy cannot be allocated.
+static bool clone_entry(uint32_t* entry, uint32_t* child, uint32_t size) {
+    uint32_t frame = *entry & ~(size - 1);
+    if (*entry & PAGE_SHARED) {
+        *child = *entry;
+    } else if (*entry & PAGE_LOCKED) {
+        uint32_t copy = copy_frame(frame, size);
+        if (!copy) return false;
+        *child = copy | (*entry & (size - 1) & ~PAGE_LOCKED);
+    } else {
+        if (*entry & PAGE_WRITABLE) {
+            *entry = (*entry & ~PAGE_WRITABLE) | PAGE_COW;
+        }
+        frame_ref(frame);
+        mem_stats.cow_shared++;
+        *child = *entry;
+    }
+    return true;
+}
+
+page_directory_t* clone_page_directory(page_directory_t* src) {
+    if (!src) return NULL;
+    
+    page_directory_t* dir = (page_directory_t*)kmalloc_aligned(sizeof(page_directory_t), PAGE_SIZE);
+    if (!dir) return NULL;
+    memset(dir, 0, sizeof(page_directory_t));
+    
+    bool ok = true;
+    for (int i = 0; i < PAGE_DIRECTORY_SIZE && ok; i++) {
+        if (!src->entries[i].present) continue;
+        
+        if (src->entries[i].page_size) {
+            ok = clone_entry((uint32_t*)&src->entries[i], (uint32_t*)&dir->entries[i], HUGE_PAGE_SIZE);
+            if (ok) {
+                mem_stats.huge_pages++;
+                mem_stats.used_pages += HUGE_PAGE_FRAMES;
+            }
+            continue;
+        }
+        
+        page_table_t* copy = (page_table_t*)kmalloc_aligned(sizeof(page_table_t), PAGE_SIZE);
+        if (!copy) {
+            ok = false;
+            break;
+        }
+        memset(copy, 0, sizeof(page_table_t));
+        dir->entries[i] = src->entries[i];
+        dir->entries[i].page_table = (uint32_t)copy >> 12;
+        
+        page_table_t* table = (page_table_t*)(src->entries[i].page_table << 12);
+        for (int j = 0; j < PAGE_ENTRIES && ok; j++) {
+            if (!table->entries[j].present) continue;
+            ok = clone_entry((uint32_t*)&table->entries[j], (uint32_t*)&copy->entries[j], PAGE_SIZE);
+            if (ok) mem_stats.used_pages++;
+        }
+    }
+    
+    // The source lost write access to everything it shares: drop stale
+    // writable translations if it is the live address space
+    if ((read_cr0() & CR0_PG) && read_cr3() == (uint32_t)src) {
+        load_page_directory((uint32_t)src);
+    }
+    
+    if (!ok) {
+        // Frames shared so far lose their extra reference again; the
+        // parent's now read-only pages are reclaimed on its next write
+        destroy_page_directory(dir);
+        return NULL;
+    }
+    return dir;
+}
+
+int populate_region(page_directory_t* dir, uint32_t virtual_addr, uint32_t size, uint32_t flags) {
+    if (!dir || size == 0 || virtual_addr + size < virtual_addr) return -1;
+    
+    uint32_t end = virtual_addr + size;
+    virtual_addr = page_align_down(virtual_addr);
+    while (virtual_addr < end) {
+        uint32_t page = PAGE_SIZE;
+        uint32_t* entry = lookup_entry(dir, virtual_addr, &page);
+        if (!entry || !(*entry & PAGE_PRESENT)) {
+            // Not mapped yet: a zeroed private frame
+            uint32_t frame = allocate_page_frame();
+            if (!frame) return -1;
+            memset((void*)frame, 0, PAGE_SIZE);
+            if (map_page(dir, virtual_addr, frame, flags | PAGE_PRESENT) != 0) {
+                free_page_frame(frame);
+                return -1;
+            }
+        } else if (!(*entry & PAGE_SHARED)) {
+            // Mapped: take the copy a later write would have faulted for
+            if ((*entry & PAGE_COW) && (flags & PAGE_WRITABLE) &&
+                !break_cow(entry, page, virtual_addr)) {
+                return -1;
+            }
+            if (flags & PAGE_LOCKED) {
+                *entry |= PAGE_LOCKED;
+            }
+        }
+        virtual_addr = (virtual_addr & ~(page - 1)) + page;
+        if (virtual_addr == 0) break; // Wrapped past the top of memory
+    }
+    return 0;
+}
+
+int unlock_region(page_directory_t* dir, uint32_t virtual_addr, uint32_t size) {
+    if (!dir || size == 0 || virtual_addr + size < virtual_addr) return -1;
+    
+    uint32_t end = virtual_addr + size;
+    virtual_addr = page_align_down(virtual_addr);
+    while (virtual_addr < end) {
+        uint32_t page = PAGE_SIZE;
+        uint32_t* entry = lookup_entry(dir, virtual_addr, &page);
+        if (entry) {
+            *entry &= ~PAGE_LOCKED;
+        }
+        virtual_addr = (virtual_addr & ~(page - 1)) + page;
+        if (virtual_addr == 0) break;
+    }
+    return 0;
+}
+
+int lock_all_pages(page_directory_t* dir, bool lock) {
+    if (!dir) return -1;
+    
+    for (int i = 0; i < PAGE_DIRECTORY_SIZE; i++) {
+        if (!dir->entries[i].present) continue;
+        
+        uint32_t base = (uint32_t)i << 22;
+        uint32_t count = dir->entries[i].page_size ? 1 : PAGE_ENTRIES;
+        uint32_t page = dir->entries[i].page_size ? HUGE_PAGE_SIZE : PAGE_SIZE;
+        for (uint32_t j = 0; j < count; j++) {
+            uint32_t virtual_addr = base + j * PAGE_SIZE;
+            uint32_t* entry = lookup_entry(dir, virtual_addr, &page);
+            if (!(*entry & PAGE_PRESENT) || (*entry & PAGE_SHARED)) continue;
+            
+            if (!lock) {
+                *entry &= ~PAGE_LOCKED;
+                continue;
+            }
+            if ((*entry & PAGE_COW) && !break_cow(entry, page, virtual_addr)) return -1;
+            *entry |= PAGE_LOCKED;
+        }
+    }
+    return 0;
 }
 
 // Map a virtual address to a physical address
@@ -120,7 +361,7 @@ int map_page(page_directory_t* dir, uint32_t virtual_addr, uint32_t physical_add
     page_table_t* page_table;
     if (!dir->entries[page_dir_index].present) {
         // Allocate new page table
-        page_table = (page_table_t*)kmalloc(sizeof(page_table_t));
+        page_table = (page_table_t*)kmalloc_aligned(sizeof(page_table_t), PAGE_SIZE);
         if (!page_table) return -1;
         
         memset(page_table, 0, sizeof(page_table_t));
@@ -130,6 +371,8 @@ int map_page(page_directory_t* dir, uint32_t virtual_addr, uint32_t physical_add
         dir->entries[page_dir_index].writable = (flags & PAGE_WRITABLE) ? 1 : 0;
         dir->entries[page_dir_index].user = (flags & PAGE_USER) ? 1 : 0;
         dir->entries[page_dir_index].page_table = ((uint32_t)page_table) >> 12;
+    } else if (dir->entries[page_dir_index].page_size) {
+        return -1; // Covered by a 4MB page
     } else {
         page_table = (page_table_t*)(dir->entries[page_dir_index].page_table << 12);
     }
@@ -138,6 +381,8 @@ int map_page(page_directory_t* dir, uint32_t virtual_addr, uint32_t physical_add
     page_table->entries[page_table_index].present = (flags & PAGE_PRESENT) ? 1 : 0;
     page_table->entries[page_table_index].writable = (flags & PAGE_WRITABLE) ? 1 : 0;
     page_table->entries[page_table_index].user = (flags & PAGE_USER) ? 1 : 0;
+    page_table->entries[page_table_index].global = (flags & PAGE_GLOBAL) ? 1 : 0;
+    page_table->entries[page_table_index].available = (flags & (PAGE_SHARED | PAGE_COW | PAGE_LOCKED)) >> 9;
     page_table->entries[page_table_index].page_frame = physical_addr >> 12;
     
     // Update statistics
@@ -158,8 +403,8 @@ int unmap_page(page_directory_t* dir, uint32_t virtual_addr) {
     uint32_t page_dir_index = virtual_to_page_index(virtual_addr);
     uint32_t page_table_index = virtual_to_table_index(virtual_addr);
     
-    if (!dir->entries[page_dir_index].present) {
-        return -1; // Page table doesn't exist
+    if (!dir->entries[page_dir_index].present || dir->entries[page_dir_index].page_size) {
+        return -1; // No page table (4MB pages go through unmap_huge_page)
     }
     
     page_table_t* page_table = (page_table_t*)(dir->entries[page_dir_index].page_table << 12);
@@ -168,9 +413,11 @@ int unmap_page(page_directory_t* dir, uint32_t virtual_addr) {
         return -1; // Page not mapped
     }
     
-    // Free the physical page
+    // Free the physical page unless someone else owns it
     uint32_t physical_addr = page_table->entries[page_table_index].page_frame << 12;
-    free_page_frame(physical_addr);
+    if (!(page_table->entries[page_table_index].available & 1)) {
+        free_page_frame(physical_addr);
+    }
     
     // Clear page table entry
     page_table->entries[page_table_index].present = 0;
@@ -197,6 +444,11 @@ uint32_t get_physical_address(page_directory_t* dir, uint32_t virtual_addr) {
         return 0; // Page table doesn't exist
     }
     
+    if (dir->entries[page_dir_index].page_size) {
+        return ((dir->entries[page_dir_index].page_table << 12) & ~(HUGE_PAGE_SIZE - 1)) |
+               (virtual_addr & (HUGE_PAGE_SIZE - 1));
+    }
+    
     page_table_t* page_table = (page_table_t*)(dir->entries[page_dir_index].page_table << 12);
     
     if (!page_table->entries[page_table_index].present) {
@@ -206,39 +458,193 @@ uint32_t get_physical_address(page_directory_t* dir, uint32_t virtual_addr) {
     return (page_table->entries[page_table_index].page_frame << 12) | page_offset;
 }
 
-// Allocate a physical page frame
-uint32_t allocate_page_frame(void) {
-    if (free_page_frames) {
-        // Use a previously freed page
-        page_frame_t* frame = free_page_frames;
-        free_page_frames = frame->next;
-        uint32_t addr = frame->physical_addr;
-        kfree(frame);
-        mem_stats.free_pages--;
-        return addr;
+bool paging_huge_pages_available(void) {
+    return pse_enabled;
+}
+
+bool paging_global_pages_available(void) {
+    return pge_enabled;
+}
+
+void flush_tlb_all(void) {
+    uint32_t cr4 = read_cr4();
+    if (cr4 & CR4_PGE) {
+        write_cr4(cr4 & ~CR4_PGE);  // Toggling PGE drops global entries too
+        write_cr4(cr4);
+    } else {
+        load_page_directory(read_cr3());
     }
+}
+
+// Touch 'pages' kernel pages (global when PGE is on) right after a CR3
+// reload, and again after a full flush; the difference is what keeping
+// kernel translations across a process switch saves
+void paging_tlb_bench(uint32_t pages) {
+    if (!(read_cr0() & CR0_PG)) {
+        vga_write_string("Paging is off: no TLB misses to measure\n");
+        return;
+    }
+    // Pages 1 to 'pages': the last one below FRAME_MEMORY_END at most
+    if (pages > FRAME_MEMORY_END / PAGE_SIZE - 1) pages = FRAME_MEMORY_END / PAGE_SIZE - 1;
+    
+    uint64_t cycles[2] = { 0, 0 };
+    volatile uint8_t* base = (volatile uint8_t*)0;
+    uint32_t flags = irq_save();
+    for (uint32_t round = 0; round < TLB_BENCH_ROUNDS; round++) {
+        for (uint32_t full = 0; full < 2; full++) {
+            if (full) {
+                flush_tlb_all();
+            } else {
+                load_page_directory(read_cr3());
+            }
+            uint64_t start = rdtsc();
+            for (uint32_t i = 1; i <= pages; i++) {
+                (void)base[i * PAGE_SIZE];
+            }
+            cycles[full] += rdtsc() - start;
+        }
+    }
+    irq_restore(flags);
+    
+    vga_write_string("Touching ");
+    print_dec(pages);
+    vga_write_string(" kernel pages after a switch: CR3 reload ");
+    print_dec((uint32_t)div_u64_u32(cycles[0], TLB_BENCH_ROUNDS, NULL));
+    vga_write_string(" cycles, full flush ");
+    print_dec((uint32_t)div_u64_u32(cycles[1], TLB_BENCH_ROUNDS, NULL));
+    vga_write_string(" cycles");
+    vga_write_string(pge_enabled ? "\n" : " (no PGE: both flush everything)\n");
+}
+
+// Map one 4MB page
+int map_huge_page(page_directory_t* dir, uint32_t virtual_addr, uint32_t physical_addr, uint32_t flags) {
+    if (!dir || !pse_enabled) return -1;
+    if ((virtual_addr | physical_addr) & (HUGE_PAGE_SIZE - 1)) return -1;
+    
+    page_directory_entry_t* entry = &dir->entries[virtual_to_page_index(virtual_addr)];
+    if (entry->present) return -1; // Page table or huge page already there
+    
+    entry->writable = (flags & PAGE_WRITABLE) ? 1 : 0;
+    entry->user = (flags & PAGE_USER) ? 1 : 0;
+    entry->page_size = 1;
+    entry->global = (flags & PAGE_GLOBAL) ? 1 : 0;
+    entry->available = (flags & (PAGE_SHARED | PAGE_COW | PAGE_LOCKED)) >> 9;
+    entry->page_table = physical_addr >> 12;
+    entry->present = (flags & PAGE_PRESENT) ? 1 : 0;
+    
+    mem_stats.huge_pages++;
+    mem_stats.used_pages += HUGE_PAGE_FRAMES;
+    if (flags & PAGE_USER) {
+        mem_stats.user_pages += HUGE_PAGE_FRAMES;
+    } else {
+        mem_stats.kernel_pages += HUGE_PAGE_FRAMES;
+    }
+    return 0;
+}
+
+// Unmap a 4MB page and free its frame (unless PAGE_SHARED)
+int unmap_huge_page(page_directory_t* dir, uint32_t virtual_addr) {
+    if (!dir) return -1;
     
-    // Allocate a new page frame
-    if (next_page_frame + PAGE_SIZE > max_memory) {
-        return 0; // Out of memory
+    page_directory_entry_t* entry = &dir->entries[virtual_to_page_index(virtual_addr)];
+    if (!entry->present || !entry->page_size) return -1;
+    
+    if (!(entry->available & 1)) {
+        free_huge_frame(entry->page_table << 12);
     }
+    entry->available = 0;
+    entry->present = 0;
+    entry->page_size = 0;
+    entry->page_table = 0;
     
-    uint32_t addr = next_page_frame;
-    next_page_frame += PAGE_SIZE;
-    mem_stats.free_pages--;
-    return addr;
+    mem_stats.huge_pages--;
+    mem_stats.used_pages -= HUGE_PAGE_FRAMES;
+    
+    // One invlpg drops the whole 4MB translation
+    __asm__ volatile ("invlpg (%0)" : : "r" (virtual_addr) : "memory");
+    return 0;
 }
 
-// Free a physical page frame
-void free_page_frame(uint32_t physical_addr) {
-    page_frame_t* frame = (page_frame_t*)kmalloc(sizeof(page_frame_t));
-    if (!frame) return;
+int map_region(page_directory_t* dir, uint32_t virtual_addr, uint32_t physical_addr,
+               uint32_t size, uint32_t flags) {
+    if (!dir) return -1;
+    
+    uint32_t end = page_align_up(virtual_addr + size);
+    virtual_addr = page_align_down(virtual_addr);
+    physical_addr = page_align_down(physical_addr);
+    while (virtual_addr < end) {
+        bool huge = pse_enabled && !((virtual_addr | physical_addr) & (HUGE_PAGE_SIZE - 1)) &&
+                    end - virtual_addr >= HUGE_PAGE_SIZE &&
+                    !dir->entries[virtual_to_page_index(virtual_addr)].present;
+        if (huge) {
+            if (map_huge_page(dir, virtual_addr, physical_addr, flags) != 0) return -1;
+            virtual_addr += HUGE_PAGE_SIZE;
+            physical_addr += HUGE_PAGE_SIZE;
+        } else {
+            if (map_page(dir, virtual_addr, physical_addr, flags) != 0) return -1;
+            virtual_addr += PAGE_SIZE;
+            physical_addr += PAGE_SIZE;
+        }
+    }
+    return 0;
+}
+
+void unmap_region(page_directory_t* dir, uint32_t virtual_addr, uint32_t size) {
+    if (!dir) return;
     
-    frame->physical_addr = physical_addr;
-    frame->ref_count = 0;
-    frame->next = free_page_frames;
-    free_page_frames = frame;
-    mem_stats.free_pages++;
+    uint32_t end = page_align_up(virtual_addr + size);
+    virtual_addr = page_align_down(virtual_addr);
+    while (virtual_addr < end) {
+        page_directory_entry_t* entry = &dir->entries[virtual_to_page_index(virtual_addr)];
+        if (entry->present && entry->page_size) {
+            uint32_t huge_addr = virtual_addr & ~(HUGE_PAGE_SIZE - 1);
+            unmap_huge_page(dir, huge_addr);
+            virtual_addr = huge_addr + HUGE_PAGE_SIZE;
+        } else {
+            unmap_page(dir, virtual_addr);
+            virtual_addr += PAGE_SIZE;
+        }
+    }
+}
+
+// Allocate a physical page frame
+uint32_t allocate_page_frame(void) {
+    return frame_alloc();
+}
+
+// Drop a reference to a physical page frame, freeing it with the last
+void free_page_frame(uint32_t physical_addr) {
+    if (frame_unref(physical_addr)) {
+        frame_free(physical_addr);
+    }
+}
+
+uint32_t allocate_huge_frame(void) {
+    uint32_t addr = frame_alloc_pages(frame_order(HUGE_PAGE_SIZE));
+    if (addr) __sync_fetch_and_add(&mem_stats.huge_frames, 1);
+    return addr;
+}
+
+void free_huge_frame(uint32_t physical_addr) {
+    if (frame_unref(physical_addr)) {
+        frame_free_pages(physical_addr, frame_order(HUGE_PAGE_SIZE));
+        __sync_fetch_and_sub(&mem_stats.huge_frames, 1);
+    }
+}
+
+uint32_t allocate_region(uint32_t size) {
+    if (size == 0) return 0;
+    if (page_align_up(size) == HUGE_PAGE_SIZE) return allocate_huge_frame();
+    return frame_alloc_pages(frame_order(size)); // Beyond 4MB the order check fails
+}
+
+void free_region(uint32_t physical_addr, uint32_t size) {
+    if (!physical_addr || size == 0) return;
+    if (page_align_up(size) == HUGE_PAGE_SIZE) {
+        free_huge_frame(physical_addr);
+    } else {
+        frame_free_pages(physical_addr, frame_order(size));
+    }
 }
 
 // Set page permissions
@@ -252,6 +658,14 @@ int set_page_permissions(page_directory_t* dir, uint32_t virtual_addr, uint32_t
         return -1; // Page table doesn't exist
     }
     
+    if (dir->entries[page_dir_index].page_size) {
+        // A 4MB page carries its permissions in the directory entry
+        dir->entries[page_dir_index].writable = (flags & PAGE_WRITABLE) ? 1 : 0;
+        dir->entries[page_dir_index].user = (flags & PAGE_USER) ? 1 : 0;
+        __asm__ volatile ("invlpg (%0)" : : "r" (virtual_addr) : "memory");
+        return 0;
+    }
+    
     page_table_t* page_table = (page_table_t*)(dir->entries[page_dir_index].page_table << 12);
     
     if (!page_table->entries[page_table_index].present) {
@@ -279,6 +693,12 @@ int is_page_accessible(page_directory_t* dir, uint32_t virtual_addr, uint32_t re
         return 0; // Page table doesn't exist
     }
     
+    if (dir->entries[page_dir_index].page_size) {
+        if ((required_flags & PAGE_WRITABLE) && !dir->entries[page_dir_index].writable) return 0;
+        if ((required_flags & PAGE_USER) && !dir->entries[page_dir_index].user) return 0;
+        return 1;
+    }
+    
     page_table_t* page_table = (page_table_t*)(dir->entries[page_dir_index].page_table << 12);
     
     if (!page_table->entries[page_table_index].present) {
@@ -300,6 +720,23 @@ int is_page_accessible(page_directory_t* dir, uint32_t virtual_addr, uint32_t re
 // Page fault handler
 void page_fault_handler(uint32_t error_code, uint32_t virtual_addr) {
     mem_stats.page_faults++;
+    if (current_process) {
+        current_process->page_faults++;
+        if (current_process->mlock_flags) {
+            current_process->mlock_faults++; // Broke the mlockall guarantee
+        }
+    }
+    
+    // Write to a present copy-on-write page (after fork)
+    if ((error_code & 0x3) == 0x3) {
+        uint32_t size = PAGE_SIZE;
+        uint32_t* entry = lookup_entry((page_directory_t*)(read_cr3() & ~0xFFF), virtual_addr, &size);
+        if (entry && (*entry & (PAGE_PRESENT | PAGE_COW)) == (PAGE_PRESENT | PAGE_COW) &&
+            break_cow(entry, size, virtual_addr)) {
+            mem_stats.page_fault_resolved++;
+            return;
+        }
+    }
     
     vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
     vga_write_string("Page fault at address: 0x");
@@ -341,20 +778,41 @@ void page_fault_handler(uint32_t error_code, uint32_t virtual_addr) {
     
     // For now, halt the system on page fault
     vga_write_string("System halted due to page fault\n");
+    vga_flush();
     __asm__ volatile ("hlt");
 }
 
 // Get memory statistics
 void get_memory_stats(memory_stats_t* stats) {
     if (stats) {
+        frame_stats_t frames;
+        frame_get_stats(&frames);
+        mem_stats.free_pages = frames.free_frames;
         *stats = mem_stats;
     }
 }
 
 // Print memory statistics
 void print_memory_stats(void) {
+    frame_print_info();
+    
     vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
     vga_write_string("=== Virtual Memory Statistics ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("Huge pages (4MB): ");
+    vga_write_string(pse_enabled ? "PSE on" : "no PSE");
+    vga_write_string(pge_enabled ? ", global kernel pages" : ", no PGE");
+    vga_write_string("  Frames in use: ");
+    print_dec(mem_stats.huge_frames);
+    vga_write_string("  Mapped: ");
+    print_dec(mem_stats.huge_pages);
+    vga_write_string("\nCopy-on-write: shared ");
+    print_dec(mem_stats.cow_shared);
+    vga_write_string("  copied ");
+    print_dec(mem_stats.cow_copies);
+    vga_write_string("  reused ");
+    print_dec(mem_stats.cow_reused);
+    vga_write_string("\n");
     
     if (kernel_page_directory == NULL) {
         vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
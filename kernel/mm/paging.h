@@ -7,6 +7,8 @@
 #define PAGE_SIZE           4096
 #define PAGE_ENTRIES        1024
 #define PAGE_DIRECTORY_SIZE 1024
+#define HUGE_PAGE_SIZE      0x400000    // One page directory entry with PSE
+#define HUGE_PAGE_FRAMES    (HUGE_PAGE_SIZE / PAGE_SIZE)
 
 // Virtual memory layout (32-bit addresses)
 #define KERNEL_VIRTUAL_BASE     0xC0000000  // 3GB - kernel space starts here
@@ -24,6 +26,9 @@
 #define PAGE_DIRTY      0x040  // Page has been written to
 #define PAGE_SIZE_4MB   0x080  // 4MB page (when PSE is enabled)
 #define PAGE_GLOBAL     0x100  // Global page (when PGE is enabled)
+#define PAGE_SHARED     0x200  // OS bit: frame owned elsewhere, not freed on unmap
+#define PAGE_COW        0x400  // OS bit: read-only until written, then copied
+#define PAGE_LOCKED     0x800  // OS bit: resident and private, never faults (mlock)
 
 // Page directory and page table entry structures
 typedef struct page_directory_entry {
@@ -63,13 +68,6 @@ typedef struct page_table {
     page_table_entry_t entries[PAGE_ENTRIES];
 } __attribute__((aligned(PAGE_SIZE))) page_table_t;
 
-// Physical page frame allocator
-typedef struct page_frame {
-    uint32_t physical_addr;
-    uint32_t ref_count;
-    struct page_frame* next;
-} page_frame_t;
-
 // Memory statistics
 typedef struct memory_stats {
     uint32_t total_pages;
@@ -79,10 +77,16 @@ typedef struct memory_stats {
     uint32_t user_pages;
     uint32_t page_faults;
     uint32_t page_fault_resolved;
+    uint32_t huge_pages;            // 4MB mappings in place
+    uint32_t huge_frames;           // 4MB frames allocated
+    uint32_t cow_shared;            // Frames shared copy-on-write by fork
+    uint32_t cow_copies;            // Write faults that copied a shared frame
+    uint32_t cow_reused;            // Write faults on a frame no one else held
 } memory_stats_t;
 
 // Function prototypes
 void paging_init(void);
+void paging_init_cpu(void);         // CR4.PSE/PGE on this CPU (APs at bring-up)
 void enable_paging(void);
 void switch_page_directory(page_directory_t* dir);
 
@@ -90,14 +94,59 @@ void switch_page_directory(page_directory_t* dir);
 page_directory_t* create_page_directory(void);
 void destroy_page_directory(page_directory_t* dir);
 
+// Copy-on-write clone for fork: the copy gets its own page tables, but every
+// private frame is shared with one more reference and write access removed
+// on both sides (PAGE_COW); the first write from either side gets a private
+// copy in page_fault_handler. PAGE_SHARED mappings stay shared and writable.
+// Costs one page table per table in use, whatever the memory behind it.
+page_directory_t* clone_page_directory(page_directory_t* src);
+
+// Memory locking (mlock). populate_region maps every missing page in the
+// range to a zeroed frame with 'flags', and for pages already mapped takes
+// now the private copy a write would fault for (copy-on-write, when 'flags'
+// has PAGE_WRITABLE). With PAGE_LOCKED the pages also stay private across
+// fork: the child gets an eager copy instead of sharing, so the locked side
+// never faults. lock_all_pages does the same for everything mapped
+// (PAGE_SHARED mappings never fault and are left alone), or unlocks it all.
+// Return -1 when out of memory; pages done so far stay done.
+int populate_region(page_directory_t* dir, uint32_t virtual_addr, uint32_t size, uint32_t flags);
+int unlock_region(page_directory_t* dir, uint32_t virtual_addr, uint32_t size);
+int lock_all_pages(page_directory_t* dir, bool lock);
+
 // Virtual memory mapping
 int map_page(page_directory_t* dir, uint32_t virtual_addr, uint32_t physical_addr, uint32_t flags);
 int unmap_page(page_directory_t* dir, uint32_t virtual_addr);
 uint32_t get_physical_address(page_directory_t* dir, uint32_t virtual_addr);
 
-// Page frame allocation
+// 4MB pages (CR4.PSE). Both addresses must be 4MB aligned and the directory
+// slot unused; unmap_huge_page frees the frame like unmap_page does, unless
+// it was mapped PAGE_SHARED.
+bool paging_huge_pages_available(void);
+bool paging_global_pages_available(void);   // PGE: kernel mappings are PAGE_GLOBAL
+int map_huge_page(page_directory_t* dir, uint32_t virtual_addr, uint32_t physical_addr, uint32_t flags);
+int unmap_huge_page(page_directory_t* dir, uint32_t virtual_addr);
+
+// Map a physically contiguous range, with 4MB pages wherever both sides are
+// 4MB aligned and a whole huge page remains, 4KB pages elsewhere
+int map_region(page_directory_t* dir, uint32_t virtual_addr, uint32_t physical_addr,
+               uint32_t size, uint32_t flags);
+
+// Undo map_region: 4MB pages go whole, frames are freed as by unmap_page
+// (not PAGE_SHARED ones); holes are skipped
+void unmap_region(page_directory_t* dir, uint32_t virtual_addr, uint32_t size);
+
+// Page frame allocation (single frames from the buddy allocator, frame.h).
+// The free functions drop one reference; the frame goes back with the last.
 uint32_t allocate_page_frame(void);
 void free_page_frame(uint32_t physical_addr);
+uint32_t allocate_huge_frame(void);         // 4MB, 4MB aligned, or 0
+void free_huge_frame(uint32_t physical_addr);
+
+// Physically contiguous memory for large buffers: request sizes of 4MB come
+// back as a huge frame, so map_region gives them a single TLB entry.
+// Returns 0 when no block that large is free (4MB at most).
+uint32_t allocate_region(uint32_t size);
+void free_region(uint32_t physical_addr, uint32_t size);
 
 // Memory protection
 int set_page_permissions(page_directory_t* dir, uint32_t virtual_addr, uint32_t flags);
@@ -106,6 +155,13 @@ int is_page_accessible(page_directory_t* dir, uint32_t virtual_addr, uint32_t re
 // Page fault handling
 void page_fault_handler(uint32_t error_code, uint32_t virtual_addr);
 
+// TLB maintenance. CR3 reloads keep PAGE_GLOBAL entries; flush_tlb_all
+// drops them too, for changes to kernel mappings.
+#define TLB_BENCH_PAGES     256
+#define TLB_BENCH_ROUNDS    64
+void flush_tlb_all(void);
+void paging_tlb_bench(uint32_t pages);
+
 // Memory statistics and debugging
 void get_memory_stats(memory_stats_t* stats);
 void print_memory_stats(void);
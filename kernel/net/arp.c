@@ -0,0 +1,364 @@
+#include "arp.h"
+#include "ip.h"
+#include "pbuf.h"
+#include "../mm/memory.h"
+#include "../arch/spinlock.h"
+#include "../proc/process.h"
+#include "../proc/timer.h"
+#include "../drivers/vga.h"
+
+static arp_entry_t entries[ARP_ENTRIES];
+static arp_entry_t* buckets[ARP_BUCKETS];
+static arp_entry_t* free_entries;
+static spinlock_t arp_lock = SPINLOCK_INIT;
+static ktimer_t scan_timer;
+static arp_stats_t arp_stats;
+static bool arp_ready;
+
+static const mac_addr_t broadcast_mac = {{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}};
+
+// Requests the scan puts out once the lock is dropped
+typedef struct {
+    ipv4_addr_t ip;
+    mac_addr_t mac;
+    bool unicast;
+} arp_probe_t;
+
+static void arp_scan(void* data);
+
+static inline uint32_t arp_hash(const ipv4_addr_t* ip) {
+    uint32_t key = (uint32_t)ip->addr[0] | (uint32_t)ip->addr[1] << 8 |
+                   (uint32_t)ip->addr[2] << 16 | (uint32_t)ip->addr[3] << 24;
+    return (key * 0x9E3779B1u) >> 26;   // Top 6 bits: ARP_BUCKETS
+}
+
+int arp_init(void) {
+    if (arp_ready) return NET_SUCCESS;
+
+    free_entries = NULL;
+    for (int i = ARP_ENTRIES - 1; i >= 0; i--) {
+        entries[i].state = ARP_STATE_FREE;
+        entries[i].next = free_entries;
+        free_entries = &entries[i];
+    }
+    memset(buckets, 0, sizeof(buckets));
+    memset(&arp_stats, 0, sizeof(arp_stats));
+    arp_ready = true;
+
+    timer_setup(&scan_timer, arp_scan, NULL);
+    timer_arm(&scan_timer, get_current_time_ms() + ARP_SCAN_MS);
+    return NET_SUCCESS;
+}
+
+// Lock held for the rest of these
+static arp_entry_t* arp_find(const ipv4_addr_t* ip) {
+    for (arp_entry_t* e = buckets[arp_hash(ip)]; e; e = e->next) {
+        if (memcmp(&e->ip, ip, sizeof(ipv4_addr_t)) == 0) return e;
+    }
+    return NULL;
+}
+
+static void arp_unlink(arp_entry_t* entry) {
+    arp_entry_t** link = &buckets[arp_hash(&entry->ip)];
+    while (*link && *link != entry) {
+        link = &(*link)->next;
+    }
+    if (*link) *link = entry->next;
+    entry->state = ARP_STATE_FREE;
+    entry->next = free_entries;
+    free_entries = entry;
+    arp_stats.entries--;
+}
+
+// A fresh entry for ip, taking over the longest unconfirmed dynamic one
+// when none is free; NULL with every entry static
+static arp_entry_t* arp_new(const ipv4_addr_t* ip) {
+    if (!free_entries) {
+        uint32_t now = get_current_time_ms();
+        arp_entry_t* victim = NULL;
+        uint32_t oldest = 0;
+        for (uint32_t i = 0; i < ARP_ENTRIES; i++) {
+            arp_entry_t* e = &entries[i];
+            if (e->state == ARP_STATE_STATIC) continue;
+            uint32_t since = e->state == ARP_STATE_INCOMPLETE ? e->probed_ms : e->confirmed_ms;
+            if (!victim || now - since > oldest) {
+                victim = e;
+                oldest = now - since;
+            }
+        }
+        if (!victim) return NULL;
+        arp_unlink(victim);
+        arp_stats.evicted++;
+    }
+
+    arp_entry_t* entry = free_entries;
+    free_entries = entry->next;
+    memset(entry, 0, sizeof(*entry));
+    entry->ip = *ip;
+    uint32_t bucket = arp_hash(ip);
+    entry->next = buckets[bucket];
+    buckets[bucket] = entry;
+    arp_stats.entries++;
+    return entry;
+}
+
+static void arp_confirm(arp_entry_t* entry, const mac_addr_t* mac) {
+    entry->mac = *mac;
+    entry->state = ARP_STATE_REACHABLE;
+    entry->probes = 0;
+    entry->used = false;
+    entry->confirmed_ms = get_current_time_ms();
+}
+
+// A frame of our own, no lock held: a request (broadcast, or straight to a
+// host being refreshed) or a reply
+static void arp_send(uint16_t op, const ipv4_addr_t* target_ip, const mac_addr_t* target_mac,
+                     bool unicast) {
+    net_interface_t* iface = net_get_interface();
+    if (!iface) return;
+    pbuf_t* p = pbuf_alloc(PBUF_FRAME_OFFSET);
+    if (!p) return;
+
+    eth_header_t* eth = (eth_header_t*)pbuf_put(p, sizeof(eth_header_t) + sizeof(arp_packet_t));
+    arp_packet_t* arp = (arp_packet_t*)(eth + 1);
+    eth->dst_mac = unicast ? *target_mac : broadcast_mac;
+    eth->src_mac = iface->mac_addr;
+    eth->ethertype = net_htons(ETH_TYPE_ARP);
+
+    arp->htype = net_htons(ARP_HTYPE_ETHERNET);
+    arp->ptype = net_htons(ETH_TYPE_IP);
+    arp->hlen = sizeof(mac_addr_t);
+    arp->plen = sizeof(ipv4_addr_t);
+    arp->oper = net_htons(op);
+    arp->sha = iface->mac_addr;
+    arp->spa = *ipv4_get_our_address();
+    if (op == ARP_OP_REPLY) {
+        arp->tha = *target_mac;
+    } else {
+        memset(&arp->tha, 0, sizeof(mac_addr_t));
+    }
+    arp->tpa = *target_ip;
+
+    if (op == ARP_OP_REPLY) {
+        __sync_fetch_and_add(&arp_stats.replies_sent, 1);
+    } else {
+        __sync_fetch_and_add(&arp_stats.requests_sent, 1);
+    }
+    net_send_pbuf(p, 0, PBUF_CSUM_NONE);
+}
+
+bool arp_lookup(const ipv4_addr_t* ip, mac_addr_t* mac) {
+    if (!arp_ready) return false;
+
+    bool ask = false;
+    uint32_t flags = spin_lock_irqsave(&arp_lock);
+    arp_entry_t* entry = arp_find(ip);
+    if (entry && entry->state >= ARP_STATE_REACHABLE) {
+        *mac = entry->mac;
+        entry->used = true;
+        arp_stats.hits++;
+        spin_unlock_irqrestore(&arp_lock, flags);
+        return true;
+    }
+    arp_stats.misses++;
+    if (!entry) {
+        // The scan retries it from here
+        entry = arp_new(ip);
+        if (entry) {
+            entry->state = ARP_STATE_INCOMPLETE;
+            entry->probes = 1;
+            entry->probed_ms = get_current_time_ms();
+            ask = true;
+        }
+    }
+    spin_unlock_irqrestore(&arp_lock, flags);
+
+    if (ask) arp_send(ARP_OP_REQUEST, ip, NULL, false);
+    return false;
+}
+
+void arp_learn(const ipv4_addr_t* ip, const mac_addr_t* mac) {
+    if (!arp_ready || ipv4_is_multicast(ip) || ipv4_is_our_address(ip) || (mac->addr[0] & 1)) return;
+
+    uint32_t flags = spin_lock_irqsave(&arp_lock);
+    arp_entry_t* entry = arp_find(ip);
+    if (!entry) entry = arp_new(ip);
+    if (entry && entry->state != ARP_STATE_STATIC) {
+        arp_confirm(entry, mac);
+    }
+    spin_unlock_irqrestore(&arp_lock, flags);
+}
+
+int arp_add_static(const ipv4_addr_t* ip, const mac_addr_t* mac) {
+    if (!arp_ready || !ip || !mac || (mac->addr[0] & 1)) return NET_INVALID;
+
+    uint32_t flags = spin_lock_irqsave(&arp_lock);
+    arp_entry_t* entry = arp_find(ip);
+    if (!entry) entry = arp_new(ip);
+    if (entry) {
+        arp_confirm(entry, mac);
+        entry->state = ARP_STATE_STATIC;
+    }
+    spin_unlock_irqrestore(&arp_lock, flags);
+    return entry ? NET_SUCCESS : NET_NO_MEMORY;
+}
+
+int arp_remove(const ipv4_addr_t* ip) {
+    if (!arp_ready) return NET_ERROR;
+
+    uint32_t flags = spin_lock_irqsave(&arp_lock);
+    arp_entry_t* entry = arp_find(ip);
+    if (entry) arp_unlink(entry);
+    spin_unlock_irqrestore(&arp_lock, flags);
+    return entry ? NET_SUCCESS : NET_ERROR;
+}
+
+void arp_handle_packet(const void* packet, uint32_t len) {
+    const arp_packet_t* arp = (const arp_packet_t*)packet;
+    if (!arp_ready || len < sizeof(arp_packet_t) ||
+        net_ntohs(arp->htype) != ARP_HTYPE_ETHERNET || net_ntohs(arp->ptype) != ETH_TYPE_IP ||
+        arp->hlen != sizeof(mac_addr_t) || arp->plen != sizeof(ipv4_addr_t)) {
+        return;
+    }
+    uint16_t op = net_ntohs(arp->oper);
+    bool for_us = ipv4_is_our_address(&arp->tpa);
+    bool has_sender = (arp->spa.addr[0] | arp->spa.addr[1] | arp->spa.addr[2] | arp->spa.addr[3]) != 0 &&
+                      !(arp->sha.addr[0] & 1) && !ipv4_is_our_address(&arp->spa);
+
+    uint32_t flags = spin_lock_irqsave(&arp_lock);
+    if (op == ARP_OP_REQUEST) {
+        arp_stats.requests_received++;
+    } else if (op == ARP_OP_REPLY) {
+        arp_stats.replies_received++;
+    }
+    if (has_sender) {
+        // RFC 826: update a sender we know; add it only if it talks to us
+        arp_entry_t* entry = arp_find(&arp->spa);
+        if (!entry && for_us) entry = arp_new(&arp->spa);
+        if (entry && entry->state == ARP_STATE_STATIC) {
+            if (memcmp(&entry->mac, &arp->sha, sizeof(mac_addr_t)) != 0) arp_stats.conflicts++;
+        } else if (entry) {
+            arp_confirm(entry, &arp->sha);
+        }
+    }
+    spin_unlock_irqrestore(&arp_lock, flags);
+
+    if (op == ARP_OP_REQUEST && for_us && has_sender) {
+        arp_send(ARP_OP_REPLY, &arp->spa, &arp->sha, true);
+    }
+}
+
+// Timer wheel, every ARP_SCAN_MS: unanswered requests retried or given up,
+// entries in use asked again before they run out, the rest aged out
+static void arp_scan(void* data) {
+    (void)data;
+    static arp_probe_t probes[ARP_ENTRIES];     // Timer callbacks run on one CPU
+    uint32_t count = 0;
+    uint32_t now = get_current_time_ms();
+
+    uint32_t flags = spin_lock_irqsave(&arp_lock);
+    for (uint32_t i = 0; i < ARP_ENTRIES; i++) {
+        arp_entry_t* e = &entries[i];
+        if (e->state == ARP_STATE_FREE || e->state == ARP_STATE_STATIC) continue;
+
+        if (e->state == ARP_STATE_INCOMPLETE) {
+            if (now - e->probed_ms < ARP_RETRY_MS) continue;
+            if (e->probes >= ARP_MAX_PROBES) {
+                arp_unlink(e);
+                arp_stats.expired++;
+                continue;
+            }
+            probes[count++] = (arp_probe_t){e->ip, e->mac, false};
+        } else {
+            uint32_t age = now - e->confirmed_ms;
+            if (age >= ARP_LIFETIME_MS) {
+                arp_unlink(e);
+                arp_stats.expired++;
+                continue;
+            }
+            if (!e->used || age < ARP_REFRESH_MS || now - e->probed_ms < ARP_RETRY_MS) continue;
+            // Straight to the address we have; its answer renews the entry
+            probes[count++] = (arp_probe_t){e->ip, e->mac, true};
+            arp_stats.refreshes++;
+        }
+        e->probes++;
+        e->probed_ms = now;
+    }
+    spin_unlock_irqrestore(&arp_lock, flags);
+
+    for (uint32_t i = 0; i < count; i++) {
+        arp_send(ARP_OP_REQUEST, &probes[i].ip, &probes[i].mac, probes[i].unicast);
+    }
+    timer_arm(&scan_timer, now + ARP_SCAN_MS);
+}
+
+void arp_get_stats(arp_stats_t* stats) {
+    if (!stats) return;
+    uint32_t flags = spin_lock_irqsave(&arp_lock);
+    *stats = arp_stats;
+    spin_unlock_irqrestore(&arp_lock, flags);
+}
+
+void arp_print_info(void) {
+    static const char* const state_names[] = {"free", "incomplete", "reachable", "static"};
+    arp_stats_t stats;
+    arp_get_stats(&stats);
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== ARP Cache ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    // A copy, so the screen is not written with the lock held
+    static arp_entry_t snapshot[ARP_ENTRIES];
+    uint32_t count = 0;
+    uint32_t now = get_current_time_ms();
+    uint32_t flags = spin_lock_irqsave(&arp_lock);
+    for (uint32_t i = 0; i < ARP_ENTRIES; i++) {
+        if (entries[i].state != ARP_STATE_FREE) snapshot[count++] = entries[i];
+    }
+    spin_unlock_irqrestore(&arp_lock, flags);
+
+    for (uint32_t i = 0; i < count; i++) {
+        const arp_entry_t* e = &snapshot[i];
+        for (int b = 0; b < 4; b++) {
+            if (b) vga_write_string(".");
+            print_dec(e->ip.addr[b]);
+        }
+        vga_write_string("  ");
+        vga_write_string(e->state == ARP_STATE_INCOMPLETE ? "--:--:--:--:--:--" : net_mac_to_string(&e->mac));
+        vga_write_string("  ");
+        vga_write_string(state_names[e->state]);
+        if (e->state == ARP_STATE_REACHABLE) {
+            vga_write_string(", ");
+            print_dec((now - e->confirmed_ms) / 1000);
+            vga_write_string(" s old");
+        }
+        vga_write_string("\n");
+    }
+
+    vga_write_string("Entries: ");
+    print_dec(stats.entries);
+    vga_write_string("/");
+    print_dec(ARP_ENTRIES);
+    vga_write_string("  Hits: ");
+    print_dec(stats.hits);
+    vga_write_string("  Misses: ");
+    print_dec(stats.misses);
+    vga_write_string("\nRequests: ");
+    print_dec(stats.requests_sent);
+    vga_write_string(" sent, ");
+    print_dec(stats.requests_received);
+    vga_write_string(" received  Replies: ");
+    print_dec(stats.replies_sent);
+    vga_write_string(" sent, ");
+    print_dec(stats.replies_received);
+    vga_write_string(" received\nRefreshes: ");
+    print_dec(stats.refreshes);
+    vga_write_string("  Expired: ");
+    print_dec(stats.expired);
+    vga_write_string("  Evicted: ");
+    print_dec(stats.evicted);
+    vga_write_string("  Static conflicts: ");
+    print_dec(stats.conflicts);
+    vga_write_string("\n");
+}
@@ -0,0 +1,95 @@
+#ifndef ARP_H
+#define ARP_H
+
+#include "net.h"
+
+// Address resolution (RFC 826) for the IPv4 interface. The neighbour cache
+// is ARP_ENTRIES entries hashed over ARP_BUCKETS chains by address.
+//
+// A lookup never waits. A miss returns false at once (the IP layer sends
+// that packet to the broadcast address) and puts out a request, retried
+// every ARP_RETRY_MS up to ARP_MAX_PROBES times. An answer, or any frame
+// from the host, makes the entry good for ARP_LIFETIME_MS. A scan every
+// ARP_SCAN_MS asks hosts in use again, directly, once their entry is
+// ARP_REFRESH_MS old, so an address being sent to is renewed before it
+// runs out; an entry nobody looked up is left to expire.
+//
+// Static entries (the exchange's next hops) are pinned: never expired,
+// evicted or overwritten by what arrives on the wire, so nothing on the
+// order path ever depends on an answer. A reply contradicting one is
+// counted as a conflict.
+#define ARP_ENTRIES             64
+#define ARP_BUCKETS             64          // Power of 2
+#define ARP_LIFETIME_MS         60000
+#define ARP_REFRESH_MS          45000       // Age from which a used entry is asked again
+#define ARP_RETRY_MS            1000
+#define ARP_MAX_PROBES          3
+#define ARP_SCAN_MS             500
+
+#define ARP_HTYPE_ETHERNET      1
+#define ARP_OP_REQUEST          1
+#define ARP_OP_REPLY            2
+
+typedef struct {
+    uint16_t htype;
+    uint16_t ptype;
+    uint8_t hlen;
+    uint8_t plen;
+    uint16_t oper;
+    mac_addr_t sha;             // Sender
+    ipv4_addr_t spa;
+    mac_addr_t tha;             // Target
+    ipv4_addr_t tpa;
+} __attribute__((packed)) arp_packet_t;
+
+// arp_entry_t.state
+#define ARP_STATE_FREE          0
+#define ARP_STATE_INCOMPLETE    1           // Asked, no answer yet
+#define ARP_STATE_REACHABLE     2
+#define ARP_STATE_STATIC        3
+
+typedef struct arp_entry {
+    ipv4_addr_t ip;
+    mac_addr_t mac;
+    uint8_t state;
+    uint8_t probes;             // Requests since the last answer
+    bool used;                  // Looked up since the last answer
+    uint32_t confirmed_ms;      // Last heard from
+    uint32_t probed_ms;         // Last asked
+    struct arp_entry* next;     // Bucket chain, or free list
+} arp_entry_t;
+
+typedef struct {
+    uint32_t entries;           // In use, static ones included
+    uint32_t hits;
+    uint32_t misses;            // Lookups answered "broadcast"
+    uint32_t requests_sent;
+    uint32_t requests_received;
+    uint32_t replies_sent;
+    uint32_t replies_received;
+    uint32_t refreshes;         // Direct requests before expiry
+    uint32_t expired;           // Aged out or never answered
+    uint32_t evicted;           // Replaced with the cache full
+    uint32_t conflicts;         // Replies contradicting a static entry
+} arp_stats_t;
+
+int arp_init(void);
+
+// The link address for an IPv4 host on the subnet: true with *mac filled
+// in, false while it is not known (a request is on its way)
+bool arp_lookup(const ipv4_addr_t* ip, mac_addr_t* mac);
+
+// The host was heard from at that address (an IP packet from it)
+void arp_learn(const ipv4_addr_t* ip, const mac_addr_t* mac);
+
+// Pinned entries; add replaces whatever the cache had for the address
+int arp_add_static(const ipv4_addr_t* ip, const mac_addr_t* mac);
+int arp_remove(const ipv4_addr_t* ip);
+
+// An ARP frame's payload, from the receive pass
+void arp_handle_packet(const void* packet, uint32_t len);
+
+void arp_get_stats(arp_stats_t* stats);
+void arp_print_info(void);
+
+#endif // ARP_H
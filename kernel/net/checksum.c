@@ -0,0 +1,120 @@
+#include "checksum.h"
+#include "../arch/fpu.h"
+
+typedef uint32_t __attribute__((may_alias)) csum_word_t;
+typedef uint16_t __attribute__((may_alias)) csum_half_t;
+
+// 'blocks' 32-byte blocks in one carry chain: dec and lea leave the carry
+// alone, so it is only folded in once at the end
+static uint32_t csum_blocks(const uint8_t* data, uint32_t blocks, uint32_t sum) {
+    __asm__ volatile (
+        "clc\n\t"
+        "1:\n\t"
+        "adcl (%1), %0\n\t"
+        "adcl 4(%1), %0\n\t"
+        "adcl 8(%1), %0\n\t"
+        "adcl 12(%1), %0\n\t"
+        "adcl 16(%1), %0\n\t"
+        "adcl 20(%1), %0\n\t"
+        "adcl 24(%1), %0\n\t"
+        "adcl 28(%1), %0\n\t"
+        "lea 32(%1), %1\n\t"
+        "decl %2\n\t"
+        "jnz 1b\n\t"
+        "adcl $0, %0"
+        : "+r"(sum), "+r"(data), "+r"(blocks)
+        :
+        : "memory", "cc");
+    return sum;
+}
+
+// 'blocks' 64-byte blocks, inside fpu_kernel_begin: every 16-bit word
+// widened into a 32-bit lane and added there, the lanes summed at the end.
+// A lane takes 8 words per block, so CSUM_SSE_CHUNK keeps it from overflowing.
+__attribute__((target("sse2")))
+static uint32_t csum_blocks_sse2(const uint8_t* data, uint32_t blocks) {
+    uint32_t lanes[4];
+    __asm__ volatile (
+        "pxor %%xmm0, %%xmm0\n\t"
+        "pxor %%xmm1, %%xmm1\n\t"
+        "pxor %%xmm2, %%xmm2\n\t"
+        "1:\n\t"
+        "movdqu (%0), %%xmm3\n\t"
+        "movdqu 16(%0), %%xmm4\n\t"
+        "movdqa %%xmm3, %%xmm5\n\t"
+        "movdqa %%xmm4, %%xmm6\n\t"
+        "punpcklwd %%xmm0, %%xmm3\n\t"
+        "punpckhwd %%xmm0, %%xmm5\n\t"
+        "punpcklwd %%xmm0, %%xmm4\n\t"
+        "punpckhwd %%xmm0, %%xmm6\n\t"
+        "paddd %%xmm3, %%xmm1\n\t"
+        "paddd %%xmm5, %%xmm2\n\t"
+        "paddd %%xmm4, %%xmm1\n\t"
+        "paddd %%xmm6, %%xmm2\n\t"
+        "movdqu 32(%0), %%xmm3\n\t"
+        "movdqu 48(%0), %%xmm4\n\t"
+        "movdqa %%xmm3, %%xmm5\n\t"
+        "movdqa %%xmm4, %%xmm6\n\t"
+        "punpcklwd %%xmm0, %%xmm3\n\t"
+        "punpckhwd %%xmm0, %%xmm5\n\t"
+        "punpcklwd %%xmm0, %%xmm4\n\t"
+        "punpckhwd %%xmm0, %%xmm6\n\t"
+        "paddd %%xmm3, %%xmm1\n\t"
+        "paddd %%xmm5, %%xmm2\n\t"
+        "paddd %%xmm4, %%xmm1\n\t"
+        "paddd %%xmm6, %%xmm2\n\t"
+        "add $64, %0\n\t"
+        "decl %1\n\t"
+        "jnz 1b\n\t"
+        "paddd %%xmm2, %%xmm1\n\t"
+        "movdqu %%xmm1, (%2)"
+        : "+r"(data), "+r"(blocks)
+        : "r"(lanes)
+        : "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6");
+
+    uint32_t sum = csum_add(lanes[0], lanes[1]);
+    sum = csum_add(sum, lanes[2]);
+    return csum_add(sum, lanes[3]);
+}
+
+uint32_t csum_partial(const void* data, uint32_t len, uint32_t sum) {
+    const uint8_t* bytes = (const uint8_t*)data;
+
+    if (len >= CSUM_SSE_MIN) {
+        while (len >= 64) {
+            uint32_t flags;
+            if (!fpu_kernel_begin(&flags)) break;
+            uint32_t chunk = len < CSUM_SSE_CHUNK ? len & ~63u : CSUM_SSE_CHUNK;
+            sum = csum_add(sum, csum_blocks_sse2(bytes, chunk / 64));
+            fpu_kernel_end(flags);
+            bytes += chunk;
+            len -= chunk;
+        }
+    }
+    if (len >= 32) {
+        sum = csum_blocks(bytes, len / 32, sum);
+        bytes += len & ~31u;
+        len &= 31;
+    }
+    while (len >= 4) {
+        sum = csum_add(sum, *(const csum_word_t*)bytes);
+        bytes += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        sum = csum_add(sum, *(const csum_half_t*)bytes);
+        bytes += 2;
+        len -= 2;
+    }
+    if (len) {
+        sum = csum_add(sum, *bytes);   // Padded with a zero byte
+    }
+    return sum;
+}
+
+void csum_replace(uint16_t* check, const void* old, const void* new_data, uint32_t len, uint32_t offset) {
+    // csum_fold of the old bytes' sum is its one's complement: ~m
+    uint32_t sum = csum_add((uint16_t)~*check, csum_fold(csum_shift(csum_partial(old, len, 0), offset)));
+    sum = csum_add(sum, csum_shift(csum_partial(new_data, len, 0), offset));
+    *check = csum_fold(sum);
+}
@@ -0,0 +1,71 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include "../types.h"
+
+// Internet checksum (RFC 1071). A partial sum is 32 bits with every carry
+// folded back in, so partial sums add with csum_add and fold down to the
+// 16-bit field with csum_fold. Words are summed in memory order, as they
+// sit in the packet: the one's complement sum comes out the same in either
+// byte order, so nothing is swapped on the way.
+//
+// csum_partial adds 32 bytes per iteration in one chain of add-with-carry,
+// and from CSUM_SSE_MIN bytes spreads 16-bit words over the 32-bit lanes of
+// XMM registers (inside fpu_kernel_begin, CSUM_SSE_CHUNK at a time, so
+// interrupts are never off for long and no lane can overflow).
+//
+// A field changed in a packet whose checksum is known is accounted for
+// without a pass over the rest (RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m')).
+#define CSUM_SSE_MIN            1024
+#define CSUM_SSE_CHUNK          4096        // Multiple of 64
+
+uint32_t csum_partial(const void* data, uint32_t len, uint32_t sum);
+
+static inline uint32_t csum_add(uint32_t sum, uint32_t addend) {
+    sum += addend;
+    return sum + (sum < addend);
+}
+
+// Sum of bytes that start 'offset' bytes into the summed data: at an odd
+// offset they land in the other half of their words, the byte swap of
+// their sum
+static inline uint32_t csum_shift(uint32_t sum, uint32_t offset) {
+    if (!(offset & 1)) return sum;
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return ((sum & 0xFF) << 8) | (sum >> 8);
+}
+
+// The checksum field for a sum: folded and complemented
+static inline uint16_t csum_fold(uint32_t sum) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+// TCP/UDP pseudo-header: addresses as they sit in the IP header, the
+// segment length in host order
+static inline uint32_t csum_pseudo(const void* src_ip, const void* dst_ip, uint8_t protocol, uint16_t len) {
+    const uint8_t* src = (const uint8_t*)src_ip;
+    const uint8_t* dst = (const uint8_t*)dst_ip;
+    uint32_t sum = csum_add((uint32_t)src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24,
+                            (uint32_t)dst[0] | (uint32_t)dst[1] << 8 | (uint32_t)dst[2] << 16 | (uint32_t)dst[3] << 24);
+    // Zero and protocol bytes, then the length in network order
+    uint16_t length = (uint16_t)((len >> 8) | (len << 8));
+    return csum_add(sum, ((uint32_t)length << 16) | ((uint32_t)protocol << 8));
+}
+
+// Incremental updates of a checksum field: a 16 or 32-bit field (as it
+// sits in the packet) changed from old to new ...
+static inline void csum_replace2(uint16_t* check, uint16_t old, uint16_t new_value) {
+    *check = csum_fold((uint32_t)(uint16_t)~*check + (uint16_t)~old + new_value);
+}
+
+static inline void csum_replace4(uint16_t* check, uint32_t old, uint32_t new_value) {
+    *check = csum_fold(csum_add(csum_add((uint16_t)~*check, ~old), new_value));
+}
+
+// ... or a run of len bytes, 'offset' bytes into the checksummed data
+void csum_replace(uint16_t* check, const void* old, const void* new_data, uint32_t len, uint32_t offset);
+
+#endif // CHECKSUM_H
@@ -1,9 +1,30 @@
 #include "eth.h"
+#include "ip.h"
+#include "nicmap.h"
+#include "pbuf.h"
+#include "arp.h"
 #include "../mm/memory.h"
+#include "../arch/tsc.h"
+#include "../arch/smp.h"
+#include "../arch/interrupts.h"
+#include "../mm/frame.h"
 #include "../drivers/vga.h"
+#include "../proc/process.h"
+#include "../proc/scheduler.h"
+#include "../proc/futex.h"
+
+#define RTL8139_RX_NONE     0xFFFFFFFF
 
 // Global RTL8139 device
 static rtl8139_device_t rtl8139_dev;
+static net_interface_t rtl8139_iface;
+static net_interface_t* net_iface;
+
+static void rtl8139_rx_start(void);
+static void rtl8139_rx_give_back(void);
+static bool rtl8139_rx_pending(void);
+static void rtl8139_rx_poll_task(void);
+static void rtl8139_rx_irq_pass(void);
 
 // Initialize RTL8139 Ethernet controller
 int rtl8139_init(uint16_t io_base) {
@@ -12,15 +33,22 @@ int rtl8139_init(uint16_t io_base) {
     rtl8139_dev.io_base = io_base;
     rtl8139_dev.initialized = 0;
 
-    // Allocate RX and TX buffers
-    rtl8139_dev.rx_buffer = (uint8_t*)kmalloc(RTL8139_RX_BUFFER_SIZE);
-    rtl8139_dev.tx_buffer = (uint8_t*)kmalloc(RTL8139_TX_BUFFER_SIZE);
+    // Allocate RX and TX buffers: the card DMAs into them, so they come
+    // physically contiguous from the frame allocator
+    rtl8139_dev.rx_buffer = (uint8_t*)frame_alloc_pages(frame_order(RTL8139_RX_ALLOC_SIZE));
+    rtl8139_dev.tx_buffer = (uint8_t*)frame_alloc_pages(frame_order(RTL8139_TX_BUFFER_SIZE * RTL8139_TX_SLOTS));
 
     if (!rtl8139_dev.rx_buffer || !rtl8139_dev.tx_buffer) {
         vga_write_string("Failed to allocate RTL8139 buffers\n");
         return NET_ERROR;
     }
 
+    // Nothing answers at the port: no card
+    if (rtl8139_read8(RTL8139_CR) == 0xFF) {
+        vga_write_string("No RTL8139 found\n");
+        return NET_ERROR;
+    }
+
     // Reset the device
     rtl8139_write8(RTL8139_CR, RTL8139_CR_RST);
     while (rtl8139_read8(RTL8139_CR) & RTL8139_CR_RST) {
@@ -37,82 +65,578 @@ int rtl8139_init(uint16_t io_base) {
     vga_write_string(mac_str);
     vga_write_string("\n");
 
-    // Set receive buffer
-    rtl8139_write32(RTL8139_RBSTART, (uint32_t)rtl8139_dev.rx_buffer);
-
-    // Configure receive buffer
-    rtl8139_write32(RTL8139_RCR, 0x0000000F); // Accept all packets
+    // No groups until the first join programs the filter
+    rtl8139_write32(RTL8139_MAR0, 0);
+    rtl8139_write32(RTL8139_MAR0 + 4, 0);
 
     // Enable transmitter and receiver
-    rtl8139_write8(RTL8139_CR, RTL8139_CR_RE | RTL8139_CR_TE);
+    rtl8139_rx_start();
 
     // Configure transmit configuration
     rtl8139_write32(RTL8139_TCR, 0x00000300); // Max DMA burst size
 
     rtl8139_dev.rx_buffer_pos = 0;
+    rtl8139_dev.rx_current = RTL8139_RX_NONE;
+    rtl8139_dev.hold_head = rtl8139_dev.hold_tail = 0;
+    rtl8139_dev.hold_done = rtl8139_dev.hold_stale = 0;
+    spin_lock_init(&rtl8139_dev.rx_lock);
     rtl8139_dev.tx_buffer_pos = 0;
+    rtl8139_dev.tx_next = 0;
+    rtl8139_dev.tx_busy = 0;
+    memset(rtl8139_dev.tx_pbuf, 0, sizeof(rtl8139_dev.tx_pbuf));
+    rtl8139_dev.tx_frames = rtl8139_dev.tx_completed = rtl8139_dev.tx_errors = 0;
+    rtl8139_dev.tx_full_waits = 0;
+    spin_lock_init(&rtl8139_dev.tx_lock);
+    spin_lock_init(&rtl8139_dev.rx_pass_lock);
+    rtl8139_dev.rx_polling = 0;
+    rtl8139_dev.rx_busy = 0;
+    memset(&rtl8139_dev.rx_stats, 0, sizeof(rtl8139_rx_stats_t));
+
+    process_t* poller = process_create("rtl8139_rx", rtl8139_rx_poll_task, PRIORITY_HIGH);
+    if (poller) scheduler_add_process(poller);
+    rtl8139_dev.rx_poll_task = poller != NULL;
     rtl8139_dev.initialized = 1;
 
+    rtl8139_iface.mac_addr = rtl8139_dev.mac_addr;
+    strcpy(rtl8139_iface.name, "eth0");
+    rtl8139_iface.mtu = ETH_MTU;
+    rtl8139_iface.send_packet = rtl8139_send_packet;
+    rtl8139_iface.send_pbuf = rtl8139_send_pbuf;
+    rtl8139_iface.recv_packet = rtl8139_recv_packet;
+    rtl8139_iface.rx_busy = rtl8139_rx_busy;
+    rtl8139_iface.rx_poll = rtl8139_rx_poll;
+    rtl8139_iface.set_multicast = rtl8139_set_multicast;
+    net_register_interface(&rtl8139_iface);
+
+    // Receive starts in interrupt mode
+    rtl8139_write16(RTL8139_ISR, 0xFFFF);
+    rtl8139_write16(RTL8139_IMR, RTL8139_RX_INTERRUPTS | RTL8139_TX_INTERRUPTS);
+
     vga_write_string("RTL8139 Ethernet controller initialized\n");
     return NET_SUCCESS;
 }
 
 // Send a packet
 int rtl8139_send_packet(const void* data, uint32_t len) {
-    if (!rtl8139_dev.initialized || len > ETH_MTU) {
+    if (!rtl8139_dev.initialized || len > ETH_MTU + ETH_HEADER_SIZE) {
         return NET_ERROR;
     }
 
-    // Wait for previous transmission to complete
-    while (!(rtl8139_read32(RTL8139_TSD0) & (1 << 15))) {
-        // Wait for TOK (Transmit OK)
+    // The card sends the descriptors in turn; each has its own buffer
+    int slot = rtl8139_tx_reserve();
+    uint8_t* buffer = rtl8139_dev.tx_buffer + slot * RTL8139_TX_BUFFER_SIZE;
+    memcpy(buffer, data, len);
+    rtl8139_tx_start(slot, buffer, len);
+
+    return NET_SUCCESS;
+}
+
+// Send from the pbuf itself, kept until the slot is reaped; the card
+// takes only dword-aligned buffers, anything else is copied
+int rtl8139_send_pbuf(pbuf_t* p, uint16_t csum_start, uint16_t csum_offset) {
+    (void)csum_start;
+    (void)csum_offset;         // No offload: always finished by now
+    if (((uint32_t)p->data & 3) || !rtl8139_dev.initialized || p->len > ETH_MTU + ETH_HEADER_SIZE) {
+        int result = rtl8139_send_packet(p->data, p->len);
+        pbuf_free(p);
+        return result;
     }
 
-    // Copy packet to TX buffer
-    memcpy(rtl8139_dev.tx_buffer, data, len);
+    int slot = rtl8139_tx_reserve();
+    rtl8139_dev.tx_pbuf[slot] = p;     // Before the busy bit a reaper looks at
+    rtl8139_tx_start(slot, p->data, p->len);
+    return NET_SUCCESS;
+}
 
-    // Set transmit start address
-    rtl8139_write32(RTL8139_TSAD0, (uint32_t)rtl8139_dev.tx_buffer);
+// Take back the slots the card has finished with; any context
+static void rtl8139_tx_reap(void) {
+    uint32_t busy = rtl8139_dev.tx_busy;
+    while (busy) {
+        int slot = __builtin_ctz(busy);
+        busy &= busy - 1;
+        uint32_t tsd = rtl8139_read32(RTL8139_TSD0 + slot * 4);
+        if (!(tsd & RTL8139_TSD_OWN)) continue;
+
+        // Another context may have reaped it first
+        if (__sync_fetch_and_and(&rtl8139_dev.tx_busy, ~(1u << slot)) & (1u << slot)) {
+            if ((tsd & RTL8139_TSD_TOK) && !(tsd & (RTL8139_TSD_TUN | RTL8139_TSD_TABT))) {
+                __sync_fetch_and_add(&rtl8139_dev.tx_completed, 1);
+            } else {
+                __sync_fetch_and_add(&rtl8139_dev.tx_errors, 1);
+            }
+            pbuf_t* p = rtl8139_dev.tx_pbuf[slot];
+            if (p) {
+                rtl8139_dev.tx_pbuf[slot] = NULL;
+                pbuf_free(p);
+            }
+        }
+    }
+}
 
-    // Set transmit status descriptor (size and ownership)
-    rtl8139_write32(RTL8139_TSD0, len);
+int rtl8139_tx_reserve(void) {
+    if (!rtl8139_dev.initialized) {
+        return -1;
+    }
 
-    return NET_SUCCESS;
+    uint32_t flags = spin_lock_irqsave(&rtl8139_dev.tx_lock);
+    int slot = (int)rtl8139_dev.tx_next;
+    if (rtl8139_dev.tx_busy & (1u << slot)) {
+        // All four in flight: wait for the oldest to reach the wire
+        rtl8139_dev.tx_full_waits++;
+        while (rtl8139_dev.tx_busy & (1u << slot)) {
+            rtl8139_tx_reap();
+        }
+    }
+    rtl8139_dev.tx_next = (slot + 1) % RTL8139_TX_SLOTS;
+    spin_unlock_irqrestore(&rtl8139_dev.tx_lock, flags);
+    return slot;
+}
+
+void rtl8139_tx_start(int slot, const void* frame, uint32_t len) {
+    rtl8139_write32(RTL8139_TSAD0 + slot * 4, (uint32_t)frame);
+    __sync_fetch_and_or(&rtl8139_dev.tx_busy, 1u << slot);
+    __sync_fetch_and_add(&rtl8139_dev.tx_frames, 1);
+    rtl8139_write32(RTL8139_TSD0 + slot * 4, len);      // Clears OWN: the card takes it
+}
+
+// Receive ring at RBSTART, read from its start: our address, broadcast
+// and the groups joined; with WRAP the card runs a frame on past the end
+// of the ring instead of wrapping it, so every frame is contiguous
+static void rtl8139_rx_start(void) {
+    rtl8139_write32(RTL8139_RBSTART, (uint32_t)rtl8139_dev.rx_buffer);
+    rtl8139_write32(RTL8139_RCR, RTL8139_RCR_APM | RTL8139_RCR_AM | RTL8139_RCR_AB | RTL8139_RCR_WRAP |
+                    RTL8139_RCR_RBLEN_32K);
+    rtl8139_write8(RTL8139_CR, RTL8139_CR_RE | RTL8139_CR_TE);
+}
+
+// Restart the receiver at the start of an empty ring, after a header that
+// cannot be one or an overflow; rx_pass_lock held. What is in the ring is
+// lost, frames still held with it: their space goes back to the card and
+// their tokens stay stale, not handed out again, until released.
+static void rtl8139_rx_reset(void) {
+    rtl8139_write8(RTL8139_CR, RTL8139_CR_TE);
+    uint32_t flags = spin_lock_irqsave(&rtl8139_dev.rx_lock);
+    for (uint32_t i = rtl8139_dev.hold_head; i != rtl8139_dev.hold_tail; i++) {
+        uint64_t bit = 1ull << (i % RTL8139_RX_HOLDS);
+        if (!(rtl8139_dev.hold_done & bit)) rtl8139_dev.hold_stale |= bit;
+    }
+    rtl8139_dev.hold_done = 0;
+    rtl8139_dev.hold_head = rtl8139_dev.hold_tail;
+    rtl8139_dev.rx_buffer_pos = 0;
+    rtl8139_rx_start();
+    rtl8139_rx_give_back();
+    spin_unlock_irqrestore(&rtl8139_dev.rx_lock, flags);
+    rtl8139_dev.rx_stats.resets++;
 }
 
-// Receive a packet
+// The frame at the read position: its receive header, or NULL with the
+// card's header reporting an error or out of step with the ring, which
+// resets the receiver
+static const uint16_t* rtl8139_rx_frame(uint16_t* length) {
+    const uint16_t* header = (const uint16_t*)(rtl8139_dev.rx_buffer + rtl8139_dev.rx_buffer_pos);
+    uint16_t status = header[0];
+    *length = header[1];                // Frame and CRC
+    if (!(status & RTL8139_RX_ROK) || *length < ETH_HEADER_SIZE + 4 || *length > ETH_MTU + 22) {
+        rtl8139_dev.rx_stats.errors++;
+        rtl8139_rx_reset();
+        return NULL;
+    }
+    return header;
+}
+
+// Past the frame: its header and the frame, to the next dword
+static void rtl8139_rx_advance(uint16_t length) {
+    uint32_t rx_pos = (rtl8139_dev.rx_buffer_pos + length + 4 + 3) & ~3u;
+    uint32_t flags = spin_lock_irqsave(&rtl8139_dev.rx_lock);
+    rtl8139_dev.rx_buffer_pos = rx_pos % RTL8139_RX_RING_SIZE;
+    rtl8139_rx_give_back();
+    spin_unlock_irqrestore(&rtl8139_dev.rx_lock, flags);
+}
+
+// Copy out the next frame without its CRC, for callers outside the stack;
+// nothing while the polling task or busy pollers have the ring
 int rtl8139_recv_packet(void* buffer, uint32_t len) {
     if (!rtl8139_dev.initialized) {
         return NET_ERROR;
     }
 
-    // Check if packet is available
-    uint16_t status = rtl8139_read16(RTL8139_ISR);
-    if (!(status & RTL8139_ISR_ROK)) {
-        return 0; // No packet available
+    uint32_t flags = spin_lock_irqsave(&rtl8139_dev.rx_pass_lock);
+    int result = 0;
+    uint16_t length;
+    const uint16_t* header;
+    if (!load_acquire(&rtl8139_dev.rx_polling) && !rtl8139_dev.rx_busy &&
+        rtl8139_rx_pending() && (header = rtl8139_rx_frame(&length))) {
+        if (length - 4u > len) {
+            result = NET_ERROR;         // Buffer too small; the frame stays
+        } else {
+            memcpy(buffer, header + 2, length - 4);
+            rtl8139_rx_advance(length);
+            result = length - 4;
+        }
+    }
+    spin_unlock_irqrestore(&rtl8139_dev.rx_pass_lock, flags);
+    return result;
+}
+
+// The card has space back up to the oldest frame still lent out, or all
+// of it up to the read position; rx_lock held
+static void rtl8139_rx_give_back(void) {
+    while (rtl8139_dev.hold_head != rtl8139_dev.hold_tail) {
+        uint64_t bit = 1ull << (rtl8139_dev.hold_head % RTL8139_RX_HOLDS);
+        if (!(rtl8139_dev.hold_done & bit)) break;
+        rtl8139_dev.hold_done &= ~bit;
+        rtl8139_dev.hold_head++;
+    }
+    uint32_t pos = rtl8139_dev.hold_head != rtl8139_dev.hold_tail ?
+                   rtl8139_dev.hold_start[rtl8139_dev.hold_head % RTL8139_RX_HOLDS] : rtl8139_dev.rx_buffer_pos;
+    rtl8139_write16(RTL8139_CAPR, pos - 16);
+}
+
+// With frames held, CAPR trails the read position and the card's empty
+// flag no longer says whether frames are waiting: compare with its write
+// position instead
+static bool rtl8139_rx_pending(void) {
+    if (rtl8139_dev.hold_head == rtl8139_dev.hold_tail) {
+        return !(rtl8139_read8(RTL8139_CR) & RTL8139_CR_BUFE);
+    }
+    return rtl8139_dev.rx_buffer_pos != rtl8139_read16(RTL8139_CBR) % RTL8139_RX_RING_SIZE;
+}
+
+// Hand each received frame to the stack where the card put it, then give
+// its space back to the card unless the stack kept it. An overflow the
+// interrupt left latched resets the receiver first.
+uint32_t rtl8139_rx_dispatch(uint32_t budget) {
+    if (rtl8139_read16(RTL8139_ISR) & RTL8139_ISR_RXOVW) {
+        rtl8139_write16(RTL8139_ISR, RTL8139_ISR_RXOVW);
+        rtl8139_rx_reset();
+    }
+
+    uint32_t frames = 0;
+    uint16_t length;
+    const uint16_t* header;
+    while (frames < budget && rtl8139_rx_pending() && (header = rtl8139_rx_frame(&length))) {
+        rtl8139_dev.rx_current = rtl8139_dev.rx_buffer_pos;
+        rtl8139_dev.rx_current_len = length;
+        net_receive(header + 2, length - 4, rdtsc(), false);
+        rtl8139_dev.rx_current = RTL8139_RX_NONE;
+        rtl8139_rx_advance(length);
+        frames++;
+    }
+
+    rtl8139_dev.rx_stats.frames += frames;
+    if (frames > rtl8139_dev.rx_stats.max_pass) rtl8139_dev.rx_stats.max_pass = frames;
+    return frames;
+}
+
+// Receive interrupts on only with neither the task nor a busy poller on
+// the ring (rx_pass_lock held)
+static void rtl8139_rx_arm(void) {
+    bool masked = rtl8139_dev.rx_polling || rtl8139_dev.rx_busy;
+    rtl8139_write16(RTL8139_IMR, masked ? RTL8139_TX_INTERRUPTS : RTL8139_RX_INTERRUPTS | RTL8139_TX_INTERRUPTS);
+}
+
+// A pass as the interrupt takes it (rx_pass_lock held): a full budget
+// hands the ring to the polling task
+static void rtl8139_rx_irq_pass(void) {
+    // Without the task the ring is drained here, whatever the load
+    uint32_t budget = rtl8139_dev.rx_poll_task ? RTL8139_RX_BUDGET : 0xFFFFFFFF;
+    if (rtl8139_rx_pending()) {
+        irq_note_delivery(irq_current(), irq_entry_tsc());
+    }
+    if (rtl8139_rx_dispatch(budget) == budget) {
+        rtl8139_dev.rx_stats.to_polling++;
+        store_release(&rtl8139_dev.rx_polling, 1);
+        rtl8139_rx_arm();
+        futex_wake(&rtl8139_dev.rx_polling, 1);
+    }
+}
+
+// Waits with receive interrupts on; passes with them masked
+static void rtl8139_rx_poll_task(void) {
+    for (;;) {
+        while (!load_acquire(&rtl8139_dev.rx_polling)) {
+            futex_wait(&rtl8139_dev.rx_polling, 0, FUTEX_WAIT_FOREVER);
+        }
+
+        uint32_t flags = spin_lock_irqsave(&rtl8139_dev.rx_pass_lock);
+        rtl8139_write16(RTL8139_ISR, RTL8139_RX_INTERRUPTS);
+        rtl8139_dev.rx_stats.polls++;
+        bool drained = rtl8139_rx_dispatch(RTL8139_RX_BUDGET) < RTL8139_RX_BUDGET;
+        if (drained) {
+            // Back to interrupts, or to the busy pollers while there are any
+            store_release(&rtl8139_dev.rx_polling, 0);
+            rtl8139_dev.rx_stats.to_interrupts++;
+            rtl8139_rx_arm();
+        }
+        spin_unlock_irqrestore(&rtl8139_dev.rx_pass_lock, flags);
+
+        if (!drained) scheduler_yield();
+    }
+}
+
+void rtl8139_rx_busy(bool on) {
+    if (!rtl8139_dev.initialized) return;
+
+    uint32_t flags = spin_lock_irqsave(&rtl8139_dev.rx_pass_lock);
+    if (on) {
+        if (rtl8139_dev.rx_busy++ == 0) rtl8139_rx_arm();
+    } else if (rtl8139_dev.rx_busy && --rtl8139_dev.rx_busy == 0 && !rtl8139_dev.rx_polling) {
+        // Acknowledge, then take what landed since the last pass: a frame
+        // arriving after that raises the interrupt once it is unmasked
+        rtl8139_write16(RTL8139_ISR, RTL8139_RX_INTERRUPTS);
+        rtl8139_rx_irq_pass();
+        rtl8139_rx_arm();
+    }
+    spin_unlock_irqrestore(&rtl8139_dev.rx_pass_lock, flags);
+}
+
+// Skips the pass when another holds the ring: its frames are being taken
+uint32_t rtl8139_rx_poll(uint32_t budget) {
+    uint32_t flags = irq_save();
+    if (!spin_trylock(&rtl8139_dev.rx_pass_lock)) {
+        irq_restore(flags);
+        return 0;
+    }
+    uint32_t frames = rtl8139_dev.initialized ? rtl8139_rx_dispatch(budget) : 0;
+    if (frames) rtl8139_dev.rx_stats.busy_passes++;
+    spin_unlock_irqrestore(&rtl8139_dev.rx_pass_lock, flags);
+    return frames;
+}
+
+int rtl8139_rx_hold(void) {
+    if (rtl8139_dev.rx_current == RTL8139_RX_NONE) return -1;
+
+    uint32_t flags = spin_lock_irqsave(&rtl8139_dev.rx_lock);
+    int token = -1;
+    uint32_t oldest = rtl8139_dev.hold_head != rtl8139_dev.hold_tail ?
+                      rtl8139_dev.hold_start[rtl8139_dev.hold_head % RTL8139_RX_HOLDS] : rtl8139_dev.rx_current;
+    uint32_t span = (rtl8139_dev.rx_current - oldest) % RTL8139_RX_RING_SIZE + rtl8139_dev.rx_current_len + 4;
+    uint64_t next = 1ull << (rtl8139_dev.hold_tail % RTL8139_RX_HOLDS);
+    if (rtl8139_dev.hold_tail - rtl8139_dev.hold_head < RTL8139_RX_HOLDS && span <= RTL8139_RX_HOLD_SPAN &&
+        !(rtl8139_dev.hold_stale & next)) {
+        token = (int)(rtl8139_dev.hold_tail++ % RTL8139_RX_HOLDS);
+        rtl8139_dev.hold_start[token] = rtl8139_dev.rx_current;
+        rtl8139_dev.hold_done &= ~(1ull << token);
+    } else {
+        rtl8139_dev.holds_refused++;
     }
+    spin_unlock_irqrestore(&rtl8139_dev.rx_lock, flags);
+    return token;
+}
 
-    // Get packet size
-    uint32_t packet_size = rtl8139_read16(RTL8139_CBR);
+void rtl8139_rx_release(int token) {
+    if (token < 0 || token >= RTL8139_RX_HOLDS) return;
 
-    if (packet_size > len) {
-        return NET_ERROR; // Buffer too small
+    uint32_t flags = spin_lock_irqsave(&rtl8139_dev.rx_lock);
+    uint64_t bit = 1ull << token;
+    if (rtl8139_dev.hold_stale & bit) {
+        rtl8139_dev.hold_stale &= ~bit;         // Held across a reset
+    } else {
+        rtl8139_dev.hold_done |= bit;
+        rtl8139_rx_give_back();
     }
+    spin_unlock_irqrestore(&rtl8139_dev.rx_lock, flags);
+}
 
-    // Copy packet from RX buffer
-    uint32_t rx_pos = rtl8139_dev.rx_buffer_pos;
-    memcpy(buffer, rtl8139_dev.rx_buffer + rx_pos, packet_size);
+void net_register_interface(net_interface_t* iface) {
+    net_iface = iface;
+}
 
-    // Update buffer position
-    rtl8139_dev.rx_buffer_pos = (rx_pos + packet_size + 4) % RTL8139_RX_BUFFER_SIZE;
+net_interface_t* net_get_interface(void) {
+    return net_iface;
+}
+
+int net_send_frame(const void* data, uint32_t len) {
+    net_interface_t* iface = net_iface;
+    return iface && iface->send_packet ? iface->send_packet(data, len) : NET_ERROR;
+}
 
-    // Update CAPR (Current Address of Packet Read)
-    rtl8139_write16(RTL8139_CAPR, rtl8139_dev.rx_buffer_pos - 16);
+int net_set_multicast(const mac_addr_t* macs, uint32_t count) {
+    net_interface_t* iface = net_iface;
+    return iface && iface->set_multicast ? iface->set_multicast(macs, count) : NET_SUCCESS;
+}
 
-    // Clear interrupt
-    rtl8139_write16(RTL8139_ISR, RTL8139_ISR_ROK);
+int net_send_pbuf(pbuf_t* p, uint16_t csum_start, uint16_t csum_offset) {
+    net_interface_t* iface = net_iface;
+    if (!iface || (csum_offset != PBUF_CSUM_NONE && csum_start + csum_offset + 2u > p->len)) {
+        pbuf_free(p);
+        return NET_ERROR;
+    }
+
+    bool offload = (iface->offloads & NET_OFFLOAD_TX_CSUM) &&
+                   (iface->send_pbuf || iface->send_packet_csum);
+    if (csum_offset != PBUF_CSUM_NONE && !offload) {
+        // The field already carries the pseudo-header; 0 means none to UDP
+        uint8_t* segment = p->data + csum_start;
+        uint16_t checksum = csum_fold(csum_partial(segment, p->len - csum_start, 0));
+        *(uint16_t*)(segment + csum_offset) = checksum ? checksum : 0xFFFF;
+        csum_offset = PBUF_CSUM_NONE;
+    }
+    if (iface->send_pbuf) {
+        return iface->send_pbuf(p, csum_start, csum_offset);
+    }
+
+    // The card copies it out
+    int result = NET_ERROR;
+    if (csum_offset != PBUF_CSUM_NONE) {
+        result = iface->send_packet_csum(p->data, p->len, csum_start, csum_offset);
+    } else if (iface->send_packet) {
+        result = iface->send_packet(p->data, p->len);
+    }
+    pbuf_free(p);
+    return result;
+}
 
-    return packet_size;
+// Set around the handling of a received frame; the receive pass runs it to
+// the end on one CPU
+typedef struct {
+    uint64_t tsc;               // 0 outside a receive pass
+    bool csum_ok;
+} net_rx_meta_t;
+
+static net_rx_meta_t rx_meta[MAX_CPUS];
+
+void net_receive(const void* packet, uint32_t len, uint64_t rx_tsc, bool csum_ok) {
+    net_rx_meta_t* meta = &rx_meta[this_cpu()->id];
+    meta->tsc = rx_tsc;
+    meta->csum_ok = csum_ok;
+    net_handle_ethernet(packet, len);
+    meta->tsc = 0;
+    meta->csum_ok = false;
+}
+
+uint64_t net_rx_timestamp(void) {
+    uint64_t tsc = rx_meta[this_cpu()->id].tsc;
+    return tsc ? tsc : rdtsc();
+}
+
+bool net_rx_csum_verified(void) {
+    return rx_meta[this_cpu()->id].csum_ok;
+}
+
+static net_busy_poll_stats_t busy_stats;
+
+void net_busy_poll_begin(void) {
+    net_interface_t* iface = net_iface;
+    if (iface && iface->rx_busy) iface->rx_busy(true);
+}
+
+uint32_t net_busy_poll(void) {
+    net_interface_t* iface = net_iface;
+    uint32_t frames = iface && iface->rx_poll ? iface->rx_poll(NET_BUSY_POLL_BUDGET) : 0;
+    if (frames) {
+        __sync_fetch_and_add(&busy_stats.passes, 1);
+        __sync_fetch_and_add(&busy_stats.frames, frames);
+    }
+    return frames;
+}
+
+void net_busy_poll_end(void) {
+    net_interface_t* iface = net_iface;
+    if (iface && iface->rx_busy) iface->rx_busy(false);
+}
+
+bool net_busy_wait(volatile uint32_t* word, uint32_t seen, uint32_t budget_us) {
+    if (!budget_us || !net_iface || !net_iface->rx_poll || !smp_cpu_isolated(this_cpu()->id)) {
+        return false;
+    }
+
+    __sync_fetch_and_add(&busy_stats.waits, 1);
+    uint64_t until = ktime_ns() + (uint64_t)budget_us * NSEC_PER_USEC;
+    net_busy_poll_begin();
+    bool changed;
+    while (!(changed = load_acquire(word) != seen) && ktime_ns() < until) {
+        if (!net_busy_poll()) cpu_relax();
+    }
+    net_busy_poll_end();
+
+    // What the last pass or the interrupts back on brought counts too
+    changed = changed || load_acquire(word) != seen;
+    __sync_fetch_and_add(changed ? &busy_stats.hits : &busy_stats.sleeps, 1);
+    return changed;
+}
+
+void net_busy_poll_get_stats(net_busy_poll_stats_t* stats) {
+    if (stats) *stats = busy_stats;
+}
+
+void net_busy_poll_print_info(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Busy Polling ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string("Waits: ");
+    print_dec(busy_stats.waits);
+    vga_write_string(", ended by data ");
+    print_dec(busy_stats.hits);
+    vga_write_string(", slept ");
+    print_dec(busy_stats.sleeps);
+    vga_write_string("\nPasses with frames: ");
+    print_dec(busy_stats.passes);
+    vga_write_string(", frames ");
+    print_dec(busy_stats.frames);
+    vga_write_string("\n");
+}
+
+void net_handle_ethernet(const void* packet, uint32_t len) {
+    if (len < sizeof(eth_header_t)) return;
+
+    if (nicmap_steer(packet, len)) return;     // A bypass process's
+
+    const eth_header_t* header = (const eth_header_t*)packet;
+    if (net_ntohs(header->ethertype) == ETH_TYPE_IP) {
+        // Where to answer; group traffic (the feeds) is not answered
+        const ipv4_header_t* ip = (const ipv4_header_t*)(header + 1);
+        if (len >= sizeof(eth_header_t) + sizeof(ipv4_header_t) && !ipv4_is_multicast(&ip->dst_ip)) {
+            ipv4_learn_neighbor(&ip->src_ip, &header->src_mac);
+        }
+        net_handle_ipv4(header + 1, len - sizeof(eth_header_t));
+    } else if (net_ntohs(header->ethertype) == ETH_TYPE_ARP) {
+        arp_handle_packet(header + 1, len - sizeof(eth_header_t));
+    }
+}
+
+// Six hex bytes separated by ':' or '-'
+int net_string_to_mac(const char* str, mac_addr_t* mac) {
+    for (int i = 0; i < 6; i++) {
+        uint32_t value = 0;
+        for (int digit = 0; digit < 2; digit++) {
+            char c = *str++;
+            if (c >= '0' && c <= '9') value = value * 16 + (uint32_t)(c - '0');
+            else if (c >= 'a' && c <= 'f') value = value * 16 + (uint32_t)(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F') value = value * 16 + (uint32_t)(c - 'A' + 10);
+            else return NET_INVALID;
+        }
+        mac->addr[i] = (uint8_t)value;
+        if (i < 5 && *str != ':' && *str != '-') return NET_INVALID;
+        str++;
+    }
+    return str[-1] == '\0' ? NET_SUCCESS : NET_INVALID;
+}
+
+// Ethernet CRC-32, most significant bit first, as the card hashes
+static uint32_t rtl8139_ether_crc(const mac_addr_t* mac) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (int i = 0; i < 6; i++) {
+        uint8_t octet = mac->addr[i];
+        for (int bit = 0; bit < 8; bit++, octet >>= 1) {
+            crc = (crc << 1) ^ (((crc >> 31) ^ (octet & 1)) ? 0x04C11DB7 : 0);
+        }
+    }
+    return crc;
+}
+
+int rtl8139_set_multicast(const mac_addr_t* macs, uint32_t count) {
+    if (!rtl8139_dev.initialized) return NET_ERROR;
+
+    uint32_t filter[2] = { 0, 0 };
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t bit = rtl8139_ether_crc(&macs[i]) >> 26;
+        filter[bit >> 5] |= 1u << (bit & 31);
+    }
+    rtl8139_write32(RTL8139_MAR0, filter[0]);
+    rtl8139_write32(RTL8139_MAR0 + 4, filter[1]);
+    return NET_SUCCESS;
 }
 
 // Get MAC address
@@ -120,27 +644,96 @@ mac_addr_t rtl8139_get_mac(void) {
     return rtl8139_dev.mac_addr;
 }
 
-// Interrupt handler (placeholder for now)
+// Interrupt handler
 void rtl8139_interrupt_handler(void) {
+    if (!rtl8139_dev.initialized) return;          // The line may be another card's
+
     uint16_t status = rtl8139_read16(RTL8139_ISR);
 
-    if (status & RTL8139_ISR_ROK) {
-        // Packet received
-        rtl8139_write16(RTL8139_ISR, RTL8139_ISR_ROK);
+    if (status & RTL8139_RX_INTERRUPTS) {
+        // Acknowledge first, so a frame landing during the pass raises
+        // the interrupt again; an overflow stays latched for the pass,
+        // whoever takes it, to reset the receiver
+        rtl8139_write16(RTL8139_ISR, status & RTL8139_RX_INTERRUPTS & ~RTL8139_ISR_RXOVW);
+        if (status & (RTL8139_ISR_RER | RTL8139_ISR_RXOVW | RTL8139_ISR_FOVW)) {
+            rtl8139_dev.rx_stats.errors++;
+        }
+        rtl8139_dev.rx_stats.interrupts++;
+
+        // The ring is the interrupt's only with nobody polling it
+        spin_lock(&rtl8139_dev.rx_pass_lock);
+        if (!load_acquire(&rtl8139_dev.rx_polling) && !rtl8139_dev.rx_busy) {
+            rtl8139_rx_irq_pass();
+        }
+        spin_unlock(&rtl8139_dev.rx_pass_lock);
     }
 
-    if (status & RTL8139_ISR_TOK) {
-        // Packet transmitted
-        rtl8139_write16(RTL8139_ISR, RTL8139_ISR_TOK);
+    if (status & RTL8139_TX_INTERRUPTS) {
+        // Frames sent or failed: their slots are free again
+        rtl8139_write16(RTL8139_ISR, status & RTL8139_TX_INTERRUPTS);
+        rtl8139_tx_reap();
     }
+}
 
-    if (status & RTL8139_ISR_TER) {
-        // Transmit error
-        rtl8139_write16(RTL8139_ISR, RTL8139_ISR_TER);
-    }
+void rtl8139_get_rx_stats(rtl8139_rx_stats_t* stats) {
+    if (!stats) return;
+
+    uint32_t flags = irq_save();
+    *stats = rtl8139_dev.rx_stats;
+    irq_restore(flags);
+}
 
-    if (status & RTL8139_ISR_RER) {
-        // Receive error
-        rtl8139_write16(RTL8139_ISR, RTL8139_ISR_RER);
+void rtl8139_print_info(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== RTL8139 ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    if (!rtl8139_dev.initialized) {
+        vga_write_string("No card\n");
+        return;
     }
-}
\ No newline at end of file
+
+    rtl8139_rx_stats_t stats;
+    rtl8139_get_rx_stats(&stats);
+    vga_write_string("Receive mode: ");
+    vga_write_string(rtl8139_dev.rx_polling ? "polling" : "interrupt");
+    vga_write_string(rtl8139_dev.rx_busy ? ", busy polled" : "");
+    vga_write_string(rtl8139_dev.rx_poll_task ? "" : " (no polling task)");
+    vga_write_string("\nFrames: ");
+    print_dec(stats.frames);
+    vga_write_string(", most in one pass ");
+    print_dec(stats.max_pass);
+    vga_write_string(" of ");
+    print_dec(RTL8139_RX_BUDGET);
+    vga_write_string("\nInterrupts: ");
+    print_dec(stats.interrupts);
+    vga_write_string(", polling passes ");
+    print_dec(stats.polls);
+    vga_write_string(", busy poll passes ");
+    print_dec(stats.busy_passes);
+    vga_write_string("\nSwitches to polling: ");
+    print_dec(stats.to_polling);
+    vga_write_string(", back to interrupts ");
+    print_dec(stats.to_interrupts);
+    vga_write_string("\nErrors: ");
+    print_dec(stats.errors);
+    vga_write_string(", receiver resets ");
+    print_dec(stats.resets);
+    vga_write_string(", holds ");
+    print_dec(rtl8139_dev.hold_tail - rtl8139_dev.hold_head);
+    vga_write_string(" out, ");
+    print_dec(rtl8139_dev.holds_refused);
+    vga_write_string(" refused\n");
+    vga_write_string("Sent: ");
+    print_dec(rtl8139_dev.tx_frames);
+    vga_write_string(", completed ");
+    print_dec(rtl8139_dev.tx_completed);
+    vga_write_string(", failed ");
+    print_dec(rtl8139_dev.tx_errors);
+    uint32_t in_flight = 0;
+    for (uint32_t busy = rtl8139_dev.tx_busy; busy; busy &= busy - 1) in_flight++;
+    vga_write_string(", in flight ");
+    print_dec(in_flight);
+    vga_write_string("\nWaits for a free slot: ");
+    print_dec(rtl8139_dev.tx_full_waits);
+    vga_write_string("\n");
+}
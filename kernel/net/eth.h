@@ -38,6 +38,7 @@ static inline uint32_t inl(uint16_t port) {
 // RTL8139 registers
 #define RTL8139_BASE        0xC000  // Base I/O port (configurable)
 #define RTL8139_IDR0        0x00    // MAC address registers
+#define RTL8139_MAR0        0x08    // Multicast hash filter, 64 bits
 #define RTL8139_TSD0        0x10    // Transmit status descriptor
 #define RTL8139_TSAD0       0x20    // Transmit start address descriptor
 #define RTL8139_RBSTART     0x30    // Receive buffer start address
@@ -54,16 +55,64 @@ static inline uint32_t inl(uint16_t port) {
 #define RTL8139_CR_RST      0x10    // Reset
 #define RTL8139_CR_RE       0x08    // Receiver enable
 #define RTL8139_CR_TE       0x04    // Transmitter enable
+#define RTL8139_CR_BUFE     0x01    // Receive ring empty
+
+#define RTL8139_RCR_APM     0x02    // Accept frames to our address
+#define RTL8139_RCR_AM      0x04    // Accept multicast passing the hash filter
+#define RTL8139_RCR_AB      0x08    // Accept broadcast
+#define RTL8139_RCR_WRAP    0x80    // Run frames past the ring end
+#define RTL8139_RCR_RBLEN_32K   0x1000  // Receive ring of 32 KB + 16
+#define RTL8139_TSD_OWN     0x2000  // Transmit descriptor: DMA done, slot free
+#define RTL8139_TSD_TUN     0x4000  // FIFO ran dry mid-frame
+#define RTL8139_TSD_TOK     0x8000  // Frame on the wire
+#define RTL8139_TSD_TABT    0x40000000  // Aborted after too many collisions
+#define RTL8139_TX_SLOTS    4
+#define RTL8139_RX_ROK      0x01    // Receive header status: frame good
 
 // RTL8139 interrupt bits
 #define RTL8139_ISR_ROK     0x01    // Receive OK
 #define RTL8139_ISR_TOK     0x04    // Transmit OK
 #define RTL8139_ISR_TER     0x08    // Transmit error
 #define RTL8139_ISR_RER     0x02    // Receive error
+#define RTL8139_ISR_RXOVW   0x10    // Receive ring overflow
+#define RTL8139_ISR_FOVW    0x40    // Receive FIFO overflow
+#define RTL8139_RX_INTERRUPTS   (RTL8139_ISR_ROK | RTL8139_ISR_RER | RTL8139_ISR_RXOVW | RTL8139_ISR_FOVW)
+#define RTL8139_TX_INTERRUPTS   (RTL8139_ISR_TOK | RTL8139_ISR_TER)
 
 // RTL8139 buffer sizes
 #define RTL8139_TX_BUFFER_SIZE  1536
-#define RTL8139_RX_BUFFER_SIZE  8192 + 16
+#define RTL8139_RX_BUFFER_SIZE  (32768 + 16)
+#define RTL8139_RX_RING_SIZE    32768
+#define RTL8139_RX_ALLOC_SIZE   (RTL8139_RX_BUFFER_SIZE + ETH_MTU + 32)    // Room for WRAP
+#define RTL8139_RX_HOLDS        64      // Received frames lent out at once
+#define RTL8139_RX_HOLD_SPAN    (RTL8139_RX_RING_SIZE / 2)     // Ring bytes they may pin
+#define RTL8139_RX_BUDGET       32      // Frames per receive pass
+
+// Receive runs in one of two modes. In interrupt mode the handler walks the
+// ring in passes of up to RTL8139_RX_BUDGET frames. A pass that uses its
+// whole budget means frames are arriving faster than interrupts should be
+// taken for them: receive interrupts are masked and a polling task walks
+// the ring in passes instead, interrupts off for each pass as the handler
+// would have them, yielding in between. The first pass that empties the
+// ring unmasks the interrupts again; a frame that lands meanwhile has its
+// status bit latched and raises one at once.
+//
+// Busy pollers (net_busy_wait) keep receive interrupts masked while any is
+// spinning and take passes of their own. rx_pass_lock makes every pass,
+// the interrupt's, the task's or a poller's, the only one on the ring; the
+// last poller out takes what landed meanwhile and hands the ring back to
+// the interrupt (or to the task, if it found a budget's worth).
+typedef struct {
+    uint32_t interrupts;        // Receive interrupts taken
+    uint32_t polls;             // Passes by the polling task
+    uint32_t busy_passes;       // By busy pollers, that found frames
+    uint32_t frames;
+    uint32_t max_pass;          // Most frames in one pass
+    uint32_t to_polling;        // Switches under load
+    uint32_t to_interrupts;
+    uint32_t errors;            // Bad frames and overflows
+    uint32_t resets;            // Receiver restarted on a bad header or overflow
+} rtl8139_rx_stats_t;
 
 // Ethernet device structure
 typedef struct {
@@ -73,14 +122,77 @@ typedef struct {
     uint8_t* tx_buffer;
     uint32_t rx_buffer_pos;
     uint32_t tx_buffer_pos;
+    spinlock_t tx_lock;
+    uint32_t tx_next;           // Slot rtl8139_tx_reserve hands out next
+    volatile uint32_t tx_busy;  // Bit per slot started and not reaped
+    uint32_t tx_frames;         // Started
+    uint32_t tx_completed;
+    uint32_t tx_errors;         // Underruns and aborts
+    uint32_t tx_full_waits;     // Sends that found all four slots in flight
+    struct pbuf* tx_pbuf[RTL8139_TX_SLOTS];    // Sent from in place, freed when reaped
+    // Frames lent out of the receive ring, oldest first: the card is given
+    // space back only up to the oldest one not yet released
+    spinlock_t rx_lock;
+    uint32_t rx_current;        // Frame being dispatched, if any
+    uint16_t rx_current_len;
+    uint32_t hold_start[RTL8139_RX_HOLDS];
+    uint64_t hold_done;         // Released, waiting for older ones
+    uint64_t hold_stale;        // Dropped by a receiver reset, not yet released
+    uint32_t hold_head;
+    uint32_t hold_tail;
+    uint32_t holds_refused;
+    spinlock_t rx_pass_lock;        // Held for a receive pass and mode changes
+    volatile uint32_t rx_polling;   // Receive interrupts masked, the task has the ring
+    uint32_t rx_busy;               // Busy pollers spinning: interrupts masked for them
+    bool rx_poll_task;              // Without one, interrupt mode only
+    rtl8139_rx_stats_t rx_stats;
     int initialized;
 } rtl8139_device_t;
 
 // Ethernet functions
 int rtl8139_init(uint16_t io_base);
 int rtl8139_send_packet(const void* data, uint32_t len);
-int rtl8139_recv_packet(void* buffer, uint32_t len);
+int rtl8139_send_pbuf(struct pbuf* p, uint16_t csum_start, uint16_t csum_offset);
+int rtl8139_recv_packet(void* buffer, uint32_t len);        // Copy out one frame
+
+// Multicast filter: the top 6 bits of each address's Ethernet CRC pick
+// one of 64 bits in MAR; frames to groups hashing to a bit set get in
+int rtl8139_set_multicast(const mac_addr_t* macs, uint32_t count);
 void rtl8139_interrupt_handler(void);
+
+// One receive pass: up to budget frames in place to net_handle_ethernet,
+// interrupts off and rx_pass_lock held; how many
+uint32_t rtl8139_rx_dispatch(uint32_t budget);
+
+// net_interface_t busy polling hooks
+void rtl8139_rx_busy(bool on);
+uint32_t rtl8139_rx_poll(uint32_t budget);
+
+void rtl8139_get_rx_stats(rtl8139_rx_stats_t* stats);
+void rtl8139_print_info(void);
+
+// Zero-copy receive: a handler called from rtl8139_rx_dispatch may keep the
+// frame it is given past its return. hold returns a token for it (-1 when
+// not called from dispatch, RTL8139_RX_HOLDS are out already, or holding
+// would pin more than RTL8139_RX_HOLD_SPAN of the ring from the oldest
+// frame held to the end of this one) and the frame stays put until the
+// token is released, from any context. Frames are given back to the card
+// in order, so one held frame keeps the ring behind it from the card; the
+// span limit leaves the card half the ring however long that frame is
+// held, and callers refused copy instead. A receiver reset (bad header or
+// ring overflow) gives held frames' space back at once: what a holder
+// reads after one may already be overwritten.
+int rtl8139_rx_hold(void);
+void rtl8139_rx_release(int token);
+
+// Zero-copy transmit through the four descriptors in turn. The transmit
+// interrupt reaps finished slots, so a send returns as soon as the card has
+// the frame while up to four are in flight; reserve only waits (reaping
+// itself) when the next slot is still in flight. -1 if the card is down.
+// The frame given to start must stay untouched until the slot comes round
+// again.
+int rtl8139_tx_reserve(void);
+void rtl8139_tx_start(int slot, const void* frame, uint32_t len);
 mac_addr_t rtl8139_get_mac(void);
 
 // Low-level register access
@@ -0,0 +1,196 @@
+#include "feed.h"
+#include "udp.h"
+#include "ip.h"
+#include "../mm/memory.h"
+#include "../arch/tsc.h"
+#include "../arch/fpu.h"
+#include "../drivers/vga.h"
+
+#define FEED_PRICE_UNIT         0.0001
+
+// Sequence numbers are compared by distance, so they may wrap
+static inline int32_t seq_distance(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b);
+}
+
+static void feed_receive(void* ctx, const void* data, uint32_t len,
+                         const ipv4_addr_t* src_ip, uint16_t src_port) {
+    (void)src_ip; (void)src_port;
+    feed_line_t* line = (feed_line_t*)ctx;
+    feed_process(line->feed, line->index, data, len);
+}
+
+int feed_open(feed_handler_t* feed, lockfree_ringbuf_t* ring,
+              const ipv4_addr_t* group_a, uint16_t port_a,
+              const ipv4_addr_t* group_b, uint16_t port_b) {
+    if (!feed || !ring || ring->element_size != sizeof(market_data_t)) {
+        return NET_INVALID;
+    }
+
+    memset(feed, 0, sizeof(feed_handler_t));
+    feed->ring = ring;
+    const ipv4_addr_t* groups[FEED_LINES] = { group_a, group_b };
+    uint16_t ports[FEED_LINES] = { port_a, port_b };
+    for (uint32_t i = 0; i < FEED_LINES; i++) {
+        feed_line_t* line = &feed->lines[i];
+        line->feed = feed;
+        line->group = *groups[i];
+        line->port = ports[i];
+        line->index = (uint8_t)i;
+        // Joins are counted, so two lines on one group join it twice
+        if (ipv4_join_group(&line->group) != NET_SUCCESS) {
+            line->feed = NULL;
+            feed_close(feed);
+            return NET_ERROR;
+        }
+        if (udp_bind(&line->group, line->port, feed_receive, line) != 0) {
+            ipv4_leave_group(&line->group);
+            line->feed = NULL;      // The binding is someone else's
+            feed_close(feed);
+            return NET_ERROR;
+        }
+    }
+    return NET_SUCCESS;
+}
+
+void feed_close(feed_handler_t* feed) {
+    if (!feed) return;
+
+    for (uint32_t i = 0; i < FEED_LINES; i++) {
+        feed_line_t* line = &feed->lines[i];
+        if (line->feed != feed) continue;
+
+        udp_unbind(&line->group, line->port);
+        ipv4_leave_group(&line->group);
+        line->feed = NULL;
+    }
+}
+
+// Messages the stream has moved past are the other line's duplicates; ones
+// beyond the next expected mean a gap, which is skipped and flagged rather
+// than waited for. Slots are reserved for the rest of the packet and the
+// records written straight into them.
+uint32_t feed_process(feed_handler_t* feed, uint32_t line, const void* payload, uint32_t len) {
+    if (line >= FEED_LINES) return 0;
+
+    const feed_packet_header_t* packet = (const feed_packet_header_t*)payload;
+    if (len < sizeof(feed_packet_header_t)) {
+        feed->malformed++;
+        return 0;
+    }
+
+    feed_line_t* source = &feed->lines[line];
+    source->packets++;
+    uint32_t sequence = packet->sequence;
+    uint32_t count = packet->count;
+    if (!feed->started) {
+        feed->next_sequence = sequence;
+        feed->started = true;
+    }
+    if (seq_distance(sequence + count, feed->next_sequence) <= 0) {
+        source->duplicates++;
+        return 0;
+    }
+    if (seq_distance(sequence, feed->next_sequence) > 0) {
+        feed->gaps++;
+        feed->gap_messages += sequence - feed->next_sequence;
+        feed->next_sequence = sequence;
+        feed->lost = true;
+    }
+
+    // When the frame came off the card, not when we got to it (now, for a
+    // packet handed in outside the receive pass)
+    uint64_t received = ktime_from_tsc(net_rx_timestamp());
+    const uint8_t* cursor = (const uint8_t*)(packet + 1);
+    uint32_t remaining = len - sizeof(feed_packet_header_t);
+    uint32_t skip = feed->next_sequence - sequence;
+    market_data_t* slots = NULL;
+    uint32_t avail = 0;
+    uint32_t used = 0;
+    uint32_t published = 0;
+
+    // This runs in the receive interrupt: the x87 price conversion must
+    // not use the FP registers of the process it interrupted
+    uint32_t fpu_flags;
+    bool fpu = fpu_kernel_begin_x87(&fpu_flags);
+
+    for (uint32_t i = 0; i < count; i++) {
+        const feed_message_header_t* message = (const feed_message_header_t*)cursor;
+        if (remaining < sizeof(feed_message_header_t) || message->length < sizeof(feed_message_header_t) ||
+            message->length > remaining) {
+            // The rest may still come whole on the other line
+            feed->malformed++;
+            break;
+        }
+
+        if (i >= skip) {
+            bool record = (message->type == FEED_MSG_QUOTE || message->type == FEED_MSG_TRADE) &&
+                          message->length >= sizeof(feed_quote_msg_t);
+            if (record && used == avail) {
+                ringbuf_commit(feed->ring, used);
+                published += used;
+                used = 0;
+                slots = (market_data_t*)ringbuf_reserve(feed->ring, count - i, &avail);
+                if (!slots) avail = 0;
+            }
+
+            if (record && used < avail) {
+                const feed_quote_msg_t* quote = (const feed_quote_msg_t*)message;
+                market_data_t* out = &slots[used++];
+                if (fpu) {
+                    out->price = quote->price * FEED_PRICE_UNIT;
+                } else {
+                    memset(&out->price, 0, sizeof(out->price));     // No FPU, no prices
+                }
+                out->volume = quote->quantity;
+                out->timestamp = received;
+                out->symbol_id = quote->symbol_id;
+                out->side = message->type == FEED_MSG_TRADE ? MD_SIDE_TRADE : (quote->side != 0);
+                out->flags = quote->flags | (feed->lost ? FEED_FLAG_GAP : 0);
+                feed->lost = false;
+            } else if (record) {
+                feed->overruns++;
+                feed->lost = true;
+            }
+            feed->next_sequence = sequence + i + 1;
+            source->first++;
+        }
+        cursor += message->length;
+        remaining -= message->length;
+    }
+
+    if (fpu) fpu_kernel_end(fpu_flags);
+
+    ringbuf_commit(feed->ring, used);
+    published += used;
+    feed->published += published;
+    return published;
+}
+
+void feed_print_stats(feed_handler_t* feed) {
+    if (!feed) return;
+
+    vga_write_string("Feed: ");
+    print_dec(feed->published);
+    vga_write_string(" published, next seq ");
+    print_dec(feed->next_sequence);
+    vga_write_string(", ");
+    print_dec(feed->gaps);
+    vga_write_string(" gaps (");
+    print_dec(feed->gap_messages);
+    vga_write_string(" msgs), ");
+    print_dec(feed->overruns);
+    vga_write_string(" overruns, ");
+    print_dec(feed->malformed);
+    vga_write_string(" malformed\n");
+    for (uint32_t i = 0; i < FEED_LINES; i++) {
+        feed_line_t* line = &feed->lines[i];
+        vga_write_string(i == 0 ? "  line A: " : "  line B: ");
+        print_dec(line->packets);
+        vga_write_string(" packets, ");
+        print_dec(line->duplicates);
+        vga_write_string(" duplicate, ");
+        print_dec(line->first);
+        vga_write_string(" msgs first\n");
+    }
+}
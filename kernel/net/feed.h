@@ -0,0 +1,92 @@
+#ifndef FEED_H
+#define FEED_H
+
+#include "net.h"
+#include "../proc/ipc.h"
+
+// Market data feed handler. An exchange publishes one sequenced stream on
+// two multicast lines (A and B) carrying the same packets; the handler
+// takes each message from whichever line brings it first, drops the copy,
+// and notices gaps that neither line filled. Messages are decoded straight
+// out of the receive buffer into market_data_t slots reserved in the SPSC
+// ring, and published with one commit per packet, so the path from the NIC
+// interrupt to the ring is a single pass with no copies in between.
+//
+// Wire format, little-endian in the style of SBE: a packet header with the
+// sequence number of its first message and the message count, then the
+// messages, each led by its length and type. Both lines are handled in the
+// receive interrupt, which makes the handler the ring's one producer.
+#define FEED_LINES              2
+#define FEED_PRICE_DECIMALS     4           // Wire prices are 10^-4 units
+
+// Message types
+#define FEED_MSG_QUOTE          'Q'
+#define FEED_MSG_TRADE          'T'
+#define FEED_MSG_HEARTBEAT      'H'
+
+// Set on the first record published after messages were lost (a gap
+// neither line filled, or a full ring)
+#define FEED_FLAG_GAP           0x80
+
+typedef struct {
+    uint32_t sequence;          // Of the first message
+    uint16_t count;
+    uint16_t session;
+} __attribute__((packed)) feed_packet_header_t;
+
+typedef struct {
+    uint16_t length;            // Whole message, this header included
+    uint8_t type;
+    uint8_t reserved;
+} __attribute__((packed)) feed_message_header_t;
+
+// FEED_MSG_QUOTE and FEED_MSG_TRADE
+typedef struct {
+    feed_message_header_t header;
+    uint16_t symbol_id;
+    uint8_t side;               // Quotes: 0 = bid, 1 = ask
+    uint8_t flags;
+    int64_t price;
+    uint64_t quantity;
+    uint64_t exchange_time;     // ns
+} __attribute__((packed)) feed_quote_msg_t;
+
+struct feed_handler;
+
+typedef struct {
+    struct feed_handler* feed;
+    ipv4_addr_t group;
+    uint16_t port;
+    uint8_t index;              // 0 = A, 1 = B
+    uint32_t packets;
+    uint32_t duplicates;        // Packets the other line had brought already
+    uint32_t first;             // Messages this line brought first
+} feed_line_t;
+
+typedef struct feed_handler {
+    lockfree_ringbuf_t* ring;   // market_data_t out
+    feed_line_t lines[FEED_LINES];
+    uint32_t next_sequence;     // Next message expected
+    bool started;               // next_sequence is set
+    bool lost;                  // Flag the next record
+    uint32_t published;
+    uint32_t gaps;
+    uint32_t gap_messages;      // Skipped by gaps
+    uint32_t overruns;          // Dropped on a full ring
+    uint32_t malformed;
+} feed_handler_t;
+
+// Join both groups and bind their ports (host order). The ring holds
+// market_data_t and outlives the handler.
+int feed_open(feed_handler_t* feed, lockfree_ringbuf_t* ring,
+              const ipv4_addr_t* group_a, uint16_t port_a,
+              const ipv4_addr_t* group_b, uint16_t port_b);
+void feed_close(feed_handler_t* feed);
+
+// One packet's UDP payload from line 0 or 1, as if received there.
+// Returns how many records were published.
+uint32_t feed_process(feed_handler_t* feed, uint32_t line, const void* payload, uint32_t len);
+
+void feed_print_stats(feed_handler_t* feed);
+
+#endif // FEED_H
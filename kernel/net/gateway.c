@@ -0,0 +1,216 @@
+#include "gateway.h"
+#include "tcp.h"
+#include "../mm/memory.h"
+
+static char gateway_symbols[GATEWAY_MAX_SYMBOLS][8];
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+// TCP pseudo-header for a segment of 'len' bytes
+static uint32_t gateway_pseudo(const ipv4_header_t* ip, uint32_t len) {
+    return csum_pseudo(&ip->src_ip, &ip->dst_ip, IP_PROTO_TCP, (uint16_t)len);
+}
+
+int gateway_set_symbol(uint16_t symbol_id, const char* name) {
+    if (symbol_id >= GATEWAY_MAX_SYMBOLS || !name) return -1;
+
+    // Space padded, as the exchange expects
+    uint32_t i = 0;
+    for (; i < 8 && name[i]; i++) {
+        gateway_symbols[symbol_id][i] = name[i];
+    }
+    for (; i < 8; i++) {
+        gateway_symbols[symbol_id][i] = ' ';
+    }
+    return 0;
+}
+
+static void gateway_fill_header(gateway_session_t* gw, gateway_frame_header_t* header,
+                                const mac_addr_t* next_hop, uint32_t message_len) {
+    tcp_connection_t* conn = gw->conn;
+    uint32_t tcp_len = sizeof(tcp_header_t) + 3 + message_len;
+
+    memset(header, 0, sizeof(gateway_frame_header_t));
+    header->eth.dst_mac = *next_hop;
+    header->eth.src_mac = rtl8139_get_mac();
+    header->eth.ethertype = net_htons(ETH_TYPE_IP);
+
+    header->ip.version_ihl = (4 << 4) | 5;
+    header->ip.total_len = net_htons(sizeof(ipv4_header_t) + tcp_len);
+    header->ip.flags_frag = net_htons(0x4000);     // Don't fragment
+    header->ip.ttl = 64;
+    header->ip.protocol = IP_PROTO_TCP;
+    header->ip.src_ip = conn->local_ip;
+    header->ip.dst_ip = conn->remote_ip;
+    header->ip.checksum = net_checksum(&header->ip, sizeof(ipv4_header_t));
+
+    header->tcp.src_port = net_htons(conn->local_port);
+    header->tcp.dst_port = net_htons(conn->remote_port);
+    header->tcp.flags = net_htons((5 << 12) | TCP_FLAG_PSH | TCP_FLAG_ACK);
+    header->tcp.window = net_htons(65535);
+
+    header->soup_length = net_htons(1 + message_len);
+    header->soup_type = SOUP_UNSEQUENCED;
+}
+
+// Sum of a template with its patched fields (sequence numbers and
+// [patch, patch + patch_len) of the message) still zero
+static uint32_t gateway_template_sum(const gateway_frame_header_t* header, uint32_t frame_len) {
+    uint32_t tcp_len = frame_len - sizeof(eth_header_t) - sizeof(ipv4_header_t);
+    return csum_partial(&header->tcp, tcp_len, gateway_pseudo(&header->ip, tcp_len));
+}
+
+#define ENTER_PATCH     (sizeof(gateway_frame_header_t) + __builtin_offsetof(ouch_enter_order_t, token) + \
+                         GATEWAY_TOKEN_PREFIX)
+#define ENTER_PATCH_END (sizeof(gateway_frame_header_t) + __builtin_offsetof(ouch_enter_order_t, time_in_force))
+#define CANCEL_PATCH    (sizeof(gateway_frame_header_t) + __builtin_offsetof(ouch_cancel_order_t, token) + \
+                         GATEWAY_TOKEN_PREFIX)
+#define CANCEL_PATCH_END sizeof(gateway_cancel_frame_t)
+#define TCP_OFFSET      (sizeof(eth_header_t) + sizeof(ipv4_header_t))
+
+int gateway_open(gateway_session_t* gw, tcp_connection_t* conn, const mac_addr_t* next_hop,
+                 const char* token_prefix, const char* firm, uint32_t flags) {
+    if (!gw || !conn || !next_hop || !token_prefix || !firm) return NET_INVALID;
+
+    memset(gw, 0, sizeof(gateway_session_t));
+    gw->conn = conn;
+    gw->flags = flags;
+    gw->enter = (gateway_enter_frame_t*)kmalloc_aligned(sizeof(gateway_enter_frame_t) * RTL8139_TX_SLOTS,
+                                                         CACHE_LINE_SIZE);
+    gw->cancel = (gateway_cancel_frame_t*)kmalloc_aligned(sizeof(gateway_cancel_frame_t) * RTL8139_TX_SLOTS,
+                                                           CACHE_LINE_SIZE);
+    if (!gw->enter || !gw->cancel) {
+        gateway_close(gw);
+        return NET_NO_MEMORY;
+    }
+
+    gateway_enter_frame_t enter;
+    gateway_fill_header(gw, &enter.header, next_hop, sizeof(ouch_enter_order_t));
+    memset(&enter.order, 0, sizeof(ouch_enter_order_t));
+    enter.order.type = OUCH_ENTER_ORDER;
+    memcpy(enter.order.token, token_prefix, GATEWAY_TOKEN_PREFIX);
+    enter.order.time_in_force = net_htonl(99998);   // Market hours
+    memcpy(enter.order.firm, firm, 4);
+    enter.order.display = 'Y';
+    enter.order.capacity = 'A';
+    enter.order.intermarket_sweep = 'N';
+    enter.order.cross_type = 'N';
+    gw->enter_sum = gateway_template_sum(&enter.header, sizeof(enter));
+
+    gateway_cancel_frame_t cancel;
+    gateway_fill_header(gw, &cancel.header, next_hop, sizeof(ouch_cancel_order_t));
+    memset(&cancel.cancel, 0, sizeof(ouch_cancel_order_t));
+    cancel.cancel.type = OUCH_CANCEL_ORDER;
+    memcpy(cancel.cancel.token, token_prefix, GATEWAY_TOKEN_PREFIX);
+    gw->cancel_sum = gateway_template_sum(&cancel.header, sizeof(cancel));
+
+    for (uint32_t i = 0; i < RTL8139_TX_SLOTS; i++) {
+        gw->enter[i] = enter;
+        gw->cancel[i] = cancel;
+    }
+    return NET_SUCCESS;
+}
+
+void gateway_close(gateway_session_t* gw) {
+    if (!gw) return;
+
+    kfree_aligned(gw->enter);
+    kfree_aligned(gw->cancel);
+    gw->enter = NULL;
+    gw->cancel = NULL;
+}
+
+static int gateway_slot(gateway_session_t* gw) {
+    if (gw->flags & GATEWAY_DRY_RUN) {
+        return (int)(gw->next_slot++ % RTL8139_TX_SLOTS);
+    }
+    // The payload stays in the send buffer until acknowledged
+    if (tcp_send_room(gw->conn) < sizeof(gateway_enter_frame_t)) {
+        return -1;
+    }
+    return rtl8139_tx_reserve();
+}
+
+static inline void gateway_put_id(char* token, uint32_t id) {
+    for (int i = 7; i >= 0; i--) {
+        token[i] = hex_digits[id & 0xF];
+        id >>= 4;
+    }
+}
+
+// Sequence numbers, then the patched bytes at their place in the segment
+static void gateway_finish(gateway_session_t* gw, gateway_frame_header_t* header, uint32_t sum,
+                           uint32_t patch, uint32_t patch_end, uint32_t frame_len, int slot) {
+    tcp_connection_t* conn = gw->conn;
+    header->tcp.seq_num = net_htonl(conn->seq_num);
+    header->tcp.ack_num = net_htonl(conn->ack_num);
+
+    sum = csum_partial(&header->tcp.seq_num, 8, sum);
+    sum = csum_add(sum, csum_shift(csum_partial((uint8_t*)header + patch, patch_end - patch, 0),
+                                   patch - TCP_OFFSET));
+    header->tcp.checksum = csum_fold(sum);
+
+    uint32_t payload_len = frame_len - sizeof(gateway_frame_header_t) + 3;
+    if (gw->flags & GATEWAY_DRY_RUN) {
+        conn->seq_num += payload_len;
+    } else {
+        tcp_record_sent(conn, &header->soup_length, payload_len);
+        rtl8139_tx_start(slot, header, frame_len);
+    }
+}
+
+int gateway_send_order(gateway_session_t* gw, const order_t* order) {
+    if (order->symbol_id >= GATEWAY_MAX_SYMBOLS || order->type != 1 || !(order->price > 0) ||
+        order->price >= 429496.7295 || order->quantity == 0 || order->quantity > 0xFFFFFFFFu) {
+        gw->errors++;
+        return NET_INVALID;
+    }
+
+    int slot = gateway_slot(gw);
+    if (slot < 0) {
+        gw->errors++;
+        return NET_ERROR;
+    }
+
+    gateway_enter_frame_t* frame = &gw->enter[slot];
+    ouch_enter_order_t* message = &frame->order;
+    gateway_put_id(message->token + GATEWAY_TOKEN_PREFIX, order->order_id);
+    message->side = order->side ? 'S' : 'B';
+    message->shares = net_htonl((uint32_t)order->quantity);
+    const uint32_t* stock = (const uint32_t*)gateway_symbols[order->symbol_id];
+    ((uint32_t*)message->stock)[0] = stock[0];
+    ((uint32_t*)message->stock)[1] = stock[1];
+    message->price = net_htonl((uint32_t)(order->price * 10000 + 0.5));
+
+    gateway_finish(gw, &frame->header, gw->enter_sum, ENTER_PATCH, ENTER_PATCH_END,
+                   sizeof(gateway_enter_frame_t), slot);
+    gw->orders++;
+    return NET_SUCCESS;
+}
+
+int gateway_send_cancel(gateway_session_t* gw, uint32_t order_id, uint32_t shares_left) {
+    int slot = gateway_slot(gw);
+    if (slot < 0) {
+        gw->errors++;
+        return NET_ERROR;
+    }
+
+    gateway_cancel_frame_t* frame = &gw->cancel[slot];
+    gateway_put_id(frame->cancel.token + GATEWAY_TOKEN_PREFIX, order_id);
+    frame->cancel.shares = net_htonl(shares_left);
+
+    gateway_finish(gw, &frame->header, gw->cancel_sum, CANCEL_PATCH, CANCEL_PATCH_END,
+                   sizeof(gateway_cancel_frame_t), slot);
+    gw->cancels++;
+    return NET_SUCCESS;
+}
+
+bool gateway_frame_valid(const void* frame, uint32_t len) {
+    if (len < sizeof(gateway_frame_header_t)) return false;
+
+    const gateway_frame_header_t* header = (const gateway_frame_header_t*)frame;
+    if (net_checksum(&header->ip, sizeof(ipv4_header_t)) != 0) return false;
+
+    uint32_t tcp_len = len - TCP_OFFSET;
+    return csum_fold(csum_partial(&header->tcp, tcp_len, gateway_pseudo(&header->ip, tcp_len))) == 0;
+}
@@ -0,0 +1,97 @@
+#ifndef GATEWAY_H
+#define GATEWAY_H
+
+#include "net.h"
+#include "eth.h"
+#include "../proc/ipc.h"
+
+// Order entry encoder for the exchange gateway. Each session pre-builds
+// whole frames (Ethernet, IPv4 and TCP headers, a SoupBinTCP header and an
+// OUCH-style message) once per message kind and transmit descriptor. A send
+// takes the next descriptor, patches the order token, side, shares, symbol,
+// price and TCP sequence numbers into its frame, folds the patched bytes
+// into a checksum precomputed over everything else and hands the frame to
+// the card where it is: no formatting, no copies. The IPv4 header never
+// changes (id 0, don't fragment), so its checksum is part of the template.
+//
+// Integers in the messages are big-endian; prices have 4 decimals. The
+// connection's ports are taken as host order. One sender per session.
+#define GATEWAY_MAX_SYMBOLS     1024
+#define GATEWAY_TOKEN_PREFIX    6           // Fixed characters ahead of the order id
+#define GATEWAY_DRY_RUN         0x1         // Encode only, for tests without a card
+
+#define OUCH_ENTER_ORDER        'O'
+#define OUCH_CANCEL_ORDER       'X'
+#define SOUP_UNSEQUENCED        'U'
+
+typedef struct {
+    eth_header_t eth;
+    ipv4_header_t ip;
+    tcp_header_t tcp;
+    uint16_t soup_length;       // Type byte and message
+    uint8_t soup_type;
+} __attribute__((packed)) gateway_frame_header_t;
+
+typedef struct {
+    uint8_t type;
+    char token[14];             // Prefix, then the order id in hex
+    uint8_t side;               // 'B' or 'S'
+    uint32_t shares;
+    char stock[8];
+    uint32_t price;
+    uint32_t time_in_force;
+    char firm[4];
+    uint8_t display;
+    uint8_t capacity;
+    uint8_t intermarket_sweep;
+    uint32_t minimum_quantity;
+    uint8_t cross_type;
+} __attribute__((packed)) ouch_enter_order_t;
+
+typedef struct {
+    uint8_t type;
+    char token[14];
+    uint32_t shares;            // Left open, 0 = cancel all
+} __attribute__((packed)) ouch_cancel_order_t;
+
+typedef struct {
+    gateway_frame_header_t header;
+    ouch_enter_order_t order;
+} __attribute__((packed)) gateway_enter_frame_t;
+
+typedef struct {
+    gateway_frame_header_t header;
+    ouch_cancel_order_t cancel;
+} __attribute__((packed)) gateway_cancel_frame_t;
+
+typedef struct {
+    tcp_connection_t* conn;
+    gateway_enter_frame_t* enter;       // One per transmit slot
+    gateway_cancel_frame_t* cancel;
+    uint32_t enter_sum;                 // Checksum of the fixed parts
+    uint32_t cancel_sum;
+    uint32_t flags;
+    uint32_t next_slot;                 // Dry runs only
+    uint32_t orders;
+    uint32_t cancels;
+    uint32_t errors;
+} gateway_session_t;
+
+// Names for symbol ids, up to 8 characters
+int gateway_set_symbol(uint16_t symbol_id, const char* name);
+
+// Templates for an established connection; next_hop is the MAC frames go
+// to, token_prefix GATEWAY_TOKEN_PREFIX characters, firm 4
+int gateway_open(gateway_session_t* gw, tcp_connection_t* conn, const mac_addr_t* next_hop,
+                 const char* token_prefix, const char* firm, uint32_t flags);
+void gateway_close(gateway_session_t* gw);
+
+// Encode and transmit (NET_SUCCESS, or an error if the card is down or the
+// order cannot be expressed)
+int gateway_send_order(gateway_session_t* gw, const order_t* order);
+int gateway_send_cancel(gateway_session_t* gw, uint32_t order_id, uint32_t shares_left);
+
+// Full recomputation of both checksums of a frame, for tests
+bool gateway_frame_valid(const void* frame, uint32_t len);
+
+#endif // GATEWAY_H
@@ -0,0 +1,299 @@
+#include "igmp.h"
+#include "ip.h"
+#include "pbuf.h"
+#include "../mm/memory.h"
+#include "../arch/spinlock.h"
+#include "../arch/tsc.h"
+#include "../proc/process.h"
+#include "../drivers/vga.h"
+
+static igmp_group_t groups[IP_MAX_GROUPS];
+static spinlock_t igmp_lock = SPINLOCK_INIT;
+static spinlock_t filter_lock = SPINLOCK_INIT;     // One reprogramming at a time
+static igmp_stats_t igmp_stats;
+static bool older_querier;
+static uint32_t older_querier_until;                // ms
+
+static const ipv4_addr_t any_addr = {{0, 0, 0, 0}};
+static const ipv4_addr_t all_hosts = {{224, 0, 0, 1}};
+static const ipv4_addr_t all_routers = {{224, 0, 0, 2}};
+static const ipv4_addr_t v3_routers = {{224, 0, 0, 22}};
+
+static void igmp_timer_expired(void* data);
+
+static inline bool igmp_same(const ipv4_addr_t* a, const ipv4_addr_t* b) {
+    return memcmp(a, b, sizeof(ipv4_addr_t)) == 0;
+}
+
+// A v1 or v2 querier heard lately
+static bool igmp_v2_mode(void) {
+    return older_querier && (int32_t)(older_querier_until - get_current_time_ms()) > 0;
+}
+
+// Lock held
+static igmp_group_t* igmp_find(const ipv4_addr_t* group) {
+    for (uint32_t i = 0; i < IP_MAX_GROUPS; i++) {
+        if (groups[i].in_use && igmp_same(&groups[i].group, group)) return &groups[i];
+    }
+    return NULL;
+}
+
+// A report (or leave) for one group: a v3 group record of type 'record',
+// or its v2 equivalent while an older querier is about
+static void igmp_send(uint8_t record, const ipv4_addr_t* group) {
+    pbuf_t* p = pbuf_alloc(PBUF_HEADROOM + IP_ROUTER_ALERT_LEN);
+    if (!p) return;
+
+    const ipv4_addr_t* dst;
+    if (igmp_v2_mode()) {
+        bool leave = record == IGMP_TO_INCLUDE;
+        igmp_v2_t* msg = (igmp_v2_t*)pbuf_put(p, sizeof(igmp_v2_t));
+        msg->type = leave ? IGMP_V2_LEAVE : IGMP_V2_REPORT;
+        msg->max_resp = 0;
+        msg->checksum = 0;
+        msg->group = *group;
+        msg->checksum = net_checksum(msg, sizeof(igmp_v2_t));
+        dst = leave ? &all_routers : group;
+    } else {
+        uint32_t len = sizeof(igmp_v3_report_t) + sizeof(igmp_v3_record_t);
+        igmp_v3_report_t* msg = (igmp_v3_report_t*)pbuf_put(p, len);
+        memset(msg, 0, len);
+        msg->type = IGMP_V3_REPORT;
+        msg->records = net_htons(1);
+        igmp_v3_record_t* rec = (igmp_v3_record_t*)(msg + 1);
+        rec->type = record;
+        rec->group = *group;
+        msg->checksum = net_checksum(msg, len);
+        dst = &v3_routers;
+    }
+
+    if (record == IGMP_TO_INCLUDE) {
+        igmp_stats.leaves_sent++;
+    } else {
+        igmp_stats.reports_sent++;
+    }
+    ipv4_send_control(dst, IP_PROTO_IGMP, p);
+}
+
+// The card takes the groups joined and all-hosts; the snapshot is taken
+// under filter_lock, so the last change to program the card wins
+static void igmp_update_filter(void) {
+    mac_addr_t macs[IP_MAX_GROUPS + 1];
+    uint32_t flags = spin_lock_irqsave(&filter_lock);
+    spin_lock(&igmp_lock);
+    uint32_t count = 0;
+    ipv4_multicast_mac(&all_hosts, &macs[count++]);
+    for (uint32_t i = 0; i < IP_MAX_GROUPS; i++) {
+        if (groups[i].in_use && groups[i].refs) {
+            ipv4_multicast_mac(&groups[i].group, &macs[count++]);
+        }
+    }
+    spin_unlock(&igmp_lock);
+    net_set_multicast(macs, count);
+    igmp_stats.filter_updates++;
+    spin_unlock_irqrestore(&filter_lock, flags);
+}
+
+int ipv4_join_group(const ipv4_addr_t* group) {
+    if (!group || !ipv4_is_multicast(group)) return NET_INVALID;
+    if (igmp_same(group, &all_hosts)) return NET_SUCCESS;      // Always a member
+
+    uint32_t flags = spin_lock_irqsave(&igmp_lock);
+    igmp_group_t* g = igmp_find(group);
+    if (g && g->refs) {
+        g->refs++;
+        spin_unlock_irqrestore(&igmp_lock, flags);
+        return NET_SUCCESS;
+    }
+    // A group still sending its leave records is taken back as it is
+    if (!g) {
+        for (uint32_t i = 0; i < IP_MAX_GROUPS && !g; i++) {
+            if (!groups[i].in_use) g = &groups[i];
+        }
+        if (!g) {
+            spin_unlock_irqrestore(&igmp_lock, flags);
+            return NET_NO_MEMORY;
+        }
+        g->group = *group;
+        g->in_use = true;
+        timer_setup(&g->timer, igmp_timer_expired, g);
+    }
+    g->refs = 1;
+    g->leaving = false;
+    g->reports = IGMP_ROBUSTNESS - 1;
+    timer_arm(&g->timer, get_current_time_ms() + IGMP_UNSOLICITED_MS);
+    igmp_stats.joins++;
+    igmp_stats.groups++;
+    spin_unlock_irqrestore(&igmp_lock, flags);
+
+    igmp_update_filter();
+    igmp_send(IGMP_TO_EXCLUDE, group);
+    return NET_SUCCESS;
+}
+
+void ipv4_leave_group(const ipv4_addr_t* group) {
+    if (!group) return;
+
+    uint32_t flags = spin_lock_irqsave(&igmp_lock);
+    igmp_group_t* g = igmp_find(group);
+    if (!g || !g->refs || --g->refs) {
+        spin_unlock_irqrestore(&igmp_lock, flags);
+        return;
+    }
+    ipv4_addr_t left = g->group;
+    if (igmp_v2_mode()) {
+        timer_cancel(&g->timer);
+        g->in_use = false;
+    } else {
+        g->leaving = true;
+        g->reports = IGMP_ROBUSTNESS - 1;
+        timer_arm(&g->timer, get_current_time_ms() + IGMP_UNSOLICITED_MS);
+    }
+    igmp_stats.leaves++;
+    igmp_stats.groups--;
+    spin_unlock_irqrestore(&igmp_lock, flags);
+
+    igmp_update_filter();
+    igmp_send(IGMP_TO_INCLUDE, &left);
+}
+
+// Lock-free: the receive path asks per datagram; a group joined or left
+// meanwhile may be seen either way
+int ipv4_in_group(const ipv4_addr_t* ip) {
+    if (igmp_same(ip, &all_hosts)) return 1;
+    for (uint32_t i = 0; i < IP_MAX_GROUPS; i++) {
+        if (groups[i].refs && igmp_same(&groups[i].group, ip)) return 1;
+    }
+    return 0;
+}
+
+// From the tick: the next unsolicited report or leave record, or the
+// answer to a query
+static void igmp_timer_expired(void* data) {
+    igmp_group_t* g = (igmp_group_t*)data;
+
+    uint32_t flags = spin_lock_irqsave(&igmp_lock);
+    if (!g->in_use || (!g->refs && !g->leaving)) {
+        spin_unlock_irqrestore(&igmp_lock, flags);
+        return;
+    }
+    uint8_t record = g->leaving ? IGMP_TO_INCLUDE : g->reports ? IGMP_TO_EXCLUDE : IGMP_MODE_IS_EXCLUDE;
+    ipv4_addr_t group = g->group;
+    if (g->reports && --g->reports) {
+        timer_arm(&g->timer, get_current_time_ms() + IGMP_UNSOLICITED_MS);
+    } else if (g->leaving) {
+        g->leaving = false;
+        g->in_use = false;
+    }
+    spin_unlock_irqrestore(&igmp_lock, flags);
+
+    igmp_send(record, &group);
+}
+
+// Max Resp Code (RFC 3376 4.1.1): tenths of a second, floating point from 128
+static uint32_t igmp_max_resp_ms(uint8_t code) {
+    if (code < 128) return code * 100u;
+    return ((((uint32_t)code & 0x0F) | 0x10) << (((code >> 4) & 0x07) + 3)) * 100u;
+}
+
+void igmp_handle_packet(const void* data, uint32_t len) {
+    if (len < sizeof(igmp_v2_t) || net_checksum(data, len) != 0) return;
+
+    // Reports from other hosts need nothing: v3 does no suppression, and
+    // every member answering a v2 query costs a few frames at most
+    const igmp_v2_t* msg = (const igmp_v2_t*)data;
+    if (msg->type != IGMP_QUERY) return;
+
+    uint32_t now = get_current_time_ms();
+    uint32_t max_ms;
+    igmp_stats.queries++;
+    if (len >= 12) {
+        max_ms = igmp_max_resp_ms(msg->max_resp);
+    } else {
+        // v1 (no response time: 10 s) or v2; the v2 reports do for both
+        igmp_stats.v2_queries++;
+        older_querier = true;
+        older_querier_until = now + IGMP_OLDER_QUERIER_MS;
+        max_ms = msg->max_resp ? msg->max_resp * 100u : 10000;
+    }
+    if (max_ms == 0) max_ms = 100;
+
+    bool general = igmp_same(&msg->group, &any_addr);
+    uint32_t flags = spin_lock_irqsave(&igmp_lock);
+    for (uint32_t i = 0; i < IP_MAX_GROUPS; i++) {
+        igmp_group_t* g = &groups[i];
+        if (!g->in_use || !g->refs || (!general && !igmp_same(&g->group, &msg->group))) continue;
+
+        // A random point within the response time; one already due sooner stands
+        uint32_t delay = (uint32_t)rdtsc() % max_ms;
+        if (!g->timer.pending || (int32_t)(g->timer.expires - (now + delay)) > 0) {
+            timer_arm(&g->timer, now + delay);
+        }
+    }
+    spin_unlock_irqrestore(&igmp_lock, flags);
+}
+
+void igmp_get_stats(igmp_stats_t* stats) {
+    if (!stats) return;
+    uint32_t flags = spin_lock_irqsave(&igmp_lock);
+    *stats = igmp_stats;
+    spin_unlock_irqrestore(&igmp_lock, flags);
+}
+
+void igmp_print_info(void) {
+    igmp_group_t snapshot[IP_MAX_GROUPS];
+    igmp_stats_t stats;
+    uint32_t flags = spin_lock_irqsave(&igmp_lock);
+    memcpy(snapshot, groups, sizeof(snapshot));
+    stats = igmp_stats;
+    bool v2 = igmp_v2_mode();
+    spin_unlock_irqrestore(&igmp_lock, flags);
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Multicast Groups ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string("IGMP ");
+    vga_write_string(v2 ? "v2 (older querier heard)" : "v3");
+    vga_write_string(", ");
+    print_dec(stats.groups);
+    vga_write_string(" of ");
+    print_dec(IP_MAX_GROUPS);
+    vga_write_string(" groups\n");
+
+    char ip_str[16];
+    for (uint32_t i = 0; i < IP_MAX_GROUPS; i++) {
+        igmp_group_t* g = &snapshot[i];
+        if (!g->in_use) continue;
+        mac_addr_t mac;
+        ipv4_multicast_mac(&g->group, &mac);
+        net_ip_to_string(&g->group, ip_str);
+        vga_write_string("  ");
+        vga_write_string(ip_str);
+        vga_write_string("  ");
+        vga_write_string(net_mac_to_string(&mac));
+        if (g->leaving) {
+            vga_write_string("  leaving\n");
+        } else {
+            vga_write_string("  joins ");
+            print_dec(g->refs);
+            vga_write_string("\n");
+        }
+    }
+
+    vga_write_string("Joins: ");
+    print_dec(stats.joins);
+    vga_write_string("  Leaves: ");
+    print_dec(stats.leaves);
+    vga_write_string("  Filter updates: ");
+    print_dec(stats.filter_updates);
+    vga_write_string("\nReports sent: ");
+    print_dec(stats.reports_sent);
+    vga_write_string("  Leaves sent: ");
+    print_dec(stats.leaves_sent);
+    vga_write_string("\nQueries: ");
+    print_dec(stats.queries);
+    vga_write_string(" (v1/v2: ");
+    print_dec(stats.v2_queries);
+    vga_write_string(")\n");
+}
@@ -0,0 +1,94 @@
+#ifndef IGMP_H
+#define IGMP_H
+
+#include "net.h"
+#include "../proc/timer.h"
+
+// Multicast group membership, and the host side of IGMP (RFC 2236 for v2,
+// RFC 3376 for v3). Joins are counted: the first join of a group and its
+// last leave are what the network hears, whoever asked for them (feeds,
+// sockets). Either change is reported at once and once more
+// IGMP_UNSOLICITED_MS later, in case the first report is lost (robustness 2).
+// A v2 leave is a single Leave Group. Queries are answered per group, after
+// a random delay up to the query's maximum response time. We speak v3,
+// one group record per report to 224.0.0.22, until a v1 or v2 querier is
+// heard; then v2 for IGMP_OLDER_QUERIER_MS after the last of its queries.
+//
+// Every change of membership reprograms the card's multicast filter
+// (net_set_multicast) with the link addresses of the groups and of
+// all-hosts (224.0.0.1, where queries go), so frames for other groups are
+// dropped by the card and never reach the stack. A hash filter lets
+// through some groups nobody joined, so IP still checks ipv4_in_group.
+#define IGMP_ROBUSTNESS         2
+#define IGMP_UNSOLICITED_MS     1000
+#define IGMP_OLDER_QUERIER_MS   260000      // Robustness x query interval + response interval
+
+// Message types
+#define IGMP_QUERY              0x11
+#define IGMP_V1_REPORT          0x12
+#define IGMP_V2_REPORT          0x16
+#define IGMP_V2_LEAVE           0x17
+#define IGMP_V3_REPORT          0x22
+
+// v3 group record types
+#define IGMP_MODE_IS_EXCLUDE    2           // Current state, in answer to a query
+#define IGMP_TO_INCLUDE         3           // Leave: include no sources
+#define IGMP_TO_EXCLUDE         4           // Join: exclude no sources
+
+typedef struct {
+    uint8_t type;
+    uint8_t max_resp;           // Queries: tenths of a second (v3: coded)
+    uint16_t checksum;
+    ipv4_addr_t group;
+} __attribute__((packed)) igmp_v2_t;
+
+typedef struct {
+    uint8_t type;               // IGMP_V3_REPORT
+    uint8_t reserved;
+    uint16_t checksum;
+    uint16_t reserved2;
+    uint16_t records;
+} __attribute__((packed)) igmp_v3_report_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t aux_len;
+    uint16_t sources;
+    ipv4_addr_t group;
+} __attribute__((packed)) igmp_v3_record_t;
+
+typedef struct {
+    ipv4_addr_t group;
+    uint16_t refs;              // Joins not yet left; 0: leaving or free
+    uint8_t reports;            // Unsolicited reports still to send
+    bool leaving;               // v3: the reports left are leave records
+    bool in_use;
+    ktimer_t timer;             // Next report
+} igmp_group_t;
+
+typedef struct {
+    uint32_t groups;            // Joined now
+    uint32_t joins;             // First joins
+    uint32_t leaves;            // Last leaves
+    uint32_t reports_sent;
+    uint32_t leaves_sent;
+    uint32_t queries;
+    uint32_t v2_queries;        // From older queriers
+    uint32_t filter_updates;    // Card filter reprogrammed
+} igmp_stats_t;
+
+// Membership: NET_SUCCESS, NET_INVALID for a non-group address, or
+// NET_NO_MEMORY with IP_MAX_GROUPS joined. Leave drops one join.
+int ipv4_join_group(const ipv4_addr_t* group);
+void ipv4_leave_group(const ipv4_addr_t* group);
+
+// Joined, or all-hosts: datagrams to it are delivered like ours
+int ipv4_in_group(const ipv4_addr_t* ip);
+
+// An IGMP message for us, from the IP layer
+void igmp_handle_packet(const void* data, uint32_t len);
+
+void igmp_get_stats(igmp_stats_t* stats);
+void igmp_print_info(void);
+
+#endif // IGMP_H
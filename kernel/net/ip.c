@@ -1,91 +1,157 @@
 #include "ip.h"
 #include "eth.h"
+#include "udp.h"
+#include "tcp.h"
+#include "arp.h"
 #include "../mm/memory.h"
+#include "../arch/spinlock.h"
 #include "../drivers/vga.h"
 
 // Global IP state
 static ipv4_addr_t our_ip = {{192, 168, 1, 100}};  // Default IP
-static ipv4_addr_t netmask __attribute__((unused)) = {{255, 255, 255, 0}}; // Default netmask
-static ipv4_addr_t gateway __attribute__((unused)) = {{192, 168, 1, 1}};   // Default gateway
+static ipv4_addr_t netmask = {{255, 255, 255, 0}}; // Default netmask
+static ipv4_addr_t gateway = {{192, 168, 1, 1}};   // Default gateway
 
 // Initialize IP layer
 int ipv4_init(void) {
     vga_write_string("Initializing IPv4 protocol...\n");
-    return NET_SUCCESS;
+    int result = pbuf_init();
+    return result == NET_SUCCESS ? arp_init() : result;
 }
 
-// Send an IP packet
-int ipv4_send_packet(const ipv4_addr_t* dst_ip, uint8_t protocol,
-                     const void* data, uint32_t data_len) {
-    // Calculate total packet size
-    uint32_t total_len = sizeof(ipv4_header_t) + data_len;
+static bool ipv4_on_link(const ipv4_addr_t* ip) {
+    for (int i = 0; i < 4; i++) {
+        if ((ip->addr[i] & netmask.addr[i]) != (our_ip.addr[i] & netmask.addr[i])) return false;
+    }
+    return true;
+}
 
-    // Allocate packet buffer
-    uint8_t* packet = (uint8_t*)kmalloc(total_len);
-    if (!packet) {
-        return NET_NO_MEMORY;
+void ipv4_learn_neighbor(const ipv4_addr_t* ip, const mac_addr_t* mac) {
+    if (ipv4_on_link(ip)) arp_learn(ip, mac);
+}
+
+// Where a packet for dst_ip goes on the wire: itself on the local subnet,
+// the gateway beyond it; the broadcast address while ARP has no answer
+bool ipv4_next_hop_mac(const ipv4_addr_t* dst_ip, mac_addr_t* mac) {
+    const ipv4_addr_t* hop = ipv4_on_link(dst_ip) ? dst_ip : &gateway;
+    if (arp_lookup(hop, mac)) return true;
+    memset(mac, 0xFF, sizeof(mac_addr_t));
+    return false;
+}
+
+// The IP and Ethernet headers pushed in front of the payload; options
+// (a multiple of 4 bytes) go after the fixed header
+static int ipv4_output_pbuf(const ipv4_addr_t* dst_ip, uint8_t protocol, pbuf_t* p, uint16_t csum_offset,
+                            uint8_t ttl, const uint8_t* options, uint32_t options_len) {
+    net_interface_t* iface = net_get_interface();
+    uint32_t header_len = sizeof(ipv4_header_t) + options_len;
+    uint32_t total_len = header_len + p->len;
+    ipv4_header_t* header = total_len <= ETH_MTU ? (ipv4_header_t*)pbuf_push(p, header_len) : NULL;
+    eth_header_t* eth = header ? (eth_header_t*)pbuf_push(p, sizeof(eth_header_t)) : NULL;
+    if (!iface || !eth) {
+        pbuf_free(p);
+        return iface ? NET_INVALID : NET_ERROR;
     }
 
-    ipv4_header_t* header = (ipv4_header_t*)packet;
+    if (ipv4_is_multicast(dst_ip)) {
+        ipv4_multicast_mac(dst_ip, &eth->dst_mac);
+    } else {
+        ipv4_next_hop_mac(dst_ip, &eth->dst_mac);
+    }
+    eth->src_mac = iface->mac_addr;
+    eth->ethertype = net_htons(ETH_TYPE_IP);
 
     // Fill IP header
-    header->version_ihl = (4 << 4) | 5;  // IPv4, 5*4=20 byte header
+    header->version_ihl = (uint8_t)((4 << 4) | (header_len / 4));  // IPv4, length in words
     header->tos = 0;
-    header->total_len = total_len;
+    header->total_len = net_htons(total_len);
     header->id = 0;  // TODO: proper ID assignment
     header->flags_frag = 0;
-    header->ttl = 64;
+    header->ttl = ttl;
     header->protocol = protocol;
     header->checksum = 0;
     header->src_ip = our_ip;
     header->dst_ip = *dst_ip;
+    if (options_len) memcpy(header + 1, options, options_len);
 
     // Calculate checksum
-    header->checksum = ipv4_checksum(header);
+    header->checksum = net_checksum(header, header_len);
 
-    // Copy data
-    memcpy(packet + sizeof(ipv4_header_t), data, data_len);
+    // Send through the registered card
+    return net_send_pbuf(p, sizeof(eth_header_t) + header_len, csum_offset);
+}
 
-    // Send via Ethernet
-    int result = rtl8139_send_packet(packet, total_len);
+int ipv4_send_pbuf(const ipv4_addr_t* dst_ip, uint8_t protocol, pbuf_t* p, uint16_t csum_offset) {
+    return ipv4_output_pbuf(dst_ip, protocol, p, csum_offset, 64, NULL, 0);
+}
 
-    kfree(packet);
-    return result;
+int ipv4_send_control(const ipv4_addr_t* dst_ip, uint8_t protocol, pbuf_t* p) {
+    // Router Alert (RFC 2113): copied, type 20, length 4, value 0
+    static const uint8_t router_alert[IP_ROUTER_ALERT_LEN] = { 0x94, 0x04, 0x00, 0x00 };
+    return ipv4_output_pbuf(dst_ip, protocol, p, PBUF_CSUM_NONE, 1, router_alert, sizeof(router_alert));
 }
 
-// Handle incoming IP packet
+// A payload from elsewhere: copied once, into a pbuf the headers go in front of
+static int ipv4_output(const ipv4_addr_t* dst_ip, uint8_t protocol,
+                       const void* data, uint32_t data_len, uint16_t csum_offset) {
+    if (sizeof(ipv4_header_t) + data_len > ETH_MTU) {
+        return NET_INVALID;
+    }
+    pbuf_t* p = pbuf_alloc(PBUF_HEADROOM);
+    if (!p) {
+        return NET_NO_MEMORY;
+    }
+    memcpy(pbuf_put(p, data_len), data, data_len);
+    return ipv4_send_pbuf(dst_ip, protocol, p, csum_offset);
+}
+
+int ipv4_send_packet(const ipv4_addr_t* dst_ip, uint8_t protocol,
+                     const void* data, uint32_t data_len) {
+    return ipv4_output(dst_ip, protocol, data, data_len, PBUF_CSUM_NONE);
+}
+
+int ipv4_send_packet_csum(const ipv4_addr_t* dst_ip, uint8_t protocol,
+                          const void* data, uint32_t data_len, uint16_t csum_offset) {
+    if (csum_offset + 2u > data_len) return NET_INVALID;
+    return ipv4_output(dst_ip, protocol, data, data_len, csum_offset);
+}
+
+// Handle incoming IP packet: validated and routed in place
 int ipv4_handle_packet(const ipv4_packet_t* packet, uint32_t len) {
     const ipv4_header_t* header = &packet->header;
-
-    // Basic validation
-    if ((header->version_ihl >> 4) != 4) {
+    if (len < sizeof(ipv4_header_t) || (header->version_ihl >> 4) != 4) {
         return NET_INVALID; // Not IPv4
     }
 
-    if (header->total_len > len) {
+    uint32_t header_len = (header->version_ihl & 0x0F) * 4;
+    uint32_t total_len = net_ntohs(header->total_len);
+    if (header_len < sizeof(ipv4_header_t) || total_len < header_len || total_len > len) {
         return NET_INVALID; // Packet too short
     }
 
-    // Verify checksum
-    ipv4_header_t temp_header = *header;
-    uint16_t checksum = temp_header.checksum;
-    temp_header.checksum = 0;
-    if (ipv4_checksum(&temp_header) != checksum) {
+    // A header with its checksum folds to zero
+    if (net_checksum(header, header_len) != 0) {
         return NET_INVALID; // Bad checksum
     }
 
     // Check if packet is for us
-    if (!ipv4_is_our_address(&header->dst_ip)) {
+    if (!ipv4_is_our_address(&header->dst_ip) && !ipv4_in_group(&header->dst_ip)) {
         return NET_SUCCESS; // Not for us, ignore
     }
 
+    const uint8_t* data = (const uint8_t*)packet + header_len;
+    uint32_t data_len = total_len - header_len;
+
     // Route to appropriate protocol handler
     switch (header->protocol) {
         case IP_PROTO_TCP:
-            // TODO: TCP handler
-            break;
+            return tcp_handle_packet((const tcp_packet_t*)data, data_len,
+                                     &header->src_ip, &header->dst_ip);
         case IP_PROTO_UDP:
-            // TODO: UDP handler
+            return udp_handle_packet((const udp_packet_t*)data, data_len,
+                                     &header->src_ip, &header->dst_ip);
+        case IP_PROTO_IGMP:
+            igmp_handle_packet(data, data_len);
             break;
         case IP_PROTO_ICMP:
             // TODO: ICMP handler
@@ -98,6 +164,10 @@ int ipv4_handle_packet(const ipv4_packet_t* packet, uint32_t len) {
     return NET_SUCCESS;
 }
 
+void net_handle_ipv4(const void* packet, uint32_t len) {
+    ipv4_handle_packet((const ipv4_packet_t*)packet, len);
+}
+
 // Calculate IP header checksum
 uint16_t ipv4_checksum(const ipv4_header_t* header) {
     return net_checksum(header, sizeof(ipv4_header_t));
@@ -111,4 +181,31 @@ int ipv4_is_our_address(const ipv4_addr_t* ip) {
 // Get our IP address
 const ipv4_addr_t* ipv4_get_our_address(void) {
     return &our_ip;
-}
\ No newline at end of file
+}
+
+// Dotted quad; str holds at least 16 bytes
+void net_ip_to_string(const ipv4_addr_t* ip, char* str) {
+    for (int i = 0; i < 4; i++) {
+        uint8_t value = ip->addr[i];
+        if (i) *str++ = '.';
+        if (value >= 100) *str++ = (char)('0' + value / 100);
+        if (value >= 10) *str++ = (char)('0' + value / 10 % 10);
+        *str++ = (char)('0' + value % 10);
+    }
+    *str = '\0';
+}
+
+int net_string_to_ip(const char* str, ipv4_addr_t* ip) {
+    for (int i = 0; i < 4; i++) {
+        uint32_t value = 0;
+        int digits = 0;
+        while (*str >= '0' && *str <= '9' && digits < 4) {
+            value = value * 10 + (uint32_t)(*str++ - '0');
+            digits++;
+        }
+        if (!digits || value > 255 || *str != (i < 3 ? '.' : '\0')) return NET_INVALID;
+        ip->addr[i] = (uint8_t)value;
+        str++;
+    }
+    return NET_SUCCESS;
+}
@@ -2,6 +2,10 @@
 #define IP_H
 
 #include "net.h"
+#include "pbuf.h"
+#include "igmp.h"               // Multicast membership
+
+#define IP_MAX_GROUPS       8       // Multicast groups joined at once
 
 // IP packet structure
 typedef struct {
@@ -13,11 +17,32 @@ typedef struct {
 int ipv4_init(void);
 int ipv4_send_packet(const ipv4_addr_t* dst_ip, uint8_t protocol,
                      const void* data, uint32_t data_len);
+// The payload's checksum field, csum_offset bytes in, holds the
+// pseudo-header sum: finished by the card or in software before it goes
+int ipv4_send_packet_csum(const ipv4_addr_t* dst_ip, uint8_t protocol,
+                          const void* data, uint32_t data_len, uint16_t csum_offset);
+// The payload already in a pbuf with PBUF_HEADROOM in front: the headers
+// go in place and the reference goes with the send (PBUF_CSUM_NONE for no
+// checksum to finish)
+int ipv4_send_pbuf(const ipv4_addr_t* dst_ip, uint8_t protocol, pbuf_t* p, uint16_t csum_offset);
+// Link-local control traffic (IGMP): TTL 1 and the Router Alert option, so
+// the payload needs IP_ROUTER_ALERT_LEN more headroom
+#define IP_ROUTER_ALERT_LEN 4
+int ipv4_send_control(const ipv4_addr_t* dst_ip, uint8_t protocol, pbuf_t* p);
 int ipv4_handle_packet(const ipv4_packet_t* packet, uint32_t len);
 
+// A host on the subnet, as seen on a packet from it: into the ARP cache
+void ipv4_learn_neighbor(const ipv4_addr_t* ip, const mac_addr_t* mac);
+
+// The link address packets for dst_ip are framed for: the host's, or the
+// gateway's beyond the subnet, from the ARP cache. Never waits: false,
+// with the broadcast address, while the answer is still out.
+bool ipv4_next_hop_mac(const ipv4_addr_t* dst_ip, mac_addr_t* mac);
+
 // Utility functions
 uint16_t ipv4_checksum(const ipv4_header_t* header);
 int ipv4_is_our_address(const ipv4_addr_t* ip);
+const ipv4_addr_t* ipv4_get_our_address(void);
 void ipv4_set_address(const ipv4_addr_t* ip, const ipv4_addr_t* netmask, const ipv4_addr_t* gateway);
 
 #endif // IP_H
\ No newline at end of file
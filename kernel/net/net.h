@@ -2,6 +2,9 @@
 #define NET_H
 
 #include "../types.h"
+#include "../proc/poll.h"
+#include "../proc/timer.h"
+#include "checksum.h"
 
 // Forward declarations
 typedef struct tcp_connection tcp_connection_t;
@@ -42,6 +45,7 @@ typedef enum {
 
 // IP protocol types
 #define IP_PROTO_ICMP       1
+#define IP_PROTO_IGMP       2
 #define IP_PROTO_TCP        6
 #define IP_PROTO_UDP        17
 
@@ -127,6 +131,12 @@ typedef struct sockaddr_in {
     char sin_zero[8];       // Padding
 } sockaddr_in_t;
 
+struct pbuf;
+
+// net_interface_t.offloads
+#define NET_OFFLOAD_TX_CSUM     0x01        // Fills in TCP/UDP checksums (send_packet_csum)
+#define NET_OFFLOAD_RX_CSUM     0x02        // Vouches for checksums of frames it received
+
 // Network interface structure
 typedef struct {
     mac_addr_t mac_addr;
@@ -135,31 +145,126 @@ typedef struct {
     ipv4_addr_t gateway;
     char name[16];
     int mtu;
+    uint32_t offloads;
     int (*send_packet)(const void* data, uint32_t len);
     int (*recv_packet)(void* buffer, uint32_t len);
+    // With NET_OFFLOAD_TX_CSUM: the card sums everything from csum_start
+    // and stores the checksum csum_offset bytes after it
+    int (*send_packet_csum)(const void* data, uint32_t len, uint16_t csum_start, uint16_t csum_offset);
+    // Optional: send the frame out of the pbuf itself, taking the
+    // reference; csum_offset PBUF_CSUM_NONE for no checksum to finish
+    int (*send_pbuf)(struct pbuf* p, uint16_t csum_start, uint16_t csum_offset);
+    // Optional busy polling: while any caller is between rx_busy(true) and
+    // rx_busy(false) receive interrupts stay off, and rx_poll walks the
+    // ring from the caller (up to budget frames; 0 when it is empty or in
+    // another pass)
+    void (*rx_busy)(bool on);
+    uint32_t (*rx_poll)(uint32_t budget);
+    // Optional: accept multicast frames only for these link addresses
+    // (count 0: none), from task context
+    int (*set_multicast)(const mac_addr_t* macs, uint32_t count);
 } net_interface_t;
 
-// TCP connection structure (full definition)
+// TCP connection structure (full definition). Ports and sequence numbers
+// are in host order; tcp.h describes the buffers and timers.
+#define TCP_OOO_RANGES      4       // Out-of-order stretches kept for reassembly
+
+typedef struct {
+    uint32_t start;             // Sequence numbers, [start, end)
+    uint32_t end;
+} tcp_range_t;
+
 typedef struct tcp_connection {
     tcp_state_t state;
     ipv4_addr_t local_ip;
     ipv4_addr_t remote_ip;
     uint16_t local_port;
     uint16_t remote_port;
-    uint32_t seq_num;
-    uint32_t ack_num;
-    uint32_t window_size;
+    uint32_t seq_num;           // Next to send (SND.NXT)
+    uint32_t ack_num;           // Next expected (RCV.NXT)
+    uint32_t window_size;       // Peer's window (SND.WND)
+
+    // Send buffer: every byte from snd_data on, sent or not, at seq & mask
+    uint8_t* send_buf;
+    uint32_t iss;
+    uint32_t snd_una;           // Oldest unacknowledged
+    uint32_t snd_data;          // First byte still buffered
+    uint32_t snd_len;
+    uint32_t fin_seq;           // Our FIN, once sent
+    uint16_t mss;               // Largest segment the peer takes
+    uint8_t dup_acks;
+    bool fin_queued;            // Closing: a FIN goes after the data
+    bool fin_sent;
+
+    // Receive buffer: unread bytes [rcv_read, ack_num), out-of-order
+    // stretches beyond
+    uint8_t* recv_buf;
+    uint32_t irs;
+    uint32_t rcv_read;
+    uint32_t rcv_adv;           // Right edge of the window last advertised
+    tcp_range_t ooo[TCP_OOO_RANGES];
+    uint32_t ooo_count;
+    uint32_t peer_fin_seq;      // Peer's FIN, seen ahead of data still missing
+    bool peer_fin_pending;
+    bool peer_fin;              // End of stream once the buffer is read
+    uint8_t ack_pending;        // Segments taken in since our last ACK
+
+    // Retransmission (RFC 6298)
+    uint32_t srtt_us;           // 0 until the first sample
+    uint32_t rttvar_us;
+    uint32_t rto_ms;
+    uint32_t rtt_seq;           // Timed segment ends here
+    uint64_t rtt_start_ns;
+    bool rtt_timing;
+    uint8_t retries;            // Timeouts in a row
+    ktimer_t rto_timer;         // Retransmit, persist, SYN retry and TIME_WAIT
+    ktimer_t ack_timer;         // Delayed ACK
+
+    // Options
+    bool nodelay;
+    bool quickack;
+    uint16_t ack_delay_ms;
+    uint32_t busy_poll_us;      // SO_BUSY_POLL
+
+    // Passive open: children are queued on their listener until accepted
+    struct tcp_connection* listener;
+    struct tcp_connection* accept_next;
+    struct tcp_connection* accept_head;
+    struct tcp_connection* accept_tail;
+    uint16_t backlog;
+    uint16_t pending;           // Children not yet accepted
+
+    bool orphan;                // No owner: freed once closed
+    int error;                  // NET_TIMEOUT or NET_ERROR once reset
+    volatile uint32_t events;   // Bumped on every change; futex word of waiters
+
+    uint32_t segs_in;
+    uint32_t segs_out;
+    uint64_t rx_tsc;            // Latest segment with data off the card
+    uint32_t retransmits;
+    uint32_t fast_retransmits;
+    uint32_t ooo_segments;
+
+    poll_head_t poll;           // Sockets watched in poll sets
+    uint32_t id;                // Never reused: what its timers carry
+
+    // Demultiplexing: the 4-tuple's hash, fixed at creation, and the chain
+    // of its bucket (a listener: of its port's bucket)
+    uint32_t hash;
+    struct tcp_connection* hash_next;
     struct tcp_connection* next;
 } tcp_connection_t;
 
 // Socket structure
 typedef struct socket {
+    int fd;
     int domain;
     int type;
     int protocol;
     union {
         tcp_connection_t* tcp_conn;
-        // UDP and raw socket data would go here
+        struct udp_socket* udp_sock;
+        // Raw socket data would go here
     } data;
     struct socket* next;
 } socket_t;
@@ -169,6 +274,65 @@ int net_init(void);
 int net_interface_up(net_interface_t* iface);
 int net_interface_down(net_interface_t* iface);
 
+// The card frames are sent through: the last one registered by its driver
+void net_register_interface(net_interface_t* iface);
+net_interface_t* net_get_interface(void);
+int net_send_frame(const void* data, uint32_t len);
+
+// Program the card's multicast filter (NET_SUCCESS if it has none to
+// program: it then takes every group, and IP sorts them out)
+int net_set_multicast(const mac_addr_t* macs, uint32_t count);
+
+// Send the frame in a pbuf, taking the caller's reference. Unless
+// csum_offset is PBUF_CSUM_NONE, the TCP/UDP checksum field csum_offset
+// bytes into the segment at csum_start holds the pseudo-header sum
+// (csum_pseudo, not folded or complemented): the card completes it, or
+// this does in place first.
+int net_send_pbuf(struct pbuf* p, uint16_t csum_start, uint16_t csum_offset);
+
+// A driver's receive pass: a frame, stamped with the TSC when the driver
+// took it off the card (neither card here stamps frames itself), and
+// whether the card checked its checksums (NET_OFFLOAD_RX_CSUM). The stack
+// handles it to the end on this CPU, and anything it calls can ask for
+// the frame's stamp and whether it was checked. Outside a receive pass
+// the stamp is the TSC now.
+void net_receive(const void* packet, uint32_t len, uint64_t rx_tsc, bool csum_ok);
+uint64_t net_rx_timestamp(void);
+bool net_rx_csum_verified(void);
+
+// Busy polling. A socket with SO_BUSY_POLL set, blocking on an isolated
+// core, does not sleep at once: it walks the card's receive ring itself,
+// receive interrupts off, for up to that many microseconds, and only then
+// arms the interrupt and sleeps. The frame it is waiting for goes from the
+// card to the stack on its own CPU, with no interrupt, wakeup or context
+// switch on the way. Elsewhere the option does nothing: spinning would take
+// the CPU from other tasks.
+#define SO_BUSY_POLL            46          // us a blocking receive spins, 0 off
+#define NET_BUSY_POLL_MAX_US    100000
+#define NET_BUSY_POLL_BUDGET    8           // Frames per pass
+
+typedef struct {
+    uint32_t waits;             // Spins started
+    uint32_t hits;              // Ended by what was waited for
+    uint32_t sleeps;            // Ran out, went to sleep
+    uint32_t passes;            // Over the ring that found frames
+    uint32_t frames;
+} net_busy_poll_stats_t;
+
+// Spin until *word is no longer 'seen' (the futex word the caller would
+// sleep on), for up to budget_us, polling the card; true if it changed.
+// False at once with no budget or off an isolated core.
+bool net_busy_wait(volatile uint32_t* word, uint32_t seen, uint32_t budget_us);
+
+// The pieces of it, for waits that spin on their own terms (busy poll
+// sets): frames handled by one pass between begin and end
+void net_busy_poll_begin(void);
+uint32_t net_busy_poll(void);
+void net_busy_poll_end(void);
+
+void net_busy_poll_get_stats(net_busy_poll_stats_t* stats);
+void net_busy_poll_print_info(void);
+
 // Socket API
 int socket_create(int domain, int type, int protocol);
 int socket_bind(int sockfd, const sockaddr_t* addr);
@@ -182,6 +346,7 @@ int socket_close(int sockfd);
 // Utility functions
 void net_ip_to_string(const ipv4_addr_t* ip, char* str);
 int net_string_to_ip(const char* str, ipv4_addr_t* ip);
+int net_string_to_mac(const char* str, mac_addr_t* mac);
 
 // Protocol handlers
 void net_handle_ethernet(const void* packet, uint32_t len);
@@ -191,26 +356,29 @@ void net_handle_udp(const void* packet, uint32_t len);
 
 // Network checksum calculation (Internet checksum)
 static inline uint16_t net_checksum(const void* data, uint32_t len) {
-    const uint16_t* ptr = (const uint16_t*)data;
-    uint32_t sum = 0;
-    
-    // Sum all 16-bit words
-    while (len > 1) {
-        sum += *ptr++;
-        len -= 2;
-    }
-    
-    // Add left-over byte, if any
-    if (len > 0) {
-        sum += *(const uint8_t*)ptr;
-    }
-    
-    // Fold 32-bit sum to 16 bits
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
-    
-    return ~sum;
+    return csum_fold(csum_partial(data, len, 0));
+}
+
+// Network byte order
+static inline uint16_t net_ntohs(uint16_t value) {
+    return (uint16_t)((value << 8) | (value >> 8));
+}
+
+static inline uint32_t net_ntohl(uint32_t value) {
+    return (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+}
+
+#define net_htons(value)    net_ntohs(value)
+#define net_htonl(value)    net_ntohl(value)
+
+// 224.0.0.0/4
+static inline bool ipv4_is_multicast(const ipv4_addr_t* ip) {
+    return (ip->addr[0] & 0xF0) == 0xE0;
+}
+
+// A group's link address: 01:00:5e and its low 23 bits
+static inline void ipv4_multicast_mac(const ipv4_addr_t* group, mac_addr_t* mac) {
+    *mac = (mac_addr_t){{0x01, 0x00, 0x5E, (uint8_t)(group->addr[1] & 0x7F), group->addr[2], group->addr[3]}};
 }
 
 // Convert MAC address to string
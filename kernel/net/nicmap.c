@@ -0,0 +1,404 @@
+#include "nicmap.h"
+#include "ip.h"
+#include "udp.h"
+#include "../proc/process.h"
+#include "../proc/scheduler.h"
+#include "../proc/futex.h"
+#include "../proc/mutex.h"
+#include "../arch/smp.h"
+#include "../arch/cpu.h"
+#include "../arch/tsc.h"
+#include "../arch/spinlock.h"
+#include "../mm/memory.h"
+#include "../mm/frame.h"
+#include "../mm/paging.h"
+#include "../drivers/vga.h"
+
+#define NICMAP_MAP_FLAGS        (PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER | PAGE_SHARED)
+
+// The process can write anything into the shared page, so the kernel keeps
+// its own indices and never takes an offset or a mask from there
+typedef struct {
+    process_t* owner;           // NULL = no session
+    nicmap_ring_t* ring;        // Kernel address
+    uint8_t* buffers;
+    uint32_t user_addr;         // The ring as the owner sees it
+    uint32_t order;
+    uint16_t ports[NICMAP_MAX_PORTS];
+    uint32_t port_count;
+    uint32_t rx_head;
+    uint32_t tx_tail;
+} nicmap_session_t;
+
+static nicmap_session_t session;
+static volatile bool session_active = false;    // Unlocked check on every frame
+static spinlock_t rx_lock = SPINLOCK_INIT;      // Receive producers, any CPU
+static kmutex_t tx_mutex = KMUTEX_INIT("nicmap_tx");   // A drain, or the session changing
+static nicmap_stats_t nicmap_stats;
+
+static process_t* poller = NULL;
+static volatile uint32_t poller_seq = 0;        // Bumped by attach; the idle poller sleeps on it
+static bool poller_isolated = false;
+
+static void nicmap_tx_task(void);
+
+static int nicmap_start_poller(void) {
+    if (poller) return 0;
+
+    int32_t cpu = -1;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (smp_cpu_online(i) && smp_cpu_isolated(i)) {
+            cpu = (int32_t)i;
+            break;
+        }
+    }
+
+    process_t* task = process_create("nicmap_tx", nicmap_tx_task, cpu >= 0 ? PRIORITY_REALTIME : PRIORITY_HIGH);
+    if (!task) return -1;
+    if (cpu >= 0) {
+        task->policy = SCHED_FIFO;
+        if (scheduler_set_affinity(task, cpu) < 0) {
+            process_destroy(task);
+            return -1;
+        }
+    }
+    poller_isolated = cpu >= 0 && tsc_available();
+    poller = task;
+    scheduler_add_process(task);
+    return 0;
+}
+
+nicmap_ring_t* nicmap_attach(process_t* process, const uint16_t* ports, uint32_t count) {
+    if (!process || !ports || count == 0 || count > NICMAP_MAX_PORTS || !net_get_interface()) return NULL;
+    for (uint32_t i = 0; i < count; i++) {
+        if (ports[i] == 0) return NULL;
+    }
+    if (nicmap_start_poller() < 0) return NULL;
+
+    // One block, so the identity address works as well as a mapping
+    uint32_t order = frame_order(NICMAP_MAP_SIZE);
+    uint32_t phys = frame_alloc_pages(order);
+    if (!phys) return NULL;
+
+    nicmap_ring_t* ring = (nicmap_ring_t*)phys;
+    memset(ring, 0, PAGE_SIZE);
+    ring->mask = NICMAP_SLOTS - 1;
+    ring->mac = net_get_interface()->mac_addr;
+    ring->ip = *ipv4_get_our_address();
+    for (uint32_t i = 0; i < count; i++) {
+        ring->ports[i] = ports[i];
+    }
+    for (uint32_t i = 0; i < NICMAP_SLOTS; i++) {
+        ring->rx[i].offset = NICMAP_BUFFER_OFFSET + i * NICMAP_SLOT_SIZE;
+        ring->tx[i].offset = NICMAP_BUFFER_OFFSET + (NICMAP_SLOTS + i) * NICMAP_SLOT_SIZE;
+    }
+
+    uint32_t user_addr = phys;
+    if (process->page_directory) {
+        page_directory_t* dir = (page_directory_t*)process->page_directory;
+        user_addr = NICMAP_VIRTUAL_BASE;
+        if (map_region(dir, user_addr, phys, NICMAP_MAP_SIZE, NICMAP_MAP_FLAGS) != 0) {
+            unmap_region(dir, user_addr, NICMAP_MAP_SIZE);
+            frame_free_pages(phys, order);
+            return NULL;
+        }
+    }
+
+    kmutex_lock(&tx_mutex);
+    uint32_t flags = spin_lock_irqsave(&rx_lock);
+    bool taken = session.owner != NULL;
+    if (!taken) {
+        session.owner = process;
+        session.ring = ring;
+        session.buffers = (uint8_t*)(phys + NICMAP_BUFFER_OFFSET);
+        session.user_addr = user_addr;
+        session.order = order;
+        for (uint32_t i = 0; i < count; i++) {
+            session.ports[i] = ports[i];
+        }
+        session.port_count = count;
+        session.rx_head = 0;
+        session.tx_tail = 0;
+        session_active = true;
+        nicmap_stats.attached = true;
+        nicmap_stats.owner_pid = process->pid;
+        nicmap_stats.attaches++;
+    }
+    spin_unlock_irqrestore(&rx_lock, flags);
+    kmutex_unlock(&tx_mutex);
+
+    if (taken) {
+        if (process->page_directory) {
+            unmap_region((page_directory_t*)process->page_directory, user_addr, NICMAP_MAP_SIZE);
+        }
+        frame_free_pages(phys, order);
+        return NULL;
+    }
+
+    __sync_fetch_and_add(&poller_seq, 1);
+    futex_wake(&poller_seq, 1);
+    return (nicmap_ring_t*)user_addr;
+}
+
+void nicmap_release(process_t* process) {
+    if (!process || session.owner != process) return;
+
+    // Holding both means no drain and no receive copy is inside the rings
+    kmutex_lock(&tx_mutex);
+    uint32_t flags = spin_lock_irqsave(&rx_lock);
+    if (session.owner != process) {
+        spin_unlock_irqrestore(&rx_lock, flags);
+        kmutex_unlock(&tx_mutex);
+        return;
+    }
+    nicmap_session_t old = session;
+    memset(&session, 0, sizeof(session));
+    session_active = false;
+    nicmap_stats.attached = false;
+    nicmap_stats.owner_pid = 0;
+    spin_unlock_irqrestore(&rx_lock, flags);
+    kmutex_unlock(&tx_mutex);
+
+    if (process->page_directory) {
+        unmap_region((page_directory_t*)process->page_directory, old.user_addr, NICMAP_MAP_SIZE);
+    }
+    frame_free_pages((uint32_t)old.ring, old.order);
+}
+
+bool nicmap_steer(const void* frame, uint32_t len) {
+    if (!session_active) return false;
+
+    const eth_header_t* eth = (const eth_header_t*)frame;
+    if (len < sizeof(eth_header_t) + sizeof(ipv4_header_t) + sizeof(udp_packet_t) ||
+        len > NICMAP_SLOT_SIZE || net_ntohs(eth->ethertype) != ETH_TYPE_IP) {
+        return false;
+    }
+    const ipv4_header_t* ip = (const ipv4_header_t*)(eth + 1);
+    uint32_t ihl = (ip->version_ihl & 0x0F) * 4;
+    if (ip->protocol != IP_PROTO_UDP || ihl < sizeof(ipv4_header_t) ||
+        len < sizeof(eth_header_t) + ihl + sizeof(udp_packet_t)) {
+        return false;
+    }
+    // Fragments: only the first has the ports, so none are taken
+    if (net_ntohs(ip->flags_frag) & 0x3FFF) return false;
+    const udp_packet_t* udp = (const udp_packet_t*)((const uint8_t*)ip + ihl);
+    uint16_t port = net_ntohs(udp->dst_port);
+
+    uint32_t flags = spin_lock_irqsave(&rx_lock);
+    bool ours = false;
+    for (uint32_t i = 0; session_active && i < session.port_count; i++) {
+        if (session.ports[i] == port) {
+            ours = true;
+            break;
+        }
+    }
+    if (!ours) {
+        spin_unlock_irqrestore(&rx_lock, flags);
+        return false;
+    }
+
+    nicmap_ring_t* ring = session.ring;
+    uint32_t index = session.rx_head & (NICMAP_SLOTS - 1);
+    if (session.rx_head - ring->rx_tail >= NICMAP_SLOTS) {
+        nicmap_stats.rx_dropped++;
+        ring->rx_dropped = nicmap_stats.rx_dropped;
+    } else {
+        memcpy(session.buffers + index * NICMAP_SLOT_SIZE, frame, len);
+        nicmap_slot_t* slot = &ring->rx[index];
+        slot->offset = NICMAP_BUFFER_OFFSET + index * NICMAP_SLOT_SIZE;
+        slot->len = (uint16_t)len;
+        slot->flags = 0;
+        slot->rx_tsc = net_rx_timestamp();
+        __sync_synchronize();       // Frame visible before the head
+        ring->rx_head = ++session.rx_head;
+        nicmap_stats.rx_steered++;
+    }
+    spin_unlock_irqrestore(&rx_lock, flags);
+    return true;
+}
+
+// Send what the owner published (tx_mutex held); frames handed over or
+// refused as malformed
+static uint32_t nicmap_tx_drain(void) {
+    nicmap_ring_t* ring = session.ring;
+    uint32_t head = ring->tx_head;
+    __sync_synchronize();           // Head read before the slots
+    if (head - session.tx_tail > NICMAP_SLOTS) {
+        // Not a head the owner could have published: skip to it
+        nicmap_stats.tx_errors++;
+        session.tx_tail = head;
+        ring->tx_tail = head;
+        ring->tx_errors = nicmap_stats.tx_errors;
+        return 1;
+    }
+
+    uint32_t done = 0;
+    while (session.tx_tail != head) {
+        uint32_t index = session.tx_tail & (NICMAP_SLOTS - 1);
+        uint32_t len = ring->tx[index].len;
+        if (len < sizeof(eth_header_t) || len > sizeof(eth_header_t) + ETH_MTU) {
+            nicmap_stats.tx_errors++;
+            ring->tx_errors = nicmap_stats.tx_errors;
+        } else if (net_send_frame(session.buffers + (NICMAP_SLOTS + index) * NICMAP_SLOT_SIZE, len) != NET_SUCCESS) {
+            nicmap_stats.tx_retries++;
+            break;                  // Card full: this frame first, next pass
+        } else {
+            nicmap_stats.tx_sent++;
+        }
+        done++;
+        session.tx_tail++;
+        ring->tx_tail = session.tx_tail;
+    }
+    return done;
+}
+
+static void nicmap_tx_task(void) {
+    uint64_t idle_limit = poller_isolated ? tsc_ns_to_cycles((uint64_t)NICMAP_TX_IDLE_US * NSEC_PER_USEC) : 0;
+    uint64_t idle_since = poller_isolated ? rdtsc() : 0;
+
+    while (1) {
+        uint32_t seq = poller_seq;
+        kmutex_lock(&tx_mutex);
+        bool attached = session.owner != NULL;
+        uint32_t work = attached ? nicmap_tx_drain() : 0;
+        if (attached && work) session.ring->flags &= ~NICMAP_TX_SLOW;
+        kmutex_unlock(&tx_mutex);
+
+        if (!attached) {
+            futex_wait(&poller_seq, seq, FUTEX_WAIT_FOREVER);
+            if (poller_isolated) idle_since = rdtsc();
+            continue;
+        }
+        if (poller_isolated && (work || rdtsc() - idle_since < idle_limit)) {
+            if (work) idle_since = rdtsc();
+            cpu_relax();
+            continue;
+        }
+
+        // Idle: look again after a sleep, and say the next frame waits for it
+        kmutex_lock(&tx_mutex);
+        if (session.owner) {
+            session.ring->flags |= NICMAP_TX_SLOW;
+            nicmap_stats.poller_sleeps++;
+        }
+        kmutex_unlock(&tx_mutex);
+        futex_wait(&poller_seq, seq, NICMAP_TX_SLEEP_MS);
+    }
+}
+
+uint32_t sys_nicmap(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+    (void)arg1; (void)arg2; (void)arg3; (void)arg4;
+    if (!current_process || session.owner != current_process) return (uint32_t)-1;
+    return session.user_addr;
+}
+
+// Echo demo: a kernel task holding the bypass, turning every datagram
+// around through the rings alone, the way a process would
+static volatile uint16_t echo_port = 0;
+static volatile bool echo_stop = false;
+static process_t* echo_task = NULL;
+
+static void nicmap_echo_task(void) {
+    uint16_t port = echo_port;
+    nicmap_ring_t* ring = nicmap_attach(current_process, &port, 1);
+    if (!ring) {
+        echo_task = NULL;
+        return;
+    }
+
+    while (!echo_stop) {
+        nicmap_slot_t* rx = nicmap_rx_peek(ring);
+        nicmap_slot_t* tx = rx ? nicmap_tx_slot(ring) : NULL;
+        if (!rx || !tx) {
+            scheduler_yield();
+            continue;
+        }
+
+        // Swapping the addresses and ports leaves both checksums right
+        uint8_t* frame = (uint8_t*)nicmap_buffer(ring, tx);
+        memcpy(frame, nicmap_buffer(ring, rx), rx->len);
+        tx->len = rx->len;
+        nicmap_rx_done(ring);
+
+        eth_header_t* eth = (eth_header_t*)frame;
+        eth->dst_mac = eth->src_mac;
+        eth->src_mac = ring->mac;
+        ipv4_header_t* ip = (ipv4_header_t*)(eth + 1);
+        ipv4_addr_t addr = ip->src_ip;
+        ip->src_ip = ip->dst_ip;
+        ip->dst_ip = addr;
+        udp_packet_t* udp = (udp_packet_t*)((uint8_t*)ip + (ip->version_ihl & 0x0F) * 4);
+        uint16_t src_port = udp->src_port;
+        udp->src_port = udp->dst_port;
+        udp->dst_port = src_port;
+        nicmap_tx_push(ring);
+    }
+    nicmap_release(current_process);
+    echo_task = NULL;
+}
+
+int nicmap_echo_start(uint16_t port) {
+    if (echo_task || session.owner || port == 0) return -1;
+    echo_port = port;
+    echo_stop = false;
+    process_t* task = process_create("nicmap_echo", nicmap_echo_task, PRIORITY_NORMAL);
+    if (!task) return -1;
+    echo_task = task;
+    scheduler_add_process(task);
+    return 0;
+}
+
+void nicmap_echo_stop(void) {
+    echo_stop = true;
+}
+
+void nicmap_get_stats(nicmap_stats_t* stats) {
+    if (stats) *stats = nicmap_stats;
+}
+
+void nicmap_print_info(void) {
+    nicmap_stats_t stats;
+    nicmap_get_stats(&stats);
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== NIC Bypass ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string("Owner: ");
+    if (stats.attached) {
+        vga_write_string("pid ");
+        print_dec(stats.owner_pid);
+        vga_write_string(", ports");
+        uint32_t flags = spin_lock_irqsave(&rx_lock);
+        uint16_t ports[NICMAP_MAX_PORTS];
+        uint32_t count = session.port_count;
+        for (uint32_t i = 0; i < count; i++) {
+            ports[i] = session.ports[i];
+        }
+        spin_unlock_irqrestore(&rx_lock, flags);
+        for (uint32_t i = 0; i < count; i++) {
+            vga_write_string(" ");
+            print_dec(ports[i]);
+        }
+        vga_write_string("\n");
+    } else {
+        vga_write_string("none\n");
+    }
+    vga_write_string("Attaches: ");
+    print_dec(stats.attaches);
+    vga_write_string("  Poller: ");
+    vga_write_string(!poller ? "not started" : poller_isolated ? "spinning on an isolated CPU" : "timed");
+    vga_write_string("\nRX steered: ");
+    print_dec(stats.rx_steered);
+    vga_write_string("  dropped: ");
+    print_dec(stats.rx_dropped);
+    vga_write_string("\nTX sent: ");
+    print_dec(stats.tx_sent);
+    vga_write_string("  errors: ");
+    print_dec(stats.tx_errors);
+    vga_write_string("  retries: ");
+    print_dec(stats.tx_retries);
+    vga_write_string("  poller sleeps: ");
+    print_dec(stats.poller_sleeps);
+    vga_write_string("\n");
+}
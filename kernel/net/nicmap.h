@@ -0,0 +1,132 @@
+#ifndef NICMAP_H
+#define NICMAP_H
+
+#include "../types.h"
+#include "net.h"
+
+struct process;
+
+// Kernel bypass: the traffic of a few UDP ports handed to one process
+// through rings of packet buffers mapped into its address space, which it
+// polls and fills with plain loads and stores. After the one call that
+// finds the mapping there is no system call and no interrupt on its side,
+// and everything else arriving on the card still goes up the kernel stack.
+//
+// Neither card here can steer a flow to a ring of its own: the RTL8139
+// has one receive ring, and virtio-net spreads flows over its queues by
+// itself. So the rings the process sees are the driver's receive pass
+// extended: a frame for a bypassed port is copied, whole and with its
+// Ethernet header, into the next receive slot right where the driver
+// would have handed it to the stack (a frame with no slot free is dropped
+// and counted). Transmit slots the process publishes are sent by a kernel
+// poller. On an isolated CPU, when there is one, it spins for
+// NICMAP_TX_IDLE_US after the last frame before it slows down to a look
+// every NICMAP_TX_SLEEP_MS, saying so in the ring flags; elsewhere it
+// only looks every NICMAP_TX_SLEEP_MS.
+//
+// Only the kernel attaches a process, so only processes it trusts get the
+// raw card: their frames go out as written. One process at a time; the
+// mapping goes with its exit.
+#define NICMAP_SLOTS            64              // Per direction (power of 2)
+#define NICMAP_SLOT_SIZE        1536            // Frame with its Ethernet header
+#define NICMAP_MAX_PORTS        8
+#define NICMAP_VIRTUAL_BASE     0x70000000      // Below the shared memory window
+#define NICMAP_TX_IDLE_US       1000            // Poller spin before it slows down
+#define NICMAP_TX_SLEEP_MS      1
+
+// nicmap_ring_t.flags (written by the kernel)
+#define NICMAP_TX_SLOW          0x01            // Poller slowed down: up to a sleep of latency
+
+typedef struct {
+    uint32_t offset;            // Of the buffer, from the start of the mapping
+    uint16_t len;               // Frame length
+    uint16_t flags;
+    uint64_t rx_tsc;            // Receive: TSC when the driver took it off the card
+} nicmap_slot_t;
+
+// The first page of the mapping; the buffers follow it, receive first.
+// Indices run freely; slot i is at i & mask.
+typedef struct {
+    // Receive: the kernel produces, the process consumes
+    volatile uint32_t rx_head;
+    volatile uint32_t rx_tail;
+    // Transmit: the process produces, the kernel consumes
+    volatile uint32_t tx_head;
+    volatile uint32_t tx_tail;
+    uint32_t mask;
+    volatile uint32_t flags;
+    volatile uint32_t rx_dropped;   // Frames that found no slot free
+    volatile uint32_t tx_errors;    // Bad lengths, not sent
+    mac_addr_t mac;             // The card's, for building frames
+    ipv4_addr_t ip;
+    uint16_t ports[NICMAP_MAX_PORTS];   // Host order, 0 unused
+    nicmap_slot_t rx[NICMAP_SLOTS];
+    nicmap_slot_t tx[NICMAP_SLOTS];
+} nicmap_ring_t;
+
+#define NICMAP_BUFFER_OFFSET    4096
+#define NICMAP_MAP_SIZE         (NICMAP_BUFFER_OFFSET + 2 * NICMAP_SLOTS * NICMAP_SLOT_SIZE)
+
+typedef struct {
+    bool attached;
+    uint32_t owner_pid;
+    uint32_t attaches;
+    uint32_t rx_steered;        // Frames put in the receive ring
+    uint32_t rx_dropped;
+    uint32_t tx_sent;
+    uint32_t tx_errors;
+    uint32_t tx_retries;        // Sends the card refused, tried again
+    uint32_t poller_sleeps;
+} nicmap_stats_t;
+
+// Kernel side. Attach maps the rings into the process, steering UDP
+// datagrams to these ports (host order, 1..NICMAP_MAX_PORTS of them) to
+// it; the ring as the process addresses it, or NULL. Under a page
+// directory it is at NICMAP_VIRTUAL_BASE, otherwise at its own address.
+nicmap_ring_t* nicmap_attach(struct process* process, const uint16_t* ports, uint32_t count);
+void nicmap_release(struct process* process);    // Detach, if it is the owner
+
+// Driver receive pass, ahead of the stack: true when the frame was the
+// process's, taken or dropped
+bool nicmap_steer(const void* frame, uint32_t len);
+
+uint32_t sys_nicmap(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+
+// Demo owner: a kernel task echoing the port's datagrams back to their
+// senders. -1 when the bypass is taken.
+int nicmap_echo_start(uint16_t port);
+void nicmap_echo_stop(void);
+
+void nicmap_get_stats(nicmap_stats_t* stats);
+void nicmap_print_info(void);
+
+// Process side: the next received frame (NULL if none), given back with
+// nicmap_rx_done once read ...
+static inline nicmap_slot_t* nicmap_rx_peek(nicmap_ring_t* ring) {
+    if (ring->rx_head == ring->rx_tail) return NULL;
+    __sync_synchronize();           // Slot read after the head
+    return &ring->rx[ring->rx_tail & ring->mask];
+}
+
+static inline void nicmap_rx_done(nicmap_ring_t* ring) {
+    __sync_synchronize();           // Done reading before the slot is reused
+    ring->rx_tail++;
+}
+
+// ... and a free transmit slot (NULL when full): write the frame at its
+// offset, set len, then nicmap_tx_push
+static inline nicmap_slot_t* nicmap_tx_slot(nicmap_ring_t* ring) {
+    if (ring->tx_head - ring->tx_tail > ring->mask) return NULL;
+    return &ring->tx[ring->tx_head & ring->mask];
+}
+
+static inline void nicmap_tx_push(nicmap_ring_t* ring) {
+    __sync_synchronize();           // Frame visible before the head
+    ring->tx_head++;
+}
+
+static inline void* nicmap_buffer(nicmap_ring_t* ring, const nicmap_slot_t* slot) {
+    return (uint8_t*)ring + slot->offset;
+}
+
+#endif // NICMAP_H
@@ -0,0 +1,96 @@
+#include "pbuf.h"
+#include "../arch/spinlock.h"
+#include "../mm/frame.h"
+#include "../drivers/vga.h"
+
+static pbuf_t pool[PBUF_COUNT];
+static pbuf_t* free_list;
+static spinlock_t pool_lock = SPINLOCK_INIT;
+static pbuf_stats_t pbuf_stats;
+
+int pbuf_init(void) {
+    if (pbuf_stats.total) return NET_SUCCESS;
+
+    uint8_t* block = (uint8_t*)frame_alloc_pages(frame_order(PBUF_COUNT * PBUF_SIZE));
+    if (!block) {
+        return NET_NO_MEMORY;
+    }
+
+    free_list = NULL;
+    for (int i = PBUF_COUNT - 1; i >= 0; i--) {
+        pool[i].buffer = block + i * PBUF_SIZE;
+        pool[i].data = pool[i].buffer;
+        pool[i].len = 0;
+        pool[i].refs = 0;
+        pool[i].next = free_list;
+        free_list = &pool[i];
+    }
+    pbuf_stats.total = PBUF_COUNT;
+    pbuf_stats.free = PBUF_COUNT;
+    pbuf_stats.low = PBUF_COUNT;
+    return NET_SUCCESS;
+}
+
+pbuf_t* pbuf_alloc(uint32_t headroom) {
+    if (headroom > PBUF_SIZE) return NULL;
+
+    uint32_t flags = spin_lock_irqsave(&pool_lock);
+    pbuf_t* p = free_list;
+    if (p) {
+        free_list = p->next;
+        pbuf_stats.allocs++;
+        if (--pbuf_stats.free < pbuf_stats.low) pbuf_stats.low = pbuf_stats.free;
+    } else {
+        pbuf_stats.failures++;
+    }
+    spin_unlock_irqrestore(&pool_lock, flags);
+    if (!p) return NULL;
+
+    p->data = p->buffer + headroom;
+    p->len = 0;
+    p->refs = 1;
+    p->next = NULL;
+    return p;
+}
+
+void pbuf_free(pbuf_t* p) {
+    if (!p || __sync_sub_and_fetch(&p->refs, 1) != 0) return;
+
+    uint32_t flags = spin_lock_irqsave(&pool_lock);
+    p->next = free_list;
+    free_list = p;
+    pbuf_stats.free++;
+    spin_unlock_irqrestore(&pool_lock, flags);
+}
+
+void pbuf_get_stats(pbuf_stats_t* stats) {
+    if (!stats) return;
+    uint32_t flags = spin_lock_irqsave(&pool_lock);
+    *stats = pbuf_stats;
+    spin_unlock_irqrestore(&pool_lock, flags);
+}
+
+void pbuf_print_info(void) {
+    pbuf_stats_t stats;
+    pbuf_get_stats(&stats);
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Packet Buffers ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string("Pool: ");
+    print_dec(stats.total);
+    vga_write_string(" x ");
+    print_dec(PBUF_SIZE);
+    vga_write_string(" bytes, headroom ");
+    print_dec(PBUF_HEADROOM);
+    vga_write_string("\nFree: ");
+    print_dec(stats.free);
+    vga_write_string("  Lowest: ");
+    print_dec(stats.low);
+    vga_write_string("\nAllocated: ");
+    print_dec(stats.allocs);
+    vga_write_string("  Pool empty: ");
+    print_dec(stats.failures);
+    vga_write_string("\n");
+}
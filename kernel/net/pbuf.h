@@ -0,0 +1,91 @@
+#ifndef PBUF_H
+#define PBUF_H
+
+#include "../types.h"
+#include "net.h"
+
+// Packet buffers for the send path. A pbuf is a fixed PBUF_SIZE buffer
+// from one physically contiguous, identity-mapped block, so a card can DMA
+// straight out of it, and a window [data, data + len) into it. The
+// transport layer writes its segment at PBUF_HEADROOM, and each layer below
+// prepends its header into the room left in front (pbuf_push) instead of
+// copying the packet into a bigger buffer of its own: IP, Ethernet, and a
+// driver header like virtio-net's. PBUF_FRAME_OFFSET puts the Ethernet
+// header on a dword, which the RTL8139 needs to send from the buffer as is.
+//
+// A pbuf is counted: a send takes the caller's reference, and a driver
+// that hands the buffer to its card keeps it until the card is done, so
+// one buffer can be queued and still owned elsewhere (pbuf_ref first).
+// The last pbuf_free puts it back on the free list, from any context.
+#define PBUF_SIZE               2048
+#define PBUF_COUNT              256                     // 512 KB
+#define PBUF_FRAME_OFFSET       96                      // Room for a driver header, dword aligned
+#define PBUF_HEADROOM           (PBUF_FRAME_OFFSET + ETH_HEADER_SIZE + IP_HEADER_SIZE)
+#define PBUF_CSUM_NONE          0xFFFF                  // No checksum left to finish
+
+typedef struct pbuf {
+    uint8_t* data;              // First byte of the packet so far
+    uint32_t len;
+    volatile uint32_t refs;     // 0 while free
+    struct pbuf* next;          // Free list
+    uint8_t* buffer;            // PBUF_SIZE bytes, physical address
+} pbuf_t;
+
+typedef struct {
+    uint32_t total;
+    uint32_t free;
+    uint32_t low;               // Fewest ever free
+    uint32_t allocs;
+    uint32_t failures;          // Pool empty
+} pbuf_stats_t;
+
+int pbuf_init(void);
+
+// An empty pbuf with 'headroom' bytes in front, one reference; NULL when
+// the pool is empty
+pbuf_t* pbuf_alloc(uint32_t headroom);
+
+static inline pbuf_t* pbuf_ref(pbuf_t* p) {
+    __sync_fetch_and_add(&p->refs, 1);
+    return p;
+}
+
+// Drop a reference; the last gives the buffer back
+void pbuf_free(pbuf_t* p);
+
+static inline uint32_t pbuf_headroom(const pbuf_t* p) {
+    return (uint32_t)(p->data - p->buffer);
+}
+
+static inline uint32_t pbuf_tailroom(const pbuf_t* p) {
+    return PBUF_SIZE - pbuf_headroom(p) - p->len;
+}
+
+// Grow the packet by len bytes at the end (returned, to be written) ...
+static inline void* pbuf_put(pbuf_t* p, uint32_t len) {
+    if (len > pbuf_tailroom(p)) return NULL;
+    uint8_t* tail = p->data + p->len;
+    p->len += len;
+    return tail;
+}
+
+// ... or at the front, for a header; NULL without the room
+static inline void* pbuf_push(pbuf_t* p, uint32_t len) {
+    if (len > pbuf_headroom(p)) return NULL;
+    p->data -= len;
+    p->len += len;
+    return p->data;
+}
+
+// Strip len bytes off the front: the new start
+static inline void* pbuf_pull(pbuf_t* p, uint32_t len) {
+    if (len > p->len) return NULL;
+    p->data += len;
+    p->len -= len;
+    return p->data;
+}
+
+void pbuf_get_stats(pbuf_stats_t* stats);
+void pbuf_print_info(void);
+
+#endif // PBUF_H
@@ -1,5 +1,6 @@
 #include "socket.h"
 #include "tcp.h"
+#include "../arch/cpu.h"
 #include "../mm/memory.h"
 #include "../drivers/vga.h"
 
@@ -21,17 +22,26 @@ int socket_create(int domain, int type, int protocol) {
     sock->domain = domain;
     sock->type = type;
     sock->protocol = protocol;
-    sock->next = sockets;
-    sockets = sock;
+    sock->data.tcp_conn = NULL;
+
+    if (type == SOCK_DGRAM) {
+        sock->data.udp_sock = udp_socket_create();
+        if (!sock->data.udp_sock) {
+            kfree(sock);
+            return -1;
+        }
+    }
 
     int fd = socket_alloc_fd();
     if (fd < 0) {
+        if (type == SOCK_DGRAM) udp_socket_destroy(sock->data.udp_sock);
         kfree(sock);
         return -1;
     }
 
-    // Store socket pointer in some way - for now just return fd
-    // In a real implementation, we'd have a file descriptor table
+    sock->fd = fd;
+    sock->next = sockets;
+    sockets = sock;
     return fd;
 }
 
@@ -44,14 +54,22 @@ int socket_bind(int sockfd, const sockaddr_t* addr) {
 
     const sockaddr_in_t* addr_in = (const sockaddr_in_t*)addr;
 
+    // The any address takes traffic to every address (and joined group)
+    static const ipv4_addr_t any_addr = {{0, 0, 0, 0}};
+    bool any = memcmp(&addr_in->sin_addr, &any_addr, sizeof(ipv4_addr_t)) == 0;
+
     if (sock->type == SOCK_STREAM) {
-        // Create TCP connection in LISTEN state
-        sock->data.tcp_conn = tcp_create_connection(&addr_in->sin_addr,
-                                                    addr_in->sin_port, addr_in->sin_port);
+        // Passive open: listening from bind, the backlog set by listen
+        if (sock->data.tcp_conn) {
+            return -1;
+        }
+        sock->data.tcp_conn = tcp_listen(any ? NULL : &addr_in->sin_addr, addr_in->sin_port, TCP_BACKLOG);
         if (!sock->data.tcp_conn) {
             return -1;
         }
-        sock->data.tcp_conn->state = TCP_LISTEN;
+    } else if (sock->type == SOCK_DGRAM) {
+        return udp_socket_bind(sock->data.udp_sock, any ? NULL : &addr_in->sin_addr,
+                               addr_in->sin_port) == NET_SUCCESS ? 0 : -1;
     }
 
     return 0;
@@ -59,34 +77,55 @@ int socket_bind(int sockfd, const sockaddr_t* addr) {
 
 // Listen for connections
 int socket_listen(int sockfd, int backlog) {
-    (void)backlog;
     socket_t* sock = socket_get(sockfd);
-    if (!sock || sock->type != SOCK_STREAM) {
+    if (!sock || sock->type != SOCK_STREAM || !sock->data.tcp_conn ||
+        sock->data.tcp_conn->state != TCP_LISTEN) {
         return -1;
     }
 
     // TCP is already in LISTEN state from bind
+    if (backlog > 0) {
+        sock->data.tcp_conn->backlog = (uint16_t)(backlog < 64 ? backlog : 64);
+    }
     return 0;
 }
 
 // Accept incoming connection
 int socket_accept(int sockfd, sockaddr_t* addr) {
     socket_t* sock = socket_get(sockfd);
-    if (!sock || sock->type != SOCK_STREAM) {
+    if (!sock || sock->type != SOCK_STREAM || !sock->data.tcp_conn) {
+        return -1;
+    }
+
+    // The connection gets a socket of its own
+    tcp_connection_t* conn = tcp_accept(sock->data.tcp_conn, TCP_WAIT_FOREVER);
+    if (!conn) {
+        return -1;
+    }
+    socket_t* child = (socket_t*)kmalloc(sizeof(socket_t));
+    int fd = child ? socket_alloc_fd() : -1;
+    if (fd < 0) {
+        if (child) kfree(child);
+        tcp_close_connection(conn);
         return -1;
     }
+    child->domain = sock->domain;
+    child->type = SOCK_STREAM;
+    child->protocol = sock->protocol;
+    child->data.tcp_conn = conn;
+    child->fd = fd;
+    child->next = sockets;
+    sockets = child;
 
-    // For now, just return the same socket
-    // In a real implementation, we'd create a new socket for the accepted connection
     if (addr) {
         // Fill in peer address
         sockaddr_in_t* addr_in = (sockaddr_in_t*)addr;
         addr_in->sin_family = AF_INET;
-        addr_in->sin_port = sock->data.tcp_conn->remote_port;
-        addr_in->sin_addr = sock->data.tcp_conn->remote_ip;
+        addr_in->sin_port = conn->remote_port;
+        addr_in->sin_addr = conn->remote_ip;
     }
 
-    return sockfd;
+    return fd;
 }
 
 // Connect to remote host
@@ -99,16 +138,26 @@ int socket_connect(int sockfd, const sockaddr_t* addr) {
     const sockaddr_in_t* addr_in = (const sockaddr_in_t*)addr;
 
     if (sock->type == SOCK_STREAM) {
+        if (sock->data.tcp_conn) {
+            return -1;
+        }
         // Create TCP connection
-        sock->data.tcp_conn = tcp_create_connection(&addr_in->sin_addr,
-                                                    addr_in->sin_port, 0); // Auto-assign local port
-        if (!sock->data.tcp_conn) {
+        tcp_connection_t* conn = tcp_create_connection(&addr_in->sin_addr,
+                                                       addr_in->sin_port, 0); // Auto-assign local port
+        if (!conn) {
             return -1;
         }
 
-        // Send SYN packet
-        sock->data.tcp_conn->state = TCP_SYN_SENT;
-        tcp_send_packet(sock->data.tcp_conn, TCP_FLAG_SYN, NULL, 0);
+        // Handshake, waiting for it
+        if (tcp_connect(conn, SOCKET_CONNECT_TIMEOUT_MS) != NET_SUCCESS) {
+            tcp_close_connection(conn);
+            return -1;
+        }
+        sock->data.tcp_conn = conn;
+    } else if (sock->type == SOCK_DGRAM) {
+        // Fixes the destination of sends and the only source received from
+        return udp_socket_connect(sock->data.udp_sock, &addr_in->sin_addr,
+                                  addr_in->sin_port) == NET_SUCCESS ? 0 : -1;
     }
 
     return 0;
@@ -122,11 +171,13 @@ int socket_send(int sockfd, const void* buf, uint32_t len) {
     }
 
     if (sock->type == SOCK_STREAM && sock->data.tcp_conn) {
-        if (sock->data.tcp_conn->state != TCP_ESTABLISHED) {
-            return -1;  // Connection not established
-        }
+        // Queued whole, waiting for buffer room
+        return tcp_send(sock->data.tcp_conn, buf, len) >= 0 ? (int)len : -1;
+    }
 
-        return tcp_send_packet(sock->data.tcp_conn, TCP_FLAG_ACK, buf, len);
+    if (sock->type == SOCK_DGRAM) {
+        int result = udp_socket_send(sock->data.udp_sock, buf, len);
+        return result == NET_SUCCESS ? (int)len : -1;
     }
 
     return -1;
@@ -134,10 +185,52 @@ int socket_send(int sockfd, const void* buf, uint32_t len) {
 
 // Receive data
 int socket_recv(int sockfd, void* buf, uint32_t len) {
-    (void)sockfd; (void)buf; (void)len;
-    // For now, this is a placeholder
-    // In a real implementation, we'd have a receive buffer
-    return 0;
+    socket_t* sock = socket_get(sockfd);
+    if (sock && sock->type == SOCK_DGRAM) {
+        // One datagram, copied out; waits for it
+        int result = udp_socket_recv(sock->data.udp_sock, buf, len, UDP_WAIT_FOREVER);
+        return result >= 0 ? result : -1;
+    }
+
+    if (sock && sock->type == SOCK_STREAM && sock->data.tcp_conn) {
+        // What has arrived in order, 0 at the end of the stream
+        int result = tcp_recv(sock->data.tcp_conn, buf, len, TCP_WAIT_FOREVER);
+        return result >= 0 ? result : -1;
+    }
+
+    return -1;
+}
+
+int socket_recv_zc(int sockfd, udp_datagram_t* dgram, uint32_t timeout_ms) {
+    socket_t* sock = socket_get(sockfd);
+    if (!sock || sock->type != SOCK_DGRAM) {
+        return -1;
+    }
+
+    return udp_socket_recv_zc(sock->data.udp_sock, dgram, timeout_ms);
+}
+
+int socket_rx_timestamp(int sockfd, uint64_t* rx_tsc) {
+    socket_t* sock = socket_get(sockfd);
+    if (!sock || !rx_tsc) {
+        return -1;
+    }
+    if (sock->type == SOCK_DGRAM && sock->data.udp_sock) {
+        *rx_tsc = sock->data.udp_sock->last_rx_tsc;
+        return 0;
+    }
+    if (sock->type == SOCK_STREAM && sock->data.tcp_conn) {
+        *rx_tsc = tcp_rx_timestamp(sock->data.tcp_conn);
+        return 0;
+    }
+    return -1;
+}
+
+void socket_release_zc(int sockfd, udp_datagram_t* dgram) {
+    socket_t* sock = socket_get(sockfd);
+    if (sock && sock->type == SOCK_DGRAM) {
+        udp_socket_release(sock->data.udp_sock, dgram);
+    }
 }
 
 // Close socket
@@ -148,7 +241,9 @@ int socket_close(int sockfd) {
     }
 
     if (sock->type == SOCK_STREAM && sock->data.tcp_conn) {
-        tcp_close_connection(sock->data.tcp_conn);
+        tcp_close(sock->data.tcp_conn);
+    } else if (sock->type == SOCK_DGRAM) {
+        udp_socket_destroy(sock->data.udp_sock);
     }
 
     // Remove from socket list
@@ -169,12 +264,68 @@ int socket_close(int sockfd) {
     return 0;
 }
 
+int socket_poll_add(pollset_t* set, int sockfd, uint32_t events, uint32_t cookie) {
+    socket_t* sock = socket_get(sockfd);
+    if (sock && sock->type == SOCK_DGRAM) {
+        udp_socket_t* udp_sock = sock->data.udp_sock;
+        int item = pollset_add(set, &udp_sock->poll, events, cookie);
+        if (item >= 0) {
+            pollset_busy_poll(set, udp_sock->busy_poll_us);
+            uint32_t ready = POLL_OUT;
+            if (load_acquire(&udp_sock->head) != udp_sock->tail) ready |= POLL_IN;
+            pollset_signal(set, item, ready);
+        }
+        return item;
+    }
+    if (!sock || sock->type != SOCK_STREAM || !sock->data.tcp_conn) {
+        return -1;
+    }
+
+    tcp_connection_t* conn = sock->data.tcp_conn;
+    int item = pollset_add(set, &conn->poll, events, cookie);
+    if (item >= 0) {
+        pollset_busy_poll(set, conn->busy_poll_us);
+        uint32_t ready = 0;
+        if (conn->state == TCP_ESTABLISHED) ready |= POLL_OUT;
+        if (tcp_readable(conn) || (conn->state == TCP_LISTEN && conn->accept_head)) ready |= POLL_IN;
+        if (ready) pollset_signal(set, item, ready);
+    }
+    return item;
+}
+
+int socket_setopt(int sockfd, int option, uint32_t value) {
+    socket_t* sock = socket_get(sockfd);
+    if (sock && sock->type == SOCK_DGRAM) {
+        udp_socket_t* udp_sock = sock->data.udp_sock;
+        ipv4_addr_t group;
+        memcpy(&group, &value, sizeof(group));
+        switch (option) {
+            case SO_BUSY_POLL:
+                udp_sock->busy_poll_us = value < NET_BUSY_POLL_MAX_US ? value : NET_BUSY_POLL_MAX_US;
+                return 0;
+            case IP_ADD_MEMBERSHIP:
+                return udp_socket_join(udp_sock, &group) == NET_SUCCESS ? 0 : -1;
+            case IP_DROP_MEMBERSHIP:
+                return udp_socket_leave(udp_sock, &group) == NET_SUCCESS ? 0 : -1;
+            default:
+                return -1;
+        }
+    }
+    if (!sock || sock->type != SOCK_STREAM || !sock->data.tcp_conn) {
+        return -1;
+    }
+
+    return tcp_set_option(sock->data.tcp_conn, option, value) == NET_SUCCESS ? 0 : -1;
+}
+
 // Get socket by file descriptor
 socket_t* socket_get(int sockfd) {
-    (void)sockfd;
-    // For now, just return the first socket
-    // In a real implementation, we'd have a proper FD table
-    return sockets;
+    for (socket_t* sock = sockets; sock; sock = sock->next) {
+        if (sock->fd == sockfd) {
+            return sock;
+        }
+    }
+    return NULL;
 }
 
 // Allocate file descriptor
@@ -2,6 +2,7 @@
 #define SOCKET_H
 
 #include "net.h"
+#include "udp.h"
 
 // Socket types
 #define SOCK_STREAM 1    // TCP
@@ -11,6 +12,13 @@
 // Address families
 #define AF_INET    2     // IPv4
 
+#define SOCKET_CONNECT_TIMEOUT_MS   5000
+
+// socket_setopt on datagram sockets; the value is the group address as it
+// sits in memory (an ipv4_addr_t read as a uint32_t)
+#define IP_ADD_MEMBERSHIP   35
+#define IP_DROP_MEMBERSHIP  36
+
 // Function declarations
 int socket_create(int domain, int type, int protocol);
 int socket_bind(int sockfd, const sockaddr_t* addr);
@@ -21,6 +29,32 @@ int socket_send(int sockfd, const void* buf, uint32_t len);
 int socket_recv(int sockfd, void* buf, uint32_t len);
 int socket_close(int sockfd);
 
+// Zero-copy receive on a datagram socket: the payload in place in the
+// receive buffer, until socket_release_zc. timeout_ms as udp_socket_recv_zc.
+int socket_recv_zc(int sockfd, udp_datagram_t* dgram, uint32_t timeout_ms);
+void socket_release_zc(int sockfd, udp_datagram_t* dgram);
+
+// Receive timestamp (TSC when the driver took the frame off the card;
+// ktime_from_tsc for ns): datagrams carry their own in rx_tsc, and this
+// gives the one of the datagram received last, or of the latest segment
+// with data on a stream. 0 with it in *rx_tsc, -1 on a bad socket.
+int socket_rx_timestamp(int sockfd, uint64_t* rx_tsc);
+
+// Watch a socket in a poll set. Stream: POLL_OUT once connected and as
+// buffer room frees, POLL_IN per segment carrying data (and per connection
+// to accept on a listener), POLL_HUP when the peer closes or resets. Datagram:
+// POLL_IN per datagram queued, POLL_OUT at once. A socket with SO_BUSY_POLL
+// makes the set's waits busy poll as long as it would.
+int socket_poll_add(pollset_t* set, int sockfd, uint32_t events, uint32_t cookie);
+
+// Stream sockets: a TCP_NODELAY, TCP_QUICKACK or TCP_ACK_DELAY option
+// (tcp.h), on the connection or on a listener for what it accepts. Both
+// kinds: SO_BUSY_POLL (net.h), us a blocking receive polls the card before
+// it sleeps, for waits begun from then on. Datagram sockets: IP_ADD_MEMBERSHIP
+// and IP_DROP_MEMBERSHIP join and leave a multicast group (igmp.h), left
+// anyway when the socket closes.
+int socket_setopt(int sockfd, int option, uint32_t value);
+
 // Helper functions
 socket_t* socket_get(int sockfd);
 int socket_alloc_fd(void);
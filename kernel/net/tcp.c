@@ -1,18 +1,53 @@
 #include "tcp.h"
 #include "ip.h"
 #include "../mm/memory.h"
+#include "../arch/spinlock.h"
+#include "../arch/tsc.h"
+#include "../arch/div64.h"
+#include "../proc/process.h"
+#include "../proc/futex.h"
 #include "../drivers/vga.h"
 
-// Global TCP state
+#define SEND_MASK       (TCP_SEND_BUFFER - 1)
+#define RECV_MASK       (TCP_RECV_BUFFER - 1)
+#define TCP_OPT_END     0
+#define TCP_OPT_NOP     1
+#define TCP_OPT_MSS     2
+#define TCP_FLAGS_MASK  0x3F
+#define HASH_MASK       (TCP_HASH_BUCKETS - 1)
+#define LISTEN_MASK     (TCP_LISTEN_BUCKETS - 1)
+
+// A received segment, fields in host order
+typedef struct {
+    uint32_t seq;
+    uint32_t ack;
+    uint16_t flags;
+    uint16_t window;
+    uint16_t mss;               // From the options, 0 if none
+    const uint8_t* data;
+    uint32_t len;
+} tcp_segment_t;
+
+// Global TCP state: every connection on one list, and the same ones
+// hashed by 4-tuple for the receive path, listeners apart by port
 static tcp_connection_t* tcp_connections = NULL;
-static uint32_t next_seq_num = 1000;  // Starting sequence number
+static tcp_connection_t* tcp_hash_table[TCP_HASH_BUCKETS];
+static tcp_connection_t* tcp_listen_table[TCP_LISTEN_BUCKETS];
+static spinlock_t tcp_lock = SPINLOCK_INIT;
+static uint16_t next_port = TCP_EPHEMERAL_PORT;
+static uint32_t iss_counter = 0;
+static uint32_t next_conn_id = 1;
+static tcp_stats_t tcp_stats;
 
-// Forward declarations
-tcp_connection_t* tcp_find_connection(const ipv4_addr_t* src_ip, const ipv4_addr_t* dst_ip,
-                                      uint16_t src_port, uint16_t dst_port);
-uint16_t tcp_checksum(const tcp_header_t* header, const void* data, uint32_t data_len,
-                      const ipv4_addr_t* src_ip, const ipv4_addr_t* dst_ip);
-const ipv4_addr_t* ipv4_get_our_address(void);
+static void tcp_rto_expired(void* data);
+static void tcp_ack_expired(void* data);
+
+static inline bool seq_lt(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+static inline bool seq_le(uint32_t a, uint32_t b) { return (int32_t)(a - b) <= 0; }
+static inline bool seq_gt(uint32_t a, uint32_t b) { return (int32_t)(a - b) > 0; }
+static inline bool seq_ge(uint32_t a, uint32_t b) { return (int32_t)(a - b) >= 0; }
+
+static inline uint32_t min_u32(uint32_t a, uint32_t b) { return a < b ? a : b; }
 
 // Initialize TCP layer
 int tcp_init(void) {
@@ -20,193 +55,1362 @@ int tcp_init(void) {
     return NET_SUCCESS;
 }
 
-// Handle incoming TCP packet
-int tcp_handle_packet(const tcp_packet_t* packet, uint32_t len,
+uint16_t tcp_checksum(const void* segment, uint32_t len,
                       const ipv4_addr_t* src_ip, const ipv4_addr_t* dst_ip) {
-    (void)len;
-    const tcp_header_t* header = &packet->header;
+    uint32_t sum = csum_pseudo(src_ip, dst_ip, IP_PROTO_TCP, (uint16_t)len);
+    return csum_fold(csum_partial(segment, len, sum));
+}
 
-    // Find matching connection
-    tcp_connection_t* conn = tcp_find_connection(src_ip, dst_ip,
-                                                 header->src_port, header->dst_port);
+// Sequence-indexed rings: a run may wrap once
+static void ring_write(uint8_t* ring, uint32_t mask, uint32_t seq, const uint8_t* data, uint32_t len) {
+    uint32_t offset = seq & mask;
+    uint32_t first = min_u32(len, mask + 1 - offset);
+    memcpy(ring + offset, data, first);
+    if (len > first) memcpy(ring, data + first, len - first);
+}
 
-    if (!conn) {
-        // No matching connection, check if it's a SYN for listening socket
-        if (header->flags & TCP_FLAG_SYN) {
-            // TODO: Handle new connection requests
-            return NET_SUCCESS;
+static void ring_read(const uint8_t* ring, uint32_t mask, uint32_t seq, uint8_t* out, uint32_t len) {
+    uint32_t offset = seq & mask;
+    uint32_t first = min_u32(len, mask + 1 - offset);
+    memcpy(out, ring + offset, first);
+    if (len > first) memcpy(out + first, ring, len - first);
+}
+
+// The 4-tuple mixed down, the remote side varying most (murmur3's
+// finalizer spreads it over the low bits the bucket takes)
+static uint32_t tcp_hash(const ipv4_addr_t* local_ip, uint16_t local_port,
+                         const ipv4_addr_t* remote_ip, uint16_t remote_port) {
+    uint32_t remote, local;
+    memcpy(&remote, remote_ip, sizeof(uint32_t));
+    memcpy(&local, local_ip, sizeof(uint32_t));
+    uint32_t hash = remote * 0x9E3779B1u;
+    hash ^= ((uint32_t)remote_port << 16) | local_port;
+    hash ^= local;
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static tcp_connection_t** tcp_chain(const tcp_connection_t* conn) {
+    return conn->state == TCP_LISTEN ? &tcp_listen_table[conn->local_port & LISTEN_MASK]
+                                     : &tcp_hash_table[conn->hash & HASH_MASK];
+}
+
+static void tcp_hash_insert(tcp_connection_t* conn) {
+    tcp_connection_t** chain = tcp_chain(conn);
+    conn->hash_next = *chain;
+    *chain = conn;
+}
+
+static void tcp_hash_remove(tcp_connection_t* conn) {
+    for (tcp_connection_t** link = tcp_chain(conn); *link; link = &(*link)->hash_next) {
+        if (*link == conn) {
+            *link = conn->hash_next;
+            return;
         }
-        return NET_SUCCESS; // Ignore
     }
+}
 
-    // Update connection state based on flags
-    if (header->flags & TCP_FLAG_SYN) {
-        if (conn->state == TCP_LISTEN) {
-            // Send SYN-ACK
-            conn->state = TCP_SYN_RECEIVED;
-            conn->ack_num = header->seq_num + 1;
-            tcp_send_packet(conn, TCP_FLAG_SYN | TCP_FLAG_ACK, NULL, 0);
-        }
+// A connection handed back by its owner is checked against the list
+// without reading it: a freed one is no longer on it (tcp_lock held)
+static bool tcp_live(const tcp_connection_t* conn) {
+    for (tcp_connection_t* other = tcp_connections; other; other = other->next) {
+        if (other == conn) return true;
     }
+    return false;
+}
 
-    if (header->flags & TCP_FLAG_ACK) {
-        if (conn->state == TCP_SYN_SENT) {
-            conn->state = TCP_ESTABLISHED;
-        } else if (conn->state == TCP_SYN_RECEIVED) {
-            conn->state = TCP_ESTABLISHED;
-        }
+// Timers carry the connection's id rather than a pointer, since one may
+// fire for a connection freed (and its memory reused) meanwhile; NULL for
+// one that is gone (tcp_lock held)
+static tcp_connection_t* tcp_find_id(void* data) {
+    uint32_t id = (uint32_t)(uintptr_t)data;
+    for (tcp_connection_t* conn = tcp_connections; conn; conn = conn->next) {
+        if (conn->id == id) return conn;
     }
+    return NULL;
+}
 
-    if (header->flags & TCP_FLAG_FIN) {
-        if (conn->state == TCP_ESTABLISHED) {
-            conn->state = TCP_CLOSE_WAIT;
-            conn->ack_num = header->seq_num + 1;
-            tcp_send_packet(conn, TCP_FLAG_ACK, NULL, 0);
-            // Send FIN
-            tcp_send_packet(conn, TCP_FLAG_FIN | TCP_FLAG_ACK, NULL, 0);
-            conn->state = TCP_LAST_ACK;
-        }
+static bool tcp_port_in_use(uint16_t port) {
+    for (tcp_connection_t* conn = tcp_connections; conn; conn = conn->next) {
+        if (conn->local_port == port) return true;
     }
+    return false;
+}
 
-    return NET_SUCCESS;
+// Waiters see every change; poll sets the ones asked for
+static void tcp_wake(tcp_connection_t* conn, uint32_t events) {
+    conn->events++;
+    futex_wake(&conn->events, 0xFFFFFFFF);
+    if (events) {
+        poll_wake(&conn->poll, events);
+    }
+}
+
+// Window offered: the receive ring's free space
+static uint32_t tcp_rcv_window(const tcp_connection_t* conn) {
+    uint32_t window = TCP_RECV_BUFFER - (conn->ack_num - conn->rcv_read);
+    return window > 65535 ? 65535 : window;
+}
+
+static void tcp_arm_rto(tcp_connection_t* conn) {
+    timer_arm(&conn->rto_timer, get_current_time_ms() + conn->rto_ms);
 }
 
-// Send TCP packet
-int tcp_send_packet(tcp_connection_t* conn, uint8_t flags,
-                    const void* data, uint32_t data_len) {
-    uint32_t total_len = sizeof(tcp_header_t) + data_len;
+static void tcp_backoff(tcp_connection_t* conn) {
+    conn->rto_ms = min_u32(conn->rto_ms * 2, TCP_RTO_MAX_MS);
+    tcp_arm_rto(conn);
+}
+
+// RTO from the smoothed round trip: SRTT + 4 * RTTVAR, rounded up to ms
+static uint32_t tcp_rto_base(const tcp_connection_t* conn) {
+    if (!conn->srtt_us) return TCP_RTO_INITIAL_MS;
+    uint32_t rto = (conn->srtt_us + 4 * conn->rttvar_us + 999) / 1000;
+    if (rto < TCP_RTO_MIN_MS) rto = TCP_RTO_MIN_MS;
+    return rto > TCP_RTO_MAX_MS ? TCP_RTO_MAX_MS : rto;
+}
 
-    // Allocate packet buffer
-    uint8_t* packet = (uint8_t*)kmalloc(total_len);
+static void tcp_rtt_sample(tcp_connection_t* conn) {
+    uint64_t elapsed = ktime_ns() - conn->rtt_start_ns;
+    uint32_t rtt = elapsed >= 4000000000ull ? 4000000 : (uint32_t)div_u64_u32(elapsed, 1000, NULL);
+    if (!rtt) rtt = 1;
+
+    if (!conn->srtt_us) {
+        conn->srtt_us = rtt;
+        conn->rttvar_us = rtt / 2;
+    } else {
+        uint32_t delta = conn->srtt_us > rtt ? conn->srtt_us - rtt : rtt - conn->srtt_us;
+        conn->rttvar_us = (3 * conn->rttvar_us + delta) / 4;
+        conn->srtt_us = (7 * conn->srtt_us + rtt) / 8;
+    }
+    conn->rtt_timing = false;
+}
+
+// Build and send one segment, its data from the send ring at seq
+// (tcp_lock held). Every segment but the first SYN carries our ACK.
+static int tcp_output_segment(tcp_connection_t* conn, uint32_t seq, uint16_t flags, uint32_t len) {
+    uint32_t options_len = (flags & TCP_FLAG_SYN) ? 4 : 0;
+    uint32_t header_len = sizeof(tcp_header_t) + options_len;
+    uint32_t total_len = header_len + len;
+
+    // Built where it goes out from: the headers below go in front of it
+    pbuf_t* p = pbuf_alloc(PBUF_HEADROOM);
+    if (!p) {
+        return NET_NO_MEMORY;
+    }
+    uint8_t* packet = (uint8_t*)pbuf_put(p, total_len);
     if (!packet) {
+        pbuf_free(p);
         return NET_NO_MEMORY;
     }
 
+    uint32_t window = tcp_rcv_window(conn);
     tcp_header_t* header = (tcp_header_t*)packet;
-
-    // Fill TCP header
-    header->src_port = conn->local_port;
-    header->dst_port = conn->remote_port;
-    header->seq_num = conn->seq_num;
-    header->ack_num = conn->ack_num;
-    header->flags = flags;
-    header->window = 65535;  // TODO: proper window management
+    header->src_port = net_htons(conn->local_port);
+    header->dst_port = net_htons(conn->remote_port);
+    header->seq_num = net_htonl(seq);
+    header->ack_num = (flags & TCP_FLAG_ACK) ? net_htonl(conn->ack_num) : 0;
+    header->flags = net_htons((uint16_t)(((header_len / 4) << 12) | flags));
+    header->window = net_htons((uint16_t)window);
     header->checksum = 0;
     header->urgent_ptr = 0;
 
-    // Copy data
-    if (data && data_len) {
-        memcpy(packet + sizeof(tcp_header_t), data, data_len);
+    uint8_t* options = packet + sizeof(tcp_header_t);
+    if (options_len) {
+        options[0] = TCP_OPT_MSS;
+        options[1] = 4;
+        options[2] = (uint8_t)(TCP_MSS >> 8);
+        options[3] = (uint8_t)TCP_MSS;
     }
+    if (len) {
+        ring_read(conn->send_buf, SEND_MASK, seq, packet + header_len, len);
+    }
+    // The pseudo-header only: the rest is summed by the card, or in the
+    // frame on the way out
+    header->checksum = (uint16_t)~csum_fold(csum_pseudo(&conn->local_ip, &conn->remote_ip,
+                                                        IP_PROTO_TCP, (uint16_t)total_len));
 
-    // Calculate checksum (includes pseudo-header)
-    header->checksum = tcp_checksum(header, data, data_len, &conn->local_ip, &conn->remote_ip);
-
-    // Send via IP
-    int result = ipv4_send_packet(&conn->remote_ip, IP_PROTO_TCP, packet, total_len);
+    int result = ipv4_send_pbuf(&conn->remote_ip, IP_PROTO_TCP, p, __builtin_offsetof(tcp_header_t, checksum));
 
-    // Update sequence number
-    if (flags & TCP_FLAG_SYN || flags & TCP_FLAG_FIN || data_len > 0) {
-        conn->seq_num += (flags & TCP_FLAG_SYN ? 1 : 0) + (flags & TCP_FLAG_FIN ? 1 : 0) + data_len;
+    if (flags & TCP_FLAG_ACK) {
+        conn->rcv_adv = conn->ack_num + window;
+        conn->ack_pending = 0;
+        timer_cancel(&conn->ack_timer);
     }
-
-    kfree(packet);
+    conn->segs_out++;
+    tcp_stats.segs_out++;
     return result;
 }
 
-// Create new TCP connection
-tcp_connection_t* tcp_create_connection(const ipv4_addr_t* remote_ip,
-                                        uint16_t remote_port, uint16_t local_port) {
+static void tcp_send_ack(tcp_connection_t* conn) {
+    tcp_output_segment(conn, conn->seq_num, TCP_FLAG_ACK, 0);
+}
+
+// Answer a segment no connection takes (RFC 793 reset generation)
+static void tcp_reset_reply(const ipv4_addr_t* remote_ip, uint16_t remote_port, uint16_t local_port,
+                            const tcp_segment_t* seg) {
+    if (seg->flags & TCP_FLAG_RST) return;
+
+    tcp_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.src_port = net_htons(local_port);
+    header.dst_port = net_htons(remote_port);
+    uint16_t flags = TCP_FLAG_RST;
+    if (seg->flags & TCP_FLAG_ACK) {
+        header.seq_num = net_htonl(seg->ack);
+    } else {
+        uint32_t seg_len = seg->len + ((seg->flags & TCP_FLAG_SYN) ? 1 : 0) + ((seg->flags & TCP_FLAG_FIN) ? 1 : 0);
+        header.ack_num = net_htonl(seg->seq + seg_len);
+        flags |= TCP_FLAG_ACK;
+    }
+    header.flags = net_htons((uint16_t)((5 << 12) | flags));
+    header.checksum = tcp_checksum(&header, sizeof(header), ipv4_get_our_address(), remote_ip);
+    ipv4_send_packet(remote_ip, IP_PROTO_TCP, &header, sizeof(header));
+    tcp_stats.resets_sent++;
+}
+
+// A connection on the list and in its chain; a listener has no remote
+// side and no buffers
+static tcp_connection_t* tcp_new(const ipv4_addr_t* local_ip, uint16_t local_port,
+                                 const ipv4_addr_t* remote_ip, uint16_t remote_port, bool listening) {
+    if (local_port == 0) {
+        // Next free ephemeral port
+        for (uint32_t tries = 0; tries < 0x10000 - TCP_EPHEMERAL_PORT; tries++) {
+            uint16_t port = next_port++;
+            if (next_port == 0) next_port = TCP_EPHEMERAL_PORT;
+            if (!tcp_port_in_use(port)) {
+                local_port = port;
+                break;
+            }
+        }
+        if (local_port == 0) return NULL;
+    }
+
     tcp_connection_t* conn = (tcp_connection_t*)kmalloc(sizeof(tcp_connection_t));
     if (!conn) {
         return NULL;
     }
+    memset(conn, 0, sizeof(tcp_connection_t));
+    if (!listening) {
+        conn->send_buf = (uint8_t*)kmalloc(TCP_SEND_BUFFER);
+        conn->recv_buf = (uint8_t*)kmalloc(TCP_RECV_BUFFER);
+        if (!conn->send_buf || !conn->recv_buf) {
+            if (conn->send_buf) kfree(conn->send_buf);
+            if (conn->recv_buf) kfree(conn->recv_buf);
+            kfree(conn);
+            return NULL;
+        }
+    }
 
-    conn->state = TCP_CLOSED;
-    conn->local_ip = *ipv4_get_our_address();
-    conn->remote_ip = *remote_ip;
+    conn->state = listening ? TCP_LISTEN : TCP_CLOSED;
+    conn->local_ip = *local_ip;
+    if (remote_ip) conn->remote_ip = *remote_ip;
     conn->local_port = local_port;
     conn->remote_port = remote_port;
-    conn->seq_num = next_seq_num++;
-    conn->ack_num = 0;
-    conn->window_size = 65535;
-    conn->next = tcp_connections;
 
+    // Initial sequence number off the clock, so a new connection on the
+    // same ports does not start inside the old one's window
+    conn->iss = (uint32_t)(ktime_ns() >> 4) + (iss_counter += 64000);
+    conn->seq_num = conn->iss;
+    conn->snd_una = conn->iss;
+    conn->snd_data = conn->iss + 1;
+    conn->window_size = 0;
+    conn->mss = TCP_MSS_DEFAULT;
+    conn->rto_ms = TCP_RTO_INITIAL_MS;
+    conn->nodelay = true;
+    conn->quickack = true;
+    conn->ack_delay_ms = TCP_ACK_DELAY_MS;
+    conn->id = next_conn_id++;
+    timer_setup(&conn->rto_timer, tcp_rto_expired, (void*)(uintptr_t)conn->id);
+    timer_setup(&conn->ack_timer, tcp_ack_expired, (void*)(uintptr_t)conn->id);
+    poll_head_init(&conn->poll);
+
+    conn->hash = tcp_hash(&conn->local_ip, local_port, &conn->remote_ip, remote_port);
+    tcp_hash_insert(conn);
+    conn->next = tcp_connections;
     tcp_connections = conn;
+    tcp_stats.connections++;
     return conn;
 }
 
-// Close TCP connection
-void tcp_close_connection(tcp_connection_t* conn) {
-    if (!conn) return;
-
-    // Remove from connection list
-    if (tcp_connections == conn) {
-        tcp_connections = conn->next;
-    } else {
-        tcp_connection_t* prev = tcp_connections;
-        while (prev && prev->next != conn) {
-            prev = prev->next;
+// Unlink and release (tcp_lock held); a child still queued leaves its
+// listener's queue
+static void tcp_free(tcp_connection_t* conn) {
+    for (tcp_connection_t** link = &tcp_connections; *link; link = &(*link)->next) {
+        if (*link == conn) {
+            *link = conn->next;
+            break;
         }
-        if (prev) {
-            prev->next = conn->next;
+    }
+    tcp_hash_remove(conn);
+    timer_cancel(&conn->rto_timer);
+    timer_cancel(&conn->ack_timer);
+
+    tcp_connection_t* listener = conn->listener;
+    if (listener) {
+        tcp_connection_t* prev = NULL;
+        for (tcp_connection_t* child = listener->accept_head; child; child = child->accept_next) {
+            if (child == conn) {
+                if (prev) prev->accept_next = conn->accept_next;
+                else listener->accept_head = conn->accept_next;
+                if (listener->accept_tail == conn) listener->accept_tail = prev;
+                break;
+            }
+            prev = child;
         }
+        listener->pending--;
     }
 
+    poll_head_release(&conn->poll);
+    if (conn->send_buf) kfree(conn->send_buf);
+    if (conn->recv_buf) kfree(conn->recv_buf);
     kfree(conn);
+    tcp_stats.connections--;
 }
 
-// Find connection by addresses and ports
-tcp_connection_t* tcp_find_connection(const ipv4_addr_t* src_ip, const ipv4_addr_t* dst_ip,
-                                      uint16_t src_port, uint16_t dst_port) {
+// Into CLOSED: freed if no one holds it, else its owner finds out
+static void tcp_drop(tcp_connection_t* conn, int error) {
+    conn->state = TCP_CLOSED;
+    if (error != NET_SUCCESS && conn->error == NET_SUCCESS) {
+        conn->error = error;
+    }
+    timer_cancel(&conn->rto_timer);
+    timer_cancel(&conn->ack_timer);
+    if (conn->orphan) {
+        tcp_free(conn);
+        return;
+    }
+    tcp_wake(conn, POLL_IN | POLL_HUP);
+}
+
+static void tcp_abort_children(tcp_connection_t* listener) {
     tcp_connection_t* conn = tcp_connections;
     while (conn) {
-        if (memcmp(&conn->local_ip, dst_ip, sizeof(ipv4_addr_t)) == 0 &&
+        tcp_connection_t* next = conn->next;
+        if (conn->listener == listener) {
+            if (conn->state != TCP_CLOSED) {
+                tcp_output_segment(conn, conn->seq_num, TCP_FLAG_RST | TCP_FLAG_ACK, 0);
+                tcp_stats.resets_sent++;
+            }
+            tcp_free(conn);
+        }
+        conn = next;
+    }
+}
+
+static void tcp_time_wait(tcp_connection_t* conn) {
+    conn->state = TCP_TIME_WAIT;
+    timer_arm(&conn->rto_timer, get_current_time_ms() + TCP_TIME_WAIT_MS);
+}
+
+// Send what the window allows (tcp_lock held): new data up to the MSS per
+// segment, then a queued FIN once the data is all out
+static void tcp_push(tcp_connection_t* conn) {
+    if (conn->state != TCP_ESTABLISHED && conn->state != TCP_CLOSE_WAIT &&
+        conn->state != TCP_FIN_WAIT_1 && conn->state != TCP_LAST_ACK) {
+        return;
+    }
+
+    while (!conn->fin_sent) {
+        uint32_t unsent = conn->snd_data + conn->snd_len - conn->seq_num;
+        uint32_t in_flight = conn->seq_num - conn->snd_una;
+        if (unsent == 0) {
+            if (conn->fin_queued) {
+                tcp_output_segment(conn, conn->seq_num, TCP_FLAG_FIN | TCP_FLAG_ACK, 0);
+                conn->fin_seq = conn->seq_num++;
+                conn->fin_sent = true;
+                if (!conn->rto_timer.pending) tcp_arm_rto(conn);
+            }
+            break;
+        }
+
+        uint32_t usable = conn->window_size > in_flight ? conn->window_size - in_flight : 0;
+        if (usable == 0) {
+            // Zero window: the timer probes it
+            if (!conn->rto_timer.pending) tcp_arm_rto(conn);
+            break;
+        }
+        uint32_t len = min_u32(min_u32(unsent, conn->mss), usable);
+        if (!conn->nodelay && len < conn->mss && in_flight) {
+            break;      // Nagle: one small segment in flight at a time
+        }
+
+        if (!conn->rtt_timing) {
+            conn->rtt_timing = true;
+            conn->rtt_seq = conn->seq_num + len;
+            conn->rtt_start_ns = ktime_ns();
+        }
+        uint16_t flags = TCP_FLAG_ACK | (len == unsent ? TCP_FLAG_PSH : 0);
+        if (tcp_output_segment(conn, conn->seq_num, flags, len) != NET_SUCCESS) {
+            // Card refused it: the timer tries again
+            conn->rtt_timing = false;
+            if (!conn->rto_timer.pending) tcp_arm_rto(conn);
+            break;
+        }
+        conn->seq_num += len;
+        if (!conn->rto_timer.pending) tcp_arm_rto(conn);
+    }
+}
+
+// Resend the oldest unacknowledged segment; Karn: no sample across it
+static void tcp_retransmit(tcp_connection_t* conn) {
+    conn->rtt_timing = false;
+    if (conn->fin_sent && conn->snd_una == conn->fin_seq) {
+        tcp_output_segment(conn, conn->fin_seq, TCP_FLAG_FIN | TCP_FLAG_ACK, 0);
+        return;
+    }
+    uint32_t data_end = conn->fin_sent ? conn->fin_seq : conn->seq_num;
+    uint32_t len = min_u32(data_end - conn->snd_una, conn->mss);
+    if (len) {
+        tcp_output_segment(conn, conn->snd_una, TCP_FLAG_ACK | TCP_FLAG_PSH, len);
+    }
+}
+
+static void tcp_rto_expired(void* data) {
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_connection_t* conn = tcp_find_id(data);
+    if (!conn) {
+        spin_unlock_irqrestore(&tcp_lock, flags);
+        return;
+    }
+
+    switch (conn->state) {
+        case TCP_TIME_WAIT:
+        case TCP_FIN_WAIT_2:
+            tcp_drop(conn, NET_SUCCESS);
+            break;
+        case TCP_SYN_SENT:
+        case TCP_SYN_RECEIVED:
+            if (++conn->retries > TCP_SYN_RETRIES) {
+                tcp_drop(conn, NET_TIMEOUT);
+                break;
+            }
+            conn->rtt_timing = false;
+            tcp_output_segment(conn, conn->iss, conn->state == TCP_SYN_SENT ?
+                               TCP_FLAG_SYN : TCP_FLAG_SYN | TCP_FLAG_ACK, 0);
+            conn->retransmits++;
+            tcp_stats.retransmits++;
+            tcp_backoff(conn);
+            break;
+        case TCP_ESTABLISHED:
+        case TCP_CLOSE_WAIT:
+        case TCP_FIN_WAIT_1:
+        case TCP_CLOSING:
+        case TCP_LAST_ACK:
+            if (conn->snd_una != conn->seq_num) {
+                if (++conn->retries > TCP_MAX_RETRIES) {
+                    tcp_output_segment(conn, conn->seq_num, TCP_FLAG_RST | TCP_FLAG_ACK, 0);
+                    tcp_stats.resets_sent++;
+                    tcp_drop(conn, NET_TIMEOUT);
+                    break;
+                }
+                tcp_retransmit(conn);
+                conn->retransmits++;
+                tcp_stats.retransmits++;
+                tcp_backoff(conn);
+            } else if (conn->snd_data + conn->snd_len != conn->seq_num) {
+                if (conn->window_size == 0) {
+                    // Window probe: one byte past the closed window
+                    tcp_output_segment(conn, conn->seq_num, TCP_FLAG_ACK, 1);
+                    conn->seq_num++;
+                    tcp_backoff(conn);
+                } else {
+                    tcp_push(conn);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+}
+
+static void tcp_ack_expired(void* data) {
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_connection_t* conn = tcp_find_id(data);
+    if (conn && conn->ack_pending && conn->state >= TCP_ESTABLISHED &&
+        conn->state != TCP_TIME_WAIT) {
+        tcp_send_ack(conn);
+        tcp_stats.delayed_acks++;
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+}
+
+// Count a segment to acknowledge: true if the ACK should go now
+static bool tcp_schedule_ack(tcp_connection_t* conn) {
+    conn->ack_pending++;
+    if (conn->quickack || conn->ack_delay_ms == 0 || conn->ack_pending >= 2) {
+        return true;
+    }
+    if (!conn->ack_timer.pending) {
+        timer_arm(&conn->ack_timer, get_current_time_ms() + conn->ack_delay_ms);
+    }
+    return false;
+}
+
+// Record [start, end) as arrived past a gap, merging with its neighbours;
+// with every slot taken the data is not kept and comes again
+static void tcp_ooo_add(tcp_connection_t* conn, uint32_t start, uint32_t end) {
+    for (uint32_t i = 0; i < conn->ooo_count; i++) {
+        tcp_range_t* range = &conn->ooo[i];
+        if (seq_le(start, range->end) && seq_ge(end, range->start)) {
+            if (seq_lt(start, range->start)) range->start = start;
+            if (seq_gt(end, range->end)) range->end = end;
+            // It may now reach the next ones
+            for (uint32_t j = 0; j < conn->ooo_count; j++) {
+                tcp_range_t* other = &conn->ooo[j];
+                if (j != i && seq_le(other->start, range->end) && seq_ge(other->end, range->start)) {
+                    if (seq_lt(other->start, range->start)) range->start = other->start;
+                    if (seq_gt(other->end, range->end)) range->end = other->end;
+                    *other = conn->ooo[--conn->ooo_count];
+                    if (i == conn->ooo_count) range = other;
+                    j = (uint32_t)-1;
+                }
+            }
+            return;
+        }
+    }
+    if (conn->ooo_count < TCP_OOO_RANGES) {
+        conn->ooo[conn->ooo_count].start = start;
+        conn->ooo[conn->ooo_count].end = end;
+        conn->ooo_count++;
+    }
+}
+
+// Move the next expected byte over stretches now joined to it
+static void tcp_ooo_merge(tcp_connection_t* conn) {
+    for (uint32_t i = 0; i < conn->ooo_count; i++) {
+        tcp_range_t* range = &conn->ooo[i];
+        if (seq_le(range->start, conn->ack_num)) {
+            if (seq_gt(range->end, conn->ack_num)) conn->ack_num = range->end;
+            *range = conn->ooo[--conn->ooo_count];
+            i = (uint32_t)-1;
+        }
+    }
+}
+
+// The peer's FIN, in order: the stream ends after what is buffered
+static void tcp_peer_fin(tcp_connection_t* conn) {
+    conn->ack_num++;
+    conn->peer_fin = true;
+    conn->peer_fin_pending = false;
+    switch (conn->state) {
+        case TCP_SYN_RECEIVED:
+        case TCP_ESTABLISHED:
+            conn->state = TCP_CLOSE_WAIT;
+            break;
+        case TCP_FIN_WAIT_1:
+            if (conn->snd_una == conn->seq_num) tcp_time_wait(conn);
+            else conn->state = TCP_CLOSING;
+            break;
+        case TCP_FIN_WAIT_2:
+            tcp_time_wait(conn);
+            break;
+        default:
+            break;
+    }
+    tcp_wake(conn, POLL_IN | POLL_HUP);
+}
+
+// Data into the receive ring where it belongs; true if the ACK should go now
+static bool tcp_take_data(tcp_connection_t* conn, const tcp_segment_t* seg) {
+    uint32_t seq = seg->seq;
+    const uint8_t* data = seg->data;
+    uint32_t len = seg->len;
+
+    // Drop what we already have ...
+    if (seq_lt(seq, conn->ack_num)) {
+        uint32_t skip = conn->ack_num - seq;
+        if (skip >= len) return true;           // All duplicate: say where we are
+        seq += skip;
+        data += skip;
+        len -= skip;
+    }
+    // ... and what is past the window
+    uint32_t right = conn->rcv_read + TCP_RECV_BUFFER;
+    if (seq_ge(seq, right)) return true;
+    if (seq_gt(seq + len, right)) len = right - seq;
+
+    ring_write(conn->recv_buf, RECV_MASK, seq, data, len);
+    if (seq != conn->ack_num) {
+        // Ahead of a gap: a duplicate ACK tells the peer at once
+        tcp_ooo_add(conn, seq, seq + len);
+        conn->ooo_segments++;
+        tcp_stats.ooo_segments++;
+        return true;
+    }
+
+    bool filled_gap = conn->ooo_count != 0;
+    conn->ack_num += len;
+    tcp_ooo_merge(conn);
+    if (conn->peer_fin_pending && conn->ack_num == conn->peer_fin_seq) {
+        tcp_peer_fin(conn);
+        return true;
+    }
+    tcp_wake(conn, POLL_IN);
+    return tcp_schedule_ack(conn) || filled_gap;
+}
+
+// Acknowledgement of new data: free it from the send ring, time the round
+// trip, and restart or stop the timer
+static void tcp_ack_advance(tcp_connection_t* conn, uint32_t ack) {
+    uint32_t data_acked = ack;
+    if (conn->fin_sent && seq_gt(ack, conn->fin_seq)) data_acked = conn->fin_seq;
+    uint32_t freed = seq_gt(data_acked, conn->snd_data) ? data_acked - conn->snd_data : 0;
+    if (freed > conn->snd_len) freed = conn->snd_len;
+    conn->snd_data += freed;
+    conn->snd_len -= freed;
+
+    conn->snd_una = ack;
+    conn->dup_acks = 0;
+    conn->retries = 0;
+    if (conn->rtt_timing && seq_ge(ack, conn->rtt_seq)) {
+        tcp_rtt_sample(conn);
+    }
+    conn->rto_ms = tcp_rto_base(conn);
+    if (conn->snd_una == conn->seq_num) {
+        if (conn->state != TCP_TIME_WAIT && conn->state != TCP_FIN_WAIT_2) timer_cancel(&conn->rto_timer);
+    } else {
+        tcp_arm_rto(conn);
+    }
+    if (freed) {
+        tcp_wake(conn, POLL_OUT);
+    }
+}
+
+static uint16_t tcp_parse_mss(const uint8_t* options, uint32_t len) {
+    uint32_t i = 0;
+    while (i < len) {
+        uint8_t kind = options[i];
+        if (kind == TCP_OPT_END) break;
+        if (kind == TCP_OPT_NOP) {
+            i++;
+            continue;
+        }
+        if (i + 1 >= len || options[i + 1] < 2 || i + options[i + 1] > len) break;
+        if (kind == TCP_OPT_MSS && options[i + 1] == 4) {
+            return (uint16_t)((options[i + 2] << 8) | options[i + 3]);
+        }
+        i += options[i + 1];
+    }
+    return 0;
+}
+
+static uint16_t tcp_peer_mss(uint16_t mss) {
+    if (mss == 0) return TCP_MSS_DEFAULT;
+    return mss > TCP_MSS ? TCP_MSS : mss;
+}
+
+static void tcp_input_listen(tcp_connection_t* listener, const ipv4_addr_t* src_ip, uint16_t src_port,
+                             const ipv4_addr_t* dst_ip, const tcp_segment_t* seg) {
+    if (seg->flags & TCP_FLAG_RST) return;
+    if (seg->flags & TCP_FLAG_ACK) {
+        tcp_reset_reply(src_ip, src_port, listener->local_port, seg);
+        return;
+    }
+    if (!(seg->flags & TCP_FLAG_SYN) || listener->pending >= listener->backlog) {
+        return;     // A full backlog: the peer retries its SYN
+    }
+
+    tcp_connection_t* conn = tcp_new(dst_ip, listener->local_port, src_ip, src_port, false);
+    if (!conn) return;
+    conn->listener = listener;
+    conn->orphan = true;            // Until accepted
+    listener->pending++;
+    conn->nodelay = listener->nodelay;
+    conn->quickack = listener->quickack;
+    conn->ack_delay_ms = listener->ack_delay_ms;
+    conn->busy_poll_us = listener->busy_poll_us;
+
+    conn->irs = seg->seq;
+    conn->ack_num = seg->seq + 1;
+    conn->rcv_read = conn->ack_num;
+    conn->mss = tcp_peer_mss(seg->mss);
+    conn->window_size = seg->window;
+    conn->state = TCP_SYN_RECEIVED;
+
+    conn->rtt_timing = true;
+    conn->rtt_seq = conn->iss + 1;
+    conn->rtt_start_ns = ktime_ns();
+    tcp_output_segment(conn, conn->iss, TCP_FLAG_SYN | TCP_FLAG_ACK, 0);
+    conn->seq_num = conn->iss + 1;
+    tcp_arm_rto(conn);
+}
+
+static void tcp_input_syn_sent(tcp_connection_t* conn, const ipv4_addr_t* src_ip, const tcp_segment_t* seg) {
+    if (seg->flags & TCP_FLAG_ACK) {
+        if (seq_le(seg->ack, conn->iss) || seq_gt(seg->ack, conn->seq_num)) {
+            tcp_reset_reply(src_ip, conn->remote_port, conn->local_port, seg);
+            return;
+        }
+    }
+    if (seg->flags & TCP_FLAG_RST) {
+        if (seg->flags & TCP_FLAG_ACK) {
+            tcp_stats.resets_received++;
+            tcp_drop(conn, NET_ERROR);       // Refused
+        }
+        return;
+    }
+    if (!(seg->flags & TCP_FLAG_SYN) || !(seg->flags & TCP_FLAG_ACK)) {
+        return;     // No simultaneous open
+    }
+
+    conn->irs = seg->seq;
+    conn->ack_num = seg->seq + 1;
+    conn->rcv_read = conn->ack_num;
+    conn->mss = tcp_peer_mss(seg->mss);
+    conn->window_size = seg->window;
+    conn->snd_una = seg->ack;
+    conn->retries = 0;
+    if (conn->rtt_timing) tcp_rtt_sample(conn);
+    conn->rto_ms = tcp_rto_base(conn);
+    timer_cancel(&conn->rto_timer);
+    conn->state = TCP_ESTABLISHED;
+    tcp_send_ack(conn);
+    tcp_wake(conn, POLL_OUT);
+}
+
+// Every state past the handshake's first step (RFC 793 3.9, "otherwise")
+static void tcp_input(tcp_connection_t* conn, const ipv4_addr_t* src_ip, const tcp_segment_t* seg) {
+    // Our SYN-ACK was lost and the peer sent its SYN again
+    if (conn->state == TCP_SYN_RECEIVED && (seg->flags & TCP_FLAG_SYN) && seg->seq == conn->irs) {
+        tcp_output_segment(conn, conn->iss, TCP_FLAG_SYN | TCP_FLAG_ACK, 0);
+        return;
+    }
+
+    // Acceptable: some of it falls in the window
+    uint32_t seg_len = seg->len + ((seg->flags & TCP_FLAG_SYN) ? 1 : 0) + ((seg->flags & TCP_FLAG_FIN) ? 1 : 0);
+    uint32_t window = tcp_rcv_window(conn);
+    uint32_t right = conn->ack_num + window;
+    bool acceptable;
+    if (seg_len == 0) {
+        acceptable = window == 0 ? seg->seq == conn->ack_num :
+                     seq_ge(seg->seq, conn->ack_num) && seq_lt(seg->seq, right);
+    } else {
+        uint32_t last = seg->seq + seg_len - 1;
+        acceptable = window != 0 &&
+                     ((seq_ge(seg->seq, conn->ack_num) && seq_lt(seg->seq, right)) ||
+                      (seq_ge(last, conn->ack_num) && seq_lt(last, right)));
+    }
+    if (!acceptable) {
+        if (!(seg->flags & TCP_FLAG_RST)) tcp_send_ack(conn);
+        return;
+    }
+
+    if (seg->flags & TCP_FLAG_RST) {
+        tcp_stats.resets_received++;
+        tcp_drop(conn, NET_ERROR);
+        return;
+    }
+    if (seg->flags & TCP_FLAG_SYN) {
+        tcp_reset_reply(src_ip, conn->remote_port, conn->local_port, seg);
+        tcp_drop(conn, NET_ERROR);
+        return;
+    }
+    if (!(seg->flags & TCP_FLAG_ACK)) {
+        return;
+    }
+
+    if (conn->state == TCP_SYN_RECEIVED) {
+        if (seq_le(seg->ack, conn->snd_una) || seq_gt(seg->ack, conn->seq_num)) {
+            tcp_reset_reply(src_ip, conn->remote_port, conn->local_port, seg);
+            return;
+        }
+        conn->state = TCP_ESTABLISHED;
+        tcp_connection_t* listener = conn->listener;
+        if (listener) {
+            conn->accept_next = NULL;
+            if (listener->accept_tail) listener->accept_tail->accept_next = conn;
+            else listener->accept_head = conn;
+            listener->accept_tail = conn;
+            tcp_wake(listener, POLL_IN);
+        }
+    }
+
+    if (seq_gt(seg->ack, conn->seq_num)) {
+        tcp_send_ack(conn);             // Acknowledges what we never sent
+        return;
+    }
+    if (seq_gt(seg->ack, conn->snd_una)) {
+        tcp_ack_advance(conn, seg->ack);
+    } else if (seg->ack == conn->snd_una && seg->len == 0 && !(seg->flags & TCP_FLAG_FIN) &&
+               seg->window == conn->window_size && conn->snd_una != conn->seq_num) {
+        if (++conn->dup_acks == TCP_DUP_ACK_THRESHOLD) {
+            tcp_retransmit(conn);
+            conn->fast_retransmits++;
+            tcp_stats.fast_retransmits++;
+        }
+    }
+    conn->window_size = seg->window;
+
+    bool fin_acked = conn->fin_sent && seq_gt(conn->snd_una, conn->fin_seq);
+    switch (conn->state) {
+        case TCP_FIN_WAIT_1:
+            if (fin_acked) {
+                conn->state = TCP_FIN_WAIT_2;
+                // An orphan does not wait forever for the peer's FIN
+                if (conn->orphan) timer_arm(&conn->rto_timer, get_current_time_ms() + TCP_TIME_WAIT_MS);
+            }
+            break;
+        case TCP_CLOSING:
+            if (fin_acked) tcp_time_wait(conn);
+            break;
+        case TCP_LAST_ACK:
+            if (fin_acked) {
+                tcp_drop(conn, NET_SUCCESS);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+
+    bool ack_now = false;
+    if (seg->len && (conn->state == TCP_ESTABLISHED || conn->state == TCP_FIN_WAIT_1 ||
+                     conn->state == TCP_FIN_WAIT_2)) {
+        ack_now = tcp_take_data(conn, seg);
+    }
+
+    if ((seg->flags & TCP_FLAG_FIN) && !conn->peer_fin) {
+        uint32_t fin_seq = seg->seq + seg->len;
+        if (fin_seq == conn->ack_num) {
+            tcp_peer_fin(conn);
+            ack_now = true;
+        } else if (seq_gt(fin_seq, conn->ack_num)) {
+            conn->peer_fin_pending = true;
+            conn->peer_fin_seq = fin_seq;
+        }
+    }
+
+    // Data going out carries the ACK; a pure one only if nothing went
+    uint32_t segs_out = conn->segs_out;
+    tcp_push(conn);
+    if (ack_now && conn->segs_out == segs_out) {
+        tcp_send_ack(conn);
+    }
+}
+
+// The connection with this 4-tuple, CLOSED ones too unless skipped
+static tcp_connection_t* tcp_hash_lookup(const ipv4_addr_t* src_ip, const ipv4_addr_t* dst_ip,
+                                         uint16_t src_port, uint16_t dst_port, bool skip_closed) {
+    uint32_t hash = tcp_hash(dst_ip, dst_port, src_ip, src_port);
+    for (tcp_connection_t* conn = tcp_hash_table[hash & HASH_MASK]; conn; conn = conn->hash_next) {
+        if (conn->hash == hash && conn->local_port == dst_port && conn->remote_port == src_port &&
             memcmp(&conn->remote_ip, src_ip, sizeof(ipv4_addr_t)) == 0 &&
-            conn->local_port == dst_port &&
-            conn->remote_port == src_port) {
+            memcmp(&conn->local_ip, dst_ip, sizeof(ipv4_addr_t)) == 0 &&
+            !(skip_closed && conn->state == TCP_CLOSED)) {
             return conn;
         }
-        conn = conn->next;
     }
     return NULL;
 }
 
-// Calculate TCP checksum (includes pseudo-header)
-uint16_t tcp_checksum(const tcp_header_t* header, const void* data, uint32_t data_len,
+// A socket listening on the port wins only when no connection matches,
+// one bound to the address over one bound to any
+static tcp_connection_t* tcp_lookup(const ipv4_addr_t* src_ip, const ipv4_addr_t* dst_ip,
+                                    uint16_t src_port, uint16_t dst_port) {
+    static const ipv4_addr_t any_addr = {{0, 0, 0, 0}};
+    tcp_connection_t* conn = tcp_hash_lookup(src_ip, dst_ip, src_port, dst_port, true);
+    if (conn) return conn;
+
+    tcp_connection_t* any = NULL;
+    for (conn = tcp_listen_table[dst_port & LISTEN_MASK]; conn; conn = conn->hash_next) {
+        if (conn->local_port != dst_port) continue;
+        if (memcmp(&conn->local_ip, dst_ip, sizeof(ipv4_addr_t)) == 0) return conn;
+        if (memcmp(&conn->local_ip, &any_addr, sizeof(ipv4_addr_t)) == 0) any = conn;
+    }
+    return any;
+}
+
+// Handle incoming TCP packet
+int tcp_handle_packet(const tcp_packet_t* packet, uint32_t len,
                       const ipv4_addr_t* src_ip, const ipv4_addr_t* dst_ip) {
-    // TCP pseudo-header
-    struct {
-        ipv4_addr_t src_ip;
-        ipv4_addr_t dst_ip;
-        uint8_t zero;
-        uint8_t protocol;
-        uint16_t tcp_len;
-    } __attribute__((packed)) pseudo_header = {
-        .src_ip = *src_ip,
-        .dst_ip = *dst_ip,
-        .zero = 0,
-        .protocol = IP_PROTO_TCP,
-        .tcp_len = sizeof(tcp_header_t) + data_len
-    };
+    if (len < sizeof(tcp_header_t) || ipv4_is_multicast(dst_ip)) {
+        return NET_INVALID;
+    }
+    const tcp_header_t* header = &packet->header;
+    uint16_t offset_flags = net_ntohs(header->flags);
+    uint32_t header_len = (uint32_t)(offset_flags >> 12) * 4;
+    if (header_len < sizeof(tcp_header_t) || header_len > len) {
+        return NET_INVALID;
+    }
+    if (!net_rx_csum_verified() && tcp_checksum(packet, len, src_ip, dst_ip) != 0) {
+        __sync_fetch_and_add(&tcp_stats.bad_checksums, 1);
+        return NET_INVALID;
+    }
+
+    tcp_segment_t seg;
+    seg.seq = net_ntohl(header->seq_num);
+    seg.ack = net_ntohl(header->ack_num);
+    seg.flags = offset_flags & TCP_FLAGS_MASK;
+    seg.window = net_ntohs(header->window);
+    seg.mss = (seg.flags & TCP_FLAG_SYN) ?
+              tcp_parse_mss(packet->data, header_len - sizeof(tcp_header_t)) : 0;
+    seg.data = (const uint8_t*)packet + header_len;
+    seg.len = len - header_len;
+    uint16_t src_port = net_ntohs(header->src_port);
+    uint16_t dst_port = net_ntohs(header->dst_port);
+
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_stats.segs_in++;
+    tcp_connection_t* conn = tcp_lookup(src_ip, dst_ip, src_port, dst_port);
+    if (!conn) {
+        tcp_reset_reply(src_ip, src_port, dst_port, &seg);
+    } else {
+        conn->segs_in++;
+        if (seg.len) conn->rx_tsc = net_rx_timestamp();
+        if (conn->state == TCP_LISTEN) {
+            tcp_input_listen(conn, src_ip, src_port, dst_ip, &seg);
+        } else if (conn->state == TCP_SYN_SENT) {
+            tcp_input_syn_sent(conn, src_ip, &seg);
+        } else {
+            tcp_input(conn, src_ip, &seg);
+        }
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return NET_SUCCESS;
+}
+
+// Sleep until the connection changes (tcp_lock held on entry and on
+// return), busy polling first with SO_BUSY_POLL; false once the deadline
+// has passed
+static bool tcp_wait(tcp_connection_t* conn, uint32_t* flags, uint32_t deadline, uint32_t timeout_ms) {
+    uint32_t wait = FUTEX_WAIT_FOREVER;
+    uint32_t busy_us = conn->busy_poll_us;
+    if (timeout_ms != TCP_WAIT_FOREVER) {
+        uint32_t now = get_current_time_ms();
+        if ((int32_t)(deadline - now) <= 0) return false;
+        wait = deadline - now;
+        if (wait < busy_us / 1000) busy_us = wait * 1000;
+    }
+    uint32_t seen = conn->events;
+    spin_unlock_irqrestore(&tcp_lock, *flags);
+    if (!net_busy_wait(&conn->events, seen, busy_us)) {
+        futex_wait(&conn->events, seen, wait);
+    }
+    *flags = spin_lock_irqsave(&tcp_lock);
+    return true;
+}
+
+tcp_connection_t* tcp_create_connection(const ipv4_addr_t* remote_ip,
+                                        uint16_t remote_port, uint16_t local_port) {
+    if (!remote_ip) return NULL;
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_connection_t* conn = tcp_new(ipv4_get_our_address(), local_port, remote_ip, remote_port, false);
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return conn;
+}
+
+int tcp_connect(tcp_connection_t* conn, uint32_t timeout_ms) {
+    if (!conn) return NET_INVALID;
+    uint32_t deadline = get_current_time_ms() + timeout_ms;
 
-    // Calculate total length for checksum
-    uint32_t total_len = sizeof(pseudo_header) + sizeof(tcp_header_t) + data_len;
-    uint8_t* buffer = (uint8_t*)kmalloc(total_len);
-    if (!buffer) {
-        return 0;
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    if (conn->state != TCP_CLOSED || conn->error != NET_SUCCESS) {
+        spin_unlock_irqrestore(&tcp_lock, flags);
+        return NET_ERROR;
     }
+    conn->state = TCP_SYN_SENT;
+    conn->rtt_timing = true;
+    conn->rtt_seq = conn->iss + 1;
+    conn->rtt_start_ns = ktime_ns();
+    tcp_output_segment(conn, conn->iss, TCP_FLAG_SYN, 0);
+    conn->seq_num = conn->iss + 1;
+    tcp_arm_rto(conn);
+
+    int result = NET_SUCCESS;
+    while (conn->state == TCP_SYN_SENT) {
+        if (!tcp_wait(conn, &flags, deadline, timeout_ms)) {
+            result = NET_TIMEOUT;
+            break;
+        }
+    }
+    if (result == NET_SUCCESS && conn->state == TCP_CLOSED) {
+        result = conn->error != NET_SUCCESS ? conn->error : NET_ERROR;
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return result;
+}
+
+tcp_connection_t* tcp_listen(const ipv4_addr_t* local_ip, uint16_t port, uint32_t backlog) {
+    static const ipv4_addr_t any_addr = {{0, 0, 0, 0}};
+    if (port == 0) return NULL;
 
-    // Copy pseudo-header
-    memcpy(buffer, &pseudo_header, sizeof(pseudo_header));
-    // Copy TCP header
-    memcpy(buffer + sizeof(pseudo_header), header, sizeof(tcp_header_t));
-    // Copy data
-    if (data && data_len) {
-        memcpy(buffer + sizeof(pseudo_header) + sizeof(tcp_header_t), data, data_len);
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_connection_t* conn = NULL;
+    if (!tcp_port_in_use(port)) {
+        conn = tcp_new(local_ip ? local_ip : &any_addr, port, NULL, 0, true);
+    }
+    if (conn) {
+        conn->backlog = (uint16_t)(backlog && backlog < 64 ? backlog : TCP_BACKLOG);
     }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return conn;
+}
 
-    uint16_t checksum = net_checksum(buffer, total_len);
-    kfree(buffer);
-    return checksum;
-}
\ No newline at end of file
+tcp_connection_t* tcp_accept(tcp_connection_t* listener, uint32_t timeout_ms) {
+    if (!listener) return NULL;
+    uint32_t deadline = get_current_time_ms() + timeout_ms;
+
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    while (listener->state == TCP_LISTEN && !listener->accept_head) {
+        if (!tcp_wait(listener, &flags, deadline, timeout_ms)) break;
+    }
+    tcp_connection_t* conn = listener->state == TCP_LISTEN ? listener->accept_head : NULL;
+    if (conn) {
+        listener->accept_head = conn->accept_next;
+        if (!listener->accept_head) listener->accept_tail = NULL;
+        listener->pending--;
+        conn->accept_next = NULL;
+        conn->listener = NULL;
+        conn->orphan = false;
+        tcp_stats.accepted++;
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return conn;
+}
+
+int tcp_send(tcp_connection_t* conn, const void* data, uint32_t len) {
+    if (!conn || (len && !data)) return NET_INVALID;
+
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint32_t done = 0;
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    while (done < len) {
+        if ((conn->state != TCP_ESTABLISHED && conn->state != TCP_CLOSE_WAIT) || conn->fin_queued) {
+            break;
+        }
+        uint32_t room = TCP_SEND_BUFFER - conn->snd_len;
+        if (room == 0) {
+            tcp_wait(conn, &flags, 0, TCP_WAIT_FOREVER);
+            continue;
+        }
+        uint32_t n = min_u32(room, len - done);
+        ring_write(conn->send_buf, SEND_MASK, conn->snd_data + conn->snd_len, bytes + done, n);
+        conn->snd_len += n;
+        done += n;
+        tcp_push(conn);
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return done == len ? (int)len : NET_ERROR;
+}
+
+// Wait for data in order (tcp_lock held, and held again on return): the
+// bytes readable, 0 at the end of the stream, or an error
+static int tcp_recv_wait(tcp_connection_t* conn, uint32_t* flags, uint32_t timeout_ms) {
+    uint32_t deadline = get_current_time_ms() + timeout_ms;
+    while (conn->ack_num == conn->rcv_read || !conn->recv_buf) {
+        if (conn->state == TCP_CLOSED || conn->state == TCP_LISTEN || !conn->recv_buf) {
+            return conn->error != NET_SUCCESS ? NET_ERROR : 0;
+        } else if (conn->peer_fin) {
+            return 0;
+        } else if (!tcp_wait(conn, flags, deadline, timeout_ms)) {
+            return NET_TIMEOUT;
+        }
+    }
+    // With the FIN taken, ack_num is one past the data
+    return (int)(conn->ack_num - conn->rcv_read - (conn->peer_fin ? 1 : 0));
+}
+
+// Past n bytes read (tcp_lock held)
+static void tcp_recv_advance(tcp_connection_t* conn, uint32_t n) {
+    conn->rcv_read += n;
+    if (conn->peer_fin && conn->ack_num - conn->rcv_read == 1) {
+        conn->rcv_read = conn->ack_num;     // Only the FIN left
+    }
+
+    // Tell a peer held up by our window that it opened again
+    uint32_t edge = conn->ack_num + tcp_rcv_window(conn);
+    if (conn->state >= TCP_ESTABLISHED && conn->state <= TCP_FIN_WAIT_2 &&
+        edge - conn->rcv_adv >= min_u32(TCP_RECV_BUFFER / 2, conn->mss)) {
+        tcp_send_ack(conn);
+    }
+}
+
+int tcp_recv(tcp_connection_t* conn, void* buf, uint32_t len, uint32_t timeout_ms) {
+    if (!conn || (len && !buf)) return NET_INVALID;
+
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    int available = tcp_recv_wait(conn, &flags, timeout_ms);
+    if (available <= 0) {
+        spin_unlock_irqrestore(&tcp_lock, flags);
+        return available;
+    }
+
+    uint32_t n = min_u32(len, (uint32_t)available);
+    ring_read(conn->recv_buf, RECV_MASK, conn->rcv_read, (uint8_t*)buf, n);
+    tcp_recv_advance(conn, n);
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return (int)n;
+}
+
+int tcp_recv_peek(tcp_connection_t* conn, uint8_t** data, uint32_t timeout_ms) {
+    if (!conn || !data) return NET_INVALID;
+
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    int available = tcp_recv_wait(conn, &flags, timeout_ms);
+    if (available > 0) {
+        // Up to the end of the ring; the rest follows from its start
+        uint32_t offset = conn->rcv_read & RECV_MASK;
+        *data = conn->recv_buf + offset;
+        available = (int)min_u32((uint32_t)available, TCP_RECV_BUFFER - offset);
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return available;
+}
+
+void tcp_recv_consume(tcp_connection_t* conn, uint32_t len) {
+    if (!conn || !conn->recv_buf) return;
+
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    uint32_t available = conn->ack_num - conn->rcv_read - (conn->peer_fin ? 1 : 0);
+    if (conn->ack_num != conn->rcv_read) {
+        tcp_recv_advance(conn, min_u32(len, available));
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+}
+
+uint64_t tcp_rx_timestamp(tcp_connection_t* conn) {
+    if (!conn) return 0;
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    uint64_t tsc = conn->rx_tsc;
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return tsc;
+}
+
+uint32_t tcp_readable(tcp_connection_t* conn) {
+    if (!conn) return 0;
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    uint32_t count = conn->ack_num - conn->rcv_read;
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return count;
+}
+
+int tcp_set_option(tcp_connection_t* conn, int option, uint32_t value) {
+    if (!conn) return NET_INVALID;
+
+    int result = NET_SUCCESS;
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    switch (option) {
+        case TCP_NODELAY:
+            conn->nodelay = value != 0;
+            if (conn->nodelay) tcp_push(conn);
+            break;
+        case TCP_QUICKACK:
+            conn->quickack = value != 0;
+            if (conn->quickack && conn->ack_pending) tcp_send_ack(conn);
+            break;
+        case TCP_ACK_DELAY:
+            conn->ack_delay_ms = (uint16_t)min_u32(value, 500);
+            break;
+        case SO_BUSY_POLL:
+            conn->busy_poll_us = min_u32(value, NET_BUSY_POLL_MAX_US);
+            break;
+        default:
+            result = NET_INVALID;
+            break;
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return result;
+}
+
+uint32_t tcp_send_room(tcp_connection_t* conn) {
+    return conn && conn->send_buf ? TCP_SEND_BUFFER - conn->snd_len : 0;
+}
+
+int tcp_record_sent(tcp_connection_t* conn, const void* data, uint32_t len) {
+    if (!conn || !conn->send_buf || (len && !data)) return -1;
+
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    // Only behind everything already sent, or the order would break
+    if (TCP_SEND_BUFFER - conn->snd_len < len || conn->snd_data + conn->snd_len != conn->seq_num) {
+        spin_unlock_irqrestore(&tcp_lock, flags);
+        return -1;
+    }
+    ring_write(conn->send_buf, SEND_MASK, conn->seq_num, (const uint8_t*)data, len);
+    conn->snd_len += len;
+    if (!conn->rtt_timing) {
+        conn->rtt_timing = true;
+        conn->rtt_seq = conn->seq_num + len;
+        conn->rtt_start_ns = ktime_ns();
+    }
+    conn->seq_num += len;
+    if (!conn->rto_timer.pending) tcp_arm_rto(conn);
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return 0;
+}
+
+void tcp_close(tcp_connection_t* conn) {
+    if (!conn) return;
+
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    if (!tcp_live(conn)) {
+        spin_unlock_irqrestore(&tcp_lock, flags);
+        return;
+    }
+    conn->orphan = true;
+    switch (conn->state) {
+        case TCP_LISTEN:
+            tcp_abort_children(conn);
+            tcp_free(conn);
+            break;
+        case TCP_CLOSED:
+        case TCP_SYN_SENT:
+            tcp_free(conn);
+            break;
+        case TCP_SYN_RECEIVED:
+        case TCP_ESTABLISHED:
+            conn->fin_queued = true;
+            conn->state = TCP_FIN_WAIT_1;
+            tcp_push(conn);
+            break;
+        case TCP_CLOSE_WAIT:
+            conn->fin_queued = true;
+            conn->state = TCP_LAST_ACK;
+            tcp_push(conn);
+            break;
+        default:
+            break;      // Already closing
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+}
+
+// Close TCP connection
+void tcp_close_connection(tcp_connection_t* conn) {
+    if (!conn) return;
+
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    if (!tcp_live(conn)) {
+        spin_unlock_irqrestore(&tcp_lock, flags);
+        return;
+    }
+    if (conn->state == TCP_LISTEN) {
+        tcp_abort_children(conn);
+    } else if (conn->state >= TCP_SYN_RECEIVED && conn->state != TCP_TIME_WAIT) {
+        tcp_output_segment(conn, conn->seq_num, TCP_FLAG_RST | TCP_FLAG_ACK, 0);
+        tcp_stats.resets_sent++;
+    }
+    tcp_free(conn);
+    spin_unlock_irqrestore(&tcp_lock, flags);
+}
+
+// Find connection by addresses and ports
+tcp_connection_t* tcp_find_connection(const ipv4_addr_t* src_ip, const ipv4_addr_t* dst_ip,
+                                      uint16_t src_port, uint16_t dst_port) {
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_connection_t* conn = tcp_hash_lookup(src_ip, dst_ip, src_port, dst_port, false);
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return conn;
+}
+
+void tcp_get_stats(tcp_stats_t* stats) {
+    if (stats) *stats = tcp_stats;
+}
+
+static const char* tcp_state_name(tcp_state_t state) {
+    static const char* names[] = {
+        "CLOSED", "LISTEN", "SYN_SENT", "SYN_RECEIVED", "ESTABLISHED", "FIN_WAIT_1",
+        "FIN_WAIT_2", "CLOSE_WAIT", "CLOSING", "LAST_ACK", "TIME_WAIT"
+    };
+    return (uint32_t)state < sizeof(names) / sizeof(names[0]) ? names[state] : "?";
+}
+
+void tcp_print_info(void) {
+    tcp_stats_t stats;
+    tcp_get_stats(&stats);
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== TCP ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string("Segments in: ");
+    print_dec(stats.segs_in);
+    vga_write_string("  out: ");
+    print_dec(stats.segs_out);
+    vga_write_string("  bad checksum: ");
+    print_dec(stats.bad_checksums);
+    vga_write_string("\nRetransmits: ");
+    print_dec(stats.retransmits);
+    vga_write_string("  fast: ");
+    print_dec(stats.fast_retransmits);
+    vga_write_string("  out of order: ");
+    print_dec(stats.ooo_segments);
+    vga_write_string("  delayed ACKs: ");
+    print_dec(stats.delayed_acks);
+    vga_write_string("\nResets sent: ");
+    print_dec(stats.resets_sent);
+    vga_write_string("  received: ");
+    print_dec(stats.resets_received);
+    vga_write_string("  accepted: ");
+    print_dec(stats.accepted);
+    vga_write_string("\n");
+
+    // Snapshot under the lock, printed after it
+    typedef struct {
+        tcp_state_t state;
+        ipv4_addr_t remote_ip;
+        uint16_t local_port;
+        uint16_t remote_port;
+        uint32_t in_flight;
+        uint32_t unread;
+        uint32_t srtt_us;
+        uint32_t rto_ms;
+    } tcp_row_t;
+    tcp_row_t rows[8];
+    uint32_t count = 0;
+    uint32_t buckets_used = 0;
+    uint32_t longest = 0;
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    for (uint32_t i = 0; i < TCP_HASH_BUCKETS; i++) {
+        uint32_t chain = 0;
+        for (tcp_connection_t* conn = tcp_hash_table[i]; conn; conn = conn->hash_next) chain++;
+        if (chain) buckets_used++;
+        if (chain > longest) longest = chain;
+    }
+    for (tcp_connection_t* conn = tcp_connections; conn && count < 8; conn = conn->next) {
+        tcp_row_t* row = &rows[count++];
+        row->state = conn->state;
+        row->remote_ip = conn->remote_ip;
+        row->local_port = conn->local_port;
+        row->remote_port = conn->remote_port;
+        row->in_flight = conn->seq_num - conn->snd_una;
+        row->unread = conn->ack_num - conn->rcv_read;
+        row->srtt_us = conn->srtt_us;
+        row->rto_ms = conn->rto_ms;
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+
+    vga_write_string("Connections: ");
+    print_dec(stats.connections);
+    vga_write_string("  hash buckets used: ");
+    print_dec(buckets_used);
+    vga_write_string("/");
+    print_dec(TCP_HASH_BUCKETS);
+    vga_write_string("  longest chain: ");
+    print_dec(longest);
+    vga_write_string("\n");
+    for (uint32_t i = 0; i < count; i++) {
+        vga_write_string("  ");
+        print_dec(rows[i].local_port);
+        vga_write_string(" -> ");
+        for (int b = 0; b < 4; b++) {
+            print_dec(rows[i].remote_ip.addr[b]);
+            vga_write_string(b < 3 ? "." : ":");
+        }
+        print_dec(rows[i].remote_port);
+        vga_write_string(" ");
+        vga_write_string(tcp_state_name(rows[i].state));
+        vga_write_string(" in flight ");
+        print_dec(rows[i].in_flight);
+        vga_write_string(" unread ");
+        print_dec(rows[i].unread);
+        vga_write_string(" srtt ");
+        print_dec(rows[i].srtt_us);
+        vga_write_string("us rto ");
+        print_dec(rows[i].rto_ms);
+        vga_write_string("ms\n");
+    }
+}
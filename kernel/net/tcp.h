@@ -3,9 +3,56 @@
 
 #include "net.h"
 
-// TCP flags and states are now defined in net.h
+// TCP over the IPv4 layer. Each connection has a send and a receive buffer
+// of fixed size, rings indexed by sequence number: a send copies into the
+// send ring and the bytes stay there until acknowledged, and a segment is
+// written into the receive ring where its sequence number puts it, so
+// reassembly is only remembering which stretches beyond the next expected
+// byte have arrived. The window offered is the receive ring's free space;
+// the peer's window limits what is in flight. There is no congestion
+// control: the peers are expected on a switched network under our control.
+//
+// Lost segments are resent from a timer on the timer wheel, with the
+// timeout estimated from measured round trips (RFC 6298, Karn's rule), or
+// at once on the third duplicate acknowledgement. The same timer probes a
+// zero window, retries a SYN and ends TIME_WAIT.
+//
+// The defaults are for latency: TCP_NODELAY is on, so a send goes out at
+// once instead of waiting for what is in flight to be acknowledged, and
+// TCP_QUICKACK is on, so every segment received is acknowledged at once.
+// With quick-ack off an ACK waits up to TCP_ACK_DELAY (ms) for data going
+// the other way to ride on, or goes with the second full segment.
+//
+// A segment finds its connection by a hash of the 4-tuple, computed once
+// when the connection is made and kept in it, in a table of
+// TCP_HASH_BUCKETS chains; only a segment nothing matches goes on to the
+// listeners, in a table of their own by port.
+//
+// One lock covers every connection; timers and receive run under it from
+// interrupt context, so nothing here sleeps with it held.
+#define TCP_SEND_BUFFER         16384       // Power of 2
+#define TCP_RECV_BUFFER         16384       // Power of 2, at most 65535 offered
+#define TCP_MSS                 (ETH_MTU - IP_HEADER_SIZE - TCP_HEADER_SIZE)
+#define TCP_MSS_DEFAULT         536         // Peer sent no MSS option
+#define TCP_RTO_INITIAL_MS      1000
+#define TCP_RTO_MIN_MS          20
+#define TCP_RTO_MAX_MS          8000
+#define TCP_MAX_RETRIES         8           // Timeouts in a row before a reset
+#define TCP_SYN_RETRIES         5
+#define TCP_DUP_ACK_THRESHOLD   3
+#define TCP_ACK_DELAY_MS        40          // Default delay with quick-ack off
+#define TCP_TIME_WAIT_MS        2000
+#define TCP_BACKLOG             8
+#define TCP_EPHEMERAL_PORT      49152
+#define TCP_WAIT_FOREVER        0xFFFFFFFF
+#define TCP_HASH_BUCKETS        256         // Power of 2
+#define TCP_LISTEN_BUCKETS      32          // Power of 2
 
-// TCP connection structure is now defined in net.h
+// tcp_set_option
+#define TCP_NODELAY             1           // 1: no Nagle (default)
+#define TCP_QUICKACK            12          // 1: acknowledge at once (default)
+#define TCP_ACK_DELAY           0x100       // ms an ACK may wait with quick-ack off, 0 none
+// and SO_BUSY_POLL (net.h): connect, accept, send and receive waits spin
 
 // TCP packet structure
 typedef struct {
@@ -13,18 +60,82 @@ typedef struct {
     uint8_t data[];
 } __attribute__((packed)) tcp_packet_t;
 
+typedef struct {
+    uint32_t connections;       // Open now
+    uint32_t segs_in;
+    uint32_t segs_out;
+    uint32_t bad_checksums;
+    uint32_t retransmits;       // From the timer
+    uint32_t fast_retransmits;
+    uint32_t ooo_segments;      // Arrived ahead of a gap
+    uint32_t delayed_acks;      // ACKs sent by the delay timer
+    uint32_t resets_sent;
+    uint32_t resets_received;
+    uint32_t accepted;
+} tcp_stats_t;
+
 // Function declarations
 int tcp_init(void);
 int tcp_handle_packet(const tcp_packet_t* packet, uint32_t len,
                       const ipv4_addr_t* src_ip, const ipv4_addr_t* dst_ip);
-int tcp_send_packet(tcp_connection_t* conn, uint8_t flags,
-                    const void* data, uint32_t data_len);
+
+// A connection in CLOSED, not yet on the wire; local_port 0 picks a free
+// ephemeral port. Ports in host order.
 tcp_connection_t* tcp_create_connection(const ipv4_addr_t* remote_ip,
                                         uint16_t remote_port, uint16_t local_port);
+
+// Active open: NET_SUCCESS once established, NET_TIMEOUT, or NET_ERROR
+// when refused or the SYN retries run out
+int tcp_connect(tcp_connection_t* conn, uint32_t timeout_ms);
+
+// Passive open on a port of ours (local_ip NULL for any); accept takes the
+// next established connection, NULL on timeout
+tcp_connection_t* tcp_listen(const ipv4_addr_t* local_ip, uint16_t port, uint32_t backlog);
+tcp_connection_t* tcp_accept(tcp_connection_t* listener, uint32_t timeout_ms);
+
+// Queue data, waiting for buffer room: len, or NET_ERROR if the
+// connection cannot send (it may have queued part)
+int tcp_send(tcp_connection_t* conn, const void* data, uint32_t len);
+
+// Copy out what has arrived in order: bytes, 0 at the end of the stream,
+// NET_TIMEOUT, or NET_ERROR once reset
+int tcp_recv(tcp_connection_t* conn, void* buf, uint32_t len, uint32_t timeout_ms);
+uint32_t tcp_readable(tcp_connection_t* conn);
+
+// When the latest segment with data was taken off the card (TSC, as
+// net_rx_timestamp), 0 before any
+uint64_t tcp_rx_timestamp(tcp_connection_t* conn);
+
+// Reading in place: the data in order at the front of the receive ring, as
+// much of it as is contiguous (the same results as tcp_recv otherwise). It
+// stays put until tcp_recv_consume lets go of len bytes of it; one reader.
+int tcp_recv_peek(tcp_connection_t* conn, uint8_t** data, uint32_t timeout_ms);
+void tcp_recv_consume(tcp_connection_t* conn, uint32_t len);
+
+int tcp_set_option(tcp_connection_t* conn, int option, uint32_t value);
+
+// For senders that put segments on the wire themselves (the order
+// gateway): the room left in the send buffer, and the payload they just
+// sent at seq_num, buffered for retransmission. 0, or -1 without room.
+uint32_t tcp_send_room(tcp_connection_t* conn);
+int tcp_record_sent(tcp_connection_t* conn, const void* data, uint32_t len);
+
+// Orderly close: a FIN after the data, and the connection is freed by the
+// stack once the exchange is over. The caller lets go of it.
+void tcp_close(tcp_connection_t* conn);
+
+// Abort: a reset if the peer knows the connection, freed at once
 void tcp_close_connection(tcp_connection_t* conn);
+
 tcp_connection_t* tcp_find_connection(const ipv4_addr_t* src_ip, const ipv4_addr_t* dst_ip,
                                       uint16_t src_port, uint16_t dst_port);
-uint16_t tcp_checksum(const tcp_header_t* header, const void* data, uint32_t data_len,
+
+// Over a whole segment and the pseudo-header: the value for the checksum
+// field, or 0 for a received segment that checks out
+uint16_t tcp_checksum(const void* segment, uint32_t len,
                       const ipv4_addr_t* src_ip, const ipv4_addr_t* dst_ip);
 
-#endif
\ No newline at end of file
+void tcp_get_stats(tcp_stats_t* stats);
+void tcp_print_info(void);
+
+#endif
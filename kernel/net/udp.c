@@ -0,0 +1,329 @@
+#include "udp.h"
+#include "ip.h"
+#include "eth.h"
+#include "../arch/spinlock.h"
+#include "../arch/cpu.h"
+#include "../arch/tsc.h"
+#include "../mm/memory.h"
+#include "../proc/futex.h"
+
+typedef struct {
+    udp_recv_fn_t fn;
+    void* ctx;
+    ipv4_addr_t addr;
+    uint16_t port;
+    bool any_addr;
+} udp_binding_t;
+
+static udp_binding_t bindings[UDP_MAX_BINDINGS];
+static spinlock_t bindings_lock = SPINLOCK_INIT;
+
+static bool udp_binding_matches(const udp_binding_t* binding, const ipv4_addr_t* addr, uint16_t port) {
+    if (!binding->fn || binding->port != port) return false;
+    if (!addr) return binding->any_addr;
+    return !binding->any_addr && memcmp(&binding->addr, addr, sizeof(ipv4_addr_t)) == 0;
+}
+
+int udp_bind(const ipv4_addr_t* addr, uint16_t port, udp_recv_fn_t fn, void* ctx) {
+    if (!fn) return -1;
+
+    uint32_t flags = spin_lock_irqsave(&bindings_lock);
+    udp_binding_t* free_binding = NULL;
+    for (int i = 0; i < UDP_MAX_BINDINGS; i++) {
+        if (udp_binding_matches(&bindings[i], addr, port)) {
+            spin_unlock_irqrestore(&bindings_lock, flags);
+            return -1;
+        }
+        if (!bindings[i].fn && !free_binding) {
+            free_binding = &bindings[i];
+        }
+    }
+    if (free_binding) {
+        free_binding->ctx = ctx;
+        free_binding->port = port;
+        free_binding->any_addr = addr == NULL;
+        if (addr) free_binding->addr = *addr;
+        free_binding->fn = fn;
+    }
+    spin_unlock_irqrestore(&bindings_lock, flags);
+    return free_binding ? 0 : -1;
+}
+
+void udp_unbind(const ipv4_addr_t* addr, uint16_t port) {
+    uint32_t flags = spin_lock_irqsave(&bindings_lock);
+    for (int i = 0; i < UDP_MAX_BINDINGS; i++) {
+        if (udp_binding_matches(&bindings[i], addr, port)) {
+            bindings[i].fn = NULL;
+        }
+    }
+    spin_unlock_irqrestore(&bindings_lock, flags);
+}
+
+// An exact address binding wins over an any-address one
+int udp_handle_packet(const udp_packet_t* packet, uint32_t len,
+                      const ipv4_addr_t* src_ip, const ipv4_addr_t* dst_ip) {
+    if (len < sizeof(udp_packet_t)) return NET_INVALID;
+
+    uint32_t length = net_ntohs(packet->length);
+    if (length < sizeof(udp_packet_t) || length > len) return NET_INVALID;
+
+    uint16_t port = net_ntohs(packet->dst_port);
+    udp_binding_t* found = NULL;
+    uint32_t flags = spin_lock_irqsave(&bindings_lock);
+    for (int i = 0; i < UDP_MAX_BINDINGS; i++) {
+        if (dst_ip && udp_binding_matches(&bindings[i], dst_ip, port)) {
+            found = &bindings[i];
+            break;
+        }
+        if (!found && udp_binding_matches(&bindings[i], NULL, port)) {
+            found = &bindings[i];
+        }
+    }
+    // Called with the lock held, so udp_unbind waits out a receiver in progress
+    if (found) {
+        found->fn(found->ctx, packet->data, length - sizeof(udp_packet_t), src_ip,
+                  net_ntohs(packet->src_port));
+    }
+    spin_unlock_irqrestore(&bindings_lock, flags);
+    return NET_SUCCESS;
+}
+
+// Datagram without its IP header: no addresses to match or report
+void net_handle_udp(const void* packet, uint32_t len) {
+    udp_handle_packet((const udp_packet_t*)packet, len, NULL, NULL);
+}
+
+int udp_send(uint16_t src_port, const ipv4_addr_t* dst_ip, uint16_t dst_port,
+             const void* data, uint32_t len) {
+    if (!dst_ip || (len && !data) || len > ETH_MTU - sizeof(ipv4_header_t) - sizeof(udp_packet_t)) {
+        return NET_INVALID;
+    }
+
+    // Built where it goes out from: the headers below go in front of it
+    uint32_t total_len = sizeof(udp_packet_t) + len;
+    pbuf_t* p = pbuf_alloc(PBUF_HEADROOM);
+    if (!p) {
+        return NET_NO_MEMORY;
+    }
+    udp_packet_t* packet = (udp_packet_t*)pbuf_put(p, total_len);
+
+    packet->src_port = net_htons(src_port);
+    packet->dst_port = net_htons(dst_port);
+    packet->length = net_htons(total_len);
+    packet->checksum = 0;
+    if (len) memcpy(packet->data, data, len);
+
+    // The pseudo-header only: the card or the frame path sums the rest
+    packet->checksum = (uint16_t)~csum_fold(csum_pseudo(ipv4_get_our_address(), dst_ip,
+                                                        IP_PROTO_UDP, (uint16_t)total_len));
+
+    return ipv4_send_pbuf(dst_ip, IP_PROTO_UDP, p, __builtin_offsetof(udp_packet_t, checksum));
+}
+
+// Receive interrupt, bindings lock held: queue the datagram in place if
+// the frame can be held, else in a copy slot
+static void udp_socket_deliver(void* ctx, const void* data, uint32_t len,
+                               const ipv4_addr_t* src_ip, uint16_t src_port) {
+    udp_socket_t* sock = (udp_socket_t*)ctx;
+    if (sock->connected && (src_port != sock->remote_port ||
+                            (src_ip && memcmp(src_ip, &sock->remote_ip, sizeof(ipv4_addr_t)) != 0))) {
+        return;
+    }
+
+    uint32_t head = sock->head;
+    if (head - load_acquire(&sock->tail) >= UDP_SOCKET_QUEUE) {
+        sock->dropped++;
+        return;
+    }
+
+    udp_datagram_t* dgram = &sock->queue[head % UDP_SOCKET_QUEUE];
+    dgram->slot = -1;
+    dgram->hold = load_acquire(&sock->holding) < UDP_SOCKET_HOLDS ? (int8_t)rtl8139_rx_hold() : -1;
+    if (dgram->hold >= 0) {
+        dgram->data = data;
+        __sync_fetch_and_add(&sock->holding, 1);
+        sock->held++;
+    } else {
+        uint32_t free = load_acquire(&sock->copies_free);
+        if (!free || len > UDP_COPY_SIZE) {
+            sock->dropped++;
+            return;
+        }
+        int slot = __builtin_ctz(free);
+        __sync_fetch_and_and(&sock->copies_free, ~(1u << slot));
+        uint8_t* copy = sock->copies + slot * UDP_COPY_SIZE;
+        memcpy(copy, data, len);
+        dgram->data = copy;
+        dgram->slot = (int8_t)slot;
+        sock->copied++;
+    }
+    dgram->len = len;
+    if (src_ip) {
+        dgram->src_ip = *src_ip;
+    } else {
+        memset(&dgram->src_ip, 0, sizeof(ipv4_addr_t));
+    }
+    dgram->src_port = src_port;
+    dgram->rx_tsc = net_rx_timestamp();
+    sock->received++;
+
+    store_release(&sock->head, head + 1);
+    futex_wake(&sock->head, FUTEX_WAKE_ALL);
+    poll_wake(&sock->poll, POLL_IN);
+}
+
+udp_socket_t* udp_socket_create(void) {
+    udp_socket_t* sock = (udp_socket_t*)kmalloc(sizeof(udp_socket_t));
+    if (!sock) return NULL;
+
+    memset(sock, 0, sizeof(udp_socket_t));
+    sock->copies = (uint8_t*)kmalloc(UDP_COPY_SLOTS * UDP_COPY_SIZE);
+    if (!sock->copies) {
+        kfree(sock);
+        return NULL;
+    }
+    sock->copies_free = (1u << UDP_COPY_SLOTS) - 1;
+    poll_head_init(&sock->poll);
+    return sock;
+}
+
+// Datagrams handed out and not yet released must be released first
+void udp_socket_destroy(udp_socket_t* sock) {
+    if (!sock) return;
+
+    // Waits out a delivery in progress
+    if (sock->local_port) {
+        udp_unbind(sock->any_addr ? NULL : &sock->local_ip, sock->local_port);
+    }
+    udp_datagram_t dgram;
+    while (udp_socket_recv_zc(sock, &dgram, 0) == NET_SUCCESS) {
+        udp_socket_release(sock, &dgram);
+    }
+    while (sock->group_count) {
+        ipv4_leave_group(&sock->groups[--sock->group_count]);
+    }
+    poll_head_release(&sock->poll);
+    kfree(sock->copies);
+    kfree(sock);
+}
+
+int udp_socket_join(udp_socket_t* sock, const ipv4_addr_t* group) {
+    if (!sock || !group || !ipv4_is_multicast(group)) return NET_INVALID;
+
+    for (uint32_t i = 0; i < sock->group_count; i++) {
+        if (memcmp(&sock->groups[i], group, sizeof(ipv4_addr_t)) == 0) return NET_SUCCESS;
+    }
+    if (sock->group_count == UDP_SOCKET_GROUPS) return NET_NO_MEMORY;
+
+    int result = ipv4_join_group(group);
+    if (result == NET_SUCCESS) {
+        sock->groups[sock->group_count++] = *group;
+    }
+    return result;
+}
+
+int udp_socket_leave(udp_socket_t* sock, const ipv4_addr_t* group) {
+    if (!sock || !group) return NET_INVALID;
+
+    for (uint32_t i = 0; i < sock->group_count; i++) {
+        if (memcmp(&sock->groups[i], group, sizeof(ipv4_addr_t)) == 0) {
+            sock->groups[i] = sock->groups[--sock->group_count];
+            ipv4_leave_group(group);
+            return NET_SUCCESS;
+        }
+    }
+    return NET_INVALID;
+}
+
+int udp_socket_bind(udp_socket_t* sock, const ipv4_addr_t* addr, uint16_t port) {
+    static uint16_t next_ephemeral = UDP_EPHEMERAL_PORT;
+    if (!sock || sock->local_port) return NET_INVALID;
+
+    if (port) {
+        if (udp_bind(addr, port, udp_socket_deliver, sock) < 0) return NET_ERROR;
+    } else {
+        // Bindings are few: a free port turns up within a handful of tries
+        for (uint32_t tries = 0; ; tries++) {
+            if (tries == UDP_MAX_BINDINGS + 1) return NET_ERROR;
+            port = next_ephemeral++;
+            if (next_ephemeral == 0) next_ephemeral = UDP_EPHEMERAL_PORT;
+            if (udp_bind(addr, port, udp_socket_deliver, sock) == 0) break;
+        }
+    }
+
+    sock->any_addr = addr == NULL;
+    if (addr) sock->local_ip = *addr;
+    sock->local_port = port;
+    return NET_SUCCESS;
+}
+
+int udp_socket_connect(udp_socket_t* sock, const ipv4_addr_t* ip, uint16_t port) {
+    if (!sock || !ip) return NET_INVALID;
+
+    sock->remote_ip = *ip;
+    sock->remote_port = port;
+    sock->connected = true;
+    return NET_SUCCESS;
+}
+
+int udp_socket_send(udp_socket_t* sock, const void* data, uint32_t len) {
+    if (!sock || !sock->connected) return NET_INVALID;
+    if (!sock->local_port) {
+        int result = udp_socket_bind(sock, NULL, 0);
+        if (result != NET_SUCCESS) return result;
+    }
+    return udp_send(sock->local_port, &sock->remote_ip, sock->remote_port, data, len);
+}
+
+int udp_socket_recv_zc(udp_socket_t* sock, udp_datagram_t* out, uint32_t timeout_ms) {
+    if (!sock || !out) return NET_INVALID;
+
+    uint64_t deadline = timeout_ms == UDP_WAIT_FOREVER ? ~0ull :
+                        ktime_ns() + (uint64_t)timeout_ms * NSEC_PER_MSEC;
+    uint32_t tail = sock->tail;
+    for (;;) {
+        uint32_t head = load_acquire(&sock->head);
+        if (head != tail) break;
+
+        uint64_t now = ktime_ns();
+        if (now >= deadline) return NET_TIMEOUT;
+        uint32_t busy_us = sock->busy_poll_us;
+        if (timeout_ms < busy_us / 1000) busy_us = timeout_ms * 1000;
+        if (net_busy_wait(&sock->head, head, busy_us)) continue;
+        uint32_t wait_ms = timeout_ms == UDP_WAIT_FOREVER ? FUTEX_WAIT_FOREVER :
+                           (uint32_t)((deadline - now) >> 20) + 1;      // ms, near enough
+        futex_wait_or_yield(&sock->head, head, wait_ms);
+    }
+
+    *out = sock->queue[tail % UDP_SOCKET_QUEUE];
+    sock->last_rx_tsc = out->rx_tsc;
+    store_release(&sock->tail, tail + 1);
+    return NET_SUCCESS;
+}
+
+void udp_socket_release(udp_socket_t* sock, udp_datagram_t* dgram) {
+    if (!sock || !dgram) return;
+
+    if (dgram->hold >= 0) {
+        rtl8139_rx_release(dgram->hold);
+        __sync_fetch_and_sub(&sock->holding, 1);
+    }
+    if (dgram->slot >= 0) {
+        __sync_fetch_and_or(&sock->copies_free, 1u << dgram->slot);
+    }
+    dgram->hold = dgram->slot = -1;
+    dgram->data = NULL;
+}
+
+int udp_socket_recv(udp_socket_t* sock, void* buf, uint32_t len, uint32_t timeout_ms) {
+    if (!buf && len) return NET_INVALID;
+
+    udp_datagram_t dgram;
+    int result = udp_socket_recv_zc(sock, &dgram, timeout_ms);
+    if (result != NET_SUCCESS) return result;
+
+    if (len > dgram.len) len = dgram.len;
+    memcpy(buf, dgram.data, len);
+    udp_socket_release(sock, &dgram);
+    return (int)len;
+}
@@ -0,0 +1,117 @@
+#ifndef UDP_H
+#define UDP_H
+
+#include "net.h"
+
+// UDP receive demultiplexing. Datagrams are handed to the receiver bound
+// to their destination (group or any address, and port) as a pointer into
+// the packet buffer they arrived in, valid only during the call. Checksums
+// are not verified: multicast feeds commonly send none, and checking would
+// mean a second pass over the payload.
+//
+// A datagram socket is a receiver that queues what it is handed. Frames
+// the card delivered stay where they are in its receive ring: the socket
+// holds the frame, so the card cannot reuse that space, and queues a
+// pointer to the payload. The application takes the pointer, reads in
+// place and releases it; nothing is copied on the way. Holding out too
+// long stalls the card, which keeps everything after the oldest frame
+// still held. Frames that did not come from the card's ring, that it has
+// no hold left for, or past UDP_SOCKET_HOLDS the socket has out already,
+// are copied into one of a few slots of the socket: a reader that falls
+// behind cannot pin much of the ring on its own.
+#define UDP_MAX_BINDINGS        16
+#define UDP_SOCKET_QUEUE        32              // Datagrams waiting (power of 2)
+#define UDP_SOCKET_HOLDS        4               // Frames held in the ring at once
+#define UDP_COPY_SLOTS          8               // For datagrams that cannot be held
+#define UDP_COPY_SIZE           ETH_MTU
+#define UDP_SOCKET_GROUPS       4               // Groups one socket joins
+#define UDP_EPHEMERAL_PORT      49152           // First port picked for unbound senders
+#define UDP_WAIT_FOREVER        0xFFFFFFFF
+
+typedef struct {
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint16_t length;
+    uint16_t checksum;
+    uint8_t data[];
+} __attribute__((packed)) udp_packet_t;
+
+// Runs in the receive interrupt; must not sleep or bind
+typedef void (*udp_recv_fn_t)(void* ctx, const void* data, uint32_t len,
+                              const ipv4_addr_t* src_ip, uint16_t src_port);
+
+// Ports in host order; addr NULL for any destination address. -1 if the
+// pair is taken or the table full.
+int udp_bind(const ipv4_addr_t* addr, uint16_t port, udp_recv_fn_t fn, void* ctx);
+void udp_unbind(const ipv4_addr_t* addr, uint16_t port);
+
+// Datagram handed out by udp_socket_recv_zc, readable until released
+typedef struct {
+    const void* data;
+    uint32_t len;
+    ipv4_addr_t src_ip;
+    uint16_t src_port;
+    uint64_t rx_tsc;            // Taken off the card (net_rx_timestamp)
+    int8_t hold;                // Receive ring hold, or -1
+    int8_t slot;                // Copy slot, or -1
+} udp_datagram_t;
+
+typedef struct udp_socket {
+    ipv4_addr_t local_ip;
+    uint16_t local_port;        // 0 until bound
+    bool any_addr;
+    bool connected;             // Only the remote end is received from
+    ipv4_addr_t remote_ip;
+    uint16_t remote_port;
+    // Single producer (the receive interrupt), single consumer
+    udp_datagram_t queue[UDP_SOCKET_QUEUE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint8_t* copies;            // UDP_COPY_SLOTS of UDP_COPY_SIZE
+    volatile uint32_t copies_free;
+    volatile uint32_t holding;  // Queued or handed out in place
+    uint64_t last_rx_tsc;       // Of the datagram received last
+    uint32_t busy_poll_us;      // SO_BUSY_POLL
+    ipv4_addr_t groups[UDP_SOCKET_GROUPS];     // Joined for the socket, left with it
+    uint32_t group_count;
+    uint32_t received;
+    uint32_t held;              // Handed out in place
+    uint32_t copied;
+    uint32_t dropped;           // Queue or copy slots full, or too large
+    poll_head_t poll;           // POLL_IN per datagram queued
+} udp_socket_t;
+
+// Build the header and checksum and send; ports in host order
+int udp_send(uint16_t src_port, const ipv4_addr_t* dst_ip, uint16_t dst_port,
+             const void* data, uint32_t len);
+
+udp_socket_t* udp_socket_create(void);
+void udp_socket_destroy(udp_socket_t* sock);
+
+// addr NULL for any address; port 0 picks an ephemeral one
+int udp_socket_bind(udp_socket_t* sock, const ipv4_addr_t* addr, uint16_t port);
+int udp_socket_connect(udp_socket_t* sock, const ipv4_addr_t* ip, uint16_t port);
+
+// Group membership for the socket's lifetime: a socket bound to the any
+// address (or to the group) then gets the group's datagrams to its port.
+// NET_NO_MEMORY past UDP_SOCKET_GROUPS; leave NET_INVALID if not joined.
+int udp_socket_join(udp_socket_t* sock, const ipv4_addr_t* group);
+int udp_socket_leave(udp_socket_t* sock, const ipv4_addr_t* group);
+
+// To the connected remote end; binds an ephemeral port if unbound
+int udp_socket_send(udp_socket_t* sock, const void* data, uint32_t len);
+
+// Zero-copy receive: the next datagram in place, waiting up to timeout_ms
+// (0 to poll, UDP_WAIT_FOREVER), busy polling first for busy_poll_us.
+// Every datagram taken must be released. NET_SUCCESS, or NET_TIMEOUT.
+int udp_socket_recv_zc(udp_socket_t* sock, udp_datagram_t* out, uint32_t timeout_ms);
+void udp_socket_release(udp_socket_t* sock, udp_datagram_t* dgram);
+
+// Copying receive for callers that keep the data: its length, truncated to
+// len, or NET_TIMEOUT
+int udp_socket_recv(udp_socket_t* sock, void* buf, uint32_t len, uint32_t timeout_ms);
+
+int udp_handle_packet(const udp_packet_t* packet, uint32_t len,
+                      const ipv4_addr_t* src_ip, const ipv4_addr_t* dst_ip);
+
+#endif // UDP_H
@@ -0,0 +1,809 @@
+#include "virtio_net.h"
+#include "pbuf.h"
+#include "../mm/memory.h"
+#include "../mm/frame.h"
+#include "../arch/cpu.h"
+#include "../arch/smp.h"
+#include "../arch/interrupts.h"
+#include "../arch/tsc.h"
+#include "../proc/process.h"
+#include "../proc/scheduler.h"
+#include "../proc/futex.h"
+#include "../drivers/vga.h"
+
+#define VIRTIO_NET_HDR_SIZE     sizeof(virtio_net_hdr_t)
+#define VIRTIO_CTRL_TIMEOUT_NS  100000000       // 100 ms for a control command
+#define VIRTIO_CTRL_BUF_SIZE    128             // Command, its data and the ack
+
+static virtio_net_device_t virtio_dev;
+
+// Receive tasks take no argument: each claims the next queue as it starts
+static volatile uint32_t virtio_rx_next_task;
+
+// Control command: class, command, argument, then the device's ack
+static uint8_t virtio_ctrl_buf[VIRTIO_CTRL_BUF_SIZE] __attribute__((aligned(8)));
+static spinlock_t virtio_ctrl_lock = SPINLOCK_INIT;
+
+// Full fence: ring stores must be visible before the device's event index
+// is read, or a kick it needs can be skipped
+static inline void virtio_mb(void) {
+    __asm__ volatile ("lock; addl $0, (%%esp)" : : : "memory");
+}
+
+// The device wants an event for any index in [old, new) past 'event'
+static inline bool vring_need_event(uint16_t event, uint16_t new_idx, uint16_t old_idx) {
+    return (uint16_t)(new_idx - event - 1) < (uint16_t)(new_idx - old_idx);
+}
+
+// 64-bit registers as two 32-bit writes, low half first
+static void virtio_write64(volatile uint64_t* reg, uint32_t value) {
+    volatile uint32_t* half = (volatile uint32_t*)reg;
+    half[0] = value;
+    half[1] = 0;
+}
+
+// Where a capability's structure lives: its BAR plus offset, or NULL
+static volatile uint8_t* virtio_cap_address(const pci_device_t* pci, uint8_t cap) {
+    uint8_t bar = pci_read8(pci, cap + 4);
+    uint32_t base = pci_bar_address(pci, bar);
+    if (!base) return NULL;
+    return (volatile uint8_t*)(base + pci_read32(pci, cap + 8));
+}
+
+static int virtio_find_caps(virtio_net_device_t* dev) {
+    for (uint8_t cap = pci_find_capability(&dev->pci, PCI_CAP_ID_VENDOR, 0); cap;
+         cap = pci_find_capability(&dev->pci, PCI_CAP_ID_VENDOR, cap)) {
+        uint8_t type = pci_read8(&dev->pci, cap + 3);
+        volatile uint8_t* address = virtio_cap_address(&dev->pci, cap);
+        if (!address) continue;
+
+        // The first of each type is the preferred one
+        if (type == VIRTIO_PCI_CAP_COMMON && !dev->common) {
+            dev->common = (volatile virtio_pci_common_cfg_t*)address;
+        } else if (type == VIRTIO_PCI_CAP_NOTIFY && !dev->notify_base) {
+            dev->notify_base = address;
+            dev->notify_multiplier = pci_read32(&dev->pci, cap + 16);
+        } else if (type == VIRTIO_PCI_CAP_ISR && !dev->isr) {
+            dev->isr = address;
+        } else if (type == VIRTIO_PCI_CAP_DEVICE && !dev->config) {
+            dev->config = (volatile virtio_net_config_t*)address;
+        }
+    }
+    return dev->common && dev->notify_base && dev->isr ? 0 : -1;
+}
+
+// Rings for one queue in physically contiguous memory, and with
+// buffer_size a buffer for each descriptor
+static int virtqueue_setup(virtio_net_device_t* dev, virtqueue_t* vq, uint16_t index, uint32_t buffer_size) {
+    volatile virtio_pci_common_cfg_t* common = dev->common;
+    common->queue_select = index;
+    uint32_t size = common->queue_size;
+    if (size == 0) return -1;
+    if (size > VIRTIO_NET_QUEUE_SIZE) size = VIRTIO_NET_QUEUE_SIZE;
+    while (size & (size - 1)) size &= size - 1;     // Split rings: a power of 2
+    common->queue_size = (uint16_t)size;
+
+    uint32_t desc_bytes = size * sizeof(vring_desc_t);
+    uint32_t avail_bytes = sizeof(vring_avail_t) + size * sizeof(uint16_t) + sizeof(uint16_t);
+    uint32_t used_offset = (desc_bytes + avail_bytes + 3) & ~3u;
+    uint32_t used_bytes = sizeof(vring_used_t) + size * sizeof(vring_used_elem_t) + sizeof(uint16_t);
+    uint32_t ring = frame_alloc_pages(frame_order(used_offset + used_bytes));
+    if (!ring) return -1;
+    memset((void*)ring, 0, used_offset + used_bytes);
+
+    memset(vq, 0, sizeof(virtqueue_t));
+    vq->index = index;
+    vq->size = (uint16_t)size;
+    vq->desc = (volatile vring_desc_t*)ring;
+    vq->avail = (volatile vring_avail_t*)(ring + desc_bytes);
+    vq->used = (volatile vring_used_t*)(ring + used_offset);
+    vq->used_event = &vq->avail->ring[size];
+    vq->avail_event = (volatile uint16_t*)&vq->used->ring[size];
+    vq->notify = (volatile uint16_t*)(dev->notify_base + common->queue_notify_off * dev->notify_multiplier);
+    spin_lock_init(&vq->lock);
+
+    if (buffer_size) {
+        uint32_t buffers = frame_alloc_pages(frame_order(size * buffer_size));
+        if (!buffers) {
+            frame_free_pages(ring, frame_order(used_offset + used_bytes));
+            return -1;
+        }
+        vq->buffers = (uint8_t*)buffers;
+    }
+
+    virtio_write64(&common->queue_desc, (uint32_t)vq->desc);
+    virtio_write64(&common->queue_driver, (uint32_t)vq->avail);
+    virtio_write64(&common->queue_device, (uint32_t)vq->used);
+    common->queue_enable = 1;
+    return 0;
+}
+
+// Tell the device about new avail entries, unless it said it needs no word
+static void virtqueue_kick(virtqueue_t* vq) {
+    virtio_mb();
+    uint16_t old_idx = vq->kicked_idx;
+    uint16_t new_idx = vq->avail_idx;
+    vq->kicked_idx = new_idx;
+
+    bool needed = virtio_dev.event_idx ? vring_need_event(*vq->avail_event, new_idx, old_idx) :
+                                         !(vq->used->flags & VRING_USED_F_NO_NOTIFY);
+    if (needed) {
+        *vq->notify = vq->index;
+        vq->kicks++;
+    } else {
+        vq->kicks_saved++;
+    }
+}
+
+static inline void virtqueue_publish(virtqueue_t* vq, uint16_t desc) {
+    vq->avail->ring[vq->avail_idx % vq->size] = desc;
+    vq->avail_idx++;
+    compiler_barrier();
+    vq->avail->idx = vq->avail_idx;
+}
+
+// Every receive descriptor owns a buffer the device writes into
+static void virtio_rx_fill(virtqueue_t* vq) {
+    for (uint16_t i = 0; i < vq->size; i++) {
+        vq->desc[i].addr = (uint32_t)(vq->buffers + i * VIRTIO_NET_BUFFER_SIZE);
+        vq->desc[i].len = VIRTIO_NET_BUFFER_SIZE;
+        vq->desc[i].flags = VRING_DESC_F_WRITE;
+        virtqueue_publish(vq, i);
+    }
+}
+
+static void virtio_tx_prepare(virtqueue_t* vq) {
+    for (uint16_t i = 0; i < vq->size; i++) {
+        vq->desc[i].addr = (uint32_t)(vq->buffers + i * VIRTIO_NET_BUFFER_SIZE);
+        vq->free_list[i] = i;
+    }
+    vq->free_count = vq->size;
+
+    // Finished sends are reaped by later ones, never by interrupt
+    if (virtio_dev.event_idx) {
+        *vq->used_event = 0xFFFF;
+    } else {
+        vq->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+    }
+}
+
+// Receive interrupts off while a task walks the ring; the event index
+// needs nothing, an old one already passed
+static inline void virtio_rx_disarm(virtqueue_t* vq) {
+    if (!virtio_dev.event_idx) vq->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+}
+
+// Ask for an interrupt on the next frame; false if one came in meanwhile
+static bool virtio_rx_arm(virtqueue_t* vq) {
+    if (virtio_dev.event_idx) {
+        *vq->used_event = vq->last_used;
+    } else {
+        vq->avail->flags = 0;
+    }
+    virtio_mb();
+    return vq->used->idx == vq->last_used;
+}
+
+// With GUEST_CSUM a frame from the same host may come with its checksum
+// only begun (finished here, as the sender's card would have) or vouched
+// for; either way the stack need not check it
+static void virtio_rx_deliver(uint8_t* buffer, uint32_t len, uint64_t rx_tsc) {
+    virtio_net_hdr_t* hdr = (virtio_net_hdr_t*)buffer;
+    uint8_t* frame = buffer + VIRTIO_NET_HDR_SIZE;
+    if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+        uint32_t start = hdr->csum_start;
+        uint32_t offset = hdr->csum_offset;
+        if (start + offset + 2 > len) return;
+        uint16_t checksum = csum_fold(csum_partial(frame + start, len - start, 0));
+        *(uint16_t*)(frame + start + offset) = checksum;
+        net_receive(frame, len, rx_tsc, true);
+    } else {
+        net_receive(frame, len, rx_tsc, (hdr->flags & VIRTIO_NET_HDR_F_DATA_VALID) != 0);
+    }
+}
+
+// One pass over a receive ring, lock held and interrupts off: frames in
+// place to the stack, buffers straight back to the device, one kick.
+// Frames already in the used ring when the interrupt came (irq_used, from
+// its snapshot, or none) are stamped with its TSC, later ones as the pass
+// reaches them.
+static uint32_t virtio_rx_pass(virtqueue_t* vq, uint32_t budget, uint16_t irq_used, uint64_t irq_tsc) {
+    uint32_t frames = 0;
+    while (frames < budget && vq->used->idx != vq->last_used) {
+        compiler_barrier();
+        volatile vring_used_elem_t* elem = &vq->used->ring[vq->last_used % vq->size];
+        uint16_t id = (uint16_t)elem->id;
+        uint32_t len = elem->len;
+        if (id < vq->size && len > VIRTIO_NET_HDR_SIZE && len <= VIRTIO_NET_BUFFER_SIZE) {
+            uint64_t rx_tsc = (int16_t)(irq_used - vq->last_used) > 0 ? irq_tsc : rdtsc();
+            if (frames == 0) {
+                irq_note_delivery(vq->irq >= 0 ? (uint32_t)vq->irq : virtio_dev.pci.irq, irq_tsc);
+            }
+            virtio_rx_deliver(vq->buffers + id * VIRTIO_NET_BUFFER_SIZE, len - VIRTIO_NET_HDR_SIZE, rx_tsc);
+        }
+        vq->last_used++;
+        virtqueue_publish(vq, id % vq->size);
+        frames++;
+    }
+    if (frames) {
+        vq->packets += frames;
+        virtqueue_kick(vq);
+    }
+    return frames;
+}
+
+// Sleeps until the interrupt hands it work (or a timer tick when the line
+// is not wired), then passes until the ring is empty and re-armed
+static void virtio_rx_task(void) {
+    uint32_t queue = __sync_fetch_and_add(&virtio_rx_next_task, 1);
+    virtqueue_t* vq = &virtio_dev.rx[queue];
+    if (vq->irq >= 0) {
+        irq_set_affinity((uint32_t)vq->irq, this_cpu()->id);
+    }
+
+    for (;;) {
+        if (!load_acquire(&vq->work)) {
+            futex_wait(&vq->work, 0, virtio_dev.irq_wired ? FUTEX_WAIT_FOREVER : VIRTIO_NET_POLL_MS);
+        }
+        // The interrupt's snapshot is only written while work is clear
+        uint16_t irq_used = vq->last_used;
+        uint64_t irq_tsc = 0;
+        if (load_acquire(&vq->work)) {
+            irq_used = vq->irq_used;
+            irq_tsc = vq->irq_tsc;
+        }
+        store_release(&vq->work, 0);
+
+        bool armed;
+        do {
+            // With busy pollers about the ring is theirs once emptied
+            uint32_t flags = spin_lock_irqsave(&vq->lock);
+            virtio_rx_disarm(vq);
+            armed = virtio_rx_pass(vq, VIRTIO_NET_RX_BUDGET, irq_used, irq_tsc) < VIRTIO_NET_RX_BUDGET &&
+                    (virtio_dev.rx_busy || virtio_rx_arm(vq));
+            irq_used = vq->last_used;       // Later passes stamp as they go
+            irq_tsc = 0;
+            spin_unlock_irqrestore(&vq->lock, flags);
+            if (!armed) scheduler_yield();
+        } while (!armed);
+    }
+}
+
+// One command on the control queue, waited for: its class and number,
+// then len bytes for it; 0 once the device has carried it out
+static int virtio_ctrl_command(uint8_t class, uint8_t command, const void* data, uint32_t len) {
+    if (len + 3 > VIRTIO_CTRL_BUF_SIZE) return -1;
+
+    uint32_t flags = spin_lock_irqsave(&virtio_ctrl_lock);
+    virtqueue_t* vq = &virtio_dev.ctrl;
+    virtio_ctrl_buf[0] = class;
+    virtio_ctrl_buf[1] = command;
+    memcpy(&virtio_ctrl_buf[2], data, len);
+    virtio_ctrl_buf[2 + len] = 0xFF;
+
+    vq->desc[0].addr = (uint32_t)&virtio_ctrl_buf[0];
+    vq->desc[0].len = 2;
+    vq->desc[0].flags = VRING_DESC_F_NEXT;
+    vq->desc[0].next = 1;
+    vq->desc[1].addr = (uint32_t)&virtio_ctrl_buf[2];
+    vq->desc[1].len = len;
+    vq->desc[1].flags = VRING_DESC_F_NEXT;
+    vq->desc[1].next = 2;
+    vq->desc[2].addr = (uint32_t)&virtio_ctrl_buf[2 + len];
+    vq->desc[2].len = 1;
+    vq->desc[2].flags = VRING_DESC_F_WRITE;
+
+    uint16_t used = vq->used->idx;
+    virtqueue_publish(vq, 0);
+    virtio_mb();
+    *vq->notify = vq->index;
+
+    int result = -1;
+    uint64_t deadline = ktime_ns() + VIRTIO_CTRL_TIMEOUT_NS;
+    while (vq->used->idx == used && ktime_ns() <= deadline) {
+        cpu_relax();
+    }
+    if (vq->used->idx != used) {
+        vq->last_used = vq->used->idx;
+        result = virtio_ctrl_buf[2 + len] == VIRTIO_NET_OK ? 0 : -1;
+    }
+    spin_unlock_irqrestore(&virtio_ctrl_lock, flags);
+    return result;
+}
+
+// Multiqueue is off until the device is told how many pairs to use
+static int virtio_set_pairs(uint16_t pairs) {
+    return virtio_ctrl_command(VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_PAIRS_SET, &pairs, sizeof(pairs));
+}
+
+// Our address, broadcast and the groups in the table; past
+// VIRTIO_NET_MAX_MULTICAST every group
+int virtio_net_set_multicast(const mac_addr_t* macs, uint32_t count) {
+    if (!virtio_dev.initialized) return NET_ERROR;
+    if (!virtio_dev.ctrl_rx) return NET_SUCCESS;        // The device takes every group
+
+    uint8_t table[2 * sizeof(uint32_t) + VIRTIO_NET_MAX_MULTICAST * sizeof(mac_addr_t)];
+    uint8_t all = count > VIRTIO_NET_MAX_MULTICAST;
+    uint32_t entries = all ? 0 : count;
+    *(uint32_t*)&table[0] = 0;                          // No other unicast addresses
+    *(uint32_t*)&table[4] = entries;
+    memcpy(&table[8], macs, entries * sizeof(mac_addr_t));
+
+    if (virtio_ctrl_command(VIRTIO_NET_CTRL_MAC, VIRTIO_NET_CTRL_MAC_TABLE_SET, table,
+                            8 + entries * sizeof(mac_addr_t)) != 0 ||
+        virtio_ctrl_command(VIRTIO_NET_CTRL_RX, VIRTIO_NET_CTRL_RX_ALLMULTI, &all, 1) != 0) {
+        return NET_ERROR;
+    }
+    return NET_SUCCESS;
+}
+
+static uint64_t virtio_device_features(volatile virtio_pci_common_cfg_t* common) {
+    common->device_feature_select = 0;
+    uint64_t features = common->device_feature;
+    common->device_feature_select = 1;
+    return features | ((uint64_t)common->device_feature << 32);
+}
+
+static void virtio_driver_features(volatile virtio_pci_common_cfg_t* common, uint64_t features) {
+    common->driver_feature_select = 0;
+    common->driver_feature = (uint32_t)features;
+    common->driver_feature_select = 1;
+    common->driver_feature = (uint32_t)(features >> 32);
+}
+
+static int virtio_net_fail(const char* why) {
+    if (virtio_dev.common) virtio_dev.common->device_status = VIRTIO_STATUS_FAILED;
+    vga_write_string("virtio-net: ");
+    vga_write_string(why);
+    vga_write_string("\n");
+    return NET_ERROR;
+}
+
+static void virtio_rx_signal(virtqueue_t* vq) {
+    if (vq->used->idx != vq->last_used && !vq->work) {
+        // What had arrived by now, and when the handler was entered: the
+        // frames' receive stamp
+        vq->irq_tsc = irq_entry_tsc();
+        vq->irq_used = vq->used->idx;
+        store_release(&vq->work, 1);
+        futex_wake(&vq->work, 1);
+    }
+}
+
+// A receive queue's own vector: no status to read, no other queue to look at
+static void virtio_rx_msix_handler(void* ctx) {
+    virtio_dev.interrupts++;
+    virtio_rx_signal((virtqueue_t*)ctx);
+}
+
+// Entry q of the table for receive queue q, first aimed at the feed CPU.
+// The device refuses a vector by reading back VIRTIO_MSI_NO_VECTOR; then
+// everything is undone and the line is used.
+static bool virtio_setup_msix(virtio_net_device_t* dev) {
+    if (pci_msix_count(&dev->pci) < dev->pairs) return false;
+
+    volatile virtio_pci_common_cfg_t* common = dev->common;
+    uint32_t q;
+    pci_msix_enable(&dev->pci, true);
+    common->msix_config = VIRTIO_MSI_NO_VECTOR;
+    for (q = 0; q < dev->pairs; q++) {
+        virtqueue_t* vq = &dev->rx[q];
+        vq->irq = irq_alloc_msix(&dev->pci, q, irq_feed_cpu(), virtio_rx_msix_handler, vq);
+        if (vq->irq < 0) break;
+        common->queue_select = vq->index;
+        common->queue_msix_vector = (uint16_t)q;
+        if (common->queue_msix_vector != q) break;
+    }
+    if (q == dev->pairs) return true;
+
+    for (uint32_t i = 0; i <= q && i < dev->pairs; i++) {
+        virtqueue_t* vq = &dev->rx[i];
+        common->queue_select = vq->index;
+        common->queue_msix_vector = VIRTIO_MSI_NO_VECTOR;
+        if (vq->irq >= 0) irq_free((uint32_t)vq->irq);
+        vq->irq = -1;
+    }
+    pci_msix_enable(&dev->pci, false);
+    return false;
+}
+
+int virtio_net_init(void) {
+    memset(&virtio_dev, 0, sizeof(virtio_dev));
+    if (pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_PCI_NET_MODERN, &virtio_dev.pci) != 0 &&
+        pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_PCI_NET_LEGACY, &virtio_dev.pci) != 0) {
+        return NET_ERROR;
+    }
+
+    vga_write_string("Initializing virtio-net controller...\n");
+    pci_enable_device(&virtio_dev.pci);
+    if (virtio_find_caps(&virtio_dev) != 0) {
+        return virtio_net_fail("no modern interface");
+    }
+
+    // Reset, then the handshake of the virtio spec, section 3.1
+    volatile virtio_pci_common_cfg_t* common = virtio_dev.common;
+    common->device_status = 0;
+    while (common->device_status != 0) {
+        cpu_relax();
+    }
+    common->device_status = VIRTIO_STATUS_ACKNOWLEDGE;
+    common->device_status = VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER;
+
+    uint64_t offered = virtio_device_features(common);
+    uint64_t wanted = (1ull << VIRTIO_F_VERSION_1) | (1ull << VIRTIO_NET_F_MAC) |
+                      (1ull << VIRTIO_F_RING_EVENT_IDX) | (1ull << VIRTIO_NET_F_CTRL_VQ) |
+                      (1ull << VIRTIO_NET_F_MQ) | (1ull << VIRTIO_NET_F_CSUM) |
+                      (1ull << VIRTIO_NET_F_GUEST_CSUM) | (1ull << VIRTIO_NET_F_CTRL_RX);
+    virtio_dev.features = offered & wanted;
+    if (!(virtio_dev.features & (1ull << VIRTIO_NET_F_CTRL_VQ))) {
+        virtio_dev.features &= ~((1ull << VIRTIO_NET_F_MQ) | (1ull << VIRTIO_NET_F_CTRL_RX));
+    }
+    if (!(virtio_dev.features & (1ull << VIRTIO_F_VERSION_1))) {
+        return virtio_net_fail("device is legacy only");
+    }
+    virtio_driver_features(common, virtio_dev.features);
+    common->device_status |= VIRTIO_STATUS_FEATURES_OK;
+    if (!(common->device_status & VIRTIO_STATUS_FEATURES_OK)) {
+        return virtio_net_fail("features refused");
+    }
+    virtio_dev.event_idx = (virtio_dev.features & (1ull << VIRTIO_F_RING_EVENT_IDX)) != 0;
+
+    // As many pairs as the device and the CPUs allow
+    uint32_t device_pairs = 1;
+    if ((virtio_dev.features & (1ull << VIRTIO_NET_F_MQ)) && virtio_dev.config) {
+        device_pairs = virtio_dev.config->max_virtqueue_pairs;
+        if (device_pairs == 0) device_pairs = 1;
+    }
+    uint32_t pairs = device_pairs;
+    if (pairs > VIRTIO_NET_MAX_PAIRS) pairs = VIRTIO_NET_MAX_PAIRS;
+    if (pairs > smp_cpu_count()) pairs = smp_cpu_count();
+    if (pairs == 0) pairs = 1;
+
+    for (uint32_t q = 0; q < pairs; q++) {
+        if (virtqueue_setup(&virtio_dev, &virtio_dev.rx[q], (uint16_t)(2 * q), VIRTIO_NET_BUFFER_SIZE) != 0 ||
+            virtqueue_setup(&virtio_dev, &virtio_dev.tx[q], (uint16_t)(2 * q + 1), VIRTIO_NET_BUFFER_SIZE) != 0) {
+            if (q == 0) return virtio_net_fail("no memory for the queues");
+            pairs = q;
+            break;
+        }
+        virtio_rx_fill(&virtio_dev.rx[q]);
+        virtio_tx_prepare(&virtio_dev.tx[q]);
+    }
+    bool have_ctrl = (virtio_dev.features & (1ull << VIRTIO_NET_F_CTRL_VQ)) &&
+                     virtqueue_setup(&virtio_dev, &virtio_dev.ctrl, (uint16_t)(2 * device_pairs), 0) == 0;
+
+    if (virtio_dev.features & (1ull << VIRTIO_NET_F_MAC)) {
+        for (int i = 0; i < 6; i++) {
+            virtio_dev.mac_addr.addr[i] = virtio_dev.config->mac[i];
+        }
+    }
+
+    common->device_status |= VIRTIO_STATUS_DRIVER_OK;
+
+    // One pair until the device agrees to more
+    virtio_dev.pairs = 1;
+    if (pairs > 1 && have_ctrl && virtio_set_pairs((uint16_t)pairs) == 0) {
+        virtio_dev.pairs = pairs;
+    }
+
+    // The device starts promiscuous: from here on only our address,
+    // broadcast and the groups joined (none yet)
+    uint8_t off = 0;
+    virtio_dev.ctrl_rx = have_ctrl && (virtio_dev.features & (1ull << VIRTIO_NET_F_CTRL_RX)) &&
+                         virtio_ctrl_command(VIRTIO_NET_CTRL_RX, VIRTIO_NET_CTRL_RX_PROMISC, &off, 1) == 0;
+
+    // Buffers were posted before the device was live
+    for (uint32_t q = 0; q < virtio_dev.pairs; q++) {
+        virtio_rx_arm(&virtio_dev.rx[q]);
+        virtqueue_kick(&virtio_dev.rx[q]);
+    }
+
+    // Vectors before the tasks, which move theirs as they start
+    for (uint32_t q = 0; q < VIRTIO_NET_MAX_PAIRS; q++) {
+        virtio_dev.rx[q].irq = -1;
+    }
+    virtio_dev.msix = virtio_setup_msix(&virtio_dev);
+    virtio_dev.irq_wired = virtio_dev.msix ||
+                           (virtio_dev.pci.irq != 0xFF && interrupts_route_pci(virtio_dev.pci.irq, irq_feed_cpu()) == 0);
+
+    // Receive tasks, each on a CPU of its own where there are enough,
+    // from the feed CPU on
+    virtio_rx_next_task = 0;
+    for (uint32_t q = 0; q < virtio_dev.pairs; q++) {
+        process_t* task = process_create("virtio_rx", virtio_rx_task, PRIORITY_HIGH);
+        if (!task) {
+            virtio_dev.pairs = q;
+            break;
+        }
+        scheduler_set_affinity(task, (int32_t)((irq_feed_cpu() + q) % smp_cpu_count()));
+        scheduler_add_process(task);
+    }
+    if (virtio_dev.pairs == 0) {
+        return virtio_net_fail("no receive task");
+    }
+
+    virtio_dev.iface.mac_addr = virtio_dev.mac_addr;
+    strcpy(virtio_dev.iface.name, "virtio0");
+    virtio_dev.iface.mtu = ETH_MTU;
+    virtio_dev.iface.send_packet = virtio_net_send_packet;
+    virtio_dev.iface.recv_packet = virtio_net_recv_packet;
+    virtio_dev.iface.send_packet_csum = virtio_net_send_packet_csum;
+    virtio_dev.iface.send_pbuf = virtio_net_send_pbuf;
+    virtio_dev.iface.rx_busy = virtio_net_rx_busy;
+    virtio_dev.iface.rx_poll = virtio_net_rx_poll;
+    virtio_dev.iface.set_multicast = virtio_net_set_multicast;
+    if (virtio_dev.features & (1ull << VIRTIO_NET_F_CSUM)) {
+        virtio_dev.iface.offloads |= NET_OFFLOAD_TX_CSUM;
+    }
+    if (virtio_dev.features & (1ull << VIRTIO_NET_F_GUEST_CSUM)) {
+        virtio_dev.iface.offloads |= NET_OFFLOAD_RX_CSUM;
+    }
+    virtio_dev.initialized = 1;
+    net_register_interface(&virtio_dev.iface);
+
+    vga_write_string("virtio-net MAC address: ");
+    vga_write_string(net_mac_to_string(&virtio_dev.mac_addr));
+    vga_write_string(", ");
+    print_dec(virtio_dev.pairs);
+    vga_write_string(" queue pairs\n");
+    return NET_SUCCESS;
+}
+
+bool virtio_net_present(void) {
+    return virtio_dev.initialized != 0;
+}
+
+// The header says whether the device finishes a checksum
+// The sending CPU's queue, locked with interrupts off and its finished
+// descriptors taken back; the lock only matters with fewer pairs than CPUs
+static virtqueue_t* virtio_tx_lock(uint32_t* flags) {
+    *flags = irq_save();
+    virtqueue_t* vq = &virtio_dev.tx[this_cpu()->id % virtio_dev.pairs];
+    spin_lock(&vq->lock);
+
+    while (vq->used->idx != vq->last_used) {
+        compiler_barrier();
+        uint16_t id = (uint16_t)vq->used->ring[vq->last_used % vq->size].id;
+        if (id < vq->size) {
+            if (vq->pbufs[id]) {
+                // Sent from in place: the descriptor gets its own buffer back
+                pbuf_free(vq->pbufs[id]);
+                vq->pbufs[id] = NULL;
+                vq->desc[id].addr = (uint32_t)(vq->buffers + id * VIRTIO_NET_BUFFER_SIZE);
+            }
+            vq->free_list[vq->free_count++] = id;
+        }
+        vq->last_used++;
+    }
+    return vq;
+}
+
+static void virtio_tx_unlock(virtqueue_t* vq, uint32_t flags) {
+    spin_unlock(&vq->lock);
+    irq_restore(flags);
+}
+
+static void virtio_tx_header(virtio_net_hdr_t* hdr, uint16_t csum_start, uint16_t csum_offset, bool partial) {
+    memset(hdr, 0, VIRTIO_NET_HDR_SIZE);
+    if (partial) {
+        hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr->csum_start = csum_start;
+        hdr->csum_offset = csum_offset;
+    }
+}
+
+static int virtio_net_send(const void* data, uint32_t len, uint16_t csum_start, uint16_t csum_offset,
+                           bool partial) {
+    if (!virtio_dev.initialized || !data || len > ETH_MTU + ETH_HEADER_SIZE) {
+        return NET_ERROR;
+    }
+
+    uint32_t flags;
+    virtqueue_t* vq = virtio_tx_lock(&flags);
+    int result = NET_ERROR;
+    if (vq->free_count == 0) {
+        vq->full++;
+    } else {
+        uint16_t id = vq->free_list[--vq->free_count];
+        uint8_t* buffer = vq->buffers + id * VIRTIO_NET_BUFFER_SIZE;
+        virtio_tx_header((virtio_net_hdr_t*)buffer, csum_start, csum_offset, partial);
+        memcpy(buffer + VIRTIO_NET_HDR_SIZE, data, len);
+        vq->desc[id].len = VIRTIO_NET_HDR_SIZE + len;
+        vq->desc[id].flags = 0;
+        virtqueue_publish(vq, id);
+        vq->packets++;
+        virtqueue_kick(vq);
+        result = NET_SUCCESS;
+    }
+    virtio_tx_unlock(vq, flags);
+    return result;
+}
+
+// The header goes in the pbuf's headroom and the descriptor points at the
+// pbuf, kept until the device hands the descriptor back
+int virtio_net_send_pbuf(pbuf_t* p, uint16_t csum_start, uint16_t csum_offset) {
+    if (!virtio_dev.initialized || p->len > ETH_MTU + ETH_HEADER_SIZE) {
+        pbuf_free(p);
+        return NET_ERROR;
+    }
+    bool partial = csum_offset != PBUF_CSUM_NONE;
+    virtio_net_hdr_t* hdr = (virtio_net_hdr_t*)pbuf_push(p, VIRTIO_NET_HDR_SIZE);
+    if (!hdr) {
+        int result = virtio_net_send(p->data, p->len, csum_start, csum_offset, partial);
+        pbuf_free(p);
+        return result;
+    }
+    virtio_tx_header(hdr, csum_start, csum_offset, partial);
+
+    uint32_t flags;
+    virtqueue_t* vq = virtio_tx_lock(&flags);
+    int result = NET_ERROR;
+    if (vq->free_count == 0) {
+        vq->full++;
+    } else {
+        uint16_t id = vq->free_list[--vq->free_count];
+        vq->pbufs[id] = p;
+        vq->desc[id].addr = (uint32_t)hdr;
+        vq->desc[id].len = p->len;
+        vq->desc[id].flags = 0;
+        virtqueue_publish(vq, id);
+        vq->packets++;
+        virtqueue_kick(vq);
+        p = NULL;
+        result = NET_SUCCESS;
+    }
+    virtio_tx_unlock(vq, flags);
+    if (p) pbuf_free(p);
+    return result;
+}
+
+int virtio_net_send_packet(const void* data, uint32_t len) {
+    return virtio_net_send(data, len, 0, 0, false);
+}
+
+int virtio_net_send_packet_csum(const void* data, uint32_t len, uint16_t csum_start, uint16_t csum_offset) {
+    return virtio_net_send(data, len, csum_start, csum_offset, true);
+}
+
+int virtio_net_recv_packet(void* buffer, uint32_t len) {
+    if (!virtio_dev.initialized) {
+        return NET_ERROR;
+    }
+
+    virtqueue_t* vq = &virtio_dev.rx[0];
+    uint32_t flags = spin_lock_irqsave(&vq->lock);
+    int result = 0;
+    if (vq->used->idx != vq->last_used) {
+        compiler_barrier();
+        volatile vring_used_elem_t* elem = &vq->used->ring[vq->last_used % vq->size];
+        uint16_t id = (uint16_t)(elem->id % vq->size);
+        uint32_t frame_len = elem->len > VIRTIO_NET_HDR_SIZE ? elem->len - VIRTIO_NET_HDR_SIZE : 0;
+        if (frame_len > len) {
+            result = NET_ERROR;         // Buffer too small; the frame stays
+        } else {
+            memcpy(buffer, vq->buffers + id * VIRTIO_NET_BUFFER_SIZE + VIRTIO_NET_HDR_SIZE, frame_len);
+            vq->last_used++;
+            virtqueue_publish(vq, id);
+            virtqueue_kick(vq);
+            result = (int)frame_len;
+        }
+    }
+    spin_unlock_irqrestore(&vq->lock, flags);
+    return result;
+}
+
+void virtio_net_rx_busy(bool on) {
+    if (!virtio_dev.initialized) return;
+
+    if (on) {
+        if (__sync_fetch_and_add(&virtio_dev.rx_busy, 1) != 0) return;
+        for (uint32_t q = 0; q < virtio_dev.pairs; q++) {
+            virtqueue_t* vq = &virtio_dev.rx[q];
+            uint32_t flags = spin_lock_irqsave(&vq->lock);
+            virtio_rx_disarm(vq);
+            spin_unlock_irqrestore(&vq->lock, flags);
+        }
+        return;
+    }
+
+    // A queue that filled since the last pass goes to its task
+    if (__sync_sub_and_fetch(&virtio_dev.rx_busy, 1) != 0) return;
+    for (uint32_t q = 0; q < virtio_dev.pairs; q++) {
+        virtqueue_t* vq = &virtio_dev.rx[q];
+        uint32_t flags = spin_lock_irqsave(&vq->lock);
+        bool armed = virtio_dev.rx_busy || virtio_rx_arm(vq);
+        spin_unlock_irqrestore(&vq->lock, flags);
+        if (!armed && !vq->work) {
+            store_release(&vq->work, 1);
+            futex_wake(&vq->work, 1);
+        }
+    }
+}
+
+// Every receive queue, skipping those in a pass elsewhere; frames stamped
+// as they are reached
+uint32_t virtio_net_rx_poll(uint32_t budget) {
+    uint32_t frames = 0;
+    for (uint32_t q = 0; q < virtio_dev.pairs && frames < budget; q++) {
+        virtqueue_t* vq = &virtio_dev.rx[q];
+        if (vq->used->idx == vq->last_used) continue;
+
+        uint32_t flags = irq_save();
+        if (spin_trylock(&vq->lock)) {
+            uint32_t n = virtio_rx_pass(vq, budget - frames, vq->last_used, 0);
+            if (n) vq->busy_passes++;
+            frames += n;
+            spin_unlock(&vq->lock);
+        }
+        irq_restore(flags);
+    }
+    return frames;
+}
+
+void virtio_net_interrupt_handler(void) {
+    if (!virtio_dev.initialized || virtio_dev.msix) return;
+
+    // Reading the status clears it and drops the line
+    uint8_t isr = *virtio_dev.isr;
+    if (!(isr & 1)) return;
+    virtio_dev.interrupts++;
+
+    for (uint32_t q = 0; q < virtio_dev.pairs; q++) {
+        virtio_rx_signal(&virtio_dev.rx[q]);
+    }
+}
+
+static void virtio_print_queue(const char* name, uint32_t q, const virtqueue_t* vq) {
+    vga_write_string(name);
+    print_dec(q);
+    vga_write_string(": ");
+    print_dec(vq->packets);
+    vga_write_string(" frames, ");
+    print_dec(vq->kicks);
+    vga_write_string(" kicks, ");
+    print_dec(vq->kicks_saved);
+    vga_write_string(" suppressed");
+}
+
+void virtio_net_print_info(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== virtio-net ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    if (!virtio_dev.initialized) {
+        vga_write_string("No device\n");
+        return;
+    }
+
+    print_dec(virtio_dev.pairs);
+    vga_write_string(" queue pairs of ");
+    print_dec(virtio_dev.rx[0].size);
+    vga_write_string(virtio_dev.event_idx ? ", event index" : ", flag");
+    vga_write_string(" notification suppression\nInterrupts: ");
+    print_dec(virtio_dev.interrupts);
+    if (virtio_dev.msix) {
+        vga_write_string(" by MSI-X, a vector per receive queue");
+    } else if (virtio_dev.irq_wired) {
+        vga_write_string(" on IRQ ");
+        print_dec(virtio_dev.pci.irq);
+    } else {
+        vga_write_string(" (line not wired, polling every ");
+        print_dec(VIRTIO_NET_POLL_MS);
+        vga_write_string(" ms)");
+    }
+    vga_write_string("\nChecksum offload:");
+    vga_write_string(virtio_dev.iface.offloads & NET_OFFLOAD_TX_CSUM ? " tx" : "");
+    vga_write_string(virtio_dev.iface.offloads & NET_OFFLOAD_RX_CSUM ? " rx" : "");
+    vga_write_string(virtio_dev.iface.offloads ? "\n" : " none\n");
+    vga_write_string(virtio_dev.ctrl_rx ? "Receive filter: our address, broadcast, groups joined\n" :
+                                          "Receive filter: none (device takes everything)\n");
+    for (uint32_t q = 0; q < virtio_dev.pairs; q++) {
+        virtio_print_queue("rx", q, &virtio_dev.rx[q]);
+        vga_write_string(", ");
+        print_dec(virtio_dev.rx[q].busy_passes);
+        vga_write_string(" busy poll passes\n");
+        virtio_print_queue("tx", q, &virtio_dev.tx[q]);
+        vga_write_string(", ");
+        print_dec(virtio_dev.tx[q].full);
+        vga_write_string(" refused full\n");
+    }
+}
@@ -0,0 +1,224 @@
+#ifndef VIRTIO_NET_H
+#define VIRTIO_NET_H
+
+#include "../types.h"
+#include "net.h"
+#include "../drivers/pci.h"
+#include "../arch/spinlock.h"
+
+// virtio-net over modern (virtio 1.0) PCI with split virtqueues. Each
+// queue pair has its own receive and transmit ring; a send takes the
+// transmit queue of the CPU it runs on, so CPUs sending at once do not
+// share a ring, and each receive queue is walked by a polling task pinned
+// to a CPU of its own. The device spreads flows over the receive queues.
+//
+// Notifications are kept to a minimum, each one being an exit to the
+// hypervisor. With event indices the driver tells the device when it next
+// wants an interrupt and the device tells the driver when it next needs a
+// kick: transmit never asks for an interrupt (finished buffers are reaped
+// by the next send), and receive asks for one only when its task has
+// emptied the ring and is about to sleep. A pass adds its recycled buffers
+// and kicks once.
+//
+// With MSI-X each receive queue has a vector of its own, delivered to the
+// CPU its task runs on (the task moves it there when it starts), so the
+// interrupt wakes a task on the same CPU and no other queue is looked at.
+// Transmit and configuration changes get no vector. Without MSI-X there
+// is the one legacy line, shared by all queues and sent to the feed CPU,
+// which wakes whichever tasks have work; a line that cannot be routed
+// leaves the tasks polling on a timer.
+//
+// While busy pollers spin (net_busy_wait) no receive queue is re-armed:
+// the pollers take passes over every queue, each pass under the queue's
+// lock, and the tasks sleep once they have emptied their ring. The last
+// poller out arms the queues again, waking a task for any that filled.
+#define VIRTIO_PCI_VENDOR           0x1AF4
+#define VIRTIO_PCI_NET_MODERN       0x1041
+#define VIRTIO_PCI_NET_LEGACY       0x1000      // Transitional; modern caps too
+
+// virtio_pci_cap types
+#define VIRTIO_PCI_CAP_COMMON       1
+#define VIRTIO_PCI_CAP_NOTIFY       2
+#define VIRTIO_PCI_CAP_ISR          3
+#define VIRTIO_PCI_CAP_DEVICE       4
+
+// Device status
+#define VIRTIO_STATUS_ACKNOWLEDGE   0x01
+#define VIRTIO_STATUS_DRIVER        0x02
+#define VIRTIO_STATUS_DRIVER_OK     0x04
+#define VIRTIO_STATUS_FEATURES_OK   0x08
+#define VIRTIO_STATUS_FAILED        0x80
+
+// Feature bits
+#define VIRTIO_NET_F_CSUM           0       // Device checksums partial frames we send
+#define VIRTIO_NET_F_GUEST_CSUM     1       // Frames we get may be partial or vouched for
+#define VIRTIO_NET_F_MAC            5
+#define VIRTIO_NET_F_CTRL_VQ        17
+#define VIRTIO_NET_F_CTRL_RX        18      // Receive filtering commands
+#define VIRTIO_NET_F_MQ             22
+#define VIRTIO_F_RING_EVENT_IDX     29
+#define VIRTIO_F_VERSION_1          32
+
+// Split virtqueue flags
+#define VRING_DESC_F_NEXT           1
+#define VRING_DESC_F_WRITE          2       // Device writes the buffer
+#define VRING_AVAIL_F_NO_INTERRUPT  1
+#define VRING_USED_F_NO_NOTIFY      1
+
+#define VIRTIO_NET_CTRL_RX          0
+#define VIRTIO_NET_CTRL_RX_PROMISC  0
+#define VIRTIO_NET_CTRL_RX_ALLMULTI 1
+#define VIRTIO_NET_CTRL_MAC         1
+#define VIRTIO_NET_CTRL_MAC_TABLE_SET 0
+#define VIRTIO_NET_CTRL_MQ          4
+#define VIRTIO_NET_CTRL_MQ_PAIRS_SET 0
+#define VIRTIO_NET_OK               0
+
+#define VIRTIO_NET_MAX_PAIRS        4
+#define VIRTIO_NET_QUEUE_SIZE       128     // Most entries per ring (power of 2)
+#define VIRTIO_NET_BUFFER_SIZE      1536    // Header and a full frame
+#define VIRTIO_NET_RX_BUDGET        32      // Frames per receive pass
+#define VIRTIO_NET_POLL_MS          1       // Timer poll without an interrupt
+#define VIRTIO_NET_MAX_MULTICAST    16      // Exact group filter entries; past it every group
+#define VIRTIO_MSI_NO_VECTOR        0xFFFF
+
+typedef struct {
+    uint32_t device_feature_select;
+    uint32_t device_feature;
+    uint32_t driver_feature_select;
+    uint32_t driver_feature;
+    uint16_t msix_config;
+    uint16_t num_queues;
+    uint8_t device_status;
+    uint8_t config_generation;
+    uint16_t queue_select;
+    uint16_t queue_size;
+    uint16_t queue_msix_vector;
+    uint16_t queue_enable;
+    uint16_t queue_notify_off;
+    uint64_t queue_desc;
+    uint64_t queue_driver;
+    uint64_t queue_device;
+} __attribute__((packed)) virtio_pci_common_cfg_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint16_t status;
+    uint16_t max_virtqueue_pairs;
+    uint16_t mtu;
+} __attribute__((packed)) virtio_net_config_t;
+
+// virtio_net_hdr_t.flags
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1       // Sum from csum_start into csum_start + csum_offset
+#define VIRTIO_NET_HDR_F_DATA_VALID 2       // Checksums checked by the device
+
+// Ahead of every frame either way; num_buffers is always there under
+// VERSION_1
+typedef struct {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+    uint16_t num_buffers;
+} __attribute__((packed)) virtio_net_hdr_t;
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) vring_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];            // Then used_event: interrupt once used idx passes it
+} __attribute__((packed)) vring_avail_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} __attribute__((packed)) vring_used_elem_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    vring_used_elem_t ring[];   // Then avail_event: kick once avail idx passes it
+} __attribute__((packed)) vring_used_t;
+
+typedef struct {
+    uint16_t index;             // Queue number on the device
+    uint16_t size;
+    volatile vring_desc_t* desc;
+    volatile vring_avail_t* avail;
+    volatile vring_used_t* used;
+    volatile uint16_t* used_event;  // After the avail ring
+    volatile uint16_t* avail_event; // After the used ring
+    volatile uint16_t* notify;
+    uint8_t* buffers;           // One per descriptor
+    uint16_t avail_idx;         // Next avail slot ours to fill
+    uint16_t last_used;         // Next used entry to take
+    uint16_t kicked_idx;        // avail_idx at the last notification check
+    uint16_t free_count;        // Transmit: descriptors not in flight
+    uint16_t free_list[VIRTIO_NET_QUEUE_SIZE];
+    struct pbuf* pbufs[VIRTIO_NET_QUEUE_SIZE];  // Transmit: sent from in place, freed when reaped
+    spinlock_t lock;
+    volatile uint32_t work;     // Receive: interrupt seen, the task has it
+    uint64_t irq_tsc;           // Receive: the interrupt's TSC, and the used
+    uint16_t irq_used;          // index then (written while work is clear)
+    int irq;                    // Receive: its MSI-X IRQ, -1 for the line
+    uint32_t packets;
+    uint32_t busy_passes;       // Receive: by busy pollers, that found frames
+    uint32_t kicks;
+    uint32_t kicks_saved;       // Notifications the device said it did not need
+    uint32_t full;              // Transmit: ring full, frame refused
+} virtqueue_t;
+
+typedef struct {
+    pci_device_t pci;
+    volatile virtio_pci_common_cfg_t* common;
+    volatile uint8_t* notify_base;
+    uint32_t notify_multiplier;
+    volatile uint8_t* isr;
+    volatile virtio_net_config_t* config;
+    uint64_t features;
+    bool event_idx;
+    uint32_t pairs;             // Queue pairs in use
+    virtqueue_t rx[VIRTIO_NET_MAX_PAIRS];
+    virtqueue_t tx[VIRTIO_NET_MAX_PAIRS];
+    virtqueue_t ctrl;
+    bool irq_wired;             // Interrupts arrive, by MSI-X or the line
+    bool msix;                  // Per receive queue vectors
+    bool ctrl_rx;               // Receive filter ours to program, promiscuous off
+    volatile uint32_t rx_busy;  // Busy pollers spinning: receive queues left unarmed
+    uint32_t interrupts;
+    mac_addr_t mac_addr;
+    net_interface_t iface;
+    int initialized;
+} virtio_net_device_t;
+
+// Probe and bring the device up, registered as the network interface;
+// needs the scheduler and every CPU online. NET_SUCCESS, or NET_ERROR
+// when there is no device or it will not take our features.
+int virtio_net_init(void);
+bool virtio_net_present(void);
+
+// net_interface_t hooks: a frame with its Ethernet header (send_packet_csum
+// has the device finish its checksum, with VIRTIO_NET_F_CSUM); recv copies
+// one frame out of receive queue 0 (0 if none)
+int virtio_net_send_packet(const void* data, uint32_t len);
+int virtio_net_send_packet_csum(const void* data, uint32_t len, uint16_t csum_start, uint16_t csum_offset);
+int virtio_net_send_pbuf(struct pbuf* p, uint16_t csum_start, uint16_t csum_offset);
+int virtio_net_recv_packet(void* buffer, uint32_t len);
+void virtio_net_rx_busy(bool on);
+int virtio_net_set_multicast(const mac_addr_t* macs, uint32_t count);
+uint32_t virtio_net_rx_poll(uint32_t budget);
+
+// The shared interrupt line; ignores interrupts that are not the device's
+void virtio_net_interrupt_handler(void);
+
+void virtio_net_print_info(void);
+
+#endif // VIRTIO_NET_H
@@ -1,15 +1,181 @@
 #include "websocket.h"
 #include "../mm/memory.h"
+#include "../arch/fpu.h"
+#include "../arch/tsc.h"
+#include "../proc/process.h"
 #include "../drivers/vga.h"
 
 // Forward declarations for string functions
 char* strdup(const char* s);
 size_t strlen(const char* s);
-int snprintf(char* str, size_t size, const char* format, ...);
+
+typedef uint32_t __attribute__((may_alias)) ws_word_t;
 
 // WebSocket GUID for handshake
 #define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
 
+static const char base64_digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+void ws_parser_init(ws_parser_t* parser) {
+    memset(parser, 0, sizeof(ws_parser_t));
+    parser->header_need = 2;
+}
+
+// 'len' bytes, a multiple of 16, inside fpu_kernel_begin
+__attribute__((target("sse2")))
+static void ws_mask_sse2(uint8_t* dst, const uint8_t* src, uint32_t len, uint32_t key) {
+    __asm__ volatile (
+        "movd %3, %%xmm1\n\t"
+        "pshufd $0, %%xmm1, %%xmm1\n\t"
+        "1:\n\t"
+        "movdqu (%1), %%xmm0\n\t"
+        "pxor %%xmm1, %%xmm0\n\t"
+        "movdqu %%xmm0, (%0)\n\t"
+        "add $16, %0\n\t"
+        "add $16, %1\n\t"
+        "subl $16, %2\n\t"
+        "jnz 1b"
+        : "+r"(dst), "+r"(src), "+r"(len)
+        : "r"(key)
+        : "memory", "cc", "xmm0", "xmm1");
+}
+
+uint32_t ws_mask(uint8_t* dst, const uint8_t* src, uint32_t len, uint32_t key, uint32_t offset) {
+    // Byte i of the key masks payload byte i mod 4: turned so that byte
+    // 'offset' is masked by the low one
+    uint32_t shift = (offset & 3) * 8;
+    uint32_t k = shift ? (key >> shift) | (key << (32 - shift)) : key;
+    uint32_t done = 0;
+
+    if (len >= WS_MASK_SSE_MIN) {
+        uint32_t flags;
+        if (fpu_kernel_begin(&flags)) {
+            done = len & ~15u;
+            ws_mask_sse2(dst, src, done, k);
+            fpu_kernel_end(flags);
+        }
+    }
+    for (; done + 4 <= len; done += 4) {
+        *(ws_word_t*)(dst + done) = *(const ws_word_t*)(src + done) ^ k;
+    }
+    for (; done < len; done++) {
+        dst[done] = src[done] ^ (uint8_t)k;
+        k = (k >> 8) | (k << 24);
+    }
+    return offset + len;
+}
+
+// The header is complete: check it and set up for the payload
+static int ws_frame_start(ws_parser_t* p) {
+    const uint8_t* h = p->header;
+    uint8_t opcode = h[0] & WS_OPCODE;
+    p->fin = (h[0] & WS_FIN) != 0;
+    p->masked = (h[1] & WS_MASKED) != 0;
+
+    uint32_t pos = 2;
+    uint64_t len = h[1] & WS_LEN;
+    if (len == WS_LEN_16) {
+        len = (uint32_t)h[2] << 8 | h[3];
+        pos = 4;
+    } else if (len == WS_LEN_64) {
+        if (h[2] & 0x80) return NET_ERROR;      // Top bit must be clear
+        len = 0;
+        for (pos = 2; pos < 10; pos++) {
+            len = len << 8 | h[pos];
+        }
+    }
+    if (p->masked) {
+        p->mask_key = *(const ws_word_t*)(h + pos);
+    }
+
+    // No extension was negotiated, so no reserved bit may be set
+    if (h[0] & WS_RSV) return NET_ERROR;
+    if (opcode >= WS_OPCODE_CLOSE) {
+        if (opcode > WS_OPCODE_PONG || !p->fin || len > WS_MAX_CONTROL) return NET_ERROR;
+        p->control_len = 0;
+    } else if (opcode == WS_OPCODE_CONTINUATION) {
+        if (!p->message) return NET_ERROR;
+    } else if (opcode == WS_OPCODE_TEXT || opcode == WS_OPCODE_BINARY) {
+        if (p->message) return NET_ERROR;      // Messages do not interleave
+        p->message = opcode;
+        p->first = true;
+    } else {
+        return NET_ERROR;
+    }
+
+    p->opcode = opcode;
+    p->remaining = len;
+    p->mask_offset = 0;
+    p->in_payload = true;
+    p->frames++;
+    return NET_SUCCESS;
+}
+
+// Its payload all seen: a control frame goes to the handler now, a data
+// frame's last piece has already said whether the message ended
+static void ws_frame_end(ws_parser_t* p, const ws_handler_t* handler) {
+    if (p->opcode >= WS_OPCODE_CLOSE) {
+        if (handler->on_control) {
+            handler->on_control(handler->ctx, p->opcode, p->control, p->control_len);
+        }
+    } else if (p->fin) {
+        p->message = 0;
+        p->messages++;
+    }
+    p->in_payload = false;
+    p->header_len = 0;
+    p->header_need = 2;
+}
+
+int ws_parse(ws_parser_t* p, uint8_t* data, uint32_t len, const ws_handler_t* handler) {
+    if (p->error) return p->error;
+
+    uint32_t pos = 0;
+    while (pos < len || (p->in_payload && !p->remaining)) {
+        if (!p->in_payload) {
+            p->header[p->header_len++] = data[pos++];
+            if (p->header_len == 2) {
+                uint8_t len7 = p->header[1] & WS_LEN;
+                p->header_need = 2 + (len7 == WS_LEN_16 ? 2 : len7 == WS_LEN_64 ? 8 : 0) +
+                                 ((p->header[1] & WS_MASKED) ? 4 : 0);
+            }
+            if (p->header_len < p->header_need) continue;
+            if (ws_frame_start(p) != NET_SUCCESS) {
+                p->error = NET_ERROR;
+                return NET_ERROR;
+            }
+            if (p->remaining || p->opcode >= WS_OPCODE_CLOSE) continue;
+            // An empty data frame: only its end of message to report
+            if (p->fin && handler->on_data) {
+                handler->on_data(handler->ctx, p->message, data + pos, 0,
+                                 WS_MSG_LAST | (p->first ? WS_MSG_FIRST : 0));
+            }
+            p->first = false;
+            ws_frame_end(p, handler);
+            continue;
+        }
+
+        uint32_t n = p->remaining < len - pos ? (uint32_t)p->remaining : len - pos;
+        uint8_t* piece = data + pos;
+        if (p->masked && n) {
+            p->mask_offset = ws_mask(piece, piece, n, p->mask_key, p->mask_offset);
+        }
+        if (p->opcode >= WS_OPCODE_CLOSE) {
+            memcpy(p->control + p->control_len, piece, n);
+            p->control_len += n;
+        } else if (n && handler->on_data) {
+            uint32_t flags = (p->first ? WS_MSG_FIRST : 0) | (p->fin && n == p->remaining ? WS_MSG_LAST : 0);
+            handler->on_data(handler->ctx, p->message, piece, n, flags);
+            p->first = false;
+        }
+        p->remaining -= n;
+        pos += n;
+        if (!p->remaining) ws_frame_end(p, handler);
+    }
+    return (int)len;
+}
+
 // Connect to WebSocket server
 websocket_t* websocket_connect(const char* host, int port, const char* path) {
     if (!host || !path) {
@@ -20,21 +186,30 @@ websocket_t* websocket_connect(const char* host, int port, const char* path) {
     if (!ws) {
         return NULL;
     }
+    memset(ws, 0, sizeof(websocket_t));
 
     ws->host = strdup(host);
     ws->path = strdup(path);
-    if (!ws->host || !ws->path) {
+    ws->send_buf = (uint8_t*)kmalloc(WS_SEND_BUFFER);
+    if (!ws->host || !ws->path || !ws->send_buf) {
         if (ws->host) kfree(ws->host);
         if (ws->path) kfree(ws->path);
+        if (ws->send_buf) kfree(ws->send_buf);
         kfree(ws);
         return NULL;
     }
     ws->port = port;
     ws->connected = 0;
+    kmutex_init(&ws->send_lock, "websocket");
+    ws->mask_seed = (uint32_t)rdtsc() | 1;
+    ws_parser_init(&ws->parser);
 
     // Create socket
     ws->sockfd = socket_create(AF_INET, SOCK_STREAM, 0);
     if (ws->sockfd < 0) {
+        kfree(ws->host);
+        kfree(ws->path);
+        kfree(ws->send_buf);
         kfree(ws);
         return NULL;
     }
@@ -43,25 +218,21 @@ websocket_t* websocket_connect(const char* host, int port, const char* path) {
     sockaddr_in_t addr;
     addr.sin_family = AF_INET;
     addr.sin_port = port;
-    // TODO: Resolve hostname to IP
-    addr.sin_addr.addr[0] = 104;  // testnet.binance.vision placeholder
-    addr.sin_addr.addr[1] = 18;
-    addr.sin_addr.addr[2] = 42;
-    addr.sin_addr.addr[3] = 102;
-
-    if (socket_connect(ws->sockfd, (sockaddr_t*)&addr) < 0) {
-        socket_close(ws->sockfd);
-        kfree(ws->host);
-        kfree(ws->path);
-        kfree(ws);
-        return NULL;
+    if (net_string_to_ip(host, &addr.sin_addr) != NET_SUCCESS) {
+        // TODO: Resolve hostname to IP
+        addr.sin_addr.addr[0] = 104;  // testnet.binance.vision placeholder
+        addr.sin_addr.addr[1] = 18;
+        addr.sin_addr.addr[2] = 42;
+        addr.sin_addr.addr[3] = 102;
     }
 
-    // Perform WebSocket handshake
-    if (websocket_upgrade_connection(ws->sockfd, host, path) < 0) {
+    socket_t* sock = socket_get(ws->sockfd);
+    if (socket_connect(ws->sockfd, (sockaddr_t*)&addr) < 0 || !sock ||
+        !(ws->conn = sock->data.tcp_conn) || websocket_upgrade_connection(ws) < 0) {
         socket_close(ws->sockfd);
         kfree(ws->host);
         kfree(ws->path);
+        kfree(ws->send_buf);
         kfree(ws);
         return NULL;
     }
@@ -70,58 +241,112 @@ websocket_t* websocket_connect(const char* host, int port, const char* path) {
     return ws;
 }
 
-// Send WebSocket text frame
-int websocket_send_text(websocket_t* ws, const char* text) {
-    if (!ws || !ws->connected) {
-        return -1;
-    }
-
-    size_t text_len = strlen(text);
-    size_t frame_size = sizeof(ws_frame_t) + text_len;
+// xorshift32: mask keys only need to be unpredictable to what sits on the
+// path, not strong
+static uint32_t ws_next_key(websocket_t* ws) {
+    uint32_t x = ws->mask_seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    ws->mask_seed = x;
+    return x;
+}
 
-    ws_frame_t* frame = (ws_frame_t*)kmalloc(frame_size);
-    if (!frame) {
+int websocket_send(websocket_t* ws, uint8_t opcode, const void* data, uint32_t len) {
+    if (!ws || !ws->connected || (len && !data) ||
+        (opcode >= WS_OPCODE_CLOSE && len > WS_MAX_CONTROL)) {
         return -1;
     }
 
-    // Fill frame header
-    frame->fin = 1;
-    frame->rsv1 = 0;
-    frame->rsv2 = 0;
-    frame->rsv3 = 0;
-    frame->opcode = WS_OPCODE_TEXT;
-    frame->mask = 0;  // Server doesn't mask
-
-    if (text_len < 126) {
-        frame->payload_len = text_len;
-    } else if (text_len < 65536) {
-        frame->payload_len = 126;
-        frame->extended_len = text_len;
+    kmutex_lock(&ws->send_lock);
+    uint8_t* frame = ws->send_buf;
+    uint32_t header_len = 2;
+    frame[0] = WS_FIN | (opcode & WS_OPCODE);
+    if (len < WS_LEN_16) {
+        frame[1] = WS_MASKED | (uint8_t)len;
+    } else if (len <= 0xFFFF) {
+        frame[1] = WS_MASKED | WS_LEN_16;
+        frame[2] = (uint8_t)(len >> 8);
+        frame[3] = (uint8_t)len;
+        header_len = 4;
     } else {
-        frame->payload_len = 127;
-        frame->full_len = text_len;
+        frame[1] = WS_MASKED | WS_LEN_64;
+        memset(frame + 2, 0, 4);
+        frame[6] = (uint8_t)(len >> 24);
+        frame[7] = (uint8_t)(len >> 16);
+        frame[8] = (uint8_t)(len >> 8);
+        frame[9] = (uint8_t)len;
+        header_len = 10;
     }
+    // A client masks everything it sends
+    uint32_t key = ws_next_key(ws);
+    *(ws_word_t*)(frame + header_len) = key;
+    header_len += 4;
 
-    // Copy payload
-    memcpy(frame->payload, text, text_len);
+    // The payload masked into the buffer behind the header, then a
+    // buffer at a time
+    const uint8_t* src = (const uint8_t*)data;
+    uint32_t offset = 0;
+    uint32_t used = header_len;
+    int result = (int)len;
+    do {
+        uint32_t n = len - offset < WS_SEND_BUFFER - used ? len - offset : WS_SEND_BUFFER - used;
+        offset = ws_mask(frame + used, src + offset, n, key, offset);
+        if (tcp_send(ws->conn, frame, used + n) < 0) {
+            result = -1;
+            break;
+        }
+        used = 0;
+    } while (offset < len);
+    kmutex_unlock(&ws->send_lock);
+    return result;
+}
 
-    // Send frame
-    int result = socket_send(ws->sockfd, frame, frame_size);
-    kfree(frame);
+// Send WebSocket text frame
+int websocket_send_text(websocket_t* ws, const char* text) {
+    return text ? websocket_send(ws, WS_OPCODE_TEXT, text, strlen(text)) : -1;
+}
 
-    return result;
+static void ws_poll_data(void* ctx, uint8_t opcode, const uint8_t* data, uint32_t len, uint32_t flags) {
+    websocket_t* ws = (websocket_t*)ctx;
+    if (ws->handler && ws->handler->on_data) {
+        ws->handler->on_data(ws->handler->ctx, opcode, data, len, flags);
+    }
 }
 
-// Receive WebSocket frame
-int websocket_recv_frame(websocket_t* ws, ws_frame_t** frame_out) {
-    if (!ws || !ws->connected) {
-        return -1;
+static void ws_poll_control(void* ctx, uint8_t opcode, const uint8_t* data, uint32_t len) {
+    websocket_t* ws = (websocket_t*)ctx;
+    if (opcode == WS_OPCODE_PING) {
+        websocket_send(ws, WS_OPCODE_PONG, data, len);
+    } else if (opcode == WS_OPCODE_CLOSE && ws->connected) {
+        // Echo the status code, then nothing more goes out
+        websocket_send(ws, WS_OPCODE_CLOSE, data, len >= 2 ? 2 : 0);
+        ws->connected = 0;
+    }
+    if (ws->handler && ws->handler->on_control) {
+        ws->handler->on_control(ws->handler->ctx, opcode, data, len);
     }
+}
 
-    // For now, this is a placeholder
-    // In a real implementation, we'd read from the socket and parse frames
-    *frame_out = NULL;
-    return 0;
+int websocket_poll(websocket_t* ws, const ws_handler_t* handler, uint32_t timeout_ms) {
+    if (!ws || !ws->conn) {
+        return NET_INVALID;
+    }
+
+    uint8_t* data;
+    int len = tcp_recv_peek(ws->conn, &data, timeout_ms);
+    if (len <= 0) {
+        if (len == 0 || len == NET_ERROR) ws->connected = 0;
+        return len;
+    }
+
+    // Parsed where it lies, and let go of after
+    ws_handler_t poll_handler = {ws_poll_data, ws_poll_control, ws};
+    ws->handler = handler;
+    int result = ws_parse(&ws->parser, data, (uint32_t)len, &poll_handler);
+    ws->handler = NULL;
+    tcp_recv_consume(ws->conn, (uint32_t)len);
+    return result;
 }
 
 // Close WebSocket connection
@@ -129,43 +354,90 @@ void websocket_close(websocket_t* ws) {
     if (!ws) return;
 
     if (ws->connected) {
-        // Send close frame
-        ws_frame_t close_frame = {
-            .fin = 1,
-            .opcode = WS_OPCODE_CLOSE,
-            .mask = 0,
-            .payload_len = 0
-        };
-        socket_send(ws->sockfd, &close_frame, sizeof(ws_frame_t));
+        // Close frame with status 1000, normal closure
+        static const uint8_t status[2] = {0x03, 0xE8};
+        websocket_send(ws, WS_OPCODE_CLOSE, status, sizeof(status));
+        ws->connected = 0;
     }
 
     socket_close(ws->sockfd);
     kfree(ws->host);
     kfree(ws->path);
+    kfree(ws->send_buf);
     kfree(ws);
 }
 
+static char* ws_append(char* out, const char* text) {
+    while (*text) {
+        *out++ = *text++;
+    }
+    return out;
+}
+
 // Perform WebSocket HTTP upgrade handshake
-int websocket_upgrade_connection(int sockfd, const char* host, const char* path) {
+int websocket_upgrade_connection(websocket_t* ws) {
+    if (strlen(ws->host) + strlen(ws->path) > 256) {
+        return -1;
+    }
+
+    // A random 16-byte key, base64
+    uint8_t nonce[18];
+    for (int i = 0; i < 16; i += 4) {
+        *(ws_word_t*)(nonce + i) = ws_next_key(ws);
+    }
+    nonce[16] = nonce[17] = 0;
+    char key[25];
+    for (int i = 0, j = 0; i < 18; i += 3, j += 4) {
+        uint32_t bits = (uint32_t)nonce[i] << 16 | (uint32_t)nonce[i + 1] << 8 | nonce[i + 2];
+        key[j] = base64_digits[(bits >> 18) & 63];
+        key[j + 1] = base64_digits[(bits >> 12) & 63];
+        key[j + 2] = base64_digits[(bits >> 6) & 63];
+        key[j + 3] = base64_digits[bits & 63];
+    }
+    key[22] = key[23] = '=';
+    key[24] = '\0';
+
     // Send HTTP upgrade request
     char request[512];
-    snprintf(request, sizeof(request),
-             "GET %s HTTP/1.1\r\n"
-             "Host: %s\r\n"
-             "Upgrade: websocket\r\n"
-             "Connection: Upgrade\r\n"
-             "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
-             "Sec-WebSocket-Version: 13\r\n"
-             "\r\n",
-             path, host);
-
-    if (socket_send(sockfd, request, strlen(request)) < 0) {
+    char* out = ws_append(request, "GET ");
+    out = ws_append(out, ws->path);
+    out = ws_append(out, " HTTP/1.1\r\nHost: ");
+    out = ws_append(out, ws->host);
+    out = ws_append(out, "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: ");
+    out = ws_append(out, key);
+    out = ws_append(out, "\r\nSec-WebSocket-Version: 13\r\n\r\n");
+    if (tcp_send(ws->conn, request, (uint32_t)(out - request)) < 0) {
         return -1;
     }
 
-    // For now, assume handshake succeeds
-    // In a real implementation, we'd read and parse the response
-    return 0;
+    // "HTTP/1.1 101", then headers up to the blank line; what follows is
+    // frames and stays in the ring. Sec-WebSocket-Accept is not checked:
+    // there is no SHA-1 here.
+    char status[12];
+    uint32_t seen = 0;
+    uint32_t terminator = 0;        // Of "\r\n\r\n", matched so far
+    uint32_t deadline = get_current_time_ms() + WS_HANDSHAKE_TIMEOUT_MS;
+    while (terminator < 4) {
+        uint32_t now = get_current_time_ms();
+        if (seen >= WS_HANDSHAKE_MAX || now >= deadline) return -1;
+
+        uint8_t* data;
+        int len = tcp_recv_peek(ws->conn, &data, deadline - now);
+        if (len <= 0) return -1;
+        int taken = 0;
+        while (taken < len && terminator < 4) {
+            char c = (char)data[taken++];
+            if (seen < sizeof(status)) status[seen] = c;
+            seen++;
+            if (c == (terminator & 1 ? '\n' : '\r')) {
+                terminator++;
+            } else {
+                terminator = c == '\r' ? 1 : 0;
+            }
+        }
+        tcp_recv_consume(ws->conn, (uint32_t)taken);
+    }
+    return seen >= sizeof(status) && memcmp(status, "HTTP/1.1 101", sizeof(status)) == 0 ? 0 : -1;
 }
 
 // Simple string duplicate (since we don't have standard library)
@@ -183,21 +455,3 @@ char* strdup(const char* s) {
     }
     return dup;
 }
-
-// Simple string length (extern from memory.c)
-extern size_t strlen(const char* s);
-
-// Simple string format (basic implementation)
-int snprintf(char* str, size_t size, const char* format, ...) {
-    if (!str || !format || size == 0) {
-        return 0;
-    }
-    // Very basic implementation - just copy format for now
-    size_t len = strlen(format);
-    if (len >= size) len = size - 1;
-    for (size_t i = 0; i < len; i++) {
-        str[i] = format[i];
-    }
-    str[len] = '\0';
-    return len;
-}
\ No newline at end of file
@@ -2,6 +2,31 @@
 #define WEBSOCKET_H
 
 #include "socket.h"
+#include "tcp.h"
+#include "../proc/mutex.h"
+
+// WebSocket (RFC 6455) client over a TCP connection.
+//
+// Frames are parsed incrementally straight out of the TCP receive ring:
+// the parser keeps only the header bytes seen so far and how much payload
+// is left, so a frame may arrive in any number of pieces, split anywhere,
+// with a 7, 16 or 64-bit length. Payload is handed to the handler where it
+// lies, a piece at a time (unmasked in place if the sender masked it), and
+// a message fragmented over continuation frames comes out as one run of
+// pieces. Only control frames, 125 bytes at most, are gathered into the
+// parser, so a ping whose payload straddles the ring's wrap is still
+// answered whole.
+//
+// Masking XORs four bytes at a time, sixteen with SSE2 from
+// WS_MASK_SSE_MIN bytes. What we send goes through a buffer allocated once
+// per connection, the mask applied on the way into it: no allocation per
+// message.
+#define WS_MAX_HEADER           14
+#define WS_MAX_CONTROL          125
+#define WS_SEND_BUFFER          4096        // Header included; longer payloads go in several sends
+#define WS_MASK_SSE_MIN         256
+#define WS_HANDSHAKE_TIMEOUT_MS 5000
+#define WS_HANDSHAKE_MAX        4096        // Response headers we wait through
 
 // WebSocket frame opcodes
 #define WS_OPCODE_CONTINUATION 0x0
@@ -11,35 +36,87 @@
 #define WS_OPCODE_PING        0x9
 #define WS_OPCODE_PONG        0xA
 
-// WebSocket frame structure
+// First two header bytes; then a 16 or 64-bit length (network order) for
+// WS_LEN_16 and WS_LEN_64, then the mask key if WS_MASKED
+#define WS_FIN                  0x80
+#define WS_RSV                  0x70
+#define WS_OPCODE               0x0F
+#define WS_MASKED               0x80
+#define WS_LEN                  0x7F
+#define WS_LEN_16               126
+#define WS_LEN_64               127
+
+// ws_handler_t.on_data flags
+#define WS_MSG_FIRST            0x01        // First piece of a message
+#define WS_MSG_LAST             0x02        // Last piece: the message is complete
+
 typedef struct {
-    uint8_t fin : 1;
-    uint8_t rsv1 : 1;
-    uint8_t rsv2 : 1;
-    uint8_t rsv3 : 1;
-    uint8_t opcode : 4;
-    uint8_t mask : 1;
-    uint8_t payload_len : 7;
-    uint16_t extended_len;  // if payload_len == 126
-    uint64_t full_len;      // if payload_len == 127
-    uint32_t masking_key;
-    uint8_t payload[];
-} __attribute__((packed)) ws_frame_t;
+    // A piece of a TEXT or BINARY message, in place; len may be 0 on the
+    // last piece
+    void (*on_data)(void* ctx, uint8_t opcode, const uint8_t* data, uint32_t len, uint32_t flags);
+    // A whole control frame (CLOSE, PING, PONG); may be NULL
+    void (*on_control)(void* ctx, uint8_t opcode, const uint8_t* data, uint32_t len);
+    void* ctx;
+} ws_handler_t;
+
+typedef struct {
+    uint8_t header[WS_MAX_HEADER];
+    uint8_t header_len;         // Bytes of it so far
+    uint8_t header_need;        // Its full length, known from the second byte
+    uint8_t opcode;             // Of the frame being parsed
+    uint8_t message;            // Opcode of the message under way, 0 between messages
+    bool fin;
+    bool masked;
+    bool first;                 // The next data piece starts the message
+    bool in_payload;
+    uint32_t mask_key;          // As it sits in the header
+    uint32_t mask_offset;       // Payload bytes unmasked so far
+    uint64_t remaining;         // Payload bytes of the frame still to come
+    uint8_t control[WS_MAX_CONTROL];
+    uint8_t control_len;
+    uint32_t frames;
+    uint32_t messages;
+    int error;                  // NET_ERROR for good once the stream is bad
+} ws_parser_t;
+
+void ws_parser_init(ws_parser_t* parser);
+
+// Feed the next len bytes of the stream: all of them are taken, and
+// handed on in place; NET_ERROR on a protocol violation (and from then on)
+int ws_parse(ws_parser_t* parser, uint8_t* data, uint32_t len, const ws_handler_t* handler);
+
+// XOR len bytes with the mask key, 'offset' bytes into the payload (dst
+// may be src); returns the offset after them
+uint32_t ws_mask(uint8_t* dst, const uint8_t* src, uint32_t len, uint32_t key, uint32_t offset);
 
 // WebSocket connection structure
 typedef struct websocket {
     int sockfd;
+    tcp_connection_t* conn;
     char* host;
     char* path;
     int port;
     int connected;
+    uint8_t* send_buf;          // WS_SEND_BUFFER, for the life of the connection
+    kmutex_t send_lock;         // One frame at a time, pongs included
+    uint32_t mask_seed;         // For mask keys
+    ws_parser_t parser;
+    const ws_handler_t* handler;    // During websocket_poll
 } websocket_t;
 
 // Function declarations
 websocket_t* websocket_connect(const char* host, int port, const char* path);
+
+// One frame, FIN set: len, or -1
+int websocket_send(websocket_t* ws, uint8_t opcode, const void* data, uint32_t len);
 int websocket_send_text(websocket_t* ws, const char* text);
-int websocket_recv_frame(websocket_t* ws, ws_frame_t** frame);
+
+// Parse what has arrived, waiting up to timeout_ms for something: the
+// bytes parsed, 0 once the stream has ended, NET_TIMEOUT or NET_ERROR.
+// Pings are answered and a close echoed before the handler sees them.
+int websocket_poll(websocket_t* ws, const ws_handler_t* handler, uint32_t timeout_ms);
+
 void websocket_close(websocket_t* ws);
-int websocket_upgrade_connection(int sockfd, const char* host, const char* path);
+int websocket_upgrade_connection(websocket_t* ws);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,314 @@
+#include "bench.h"
+#include "ipc.h"
+#include "risk.h"
+#include "../net/feed.h"
+#include "../net/udp.h"
+#include "../net/ip.h"
+#include "../net/tcp.h"
+#include "../net/gateway.h"
+#include "../mm/memory.h"
+#include "../arch/cpu.h"
+#include "../arch/tsc.h"
+#include "../arch/div64.h"
+#include "../drivers/vga.h"
+
+#define BENCH_RING_SIZE         64
+#define BENCH_FEED_PORT         31001           // Line B on the next port
+#define BENCH_BASE_TICKS        1000000         // 100.0000
+#define BENCH_LOT               100
+#define BENCH_BAR_WIDTH         40
+
+static const char* stage_names[BENCH_STAGES] = {
+    "feed    ", "strategy", "risk    ", "gateway ", "total   "
+};
+
+static inline uint32_t bench_bucket(uint32_t cycles) {
+    if (cycles < BENCH_SUB_BUCKETS) return cycles;
+
+    uint32_t msb = 31 - __builtin_clz(cycles);
+    return ((msb - BENCH_SUB_SHIFT + 1) << BENCH_SUB_SHIFT) |
+           ((cycles >> (msb - BENCH_SUB_SHIFT)) & (BENCH_SUB_BUCKETS - 1));
+}
+
+// First value past the bucket
+static uint64_t bench_bucket_end(uint32_t bucket) {
+    if (bucket < BENCH_SUB_BUCKETS) return bucket + 1;
+
+    uint32_t msb = (bucket >> BENCH_SUB_SHIFT) + BENCH_SUB_SHIFT - 1;
+    uint64_t sub = BENCH_SUB_BUCKETS + (bucket & (BENCH_SUB_BUCKETS - 1)) + 1;
+    return sub << (msb - BENCH_SUB_SHIFT);
+}
+
+static void hist_add(bench_hist_t* hist, uint64_t cycles) {
+    uint32_t value = cycles > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)cycles;
+    hist->count++;
+    hist->total += value;
+    if (value < hist->min) hist->min = value;
+    if (value > hist->max) hist->max = value;
+    hist->buckets[bench_bucket(value)]++;
+}
+
+uint32_t bench_percentile(const bench_hist_t* hist, uint32_t per_100k) {
+    if (!hist || hist->count == 0) return 0;
+
+    uint32_t target = (uint32_t)div_u64_u32((uint64_t)hist->count * per_100k + 99999, 100000, NULL);
+    uint32_t seen = 0;
+    for (uint32_t i = 0; i < BENCH_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target) {
+            uint64_t edge = bench_bucket_end(i) - 1;
+            return edge > hist->max ? hist->max : (uint32_t)edge;
+        }
+    }
+    return hist->max;
+}
+
+// Stand-in strategy: join every quote on its own side with one lot
+static bool bench_strategy(const market_data_t* md, uint32_t order_id, order_t* order) {
+    if (md->side == MD_SIDE_TRADE) return false;
+
+    order->order_id = order_id;
+    order->symbol_id = md->symbol_id;
+    order->side = md->side;             // Bid quote, buy; ask quote, sell
+    order->type = 1;
+    order->price = md->price;
+    order->quantity = BENCH_LOT;
+    order->timestamp = md->timestamp;
+    order->client_id = 0;
+    order->status = 0;
+    return true;
+}
+
+// One-quote feed packet to the bench group; returns the frame length
+static uint32_t bench_build_frame(uint8_t* frame, const ipv4_addr_t* group) {
+    eth_header_t* eth = (eth_header_t*)frame;
+    ipv4_header_t* ip = (ipv4_header_t*)(eth + 1);
+    udp_packet_t* udp = (udp_packet_t*)(ip + 1);
+    feed_packet_header_t* packet = (feed_packet_header_t*)udp->data;
+    feed_quote_msg_t* quote = (feed_quote_msg_t*)(packet + 1);
+
+    uint32_t payload = sizeof(feed_packet_header_t) + sizeof(feed_quote_msg_t);
+    memset(frame, 0, sizeof(eth_header_t) + sizeof(ipv4_header_t) + sizeof(udp_packet_t) + payload);
+    eth->ethertype = net_htons(ETH_TYPE_IP);
+    ip->version_ihl = (4 << 4) | 5;
+    ip->total_len = net_htons(sizeof(ipv4_header_t) + sizeof(udp_packet_t) + payload);
+    ip->ttl = 1;
+    ip->protocol = IP_PROTO_UDP;
+    ip->dst_ip = *group;
+    ip->checksum = ipv4_checksum(ip);
+    udp->dst_port = net_htons(BENCH_FEED_PORT);
+    udp->length = net_htons(sizeof(udp_packet_t) + payload);
+
+    packet->count = 1;
+    quote->header.length = sizeof(feed_quote_msg_t);
+    quote->header.type = FEED_MSG_QUOTE;
+    quote->symbol_id = BENCH_SYMBOL;
+    quote->quantity = BENCH_LOT;
+    return sizeof(eth_header_t) + net_ntohs(ip->total_len);
+}
+
+static void bench_run(bench_result_t* result, uint32_t samples, lockfree_ringbuf_t* ring,
+                      gateway_session_t* gw, uint8_t* frame, uint32_t frame_len) {
+    feed_packet_header_t* packet = (feed_packet_header_t*)(frame + sizeof(eth_header_t) +
+                                                           sizeof(ipv4_header_t) + sizeof(udp_packet_t));
+    feed_quote_msg_t* quote = (feed_quote_msg_t*)(packet + 1);
+
+    for (uint32_t i = 0; i < BENCH_WARMUP + samples; i++) {
+        // Quotes alternate sides and walk a few ticks, inside the band
+        packet->sequence = i + 1;
+        quote->side = i & 1;
+        quote->price = BENCH_BASE_TICKS + (i & 63);
+
+        order_t order;
+        uint64_t stamps[BENCH_STAGES];
+        uint32_t flags = irq_save();
+        stamps[0] = rdtsc();
+        net_handle_ethernet(frame, frame_len);
+        stamps[1] = rdtsc();
+        uint32_t avail;
+        market_data_t* md = (market_data_t*)ringbuf_peek(ring, 1, &avail);
+        bool trade = md && bench_strategy(md, i + 1, &order);
+        if (md) ringbuf_release(ring, 1);
+        stamps[2] = rdtsc();
+        uint32_t reject = trade ? risk_check(&order) : RISK_OK;
+        stamps[3] = rdtsc();
+        int sent = trade && reject == RISK_OK ? gateway_send_order(gw, &order) : NET_ERROR;
+        stamps[4] = rdtsc();
+        irq_restore(flags);
+
+        if (!trade) {
+            result->errors++;
+            continue;
+        }
+        if (reject != RISK_OK) {
+            result->rejects++;
+            continue;
+        }
+        // Never reached an exchange: give the reservation back
+        risk_on_cancel(order.symbol_id, order.side, order.quantity);
+        if (sent != NET_SUCCESS) {
+            result->errors++;
+            continue;
+        }
+        if (i < BENCH_WARMUP) continue;
+
+        for (uint32_t s = 0; s < BENCH_TOTAL; s++) {
+            hist_add(&result->stages[s], stamps[s + 1] - stamps[s]);
+        }
+        hist_add(&result->stages[BENCH_TOTAL], stamps[BENCH_TOTAL] - stamps[0]);
+        result->samples++;
+    }
+}
+
+int bench_tick_to_trade(uint32_t samples, bench_result_t* result) {
+    if (!result || !tsc_available()) return -1;
+    if (samples == 0) samples = BENCH_DEFAULT_SAMPLES;
+
+    memset(result, 0, sizeof(bench_result_t));
+    for (uint32_t s = 0; s < BENCH_STAGES; s++) {
+        result->stages[s].min = 0xFFFFFFFF;
+    }
+
+    ipv4_addr_t group = {{239, 1, 1, 99}};
+    ipv4_addr_t exchange = {{10, 0, 0, 99}};
+    mac_addr_t next_hop = {{0x02, 0, 0, 0, 0, 0x99}};
+    risk_limits_t limits = { 1000000, 0xFFFFFFFF, 1e9, 500 };
+
+    lockfree_ringbuf_t ring;
+    bool ring_ok = ringbuf_init(&ring, BENCH_RING_SIZE, sizeof(market_data_t)) == 0;
+    feed_handler_t* feed = (feed_handler_t*)kmalloc(sizeof(feed_handler_t));
+    gateway_session_t* gw = (gateway_session_t*)kmalloc(sizeof(gateway_session_t));
+    uint8_t* frame = (uint8_t*)kmalloc(ETH_MTU + ETH_HEADER_SIZE);
+    tcp_connection_t* conn = tcp_create_connection(&exchange, 9000, 40099);
+
+    int status = -1;
+    if (ring_ok && feed && gw && frame && conn &&
+        feed_open(feed, &ring, &group, BENCH_FEED_PORT, &group, BENCH_FEED_PORT + 1) == NET_SUCCESS) {
+        if (gateway_open(gw, conn, &next_hop, "BENCH0", "TKRN", GATEWAY_DRY_RUN) == NET_SUCCESS) {
+            gateway_set_symbol(BENCH_SYMBOL, "BENCH");
+            risk_set_limits(BENCH_SYMBOL, &limits);
+            risk_mark(BENCH_SYMBOL, BENCH_BASE_TICKS * 0.0001);
+
+            bench_run(result, samples, &ring, gw, frame, bench_build_frame(frame, &group));
+            status = 0;
+
+            risk_set_limits(BENCH_SYMBOL, NULL);
+            gateway_close(gw);
+        }
+        feed_close(feed);
+    }
+
+    tcp_close_connection(conn);
+    kfree(frame);
+    kfree(gw);
+    kfree(feed);
+    if (ring_ok) ringbuf_destroy(&ring);
+    return status;
+}
+
+// Right-aligned in 'width' columns
+static void print_padded(uint32_t value, uint32_t width) {
+    uint32_t digits = 1;
+    for (uint32_t v = value; v >= 10; v /= 10) {
+        digits++;
+    }
+    for (; digits < width; digits++) {
+        vga_putchar(' ');
+    }
+    print_dec(value);
+}
+
+static uint32_t cycles_ns(uint64_t cycles) {
+    uint64_t ns = tsc_cycles_to_ns(cycles);
+    return ns > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)ns;
+}
+
+void bench_print(const bench_result_t* result) {
+    if (!result) return;
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Tick-to-Trade (");
+    print_dec(result->samples);
+    vga_write_string(" samples, ns) ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    if (result->samples == 0) {
+        vga_write_string("No samples\n");
+        return;
+    }
+
+    vga_write_string("STAGE        MIN     AVG     P50     P99   P99.9     MAX\n");
+    for (uint32_t s = 0; s < BENCH_STAGES; s++) {
+        const bench_hist_t* hist = &result->stages[s];
+        vga_write_string(stage_names[s]);
+        print_padded(cycles_ns(hist->min), 8);
+        print_padded(cycles_ns(div_u64_u32(hist->total, hist->count, NULL)), 8);
+        print_padded(cycles_ns(bench_percentile(hist, 50000)), 8);
+        print_padded(cycles_ns(bench_percentile(hist, 99000)), 8);
+        print_padded(cycles_ns(bench_percentile(hist, 99900)), 8);
+        print_padded(cycles_ns(hist->max), 8);
+        vga_write_string("\n");
+    }
+
+    // Total by powers of two
+    const bench_hist_t* total = &result->stages[BENCH_TOTAL];
+    uint32_t rows[33] = {0};
+    uint32_t first = 32, last = 0, widest = 0;
+    for (uint32_t i = 0; i < BENCH_BUCKETS; i++) {
+        if (total->buckets[i] == 0) continue;
+        uint32_t row = 32 - __builtin_clz((uint32_t)(bench_bucket_end(i) - 1) | 1);
+        rows[row] += total->buckets[i];
+        if (row < first) first = row;
+        if (row > last) last = row;
+    }
+    for (uint32_t r = first; r <= last; r++) {
+        if (rows[r] > widest) widest = rows[r];
+    }
+    for (uint32_t r = first; r <= last; r++) {
+        vga_write_string("  <");
+        print_padded(cycles_ns(1ULL << r), 7);
+        vga_write_string(" ");
+        print_padded(rows[r], 8);
+        vga_write_string(" ");
+        uint32_t bar = (uint32_t)div_u64_u32((uint64_t)rows[r] * BENCH_BAR_WIDTH + widest - 1, widest, NULL);
+        for (uint32_t b = 0; b < bar; b++) {
+            vga_putchar('#');
+        }
+        vga_write_string("\n");
+    }
+
+    if (result->rejects || result->errors) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        print_dec(result->rejects);
+        vga_write_string(" rejected, ");
+        print_dec(result->errors);
+        vga_write_string(" failed (not counted)\n");
+        vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    }
+
+    // One line to compare runs by
+    vga_write_string("bench: p50=");
+    print_dec(cycles_ns(bench_percentile(total, 50000)));
+    vga_write_string(" p99=");
+    print_dec(cycles_ns(bench_percentile(total, 99000)));
+    vga_write_string(" p99.9=");
+    print_dec(cycles_ns(bench_percentile(total, 99900)));
+    vga_write_string(" max=");
+    print_dec(cycles_ns(total->max));
+    vga_write_string(" ns\n");
+}
+
+void bench_boot(uint32_t samples) {
+    vga_set_mirror_port(BENCH_DEBUGCON_PORT);
+
+    bench_result_t* result = (bench_result_t*)kmalloc(sizeof(bench_result_t));
+    int status = result ? bench_tick_to_trade(samples, result) : -1;
+    if (status == 0) {
+        bench_print(result);
+    } else {
+        vga_write_string("bench: could not run (no TSC or no memory)\n");
+    }
+    kfree(result);
+
+    outb(BENCH_EXIT_PORT, status == 0 ? 0 : 1);
+    vga_set_mirror_port(0);
+}
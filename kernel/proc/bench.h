@@ -0,0 +1,66 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "../types.h"
+
+// Tick-to-trade benchmark. Synthetic quotes go in as Ethernet frames at the
+// point the NIC driver hands frames over (net_handle_ethernet) and pass the
+// feed handler into the market data ring, a stand-in strategy that joins
+// every quote, the pre-trade risk checks and the order encoder (dry run:
+// the frame is built, the card never sees it). Each stage is stamped with
+// the TSC, interrupts off as in the receive interrupt, and folded into a
+// log-linear histogram of BENCH_SUB_BUCKETS buckets per power of two, so
+// percentiles are within 1/BENCH_SUB_BUCKETS of the true value.
+//
+// Orders are released from risk right after each sample, so every sample
+// takes the accepting path. "make bench" boots with "bench=N" on the
+// command line: N samples, printed to QEMU's debug console, then exit.
+#define BENCH_DEFAULT_SAMPLES   10000
+#define BENCH_WARMUP            1000            // Unrecorded first samples
+#define BENCH_SUB_SHIFT         4
+#define BENCH_SUB_BUCKETS       (1 << BENCH_SUB_SHIFT)
+#define BENCH_BUCKETS           ((33 - BENCH_SUB_SHIFT) * BENCH_SUB_BUCKETS)
+#define BENCH_SYMBOL            1023            // Kept clear of real symbols
+#define BENCH_DEBUGCON_PORT     0xE9            // QEMU -debugcon
+#define BENCH_EXIT_PORT         0xF4            // QEMU isa-debug-exit
+
+typedef enum {
+    BENCH_FEED = 0,             // Frame to a record in the ring
+    BENCH_STRATEGY,             // Record to an order
+    BENCH_RISK,
+    BENCH_GATEWAY,              // Order to an encoded frame
+    BENCH_TOTAL,                // Tick to trade
+    BENCH_STAGES
+} bench_stage_t;
+
+// Cycles
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t buckets[BENCH_BUCKETS];
+} bench_hist_t;
+
+typedef struct {
+    uint32_t samples;
+    uint32_t rejects;           // By risk, not recorded
+    uint32_t errors;            // No record or no frame, not recorded
+    bench_hist_t stages[BENCH_STAGES];
+} bench_result_t;
+
+// 0, or -1 without a calibrated TSC or memory
+int bench_tick_to_trade(uint32_t samples, bench_result_t* result);
+
+// Upper edge of the bucket holding the given fraction (per 100000,
+// so 99900 is p99.9), in cycles and never above the maximum
+uint32_t bench_percentile(const bench_hist_t* hist, uint32_t per_100k);
+
+void bench_print(const bench_result_t* result);
+
+// Batch run for "make bench": output mirrored to the debug console, then
+// QEMU is left with status 0 (ran) or 1 (could not run). Without an exit
+// device boot simply goes on.
+void bench_boot(uint32_t samples);
+
+#endif // BENCH_H
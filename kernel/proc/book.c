@@ -0,0 +1,501 @@
+#include "book.h"
+#include "../drivers/vga.h"
+
+_Static_assert((BOOK_WINDOW & (BOOK_WINDOW - 1)) == 0 && BOOK_WINDOW % 32 == 0, "BOOK_WINDOW");
+_Static_assert((BOOK_FAR_BUCKETS & (BOOK_FAR_BUCKETS - 1)) == 0, "BOOK_FAR_BUCKETS");
+
+#define WINDOW_MASK             (BOOK_WINDOW - 1)
+#define BOOK_MAX_ORDERS         (1u << 20)
+
+static order_book_t* books[BOOK_MAX_SYMBOLS];
+
+static inline bool tick_within(int32_t base, int32_t tick) {
+    return (uint32_t)tick - (uint32_t)base < BOOK_WINDOW;
+}
+
+// a is a better price than b for the side
+static inline bool tick_better(uint8_t side, int32_t a, int32_t b) {
+    return side == BOOK_BID ? a > b : a < b;
+}
+
+static inline bool far_is_better(const order_book_t* book, uint8_t side, int32_t tick) {
+    return side == BOOK_BID ? tick >= book->base + BOOK_WINDOW : tick < book->base;
+}
+
+static inline uint32_t far_bucket(uint8_t side, int32_t tick) {
+    return ((uint32_t)tick * 2 + side) & (BOOK_FAR_BUCKETS - 1);
+}
+
+static inline bool level_in_window(const order_book_t* book, uint8_t side, const book_level_t* level) {
+    return level >= book->window[side] && level < book->window[side] + BOOK_WINDOW;
+}
+
+static inline void window_mark(order_book_t* book, uint8_t side, int32_t tick) {
+    uint32_t index = (uint32_t)tick & WINDOW_MASK;
+    book->window_map[side][index >> 5] |= 1u << (index & 31);
+}
+
+static inline void window_clear(order_book_t* book, uint8_t side, int32_t tick) {
+    uint32_t index = (uint32_t)tick & WINDOW_MASK;
+    book->window_map[side][index >> 5] &= ~(1u << (index & 31));
+}
+
+static void far_link(order_book_t* book, book_level_t* level) {
+    uint32_t bucket = far_bucket(level->side, level->tick);
+    level->far_next = book->far[bucket];
+    book->far[bucket] = level;
+    book->far_levels[level->side]++;
+}
+
+static book_level_t* level_find(order_book_t* book, uint8_t side, int32_t tick) {
+    if (tick_within(book->base, tick)) {
+        book_level_t* level = &book->window[side][(uint32_t)tick & WINDOW_MASK];
+        return level->orders ? level : NULL;
+    }
+    for (book_level_t* level = book->far[far_bucket(side, tick)]; level; level = level->far_next) {
+        if (level->tick == tick && level->side == side) return level;
+    }
+    return NULL;
+}
+
+// Existing or new, empty level
+static book_level_t* level_get(order_book_t* book, uint8_t side, int32_t tick) {
+    book_level_t* level = level_find(book, side, tick);
+    if (level) return level;
+
+    bool near = tick_within(book->base, tick);
+    if (near) {
+        level = &book->window[side][(uint32_t)tick & WINDOW_MASK];
+    } else {
+        level = (book_level_t*)pool_alloc(book->level_pool);
+        if (!level) return NULL;
+    }
+    level->head = level->tail = NULL;
+    level->quantity = 0;
+    level->orders = 0;
+    level->tick = tick;
+    level->side = side;
+    level->far_next = NULL;
+
+    if (near) {
+        window_mark(book, side, tick);
+    } else {
+        far_link(book, level);
+        if (far_is_better(book, side, tick)) book->far_better[side]++;
+    }
+    return level;
+}
+
+static void level_remove(order_book_t* book, book_level_t* level) {
+    uint8_t side = level->side;
+    if (level_in_window(book, side, level)) {
+        window_clear(book, side, level->tick);
+        level->head = level->tail = NULL;
+        return;
+    }
+
+    book_level_t** link = &book->far[far_bucket(side, level->tick)];
+    while (*link != level) {
+        link = &(*link)->far_next;
+    }
+    *link = level->far_next;
+    book->far_levels[side]--;
+    if (far_is_better(book, side, level->tick)) book->far_better[side]--;
+    pool_free(book->level_pool, level);
+}
+
+// Best window level strictly worse than 'after' (BOOK_NO_PRICE: any).
+// Walks the bitmap a word at a time from 'after' towards the far edge.
+static int32_t window_scan(const order_book_t* book, uint8_t side, int32_t after) {
+    const uint32_t* map = book->window_map[side];
+    int32_t low = book->base;
+    int32_t high = book->base + BOOK_WINDOW;
+
+    if (side == BOOK_BID) {
+        int32_t tick = (after == BOOK_NO_PRICE || after > high) ? high - 1 : after - 1;
+        while (tick >= low) {
+            uint32_t bit = (uint32_t)tick & 31;
+            uint32_t word = map[((uint32_t)tick & WINDOW_MASK) >> 5] & (0xFFFFFFFFu >> (31 - bit));
+            if (word) {
+                int32_t hit = tick - (int32_t)(bit - (31 - __builtin_clz(word)));
+                return hit >= low ? hit : BOOK_NO_PRICE;
+            }
+            tick -= (int32_t)bit + 1;
+        }
+    } else {
+        int32_t tick = (after == BOOK_NO_PRICE || after < low) ? low : after + 1;
+        while (tick < high) {
+            uint32_t bit = (uint32_t)tick & 31;
+            uint32_t word = map[((uint32_t)tick & WINDOW_MASK) >> 5] & (0xFFFFFFFFu << bit);
+            if (word) {
+                int32_t hit = tick + (int32_t)(__builtin_ctz(word) - bit);
+                return hit < high ? hit : BOOK_NO_PRICE;
+            }
+            tick += 32 - (int32_t)bit;
+        }
+    }
+    return BOOK_NO_PRICE;
+}
+
+// Best far level strictly worse than 'after' (BOOK_NO_PRICE: any)
+static int32_t far_scan(const order_book_t* book, uint8_t side, int32_t after) {
+    int32_t best = BOOK_NO_PRICE;
+    if (!book->far_levels[side]) return best;
+
+    for (uint32_t bucket = 0; bucket < BOOK_FAR_BUCKETS; bucket++) {
+        for (book_level_t* level = book->far[bucket]; level; level = level->far_next) {
+            if (level->side != side) continue;
+            if (after != BOOK_NO_PRICE && !tick_better(side, after, level->tick)) continue;
+            if (best == BOOK_NO_PRICE || tick_better(side, level->tick, best)) best = level->tick;
+        }
+    }
+    return best;
+}
+
+// Next best after the level at 'after' has gone. While no far level beats
+// the window, a hit in the window is the answer without looking further.
+static int32_t book_next_best(const order_book_t* book, uint8_t side, int32_t after) {
+    if (!book->far_better[side]) {
+        int32_t tick = window_scan(book, side, after);
+        if (tick != BOOK_NO_PRICE) return tick;
+    }
+    return far_scan(book, side, after);
+}
+
+// Move the window to start at 'base': levels left outside go to the far
+// hash first, so the slots of the far levels coming in are free. Levels
+// never outnumber orders, and the level pool has no per-CPU magazines to
+// strand free levels in, so it cannot run dry.
+static void book_recentre(order_book_t* book, int32_t base) {
+    book->base = base;
+    for (uint8_t side = BOOK_BID; side <= BOOK_ASK; side++) {
+        for (uint32_t i = 0; i < BOOK_WINDOW; i++) {
+            book_level_t* level = &book->window[side][i];
+            if (!level->orders || tick_within(base, level->tick)) continue;
+
+            book_level_t* far = (book_level_t*)pool_alloc(book->level_pool);
+            *far = *level;
+            far_link(book, far);
+            window_clear(book, side, level->tick);
+            level->orders = 0;
+            level->head = level->tail = NULL;
+        }
+    }
+
+    book->far_better[BOOK_BID] = book->far_better[BOOK_ASK] = 0;
+    for (uint32_t bucket = 0; bucket < BOOK_FAR_BUCKETS; bucket++) {
+        book_level_t** link = &book->far[bucket];
+        while (*link) {
+            book_level_t* level = *link;
+            if (!tick_within(base, level->tick)) {
+                if (far_is_better(book, level->side, level->tick)) book->far_better[level->side]++;
+                link = &level->far_next;
+                continue;
+            }
+
+            *link = level->far_next;
+            book_level_t* slot = &book->window[level->side][(uint32_t)level->tick & WINDOW_MASK];
+            *slot = *level;
+            slot->far_next = NULL;
+            window_mark(book, level->side, level->tick);
+            book->far_levels[level->side]--;
+            pool_free(book->level_pool, level);
+        }
+    }
+    book->recentres++;
+}
+
+// Keep the touch in the window: centre on the mid, or on the bid when the
+// spread is too wide for both. Only moves if a best comes in by it.
+static void book_check_window(order_book_t* book) {
+    int32_t bid = book->best[BOOK_BID];
+    int32_t ask = book->best[BOOK_ASK];
+    bool bid_out = bid != BOOK_NO_PRICE && !tick_within(book->base, bid);
+    bool ask_out = ask != BOOK_NO_PRICE && !tick_within(book->base, ask);
+    if (!bid_out && !ask_out) return;
+
+    int32_t centre;
+    if (bid != BOOK_NO_PRICE && ask != BOOK_NO_PRICE && ask > bid && ask - bid < BOOK_WINDOW) {
+        centre = bid + (ask - bid) / 2;
+    } else {
+        centre = bid != BOOK_NO_PRICE ? bid : ask;
+    }
+    int32_t base = centre - BOOK_WINDOW / 2;
+    if ((bid_out && tick_within(base, bid)) || (ask_out && tick_within(base, ask))) {
+        book_recentre(book, base);
+    }
+}
+
+static void book_free(order_book_t* book) {
+    destroy_memory_pool(book->order_pool);
+    destroy_memory_pool(book->level_pool);
+    kfree(book->orders);
+    kfree(book);
+}
+
+order_book_t* book_create(uint16_t symbol_id, double tick_size, uint32_t max_orders) {
+    if (symbol_id >= BOOK_MAX_SYMBOLS || books[symbol_id] || !(tick_size > 0) ||
+        max_orders == 0 || max_orders > BOOK_MAX_ORDERS) {
+        return NULL;
+    }
+
+    order_book_t* book = (order_book_t*)kmalloc(sizeof(order_book_t));
+    if (!book) return NULL;
+    memset(book, 0, sizeof(order_book_t));
+    book->symbol_id = symbol_id;
+    book->tick_size = tick_size;
+    book->ticks_per_unit = 1.0 / tick_size;
+    book->best[BOOK_BID] = book->best[BOOK_ASK] = BOOK_NO_PRICE;
+
+    uint32_t buckets = 1;
+    while (buckets < max_orders) {
+        buckets <<= 1;
+    }
+    book->orders = (book_order_t**)kmalloc(buckets * sizeof(book_order_t*));
+    book->order_mask = buckets - 1;
+    book->order_pool = create_memory_pool(sizeof(book_order_t), max_orders);
+    book->level_pool = create_memory_pool_uncached(sizeof(book_level_t), max_orders);
+    if (!book->orders || !book->order_pool || !book->level_pool) {
+        book_free(book);
+        return NULL;
+    }
+    memset(book->orders, 0, buckets * sizeof(book_order_t*));
+
+    books[symbol_id] = book;
+    return book;
+}
+
+void book_destroy(order_book_t* book) {
+    if (!book) return;
+
+    if (books[book->symbol_id] == book) {
+        books[book->symbol_id] = NULL;
+    }
+    book_free(book);
+}
+
+order_book_t* book_lookup(uint16_t symbol_id) {
+    return symbol_id < BOOK_MAX_SYMBOLS ? books[symbol_id] : NULL;
+}
+
+int32_t book_price_to_tick(const order_book_t* book, double price) {
+    double ticks = price * book->ticks_per_unit;
+    return (int32_t)(ticks >= 0 ? ticks + 0.5 : ticks - 0.5);
+}
+
+double book_tick_to_price(const order_book_t* book, int32_t tick) {
+    return tick * book->tick_size;
+}
+
+book_order_t* book_find(order_book_t* book, uint32_t order_id) {
+    book_order_t* order = book->orders[order_id & book->order_mask];
+    while (order && order->order_id != order_id) {
+        order = order->hash_next;
+    }
+    return order;
+}
+
+int book_add(order_book_t* book, uint32_t order_id, uint8_t side, int32_t tick,
+             uint64_t quantity, uint64_t timestamp, uint32_t client_id) {
+    if (!book) return -1;
+    if (side > BOOK_ASK || quantity == 0 || tick == BOOK_NO_PRICE || book_find(book, order_id)) {
+        book->rejects++;
+        return -1;
+    }
+
+    book_order_t* order = (book_order_t*)pool_alloc(book->order_pool);
+    book_level_t* level = order ? level_get(book, side, tick) : NULL;
+    if (!level) {
+        if (order) pool_free(book->order_pool, order);
+        book->rejects++;
+        return -1;
+    }
+
+    order->order_id = order_id;
+    order->tick = tick;
+    order->quantity = quantity;
+    order->timestamp = timestamp;
+    order->client_id = client_id;
+    order->side = side;
+
+    // Joins the back of the queue at its price
+    order->next = NULL;
+    order->prev = level->tail;
+    if (level->tail) {
+        level->tail->next = order;
+    } else {
+        level->head = order;
+    }
+    level->tail = order;
+    level->quantity += quantity;
+    level->orders++;
+
+    book_order_t** bucket = &book->orders[order_id & book->order_mask];
+    order->hash_next = *bucket;
+    *bucket = order;
+    book->order_count++;
+    book->adds++;
+
+    if (book->best[side] == BOOK_NO_PRICE || tick_better(side, tick, book->best[side])) {
+        book->best[side] = tick;
+        book_check_window(book);
+    }
+    return 0;
+}
+
+static void book_remove(order_book_t* book, book_order_t* order) {
+    book_order_t** link = &book->orders[order->order_id & book->order_mask];
+    while (*link != order) {
+        link = &(*link)->hash_next;
+    }
+    *link = order->hash_next;
+    book->order_count--;
+
+    uint8_t side = order->side;
+    book_level_t* level = level_find(book, side, order->tick);
+    if (order->prev) {
+        order->prev->next = order->next;
+    } else {
+        level->head = order->next;
+    }
+    if (order->next) {
+        order->next->prev = order->prev;
+    } else {
+        level->tail = order->prev;
+    }
+    level->quantity -= order->quantity;
+    level->orders--;
+
+    if (!level->orders) {
+        level_remove(book, level);
+        if (order->tick == book->best[side]) {
+            book->best[side] = book_next_best(book, side, order->tick);
+            book_check_window(book);
+        }
+    }
+    pool_free(book->order_pool, order);
+}
+
+int book_cancel(order_book_t* book, uint32_t order_id) {
+    if (!book) return -1;
+
+    book_order_t* order = book_find(book, order_id);
+    if (!order) {
+        book->rejects++;
+        return -1;
+    }
+    book_remove(book, order);
+    book->cancels++;
+    return 0;
+}
+
+int book_execute(order_book_t* book, uint32_t order_id, uint64_t quantity) {
+    if (!book) return -1;
+
+    book_order_t* order = book_find(book, order_id);
+    if (!order || quantity == 0) {
+        book->rejects++;
+        return -1;
+    }
+
+    book->executions++;
+    if (quantity >= order->quantity) {
+        book_remove(book, order);
+    } else {
+        order->quantity -= quantity;
+        level_find(book, order->side, order->tick)->quantity -= quantity;
+    }
+    return 0;
+}
+
+int32_t book_best(order_book_t* book, uint8_t side, uint64_t* quantity, uint32_t* orders) {
+    int32_t tick = side <= BOOK_ASK ? book->best[side] : BOOK_NO_PRICE;
+    book_level_t* level = tick != BOOK_NO_PRICE ? level_find(book, side, tick) : NULL;
+    if (quantity) *quantity = level ? level->quantity : 0;
+    if (orders) *orders = level ? level->orders : 0;
+    return tick;
+}
+
+int book_apply(order_book_t* book, const order_t* order) {
+    if (!book || !order) return -1;
+    if (order->type == 0) return 0;
+
+    switch (order->status) {
+        case 0:
+            if (book_find(book, order->order_id)) {
+                book_cancel(book, order->order_id);
+            }
+            return book_add(book, order->order_id, order->side, book_price_to_tick(book, order->price),
+                            order->quantity, order->timestamp, order->client_id);
+        case 1:
+            return book_execute(book, order->order_id, order->quantity);
+        case 2:
+            return book_cancel(book, order->order_id);
+    }
+    book->rejects++;
+    return -1;
+}
+
+uint32_t book_feed(lockfree_ringbuf_t* ring, uint32_t max) {
+    if (!ring || ring->element_size != sizeof(order_t)) return 0;
+
+    uint32_t consumed = 0;
+    while (consumed < max) {
+        uint32_t avail;
+        const order_t* events = (const order_t*)ringbuf_peek(ring, max - consumed, &avail);
+        if (!events) break;
+
+        for (uint32_t i = 0; i < avail; i++) {
+            order_book_t* book = book_lookup(events[i].symbol_id);
+            if (book) book_apply(book, &events[i]);
+        }
+        ringbuf_release(ring, avail);
+        consumed += avail;
+    }
+    return consumed;
+}
+
+static void book_print_level(order_book_t* book, uint8_t side, int32_t tick) {
+    book_level_t* level = level_find(book, side, tick);
+    vga_write_string(side == BOOK_BID ? "  bid " : "  ask ");
+    print_dec((uint32_t)tick);
+    vga_write_string(" x ");
+    print_dec((uint32_t)level->quantity);
+    vga_write_string(" (");
+    print_dec(level->orders);
+    vga_write_string(level->orders == 1 ? " order)\n" : " orders)\n");
+}
+
+void book_print(order_book_t* book, uint32_t depth) {
+    if (!book) return;
+
+    vga_write_string("Book for symbol ");
+    print_dec(book->symbol_id);
+    vga_write_string(": ");
+    print_dec(book->order_count);
+    vga_write_string(" orders, ");
+    print_dec(book->far_levels[BOOK_BID] + book->far_levels[BOOK_ASK]);
+    vga_write_string(" far levels, ");
+    print_dec(book->recentres);
+    vga_write_string(" recentres\n");
+
+    // Asks from the worst shown down to the touch, then bids downwards
+    int32_t asks[16];
+    uint32_t shown = 0;
+    if (depth > 16) depth = 16;
+    for (int32_t tick = book->best[BOOK_ASK]; tick != BOOK_NO_PRICE && shown < depth; shown++) {
+        asks[shown] = tick;
+        int32_t near = window_scan(book, BOOK_ASK, tick);
+        int32_t far = far_scan(book, BOOK_ASK, tick);
+        tick = (near == BOOK_NO_PRICE || (far != BOOK_NO_PRICE && far < near)) ? far : near;
+    }
+    while (shown) {
+        book_print_level(book, BOOK_ASK, asks[--shown]);
+    }
+    for (int32_t tick = book->best[BOOK_BID]; tick != BOOK_NO_PRICE && shown < depth; shown++) {
+        book_print_level(book, BOOK_BID, tick);
+        int32_t near = window_scan(book, BOOK_BID, tick);
+        int32_t far = far_scan(book, BOOK_BID, tick);
+        tick = (near == BOOK_NO_PRICE || (far != BOOK_NO_PRICE && far > near)) ? far : near;
+    }
+}
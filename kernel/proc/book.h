@@ -0,0 +1,107 @@
+#ifndef BOOK_H
+#define BOOK_H
+
+#include "../types.h"
+#include "../mm/memory.h"
+#include "ipc.h"
+
+// Limit order book per symbol, built from the order events of a feed.
+// Prices are kept in ticks. Levels near the touch sit in an array window of
+// BOOK_WINDOW ticks per side, indexed by tick modulo the window, with a
+// bitmap of the levels in use; levels further out hang off a small hash and
+// are pulled into the window when the touch moves to them. Each level holds
+// its orders in arrival order on an intrusive list, and orders are found by
+// id through a hash, so adding, cancelling and executing an order are O(1)
+// and the best bid and ask are kept as orders come and go.
+//
+// Order nodes and far levels come from memory pools sized at creation; a
+// book holds at most max_orders orders. One writer (the feed handler) at a
+// time, no locking.
+#define BOOK_WINDOW             256         // Ticks per side held in the array, power of two
+#define BOOK_FAR_BUCKETS        64          // Power of two
+#define BOOK_MAX_SYMBOLS        1024
+#define BOOK_NO_PRICE           ((int32_t)0x80000000)
+
+#define BOOK_BID                0
+#define BOOK_ASK                1
+
+typedef struct book_order {
+    struct book_order* next;    // Later order at the same level
+    struct book_order* prev;
+    struct book_order* hash_next;
+    uint32_t order_id;
+    int32_t tick;
+    uint64_t quantity;          // Still open
+    uint64_t timestamp;
+    uint32_t client_id;
+    uint8_t side;
+} book_order_t;
+
+typedef struct book_level {
+    book_order_t* head;         // Oldest order, first to fill
+    book_order_t* tail;
+    uint64_t quantity;          // Sum over the orders
+    uint32_t orders;            // 0 = unused window slot
+    int32_t tick;
+    uint8_t side;
+    struct book_level* far_next; // Far levels only
+} book_level_t;
+
+typedef struct {
+    uint16_t symbol_id;
+    double tick_size;
+    double ticks_per_unit;      // 1 / tick_size
+    int32_t base;               // Window covers [base, base + BOOK_WINDOW)
+    int32_t best[2];            // Ticks, BOOK_NO_PRICE if the side is empty
+    book_level_t window[2][BOOK_WINDOW];
+    uint32_t window_map[2][BOOK_WINDOW / 32];
+    book_level_t* far[BOOK_FAR_BUCKETS];
+    uint32_t far_levels[2];
+    uint32_t far_better[2];     // Far levels better than the whole window
+    book_order_t** orders;      // order_id hash
+    uint32_t order_mask;
+    uint32_t order_count;
+    memory_pool_t* order_pool;
+    memory_pool_t* level_pool;
+    uint64_t adds;
+    uint64_t cancels;
+    uint64_t executions;
+    uint64_t rejects;
+    uint32_t recentres;
+} order_book_t;
+
+// A book for symbol_id, registered for book_lookup and book_feed. NULL if
+// one exists already, the id is out of range or memory runs out.
+order_book_t* book_create(uint16_t symbol_id, double tick_size, uint32_t max_orders);
+void book_destroy(order_book_t* book);
+order_book_t* book_lookup(uint16_t symbol_id);
+
+// Price in ticks, rounded to the nearest
+int32_t book_price_to_tick(const order_book_t* book, double price);
+double book_tick_to_price(const order_book_t* book, int32_t tick);
+
+// 0 or -1: duplicate or unknown id, zero quantity, bad side, book full.
+// An execution takes quantity off the order and removes it once filled.
+int book_add(order_book_t* book, uint32_t order_id, uint8_t side, int32_t tick,
+             uint64_t quantity, uint64_t timestamp, uint32_t client_id);
+int book_cancel(order_book_t* book, uint32_t order_id);
+int book_execute(order_book_t* book, uint32_t order_id, uint64_t quantity);
+book_order_t* book_find(order_book_t* book, uint32_t order_id);
+
+// Best price of a side in ticks (BOOK_NO_PRICE if empty) with the
+// quantity and order count there
+int32_t book_best(order_book_t* book, uint8_t side, uint64_t* quantity, uint32_t* orders);
+
+// One order event: status pending adds (or replaces, losing priority),
+// filled executes 'quantity' and cancelled removes. Market orders do not
+// rest and are ignored.
+int book_apply(order_book_t* book, const order_t* order);
+
+// Apply up to 'max' order_t events from a feed ring, in place, each to the
+// book of its symbol; events for symbols without a book are dropped.
+// Returns how many were consumed.
+uint32_t book_feed(lockfree_ringbuf_t* ring, uint32_t max);
+
+void book_print(order_book_t* book, uint32_t depth);
+
+#endif // BOOK_H
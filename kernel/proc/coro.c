@@ -0,0 +1,363 @@
+#include "coro.h"
+#include "process.h"
+#include "futex.h"
+#include "../arch/spinlock.h"
+#include "../arch/tsc.h"
+#include "../arch/div64.h"
+#include "../mm/memory.h"
+#include "../drivers/vga.h"
+
+extern void coro_switch(uint32_t* save_esp, uint32_t load_esp);
+
+typedef struct {
+    uint32_t spawned;
+    uint32_t active;
+    uint32_t peak;
+    uint32_t exhausted;             // Spawns refused, pool empty
+    uint32_t overflows;             // Stacks found with the magic overwritten
+} coro_stats_t;
+
+static coro_t coro_pool[CORO_POOL_SIZE];
+static uint8_t coro_stacks[CORO_POOL_SIZE][CORO_STACK_SIZE] __attribute__((aligned(16)));
+static coro_t* coro_free_list = NULL;
+static spinlock_t coro_pool_lock = SPINLOCK_INIT;
+static coro_stats_t coro_stats;
+static uint32_t coro_next_id = 1;
+
+void coro_init(void) {
+    for (int i = CORO_POOL_SIZE - 1; i >= 0; i--) {
+        coro_pool[i].state = CORO_FREE;
+        coro_pool[i].stack = coro_stacks[i];
+        coro_pool[i].next = coro_free_list;
+        coro_free_list = &coro_pool[i];
+    }
+}
+
+void coro_sched_init(coro_sched_t* sched) {
+    memset(sched, 0, sizeof(coro_sched_t));
+}
+
+static void coro_release(coro_t* coro) {
+    if (*(uint32_t*)coro->stack != CORO_STACK_MAGIC) {
+        __sync_fetch_and_add(&coro_stats.overflows, 1);
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("coro: stack overflow in ");
+        vga_write_string(coro->name ? coro->name : "?");
+        vga_write_string("\n");
+    }
+
+    uint32_t flags = spin_lock_irqsave(&coro_pool_lock);
+    coro->state = CORO_FREE;
+    coro->next = coro_free_list;
+    coro_free_list = coro;
+    coro_stats.active--;
+    spin_unlock_irqrestore(&coro_pool_lock, flags);
+}
+
+static void coro_enqueue(coro_sched_t* sched, coro_t* coro) {
+    coro->state = CORO_READY;
+    coro->next = NULL;
+    if (sched->run_tail) {
+        sched->run_tail->next = coro;
+    } else {
+        sched->run_head = coro;
+    }
+    sched->run_tail = coro;
+}
+
+static coro_t* coro_dequeue(coro_sched_t* sched) {
+    coro_t* coro = sched->run_head;
+    if (coro) {
+        sched->run_head = coro->next;
+        if (!sched->run_head) sched->run_tail = NULL;
+        coro->next = NULL;
+    }
+    return coro;
+}
+
+// Move waiters whose word changed or whose time ran out to the run queue
+static void coro_poll_waiters(coro_sched_t* sched) {
+    if (!sched->waiters) return;
+    uint32_t now = get_current_time_ms();
+
+    coro_t** link = &sched->waiters;
+    while (*link) {
+        coro_t* coro = *link;
+        bool changed = *coro->wait_addr != coro->wait_value;
+        bool expired = coro->wait_timed && (int32_t)(now - coro->wait_deadline) >= 0;
+        if (changed || expired) {
+            *link = coro->next;
+            coro->timed_out = !changed;
+            coro->wait_addr = NULL;
+            coro_enqueue(sched, coro);
+        } else {
+            link = &coro->next;
+        }
+    }
+}
+
+// First switch into a coroutine returns here with it as the argument
+static void coro_start(coro_t* coro) {
+    coro->entry(coro->arg);
+
+    // Off this stack before it is reused: coro_run releases it
+    coro_sched_t* sched = coro->sched;
+    coro->state = CORO_DEAD;
+    coro_switch(&coro->esp, sched->esp);
+}
+
+coro_t* coro_spawn(coro_sched_t* sched, coro_fn_t entry, void* arg, const char* name) {
+    if (!sched || !entry) return NULL;
+
+    uint32_t flags = spin_lock_irqsave(&coro_pool_lock);
+    coro_t* coro = coro_free_list;
+    if (!coro) {
+        coro_stats.exhausted++;
+        spin_unlock_irqrestore(&coro_pool_lock, flags);
+        return NULL;
+    }
+    coro_free_list = coro->next;
+    coro->id = coro_next_id++;
+    coro_stats.spawned++;
+    if (++coro_stats.active > coro_stats.peak) coro_stats.peak = coro_stats.active;
+    spin_unlock_irqrestore(&coro_pool_lock, flags);
+
+    coro->entry = entry;
+    coro->arg = arg;
+    coro->name = name;
+    coro->sched = sched;
+    coro->switches = 0;
+    coro->wait_addr = NULL;
+    coro->timed_out = false;
+    *(uint32_t*)coro->stack = CORO_STACK_MAGIC;
+
+    // Layout coro_switch pops: edi, esi, ebx, ebp, then 'return' into
+    // coro_start with a dummy return address and its argument above
+    uint32_t* sp = (uint32_t*)(coro->stack + CORO_STACK_SIZE);
+    *--sp = (uint32_t)coro;
+    *--sp = 0;
+    *--sp = (uint32_t)coro_start;
+    for (int i = 0; i < 4; i++) {
+        *--sp = 0;
+    }
+    coro->esp = (uint32_t)sp;
+
+    sched->live++;
+    coro_enqueue(sched, coro);
+    return coro;
+}
+
+static coro_sched_t* coro_current_sched(void) {
+    process_t* self = current_process;
+    return self ? self->coro_sched : NULL;
+}
+
+coro_t* coro_self(void) {
+    coro_sched_t* sched = coro_current_sched();
+    return sched ? sched->current : NULL;
+}
+
+// Leave 'self' (already queued or parked) for the next ready coroutine,
+// or for coro_run when there is none
+static void coro_switch_away(coro_sched_t* sched, coro_t* self) {
+    coro_t* next = coro_dequeue(sched);
+    if (!next) {
+        coro_switch(&self->esp, sched->esp);
+    } else if (next != self) {
+        sched->current = next;
+        next->state = CORO_RUNNING;
+        next->switches++;
+        sched->switches++;
+        coro_switch(&self->esp, next->esp);
+    }
+    // Resumed: whoever switched to us made us current
+    self->state = CORO_RUNNING;
+}
+
+void coro_yield(void) {
+    coro_sched_t* sched = coro_current_sched();
+    coro_t* self = sched ? sched->current : NULL;
+    if (!self) {
+        scheduler_yield();
+        return;
+    }
+
+    coro_poll_waiters(sched);
+    if (!sched->run_head) return;      // Nobody else to run
+    coro_enqueue(sched, self);
+    coro_switch_away(sched, self);
+}
+
+int coro_wait(volatile uint32_t* addr, uint32_t expected, uint32_t timeout_ms) {
+    coro_sched_t* sched = coro_current_sched();
+    coro_t* self = sched ? sched->current : NULL;
+    if (!self) {
+        return futex_wait(addr, expected, timeout_ms);
+    }
+    if (*addr != expected) return 0;
+    if (timeout_ms == 0) return -1;
+
+    self->wait_addr = addr;
+    self->wait_value = expected;
+    self->wait_timed = timeout_ms != CORO_WAIT_FOREVER;
+    self->wait_deadline = get_current_time_ms() + timeout_ms;
+    self->timed_out = false;
+    self->state = CORO_WAITING;
+    self->next = sched->waiters;
+    sched->waiters = self;
+
+    coro_poll_waiters(sched);
+    coro_switch_away(sched, self);
+    return self->timed_out ? -1 : 0;
+}
+
+void coro_sleep_ms(uint32_t ms) {
+    static volatile uint32_t never_changes = 0;
+    if (!coro_self()) {
+        process_sleep(current_process, ms);
+        return;
+    }
+    coro_wait(&never_changes, 0, ms);
+}
+
+int coro_msgrcv(uint32_t msgid, message_t* msg, uint32_t size, uint32_t type, uint32_t timeout_ms) {
+    uint32_t deadline = get_current_time_ms() + timeout_ms;
+    while (1) {
+        volatile uint32_t* word = msgq_send_seq(msgid);
+        if (!word) return -1;
+        uint32_t seen = *word;
+        int received = msgrcv_timeout(msgid, msg, size, type, 0);
+        if (received >= 0) return received;
+
+        uint32_t wait = CORO_WAIT_FOREVER;
+        if (timeout_ms != CORO_WAIT_FOREVER) {
+            int32_t remaining = (int32_t)(deadline - get_current_time_ms());
+            if (remaining <= 0) return -1;
+            wait = (uint32_t)remaining;
+        }
+        coro_wait(word, seen, wait);
+    }
+}
+
+int coro_pipe_read(pipe_t* pipe, void* buffer, uint32_t count) {
+    if (!pipe) return -1;
+    while (1) {
+        uint32_t seen = pipe->write_seq;
+        int got = pipe_read(pipe, buffer, count, IPC_NOWAIT);
+        if (got >= 0) return got;
+        coro_wait(&pipe->write_seq, seen, CORO_WAIT_FOREVER);
+    }
+}
+
+// Nothing ready: sleep until the first waiter's word moves, a bounded
+// time since the other waiters are not being watched
+static void coro_idle(coro_sched_t* sched) {
+    coro_t* waiter = sched->waiters;
+    uint32_t timeout = CORO_IDLE_POLL_MS;
+    if (waiter->wait_timed) {
+        int32_t remaining = (int32_t)(waiter->wait_deadline - get_current_time_ms());
+        if (remaining <= 0) return;
+        if ((uint32_t)remaining < timeout) timeout = (uint32_t)remaining;
+    }
+    sched->idle_sleeps++;
+    futex_wait(waiter->wait_addr, waiter->wait_value, timeout);
+}
+
+int coro_run(coro_sched_t* sched) {
+    process_t* self = current_process;
+    if (!sched || !self || self->coro_sched) return -1;
+    self->coro_sched = sched;
+
+    while (sched->live) {
+        // Back from a coroutine that finished or parked with nothing ready
+        coro_t* last = sched->current;
+        sched->current = NULL;
+        if (last && last->state == CORO_DEAD) {
+            sched->live--;
+            coro_release(last);
+        }
+
+        coro_poll_waiters(sched);
+        coro_t* next = coro_dequeue(sched);
+        if (!next) {
+            if (sched->waiters) coro_idle(sched);
+            continue;
+        }
+
+        sched->current = next;
+        next->state = CORO_RUNNING;
+        next->switches++;
+        sched->switches++;
+        coro_switch(&sched->esp, next->esp);
+    }
+
+    self->coro_sched = NULL;
+    return 0;
+}
+
+void coro_print_info(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Coroutines ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string("Pool: ");
+    print_dec(coro_stats.active);
+    vga_write_string("/");
+    print_dec(CORO_POOL_SIZE);
+    vga_write_string(" in use (");
+    print_dec(CORO_STACK_SIZE);
+    vga_write_string(" byte stacks)  Peak: ");
+    print_dec(coro_stats.peak);
+    vga_write_string("\nSpawned: ");
+    print_dec(coro_stats.spawned);
+    vga_write_string("  Refused: ");
+    print_dec(coro_stats.exhausted);
+    vga_write_string("  Stack overflows: ");
+    print_dec(coro_stats.overflows);
+    vga_write_string("\n");
+}
+
+typedef struct {
+    uint32_t rounds;
+} coro_bench_arg_t;
+
+static void coro_bench_task(void* arg) {
+    coro_bench_arg_t* bench = (coro_bench_arg_t*)arg;
+    for (uint32_t i = 0; i < bench->rounds; i++) {
+        coro_yield();
+    }
+}
+
+// Two coroutines yielding to each other: every yield is one switch
+void coro_bench(uint32_t switches) {
+    if (!current_process || !tsc_available()) {
+        vga_write_string("coro bench needs a process and a calibrated TSC\n");
+        return;
+    }
+
+    coro_sched_t sched;
+    coro_sched_init(&sched);
+    coro_bench_arg_t arg = { switches / 2 };
+    if (!coro_spawn(&sched, coro_bench_task, &arg, "bench_a") ||
+        !coro_spawn(&sched, coro_bench_task, &arg, "bench_b")) {
+        vga_write_string("Coroutine pool exhausted\n");
+        while (sched.run_head) {
+            coro_t* coro = coro_dequeue(&sched);
+            coro_release(coro);
+        }
+        return;
+    }
+
+    uint64_t start = rdtsc();
+    coro_run(&sched);
+    uint64_t cycles = rdtsc() - start;
+    uint32_t count = sched.switches ? sched.switches : 1;
+
+    vga_write_string("Coroutine switches: ");
+    print_dec(sched.switches);
+    vga_write_string("  ");
+    print_dec((uint32_t)div_u64_u32(cycles, count, NULL));
+    vga_write_string(" cycles  ");
+    print_dec((uint32_t)div_u64_u32(tsc_cycles_to_ns(cycles), count, NULL));
+    vga_write_string(" ns each\n");
+}
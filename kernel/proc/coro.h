@@ -0,0 +1,83 @@
+#ifndef CORO_H
+#define CORO_H
+
+#include "../types.h"
+#include "syscalls.h"
+#include "ipc.h"
+
+// Cooperative coroutines inside one process. Each has a small stack from a
+// global pool and switches by saving four registers, so one SCHED_FIFO
+// process can multiplex many per-symbol state machines without a process,
+// a kernel stack or a trip through the scheduler each. Yields hand over
+// straight to the next ready coroutine; waits park a coroutine on a word
+// (message queue and pipe sequence counters for IPC readiness) that is
+// polled at every switch. With nothing ready the process itself sleeps on
+// the first waiter's word, for at most CORO_IDLE_POLL_MS, since the others
+// cannot be watched at the same time.
+#define CORO_POOL_SIZE          128
+#define CORO_STACK_SIZE         2048
+#define CORO_STACK_MAGIC        0xC0DE57AC  // Bottom of every stack, checked on release
+#define CORO_IDLE_POLL_MS       1
+#define CORO_WAIT_FOREVER       0xFFFFFFFF
+
+typedef enum {
+    CORO_FREE = 0,
+    CORO_READY,
+    CORO_RUNNING,
+    CORO_WAITING,
+    CORO_DEAD
+} coro_state_t;
+
+typedef void (*coro_fn_t)(void* arg);
+
+struct coro_sched;
+
+typedef struct coro {
+    uint32_t esp;                   // Saved stack pointer while switched out
+    coro_state_t state;
+    coro_fn_t entry;
+    void* arg;
+    uint8_t* stack;
+    struct coro_sched* sched;
+    struct coro* next;              // Run queue or wait list link
+    volatile uint32_t* wait_addr;   // Parked until *wait_addr != wait_value
+    uint32_t wait_value;
+    uint32_t wait_deadline;         // ms, when wait_timed
+    bool wait_timed;
+    bool timed_out;
+    uint32_t id;
+    const char* name;
+    uint32_t switches;              // Times switched in
+} coro_t;
+
+typedef struct coro_sched {
+    uint32_t esp;                   // coro_run's own stack while a coroutine runs
+    coro_t* current;
+    coro_t* run_head;               // FIFO of ready coroutines
+    coro_t* run_tail;
+    coro_t* waiters;
+    uint32_t live;                  // Spawned and not finished
+    uint32_t switches;
+    uint32_t idle_sleeps;           // Times the process slept with nothing ready
+} coro_sched_t;
+
+void coro_init(void);
+void coro_sched_init(coro_sched_t* sched);
+coro_t* coro_spawn(coro_sched_t* sched, coro_fn_t entry, void* arg, const char* name);
+
+// Run coroutines until all have returned (process context, not nested).
+// Returns 0, or -1 if the process already runs a coroutine scheduler.
+int coro_run(coro_sched_t* sched);
+
+// Inside a coroutine (outside one these fall back to the process calls)
+coro_t* coro_self(void);
+void coro_yield(void);
+int coro_wait(volatile uint32_t* addr, uint32_t expected, uint32_t timeout_ms);  // -1 on timeout
+void coro_sleep_ms(uint32_t ms);
+int coro_msgrcv(uint32_t msgid, message_t* msg, uint32_t size, uint32_t type, uint32_t timeout_ms);
+int coro_pipe_read(pipe_t* pipe, void* buffer, uint32_t count);
+
+void coro_print_info(void);
+void coro_bench(uint32_t switches);
+
+#endif // CORO_H
@@ -0,0 +1,193 @@
+#include "futex.h"
+#include "process.h"
+#include "scheduler.h"
+#include "../arch/tsc.h"
+#include "../arch/smp.h"
+#include "../drivers/vga.h"
+
+typedef struct {
+    spinlock_t lock;
+    process_t* waiters;         // FIFO through process->futex_next
+    uint32_t spin_us;           // Adaptive spin budget
+} __cacheline_aligned futex_bucket_t;
+
+static futex_bucket_t futex_hash[FUTEX_HASH_SIZE];
+static futex_stats_t futex_stats;
+
+static inline futex_bucket_t* futex_bucket(volatile uint32_t* addr) {
+    uint32_t hash = ((uint32_t)addr >> 2) * 2654435761u;
+    return &futex_hash[hash >> (32 - FUTEX_HASH_BITS)];
+}
+
+void futex_init(void) {
+    for (uint32_t i = 0; i < FUTEX_HASH_SIZE; i++) {
+        spin_lock_init(&futex_hash[i].lock);
+        futex_hash[i].waiters = NULL;
+        futex_hash[i].spin_us = FUTEX_SPIN_MIN_US;
+    }
+}
+
+// Unlink a waiter (bucket lock held)
+static void futex_unlink(futex_bucket_t* bucket, process_t* process) {
+    for (process_t** link = &bucket->waiters; *link; link = &(*link)->futex_next) {
+        if (*link == process) {
+            *link = process->futex_next;
+            break;
+        }
+    }
+    process->futex_next = NULL;
+    process->futex_key = NULL;
+}
+
+bool futex_spin(volatile uint32_t* addr, uint32_t expected) {
+    // Only another CPU can change the word while we spin
+    if (*addr != expected) return true;
+    if (smp_cpu_count() < 2 || !tsc_available()) return false;
+
+    futex_bucket_t* bucket = futex_bucket(addr);
+    uint32_t budget = bucket->spin_us;
+    uint64_t end = rdtsc() + tsc_ns_to_cycles((uint64_t)budget * NSEC_PER_USEC);
+
+    while ((int64_t)(rdtsc() - end) < 0) {
+        if (*addr != expected) {
+            // Worth it: allow a little longer next time (racy on purpose)
+            if (budget < FUTEX_SPIN_MAX_US) {
+                bucket->spin_us = budget * 2 > FUTEX_SPIN_MAX_US ? FUTEX_SPIN_MAX_US : budget * 2;
+            }
+            __sync_fetch_and_add(&futex_stats.spin_hits, 1);
+            return true;
+        }
+        cpu_relax();
+    }
+
+    if (budget > FUTEX_SPIN_MIN_US) {
+        bucket->spin_us = budget / 2 < FUTEX_SPIN_MIN_US ? FUTEX_SPIN_MIN_US : budget / 2;
+    }
+    return false;
+}
+
+int futex_wait(volatile uint32_t* addr, uint32_t expected, uint32_t timeout_ms) {
+    process_t* self = current_process;
+    __sync_fetch_and_add(&futex_stats.waits, 1);
+
+    if (futex_spin(addr, expected)) {
+        return 0;
+    }
+    if (!self || self == idle_process || timeout_ms == 0) {
+        return -1;
+    }
+
+    futex_bucket_t* bucket = futex_bucket(addr);
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+    if (*addr != expected) {
+        spin_unlock_irqrestore(&bucket->lock, flags);
+        return 0;
+    }
+
+    // Append, so equal waiters are woken in arrival order
+    process_t** link = &bucket->waiters;
+    while (*link) {
+        link = &(*link)->futex_next;
+    }
+    self->futex_next = NULL;
+    self->futex_key = addr;
+    *link = self;
+
+    // Blocked before the bucket lock drops: futex_wake cannot slip past
+    process_set_state(self, PROCESS_BLOCKED);
+    spin_unlock_irqrestore(&bucket->lock, flags);
+    __sync_fetch_and_add(&futex_stats.blocks, 1);
+
+    if (timeout_ms == FUTEX_WAIT_FOREVER) {
+        uint32_t irq = irq_save();
+        if (self->state == PROCESS_BLOCKED) {
+            scheduler_yield();
+        }
+        irq_restore(irq);
+    } else {
+        process_block_timeout(self, timeout_ms);
+    }
+
+    // Still queued means nobody woke us
+    flags = spin_lock_irqsave(&bucket->lock);
+    bool queued = self->futex_key == addr;
+    if (queued) {
+        futex_unlink(bucket, self);
+    }
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    if (queued && timeout_ms != FUTEX_WAIT_FOREVER) {
+        __sync_fetch_and_add(&futex_stats.timeouts, 1);
+        return -1;
+    }
+    return 0;
+}
+
+int futex_wait_or_yield(volatile uint32_t* addr, uint32_t expected, uint32_t timeout_ms) {
+    int result = futex_wait(addr, expected, timeout_ms);
+    if (result < 0 && load_acquire(addr) == expected) {
+        scheduler_yield();
+    }
+    return result;
+}
+
+uint32_t futex_wake(volatile uint32_t* addr, uint32_t count) {
+    futex_bucket_t* bucket = futex_bucket(addr);
+    uint32_t woken = 0;
+
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+    process_t** link = &bucket->waiters;
+    while (*link && woken < count) {
+        process_t* waiter = *link;
+        if (waiter->futex_key != addr) {
+            link = &waiter->futex_next;
+            continue;
+        }
+        *link = waiter->futex_next;
+        waiter->futex_next = NULL;
+        waiter->futex_key = NULL;
+        process_unblock(waiter);
+        woken++;
+    }
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    if (woken) {
+        __sync_fetch_and_add(&futex_stats.wakeups, woken);
+    }
+    return woken;
+}
+
+void futex_cancel(process_t* process) {
+    volatile uint32_t* key = process->futex_key;
+    if (!key) return;
+
+    futex_bucket_t* bucket = futex_bucket(key);
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+    if (process->futex_key == key) {
+        futex_unlink(bucket, process);
+    }
+    spin_unlock_irqrestore(&bucket->lock, flags);
+}
+
+void futex_get_stats(futex_stats_t* stats) {
+    if (!stats) return;
+    *stats = futex_stats;
+}
+
+void futex_print_info(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Wait Queues ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string("Waits: ");
+    print_dec(futex_stats.waits);
+    vga_write_string("  Spin hits: ");
+    print_dec(futex_stats.spin_hits);
+    vga_write_string("  Blocked: ");
+    print_dec(futex_stats.blocks);
+    vga_write_string("  Woken: ");
+    print_dec(futex_stats.wakeups);
+    vga_write_string("  Timeouts: ");
+    print_dec(futex_stats.timeouts);
+    vga_write_string("\n");
+}
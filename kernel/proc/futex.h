@@ -0,0 +1,54 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include "../types.h"
+
+struct process;
+
+// Futex-style wait queues keyed by the address of a 32-bit word. A waiter
+// names the value it last saw; it only sleeps if the word still holds it,
+// checked under the hash bucket lock that wakers also take, so a change
+// followed by futex_wake can never be missed. Before sleeping a waiter
+// spins briefly when another CPU could be about to change the word; the
+// spin budget per bucket grows when spinning pays off and shrinks when
+// it does not.
+#define FUTEX_HASH_BITS         6
+#define FUTEX_HASH_SIZE         (1 << FUTEX_HASH_BITS)
+#define FUTEX_SPIN_MIN_US       2
+#define FUTEX_SPIN_MAX_US       50
+#define FUTEX_WAIT_FOREVER      0xFFFFFFFF
+#define FUTEX_WAKE_ALL          0xFFFFFFFF
+
+typedef struct {
+    uint32_t waits;             // futex_wait calls
+    uint32_t spin_hits;         // Value changed while spinning
+    uint32_t blocks;            // Waits that went to sleep
+    uint32_t wakeups;           // Processes woken by futex_wake
+    uint32_t timeouts;          // Sleeps that ran out
+} futex_stats_t;
+
+void futex_init(void);
+
+// Wait while *addr == expected. Returns 0 once woken or if the value
+// differs (callers recheck their condition), -1 on timeout or when the
+// caller cannot sleep (no process, or the idle process).
+int futex_wait(volatile uint32_t* addr, uint32_t expected, uint32_t timeout_ms);
+
+// futex_wait for callers that may be the boot CPU's idle context (the
+// shell), which cannot sleep: a wait refused there, with the word still
+// at 'expected', yields instead. Same return as futex_wait.
+int futex_wait_or_yield(volatile uint32_t* addr, uint32_t expected, uint32_t timeout_ms);
+
+// Spin phase only: true if *addr moved off 'expected' within the budget
+bool futex_spin(volatile uint32_t* addr, uint32_t expected);
+
+// Wake up to 'count' waiters on addr, returns how many were woken
+uint32_t futex_wake(volatile uint32_t* addr, uint32_t count);
+
+// Drop a dying process from any wait queue
+void futex_cancel(struct process* process);
+
+void futex_get_stats(futex_stats_t* stats);
+void futex_print_info(void);
+
+#endif // FUTEX_H
@@ -1,8 +1,19 @@
 #include "ipc.h"
 #include "../mm/memory.h"
+#include "../mm/magazine.h"
+#include "../mm/paging.h"
+#include "../mm/frame.h"
 #include "../drivers/vga.h"
 #include "process.h"
 #include "../arch/interrupts.h"
+#include "../arch/tsc.h"
+#include "futex.h"
+#include "mutex.h"
+#include "sequencer.h"
+#include "risk.h"
+#include "price.h"
+#include "portfolio.h"
+#include "journal.h"
 
 // Remove static memcpy/memset implementations - use the ones from memory.h
 
@@ -10,10 +21,20 @@
 static message_queue_t message_queues[MAX_MESSAGE_QUEUES];
 static semaphore_t semaphores[MAX_SEMAPHORES];
 static uint32_t next_msgq_id = 1;
+
+// Shared memory segments: physically contiguous frames, a single 4MB page
+// when the segment is that large (ipc_create_shared_memory)
+static shm_segment_t shm_segments[MAX_SHARED_SEGMENTS];
+static spinlock_t shm_lock = SPINLOCK_INIT;
+static uint32_t next_shm_id = 1;
 static uint32_t next_sem_id = 1;
 
-extern process_t* current_process;
-extern uint32_t get_ticks(void);
+// Trade signal fan-out; broadcasters take turns as its single producer
+static sequencer_t* trade_signals = NULL;
+static kmutex_t trade_signal_writer = KMUTEX_INIT("trade signals");
+
+// Per-symbol quotes, in a shared memory segment
+static md_table_t* market_snapshots = NULL;
 
 void ipc_init(void) {
     // Initialize message queues
@@ -22,7 +43,11 @@ void ipc_init(void) {
         message_queues[i].id = 0;
         message_queues[i].head = 0;
         message_queues[i].tail = 0;
+        message_queues[i].live = 0;
         message_queues[i].count = 0;
+        message_queues[i].ring = NULL;
+        message_queues[i].ring_size = 0;
+        poll_head_init(&message_queues[i].poll);
     }
     
     // Initialize semaphores
@@ -31,12 +56,157 @@ void ipc_init(void) {
         semaphores[i].id = 0;
         semaphores[i].value = 0;
         semaphores[i].wait_count = 0;
+        semaphores[i].pi.owner = NULL;
+        semaphores[i].pi.waiters = NULL;
+        semaphores[i].pi.held_next = NULL;
+        semaphores[i].pi.handoff = false;
     }
     
+    trade_signals = seq_create("trade signals", TRADE_SIGNAL_SLOTS, sizeof(trade_signal_t));
+    market_snapshots = md_table_init(
+        ipc_create_shared_memory(md_table_size(MARKET_SNAPSHOT_SYMBOLS), MARKET_SNAPSHOT_KEY),
+        MARKET_SNAPSHOT_SYMBOLS);
+    risk_init();
+    portfolio_init();
+    price_init();
+    
     vga_write_string("IPC subsystem initialized\n");
 }
 
 // Message queue implementation
+_Static_assert(sizeof(msg_record_t) % MSGQ_RECORD_ALIGN == 0, "msg_record_t size");
+
+// Records are whole multiples of MSGQ_RECORD_ALIGN, so the space left
+// before the end of the ring always holds a padding record
+static inline uint32_t msgq_record_length(uint32_t size) {
+    return (sizeof(msg_record_t) + size + MSGQ_RECORD_ALIGN - 1) & ~(uint32_t)(MSGQ_RECORD_ALIGN - 1);
+}
+
+static inline msg_record_t* msgq_record(message_queue_t* queue, uint32_t offset) {
+    return (msg_record_t*)(queue->ring + (offset & (queue->ring_size - 1)));
+}
+
+static msgq_list_t* msgq_list(message_queue_t* queue, msg_record_t* record, int which) {
+    if (which == MSGQ_LIST_TYPE) {
+        return &queue->by_type[record->type % MSGQ_TYPE_LISTS];
+    }
+    return &queue->by_priority[record->priority];
+}
+
+static void msgq_lists_reset(message_queue_t* queue) {
+    for (int i = 0; i < MSGQ_TYPE_LISTS; i++) {
+        queue->by_type[i].head = queue->by_type[i].tail = MSGQ_NONE;
+    }
+    for (int i = 0; i < MSGQ_PRIORITIES; i++) {
+        queue->by_priority[i].head = queue->by_priority[i].tail = MSGQ_NONE;
+    }
+    queue->priority_mask = 0;
+}
+
+// Append the record at 'offset' to its type and priority lists
+static void msgq_link(message_queue_t* queue, uint32_t offset) {
+    msg_record_t* record = msgq_record(queue, offset);
+    for (int which = 0; which < 2; which++) {
+        msgq_list_t* list = msgq_list(queue, record, which);
+        record->next[which] = MSGQ_NONE;
+        record->prev[which] = list->tail;
+        if (list->tail == MSGQ_NONE) {
+            list->head = offset;
+        } else {
+            msgq_record(queue, list->tail)->next[which] = offset;
+        }
+        list->tail = offset;
+    }
+    queue->priority_mask |= 1u << record->priority;
+}
+
+static void msgq_unlink(message_queue_t* queue, uint32_t offset) {
+    msg_record_t* record = msgq_record(queue, offset);
+    for (int which = 0; which < 2; which++) {
+        msgq_list_t* list = msgq_list(queue, record, which);
+        if (record->prev[which] == MSGQ_NONE) {
+            list->head = record->next[which];
+        } else {
+            msgq_record(queue, record->prev[which])->next[which] = record->next[which];
+        }
+        if (record->next[which] == MSGQ_NONE) {
+            list->tail = record->prev[which];
+        } else {
+            msgq_record(queue, record->next[which])->prev[which] = record->prev[which];
+        }
+    }
+    if (queue->by_priority[record->priority].head == MSGQ_NONE) {
+        queue->priority_mask &= ~(1u << record->priority);
+    }
+}
+
+// Move the live records, in order, into a new ring and thread the lists
+// through their new offsets (queue->lock held)
+static bool msgq_resize(message_queue_t* queue, uint32_t ring_size) {
+    uint8_t* ring = kmalloc(ring_size);
+    if (!ring) {
+        return false;
+    }
+    
+    uint32_t used = 0;
+    for (uint32_t offset = queue->head; offset != queue->tail;) {
+        msg_record_t* record = msgq_record(queue, offset);
+        offset += record->length;
+        if (!(record->flags & MSGQ_RECORD_DEAD)) {
+            memcpy(ring + used, record, record->length);
+            used += record->length;
+        }
+    }
+    kfree(queue->ring);
+    queue->ring = ring;
+    queue->ring_size = ring_size;
+    queue->head = 0;
+    queue->tail = used;
+    queue->live = used;
+    
+    msgq_lists_reset(queue);
+    for (uint32_t offset = 0; offset != used; offset += msgq_record(queue, offset)->length) {
+        msgq_link(queue, offset);
+    }
+    return true;
+}
+
+// Space for a record at the tail, padding to the end of the ring if it
+// would not fit before it, and allocating or doubling the ring as needed;
+// at MSGQ_RING_MAX the dead records still between live ones (taken out of
+// order, by type or priority) are squeezed out instead (queue->lock held).
+// NULL when the queue is full.
+static msg_record_t* msgq_reserve(message_queue_t* queue, uint32_t length) {
+    while (1) {
+        if (queue->ring) {
+            uint32_t to_end = queue->ring_size - (queue->tail & (queue->ring_size - 1));
+            uint32_t pad = to_end < length ? to_end : 0;
+            if (queue->ring_size - (queue->tail - queue->head) >= pad + length) {
+                if (pad) {
+                    msg_record_t* filler = msgq_record(queue, queue->tail);
+                    filler->length = pad;
+                    filler->flags = MSGQ_RECORD_DEAD;
+                    queue->tail += pad;
+                }
+                msg_record_t* record = msgq_record(queue, queue->tail);
+                queue->tail += length;
+                queue->live += length;
+                return record;
+            }
+            if (queue->ring_size >= MSGQ_RING_MAX) {
+                if (queue->tail - queue->head == queue->live ||
+                    !msgq_resize(queue, queue->ring_size)) {
+                    return NULL;
+                }
+                continue;
+            }
+        }
+        if (!msgq_resize(queue, queue->ring ? queue->ring_size * 2 : MSGQ_RING_MIN)) {
+            return NULL;
+        }
+    }
+}
+
 uint32_t msgget(uint32_t key, uint32_t flags) {
     // Look for existing queue with same key
     for (int i = 0; i < MAX_MESSAGE_QUEUES; i++) {
@@ -49,15 +219,20 @@ uint32_t msgget(uint32_t key, uint32_t flags) {
     if (flags & 0x200) { // IPC_CREAT
         for (int i = 0; i < MAX_MESSAGE_QUEUES; i++) {
             if (!message_queues[i].in_use) {
-                message_queues[i].in_use = 1;
-                message_queues[i].id = next_msgq_id++;
+                spin_lock_init(&message_queues[i].lock);
+                message_queues[i].id = next_msgq_id++ * MAX_MESSAGE_QUEUES + i + 1;
                 message_queues[i].key = key;
                 message_queues[i].head = 0;
                 message_queues[i].tail = 0;
+                message_queues[i].live = 0;
                 message_queues[i].count = 0;
+                message_queues[i].ring = NULL;     // Allocated by the first send
+                message_queues[i].ring_size = 0;
+                msgq_lists_reset(&message_queues[i]);
                 message_queues[i].max_size = MAX_QUEUE_SIZE;
                 message_queues[i].permissions = flags & 0777;
                 message_queues[i].creator_pid = current_process ? current_process->pid : 0;
+                message_queues[i].in_use = 1;
                 
                 return message_queues[i].id;
             }
@@ -67,119 +242,233 @@ uint32_t msgget(uint32_t key, uint32_t flags) {
     return -1; // No queue found or created
 }
 
-int msgsnd(uint32_t msgid, const message_t* msg, uint32_t size, uint32_t flags) {
-    if (!msg || size > MAX_MESSAGE_SIZE) {
+static message_queue_t* find_message_queue(uint32_t msgid) {
+    message_queue_t* queue = &message_queues[(msgid - 1) & (MAX_MESSAGE_QUEUES - 1)];
+    return queue->in_use && queue->id == msgid ? queue : NULL;
+}
+
+// Readable with a message queued, writable with room for one
+int msgq_poll_add(pollset_t* set, uint32_t msgid, uint32_t events, uint32_t cookie) {
+    message_queue_t* queue = find_message_queue(msgid);
+    if (!queue) {
         return -1;
     }
     
-    // Find message queue
-    message_queue_t* queue = NULL;
-    for (int i = 0; i < MAX_MESSAGE_QUEUES; i++) {
-        if (message_queues[i].in_use && message_queues[i].id == msgid) {
-            queue = &message_queues[i];
-            break;
-        }
+    int item = pollset_add(set, &queue->poll, events, cookie);
+    if (item >= 0) {
+        uint32_t lock_flags = spin_lock_irqsave(&queue->lock);
+        uint32_t ready = 0;
+        if (queue->count > 0) ready |= POLL_IN;
+        if (queue->count < queue->max_size) ready |= POLL_OUT;
+        spin_unlock_irqrestore(&queue->lock, lock_flags);
+        pollset_signal(set, item, ready);
+    }
+    return item;
+}
+
+volatile uint32_t* msgq_send_seq(uint32_t msgid) {
+    message_queue_t* queue = find_message_queue(msgid);
+    return queue ? &queue->send_seq : NULL;
+}
+
+int msgsnd_buf(uint32_t msgid, uint32_t type, uint32_t priority, const void* data,
+               uint32_t size, uint32_t flags) {
+    if ((!data && size) || size > MAX_MESSAGE_SIZE) {
+        return -1;
     }
     
+    message_queue_t* queue = find_message_queue(msgid);
     if (!queue) {
         return -1;
     }
     
-    // Check if queue is full
-    if (queue->count >= queue->max_size) {
-        if (flags & 0x800) { // IPC_NOWAIT
+    uint32_t length = msgq_record_length(size);
+    while (1) {
+        uint32_t seq = queue->recv_seq;
+        uint32_t lock_flags = spin_lock_irqsave(&queue->lock);
+        if (!queue->in_use || queue->id != msgid) {
+            spin_unlock_irqrestore(&queue->lock, lock_flags);
+            return -1;
+        }
+        
+        msg_record_t* record = queue->count < queue->max_size ? msgq_reserve(queue, length) : NULL;
+        if (record) {
+            // Add message to queue: the header and 'size' bytes
+            record->length = length;
+            record->type = type;
+            record->sender_pid = current_process ? current_process->pid : 0;
+            record->size = size;
+            record->priority = priority < MSGQ_PRIORITIES ? priority : MSGQ_PRIORITIES - 1;
+            record->flags = 0;
+            record->timestamp = ktime_ns();
+            memcpy(record + 1, data, size);
+            msgq_link(queue, queue->tail - length);
+            
+            queue->count++;
+            queue->send_seq++;
+            spin_unlock_irqrestore(&queue->lock, lock_flags);
+            
+            // Receivers may filter by type, so each one rechecks
+            futex_wake(&queue->send_seq, FUTEX_WAKE_ALL);
+            poll_wake(&queue->poll, POLL_IN);
+            return 0;
+        }
+        spin_unlock_irqrestore(&queue->lock, lock_flags);
+        
+        // Full: sleep until a receiver makes room
+        if ((flags & 0x800) || // IPC_NOWAIT
+            futex_wait(&queue->recv_seq, seq, FUTEX_WAIT_FOREVER) != 0) {
             return -1;
         }
-        // In full implementation, would block here
-        return -1;
     }
-    
-    // Add message to queue
-    message_t* slot = &queue->messages[queue->tail];
-    memcpy(slot, msg, sizeof(message_t));
-    slot->sender_pid = current_process ? current_process->pid : 0;
-    slot->timestamp = get_ticks();
-    slot->size = size;
-    
-    queue->tail = (queue->tail + 1) % queue->max_size;
-    queue->count++;
-    
-    return 0;
 }
 
-int msgrcv(uint32_t msgid, message_t* msg, uint32_t size, uint32_t type, uint32_t flags) {
+int msgsnd(uint32_t msgid, const message_t* msg, uint32_t size, uint32_t flags) {
     if (!msg) {
         return -1;
     }
-    
-    // Find message queue
-    message_queue_t* queue = NULL;
-    for (int i = 0; i < MAX_MESSAGE_QUEUES; i++) {
-        if (message_queues[i].in_use && message_queues[i].id == msgid) {
-            queue = &message_queues[i];
-            break;
+    return msgsnd_buf(msgid, msg->type, msg->priority, msg->data, size, flags);
+}
+
+#define MSGQ_TAKE_NONE      (-2)    // Nothing matching queued
+
+// Take the oldest message of 'type', or with type 0 the oldest of the
+// highest priority (queue->lock held): its header into 'info' if given and
+// its data into 'data'. Returns its size (0 for an empty message),
+// MSGQ_TAKE_NONE if there is none, or -1 if it does not fit. The record is
+// marked dead; the ring reclaims dead records once they reach the head.
+static int queue_take_message(message_queue_t* queue, message_t* info, void* data,
+                              uint32_t size, uint32_t type) {
+    uint32_t offset;
+    if (type == 0) {
+        if (!queue->priority_mask) {
+            return MSGQ_TAKE_NONE;
+        }
+        offset = queue->by_priority[__builtin_ctz(queue->priority_mask)].head;
+    } else {
+        // Types sharing the sub-queue are skipped
+        offset = queue->by_type[type % MSGQ_TYPE_LISTS].head;
+        while (offset != MSGQ_NONE && msgq_record(queue, offset)->type != type) {
+            offset = msgq_record(queue, offset)->next[MSGQ_LIST_TYPE];
+        }
+        if (offset == MSGQ_NONE) {
+            return MSGQ_TAKE_NONE;
         }
     }
     
+    msg_record_t* record = msgq_record(queue, offset);
+    uint32_t msg_size = record->size;
+    if (msg_size > size) {
+        return -1; // Message too large
+    }
+    if (info) {
+        info->type = record->type;
+        info->sender_pid = record->sender_pid;
+        info->size = msg_size;
+        info->timestamp = record->timestamp;
+        info->priority = record->priority;
+    }
+    memcpy(data, record + 1, msg_size);
+    msgq_unlink(queue, offset);
+    record->flags |= MSGQ_RECORD_DEAD;
+    queue->live -= record->length;
+    
+    while (queue->head != queue->tail &&
+           (msgq_record(queue, queue->head)->flags & MSGQ_RECORD_DEAD)) {
+        queue->head += msgq_record(queue, queue->head)->length;
+    }
+    if (queue->head == queue->tail) {
+        queue->head = queue->tail = 0;  // Empty: start over without a wrap
+    }
+    
+    queue->count--;
+    queue->recv_seq++;
+    return (int)msg_size;
+}
+
+static int msgq_receive(uint32_t msgid, message_t* info, void* data, uint32_t size,
+                        uint32_t type, uint32_t timeout_ms) {
+    message_queue_t* queue = find_message_queue(msgid);
     if (!queue) {
         return -1;
     }
     
-    // Look for message of specified type (or any type if type == 0)
-    for (uint32_t i = 0; i < queue->count; i++) {
-        uint32_t index = (queue->head + i) % queue->max_size;
-        message_t* candidate = &queue->messages[index];
+    uint32_t deadline = get_current_time_ms() + timeout_ms;
+    while (1) {
+        // Sampled before looking, so a send after the check still wakes us
+        uint32_t seq = queue->send_seq;
+        uint32_t lock_flags = spin_lock_irqsave(&queue->lock);
+        if (!queue->in_use || queue->id != msgid) {
+            spin_unlock_irqrestore(&queue->lock, lock_flags);
+            return -1;
+        }
+        int result = queue_take_message(queue, info, data, size, type);
+        spin_unlock_irqrestore(&queue->lock, lock_flags);
         
-        if (type == 0 || candidate->type == type) {
-            // Found matching message
-            uint32_t msg_size = candidate->size;
-            if (msg_size > size) {
-                return -1; // Message too large
-            }
-            
-            // Copy message
-            memcpy(msg, candidate, sizeof(message_t));
-            
-            // Remove from queue by shifting remaining messages
-            for (uint32_t j = i; j < queue->count - 1; j++) {
-                uint32_t src_idx = (queue->head + j + 1) % queue->max_size;
-                uint32_t dst_idx = (queue->head + j) % queue->max_size;
-                memcpy(&queue->messages[dst_idx], &queue->messages[src_idx], sizeof(message_t));
+        if (result != MSGQ_TAKE_NONE) {
+            if (result >= 0) {
+                futex_wake(&queue->recv_seq, 1);    // Room for one sender
+                poll_wake(&queue->poll, POLL_OUT);
             }
-            
-            queue->count--;
-            
-            return msg_size;
+            return result;
+        }
+        
+        // No matching message found: sleep until the next send
+        uint32_t wait = FUTEX_WAIT_FOREVER;
+        if (timeout_ms != FUTEX_WAIT_FOREVER) {
+            int32_t remaining = (int32_t)(deadline - get_current_time_ms());
+            wait = remaining > 0 ? (uint32_t)remaining : 0;
+        }
+        if (futex_wait(&queue->send_seq, seq, wait) != 0) {
+            return -1;
         }
     }
-    
-    // No matching message found
-    if (flags & 0x800) { // IPC_NOWAIT
+}
+
+int msgrcv_timeout(uint32_t msgid, message_t* msg, uint32_t size, uint32_t type,
+                   uint32_t timeout_ms) {
+    if (!msg) {
         return -1;
     }
-    
-    // In full implementation, would block here
-    return -1;
+    return msgq_receive(msgid, msg, msg->data, size > MAX_MESSAGE_SIZE ? MAX_MESSAGE_SIZE : size,
+                        type, timeout_ms);
+}
+
+int msgrcv_buf(uint32_t msgid, uint32_t type, void* data, uint32_t size, uint32_t timeout_ms) {
+    if (!data && size) {
+        return -1;
+    }
+    return msgq_receive(msgid, NULL, data, size, type, timeout_ms);
+}
+
+int msgrcv(uint32_t msgid, message_t* msg, uint32_t size, uint32_t type, uint32_t flags) {
+    return msgrcv_timeout(msgid, msg, size, type,
+                          (flags & 0x800) ? 0 : FUTEX_WAIT_FOREVER); // IPC_NOWAIT
 }
 
 int msgctl(uint32_t msgid, uint32_t cmd, void* buf) {
     (void)buf;  // Suppress unused parameter warning - TODO: implement control operations
     
-    // Find message queue
-    message_queue_t* queue = NULL;
-    for (int i = 0; i < MAX_MESSAGE_QUEUES; i++) {
-        if (message_queues[i].in_use && message_queues[i].id == msgid) {
-            queue = &message_queues[i];
-            break;
-        }
-    }
-    
+    message_queue_t* queue = find_message_queue(msgid);
     if (!queue) {
         return -1;
     }
     
-    if (cmd == 0) { // IPC_RMID - remove queue
+    if (cmd == 0) { // IPC_RMID - remove queue; blocked senders and receivers fail
+        uint32_t lock_flags = spin_lock_irqsave(&queue->lock);
         queue->in_use = 0;
+        queue->send_seq++;
+        queue->recv_seq++;
+        uint8_t* ring = queue->ring;
+        queue->ring = NULL;
+        queue->ring_size = 0;
+        queue->head = queue->tail = queue->live = queue->count = 0;
+        msgq_lists_reset(queue);
+        spin_unlock_irqrestore(&queue->lock, lock_flags);
+        kfree(ring);
+        futex_wake(&queue->send_seq, FUTEX_WAKE_ALL);
+        futex_wake(&queue->recv_seq, FUTEX_WAKE_ALL);
+        poll_head_release(&queue->poll);
         return 0;
     }
     
@@ -218,260 +507,1033 @@ uint32_t semget(uint32_t key, uint32_t nsems, uint32_t flags) {
     return -1;
 }
 
+static semaphore_t* find_semaphore(uint32_t semid) {
+    for (int i = 0; i < MAX_SEMAPHORES; i++) {
+        if (semaphores[i].in_use && semaphores[i].id == semid) {
+            return &semaphores[i];
+        }
+    }
+    return NULL;
+}
+
 int semop(uint32_t semid, sembuf_t* ops, uint32_t nops) {
-    (void)semid; (void)ops; (void)nops;  // Suppress unused parameter warnings - TODO: implement semaphore operations
-    // Simplified semaphore operations
-    // In full implementation, would support multiple operations atomically
-    return -1; // Not fully implemented
+    return semtimedop(semid, ops, nops, PI_WAIT_FOREVER);
 }
 
-int semctl(uint32_t semid, uint32_t semnum, uint32_t cmd, void* arg) {
-    (void)semnum;  // Suppress unused parameter warning - TODO: implement multi-semaphore operations
+// Apply all operations or none, blocking (up to timeout_ms) until they fit.
+// Every id is a single semaphore, so sem_num must be 0.
+int semtimedop(uint32_t semid, sembuf_t* ops, uint32_t nops, uint32_t timeout_ms) {
+    if (!ops || nops == 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < nops; i++) {
+        if (ops[i].sem_num != 0) {
+            return -1;
+        }
+    }
     
-    // Find semaphore
-    semaphore_t* sem = NULL;
-    for (int i = 0; i < MAX_SEMAPHORES; i++) {
-        if (semaphores[i].in_use && semaphores[i].id == semid) {
-            sem = &semaphores[i];
-            break;
+    semaphore_t* sem = find_semaphore(semid);
+    if (!sem) {
+        return -1;
+    }
+    
+    process_t* self = current_process;
+    uint32_t deadline = get_current_time_ms() + timeout_ms;
+    uint32_t flags = pi_lock_irqsave();
+    
+    while (1) {
+        if (!sem->in_use || sem->id != semid) {
+            pi_unlock_irqrestore(flags);
+            return -1;
+        }
+        
+        int32_t value = sem->value;
+        bool nowait = false;
+        uint32_t i;
+        for (i = 0; i < nops; i++) {
+            int32_t op = ops[i].sem_op;
+            if ((op < 0 && value + op < 0) || (op == 0 && value != 0)) {
+                nowait = (ops[i].sem_flg & 0x800) != 0; // IPC_NOWAIT
+                break;
+            }
+            value += op;
+            if (value > SEM_VALUE_MAX) {
+                pi_unlock_irqrestore(flags);
+                return -1;
+            }
+        }
+        
+        if (i == nops) {
+            bool changed = value != sem->value;
+            sem->value = value;
+            
+            // Taking a binary semaphore makes the caller its owner, so
+            // waiters lend it their priority until it is given back
+            if (sem->max_value == 1) {
+                pi_set_owner(&sem->pi, value == 0 ? self : NULL);
+            }
+            if (changed) {
+                pi_wake_all(&sem->pi);
+            }
+            pi_unlock_irqrestore(flags);
+            return 0;
         }
+        
+        uint32_t wait = PI_WAIT_FOREVER;
+        if (timeout_ms != PI_WAIT_FOREVER) {
+            int32_t remaining = (int32_t)(deadline - get_current_time_ms());
+            wait = remaining > 0 ? (uint32_t)remaining : 0;
+        }
+        if (nowait || wait == 0 || !self || self == idle_process) {
+            pi_unlock_irqrestore(flags);
+            return -1;
+        }
+        
+        // The holder may be about to give it back on another CPU: spin
+        // on the value first, sleep with priority inheritance otherwise
+        int32_t seen = sem->value;
+        pi_unlock_irqrestore(flags);
+        bool moved = futex_spin((volatile uint32_t*)&sem->value, (uint32_t)seen);
+        flags = pi_lock_irqsave();
+        if (moved) {
+            continue;
+        }
+        
+        sem->wait_count++;
+        pi_wait(&sem->pi, &flags, wait);
+        sem->wait_count--;
     }
+}
+
+int semctl(uint32_t semid, uint32_t semnum, uint32_t cmd, void* arg) {
+    (void)semnum;  // Suppress unused parameter warning - TODO: implement multi-semaphore operations
     
+    int result = -1;
+    uint32_t flags = pi_lock_irqsave();
+    semaphore_t* sem = find_semaphore(semid);
     if (!sem) {
+        pi_unlock_irqrestore(flags);
         return -1;
     }
     
-    if (cmd == 0) { // IPC_RMID - remove semaphore
+    if (cmd == 0) { // IPC_RMID - remove semaphore; waiters fail
         sem->in_use = 0;
-        return 0;
-    } else if (cmd == 16) { // SETVAL - set value
-        sem->value = *(int*)arg;
-        return 0;
+        pi_set_owner(&sem->pi, NULL);
+        pi_wake_all(&sem->pi);
+        result = 0;
+    } else if (cmd == 16 && arg) { // SETVAL - set value
+        int value = *(int*)arg;
+        if (value >= 0 && value <= SEM_VALUE_MAX) {
+            sem->value = value;
+            if ((uint32_t)value > sem->max_value) {
+                sem->max_value = value;
+            }
+            pi_set_owner(&sem->pi, NULL);
+            pi_wake_all(&sem->pi);
+            result = 0;
+        }
     } else if (cmd == 12) { // GETVAL - get value
-        return sem->value;
+        result = sem->value;
     }
     
-    return -1;
+    pi_unlock_irqrestore(flags);
+    return result;
 }
 
 // Trading-specific IPC functions
+// Straight between the caller's record and the queue's ring
 int send_market_data(uint32_t queue_id, const market_data_t* data) {
-    message_t msg;
-    msg.type = MSG_MARKET_DATA;
-    msg.priority = 1; // High priority for market data
-    memcpy(msg.data, data, sizeof(market_data_t));
-    
-    return msgsnd(queue_id, &msg, sizeof(market_data_t), 0);
+    // High priority for market data
+    return msgsnd_buf(queue_id, MSG_MARKET_DATA, 1, data, sizeof(market_data_t), 0);
 }
 
 int receive_market_data(uint32_t queue_id, market_data_t* data) {
-    message_t msg;
-    int result = msgrcv(queue_id, &msg, sizeof(market_data_t), MSG_MARKET_DATA, 0);
-    
-    if (result > 0) {
-        memcpy(data, msg.data, sizeof(market_data_t));
-        return 0;
-    }
-    
-    return -1;
+    int result = msgrcv_buf(queue_id, MSG_MARKET_DATA, data, sizeof(market_data_t),
+                            FUTEX_WAIT_FOREVER);
+    return result > 0 ? 0 : -1;
 }
 
+// New orders pass the pre-trade checks first; one that cannot be queued
+// gives its reservation back
 int send_order(uint32_t queue_id, const order_t* order) {
-    message_t msg;
-    msg.type = MSG_ORDER_REQUEST;
-    msg.priority = 0; // Highest priority for orders
-    memcpy(msg.data, order, sizeof(order_t));
-    
-    return msgsnd(queue_id, &msg, sizeof(order_t), 0);
+    return send_order_flags(queue_id, order, 0);
 }
 
-int receive_order(uint32_t queue_id, order_t* order) {
-    message_t msg;
-    int result = msgrcv(queue_id, &msg, sizeof(order_t), MSG_ORDER_REQUEST, 0);
-    
-    if (result > 0) {
-        memcpy(order, msg.data, sizeof(order_t));
-        return 0;
+int send_order_flags(uint32_t queue_id, const order_t* order, uint32_t flags) {
+    if (!order) {
+        return -1;
+    }
+    if (risk_check(order) != RISK_OK) {
+        journal_log_order(JOURNAL_REJECT, order);
+        return -1;
     }
     
-    return -1;
-}
-
-int broadcast_trade_signal(uint32_t signal_type, const void* data, uint32_t size) {
-    (void)signal_type;  // Suppress unused parameter warning - TODO: implement signal type handling
-    
-    // Broadcast to all interested processes
-    // In full implementation, would maintain subscriber lists
-    message_t msg;
-    msg.type = MSG_TRADE_SIGNAL;
-    msg.priority = 2;
-    memcpy(msg.data, data, size);
-    
-    // For now, just demonstrate the concept
-    vga_write_string("Broadcasting trade signal\n");
-    return 0;
-}
-
-int send_priority_message(uint32_t queue_id, uint32_t type, const void* data, 
-                         uint32_t size, uint32_t priority) {
-    message_t msg;
-    msg.type = type;
-    msg.priority = priority;
-    memcpy(msg.data, data, size);
-    
-    return msgsnd(queue_id, &msg, size, 0);
+    // Highest priority for orders
+    int result = msgsnd_buf(queue_id, MSG_ORDER_REQUEST, 0, order, sizeof(order_t), flags);
+    if (result != 0 && order->status == 0) {
+        risk_on_cancel(order->symbol_id, order->side, order->quantity);
+    }
+    journal_log_order(result == 0 ? JOURNAL_ORDER : JOURNAL_REJECT, order);
+    return result;
 }
 
-int receive_priority_message(uint32_t queue_id, uint32_t type, void* data, 
-                            uint32_t max_size, uint32_t timeout) {
-    (void)timeout;  // Suppress unused parameter warning - TODO: implement timeout functionality
-    
-    message_t msg;
-    int result = msgrcv(queue_id, &msg, max_size, type, 0x800); // IPC_NOWAIT
-    
-    if (result > 0) {
-        memcpy(data, msg.data, result);
-        return result;
-    }
-    
-    return -1;
+int receive_order(uint32_t queue_id, order_t* order) {
+    int result = msgrcv_buf(queue_id, MSG_ORDER_REQUEST, order, sizeof(order_t),
+                            FUTEX_WAIT_FOREVER);
+    return result > 0 ? 0 : -1;
 }
 
-// Lock-free ring buffer implementation for ultra-low latency
-int ringbuf_init(lockfree_ringbuf_t* rb, uint32_t size, uint32_t element_size) {
-    if (!rb || size == 0 || element_size == 0) {
+// One copy in, however many subscribers read it
+int broadcast_trade_signal(uint32_t signal_type, const void* data, uint32_t size) {
+    if (!trade_signals || size > TRADE_SIGNAL_MAX_DATA || (size && !data)) {
         return -1;
     }
     
-    // Ensure size is power of 2 for efficient modulo
-    uint32_t power_of_two = 1;
-    while (power_of_two < size) {
-        power_of_two <<= 1;
-    }
-    
-    rb->buffer = kmalloc(power_of_two * element_size);
-    if (!rb->buffer) {
+    if (kmutex_lock(&trade_signal_writer) != 0) {
         return -1;
     }
-    
-    rb->size = power_of_two;
-    rb->mask = power_of_two - 1;
-    rb->element_size = element_size;
-    rb->head = 0;
-    rb->tail = 0;
-    
-    return 0;
+    uint32_t sequence;
+    trade_signal_t* signal = seq_claim_wait(trade_signals, &sequence, TRADE_SIGNAL_WAIT_MS);
+    if (signal) {
+        signal->type = signal_type;
+        signal->size = size;
+        signal->timestamp = ktime_ns();
+        memcpy(signal->data, data, size);
+        seq_publish(trade_signals, sequence);
+    }
+    kmutex_unlock(&trade_signal_writer);
+    return signal ? 0 : -1;
 }
 
-int ringbuf_push(lockfree_ringbuf_t* rb, const void* data) {
-    if (!rb || !data) {
+int market_snapshot_update(const market_data_t* data) {
+    md_snapshot_t* entry = market_snapshots ? md_write_begin(market_snapshots, data->symbol_id) : NULL;
+    if (!entry) {
         return -1;
     }
     
-    uint32_t head = rb->head;
-    uint32_t tail = rb->tail;
-    uint32_t next_tail = (tail + 1) & rb->mask;
-    
-    // Check if buffer is full
-    if (next_tail == head) {
-        return -1; // Buffer full
+    if (data->side == 0) {
+        entry->bid = data->price;
+        entry->bid_size = data->volume;
+        portfolio_on_quote(data->symbol_id, entry->bid, entry->ask);
+    } else if (data->side == 1) {
+        entry->ask = data->price;
+        entry->ask_size = data->volume;
+        portfolio_on_quote(data->symbol_id, entry->bid, entry->ask);
+    } else {
+        entry->last = data->price;
+        entry->volume += data->volume;
+        risk_mark(data->symbol_id, data->price);
     }
-    
-    // Copy data to buffer
-    uint8_t* slot = rb->buffer + (tail * rb->element_size);
-    memcpy(slot, data, rb->element_size);
-    
-    // Update tail (memory barrier would be needed in SMP)
-    rb->tail = next_tail;
-    
+    md_write_end(market_snapshots, entry);
     return 0;
 }
 
-int ringbuf_pop(lockfree_ringbuf_t* rb, void* data) {
-    if (!rb || !data) {
-        return -1;
-    }
-    
-    uint32_t head = rb->head;
-    uint32_t tail = rb->tail;
-    
-    // Check if buffer is empty
-    if (head == tail) {
-        return -1; // Buffer empty
-    }
-    
-    // Copy data from buffer
-    uint8_t* slot = rb->buffer + (head * rb->element_size);
-    memcpy(data, slot, rb->element_size);
-    
-    // Update head (memory barrier would be needed in SMP)
-    rb->head = (head + 1) & rb->mask;
-    
-    return 0;
+int market_snapshot_read(uint16_t symbol_id, md_snapshot_t* out) {
+    return market_snapshots ? md_read(market_snapshots, symbol_id, out) : -1;
 }
 
-uint32_t ringbuf_count(const lockfree_ringbuf_t* rb) {
-    if (!rb) {
-        return 0;
+uint32_t market_snapshot_conflate(uint32_t* cursor, md_conflate_fn_t fn, void* ctx) {
+    return market_snapshots ? md_conflate(market_snapshots, cursor, fn, ctx) : 0;
+}
+
+int trade_signal_subscribe(uint32_t after) {
+    return trade_signals ? seq_subscribe(trade_signals, after) : -1;
+}
+
+void trade_signal_unsubscribe(int subscriber) {
+    if (trade_signals) {
+        seq_unsubscribe(trade_signals, subscriber);
     }
-    
-    return (rb->tail - rb->head) & rb->mask;
 }
 
-// Shared memory pools for trading data
-shared_pool_t* create_shared_pool(uint32_t element_size, uint32_t max_elements) {
-    shared_pool_t* pool = kmalloc(sizeof(shared_pool_t));
-    if (!pool) {
+const trade_signal_t* trade_signal_next(int subscriber, uint32_t timeout_ms) {
+    if (!trade_signals || subscriber < 0 || subscriber >= SEQ_MAX_CONSUMERS) {
         return NULL;
     }
     
-    pool->element_size = element_size;
-    pool->max_elements = max_elements;
-    pool->used_elements = 0;
-    
-    // Allocate memory for elements
-    pool->size = element_size * max_elements;
-    pool->base_addr = kmalloc(pool->size);
-    if (!pool->base_addr) {
-        kfree(pool);
+    uint32_t sequence;
+    if (seq_wait(trade_signals, subscriber, &sequence, timeout_ms) == 0) {
         return NULL;
     }
-    
-    // Allocate bitmap for tracking allocations
-    uint32_t bitmap_size = (max_elements + 7) / 8; // Round up to bytes
+    return seq_slot(trade_signals, sequence);
+}
+
+void trade_signal_done(int subscriber) {
+    if (trade_signals && subscriber >= 0 && subscriber < SEQ_MAX_CONSUMERS) {
+        seq_release(trade_signals, subscriber, 1);
+    }
+}
+
+void trade_signal_print_info(void) {
+    seq_print_info(trade_signals);
+}
+
+int send_priority_message(uint32_t queue_id, uint32_t type, const void* data, 
+                         uint32_t size, uint32_t priority) {
+    return msgsnd_buf(queue_id, type, priority, data, size, 0);
+}
+
+// Receive a message, waiting up to 'timeout' ms for one to arrive
+// (0 = poll). The receiver sleeps on the queue's wait word until a send.
+int receive_priority_message(uint32_t queue_id, uint32_t type, void* data, 
+                            uint32_t max_size, uint32_t timeout) {
+    int result = msgrcv_buf(queue_id, type, data, max_size, timeout);
+    return result > 0 ? result : -1;
+}
+
+// Pipe implementation
+static inline pipe_buffer_t* pipe_buf(pipe_t* pipe, uint32_t index) {
+    return &pipe->bufs[index & (PIPE_BUFFERS - 1)];
+}
+
+// After data went in, and after room was made
+static void pipe_wake_readers(pipe_t* pipe) {
+    futex_wake(&pipe->write_seq, FUTEX_WAKE_ALL);
+    poll_wake(&pipe->poll, POLL_IN);
+}
+
+static void pipe_wake_writers(pipe_t* pipe) {
+    futex_wake(&pipe->read_seq, FUTEX_WAKE_ALL);
+    poll_wake(&pipe->poll, POLL_OUT);
+}
+
+static inline bool pipe_full(pipe_t* pipe) {
+    return pipe->tail - pipe->head == PIPE_BUFFERS;
+}
+
+// The emptied page kept from the last read, or a new one (lock held)
+static uint32_t pipe_page_get(pipe_t* pipe) {
+    uint32_t page = pipe->spare;
+    pipe->spare = 0;
+    return page ? page : allocate_page_frame();
+}
+
+// Drop the pipe's reference to a page; with the last it becomes the spare
+static void pipe_page_put(pipe_t* pipe, uint32_t page) {
+    if (!frame_unref(page)) {
+        return;
+    }
+    if (!pipe->spare) {
+        pipe->spare = page;
+    } else {
+        frame_free(page);
+    }
+}
+
+// Both pipes' locks in address order, so two splices the opposite way
+// round cannot deadlock
+static uint32_t pipe_lock_pair(pipe_t* a, pipe_t* b) {
+    pipe_t* first = a < b ? a : b;
+    pipe_t* second = a < b ? b : a;
+    uint32_t flags = spin_lock_irqsave(&first->lock);
+    spin_lock(&second->lock);
+    return flags;
+}
+
+static void pipe_unlock_pair(pipe_t* a, pipe_t* b, uint32_t flags) {
+    pipe_t* first = a < b ? a : b;
+    pipe_t* second = a < b ? b : a;
+    spin_unlock(&second->lock);
+    spin_unlock_irqrestore(&first->lock, flags);
+}
+
+void pipe_init(pipe_t* pipe) {
+    memset(pipe, 0, sizeof(pipe_t));
+    spin_lock_init(&pipe->lock);
+    poll_head_init(&pipe->poll);
+    pipe->readers = 1;
+    pipe->writers = 1;
+}
+
+pipe_t* pipe_create(void) {
+    pipe_t* pipe = (pipe_t*)kmalloc(sizeof(pipe_t));
+    if (pipe) {
+        pipe_init(pipe);
+    }
+    return pipe;
+}
+
+void pipe_destroy(pipe_t* pipe) {
+    if (!pipe) {
+        return;
+    }
+    
+    poll_head_release(&pipe->poll);
+    while (pipe->head != pipe->tail) {
+        free_page_frame(pipe_buf(pipe, pipe->head++)->page);
+    }
+    if (pipe->spare) {
+        free_page_frame(pipe->spare);
+    }
+    kfree(pipe);
+}
+
+// Readable with data or at end of file, writable with a free buffer
+int pipe_poll_add(pollset_t* set, pipe_t* pipe, uint32_t events, uint32_t cookie) {
+    if (!pipe) {
+        return -1;
+    }
+    
+    int item = pollset_add(set, &pipe->poll, events, cookie);
+    if (item >= 0) {
+        uint32_t lock_flags = spin_lock_irqsave(&pipe->lock);
+        uint32_t ready = 0;
+        if (pipe->head != pipe->tail || pipe->closed_for_writing) ready |= POLL_IN;
+        if (!pipe_full(pipe)) ready |= POLL_OUT;
+        if (pipe->closed_for_reading || pipe->closed_for_writing) ready |= POLL_HUP;
+        spin_unlock_irqrestore(&pipe->lock, lock_flags);
+        pollset_signal(set, item, ready);
+    }
+    return item;
+}
+
+void pipe_ref(pipe_t* pipe, bool writer) {
+    uint32_t lock_flags = spin_lock_irqsave(&pipe->lock);
+    if (writer) {
+        pipe->writers++;
+    } else {
+        pipe->readers++;
+    }
+    spin_unlock_irqrestore(&pipe->lock, lock_flags);
+}
+
+int pipe_read(pipe_t* pipe, void* buffer, uint32_t count, uint32_t flags) {
+    if (!pipe || !buffer) {
+        return -1;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    
+    uint8_t* out = (uint8_t*)buffer;
+    while (1) {
+        uint32_t seq = pipe->write_seq;
+        uint32_t lock_flags = spin_lock_irqsave(&pipe->lock);
+        uint32_t bytes_read = 0;
+        while (bytes_read < count && pipe->head != pipe->tail) {
+            pipe_buffer_t* buf = pipe_buf(pipe, pipe->head);
+            uint32_t n = count - bytes_read < buf->len ? count - bytes_read : buf->len;
+            memcpy(out + bytes_read, (uint8_t*)buf->page + buf->offset, n);
+            bytes_read += n;
+            buf->offset += n;
+            buf->len -= n;
+            if (buf->len == 0) {
+                pipe_page_put(pipe, buf->page);
+                pipe->head++;
+            }
+        }
+        pipe->size -= bytes_read;
+        bool closed = pipe->closed_for_writing;
+        if (bytes_read > 0) {
+            pipe->read_seq++;
+        }
+        spin_unlock_irqrestore(&pipe->lock, lock_flags);
+        
+        if (bytes_read > 0) {
+            pipe_wake_writers(pipe);
+            return (int)bytes_read;
+        }
+        if (closed) {
+            return 0;   // End of file
+        }
+        if ((flags & IPC_NOWAIT) ||
+            futex_wait(&pipe->write_seq, seq, FUTEX_WAIT_FOREVER) != 0) {
+            return -1;
+        }
+    }
+}
+
+int pipe_write(pipe_t* pipe, const void* buffer, uint32_t count, uint32_t flags) {
+    if (!pipe || !buffer) {
+        return -1;
+    }
+    
+    const uint8_t* in = (const uint8_t*)buffer;
+    uint32_t bytes_written = 0;
+    bool no_memory = false;
+    while (bytes_written < count) {
+        uint32_t seq = pipe->read_seq;
+        uint32_t lock_flags = spin_lock_irqsave(&pipe->lock);
+        if (pipe->closed_for_reading) {
+            spin_unlock_irqrestore(&pipe->lock, lock_flags);
+            break;
+        }
+        uint32_t start = bytes_written;
+        while (bytes_written < count) {
+            // Append to the newest page unless a splice shares it
+            pipe_buffer_t* buf = NULL;
+            uint32_t room = 0;
+            if (pipe->head != pipe->tail) {
+                buf = pipe_buf(pipe, pipe->tail - 1);
+                if (frame_refs(buf->page) == 1) {
+                    room = PAGE_SIZE - buf->offset - buf->len;
+                }
+            }
+            if (room == 0) {
+                if (pipe_full(pipe)) {
+                    break;
+                }
+                uint32_t page = pipe_page_get(pipe);
+                if (!page) {
+                    no_memory = true;
+                    break;
+                }
+                buf = pipe_buf(pipe, pipe->tail++);
+                buf->page = page;
+                buf->offset = 0;
+                buf->len = 0;
+                room = PAGE_SIZE;
+            }
+            uint32_t n = count - bytes_written < room ? count - bytes_written : room;
+            memcpy((uint8_t*)buf->page + buf->offset + buf->len, in + bytes_written, n);
+            buf->len += n;
+            bytes_written += n;
+        }
+        pipe->size += bytes_written - start;
+        if (bytes_written > start) {
+            pipe->write_seq++;
+        }
+        spin_unlock_irqrestore(&pipe->lock, lock_flags);
+        
+        if (bytes_written > start) {
+            pipe_wake_readers(pipe);
+        }
+        if (bytes_written == count || no_memory || (flags & IPC_NOWAIT)) {
+            break;
+        }
+        if (futex_wait(&pipe->read_seq, seq, FUTEX_WAIT_FOREVER) != 0) {
+            break;
+        }
+    }
+    
+    return bytes_written > 0 || count == 0 ? (int)bytes_written : -1;
+}
+
+// Whole buffers change pipes; a buffer only partly wanted is split, both
+// halves referencing the page
+int pipe_splice(pipe_t* in, pipe_t* out, uint32_t count, uint32_t flags) {
+    if (!in || !out || in == out) {
+        return -1;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    
+    while (1) {
+        uint32_t in_seq = in->write_seq;
+        uint32_t out_seq = out->read_seq;
+        uint32_t lock_flags = pipe_lock_pair(in, out);
+        if (out->closed_for_reading) {
+            pipe_unlock_pair(in, out, lock_flags);
+            return -1;
+        }
+        uint32_t moved = 0;
+        while (moved < count && in->head != in->tail && !pipe_full(out)) {
+            pipe_buffer_t* buf = pipe_buf(in, in->head);
+            pipe_buffer_t* dst = pipe_buf(out, out->tail++);
+            uint32_t n = count - moved < buf->len ? count - moved : buf->len;
+            *dst = *buf;
+            if (n == buf->len) {
+                in->head++;
+            } else {
+                frame_ref(buf->page);
+                dst->len = n;
+                buf->offset += n;
+                buf->len -= n;
+            }
+            moved += n;
+        }
+        in->size -= moved;
+        out->size += moved;
+        bool empty = in->head == in->tail;
+        bool closed = in->closed_for_writing;
+        if (moved > 0) {
+            in->read_seq++;
+            out->write_seq++;
+        }
+        pipe_unlock_pair(in, out, lock_flags);
+        
+        if (moved > 0) {
+            pipe_wake_writers(in);
+            pipe_wake_readers(out);
+            return (int)moved;
+        }
+        if (empty && closed) {
+            return 0;
+        }
+        if (flags & IPC_NOWAIT) {
+            return -1;
+        }
+        int result = empty ? futex_wait(&in->write_seq, in_seq, FUTEX_WAIT_FOREVER)
+                           : futex_wait(&out->read_seq, out_seq, FUTEX_WAIT_FOREVER);
+        if (result != 0) {
+            return -1;
+        }
+    }
+}
+
+// Unlocked, the sink works on a piece taken off the head. What it does
+// not take goes back in front if there is a free buffer for it.
+int pipe_splice_to(pipe_t* pipe, pipe_sink_fn_t sink, int fd, uint32_t count, uint32_t flags) {
+    if (!pipe || !sink) {
+        return -1;
+    }
+    
+    uint32_t total = 0;
+    int error = 0;
+    while (total < count) {
+        uint32_t seq = pipe->write_seq;
+        uint32_t lock_flags = spin_lock_irqsave(&pipe->lock);
+        if (pipe->head == pipe->tail) {
+            bool closed = pipe->closed_for_writing;
+            spin_unlock_irqrestore(&pipe->lock, lock_flags);
+            if (total > 0 || closed) {
+                break;
+            }
+            if ((flags & IPC_NOWAIT) ||
+                futex_wait(&pipe->write_seq, seq, FUTEX_WAIT_FOREVER) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        
+        pipe_buffer_t* buf = pipe_buf(pipe, pipe->head);
+        pipe_buffer_t piece = *buf;
+        if (count - total < buf->len) {
+            frame_ref(buf->page);
+            piece.len = count - total;
+            buf->offset += piece.len;
+            buf->len -= piece.len;
+        } else {
+            pipe->head++;
+        }
+        pipe->size -= piece.len;
+        pipe->read_seq++;
+        spin_unlock_irqrestore(&pipe->lock, lock_flags);
+        pipe_wake_writers(pipe);
+        
+        int sent = sink(fd, (uint8_t*)piece.page + piece.offset, piece.len);
+        if (sent > 0) {
+            total += (uint32_t)sent;
+        }
+        if (sent == (int)piece.len) {
+            free_page_frame(piece.page);
+            continue;
+        }
+        
+        uint32_t taken = sent > 0 ? (uint32_t)sent : 0;
+        piece.offset += taken;
+        piece.len -= taken;
+        lock_flags = spin_lock_irqsave(&pipe->lock);
+        pipe_buffer_t* head = pipe->head != pipe->tail ? pipe_buf(pipe, pipe->head) : NULL;
+        bool merge = head && head->page == piece.page &&
+                     head->offset == piece.offset + piece.len;
+        bool put_back = merge || !pipe_full(pipe);
+        if (merge) {
+            // The rest of a split buffer: rejoin it and drop the extra reference
+            head->offset = piece.offset;
+            head->len += piece.len;
+        } else if (put_back) {
+            *pipe_buf(pipe, --pipe->head) = piece;
+        }
+        if (put_back) {
+            pipe->size += piece.len;
+            pipe->write_seq++;
+        }
+        spin_unlock_irqrestore(&pipe->lock, lock_flags);
+        if (put_back) {
+            pipe_wake_readers(pipe);
+        }
+        if (!put_back || merge) {
+            free_page_frame(piece.page);
+        }
+        error = -1;
+        break;
+    }
+    
+    return total > 0 ? (int)total : error;
+}
+
+// The source reads into a page of the pipe's, which is then queued as is
+int pipe_splice_from(pipe_t* pipe, pipe_source_fn_t source, int fd, uint32_t count, uint32_t flags) {
+    if (!pipe || !source) {
+        return -1;
+    }
+    
+    uint32_t total = 0;
+    while (total < count) {
+        uint32_t seq = pipe->read_seq;
+        uint32_t lock_flags = spin_lock_irqsave(&pipe->lock);
+        bool closed = pipe->closed_for_reading;
+        bool full = pipe_full(pipe);
+        uint32_t page = closed || full ? 0 : pipe_page_get(pipe);
+        spin_unlock_irqrestore(&pipe->lock, lock_flags);
+        if (closed) {
+            return total > 0 ? (int)total : -1;
+        }
+        if (full) {
+            if (total > 0 || (flags & IPC_NOWAIT) ||
+                futex_wait(&pipe->read_seq, seq, FUTEX_WAIT_FOREVER) != 0) {
+                break;
+            }
+            continue;
+        }
+        if (!page) {
+            break;
+        }
+        
+        uint32_t want = count - total < PAGE_SIZE ? count - total : PAGE_SIZE;
+        int got = source(fd, (void*)page, want);
+        if (got <= 0) {
+            free_page_frame(page);
+            if (total == 0) {
+                return got;
+            }
+            break;
+        }
+        
+        // Another writer may have taken the free buffer meanwhile: the data
+        // is already read, so wait for one even when not blocking
+        while (1) {
+            seq = pipe->read_seq;
+            lock_flags = spin_lock_irqsave(&pipe->lock);
+            closed = pipe->closed_for_reading;
+            full = pipe_full(pipe);
+            if (!closed && !full) {
+                pipe_buffer_t* buf = pipe_buf(pipe, pipe->tail++);
+                buf->page = page;
+                buf->offset = 0;
+                buf->len = (uint16_t)got;
+                pipe->size += (uint32_t)got;
+                pipe->write_seq++;
+            }
+            spin_unlock_irqrestore(&pipe->lock, lock_flags);
+            if (closed || !full ||
+                futex_wait(&pipe->read_seq, seq, FUTEX_WAIT_FOREVER) != 0) {
+                break;
+            }
+        }
+        if (closed || full) {
+            free_page_frame(page);
+            break;
+        }
+        pipe_wake_readers(pipe);
+        total += (uint32_t)got;
+        if ((uint32_t)got < want) {
+            break;      // Source has no more for now
+        }
+    }
+    
+    return total > 0 || count == 0 ? (int)total : -1;
+}
+
+// Returns true once both ends are closed, for the caller to destroy it
+bool pipe_close_read(pipe_t* pipe) {
+    uint32_t lock_flags = spin_lock_irqsave(&pipe->lock);
+    bool closed = pipe->readers > 0 && --pipe->readers == 0;
+    if (closed) {
+        pipe->closed_for_reading = 1;
+        pipe->read_seq++;
+    }
+    bool unused = pipe->readers == 0 && pipe->writers == 0;
+    spin_unlock_irqrestore(&pipe->lock, lock_flags);
+    if (closed) {
+        futex_wake(&pipe->read_seq, FUTEX_WAKE_ALL);
+        poll_wake(&pipe->poll, POLL_HUP);
+    }
+    return unused;
+}
+
+bool pipe_close_write(pipe_t* pipe) {
+    uint32_t lock_flags = spin_lock_irqsave(&pipe->lock);
+    bool closed = pipe->writers > 0 && --pipe->writers == 0;
+    if (closed) {
+        pipe->closed_for_writing = 1;
+        pipe->write_seq++;
+    }
+    bool unused = pipe->readers == 0 && pipe->writers == 0;
+    spin_unlock_irqrestore(&pipe->lock, lock_flags);
+    if (closed) {
+        futex_wake(&pipe->write_seq, FUTEX_WAKE_ALL);
+        poll_wake(&pipe->poll, POLL_HUP | POLL_IN);     // End of file is readable
+    }
+    return unused;
+}
+
+// Lock-free SPSC ring buffer
+int ringbuf_init(lockfree_ringbuf_t* rb, uint32_t size, uint32_t element_size) {
+    if (!rb || size == 0 || size > 0x80000000 || element_size == 0) {
+        return -1;
+    }
+    
+    // Ensure size is power of 2 for efficient modulo
+    uint32_t power_of_two = 1;
+    while (power_of_two < size) {
+        power_of_two <<= 1;
+    }
+    
+    rb->buffer = kmalloc_aligned(power_of_two * element_size, CACHE_LINE_SIZE);
+    if (!rb->buffer) {
+        return -1;
+    }
+    
+    rb->size = power_of_two;
+    rb->mask = power_of_two - 1;
+    rb->element_size = element_size;
+    rb->head = 0;
+    rb->tail = 0;
+    rb->head_cache = 0;
+    rb->tail_cache = 0;
+    
+    return 0;
+}
+
+void ringbuf_destroy(lockfree_ringbuf_t* rb) {
+    if (!rb) {
+        return;
+    }
+    
+    kfree_aligned(rb->buffer);
+    rb->buffer = NULL;
+}
+
+// Producer: free slots from tail, rereading head only when the cached copy
+// shows fewer than 'want'
+static uint32_t ringbuf_space(lockfree_ringbuf_t* rb, uint32_t tail, uint32_t want) {
+    uint32_t space = rb->size - (tail - rb->head_cache);
+    if (space < want) {
+        rb->head_cache = load_acquire(&rb->head);
+        space = rb->size - (tail - rb->head_cache);
+    }
+    return space;
+}
+
+// Consumer: filled slots from head, likewise through the cached tail
+static uint32_t ringbuf_filled(lockfree_ringbuf_t* rb, uint32_t head, uint32_t want) {
+    uint32_t filled = rb->tail_cache - head;
+    if (filled < want) {
+        rb->tail_cache = load_acquire(&rb->tail);
+        filled = rb->tail_cache - head;
+    }
+    return filled;
+}
+
+int ringbuf_push(lockfree_ringbuf_t* rb, const void* data) {
+    if (!rb || !data) {
+        return -1;
+    }
+    
+    uint32_t tail = rb->tail;
+    if (ringbuf_space(rb, tail, 1) == 0) {
+        return -1; // Buffer full
+    }
+    
+    memcpy(rb->buffer + (tail & rb->mask) * rb->element_size, data, rb->element_size);
+    store_release(&rb->tail, tail + 1);
+    return 0;
+}
+
+int ringbuf_pop(lockfree_ringbuf_t* rb, void* data) {
+    if (!rb || !data) {
+        return -1;
+    }
+    
+    uint32_t head = rb->head;
+    if (ringbuf_filled(rb, head, 1) == 0) {
+        return -1; // Buffer empty
+    }
+    
+    memcpy(data, rb->buffer + (head & rb->mask) * rb->element_size, rb->element_size);
+    store_release(&rb->head, head + 1);
+    return 0;
+}
+
+// At most two copies: up to the end of the buffer, then from its start
+uint32_t ringbuf_push_n(lockfree_ringbuf_t* rb, const void* data, uint32_t count) {
+    if (!rb || !data || count == 0) {
+        return 0;
+    }
+    
+    uint32_t tail = rb->tail;
+    uint32_t space = ringbuf_space(rb, tail, count);
+    if (count > space) count = space;
+    if (count == 0) {
+        return 0;
+    }
+    
+    uint32_t index = tail & rb->mask;
+    uint32_t first = rb->size - index;
+    if (first > count) first = count;
+    memcpy(rb->buffer + index * rb->element_size, data, first * rb->element_size);
+    memcpy(rb->buffer, (const uint8_t*)data + first * rb->element_size,
+           (count - first) * rb->element_size);
+    store_release(&rb->tail, tail + count);
+    return count;
+}
+
+uint32_t ringbuf_pop_n(lockfree_ringbuf_t* rb, void* data, uint32_t count) {
+    if (!rb || !data || count == 0) {
+        return 0;
+    }
+    
+    uint32_t head = rb->head;
+    uint32_t filled = ringbuf_filled(rb, head, count);
+    if (count > filled) count = filled;
+    if (count == 0) {
+        return 0;
+    }
+    
+    uint32_t index = head & rb->mask;
+    uint32_t first = rb->size - index;
+    if (first > count) first = count;
+    memcpy(data, rb->buffer + index * rb->element_size, first * rb->element_size);
+    memcpy((uint8_t*)data + first * rb->element_size, rb->buffer,
+           (count - first) * rb->element_size);
+    store_release(&rb->head, head + count);
+    return count;
+}
+
+void* ringbuf_reserve(lockfree_ringbuf_t* rb, uint32_t count, uint32_t* avail) {
+    uint32_t tail = rb->tail;
+    uint32_t index = tail & rb->mask;
+    uint32_t space = ringbuf_space(rb, tail, count);
+    if (space > rb->size - index) space = rb->size - index;
+    if (count > space) count = space;
+    
+    *avail = count;
+    return count ? rb->buffer + index * rb->element_size : NULL;
+}
+
+void ringbuf_commit(lockfree_ringbuf_t* rb, uint32_t count) {
+    store_release(&rb->tail, rb->tail + count);
+}
+
+void* ringbuf_peek(lockfree_ringbuf_t* rb, uint32_t count, uint32_t* avail) {
+    uint32_t head = rb->head;
+    uint32_t index = head & rb->mask;
+    uint32_t filled = ringbuf_filled(rb, head, count);
+    if (filled > rb->size - index) filled = rb->size - index;
+    if (count > filled) count = filled;
+    
+    *avail = count;
+    return count ? rb->buffer + index * rb->element_size : NULL;
+}
+
+void ringbuf_release(lockfree_ringbuf_t* rb, uint32_t count) {
+    store_release(&rb->head, rb->head + count);
+}
+
+uint32_t ringbuf_count(const lockfree_ringbuf_t* rb) {
+    if (!rb) {
+        return 0;
+    }
+    
+    return load_acquire(&rb->tail) - load_acquire(&rb->head);
+}
+
+// Shared memory pools for trading data
+// Locked pool side of the magazine layer
+static void* shared_pool_take(void* backend) {
+    shared_pool_t* pool = backend;
+    uint32_t flags = spin_lock_irqsave(&pool->lock);
+    void** element = pool->free_list;
+    if (!element) {
+        spin_unlock_irqrestore(&pool->lock, flags);
+        return NULL;
+    }
+    pool->free_list = *element;
+    pool->used_elements++;
+    
+    // Mark as allocated
+    uint32_t index = ((uint8_t*)element - (uint8_t*)pool->base_addr) / pool->element_size;
+    pool->allocation_bitmap[index / 8] |= 1 << (index % 8);
+    spin_unlock_irqrestore(&pool->lock, flags);
+    
+    *element = NULL;
+    return element;
+}
+
+static void shared_pool_put(void* backend, void* ptr) {
+    shared_pool_t* pool = backend;
+    uint32_t index = ((uint8_t*)ptr - (uint8_t*)pool->base_addr) / pool->element_size;
+    uint32_t byte_idx = index / 8;
+    uint32_t bit_idx = index % 8;
+    
+    // Mark as free
+    uint32_t flags = spin_lock_irqsave(&pool->lock);
+    if (pool->allocation_bitmap[byte_idx] & (1 << bit_idx)) {
+        pool->allocation_bitmap[byte_idx] &= ~(1 << bit_idx);
+        pool->used_elements--;
+        *(void**)ptr = pool->free_list;
+        pool->free_list = ptr;
+    }
+    spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+shared_pool_t* create_shared_pool(uint32_t element_size, uint32_t max_elements) {
+    return create_shared_pool_aligned(element_size, max_elements, 0);
+}
+
+shared_pool_t* create_shared_pool_aligned(uint32_t element_size, uint32_t max_elements,
+                                          uint32_t align) {
+    if (element_size == 0 || max_elements == 0 || (align & (align - 1))) {
+        return NULL;
+    }
+    
+    shared_pool_t* pool = kmalloc_aligned(sizeof(shared_pool_t), CACHE_LINE_SIZE);
+    if (!pool) {
+        return NULL;
+    }
+    
+    // Each free element holds the free list link
+    element_size = pool_stride(element_size, align);
+    
+    pool->element_size = element_size;
+    pool->max_elements = max_elements;
+    pool->used_elements = 0;
+    spin_lock_init(&pool->lock);
+    
+    // Allocate memory for elements
+    pool->size = element_size * max_elements;
+    pool->base_addr = kmalloc_coloured(pool->size);
+    if (!pool->base_addr) {
+        kfree_aligned(pool);
+        return NULL;
+    }
+    
+    // Allocate bitmap for tracking allocations
+    uint32_t bitmap_size = (max_elements + 7) / 8; // Round up to bytes
     pool->allocation_bitmap = kmalloc(bitmap_size);
     if (!pool->allocation_bitmap) {
-        kfree(pool->base_addr);
-        kfree(pool);
+        kfree_aligned(pool->base_addr);
+        kfree_aligned(pool);
         return NULL;
     }
     
     memset(pool->allocation_bitmap, 0, bitmap_size);
     
+    // Chain every element, lowest address first
+    pool->free_list = NULL;
+    for (uint32_t i = max_elements; i-- > 0;) {
+        void** element = (void**)((uint8_t*)pool->base_addr + i * element_size);
+        *element = pool->free_list;
+        pool->free_list = element;
+    }
+    
+    pool->cache = mag_cache_create("shared pool", element_size,
+                                   shared_pool_take, shared_pool_put, pool);
     return pool;
 }
 
 void* shared_pool_alloc(shared_pool_t* pool) {
-    if (!pool || pool->used_elements >= pool->max_elements) {
+    if (!pool) {
         return NULL;
     }
     
-    // Find free slot
-    for (uint32_t i = 0; i < pool->max_elements; i++) {
-        uint32_t byte_idx = i / 8;
-        uint32_t bit_idx = i % 8;
-        
-        if (!(pool->allocation_bitmap[byte_idx] & (1 << bit_idx))) {
-            // Mark as allocated
-            pool->allocation_bitmap[byte_idx] |= (1 << bit_idx);
-            pool->used_elements++;
-            
-            // Return pointer to element
-            return (uint8_t*)pool->base_addr + (i * pool->element_size);
-        }
+    if (pool->cache) {
+        return mag_alloc(pool->cache);
     }
-    
-    return NULL;
+    return shared_pool_take(pool);
 }
 
 void shared_pool_free(shared_pool_t* pool, void* ptr) {
@@ -483,17 +1545,14 @@ void shared_pool_free(shared_pool_t* pool, void* ptr) {
     uintptr_t offset = (uintptr_t)ptr - (uintptr_t)pool->base_addr;
     uint32_t index = offset / pool->element_size;
     
-    if (index >= pool->max_elements) {
+    if (index >= pool->max_elements || offset % pool->element_size != 0) {
         return; // Invalid pointer
     }
     
-    uint32_t byte_idx = index / 8;
-    uint32_t bit_idx = index % 8;
-    
-    // Mark as free
-    if (pool->allocation_bitmap[byte_idx] & (1 << bit_idx)) {
-        pool->allocation_bitmap[byte_idx] &= ~(1 << bit_idx);
-        pool->used_elements--;
+    if (pool->cache) {
+        mag_free(pool->cache, ptr);
+    } else {
+        shared_pool_put(pool, ptr);
     }
 }
 
@@ -502,11 +1561,248 @@ void destroy_shared_pool(shared_pool_t* pool) {
         return;
     }
     
-    if (pool->base_addr) {
-        kfree(pool->base_addr);
-    }
+    mag_cache_destroy(pool->cache);
+    kfree_aligned(pool->base_addr);
     if (pool->allocation_bitmap) {
         kfree(pool->allocation_bitmap);
     }
-    kfree(pool);
-}
\ No newline at end of file
+    kfree_aligned(pool);
+}
+
+// Shared memory segments (shm_lock held for all of these)
+static shm_segment_t* shm_find(uint32_t key) {
+    if (key == IPC_PRIVATE) {
+        return NULL;
+    }
+    for (int i = 0; i < MAX_SHARED_SEGMENTS; i++) {
+        if (shm_segments[i].data && !shm_segments[i].removed && shm_segments[i].key == key) {
+            return &shm_segments[i];
+        }
+    }
+    return NULL;
+}
+
+// An id names its slot, as for message queues
+static shm_segment_t* shm_lookup(int shmid) {
+    shm_segment_t* segment = &shm_segments[(uint32_t)(shmid - 1) & (MAX_SHARED_SEGMENTS - 1)];
+    return segment->data && segment->id == (uint32_t)shmid ? segment : NULL;
+}
+
+static void shm_free(shm_segment_t* segment) {
+    free_region((uint32_t)segment->data, segment->size);
+    segment->data = NULL;
+    segment->id = 0;
+}
+
+// Lowest free range of the window for 'size' bytes, 4MB aligned when the
+// segment can use huge pages; 0 if none
+static uint32_t shm_place(process_t* process, uint32_t size) {
+    uint32_t align = size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : PAGE_SIZE;
+    uint32_t addr = SHM_VIRTUAL_BASE;
+    for (int i = 0; i < MAX_SHM_ATTACH; i++) {
+        shm_attachment_t* other = &process->shm[i];
+        if (other->segment && addr < other->addr + other->segment->size &&
+            other->addr < addr + size) {
+            addr = (other->addr + other->segment->size + align - 1) & ~(align - 1);
+            i = -1;     // Recheck against all of them
+        }
+    }
+    return addr + size <= SHM_VIRTUAL_END ? addr : 0;
+}
+
+static void shm_detach(process_t* process, shm_attachment_t* attachment) {
+    shm_segment_t* segment = attachment->segment;
+    if (process->page_directory) {
+        unmap_region((page_directory_t*)process->page_directory, attachment->addr, segment->size);
+    }
+    attachment->segment = NULL;
+    attachment->addr = 0;
+    if (--segment->ref_count == 0 && segment->removed) {
+        shm_free(segment);
+    }
+}
+
+int ipc_shmget(uint32_t key, uint32_t size, uint32_t flags) {
+    if (size == 0) {
+        return -1;
+    }
+    
+    uint32_t lock_flags = spin_lock_irqsave(&shm_lock);
+    shm_segment_t* segment = shm_find(key);
+    if (segment || !(flags & IPC_CREAT)) {
+        int id = segment && segment->size >= size ? (int)segment->id : -1;
+        spin_unlock_irqrestore(&shm_lock, lock_flags);
+        return id;
+    }
+    spin_unlock_irqrestore(&shm_lock, lock_flags);
+    
+    // Zeroed before anyone can find it. A 4MB request gets a huge frame,
+    // mapped with one TLB entry.
+    void* data = (void*)allocate_region(size);
+    if (!data) {
+        return -1;
+    }
+    memset(data, 0, page_align_up(size));
+    
+    lock_flags = spin_lock_irqsave(&shm_lock);
+    segment = shm_find(key);
+    if (segment) {
+        // Created meanwhile by someone else
+        int id = segment->size >= size ? (int)segment->id : -1;
+        spin_unlock_irqrestore(&shm_lock, lock_flags);
+        free_region((uint32_t)data, size);
+        return id;
+    }
+    for (int i = 0; i < MAX_SHARED_SEGMENTS; i++) {
+        if (!shm_segments[i].data) {
+            segment = &shm_segments[i];
+            segment->id = next_shm_id++ * MAX_SHARED_SEGMENTS + i + 1;
+            segment->key = key;
+            segment->size = page_align_up(size);
+            segment->data = data;
+            segment->ref_count = 0;
+            segment->removed = 0;
+            segment->permissions = PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER | PAGE_SHARED;
+            break;
+        }
+    }
+    int id = segment ? (int)segment->id : -1;
+    spin_unlock_irqrestore(&shm_lock, lock_flags);
+    
+    if (!segment) {
+        free_region((uint32_t)data, size);
+    }
+    return id;
+}
+
+// Maps the segment's frames into the process, so it reaches them with plain
+// loads and stores; identity address when it has no page directory
+void* ipc_shmat(process_t* process, int shmid, uint32_t flags) {
+    if (!process) {
+        return NULL;
+    }
+    
+    uint32_t lock_flags = spin_lock_irqsave(&shm_lock);
+    shm_segment_t* segment = shm_lookup(shmid);
+    shm_attachment_t* attachment = NULL;
+    for (int i = 0; segment && !segment->removed && i < MAX_SHM_ATTACH; i++) {
+        if (!process->shm[i].segment) {
+            attachment = &process->shm[i];
+            break;
+        }
+    }
+    if (!attachment) {
+        spin_unlock_irqrestore(&shm_lock, lock_flags);
+        return NULL;
+    }
+    
+    uint32_t addr = (uint32_t)segment->data;
+    if (process->page_directory) {
+        page_directory_t* dir = (page_directory_t*)process->page_directory;
+        uint32_t permissions = segment->permissions;
+        if (flags & SHM_RDONLY) {
+            permissions &= ~PAGE_WRITABLE;
+        }
+        addr = shm_place(process, segment->size);
+        if (!addr || map_region(dir, addr, (uint32_t)segment->data, segment->size, permissions) != 0) {
+            if (addr) {
+                unmap_region(dir, addr, segment->size);
+            }
+            spin_unlock_irqrestore(&shm_lock, lock_flags);
+            return NULL;
+        }
+    }
+    
+    attachment->segment = segment;
+    attachment->addr = addr;
+    segment->ref_count++;
+    spin_unlock_irqrestore(&shm_lock, lock_flags);
+    return (void*)addr;
+}
+
+int ipc_shmdt(process_t* process, void* addr) {
+    if (!process) {
+        return -1;
+    }
+    
+    uint32_t lock_flags = spin_lock_irqsave(&shm_lock);
+    for (int i = 0; i < MAX_SHM_ATTACH; i++) {
+        if (process->shm[i].segment && process->shm[i].addr == (uint32_t)addr) {
+            shm_detach(process, &process->shm[i]);
+            spin_unlock_irqrestore(&shm_lock, lock_flags);
+            return 0;
+        }
+    }
+    spin_unlock_irqrestore(&shm_lock, lock_flags);
+    return -1;
+}
+
+int ipc_shmctl(int shmid, uint32_t cmd) {
+    if (cmd != IPC_RMID) {
+        return -1;
+    }
+    
+    uint32_t lock_flags = spin_lock_irqsave(&shm_lock);
+    shm_segment_t* segment = shm_lookup(shmid);
+    if (segment) {
+        segment->removed = 1;
+        if (segment->ref_count == 0) {
+            shm_free(segment);
+        }
+    }
+    spin_unlock_irqrestore(&shm_lock, lock_flags);
+    return segment ? 0 : -1;
+}
+
+// The cloned directory already maps the segments (PAGE_SHARED survives fork)
+void ipc_shm_fork(process_t* parent, process_t* child) {
+    uint32_t lock_flags = spin_lock_irqsave(&shm_lock);
+    for (int i = 0; i < MAX_SHM_ATTACH; i++) {
+        child->shm[i] = parent->shm[i];
+        if (child->shm[i].segment) {
+            child->shm[i].segment->ref_count++;
+        }
+    }
+    spin_unlock_irqrestore(&shm_lock, lock_flags);
+}
+
+void ipc_shm_exit(process_t* process) {
+    uint32_t lock_flags = spin_lock_irqsave(&shm_lock);
+    for (int i = 0; i < MAX_SHM_ATTACH; i++) {
+        if (process->shm[i].segment) {
+            shm_detach(process, &process->shm[i]);
+        }
+    }
+    spin_unlock_irqrestore(&shm_lock, lock_flags);
+}
+
+// Kernel-side use by key: the frames' identity address
+void* ipc_create_shared_memory(uint32_t size, uint32_t key) {
+    int id = ipc_shmget(key, size, IPC_CREAT);
+    if (id < 0) {
+        return NULL;
+    }
+    
+    uint32_t lock_flags = spin_lock_irqsave(&shm_lock);
+    shm_segment_t* segment = shm_lookup(id);
+    void* data = segment ? segment->data : NULL;
+    spin_unlock_irqrestore(&shm_lock, lock_flags);
+    return data;
+}
+
+// Freed once every process has detached
+int ipc_destroy_shared_memory(uint32_t key) {
+    uint32_t lock_flags = spin_lock_irqsave(&shm_lock);
+    shm_segment_t* segment = shm_find(key);
+    int id = segment ? (int)segment->id : -1;
+    spin_unlock_irqrestore(&shm_lock, lock_flags);
+    return id < 0 ? -1 : ipc_shmctl(id, IPC_RMID);
+}
+
+void* ipc_attach_shared_memory(process_t* process, uint32_t key) {
+    uint32_t lock_flags = spin_lock_irqsave(&shm_lock);
+    shm_segment_t* segment = shm_find(key);
+    int id = segment ? (int)segment->id : -1;
+    spin_unlock_irqrestore(&shm_lock, lock_flags);
+    return id < 0 ? NULL : ipc_shmat(process, id, 0);
+}
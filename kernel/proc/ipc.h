@@ -2,14 +2,23 @@
 #define IPC_H
 
 #include "../types.h"
+#include "../arch/spinlock.h"
+#include "mutex.h"
+#include "snapshot.h"
+#include "syscalls.h"
 
-// Message queue constants
+// Message queue constants. A queue id names its slot: (id - 1) modulo
+// MAX_MESSAGE_QUEUES, which must be a power of two.
 #define MAX_MESSAGE_QUEUES 32
 #define MAX_MESSAGE_SIZE 1024
 #define MAX_QUEUE_SIZE 64
 
 // Semaphore constants
 #define MAX_SEMAPHORES 64
+#define MAX_SHARED_SEGMENTS 16      // Power of two: ids name their slot
+#define SHM_VIRTUAL_BASE    0x80000000  // Window user processes attach segments in
+#define SHM_VIRTUAL_END     0xC0000000
+#define SEM_VALUE_MAX 32767
 
 // Message types for trading algorithms
 #define MSG_MARKET_DATA     1
@@ -26,22 +35,69 @@ typedef struct {
     uint32_t sender_pid;
     uint32_t size;
     uint8_t data[MAX_MESSAGE_SIZE];
-    uint32_t timestamp;
+    uint64_t timestamp;     // ktime_ns()
     uint32_t priority;
 } message_t;
 
+// Queued messages are variable-length records in a byte ring: this header,
+// then the data, padded to MSGQ_RECORD_ALIGN. A send copies the header and
+// 'size' bytes, not a whole message_t. The ring is allocated by the first
+// send and doubles, compacting, up to MSGQ_RING_MAX when a message does not
+// fit; msgctl(IPC_RMID) frees it.
+//
+// Every record is also on two lists threaded through the ring: its type's
+// sub-queue (types share one when they are equal modulo MSGQ_TYPE_LISTS)
+// and the FIFO of its priority level, 0 the highest. msgrcv of a type
+// takes the head of its sub-queue; type 0 takes the oldest message of the
+// highest non-empty level, found from a bitmap.
+#define MSGQ_RING_MIN       4096
+#define MSGQ_RING_MAX       (64 * 1024)
+#define MSGQ_RECORD_ALIGN   16          // Room for a padding record's length and flags
+#define MSGQ_RECORD_DEAD    0x1         // Taken out of order, or padding at the end
+#define MSGQ_TYPE_LISTS     8           // The MSG_* types each get their own
+#define MSGQ_PRIORITIES     4           // Priorities above 3 share the lowest level
+#define MSGQ_LIST_TYPE      0
+#define MSGQ_LIST_PRIORITY  1
+#define MSGQ_NONE           0xFFFFFFFF  // End of a list
+
+typedef struct {
+    uint32_t length;        // Header, data and padding
+    uint32_t flags;         // MSGQ_RECORD_*
+    uint32_t type;
+    uint32_t sender_pid;
+    uint32_t size;          // Data bytes
+    uint32_t priority;
+    uint64_t timestamp;     // ktime_ns()
+    uint32_t next[2];       // Ring offsets along MSGQ_LIST_TYPE and _PRIORITY
+    uint32_t prev[2];
+} msg_record_t;
+
+typedef struct {
+    uint32_t head;          // Ring offsets, MSGQ_NONE when empty
+    uint32_t tail;
+} msgq_list_t;
+
 // Message queue structure
 typedef struct {
     uint32_t id;
     uint32_t key;
-    message_t messages[MAX_QUEUE_SIZE];
-    uint32_t head;
+    uint8_t* ring;                  // NULL until the first send
+    uint32_t ring_size;             // Bytes, a power of two
+    uint32_t head;                  // Byte offsets, free running
     uint32_t tail;
-    uint32_t count;
-    uint32_t max_size;
+    uint32_t live;                  // Bytes of them in records not yet taken
+    uint32_t count;                 // Messages queued
+    msgq_list_t by_type[MSGQ_TYPE_LISTS];
+    msgq_list_t by_priority[MSGQ_PRIORITIES];
+    uint32_t priority_mask;         // Bit per non-empty level
+    uint32_t max_size;              // Messages at most
     uint32_t permissions;
     uint32_t creator_pid;
     uint8_t in_use;
+    spinlock_t lock;                // Messages and counters
+    volatile uint32_t send_seq;     // Bumped per message added (receivers wait on it)
+    volatile uint32_t recv_seq;     // Bumped per message removed (senders wait on it)
+    poll_head_t poll;               // Poll sets watching it
 } message_queue_t;
 
 // Semaphore structure
@@ -49,23 +105,29 @@ typedef struct {
     uint32_t id;
     uint32_t key;
     int32_t value;
-    uint32_t max_value;
+    uint32_t max_value;     // 1 = binary: the taker owns it and inherits waiters' priority
     uint32_t wait_count;
     uint32_t permissions;
     uint32_t creator_pid;
     uint8_t in_use;
+    pi_object_t pi;         // Waiters and current owner (binary semaphores)
 } semaphore_t;
 
-// Trading-specific shared data structures
+// Trading-specific shared data structures. They stay compact (28, 40 and
+// 48 bytes) to travel in messages; a pool of per-symbol records updated
+// from several CPUs should come from create_shared_pool_aligned with
+// CACHE_LINE_SIZE, or two market_data_t would share a line.
 typedef struct {
     double price;
     uint64_t volume;
-    uint32_t timestamp;
+    uint64_t timestamp;     // ktime_ns(); from the feed, the frame's receive stamp
     uint16_t symbol_id;
-    uint8_t side;       // 0=bid, 1=ask
+    uint8_t side;       // 0=bid, 1=ask, 2=trade (MD_SIDE_TRADE)
     uint8_t flags;
 } market_data_t;
 
+#define MD_SIDE_TRADE       2
+
 typedef struct {
     uint32_t order_id;
     uint16_t symbol_id;
@@ -73,7 +135,7 @@ typedef struct {
     uint8_t type;       // 0=market, 1=limit, 2=stop
     double price;
     uint64_t quantity;
-    uint32_t timestamp;
+    uint64_t timestamp;     // ktime_ns()
     uint32_t client_id;
     uint8_t status;     // 0=pending, 1=filled, 2=cancelled
 } order_t;
@@ -85,7 +147,7 @@ typedef struct {
     double avg_price;
     double unrealized_pnl;
     double realized_pnl;
-    uint32_t timestamp;
+    uint64_t timestamp;     // ktime_ns()
 } position_t;
 
 // IPC management functions
@@ -97,6 +159,12 @@ int msgsnd(uint32_t msgid, const message_t* msg, uint32_t size, uint32_t flags);
 int msgrcv(uint32_t msgid, message_t* msg, uint32_t size, uint32_t type, uint32_t flags);
 int msgctl(uint32_t msgid, uint32_t cmd, void* buf);
 
+// Without a message_t: 'size' bytes from or into the caller's buffer.
+// msgrcv_buf returns the size or -1 like msgrcv_timeout.
+int msgsnd_buf(uint32_t msgid, uint32_t type, uint32_t priority, const void* data,
+               uint32_t size, uint32_t flags);
+int msgrcv_buf(uint32_t msgid, uint32_t type, void* data, uint32_t size, uint32_t timeout_ms);
+
 // Semaphore operation structure
 typedef struct sembuf {
     uint16_t sem_num;    // semaphore number
@@ -104,50 +172,168 @@ typedef struct sembuf {
     int16_t sem_flg;     // operation flags
 } sembuf_t;
 
+// Blocking variant of msgrcv: waits up to timeout_ms (FUTEX_WAIT_FOREVER
+// for no limit, 0 to poll) for a matching message
+int msgrcv_timeout(uint32_t msgid, message_t* msg, uint32_t size, uint32_t type,
+                   uint32_t timeout_ms);
+
+// Word bumped per message added, for waiting outside msgrcv (see coro.h);
+// NULL if the queue does not exist
+volatile uint32_t* msgq_send_seq(uint32_t msgid);
+
+// Watch a queue in a poll set (poll.h): POLL_IN per message sent, POLL_OUT
+// per message taken, POLL_HUP when it is removed
+int msgq_poll_add(pollset_t* set, uint32_t msgid, uint32_t events, uint32_t cookie);
+
 // Semaphore functions
 uint32_t semget(uint32_t key, uint32_t nsems, uint32_t flags);
 int semop(uint32_t semid, sembuf_t* ops, uint32_t nops);
+int semtimedop(uint32_t semid, sembuf_t* ops, uint32_t nops, uint32_t timeout_ms);
 int semctl(uint32_t semid, uint32_t semnum, uint32_t cmd, void* arg);
 
 // Trading-specific IPC functions
 int send_market_data(uint32_t queue_id, const market_data_t* data);
 int receive_market_data(uint32_t queue_id, market_data_t* data);
 int send_order(uint32_t queue_id, const order_t* order);
+int send_order_flags(uint32_t queue_id, const order_t* order, uint32_t flags);    // IPC_NOWAIT
 int receive_order(uint32_t queue_id, order_t* order);
 int broadcast_trade_signal(uint32_t signal_type, const void* data, uint32_t size);
 
+// Trade signals are written once into a multicast sequencer (sequencer.h)
+// and read in place by every subscriber. A subscriber set up 'after' others
+// (a mask of their numbers, say the gateway after risk) sees each signal
+// once they are done with it; broadcasting waits up to TRADE_SIGNAL_WAIT_MS
+// for the slowest subscriber to make room.
+#define TRADE_SIGNAL_SLOTS      256
+#define TRADE_SIGNAL_MAX_DATA   112
+#define TRADE_SIGNAL_WAIT_MS    10
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+    uint64_t timestamp;     // ktime_ns()
+    uint8_t data[TRADE_SIGNAL_MAX_DATA];
+} trade_signal_t;
+
+int trade_signal_subscribe(uint32_t after);     // Subscriber number, or -1
+void trade_signal_unsubscribe(int subscriber);
+const trade_signal_t* trade_signal_next(int subscriber, uint32_t timeout_ms);  // NULL on timeout
+void trade_signal_done(int subscriber);         // Finished with the last one
+void trade_signal_print_info(void);
+
+// Latest quote per symbol for readers that do not need every update: a
+// seqlocked table (snapshot.h) in the shared memory segment keyed
+// MARKET_SNAPSHOT_KEY, which processes can attach and read in place. The
+// feed handler is its one writer: bids and asks replace that side of the
+// book, trades set the last price and add to the volume.
+#define MARKET_SNAPSHOT_KEY     0x4D444154  // "MDAT"
+#define MARKET_SNAPSHOT_SYMBOLS 1024
+
+int market_snapshot_update(const market_data_t* data);
+int market_snapshot_read(uint16_t symbol_id, md_snapshot_t* out);
+uint32_t market_snapshot_conflate(uint32_t* cursor, md_conflate_fn_t fn, void* ctx);
+
 // Real-time messaging for high-frequency trading
 int send_priority_message(uint32_t queue_id, uint32_t type, const void* data, 
                          uint32_t size, uint32_t priority);
 int receive_priority_message(uint32_t queue_id, uint32_t type, void* data, 
                             uint32_t max_size, uint32_t timeout);
 
-// Lock-free ring buffer for ultra-low latency
+// Pipes: reads block until data arrives or the write side closes (0 = end
+// of file), writes until everything fits or the read side closes.
+// flags: IPC_NOWAIT returns what could be done without blocking. A new
+// pipe has one reader and one writer; pipe_ref adds one (fork), and the
+// close that leaves neither returns true for the caller to destroy it.
+void pipe_init(pipe_t* pipe);
+pipe_t* pipe_create(void);
+void pipe_destroy(pipe_t* pipe);
+void pipe_ref(pipe_t* pipe, bool writer);
+int pipe_read(pipe_t* pipe, void* buffer, uint32_t count, uint32_t flags);
+int pipe_write(pipe_t* pipe, const void* buffer, uint32_t count, uint32_t flags);
+bool pipe_close_read(pipe_t* pipe);
+bool pipe_close_write(pipe_t* pipe);
+
+// Watch a pipe in a poll set: POLL_IN when data goes in or the write side
+// closes, POLL_OUT when room is made, POLL_HUP when either side closes
+int pipe_poll_add(pollset_t* set, pipe_t* pipe, uint32_t events, uint32_t cookie);
+
+// Splice: up to 'count' bytes without going through a caller's buffer,
+// blocking like pipe_read for the first. Between pipes the pages move;
+// a socket or file (socket_send/socket_recv, fs_write/fs_read, or anything
+// shaped like them) writes from or reads into the pipe's pages directly.
+// Returns the bytes moved, 0 at end of file, -1 on error.
+typedef int (*pipe_sink_fn_t)(int fd, const void* buf, uint32_t len);
+typedef int (*pipe_source_fn_t)(int fd, void* buf, uint32_t len);
+
+int pipe_splice(pipe_t* in, pipe_t* out, uint32_t count, uint32_t flags);
+int pipe_splice_to(pipe_t* pipe, pipe_sink_fn_t sink, int fd, uint32_t count, uint32_t flags);
+int pipe_splice_from(pipe_t* pipe, pipe_source_fn_t source, int fd, uint32_t count, uint32_t flags);
+
+// Lock-free single-producer single-consumer ring for ultra-low latency
+// (feed handler to strategy). head and tail run freely and are masked on
+// use, so all 'size' slots hold elements. The producer publishes tail with
+// a release store after writing slots, and the consumer publishes head the
+// same way after reading them. Each side has a line holding its own index
+// and a cached copy of the other's, so the other side's line is only
+// pulled in when the cached copy says the ring is full or empty.
 typedef struct {
-    volatile uint32_t head;
-    volatile uint32_t tail;
-    uint32_t size;
+    volatile uint32_t tail __cacheline_aligned;     // Producer writes
+    uint32_t head_cache;                            // Producer's view of head
+    volatile uint32_t head __cacheline_aligned;     // Consumer writes
+    uint32_t tail_cache;                            // Consumer's view of tail
+    uint32_t size __cacheline_aligned;              // Read-only after init
     uint32_t mask;
     uint8_t* buffer;
     uint32_t element_size;
 } lockfree_ringbuf_t;
 
+// size is rounded up to a power of two; 0 on success, -1 on failure
 int ringbuf_init(lockfree_ringbuf_t* rb, uint32_t size, uint32_t element_size);
+void ringbuf_destroy(lockfree_ringbuf_t* rb);
+
+// One element: 0, or -1 when full (push) or empty (pop)
 int ringbuf_push(lockfree_ringbuf_t* rb, const void* data);
 int ringbuf_pop(lockfree_ringbuf_t* rb, void* data);
+
+// Up to 'count' elements with one index update; returns how many moved
+uint32_t ringbuf_push_n(lockfree_ringbuf_t* rb, const void* data, uint32_t count);
+uint32_t ringbuf_pop_n(lockfree_ringbuf_t* rb, void* data, uint32_t count);
+
+// Zero copy. The producer gets up to 'count' contiguous free slots (fewer at
+// the wrap; *avail says how many, NULL if none), fills some and publishes
+// them with ringbuf_commit. The consumer likewise reads slots in place from
+// ringbuf_peek and hands them back with ringbuf_release.
+void* ringbuf_reserve(lockfree_ringbuf_t* rb, uint32_t count, uint32_t* avail);
+void ringbuf_commit(lockfree_ringbuf_t* rb, uint32_t count);
+void* ringbuf_peek(lockfree_ringbuf_t* rb, uint32_t count, uint32_t* avail);
+void ringbuf_release(lockfree_ringbuf_t* rb, uint32_t count);
+
 uint32_t ringbuf_count(const lockfree_ringbuf_t* rb);
 
-// Shared memory pools for trading data
+// Shared memory pools for trading data. Free elements are chained through
+// their first word, so alloc and free are O(1); the bitmap keeps frees of
+// unallocated elements out. Elements start on a cache line (see
+// pool_stride for the padding rule). A per-CPU magazine cache sits in
+// front; the spinlocked free list behind it is only reached when a CPU's
+// magazines run empty or full.
+struct mag_cache;
+
 typedef struct {
     void* base_addr;
     uint32_t size;
     uint32_t element_size;
     uint32_t max_elements;
     uint32_t used_elements;
-    uint8_t* allocation_bitmap;
+    uint8_t* allocation_bitmap;     // Bit set = allocated
+    void* free_list;
+    spinlock_t lock;
+    struct mag_cache* cache;        // Per-CPU magazines, or NULL
 } shared_pool_t;
 
 shared_pool_t* create_shared_pool(uint32_t element_size, uint32_t max_elements);
+// Element stride a multiple of 'align' (see pool_stride)
+shared_pool_t* create_shared_pool_aligned(uint32_t element_size, uint32_t max_elements,
+                                          uint32_t align);
 void* shared_pool_alloc(shared_pool_t* pool);
 void shared_pool_free(shared_pool_t* pool, void* ptr);
 void destroy_shared_pool(shared_pool_t* pool);
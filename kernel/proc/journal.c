@@ -0,0 +1,458 @@
+#include "journal.h"
+#include "portfolio.h"
+#include "process.h"
+#include "scheduler.h"
+#include "futex.h"
+#include "../mm/memory.h"
+#include "../arch/cpu.h"
+#include "../arch/smp.h"
+#include "../arch/tsc.h"
+#include "../arch/div64.h"
+#include "../drivers/vga.h"
+
+#define JOURNAL_BATCH_RECORDS   (JOURNAL_BATCH_SECTORS * JOURNAL_RECORDS_PER_SECTOR)
+#define JOURNAL_WAIT_MS         10
+
+_Static_assert(SECTOR_SIZE % sizeof(journal_record_t) == 0, "journal_record_t size");
+
+// Hot path state, read-mostly apart from the rings and the sequence
+static struct {
+    volatile uint32_t ready;
+    uint32_t cpus;              // Rings, one per CPU online at init
+    lockfree_ringbuf_t rings[MAX_CPUS];
+    volatile uint32_t sequence __cacheline_aligned;
+    volatile uint32_t dropped;
+} journal;
+
+// The flusher's own: only it touches the disk region once running
+static struct {
+    uint32_t base;              // LBA of the header sector
+    uint32_t sectors;           // Record sectors after it
+    uint32_t epoch;
+    uint32_t tail_sector;       // First sector not yet full
+    uint32_t pending;           // Records in the batch, from tail_sector on
+    uint32_t written;           // Of them, already on disk
+    bool full;
+    journal_record_t* batch;
+    uint32_t position[MAX_CPUS];        // Ring head once the batch is written
+    volatile uint32_t durable[MAX_CPUS]; // Ring position known to be on disk
+    volatile uint32_t generation;       // Bumped after every commit attempt
+    volatile uint32_t kick;
+    volatile uint32_t reset;            // Asked for; cleared once done
+    journal_stats_t stats;
+} flusher;
+
+static uint32_t crc_table[256];
+static uint8_t header_sector[SECTOR_SIZE];
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+        }
+        crc_table[i] = crc;
+    }
+}
+
+// The checksum field counts as zero
+static uint32_t journal_checksum(const journal_record_t* record) {
+    journal_record_t copy = *record;
+    copy.checksum = 0;
+    const uint8_t* bytes = (const uint8_t*)&copy;
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < sizeof(copy); i++) {
+        crc = (crc >> 8) ^ crc_table[(crc ^ bytes[i]) & 0xFF];
+    }
+    return ~crc;
+}
+
+static bool journal_record_valid(const journal_record_t* record, uint32_t epoch) {
+    return record->epoch == epoch && record->type != 0 && record->type < JOURNAL_TYPES &&
+           record->checksum == journal_checksum(record);
+}
+
+static int journal_read_header(uint32_t base, journal_header_t* header) {
+    if (disk_read_sector(base, header_sector) != DISK_SUCCESS) return -1;
+    memcpy(header, header_sector, sizeof(journal_header_t));
+    return header->magic == JOURNAL_MAGIC && header->version == JOURNAL_VERSION &&
+           header->record_size == sizeof(journal_record_t) ? 0 : -1;
+}
+
+static int journal_write_header(uint32_t epoch) {
+    journal_header_t header = { JOURNAL_MAGIC, JOURNAL_VERSION, epoch, sizeof(journal_record_t) };
+    memset(header_sector, 0, SECTOR_SIZE);
+    memcpy(header_sector, &header, sizeof(header));
+    if (disk_write_sector(flusher.base, header_sector) != DISK_SUCCESS) return -1;
+    return disk_flush() == DISK_SUCCESS ? 0 : -1;
+}
+
+// Good records from the start, read a batch at a time into 'buffer'
+static uint32_t journal_scan(journal_record_t* buffer, uint32_t epoch, journal_replay_fn_t fn, void* ctx,
+                             uint32_t* next_sequence) {
+    uint32_t count = 0;
+    for (uint32_t sector = 0; sector < flusher.sectors; sector += JOURNAL_BATCH_SECTORS) {
+        uint32_t run = flusher.sectors - sector;
+        if (run > JOURNAL_BATCH_SECTORS) run = JOURNAL_BATCH_SECTORS;
+        if (disk_read_sectors(flusher.base + 1 + sector, run, buffer) != DISK_SUCCESS) break;
+
+        for (uint32_t i = 0; i < run * JOURNAL_RECORDS_PER_SECTOR; i++) {
+            if (!journal_record_valid(&buffer[i], epoch)) return count;
+            if (next_sequence && buffer[i].sequence + 1 > *next_sequence) {
+                *next_sequence = buffer[i].sequence + 1;
+            }
+            if (fn) fn(&buffer[i], ctx);
+            count++;
+        }
+    }
+    return count;
+}
+
+// Gather every ring into the batch and write it at the tail. True when
+// the batch filled before the rings emptied.
+static bool journal_commit(void) {
+    uint32_t n = flusher.pending;
+    for (uint32_t cpu = 0; cpu < journal.cpus; cpu++) {
+        lockfree_ringbuf_t* ring = &journal.rings[cpu];
+        while (n < JOURNAL_BATCH_RECORDS) {
+            uint32_t avail;
+            journal_record_t* in = (journal_record_t*)ringbuf_peek(ring, JOURNAL_BATCH_RECORDS - n, &avail);
+            if (!in) break;
+            for (uint32_t i = 0; i < avail; i++) {
+                journal_record_t* record = &flusher.batch[n + i];
+                *record = in[i];
+                record->epoch = flusher.epoch;
+                record->checksum = journal_checksum(record);
+            }
+            ringbuf_release(ring, avail);
+            n += avail;
+        }
+        flusher.position[cpu] = ring->head;
+    }
+    bool more = n == JOURNAL_BATCH_RECORDS;
+
+    // Whatever does not fit the region is lost, and says so
+    uint32_t room = (flusher.sectors - flusher.tail_sector) * JOURNAL_RECORDS_PER_SECTOR;
+    if (n > room) {
+        __sync_fetch_and_add(&journal.dropped, n - room);
+        flusher.full = true;
+        n = room;
+        more = false;
+    }
+
+    if (n > flusher.written) {
+        uint32_t sectors = (n + JOURNAL_RECORDS_PER_SECTOR - 1) / JOURNAL_RECORDS_PER_SECTOR;
+        memset(&flusher.batch[n], 0, (sectors * JOURNAL_RECORDS_PER_SECTOR - n) * sizeof(journal_record_t));
+
+        uint64_t start = ktime_ns();
+        int result = disk_write_sectors(flusher.base + 1 + flusher.tail_sector, sectors, flusher.batch);
+        if (result == DISK_SUCCESS) result = disk_flush();
+        flusher.stats.commit_ns += ktime_ns() - start;
+
+        if (result != DISK_SUCCESS) {
+            // Kept in the batch for the next attempt
+            flusher.stats.errors++;
+            flusher.pending = n;
+            more = false;
+        } else {
+            flusher.stats.commits++;
+            flusher.stats.records_written += n - flusher.written;
+            flusher.stats.sectors_written += sectors;
+            if (n - flusher.written > flusher.stats.max_batch) {
+                flusher.stats.max_batch = n - flusher.written;
+            }
+            for (uint32_t cpu = 0; cpu < journal.cpus; cpu++) {
+                store_release(&flusher.durable[cpu], flusher.position[cpu]);
+            }
+
+            // The partly filled sector moves to the front, to be written again
+            uint32_t whole = n / JOURNAL_RECORDS_PER_SECTOR;
+            uint32_t rest = n % JOURNAL_RECORDS_PER_SECTOR;
+            if (whole && rest) {
+                memcpy(flusher.batch, &flusher.batch[whole * JOURNAL_RECORDS_PER_SECTOR],
+                       rest * sizeof(journal_record_t));
+            }
+            flusher.tail_sector += whole;
+            flusher.pending = flusher.written = rest;
+        }
+    } else if (flusher.full) {
+        // Nothing more can go on disk; let waiters see it
+        for (uint32_t cpu = 0; cpu < journal.cpus; cpu++) {
+            store_release(&flusher.durable[cpu], flusher.position[cpu]);
+        }
+    }
+    flusher.stats.log_records = flusher.tail_sector * JOURNAL_RECORDS_PER_SECTOR + flusher.written;
+
+    store_release(&flusher.generation, flusher.generation + 1);
+    futex_wake(&flusher.generation, FUTEX_WAKE_ALL);
+    return more;
+}
+
+static void journal_do_reset(void) {
+    // What is still in the rings goes in under the new epoch
+    if (journal_write_header(flusher.epoch + 1) == 0) {
+        flusher.epoch++;
+        flusher.tail_sector = 0;
+        flusher.full = false;
+
+        // Records a failed write left in the batch are kept
+        uint32_t unwritten = flusher.pending - flusher.written;
+        for (uint32_t i = 0; i < unwritten; i++) {
+            journal_record_t* record = &flusher.batch[i];
+            *record = flusher.batch[flusher.written + i];
+            record->epoch = flusher.epoch;
+            record->checksum = journal_checksum(record);
+        }
+        flusher.pending = unwritten;
+        flusher.written = 0;
+        flusher.stats.log_records = 0;
+    } else {
+        flusher.stats.errors++;
+    }
+    store_release(&flusher.reset, 0);
+    futex_wake(&flusher.reset, FUTEX_WAKE_ALL);
+}
+
+static void journal_flusher_task(void) {
+    for (;;) {
+        futex_wait(&flusher.kick, 0, JOURNAL_COMMIT_MS);
+        store_release(&flusher.kick, 0);
+        if (load_acquire(&flusher.reset)) {
+            journal_do_reset();
+        }
+        while (journal_commit()) {
+        }
+    }
+}
+
+static void journal_kick(void) {
+    store_release(&flusher.kick, 1);
+    futex_wake(&flusher.kick, FUTEX_WAKE_ALL);
+}
+
+// Recovery: fills rebuild the positions
+static void journal_recover_record(const journal_record_t* record, void* ctx) {
+    uint32_t* fills = (uint32_t*)ctx;
+    if (record->type == JOURNAL_FILL) {
+        portfolio_on_fill(record->symbol_id, record->side, (uint32_t)record->quantity, record->price);
+        (*fills)++;
+    }
+}
+
+int journal_init(void) {
+    memset(&journal, 0, sizeof(journal));
+    memset(&flusher, 0, sizeof(flusher));
+    crc_init();
+
+    uint32_t total = disk_get_total_sectors();
+    if (!disk_is_present() || total <= 2 * DISK_JOURNAL_SECTORS) {
+        vga_write_string("Journal: no disk, order events not kept\n");
+        return -1;
+    }
+    flusher.base = total - DISK_JOURNAL_SECTORS;
+    flusher.sectors = DISK_JOURNAL_SECTORS - 1;
+    flusher.stats.capacity = flusher.sectors * JOURNAL_RECORDS_PER_SECTOR;
+    flusher.batch = (journal_record_t*)kmalloc_aligned(JOURNAL_BATCH_SECTORS * SECTOR_SIZE, CACHE_LINE_SIZE);
+    if (!flusher.batch) return -1;
+
+    // Replay what the last run left, or start a log
+    journal_header_t header;
+    uint32_t count = 0, fills = 0;
+    if (journal_read_header(flusher.base, &header) == 0) {
+        flusher.epoch = header.epoch;
+        uint32_t next = 0;
+        count = journal_scan(flusher.batch, flusher.epoch, journal_recover_record, &fills, &next);
+        journal.sequence = next;
+    } else if (journal_write_header(1) == 0) {
+        flusher.epoch = 1;
+    } else {
+        kfree_aligned(flusher.batch);
+        vga_write_string("Journal: cannot write the log header\n");
+        return -1;
+    }
+    flusher.stats.recovered = count;
+    flusher.tail_sector = count / JOURNAL_RECORDS_PER_SECTOR;
+    flusher.pending = flusher.written = count % JOURNAL_RECORDS_PER_SECTOR;
+    flusher.stats.log_records = count;
+    flusher.full = flusher.tail_sector == flusher.sectors;
+    if (flusher.pending &&
+        disk_read_sector(flusher.base + 1 + flusher.tail_sector, flusher.batch) != DISK_SUCCESS) {
+        flusher.pending = flusher.written = 0;
+    }
+
+    journal.cpus = smp_cpu_count();
+    for (uint32_t cpu = 0; cpu < journal.cpus; cpu++) {
+        if (ringbuf_init(&journal.rings[cpu], JOURNAL_RING_SIZE, sizeof(journal_record_t)) != 0) {
+            journal.cpus = cpu;
+            break;
+        }
+    }
+    process_t* task = journal.cpus ? process_create("journal", journal_flusher_task, PRIORITY_LOW) : NULL;
+    if (!task) {
+        for (uint32_t cpu = 0; cpu < journal.cpus; cpu++) {
+            ringbuf_destroy(&journal.rings[cpu]);
+        }
+        kfree_aligned(flusher.batch);
+        return -1;
+    }
+    scheduler_add_process(task);
+    store_release(&journal.ready, 1);
+
+    vga_write_string("Journal: ");
+    print_dec(count);
+    vga_write_string(" records recovered, ");
+    print_dec(fills);
+    vga_write_string(" fills applied\n");
+    return 0;
+}
+
+static int journal_emit(uint8_t type, uint32_t order_id, uint16_t symbol_id, uint8_t side, uint8_t status,
+                        double price, uint64_t quantity, uint32_t client_id) {
+    if (!journal.ready) {
+        __sync_fetch_and_add(&journal.dropped, 1);
+        return -1;
+    }
+
+    // Interrupts off: an interrupt on this CPU logging too would be a
+    // second producer on the ring
+    uint32_t flags = irq_save();
+    uint32_t cpu = this_cpu()->id;
+    uint32_t avail;
+    journal_record_t* record = cpu < journal.cpus ?
+        (journal_record_t*)ringbuf_reserve(&journal.rings[cpu], 1, &avail) : NULL;
+    if (!record) {
+        irq_restore(flags);
+        __sync_fetch_and_add(&journal.dropped, 1);
+        return -1;
+    }
+
+    record->sequence = __sync_fetch_and_add(&journal.sequence, 1);
+    record->type = type;
+    record->cpu = (uint8_t)cpu;
+    record->side = side;
+    record->status = status;
+    record->timestamp = ktime_ns();
+    record->order_id = order_id;
+    record->symbol_id = symbol_id;
+    record->reserved = 0;
+    record->price = price;
+    record->quantity = quantity;
+    record->client_id = client_id;
+    record->spare[0] = record->spare[1] = record->spare[2] = 0;
+    ringbuf_commit(&journal.rings[cpu], 1);
+    irq_restore(flags);
+    return 0;
+}
+
+int journal_log_order(uint8_t type, const order_t* order) {
+    if (!order) return -1;
+    return journal_emit(type, order->order_id, order->symbol_id, order->side, order->status, order->price,
+                        order->quantity, order->client_id);
+}
+
+int journal_log_fill(uint32_t order_id, uint16_t symbol_id, uint8_t side, uint64_t quantity, double price) {
+    return journal_emit(JOURNAL_FILL, order_id, symbol_id, side, 1, price, quantity, 0);
+}
+
+int journal_sync(void) {
+    if (!journal.ready) return -1;
+
+    uint32_t target[MAX_CPUS];
+    for (uint32_t cpu = 0; cpu < journal.cpus; cpu++) {
+        target[cpu] = load_acquire(&journal.rings[cpu].tail);
+    }
+    uint32_t errors = flusher.stats.errors;
+
+    for (;;) {
+        uint32_t generation = load_acquire(&flusher.generation);
+        bool durable = true;
+        for (uint32_t cpu = 0; cpu < journal.cpus && durable; cpu++) {
+            durable = (int32_t)(load_acquire(&flusher.durable[cpu]) - target[cpu]) >= 0;
+        }
+        if (durable) return flusher.full ? -1 : 0;
+        if (flusher.stats.errors != errors) return -1;
+
+        journal_kick();
+        futex_wait_or_yield(&flusher.generation, generation, JOURNAL_WAIT_MS);
+    }
+}
+
+uint32_t journal_replay(journal_replay_fn_t fn, void* ctx) {
+    if (!journal.ready) return 0;
+
+    journal_record_t* buffer = (journal_record_t*)kmalloc_aligned(JOURNAL_BATCH_SECTORS * SECTOR_SIZE,
+                                                                  CACHE_LINE_SIZE);
+    if (!buffer) return 0;
+    uint32_t count = journal_scan(buffer, flusher.epoch, fn, ctx, NULL);
+    kfree_aligned(buffer);
+    return count;
+}
+
+int journal_reset(void) {
+    if (!journal.ready) return -1;
+
+    uint32_t errors = flusher.stats.errors;
+    store_release(&flusher.reset, 1);
+    journal_kick();
+    while (load_acquire(&flusher.reset)) {
+        futex_wait_or_yield(&flusher.reset, 1, JOURNAL_WAIT_MS);
+    }
+    return flusher.stats.errors == errors ? 0 : -1;
+}
+
+void journal_get_stats(journal_stats_t* stats) {
+    if (!stats) return;
+
+    *stats = flusher.stats;
+    stats->ready = journal.ready != 0;
+    stats->dropped = journal.dropped;
+    stats->logged = 0;
+    for (uint32_t cpu = 0; cpu < journal.cpus; cpu++) {
+        stats->logged += load_acquire(&journal.rings[cpu].tail);
+    }
+}
+
+void journal_print_info(void) {
+    journal_stats_t stats;
+    journal_get_stats(&stats);
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Order Journal ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    if (!stats.ready) {
+        vga_write_string("Off (no disk)  Dropped: ");
+        print_dec(stats.dropped);
+        vga_write_string("\n");
+        return;
+    }
+
+    vga_write_string("Log: ");
+    print_dec(stats.log_records);
+    vga_write_string("/");
+    print_dec(stats.capacity);
+    vga_write_string(" records (epoch ");
+    print_dec(flusher.epoch);
+    vga_write_string(flusher.full ? ", full)  Recovered: " : ")  Recovered: ");
+    print_dec(stats.recovered);
+    vga_write_string("\nLogged: ");
+    print_dec(stats.logged);
+    vga_write_string("  Dropped: ");
+    print_dec(stats.dropped);
+    vga_write_string("  Write errors: ");
+    print_dec(stats.errors);
+    vga_write_string("\nCommits: ");
+    print_dec(stats.commits);
+    vga_write_string(" (");
+    print_dec(stats.records_written);
+    vga_write_string(" records, ");
+    print_dec(stats.sectors_written);
+    vga_write_string(" sectors, largest ");
+    print_dec(stats.max_batch);
+    vga_write_string(")");
+    if (stats.commits) {
+        vga_write_string("  ");
+        print_dec((uint32_t)div_u64_u32(stats.commit_ns, stats.commits * NSEC_PER_USEC, NULL));
+        vga_write_string(" us each");
+    }
+    vga_write_string("\n");
+}
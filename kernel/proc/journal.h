@@ -0,0 +1,101 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "../types.h"
+#include "ipc.h"
+#include "../fs/disk.h"
+
+// Append-only order event journal. The last DISK_JOURNAL_SECTORS of the
+// disk hold a header sector and then fixed 64-byte records, eight to a
+// sector, each with a CRC-32 and the epoch of the header it was written
+// under. Logging an event is a copy into a slot of the calling CPU's ring,
+// interrupts off: no lock, no disk. A low priority flusher wakes every
+// JOURNAL_COMMIT_MS (or when a caller waits in journal_sync), gathers what
+// every CPU has logged into one batch and commits it with a single
+// sequential write and a cache flush, so many events share one trip to the
+// disk. The last, partly filled sector stays in the batch and is written
+// again with the next one. A batch takes each CPU's records in turn, so
+// the log interleaves CPUs; the sequence numbers give the logging order.
+//
+// At boot the log is read back up to the first record that fails its
+// check; fills are applied to the portfolio, and logging carries on after
+// the last good record. An event that finds its ring full is dropped and
+// counted; without a disk the journal is off and every event is dropped.
+#define JOURNAL_MAGIC           0x4C4E524A      // "JRNL"
+#define JOURNAL_VERSION         1
+#define JOURNAL_RING_SIZE       1024            // Records per CPU between commits
+#define JOURNAL_BATCH_SECTORS   128             // Largest write, 64 KB
+#define JOURNAL_COMMIT_MS       2               // Group commit window
+#define JOURNAL_RECORDS_PER_SECTOR  (SECTOR_SIZE / sizeof(journal_record_t))
+
+// Event types
+#define JOURNAL_ORDER           1               // Passed risk, queued
+#define JOURNAL_REJECT          2               // Stopped by risk
+#define JOURNAL_ACK             3               // Accepted by the venue
+#define JOURNAL_FILL            4
+#define JOURNAL_CANCEL          5               // Left the book unfilled
+#define JOURNAL_TYPES           6
+
+typedef struct {
+    uint32_t epoch;
+    uint32_t sequence;          // Across all CPUs, in logging order
+    uint32_t checksum;          // CRC-32 of the record with this field zero
+    uint8_t type;
+    uint8_t cpu;
+    uint8_t side;
+    uint8_t status;
+    uint64_t timestamp;         // ktime_ns() when logged
+    uint32_t order_id;
+    uint16_t symbol_id;
+    uint16_t reserved;
+    double price;               // Limit price, or the fill price
+    uint64_t quantity;          // Ordered, or filled
+    uint32_t client_id;
+    uint32_t spare[3];
+} journal_record_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t epoch;             // Bumped by a reset; older records are ignored
+    uint32_t record_size;
+} journal_header_t;
+
+typedef struct {
+    bool ready;
+    uint32_t logged;
+    uint32_t dropped;           // Ring full, log full, or no journal
+    uint32_t commits;           // Disk writes
+    uint32_t records_written;
+    uint32_t sectors_written;
+    uint32_t max_batch;         // Most records in one commit
+    uint32_t errors;            // Failed writes, retried with the next commit
+    uint32_t recovered;         // Good records found at boot
+    uint32_t log_records;       // On disk now
+    uint32_t capacity;          // Records the region holds
+    uint64_t commit_ns;         // Total time in commits
+} journal_stats_t;
+
+// Recover the log and start the flusher; needs the disk, the scheduler
+// and every CPU online. 0, or -1 when the journal stays off.
+int journal_init(void);
+
+// Hot path: 0, or -1 when the event was dropped
+int journal_log_order(uint8_t type, const order_t* order);
+int journal_log_fill(uint32_t order_id, uint16_t symbol_id, uint8_t side, uint64_t quantity, double price);
+
+// Wait until everything logged before the call, on any CPU, is on disk:
+// one commit covers every caller waiting on it. 0, or -1 if it cannot be.
+int journal_sync(void);
+
+// Read the log back, one call per good record in order; how many
+typedef void (*journal_replay_fn_t)(const journal_record_t* record, void* ctx);
+uint32_t journal_replay(journal_replay_fn_t fn, void* ctx);
+
+// Start an empty log under a new epoch
+int journal_reset(void);
+
+void journal_get_stats(journal_stats_t* stats);
+void journal_print_info(void);
+
+#endif // JOURNAL_H
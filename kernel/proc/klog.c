@@ -0,0 +1,380 @@
+#include "klog.h"
+#include "process.h"
+#include "scheduler.h"
+#include "futex.h"
+#include "../fs/fs.h"
+#include "../mm/memory.h"
+#include "../arch/cpu.h"
+#include "../arch/tsc.h"
+#include "../arch/div64.h"
+#include "../drivers/vga.h"
+
+#define KLOG_FILE_BUFFER        4096    // Lines gathered per file write
+
+_Static_assert((KLOG_ENTRIES & (KLOG_ENTRIES - 1)) == 0, "KLOG_ENTRIES");
+
+typedef struct {
+    uint64_t tsc;
+    const char* fmt;
+    uint32_t args[KLOG_MAX_ARGS];
+    uint8_t level;
+    uint8_t cpu;
+    uint8_t nargs;
+    uint8_t reserved;
+} klog_record_t;
+
+// The writing CPU owns head and the counts beside it, the drainer tail
+typedef struct {
+    volatile uint32_t head;     // Records written
+    uint32_t logged;
+    uint32_t dropped;
+    uint32_t filtered;
+    uint32_t max_backlog;
+    volatile uint32_t tail __cacheline_aligned;     // Records drained
+    klog_record_t records[KLOG_ENTRIES];
+} __cacheline_aligned klog_ring_t;
+
+static klog_ring_t klog_rings[MAX_CPUS];
+static volatile uint32_t klog_level = KLOG_INFO;
+static volatile uint32_t klog_sinks = KLOG_SINK_VGA;
+static klog_hook_t klog_hook = NULL;
+static volatile uint32_t klog_started = 0;
+static volatile uint32_t klog_draining = 0;
+static volatile uint32_t klog_kick = 0;
+static uint32_t klog_drained = 0;
+static uint32_t klog_file_errors = 0;
+
+// File sink: an append descriptor and the lines not yet written to it
+static int klog_fd = -1;
+static char* file_buffer = NULL;
+static uint32_t file_used = 0;
+
+static char klog_line[KLOG_LINE_MAX];
+
+static const vga_color_t level_colors[] = {
+    VGA_COLOR_LIGHT_RED, VGA_COLOR_LIGHT_BROWN, VGA_COLOR_LIGHT_GREY, VGA_COLOR_DARK_GREY
+};
+
+void klog_write(uint32_t level, const char* fmt, uint32_t nargs, ...) {
+    uint32_t flags = irq_save();
+    uint32_t cpu = this_cpu()->id;
+    klog_ring_t* ring = &klog_rings[cpu];
+    if (level > klog_level) {
+        ring->filtered++;
+        irq_restore(flags);
+        return;
+    }
+
+    uint32_t head = ring->head;
+    uint32_t backlog = head - load_acquire(&ring->tail);
+    if (backlog >= KLOG_ENTRIES) {
+        ring->dropped++;
+        irq_restore(flags);
+        return;
+    }
+    klog_record_t* record = &ring->records[head & KLOG_MASK];
+    record->tsc = rdtsc();
+    record->fmt = fmt;
+    record->level = (uint8_t)level;
+    record->cpu = (uint8_t)cpu;
+    record->nargs = (uint8_t)(nargs < KLOG_MAX_ARGS ? nargs : KLOG_MAX_ARGS);
+
+    __builtin_va_list args;
+    __builtin_va_start(args, nargs);
+    for (uint32_t i = 0; i < record->nargs; i++) {
+        record->args[i] = __builtin_va_arg(args, uint32_t);
+    }
+    __builtin_va_end(args);
+
+    ring->logged++;
+    if (backlog + 1 > ring->max_backlog) ring->max_backlog = backlog + 1;
+    store_release(&ring->head, head + 1);
+    irq_restore(flags);
+
+    // Nobody to drain it yet: boot messages show in order
+    if (!load_acquire(&klog_started)) {
+        klog_drain();
+    }
+}
+
+// Formatting into klog_line, drain lock held
+
+static uint32_t line_put(uint32_t n, char c) {
+    if (n < KLOG_LINE_MAX - 1) klog_line[n++] = c;
+    return n;
+}
+
+static uint32_t line_puts(uint32_t n, const char* s) {
+    while (s && *s) n = line_put(n, *s++);
+    return n;
+}
+
+static uint32_t line_dec(uint32_t n, uint32_t value) {
+    char digits[10];
+    uint32_t count = 0;
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (count) n = line_put(n, digits[--count]);
+    return n;
+}
+
+static uint32_t line_hex(uint32_t n, uint32_t value) {
+    static const char hex[] = "0123456789ABCDEF";
+    n = line_puts(n, "0x");
+    for (int shift = 28; shift >= 0; shift -= 4) {
+        n = line_put(n, hex[(value >> shift) & 0xF]);
+    }
+    return n;
+}
+
+static uint32_t format_record(const klog_record_t* record) {
+    uint32_t n = 0, arg = 0;
+    for (const char* p = record->fmt; *p; p++) {
+        if (*p != '%' || !p[1]) {
+            n = line_put(n, *p);
+            continue;
+        }
+        char spec = *++p;
+        if (spec == '%') {
+            n = line_put(n, '%');
+            continue;
+        }
+        if (arg >= record->nargs) {
+            n = line_put(n, '?');
+            continue;
+        }
+        uint32_t value = record->args[arg++];
+        switch (spec) {
+        case 'u': n = line_dec(n, value); break;
+        case 'd':
+            if ((int32_t)value < 0) {
+                n = line_put(n, '-');
+                value = 0u - value;
+            }
+            n = line_dec(n, value);
+            break;
+        case 'x': n = line_hex(n, value); break;
+        case 'c': n = line_put(n, (char)value); break;
+        case 's': n = line_puts(n, (const char*)value); break;
+        default: n = line_put(n, '?'); break;
+        }
+    }
+    klog_line[n] = '\0';
+    return n;
+}
+
+static void file_flush(void) {
+    if (file_used && klog_fd >= 0 && fs_write(klog_fd, file_buffer, file_used) != (int)file_used) {
+        klog_file_errors++;
+    }
+    file_used = 0;
+}
+
+// "[seconds.microseconds] " then the line
+static void file_append(const klog_record_t* record, uint32_t length) {
+    char stamp[24];
+    uint32_t n = 0;
+    if (tsc_available()) {
+        uint32_t us;
+        uint64_t seconds = div_u64_u32(div_u64_u32(ktime_from_tsc(record->tsc), NSEC_PER_USEC, NULL),
+                                       1000000, &us);
+        stamp[n++] = '[';
+        char digits[10];
+        uint32_t count = 0;
+        uint32_t value = (uint32_t)seconds;
+        do {
+            digits[count++] = (char)('0' + value % 10);
+            value /= 10;
+        } while (value);
+        while (count) stamp[n++] = digits[--count];
+        stamp[n++] = '.';
+        for (uint32_t div = 100000; div; div /= 10) {
+            stamp[n++] = (char)('0' + (us / div) % 10);
+        }
+        stamp[n++] = ']';
+        stamp[n++] = ' ';
+    }
+    if (file_used + n + length > KLOG_FILE_BUFFER) {
+        file_flush();
+    }
+    memcpy(file_buffer + file_used, stamp, n);
+    memcpy(file_buffer + file_used + n, klog_line, length);
+    file_used += n + length;
+}
+
+static void emit(const klog_record_t* record) {
+    uint32_t length = format_record(record);
+    uint32_t sinks = klog_sinks;
+    if (sinks & KLOG_SINK_VGA) {
+        uint32_t level = record->level < 4 ? record->level : KLOG_DEBUG;
+        vga_set_color(level_colors[level], VGA_COLOR_BLACK);
+        vga_write_string(klog_line);
+        vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    }
+    if ((sinks & KLOG_SINK_HOOK) && klog_hook) {
+        klog_hook(record->level, klog_line);
+    }
+    if ((sinks & KLOG_SINK_FILE) && file_buffer) {
+        file_append(record, length);
+    }
+}
+
+uint32_t klog_drain(void) {
+    if (__sync_lock_test_and_set(&klog_draining, 1)) {
+        return 0;
+    }
+
+    // Oldest first over all rings; a bounded batch, so busy writers cannot
+    // keep the drainer here
+    uint32_t drained = 0;
+    while (drained < KLOG_ENTRIES * MAX_CPUS) {
+        klog_ring_t* oldest = NULL;
+        uint64_t oldest_tsc = 0;
+        for (uint32_t c = 0; c < MAX_CPUS; c++) {
+            klog_ring_t* ring = &klog_rings[c];
+            uint32_t tail = ring->tail;
+            if (tail == load_acquire(&ring->head)) continue;
+            uint64_t tsc = ring->records[tail & KLOG_MASK].tsc;
+            if (!oldest || (int64_t)(tsc - oldest_tsc) < 0) {
+                oldest = ring;
+                oldest_tsc = tsc;
+            }
+        }
+        if (!oldest) break;
+
+        klog_record_t record = oldest->records[oldest->tail & KLOG_MASK];
+        store_release(&oldest->tail, oldest->tail + 1);
+        emit(&record);
+        drained++;
+    }
+    file_flush();
+    klog_drained += drained;
+
+    __sync_lock_release(&klog_draining);
+    return drained;
+}
+
+static void klog_task(void) {
+    for (;;) {
+        klog_drain();
+        futex_wait(&klog_kick, 0, KLOG_DRAIN_MS);
+    }
+}
+
+void klog_start(void) {
+    if (load_acquire(&klog_started)) return;
+    process_t* task = process_create("klog", klog_task, PRIORITY_LOW);
+    if (!task) return;
+    scheduler_add_process(task);
+    store_release(&klog_started, 1);
+}
+
+void klog_set_level(uint32_t level) {
+    klog_level = level;
+}
+
+uint32_t klog_get_level(void) {
+    return klog_level;
+}
+
+void klog_set_sinks(uint32_t sinks) {
+    klog_sinks = sinks;
+}
+
+uint32_t klog_get_sinks(void) {
+    return klog_sinks;
+}
+
+void klog_set_hook(klog_hook_t hook) {
+    klog_hook = hook;
+}
+
+int klog_set_file(const char* path) {
+    // Whatever is waiting goes to the old file first
+    klog_drain();
+    while (__sync_lock_test_and_set(&klog_draining, 1)) {
+        cpu_relax();
+    }
+    if (klog_fd >= 0) {
+        fs_close(klog_fd);
+        klog_fd = -1;
+    }
+    int result = FS_SUCCESS;
+    if (path) {
+        if (!fs_exists(path)) {
+            result = fs_create_file(path, FILE_TYPE_REGULAR);
+        }
+        if (result == FS_SUCCESS && !file_buffer) {
+            file_buffer = (char*)kmalloc(KLOG_FILE_BUFFER);
+            if (!file_buffer) result = FS_ERROR_NO_MEMORY;
+        }
+        if (result == FS_SUCCESS) {
+            klog_fd = fs_open(path, FS_OPEN_WRITE | FS_OPEN_APPEND);
+            if (klog_fd < 0) result = klog_fd;
+        }
+    }
+    if (klog_fd < 0 && file_buffer) {
+        kfree(file_buffer);
+        file_buffer = NULL;
+    }
+    if (klog_fd >= 0) {
+        klog_sinks |= KLOG_SINK_FILE;
+    } else {
+        klog_sinks &= ~KLOG_SINK_FILE;
+    }
+    __sync_lock_release(&klog_draining);
+    return result;
+}
+
+void klog_get_stats(klog_stats_t* stats) {
+    if (!stats) return;
+    memset(stats, 0, sizeof(klog_stats_t));
+    for (uint32_t c = 0; c < MAX_CPUS; c++) {
+        klog_ring_t* ring = &klog_rings[c];
+        stats->logged += ring->logged;
+        stats->dropped += ring->dropped;
+        stats->filtered += ring->filtered;
+        if (ring->max_backlog > stats->max_backlog) {
+            stats->max_backlog = ring->max_backlog;
+        }
+    }
+    stats->drained = klog_drained;
+    stats->file_errors = klog_file_errors;
+}
+
+void klog_print_info(void) {
+    static const char* level_names[] = { "err", "warn", "info", "debug" };
+    klog_stats_t stats;
+    klog_get_stats(&stats);
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Kernel Log ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string("Level: ");
+    vga_write_string(klog_level < 4 ? level_names[klog_level] : "all");
+    vga_write_string("  Sinks:");
+    if (klog_sinks & KLOG_SINK_VGA) vga_write_string(" console");
+    if (klog_sinks & KLOG_SINK_FILE) vga_write_string(" file");
+    if ((klog_sinks & KLOG_SINK_HOOK) && klog_hook) vga_write_string(" hook");
+    vga_write_string(load_acquire(&klog_started) ? "\nDrainer: running\n" : "\nDrainer: not started\n");
+    vga_write_string("Logged: ");
+    print_dec(stats.logged);
+    vga_write_string("  Drained: ");
+    print_dec(stats.drained);
+    vga_write_string("  Dropped: ");
+    print_dec(stats.dropped);
+    vga_write_string("  Filtered: ");
+    print_dec(stats.filtered);
+    vga_write_string("\nMost waiting in one ring: ");
+    print_dec(stats.max_backlog);
+    vga_write_string(" of ");
+    print_dec(KLOG_ENTRIES);
+    if (stats.file_errors) {
+        vga_write_string("\nFile write errors: ");
+        print_dec(stats.file_errors);
+    }
+    vga_write_string("\n");
+}
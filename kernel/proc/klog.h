@@ -0,0 +1,80 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include "../types.h"
+
+// Deferred kernel log. A message is recorded, not printed: its format
+// string (the address is the message's id, so it must live for good),
+// up to KLOG_MAX_ARGS 32-bit arguments and a TSC stamp go into a ring of
+// the CPU it was logged on. Only that CPU writes its ring, with
+// interrupts off, and only the drainer reads it, so this takes no lock:
+// a handful of stores and an index published with a release. A full ring
+// drops the message and counts it rather than wait.
+//
+// A low priority task formats the records, oldest first across CPUs, and
+// hands each line to the sinks: the VGA console, an append only file and
+// a hook (for a GUI window), every KLOG_DRAIN_MS. Until that task is
+// started the records are drained as soon as they are written.
+//
+// Formats take %u, %d, %x, %c, %s (a string that outlives the message)
+// and %%.
+#define KLOG_ENTRIES            256     // Per CPU, power of two
+#define KLOG_MASK               (KLOG_ENTRIES - 1)
+#define KLOG_MAX_ARGS           4
+#define KLOG_LINE_MAX           160
+#define KLOG_DRAIN_MS           20
+
+// Levels
+#define KLOG_ERR                0
+#define KLOG_WARN               1
+#define KLOG_INFO               2
+#define KLOG_DEBUG              3
+
+// Sinks
+#define KLOG_SINK_VGA           0x01
+#define KLOG_SINK_FILE          0x02
+#define KLOG_SINK_HOOK          0x04
+
+typedef void (*klog_hook_t)(uint32_t level, const char* line);
+
+typedef struct {
+    uint32_t logged;
+    uint32_t dropped;           // Ring full
+    uint32_t filtered;          // Above the level
+    uint32_t drained;
+    uint32_t max_backlog;       // Records waiting in one ring, at most
+    uint32_t file_errors;
+} klog_stats_t;
+
+#define KLOG_NARGS(...)         KLOG_NARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define KLOG_NARGS_(_0, _1, _2, _3, _4, n, ...) n
+
+#define klog(level, fmt, ...) \
+    klog_write((level), (fmt), KLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+
+// Use klog(); arguments are 32-bit each
+void klog_write(uint32_t level, const char* fmt, uint32_t nargs, ...);
+
+// The drainer task; before it runs, records are printed as they come
+void klog_start(void);
+
+// Format and send out everything recorded so far; 0 if another caller is
+// draining already. For whoever needs the output now (a failure report
+// about to be shown, a shutdown).
+uint32_t klog_drain(void);
+
+// Messages above 'level' are not recorded
+void klog_set_level(uint32_t level);
+uint32_t klog_get_level(void);
+
+void klog_set_sinks(uint32_t sinks);
+uint32_t klog_get_sinks(void);
+void klog_set_hook(klog_hook_t hook);
+
+// Lines also appended to 'path' (created if needed); NULL stops that
+int klog_set_file(const char* path);
+
+void klog_get_stats(klog_stats_t* stats);
+void klog_print_info(void);
+
+#endif // KLOG_H
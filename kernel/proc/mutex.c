@@ -0,0 +1,310 @@
+#include "mutex.h"
+#include "process.h"
+#include "sched_trace.h"
+#include "../arch/tsc.h"
+#include "../arch/div64.h"
+#include "../drivers/vga.h"
+
+static spinlock_t pi_lock = SPINLOCK_INIT;
+static pi_stats_t pi_stats;
+
+uint32_t pi_lock_irqsave(void) {
+    return spin_lock_irqsave(&pi_lock);
+}
+
+void pi_unlock_irqrestore(uint32_t flags) {
+    spin_unlock_irqrestore(&pi_lock, flags);
+}
+
+// Waiter lists are short and kept sorted; equal priorities queue FIFO
+static void pi_waiter_insert(pi_object_t* obj, process_t* process) {
+    process_t** link = &obj->waiters;
+    while (*link && (*link)->priority <= process->priority) {
+        link = &(*link)->pi_wait_next;
+    }
+    process->pi_wait_next = *link;
+    *link = process;
+}
+
+static void pi_waiter_remove(pi_object_t* obj, process_t* process) {
+    for (process_t** link = &obj->waiters; *link; link = &(*link)->pi_wait_next) {
+        if (*link == process) {
+            *link = process->pi_wait_next;
+            process->pi_wait_next = NULL;
+            return;
+        }
+    }
+}
+
+// Recompute what a process inherits from the objects it holds. Returns
+// true if its effective priority changed.
+static bool pi_adjust(process_t* process) {
+    uint32_t inherited = NUM_PRIORITY_LEVELS;
+    for (pi_object_t* obj = process->pi_held; obj; obj = obj->held_next) {
+        if (obj->waiters && (uint32_t)obj->waiters->priority < inherited) {
+            inherited = obj->waiters->priority;
+        }
+    }
+
+    uint32_t old_priority = process->priority;
+    process->inherited_priority = inherited;
+    process_update_priority(process);
+    if ((uint32_t)process->priority == old_priority) {
+        return false;
+    }
+
+    if ((uint32_t)process->priority < old_priority) {
+        pi_stats.boosts++;
+    } else {
+        pi_stats.restores++;
+    }
+    sched_trace_pi(process, old_priority);
+    return true;
+}
+
+// Something 'owner' holds changed its waiters: carry the result up the
+// chain of owners it is blocked behind
+static void pi_chain_update(process_t* owner) {
+    uint32_t depth = 0;
+    while (owner && depth < PI_MAX_CHAIN_DEPTH) {
+        if (!pi_adjust(owner)) break;
+        depth++;
+
+        // Its place among the waiters of what it is blocked on moves too
+        pi_object_t* obj = owner->pi_blocked_on;
+        if (!obj) break;
+        pi_waiter_remove(obj, owner);
+        pi_waiter_insert(obj, owner);
+        owner = obj->owner;
+    }
+    if (depth > pi_stats.max_chain) {
+        pi_stats.max_chain = depth;
+    }
+}
+
+void pi_set_owner(pi_object_t* obj, process_t* owner) {
+    process_t* old_owner = obj->owner;
+    if (old_owner == owner) return;
+
+    if (old_owner) {
+        for (pi_object_t** link = &old_owner->pi_held; *link; link = &(*link)->held_next) {
+            if (*link == obj) {
+                *link = obj->held_next;
+                break;
+            }
+        }
+        obj->held_next = NULL;
+        obj->owner = NULL;
+        pi_chain_update(old_owner);
+    }
+
+    if (owner) {
+        obj->owner = owner;
+        obj->held_next = owner->pi_held;
+        owner->pi_held = obj;
+        pi_chain_update(owner);
+    }
+}
+
+// Queue the current process on 'obj' and sleep until a waker takes it off
+// the list or the timeout passes. pi_lock is dropped while blocked and
+// held again on return; true means a waker dequeued us.
+bool pi_wait(pi_object_t* obj, uint32_t* flags, uint32_t timeout_ms) {
+    process_t* self = current_process;
+
+    pi_waiter_insert(obj, self);
+    self->pi_blocked_on = obj;
+    pi_chain_update(obj->owner);
+
+    // Marked blocked before pi_lock drops, so a wakeup cannot be missed
+    process_set_state(self, PROCESS_BLOCKED);
+    spin_unlock_irqrestore(&pi_lock, *flags);
+
+    if (timeout_ms == PI_WAIT_FOREVER) {
+        uint32_t irq = irq_save();
+        if (self->state == PROCESS_BLOCKED) {
+            scheduler_yield();
+        }
+        irq_restore(irq);
+    } else {
+        process_block_timeout(self, timeout_ms);
+    }
+
+    *flags = spin_lock_irqsave(&pi_lock);
+    if (self->pi_blocked_on != obj) {
+        return true;
+    }
+
+    // Timed out (or unblocked by someone else): stop lending our priority
+    pi_waiter_remove(obj, self);
+    self->pi_blocked_on = NULL;
+    pi_chain_update(obj->owner);
+    return false;
+}
+
+// Dequeue and wake one waiter (pi_lock held)
+static process_t* pi_wake_top(pi_object_t* obj) {
+    process_t* waiter = obj->waiters;
+    if (!waiter) return NULL;
+
+    obj->waiters = waiter->pi_wait_next;
+    waiter->pi_wait_next = NULL;
+    waiter->pi_blocked_on = NULL;
+    return waiter;
+}
+
+void pi_wake_all(pi_object_t* obj) {
+    process_t* waiter;
+    while ((waiter = pi_wake_top(obj)) != NULL) {
+        process_unblock(waiter);
+    }
+    pi_chain_update(obj->owner);
+}
+
+// Priority set by process_set_priority: re-evaluate it and, if it waits on
+// something, its place in the waiter list and the owners above it
+void pi_priority_changed(process_t* process) {
+    uint32_t flags = spin_lock_irqsave(&pi_lock);
+    process_update_priority(process);
+    pi_object_t* obj = process->pi_blocked_on;
+    if (obj) {
+        pi_waiter_remove(obj, process);
+        pi_waiter_insert(obj, process);
+        pi_chain_update(obj->owner);
+    }
+    spin_unlock_irqrestore(&pi_lock, flags);
+}
+
+// A dying process stops waiting and gives up what it holds: mutexes pass
+// to their top waiter, other objects are just left without an owner
+void pi_process_exit(process_t* process) {
+    uint32_t flags = spin_lock_irqsave(&pi_lock);
+
+    pi_object_t* obj = process->pi_blocked_on;
+    if (obj) {
+        pi_waiter_remove(obj, process);
+        process->pi_blocked_on = NULL;
+        pi_chain_update(obj->owner);
+    }
+
+    while ((obj = process->pi_held) != NULL) {
+        process_t* next = obj->handoff ? pi_wake_top(obj) : NULL;
+        pi_set_owner(obj, next);
+        if (next) {
+            pi_stats.handoffs++;
+            process_unblock(next);
+        }
+    }
+
+    spin_unlock_irqrestore(&pi_lock, flags);
+}
+
+void kmutex_init(kmutex_t* mutex, const char* name) {
+    mutex->pi.owner = NULL;
+    mutex->pi.waiters = NULL;
+    mutex->pi.held_next = NULL;
+    mutex->pi.handoff = true;
+    mutex->name = name;
+    mutex->contentions = 0;
+    mutex->max_wait_us = 0;
+}
+
+int kmutex_lock(kmutex_t* mutex) {
+    return kmutex_lock_timeout(mutex, PI_WAIT_FOREVER);
+}
+
+int kmutex_trylock(kmutex_t* mutex) {
+    return kmutex_lock_timeout(mutex, 0);
+}
+
+int kmutex_lock_timeout(kmutex_t* mutex, uint32_t ms) {
+    process_t* self = current_process;
+    if (!mutex || !self) return -1;
+
+    uint32_t flags = spin_lock_irqsave(&pi_lock);
+    if (!mutex->pi.owner) {
+        pi_set_owner(&mutex->pi, self);
+        spin_unlock_irqrestore(&pi_lock, flags);
+        return 0;
+    }
+
+    // Recursion would deadlock; the idle process must never block
+    if (mutex->pi.owner == self || ms == 0 || self == idle_process) {
+        spin_unlock_irqrestore(&pi_lock, flags);
+        return -1;
+    }
+
+    mutex->contentions++;
+    uint64_t start = ktime_ns();
+    uint32_t deadline = get_current_time_ms() + ms;
+
+    // Unlock hands the mutex over, so one wakeup normally suffices
+    while (mutex->pi.owner != self) {
+        uint32_t wait = PI_WAIT_FOREVER;
+        if (ms != PI_WAIT_FOREVER) {
+            int32_t remaining = (int32_t)(deadline - get_current_time_ms());
+            if (remaining <= 0) {
+                pi_stats.timeouts++;
+                spin_unlock_irqrestore(&pi_lock, flags);
+                return -1;
+            }
+            wait = (uint32_t)remaining;
+        }
+        pi_wait(&mutex->pi, &flags, wait);
+    }
+
+    uint64_t waited_us = div_u64_u32(ktime_ns() - start, NSEC_PER_USEC, NULL);
+    uint32_t waited = (waited_us >> 32) ? 0xFFFFFFFF : (uint32_t)waited_us;
+    if (waited > mutex->max_wait_us) mutex->max_wait_us = waited;
+    if (waited > pi_stats.max_wait_us) pi_stats.max_wait_us = waited;
+
+    spin_unlock_irqrestore(&pi_lock, flags);
+    return 0;
+}
+
+int kmutex_unlock(kmutex_t* mutex) {
+    process_t* self = current_process;
+    if (!mutex || !self) return -1;
+
+    uint32_t flags = spin_lock_irqsave(&pi_lock);
+    if (mutex->pi.owner != self) {
+        spin_unlock_irqrestore(&pi_lock, flags);
+        return -1;
+    }
+
+    // Direct handoff: a lower priority process cannot barge in between
+    process_t* next = pi_wake_top(&mutex->pi);
+    pi_set_owner(&mutex->pi, next);
+    if (next) {
+        pi_stats.handoffs++;
+        process_unblock(next);
+    }
+
+    spin_unlock_irqrestore(&pi_lock, flags);
+    return 0;
+}
+
+void pi_get_stats(pi_stats_t* stats) {
+    if (!stats) return;
+    *stats = pi_stats;
+}
+
+void pi_print_info(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Priority Inheritance ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string("Boosts: ");
+    print_dec(pi_stats.boosts);
+    vga_write_string("  Restores: ");
+    print_dec(pi_stats.restores);
+    vga_write_string("  Handoffs: ");
+    print_dec(pi_stats.handoffs);
+    vga_write_string("  Timeouts: ");
+    print_dec(pi_stats.timeouts);
+    vga_write_string("\nLongest chain: ");
+    print_dec(pi_stats.max_chain);
+    vga_write_string("  Longest mutex wait: ");
+    print_dec(pi_stats.max_wait_us);
+    vga_write_string(" us\n");
+}
@@ -0,0 +1,67 @@
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include "../types.h"
+
+struct process;
+
+// Blocking locks with priority inheritance. A process waiting on a held
+// object lends its priority to the owner, and on through whatever that
+// owner is blocked on, so a low priority holder cannot be starved by
+// medium priority work while a realtime process waits on it. A waiter is
+// therefore blocked for at most the critical sections ahead of it; waits
+// can also be bounded outright with a timeout.
+#define PI_MAX_CHAIN_DEPTH      8           // Owner chain walked per change
+#define PI_WAIT_FOREVER         0xFFFFFFFF
+
+// Anything a process can block on that may have an owner to boost.
+// All of them are protected by one lock, pi_lock, which nests outside
+// proc_lock and the run queue locks.
+typedef struct pi_object {
+    struct process* owner;          // Inherits the waiters' priority, or NULL
+    struct process* waiters;        // Highest priority first (process->pi_wait_next)
+    struct pi_object* held_next;    // Next object the owner holds
+    bool handoff;                   // Pass ownership to the top waiter on exit
+} pi_object_t;
+
+typedef struct kmutex {
+    pi_object_t pi;
+    const char* name;
+    uint32_t contentions;           // Lock attempts that had to wait
+    uint32_t max_wait_us;           // Longest wait for it
+} kmutex_t;
+
+typedef struct {
+    uint32_t boosts;                // Owners raised by a waiter
+    uint32_t restores;              // Owners dropped back after a release
+    uint32_t handoffs;              // Mutexes passed straight to a waiter
+    uint32_t timeouts;              // Waits that gave up
+    uint32_t max_chain;             // Longest owner chain walked
+    uint32_t max_wait_us;           // Longest mutex wait seen
+} pi_stats_t;
+
+#define KMUTEX_INIT(n)  { { NULL, NULL, NULL, true }, (n), 0, 0 }
+
+// Mutexes (process context only). The lock calls return 0 once the caller
+// owns the mutex and -1 on timeout, recursion or outside a process.
+void kmutex_init(kmutex_t* mutex, const char* name);
+int kmutex_lock(kmutex_t* mutex);
+int kmutex_lock_timeout(kmutex_t* mutex, uint32_t ms);
+int kmutex_trylock(kmutex_t* mutex);
+int kmutex_unlock(kmutex_t* mutex);
+
+// Building blocks for other blocking objects (see semop in ipc.c)
+uint32_t pi_lock_irqsave(void);
+void pi_unlock_irqrestore(uint32_t flags);
+bool pi_wait(pi_object_t* obj, uint32_t* flags, uint32_t timeout_ms);  // pi_lock held
+void pi_wake_all(pi_object_t* obj);                                     // pi_lock held
+void pi_set_owner(pi_object_t* obj, struct process* owner);             // pi_lock held
+
+// Process lifecycle hooks
+void pi_priority_changed(struct process* process);
+void pi_process_exit(struct process* process);
+
+void pi_get_stats(pi_stats_t* stats);
+void pi_print_info(void);
+
+#endif // MUTEX_H
@@ -0,0 +1,305 @@
+#include "poll.h"
+#include "futex.h"
+#include "process.h"
+#include "../mm/memory.h"
+#include "../arch/cpu.h"
+#include "../net/net.h"
+#include "../drivers/vga.h"
+
+_Static_assert((POLLSET_MAX_ITEMS & (POLLSET_MAX_ITEMS - 1)) == 0, "POLLSET_MAX_ITEMS");
+_Static_assert(POLLSET_MAX_ITEMS <= 256, "ready ring holds item numbers in bytes");
+
+#define POLLSET_MASK            (POLLSET_MAX_ITEMS - 1)
+
+// Add events to an item and queue it if it is not already (set->lock held)
+static void poll_queue(poll_item_t* item, uint32_t events) {
+    pollset_t* set = item->set;
+    item->revents |= events;
+    if (item->queued) return;
+
+    item->queued = true;
+    set->ready[set->ready_tail++ & POLLSET_MASK] = (uint8_t)(item - set->items);
+    set->seq++;
+}
+
+// Wakers store seq, fence and then look at waiters, so either they see the
+// count or futex_wait sees the new value
+static void poll_notify(pollset_t* set) {
+    __sync_synchronize();
+    if (set->waiters) {
+        futex_wake(&set->seq, FUTEX_WAKE_ALL);
+    }
+}
+
+// The fence orders the source's state change before the peek at its list;
+// pollset_add links the item before its caller samples the state
+void poll_wake(poll_head_t* head, uint32_t events) {
+    __sync_synchronize();
+    if (!head->first) return;
+
+    uint32_t flags = spin_lock_irqsave(&head->lock);
+    for (poll_item_t* item = head->first; item; item = item->next) {
+        uint32_t hit = events & (item->events | POLL_HUP);
+        if (!hit) continue;
+
+        pollset_t* set = item->set;
+        spin_lock(&set->lock);
+        poll_queue(item, hit);
+        spin_unlock(&set->lock);
+        poll_notify(set);
+    }
+    spin_unlock_irqrestore(&head->lock, flags);
+}
+
+void poll_head_release(poll_head_t* head) {
+    uint32_t flags = spin_lock_irqsave(&head->lock);
+    poll_item_t* item = head->first;
+    head->first = NULL;
+    while (item) {
+        poll_item_t* next = item->next;
+        pollset_t* set = item->set;
+        spin_lock(&set->lock);
+        item->head = NULL;
+        item->next = NULL;
+        poll_queue(item, POLL_HUP);
+        spin_unlock(&set->lock);
+        poll_notify(set);
+        item = next;
+    }
+    spin_unlock_irqrestore(&head->lock, flags);
+}
+
+pollset_t* pollset_create(uint32_t flags) {
+    pollset_t* set = (pollset_t*)kmalloc(sizeof(pollset_t));
+    if (!set) return NULL;
+
+    memset(set, 0, sizeof(pollset_t));
+    set->flags = flags;
+    spin_lock_init(&set->lock);
+    return set;
+}
+
+void pollset_destroy(pollset_t* set) {
+    if (!set) return;
+
+    for (int i = 0; i < POLLSET_MAX_ITEMS; i++) {
+        if (set->items[i].in_use) {
+            pollset_del(set, i);
+        }
+    }
+    kfree(set);
+}
+
+static poll_item_t* poll_item_alloc(pollset_t* set, uint32_t events, uint32_t cookie) {
+    uint32_t flags = spin_lock_irqsave(&set->lock);
+    poll_item_t* item = NULL;
+    for (int i = 0; i < POLLSET_MAX_ITEMS; i++) {
+        if (!set->items[i].in_use) {
+            item = &set->items[i];
+            memset(item, 0, sizeof(poll_item_t));
+            item->set = set;
+            item->events = events;
+            item->cookie = cookie;
+            item->in_use = true;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&set->lock, flags);
+    return item;
+}
+
+int pollset_add(pollset_t* set, poll_head_t* head, uint32_t events, uint32_t cookie) {
+    if (!set || !head) return -1;
+
+    poll_item_t* item = poll_item_alloc(set, events, cookie);
+    if (!item) return -1;
+
+    uint32_t flags = spin_lock_irqsave(&head->lock);
+    item->head = head;
+    item->next = head->first;
+    head->first = item;
+    spin_unlock_irqrestore(&head->lock, flags);
+    return (int)(item - set->items);
+}
+
+void pollset_signal(pollset_t* set, int item, uint32_t events) {
+    if (!set || item < 0 || item >= POLLSET_MAX_ITEMS || !events) return;
+
+    uint32_t flags = spin_lock_irqsave(&set->lock);
+    bool queued = set->items[item].in_use;
+    if (queued) {
+        poll_queue(&set->items[item], events & (set->items[item].events | POLL_HUP));
+    }
+    spin_unlock_irqrestore(&set->lock, flags);
+    if (queued) poll_notify(set);
+}
+
+// Runs from the tick; re-armed from its own expiry so periods do not drift.
+// Re-armed under set->lock, so once pollset_del has cleared in_use it is
+// not armed again.
+static void poll_timer_expired(void* data) {
+    poll_item_t* item = (poll_item_t*)data;
+    pollset_t* set = item->set;
+
+    uint32_t flags = spin_lock_irqsave(&set->lock);
+    bool live = item->in_use;
+    if (live) {
+        poll_queue(item, POLL_TIMER);
+        timer_arm(&item->timer, item->timer.expires + item->period);
+    }
+    spin_unlock_irqrestore(&set->lock, flags);
+    if (live) poll_notify(set);
+}
+
+int pollset_add_timer(pollset_t* set, uint32_t period_ms, uint32_t cookie) {
+    if (!set || period_ms == 0 || period_ms > TIMER_MAX_DELAY_MS) return -1;
+
+    poll_item_t* item = poll_item_alloc(set, POLL_TIMER, cookie);
+    if (!item) return -1;
+
+    item->period = period_ms;
+    timer_setup(&item->timer, poll_timer_expired, item);
+    timer_arm(&item->timer, get_current_time_ms() + period_ms);
+    return (int)(item - set->items);
+}
+
+int pollset_del(pollset_t* set, int index) {
+    if (!set || index < 0 || index >= POLLSET_MAX_ITEMS || !set->items[index].in_use) return -1;
+
+    poll_item_t* item = &set->items[index];
+    poll_head_t* head = item->head;
+    if (head) {
+        // The source may have released its list meanwhile
+        uint32_t flags = spin_lock_irqsave(&head->lock);
+        if (item->head == head) {
+            poll_item_t** link = &head->first;
+            while (*link && *link != item) {
+                link = &(*link)->next;
+            }
+            if (*link) *link = item->next;
+            item->head = NULL;
+        }
+        spin_unlock_irqrestore(&head->lock, flags);
+    }
+
+    uint32_t flags = spin_lock_irqsave(&set->lock);
+    item->in_use = false;
+    item->revents = 0;
+    if (item->queued) {
+        // Close the gap in the ready ring
+        uint32_t out = set->ready_head;
+        for (uint32_t i = set->ready_head; i != set->ready_tail; i++) {
+            uint8_t n = set->ready[i & POLLSET_MASK];
+            if (n != (uint8_t)index) {
+                set->ready[out++ & POLLSET_MASK] = n;
+            }
+        }
+        set->ready_tail = out;
+        item->queued = false;
+    }
+    spin_unlock_irqrestore(&set->lock, flags);
+
+    // Not re-armed from here on; one mid-callback on the boot CPU is waited
+    // out, so the item can be reused or freed
+    if (item->period) {
+        timer_cancel_sync(&item->timer);
+    }
+    return 0;
+}
+
+int pollset_find(pollset_t* set, uint32_t cookie) {
+    if (!set) return -1;
+
+    for (int i = 0; i < POLLSET_MAX_ITEMS; i++) {
+        if (set->items[i].in_use && set->items[i].cookie == cookie) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void pollset_busy_poll(pollset_t* set, uint32_t busy_us) {
+    if (set && busy_us > set->busy_poll_us) set->busy_poll_us = busy_us;
+}
+
+int pollset_wait(pollset_t* set, poll_event_t* events, uint32_t max, uint32_t timeout_ms) {
+    if (!set || !events || max == 0) return -1;
+
+    uint32_t deadline = get_current_time_ms() + timeout_ms;
+    while (1) {
+        uint32_t seq = set->seq;
+        uint32_t flags = spin_lock_irqsave(&set->lock);
+        uint32_t count = 0;
+        while (count < max && set->ready_head != set->ready_tail) {
+            poll_item_t* item = &set->items[set->ready[set->ready_head++ & POLLSET_MASK]];
+            item->queued = false;
+            if (!item->revents) continue;
+
+            events[count].events = item->revents;
+            events[count].cookie = item->cookie;
+            item->revents = 0;
+            count++;
+        }
+        set->waits++;
+        set->reported += count;
+        spin_unlock_irqrestore(&set->lock, flags);
+        if (count || timeout_ms == 0) return (int)count;
+
+        uint32_t wait = FUTEX_WAIT_FOREVER;
+        if (timeout_ms != FUTEX_WAIT_FOREVER) {
+            int32_t remaining = (int32_t)(deadline - get_current_time_ms());
+            if (remaining <= 0) return 0;
+            wait = (uint32_t)remaining;
+        }
+
+        if (set->flags & POLLSET_BUSY_POLL) {
+            bool expired = false;
+            net_busy_poll_begin();
+            while (set->seq == seq) {
+                if (timeout_ms != FUTEX_WAIT_FOREVER &&
+                    (int32_t)(deadline - get_current_time_ms()) <= 0) {
+                    expired = true;
+                    break;
+                }
+                if (!net_busy_poll()) cpu_relax();
+            }
+            net_busy_poll_end();
+            if (expired && set->seq == seq) return 0;
+            continue;
+        }
+
+        uint32_t busy_us = set->busy_poll_us;
+        if (busy_us / 1000 > wait) busy_us = wait * 1000;
+        if (net_busy_wait(&set->seq, seq, busy_us)) continue;
+
+        __sync_fetch_and_add(&set->waiters, 1);
+        int result = futex_wait(&set->seq, seq, wait);
+        __sync_fetch_and_sub(&set->waiters, 1);
+        if (result != 0) return 0;
+    }
+}
+
+void pollset_print_info(pollset_t* set) {
+    if (!set) return;
+
+    uint32_t items = 0;
+    for (int i = 0; i < POLLSET_MAX_ITEMS; i++) {
+        if (set->items[i].in_use) items++;
+    }
+    vga_write_string("Poll set: ");
+    print_dec(items);
+    vga_write_string(" items, ");
+    print_dec(set->ready_tail - set->ready_head);
+    vga_write_string(" ready  Waits ");
+    print_dec(set->waits);
+    vga_write_string("  Events ");
+    print_dec(set->reported);
+    if (set->flags & POLLSET_BUSY_POLL) {
+        vga_write_string("  (busy poll)");
+    } else if (set->busy_poll_us) {
+        vga_write_string("  (busy poll ");
+        print_dec(set->busy_poll_us);
+        vga_write_string(" us)");
+    }
+    vga_write_string("\n");
+}
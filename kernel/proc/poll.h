@@ -0,0 +1,121 @@
+#ifndef POLL_H
+#define POLL_H
+
+#include "../types.h"
+#include "../arch/spinlock.h"
+#include "timer.h"
+
+// Readiness multiplexer in the style of epoll. A poll set watches pipes,
+// message queues, sockets and timers; each source keeps a poll_head_t of
+// the items watching it and calls poll_wake when its state changes, so a
+// wait costs the same however many sources are watched. Readiness is edge
+// triggered: an item is queued on the set's ready ring when an event it
+// asked for happens and is not queued already, and pollset_wait reports
+// and clears what has happened since. The ring holds every item at most
+// once, so it cannot overflow.
+//
+// POLLSET_BUSY_POLL sets never sleep: waits spin until the timeout,
+// walking the card's receive ring themselves (net_busy_poll), for a
+// process alone on an isolated core. Other sets spin that way for
+// busy_poll_us first, the longest SO_BUSY_POLL of the sockets added, so one
+// poller covers every socket it watches.
+#define POLLSET_MAX_ITEMS       64          // Power of two
+#define POLLSET_BUSY_POLL       0x1
+
+// Events
+#define POLL_IN                 0x1         // Data or a message to take
+#define POLL_OUT                0x2         // Room to write or send
+#define POLL_HUP                0x4         // Other end closed or source removed (always reported)
+#define POLL_TIMER              0x8         // Timer expired
+
+// Sources for user-level registration (sys_poll_ctl)
+#define POLL_SRC_FD             0           // Pipe end or socket in the fd table
+#define POLL_SRC_MSGQ           1           // Message queue id
+#define POLL_SRC_TIMER          2           // Period in ms
+
+#define POLL_CTL_ADD            0
+#define POLL_CTL_DEL            1           // By cookie
+
+struct pollset;
+
+typedef struct poll_item {
+    struct poll_item* next;     // On its source's list
+    struct pollset* set;
+    struct poll_head* head;     // Source it watches, NULL for timers
+    uint32_t events;            // Asked for
+    uint32_t revents;           // Happened since last reported
+    uint32_t cookie;            // Caller's, reported with the events
+    uint32_t period;            // Timers: ms between expiries
+    ktimer_t timer;
+    bool in_use;
+    bool queued;                // On the ready ring
+} poll_item_t;
+
+// Embedded in every source that can be watched
+typedef struct poll_head {
+    poll_item_t* first;
+    spinlock_t lock;
+} poll_head_t;
+
+#define POLL_HEAD_INIT { NULL, SPINLOCK_INIT }
+
+typedef struct {
+    uint32_t events;
+    uint32_t cookie;
+} poll_event_t;
+
+// sys_poll_ctl argument
+typedef struct {
+    uint32_t source;            // POLL_SRC_*
+    uint32_t target;            // fd, queue id or period
+    uint32_t events;
+    uint32_t cookie;
+} poll_ctl_t;
+
+typedef struct pollset {
+    volatile uint32_t seq;      // Bumped per item queued (waiters sleep on it)
+    uint32_t ready_head;        // Ready ring of item numbers, free running
+    uint32_t ready_tail;
+    uint8_t ready[POLLSET_MAX_ITEMS];
+    poll_item_t items[POLLSET_MAX_ITEMS];
+    uint32_t flags;
+    uint32_t busy_poll_us;      // Spun before sleeping (net_busy_wait)
+    uint32_t waiters;           // In futex_wait on seq
+    uint32_t waits;
+    uint32_t reported;          // Events handed out
+    spinlock_t lock;            // Items, revents and the ready ring
+} pollset_t;
+
+static inline void poll_head_init(poll_head_t* head) {
+    head->first = NULL;
+    spin_lock_init(&head->lock);
+}
+
+// Source side: 'events' happened. Cheap when nobody watches.
+void poll_wake(poll_head_t* head, uint32_t events);
+
+// Source going away: every item watching it gets POLL_HUP and is detached
+void poll_head_release(poll_head_t* head);
+
+pollset_t* pollset_create(uint32_t flags);
+void pollset_destroy(pollset_t* set);
+
+// Watch a source for 'events' (POLL_HUP is implied). Returns the item
+// number or -1. What holds already must then be sampled and passed to
+// pollset_signal, or an edge from before the add is lost.
+int pollset_add(pollset_t* set, poll_head_t* head, uint32_t events, uint32_t cookie);
+void pollset_signal(pollset_t* set, int item, uint32_t events);
+int pollset_add_timer(pollset_t* set, uint32_t period_ms, uint32_t cookie);
+int pollset_del(pollset_t* set, int item);
+int pollset_find(pollset_t* set, uint32_t cookie);  // Item number, or -1
+
+// Spin at least busy_us in waits before sleeping
+void pollset_busy_poll(pollset_t* set, uint32_t busy_us);
+
+// Up to 'max' events, waiting up to timeout_ms for the first (0 = poll,
+// FUTEX_WAIT_FOREVER = no limit). Returns how many, 0 on timeout.
+int pollset_wait(pollset_t* set, poll_event_t* events, uint32_t max, uint32_t timeout_ms);
+
+void pollset_print_info(pollset_t* set);
+
+#endif // POLL_H
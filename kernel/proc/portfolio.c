@@ -0,0 +1,328 @@
+#include "portfolio.h"
+#include "risk.h"
+#include "../mm/memory.h"
+#include "../arch/spinlock.h"
+#include "../arch/tsc.h"
+#include "../drivers/vga.h"
+
+#define PORTFOLIO_WORDS     (PORTFOLIO_MAX_SYMBOLS / 32)
+
+// One array per field, each starting on a line of its own
+static int32_t pf_quantity[PORTFOLIO_MAX_SYMBOLS] __cacheline_aligned;
+static double pf_avg_price[PORTFOLIO_MAX_SYMBOLS] __cacheline_aligned;
+static double pf_mark[PORTFOLIO_MAX_SYMBOLS] __cacheline_aligned;
+static double pf_unrealized[PORTFOLIO_MAX_SYMBOLS] __cacheline_aligned;
+static double pf_exposure[PORTFOLIO_MAX_SYMBOLS] __cacheline_aligned;
+static double pf_realized[PORTFOLIO_MAX_SYMBOLS] __cacheline_aligned;
+static double pf_bid[PORTFOLIO_MAX_SYMBOLS] __cacheline_aligned;
+static double pf_ask[PORTFOLIO_MAX_SYMBOLS] __cacheline_aligned;
+static uint64_t pf_timestamp[PORTFOLIO_MAX_SYMBOLS] __cacheline_aligned;
+
+// What was last broadcast, for the threshold
+static int32_t pf_sent_quantity[PORTFOLIO_MAX_SYMBOLS] __cacheline_aligned;
+static double pf_sent_pnl[PORTFOLIO_MAX_SYMBOLS] __cacheline_aligned;
+
+// Quotes may arrive in the receive interrupt: held with interrupts off
+static struct {
+    spinlock_t lock;
+    double threshold;
+    uint32_t symbols;           // Highest symbol touched, plus one
+    portfolio_totals_t totals;
+    uint64_t timestamp;
+    uint32_t totals_pending;
+    uint32_t pending[PORTFOLIO_WORDS];
+} portfolio;
+
+static inline double pf_abs(double value) {
+    return value < 0 ? -value : value;
+}
+
+void portfolio_init(void) {
+    memset(pf_quantity, 0, sizeof(pf_quantity));
+    memset(pf_avg_price, 0, sizeof(pf_avg_price));
+    memset(pf_mark, 0, sizeof(pf_mark));
+    memset(pf_unrealized, 0, sizeof(pf_unrealized));
+    memset(pf_exposure, 0, sizeof(pf_exposure));
+    memset(pf_realized, 0, sizeof(pf_realized));
+    memset(pf_bid, 0, sizeof(pf_bid));
+    memset(pf_ask, 0, sizeof(pf_ask));
+    memset(pf_timestamp, 0, sizeof(pf_timestamp));
+    memset(pf_sent_quantity, 0, sizeof(pf_sent_quantity));
+    memset(pf_sent_pnl, 0, sizeof(pf_sent_pnl));
+    memset(&portfolio, 0, sizeof(portfolio));
+    spin_lock_init(&portfolio.lock);
+    portfolio.threshold = PORTFOLIO_DEFAULT_THRESHOLD;
+}
+
+void portfolio_set_threshold(double threshold) {
+    portfolio.threshold = threshold > 0 ? threshold : 0;
+}
+
+// The side a close would trade against, else the other, else unchanged
+static double portfolio_pick_mark(uint32_t i) {
+    double near = pf_quantity[i] < 0 ? pf_ask[i] : pf_bid[i];
+    double far = pf_quantity[i] < 0 ? pf_bid[i] : pf_ask[i];
+    return near > 0 ? near : far > 0 ? far : pf_mark[i];
+}
+
+// One symbol at its mark, the totals moved by the difference; lock held
+static void portfolio_revalue(uint32_t i, uint64_t now) {
+    double held = pf_quantity[i];
+    double unrealized = (pf_mark[i] - pf_avg_price[i]) * held;
+    double exposure = pf_mark[i] * held;
+
+    portfolio_totals_t* totals = &portfolio.totals;
+    totals->unrealized_pnl += unrealized - pf_unrealized[i];
+    totals->net_exposure += exposure - pf_exposure[i];
+    totals->gross_exposure += pf_abs(exposure) - pf_abs(pf_exposure[i]);
+    pf_unrealized[i] = unrealized;
+    pf_exposure[i] = exposure;
+    pf_timestamp[i] = now;
+    portfolio.timestamp = now;
+
+    double moved = pf_realized[i] + unrealized - pf_sent_pnl[i];
+    if (pf_quantity[i] != pf_sent_quantity[i] || pf_abs(moved) > portfolio.threshold) {
+        portfolio.pending[i / 32] |= 1u << (i % 32);
+    }
+}
+
+static inline void portfolio_touch(uint32_t i) {
+    if (i >= portfolio.symbols) {
+        portfolio.symbols = i + 1;
+    }
+}
+
+void portfolio_on_fill(uint16_t symbol_id, uint8_t side, uint32_t quantity, double price) {
+    if (symbol_id >= PORTFOLIO_MAX_SYMBOLS || quantity == 0 || quantity > RISK_MAX_QUANTITY) return;
+
+    uint32_t flags = spin_lock_irqsave(&portfolio.lock);
+    uint32_t i = symbol_id;
+    int32_t before = pf_quantity[i];
+    int32_t delta = side ? -(int32_t)quantity : (int32_t)quantity;
+    int32_t after = before + delta;
+    int32_t held = before < 0 ? -before : before;
+
+    // Averaging in, or closing against the average
+    if (before == 0 || (before > 0) == (delta > 0)) {
+        int32_t total = after < 0 ? -after : after;
+        pf_avg_price[i] = (pf_avg_price[i] * held + price * (int32_t)quantity) / total;
+    } else {
+        int32_t closed = (int32_t)quantity < held ? (int32_t)quantity : held;
+        double gain = (price - pf_avg_price[i]) * closed;
+        if (before < 0) gain = -gain;
+        pf_realized[i] += gain;
+        portfolio.totals.realized_pnl += gain;
+        if (after == 0) {
+            pf_avg_price[i] = 0;
+        } else if ((after > 0) != (before > 0)) {
+            pf_avg_price[i] = price;    // Flipped through flat
+        }
+    }
+    pf_quantity[i] = after;
+    if (before == 0) portfolio.totals.positions++;
+    if (after == 0) portfolio.totals.positions--;
+
+    // Marked at the fill until the book has the closing side
+    double mark = portfolio_pick_mark(i);
+    pf_mark[i] = mark > 0 ? mark : price;
+    portfolio_touch(i);
+    portfolio_revalue(i, ktime_ns());
+    spin_unlock_irqrestore(&portfolio.lock, flags);
+}
+
+void portfolio_on_quote(uint16_t symbol_id, double bid, double ask) {
+    if (symbol_id >= PORTFOLIO_MAX_SYMBOLS) return;
+
+    uint32_t flags = spin_lock_irqsave(&portfolio.lock);
+    uint32_t i = symbol_id;
+    pf_bid[i] = bid;
+    pf_ask[i] = ask;
+
+    // Flat symbols only keep the quote for their next fill
+    double mark = portfolio_pick_mark(i);
+    if (pf_quantity[i] != 0 && mark != pf_mark[i]) {
+        pf_mark[i] = mark;
+        portfolio_revalue(i, ktime_ns());
+    } else {
+        pf_mark[i] = mark;
+    }
+    spin_unlock_irqrestore(&portfolio.lock, flags);
+}
+
+void portfolio_revalue_all(portfolio_totals_t* totals) {
+    uint32_t flags = spin_lock_irqsave(&portfolio.lock);
+    uint32_t count = portfolio.symbols;
+
+    // No branches but the loop's, so the arithmetic runs in vector lanes
+    double unrealized = 0, realized = 0, net = 0, gross = 0;
+    uint32_t positions = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        double held = pf_quantity[i];
+        double value = (pf_mark[i] - pf_avg_price[i]) * held;
+        double exposure = pf_mark[i] * held;
+        pf_unrealized[i] = value;
+        pf_exposure[i] = exposure;
+        unrealized += value;
+        realized += pf_realized[i];
+        net += exposure;
+        gross += pf_abs(exposure);
+        positions += pf_quantity[i] != 0;
+    }
+
+    portfolio.totals.positions = positions;
+    portfolio.totals.realized_pnl = realized;
+    portfolio.totals.unrealized_pnl = unrealized;
+    portfolio.totals.net_exposure = net;
+    portfolio.totals.gross_exposure = gross;
+    portfolio.timestamp = ktime_ns();
+    portfolio.totals_pending = 1;   // A snapshot always goes out
+    if (totals) *totals = portfolio.totals;
+    spin_unlock_irqrestore(&portfolio.lock, flags);
+}
+
+static void portfolio_fill_update(uint32_t i, portfolio_update_t* update) {
+    update->symbol_id = (uint16_t)i;
+    update->reserved = 0;
+    update->quantity = pf_quantity[i];
+    update->avg_price = pf_avg_price[i];
+    update->mark = pf_mark[i];
+    update->realized_pnl = pf_realized[i];
+    update->unrealized_pnl = pf_unrealized[i];
+    update->exposure = pf_exposure[i];
+    update->gross_exposure = pf_abs(pf_exposure[i]);
+    update->timestamp = pf_timestamp[i];
+}
+
+uint32_t portfolio_publish(void) {
+    portfolio_update_t update;
+    uint32_t sent = 0;
+
+    // Copied under the lock, broadcast outside it: broadcasting may sleep
+    for (uint32_t w = 0; w < PORTFOLIO_WORDS; w++) {
+        for (;;) {
+            uint32_t flags = spin_lock_irqsave(&portfolio.lock);
+            uint32_t bits = portfolio.pending[w];
+            if (!bits) {
+                spin_unlock_irqrestore(&portfolio.lock, flags);
+                break;
+            }
+            uint32_t bit = 1u << __builtin_ctz(bits);
+            uint32_t i = w * 32 + __builtin_ctz(bits);
+            portfolio.pending[w] &= ~bit;
+            portfolio_fill_update(i, &update);
+            pf_sent_quantity[i] = pf_quantity[i];
+            pf_sent_pnl[i] = pf_realized[i] + pf_unrealized[i];
+            spin_unlock_irqrestore(&portfolio.lock, flags);
+
+            if (broadcast_trade_signal(MSG_PORTFOLIO_DATA, &update, sizeof(update)) != 0) {
+                flags = spin_lock_irqsave(&portfolio.lock);
+                portfolio.pending[w] |= bit;
+                portfolio.totals_pending |= sent != 0;
+                spin_unlock_irqrestore(&portfolio.lock, flags);
+                return sent;
+            }
+            sent++;
+        }
+    }
+
+    uint32_t flags = spin_lock_irqsave(&portfolio.lock);
+    bool totals = sent || portfolio.totals_pending;
+    portfolio.totals_pending = 0;
+    memset(&update, 0, sizeof(update));
+    update.symbol_id = PORTFOLIO_TOTALS;
+    update.quantity = (int32_t)portfolio.totals.positions;
+    update.realized_pnl = portfolio.totals.realized_pnl;
+    update.unrealized_pnl = portfolio.totals.unrealized_pnl;
+    update.exposure = portfolio.totals.net_exposure;
+    update.gross_exposure = portfolio.totals.gross_exposure;
+    update.timestamp = portfolio.timestamp;
+    spin_unlock_irqrestore(&portfolio.lock, flags);
+
+    if (totals && broadcast_trade_signal(MSG_PORTFOLIO_DATA, &update, sizeof(update)) != 0) {
+        flags = spin_lock_irqsave(&portfolio.lock);
+        portfolio.totals_pending = 1;
+        spin_unlock_irqrestore(&portfolio.lock, flags);
+    }
+    return sent;
+}
+
+int portfolio_position(uint16_t symbol_id, position_t* out) {
+    if (symbol_id >= PORTFOLIO_MAX_SYMBOLS || !out) return -1;
+
+    uint32_t flags = spin_lock_irqsave(&portfolio.lock);
+    out->position_id = symbol_id;
+    out->symbol_id = symbol_id;
+    out->quantity = pf_quantity[symbol_id];
+    out->avg_price = pf_avg_price[symbol_id];
+    out->unrealized_pnl = pf_unrealized[symbol_id];
+    out->realized_pnl = pf_realized[symbol_id];
+    out->timestamp = pf_timestamp[symbol_id];
+    spin_unlock_irqrestore(&portfolio.lock, flags);
+    return 0;
+}
+
+void portfolio_totals(portfolio_totals_t* totals) {
+    if (!totals) return;
+
+    uint32_t flags = spin_lock_irqsave(&portfolio.lock);
+    *totals = portfolio.totals;
+    spin_unlock_irqrestore(&portfolio.lock, flags);
+}
+
+// Whole currency units, rounded, with a sign
+static void portfolio_print_amount(double value) {
+    if (value < 0) {
+        vga_write_string("-");
+        value = -value;
+    }
+    print_dec((uint32_t)(value + 0.5));
+}
+
+// Hundredths, for prices
+static void portfolio_print_price(double value) {
+    uint32_t cents = (uint32_t)(value * 100 + 0.5);
+    print_dec(cents / 100);
+    vga_write_string(cents % 100 < 10 ? ".0" : ".");
+    print_dec(cents % 100);
+}
+
+void portfolio_print_info(void) {
+    portfolio_totals_t totals;
+    portfolio_totals(&totals);
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Portfolio ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    uint32_t count = portfolio.symbols;
+    for (uint32_t i = 0; i < count; i++) {
+        position_t position;
+        portfolio_position((uint16_t)i, &position);
+        if (position.quantity == 0 && position.realized_pnl == 0) continue;
+
+        vga_write_string("  ");
+        print_dec(i);
+        vga_write_string(": ");
+        portfolio_print_amount((double)position.quantity);
+        vga_write_string(" @ ");
+        portfolio_print_price(position.avg_price);
+        vga_write_string(", mark ");
+        portfolio_print_price(pf_mark[i]);
+        vga_write_string(", unrealised ");
+        portfolio_print_amount(position.unrealized_pnl);
+        vga_write_string(", realised ");
+        portfolio_print_amount(position.realized_pnl);
+        vga_write_string("\n");
+    }
+
+    print_dec(totals.positions);
+    vga_write_string(" positions  P&L: ");
+    portfolio_print_amount(totals.realized_pnl);
+    vga_write_string(" realised, ");
+    portfolio_print_amount(totals.unrealized_pnl);
+    vga_write_string(" unrealised\nExposure: ");
+    portfolio_print_amount(totals.net_exposure);
+    vga_write_string(" net, ");
+    portfolio_print_amount(totals.gross_exposure);
+    vga_write_string(" gross\n");
+}
@@ -0,0 +1,72 @@
+#ifndef PORTFOLIO_H
+#define PORTFOLIO_H
+
+#include "../types.h"
+#include "ipc.h"
+
+// Position keeping and mark-to-market. Each field of the book of positions
+// is an array of its own (quantity, average price, mark, P&L, exposure), so
+// a fill or a top-of-book change rewrites one symbol's slots and moves the
+// totals by the difference, and the periodic full revaluation is one pass
+// of straight-line arithmetic over the arrays that the compiler can
+// vectorise. Longs mark at the bid and shorts at the ask, what closing out
+// would fetch; a symbol without that side marks at the other, or its last
+// fill.
+//
+// Updates are never broadcast inline: fills come from the trading path and
+// quotes from the feed handler, which may be in the receive interrupt. A
+// symbol is marked pending when its quantity changes or its P&L moves more
+// than the threshold from what was last sent, and portfolio_publish sends
+// the pending ones as MSG_PORTFOLIO_DATA trade signals, with the totals
+// after them, from a context that may sleep.
+#define PORTFOLIO_MAX_SYMBOLS       1024
+#define PORTFOLIO_DEFAULT_THRESHOLD 1.0         // P&L change worth a broadcast
+#define PORTFOLIO_TOTALS            0xFFFF      // symbol_id of the totals update
+
+// MSG_PORTFOLIO_DATA payload
+typedef struct {
+    uint16_t symbol_id;         // PORTFOLIO_TOTALS for the book as a whole
+    uint16_t reserved;
+    int32_t quantity;           // Totals: symbols with a position
+    double avg_price;           // Totals: 0
+    double mark;                // Totals: 0
+    double realized_pnl;
+    double unrealized_pnl;
+    double exposure;            // Quantity at the mark; totals: net
+    double gross_exposure;      // Absolute exposure
+    uint64_t timestamp;         // ktime_ns() of the last change
+} portfolio_update_t;
+
+typedef struct {
+    uint32_t positions;         // Symbols not flat
+    double realized_pnl;
+    double unrealized_pnl;
+    double net_exposure;
+    double gross_exposure;
+} portfolio_totals_t;
+
+void portfolio_init(void);
+void portfolio_set_threshold(double threshold);
+
+// Incremental updates, touching only the symbol concerned. Fills come in
+// through risk_on_fill, top of book through market_snapshot_update; a zero
+// price is a side with no quote.
+void portfolio_on_fill(uint16_t symbol_id, uint8_t side, uint32_t quantity, double price);
+void portfolio_on_quote(uint16_t symbol_id, double bid, double ask);
+
+// Full revaluation of every symbol at its current mark, for snapshots. The
+// running totals are replaced with the recomputed ones, which clears any
+// rounding the incremental updates have gathered.
+void portfolio_revalue_all(portfolio_totals_t* totals);
+
+// Broadcast the pending updates; how many symbols were sent. Stops early
+// when the trade signal subscribers have no room, leaving the rest pending.
+uint32_t portfolio_publish(void);
+
+// A consistent copy (-1 out of range)
+int portfolio_position(uint16_t symbol_id, position_t* out);
+void portfolio_totals(portfolio_totals_t* totals);
+
+void portfolio_print_info(void);
+
+#endif // PORTFOLIO_H
@@ -0,0 +1,134 @@
+#include "price.h"
+#include "../mm/memory.h"
+
+// Per-symbol scale, both ways, so neither conversion divides
+static uint8_t price_scales[PRICE_MAX_SYMBOLS];
+static double ticks_per_unit[PRICE_MAX_SYMBOLS];
+static double units_per_tick[PRICE_MAX_SYMBOLS];
+
+void price_init(void) {
+    for (uint32_t i = 0; i < PRICE_MAX_SYMBOLS; i++) {
+        price_set_scale((uint16_t)i, PRICE_DEFAULT_DECIMALS);
+    }
+}
+
+int price_set_scale(uint16_t symbol_id, uint8_t decimals) {
+    if (symbol_id >= PRICE_MAX_SYMBOLS || decimals > PRICE_MAX_DECIMALS) return -1;
+
+    double factor = 1;
+    for (uint8_t i = 0; i < decimals; i++) {
+        factor *= 10;
+    }
+    price_scales[symbol_id] = decimals;
+    ticks_per_unit[symbol_id] = factor;
+    units_per_tick[symbol_id] = 1 / factor;
+    return 0;
+}
+
+uint8_t price_decimals(uint16_t symbol_id) {
+    return symbol_id < PRICE_MAX_SYMBOLS ? price_scales[symbol_id] : 0;
+}
+
+price_t price_from_double(uint16_t symbol_id, double price) {
+    if (symbol_id >= PRICE_MAX_SYMBOLS) return 0;
+
+    double ticks = price * ticks_per_unit[symbol_id];
+    return (price_t)(ticks >= 0 ? ticks + 0.5 : ticks - 0.5);
+}
+
+double price_to_double(uint16_t symbol_id, price_t price) {
+    return symbol_id < PRICE_MAX_SYMBOLS ? price * units_per_tick[symbol_id] : 0;
+}
+
+md_batch_t* md_batch_create(void) {
+    md_batch_t* batch = (md_batch_t*)kmalloc_aligned(sizeof(md_batch_t), CACHE_LINE_SIZE);
+    if (batch) {
+        batch->count = 0;
+    }
+    return batch;
+}
+
+int md_batch_add(md_batch_t* batch, const market_data_t* data) {
+    if (batch->count >= MD_BATCH_SIZE) return -1;
+
+    uint32_t i = batch->count++;
+    batch->symbol_id[i] = data->symbol_id;
+    batch->side[i] = data->side;
+    batch->flags[i] = data->flags;
+    batch->price[i] = price_from_double(data->symbol_id, data->price);
+    batch->volume[i] = (qty_t)data->volume;
+    batch->timestamp[i] = data->timestamp;
+    return 0;
+}
+
+void md_batch_get(const md_batch_t* batch, uint32_t index, market_data_t* out) {
+    out->symbol_id = batch->symbol_id[index];
+    out->side = batch->side[index];
+    out->flags = batch->flags[index];
+    out->price = price_to_double(out->symbol_id, batch->price[index]);
+    out->volume = (uint64_t)batch->volume[index];
+    out->timestamp = batch->timestamp[index];
+}
+
+uint32_t md_batch_fill(md_batch_t* batch, lockfree_ringbuf_t* ring) {
+    if (!ring || ring->element_size != sizeof(market_data_t)) return 0;
+
+    uint32_t added = 0;
+    while (batch->count < MD_BATCH_SIZE) {
+        uint32_t avail;
+        const market_data_t* data = (const market_data_t*)ringbuf_peek(ring, MD_BATCH_SIZE - batch->count,
+                                                                      &avail);
+        if (!data) break;
+
+        for (uint32_t i = 0; i < avail; i++) {
+            md_batch_add(batch, &data[i]);
+        }
+        ringbuf_release(ring, avail);
+        added += avail;
+    }
+    return added;
+}
+
+// The loops below select with masks rather than branches, so each is a
+// straight pass over two or three arrays
+qty_t md_batch_volume(const md_batch_t* batch, uint16_t symbol_id, uint8_t side, int64_t* notional) {
+    qty_t volume = 0;
+    int64_t sum = 0;
+    for (uint32_t i = 0; i < batch->count; i++) {
+        int64_t mask = -(int64_t)(batch->symbol_id[i] == symbol_id && batch->side[i] == side);
+        qty_t v = batch->volume[i] & mask;
+        volume += v;
+        sum += batch->price[i] * v;
+    }
+    if (notional) *notional = sum;
+    return volume;
+}
+
+int md_batch_range(const md_batch_t* batch, uint16_t symbol_id, price_t* low, price_t* high) {
+    price_t lo = PRICE_MAX;
+    price_t hi = PRICE_MIN;
+    for (uint32_t i = 0; i < batch->count; i++) {
+        int64_t mask = -(int64_t)(batch->symbol_id[i] == symbol_id);
+        price_t p = batch->price[i];
+        // Lanes of other symbols see the identities
+        price_t for_low = (p & mask) | (PRICE_MAX & ~mask);
+        price_t for_high = (p & mask) | (PRICE_MIN & ~mask);
+        lo = for_low < lo ? for_low : lo;
+        hi = for_high > hi ? for_high : hi;
+    }
+    if (hi < lo) return -1;
+
+    *low = lo;
+    *high = hi;
+    return 0;
+}
+
+double md_batch_vwap(const md_batch_t* batch, uint16_t symbol_id) {
+    if (symbol_id >= PRICE_MAX_SYMBOLS) return 0;
+
+    int64_t notional;
+    qty_t volume = md_batch_volume(batch, symbol_id, MD_SIDE_TRADE, &notional);
+    if (volume == 0) return 0;
+
+    return (double)notional / (double)volume * units_per_tick[symbol_id];
+}
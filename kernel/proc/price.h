@@ -0,0 +1,70 @@
+#ifndef PRICE_H
+#define PRICE_H
+
+#include "../types.h"
+#include "ipc.h"
+
+// Fixed-point prices and quantities. A price_t counts ticks of 10^-decimals
+// in its symbol's scale (PRICE_DEFAULT_DECIMALS until set), so arithmetic on
+// prices is integer arithmetic and needs no FPU state. The double fields of
+// the IPC records stay as the interface; convert at the edges with
+// price_from_double / price_to_double.
+#define PRICE_MAX_SYMBOLS       1024
+#define PRICE_MAX_DECIMALS      9
+#define PRICE_DEFAULT_DECIMALS  4
+
+typedef int64_t price_t;
+typedef int64_t qty_t;
+
+#define PRICE_MAX               ((price_t)0x7FFFFFFFFFFFFFFFLL)
+#define PRICE_MIN               (-PRICE_MAX - 1)
+
+void price_init(void);
+int price_set_scale(uint16_t symbol_id, uint8_t decimals);
+uint8_t price_decimals(uint16_t symbol_id);
+
+// Rounded to the nearest tick
+price_t price_from_double(uint16_t symbol_id, double price);
+double price_to_double(uint16_t symbol_id, price_t price);
+
+// Market data in structure-of-arrays form: one array per field, each on
+// lines of its own, so a pass over many updates reads only the fields it
+// uses and the loops vectorise. Prices are in each symbol's scale.
+#define MD_BATCH_SIZE           256
+
+typedef struct {
+    uint32_t count;
+    uint16_t symbol_id[MD_BATCH_SIZE] __cacheline_aligned;
+    uint8_t side[MD_BATCH_SIZE] __cacheline_aligned;
+    uint8_t flags[MD_BATCH_SIZE] __cacheline_aligned;
+    price_t price[MD_BATCH_SIZE] __cacheline_aligned;
+    qty_t volume[MD_BATCH_SIZE] __cacheline_aligned;
+    uint64_t timestamp[MD_BATCH_SIZE] __cacheline_aligned;
+} __cacheline_aligned md_batch_t;
+
+// Free with kfree_aligned
+md_batch_t* md_batch_create(void);
+
+static inline void md_batch_clear(md_batch_t* batch) {
+    batch->count = 0;
+}
+
+// Edges: one record in (-1 when full) or out
+int md_batch_add(md_batch_t* batch, const market_data_t* data);
+void md_batch_get(const md_batch_t* batch, uint32_t index, market_data_t* out);
+
+// Take market_data_t from a feed ring, in place, until the batch is full
+// or the ring empty. Returns how many were added.
+uint32_t md_batch_fill(md_batch_t* batch, lockfree_ringbuf_t* ring);
+
+// Over the updates of one symbol and side (MD_SIDE_TRADE for trades):
+// total volume, with the sum of price times volume in *notional
+qty_t md_batch_volume(const md_batch_t* batch, uint16_t symbol_id, uint8_t side, int64_t* notional);
+
+// Lowest and highest price of a symbol's updates; -1 if it has none
+int md_batch_range(const md_batch_t* batch, uint16_t symbol_id, price_t* low, price_t* high);
+
+// Volume-weighted trade price, converted at the edge (0 without trades)
+double md_batch_vwap(const md_batch_t* batch, uint16_t symbol_id);
+
+#endif // PRICE_H
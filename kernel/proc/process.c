@@ -2,14 +2,84 @@
 #include "../mm/memory.h"
 #include "../mm/paging.h"
 #include "../drivers/vga.h"
+#include "tick.h"
+#include "timer.h"
+#include "sched_trace.h"
+#include "mutex.h"
+#include "futex.h"
+#include "vdso.h"
+#include "uring.h"
+#include "../net/nicmap.h"
+#include "../arch/fpu.h"
+
+// Entry stub for new processes (context_switch.asm)
+extern void process_entry_trampoline(void);
+
+// process_t offsets hard-coded in context_switch.asm
+_Static_assert(__builtin_offsetof(process_t, context) +
+               __builtin_offsetof(cpu_context_t, esp) == 76, "context.esp offset");
+_Static_assert(__builtin_offsetof(process_t, context) +
+               __builtin_offsetof(cpu_context_t, eip) == 84, "context.eip offset");
+_Static_assert(__builtin_offsetof(process_t, context) +
+               __builtin_offsetof(cpu_context_t, cr3) == 104, "context.cr3 offset");
 
 // Global variables
 process_t process_table[MAX_PROCESSES];
 static bool process_table_used[MAX_PROCESSES];
 static uint32_t next_pid = 1;
-static uint32_t system_time_ms = 0;
-process_t* current_process = NULL;
-process_t* idle_process = NULL;
+
+// O(1) slot allocation: a stack of free table slots, and a kernel stack
+// slab with one DEFAULT_STACK_SIZE stack per slot
+static uint16_t free_slots[MAX_PROCESSES];
+static uint32_t free_slot_count;
+static uint8_t stack_slab[MAX_PROCESSES][DEFAULT_STACK_SIZE] __attribute__((aligned(16)));
+
+// PID -> PCB index
+static process_t* pid_hash[PID_HASH_SIZE];
+
+// Protects the process table, the blocked/terminated queues and
+// proc_stats. Ready queues have their own per-CPU locks, taken after this
+// one is released.
+static spinlock_t proc_lock = SPINLOCK_INIT;
+
+static inline uint32_t pid_hash_bucket(uint32_t pid) {
+    return (pid * 2654435761u) >> 23;   // Knuth multiplicative, top 9 bits
+}
+
+// PID hash maintenance (proc_lock held)
+static void pid_hash_insert(process_t* process) {
+    uint32_t bucket = pid_hash_bucket(process->pid);
+    process->pid_hash_next = pid_hash[bucket];
+    pid_hash[bucket] = process;
+}
+
+static void pid_hash_remove(process_t* process) {
+    process_t** link = &pid_hash[pid_hash_bucket(process->pid)];
+    while (*link) {
+        if (*link == process) {
+            *link = process->pid_hash_next;
+            process->pid_hash_next = NULL;
+            return;
+        }
+        link = &(*link)->pid_hash_next;
+    }
+}
+
+static process_t* pid_hash_lookup(uint32_t pid) {
+    for (process_t* process = pid_hash[pid_hash_bucket(pid)]; process; process = process->pid_hash_next) {
+        if (process->pid == pid) {
+            return process;
+        }
+    }
+    return NULL;
+}
+
+// Whether a stack came from the slab (the APs' idle stacks do not)
+static inline bool stack_in_slab(uint32_t base) {
+    return base >= (uint32_t)stack_slab && base < (uint32_t)stack_slab + sizeof(stack_slab);
+}
+
+static void process_timer_expired(void* data);
 
 // Idle task function - runs when no other processes are ready
 void idle_task(void) {
@@ -21,8 +91,7 @@ void idle_task(void) {
 // Process statistics
 process_stats_t proc_stats = {0};
 
-// Scheduler queues for each priority level
-scheduler_queue_t ready_queues[5];  // One for each priority level
+// Scheduler queues (ready queues are per CPU, see cpu_t)
 scheduler_queue_t blocked_queue;
 scheduler_queue_t terminated_queue;
 
@@ -39,46 +108,69 @@ void process_init(void) {
     // Clear process table
     memset(process_table, 0, sizeof(process_table));
     memset(process_table_used, 0, sizeof(process_table_used));
+    memset(pid_hash, 0, sizeof(pid_hash));
     
-    // Initialize scheduler queues
-    for (int i = 0; i < 5; i++) {
-        queue_init(&ready_queues[i]);
+    // Lowest slots come off the free stack first
+    free_slot_count = 0;
+    for (int i = MAX_PROCESSES - 1; i >= 0; i--) {
+        free_slots[free_slot_count++] = (uint16_t)i;
     }
+    
+    timer_init();
+    futex_init();
+    
+    // Initialize scheduler queues
+    scheduler_init_cpu(&cpus[BOOT_CPU]);
     queue_init(&blocked_queue);
     queue_init(&terminated_queue);
     
     // Initialize statistics
     memset(&proc_stats, 0, sizeof(proc_stats));
     
-    // Create idle process
-    idle_process = process_create("idle", idle_task, PRIORITY_IDLE);
-    if (idle_process) {
-        idle_process->pid = IDLE_PROCESS_PID;
-        idle_process->state = PROCESS_READY;
-    }
-    
-    // Set initial current process to idle
-    current_process = idle_process;
+    // Create idle process; the boot code itself becomes its context
+    process_create_idle(BOOT_CPU);
     
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     vga_write_string("Process management initialized\n");
 }
 
+// Create the idle process of a CPU. It is that CPU's current process from
+// the start: whatever code the CPU is running becomes the idle context on
+// the first switch away.
+process_t* process_create_idle(uint32_t cpu) {
+    char name[8] = "idle/0";
+    name[5] = '0' + (char)cpu;
+    
+    process_t* idle = process_create(cpu == BOOT_CPU ? "idle" : name, idle_task, PRIORITY_IDLE);
+    if (!idle) return NULL;
+    
+    if (cpu == BOOT_CPU) {
+        uint32_t flags = spin_lock_irqsave(&proc_lock);
+        pid_hash_remove(idle);
+        idle->pid = IDLE_PROCESS_PID;
+        pid_hash_insert(idle);
+        spin_unlock_irqrestore(&proc_lock, flags);
+    }
+    idle->state = PROCESS_READY;
+    idle->cpu = cpu;
+    idle->pinned_cpu = (int32_t)cpu;
+    idle->on_cpu = true;
+    
+    cpus[cpu].idle = idle;
+    cpus[cpu].current = idle;
+    return idle;
+}
+
 // Create a new process
 process_t* process_create(const char* name, void* entry_point, process_priority_t priority) {
-    // Find free slot in process table
-    int slot = -1;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (!process_table_used[i]) {
-            slot = i;
-            break;
-        }
-    }
-    
-    if (slot == -1) {
+    // Take a free slot in process table
+    uint32_t flags = spin_lock_irqsave(&proc_lock);
+    if (free_slot_count == 0) {
+        spin_unlock_irqrestore(&proc_lock, flags);
         return NULL; // No free slots
     }
     
+    uint32_t slot = free_slots[--free_slot_count];
     process_t* process = &process_table[slot];
     process_table_used[slot] = true;
     
@@ -87,13 +179,18 @@ process_t* process_create(const char* name, void* entry_point, process_priority_
     
     // Basic process information
     process->pid = process_get_next_pid();
+    pid_hash_insert(process);
+    spin_unlock_irqrestore(&proc_lock, flags);
+    
     process->ppid = current_process ? current_process->pid : 0;
     strncpy(process->name, name, sizeof(process->name) - 1);
     process->name[sizeof(process->name) - 1] = '\0';
     
     // Process state
     process->state = PROCESS_NEW;
-    process->priority = priority;
+    process->priority = ((uint32_t)priority < NUM_PRIORITY_LEVELS) ? priority : PRIORITY_IDLE;
+    process->base_priority = process->priority;
+    process->inherited_priority = NUM_PRIORITY_LEVELS;
     process->policy = SCHED_RR; // Default to round-robin
     
     // Timing information
@@ -103,18 +200,17 @@ process_t* process_create(const char* name, void* entry_point, process_priority_
     process->time_slice = DEFAULT_TIME_SLICE;
     process->remaining_slice = DEFAULT_TIME_SLICE;
     
-    // Memory setup
+    // Memory setup: each slot owns its kernel stack
     process->stack_size = DEFAULT_STACK_SIZE;
-    process->stack_base = (uint32_t)kmalloc(process->stack_size);
-    if (!process->stack_base) {
-        process_table_used[slot] = false;
-        return NULL;
-    }
+    process->stack_base = (uint32_t)stack_slab[slot];
     
-    // Initialize CPU context
+    // Initialize CPU context: the first switch lands in the trampoline,
+    // which pops the entry point off the new stack
+    uint32_t* stack_top = (uint32_t*)(process->stack_base + process->stack_size);
+    *--stack_top = (uint32_t)entry_point;
     memset(&process->context, 0, sizeof(cpu_context_t));
-    process->context.eip = (uint32_t)entry_point;
-    process->context.esp = process->stack_base + process->stack_size - 4;
+    process->context.eip = (uint32_t)process_entry_trampoline;
+    process->context.esp = (uint32_t)stack_top;
     process->context.ebp = process->context.esp;
     process->context.eflags = 0x202; // Enable interrupts
     
@@ -126,12 +222,14 @@ process_t* process_create(const char* name, void* entry_point, process_priority_
     process->context.gs = 0x10;
     process->context.ss = 0x10;
     
-    // Initialize file descriptor table
-    for (int i = 0; i < 32; i++) {
-        process->fd_table[i] = -1; // Closed
-    }
+    // Start on the creating CPU, free to move
+    process->cpu = this_cpu()->id;
+    process->pinned_cpu = -1;
+    process->fpu_cpu = -1;
+    timer_setup(&process->timer, process_timer_expired, process);
     
     // Set up process relationships
+    flags = spin_lock_irqsave(&proc_lock);
     if (current_process) {
         process->parent = current_process;
         // Add to parent's children list
@@ -145,7 +243,9 @@ process_t* process_create(const char* name, void* entry_point, process_priority_
     // Update statistics
     proc_stats.total_processes++;
     proc_stats.active_processes++;
+    spin_unlock_irqrestore(&proc_lock, flags);
     
+    vdso_map(process);
     return process;
 }
 
@@ -175,45 +275,131 @@ int process_destroy(process_t* process) {
     }
     
     // Free memory resources
-    if (process->stack_base) {
+    pi_process_exit(process);
+    futex_cancel(process);
+    uring_release(process);
+    nicmap_release(process);
+    fpu_release(process);
+    ipc_shm_exit(process);
+    process_fd_exit(process);
+    if (process->stack_base && !stack_in_slab(process->stack_base)) {
         kfree((void*)process->stack_base);
     }
+    if (process->page_directory) {
+        destroy_page_directory((page_directory_t*)process->page_directory);
+        process->page_directory = NULL;
+    }
     
-    // Remove from scheduler queues
+    // Remove from scheduler queues, releasing any deadline reservation
+    scheduler_clear_deadline(process);
     scheduler_remove_process(process);
+    timer_cancel(&process->timer);
+    uint32_t flags = spin_lock_irqsave(&proc_lock);
     
-    // Mark process table slot as free
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (&process_table[i] == process) {
-            process_table_used[i] = false;
-            break;
-        }
+    // Return the slot and its stack
+    uint32_t slot = (uint32_t)(process - process_table);
+    if (process_table_used[slot]) {
+        process_table_used[slot] = false;
+        free_slots[free_slot_count++] = (uint16_t)slot;
+        pid_hash_remove(process);
     }
     
     // Update statistics
     proc_stats.active_processes--;
+    spin_unlock_irqrestore(&proc_lock, flags);
     
     return 0;
 }
 
 // Find process by PID
 process_t* process_find_by_pid(uint32_t pid) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table_used[i] && process_table[i].pid == pid) {
-            return &process_table[i];
+    uint32_t flags = spin_lock_irqsave(&proc_lock);
+    process_t* process = pid_hash_lookup(pid);
+    spin_unlock_irqrestore(&proc_lock, flags);
+    return process;
+}
+
+// Get next available PID (proc_lock held). PIDs are not recycled until
+// the 32-bit counter wraps, and then only ones no live process holds.
+uint32_t process_get_next_pid(void) {
+    uint32_t pid;
+    do {
+        pid = next_pid++;
+        if (next_pid == 0) {
+            next_pid = 1; // Don't reuse PID 0 (idle)
         }
+    } while (pid_hash_lookup(pid));
+    return pid;
+}
+
+// Fork: the child resumes from the parent's saved context with eax = 0 and
+// gets a copy-on-write clone of its address space, so the cost is the page
+// tables, not the memory mapped. Like process_create, the child is linked
+// under the calling process. Returns the child's PID, -1 on failure.
+int process_fork(process_t* parent) {
+    if (!parent) return -1;
+    
+    // MCL_FUTURE: mappings added since mlockall must not turn copy-on-write
+    if ((parent->mlock_flags & MCL_FUTURE) && parent->page_directory &&
+        lock_all_pages((page_directory_t*)parent->page_directory, true) != 0) {
+        return -1;
     }
-    return NULL;
+    
+    page_directory_t* dir = NULL;
+    if (parent->page_directory) {
+        dir = clone_page_directory((page_directory_t*)parent->page_directory);
+        if (!dir) return -1;
+    }
+    
+    process_t* child = process_create(parent->name, NULL, parent->priority);
+    if (!child) {
+        destroy_page_directory(dir);
+        return -1;
+    }
+    
+    // Copy parent's context; parent gets the child PID, child gets 0
+    memcpy(&child->context, &parent->context, sizeof(cpu_context_t));
+    child->context.eax = 0;
+    parent->context.eax = child->pid;
+    if (dir) {
+        child->page_directory = (uint32_t*)dir;
+        child->context.cr3 = (uint32_t)dir;
+    }
+    
+    child->policy = parent->policy;
+    ipc_shm_fork(parent, child);
+    process_fd_fork(parent, child);
+    return (int)child->pid;
 }
 
-// Get next available PID
-uint32_t process_get_next_pid(void) {
-    uint32_t pid = next_pid;
-    next_pid++;
-    if (next_pid >= MAX_PROCESSES) {
-        next_pid = 1; // Don't reuse PID 0 (idle)
+int process_mlock(process_t* process, uint32_t addr, uint32_t size) {
+    if (!process || size == 0) return -1;
+    if (!process->page_directory) return 0;
+    return populate_region((page_directory_t*)process->page_directory, addr, size,
+                           PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER | PAGE_LOCKED);
+}
+
+int process_munlock(process_t* process, uint32_t addr, uint32_t size) {
+    if (!process || size == 0) return -1;
+    if (!process->page_directory) return 0;
+    return unlock_region((page_directory_t*)process->page_directory, addr, size);
+}
+
+int process_mlockall(process_t* process, uint32_t flags) {
+    if (!process || !(flags & (MCL_CURRENT | MCL_FUTURE))) return -1;
+    if ((flags & MCL_CURRENT) && process->page_directory &&
+        lock_all_pages((page_directory_t*)process->page_directory, true) != 0) {
+        return -1;
     }
-    return pid;
+    process->mlock_flags = flags;
+    return 0;
+}
+
+int process_munlockall(process_t* process) {
+    if (!process) return -1;
+    process->mlock_flags = 0;
+    if (!process->page_directory) return 0;
+    return lock_all_pages((page_directory_t*)process->page_directory, false);
 }
 
 // Process exit
@@ -221,6 +407,11 @@ void process_exit(process_t* process, int32_t exit_code) {
     if (!process) return;
     
     process->exit_code = exit_code;
+    pi_process_exit(process);
+    futex_cancel(process);
+    uring_release(process);
+    nicmap_release(process);
+    scheduler_clear_deadline(process);
     process_set_state(process, PROCESS_TERMINATED);
     
     // If this is the current process, schedule next one
@@ -229,6 +420,11 @@ void process_exit(process_t* process, int32_t exit_code) {
     }
 }
 
+// A process returned from its entry point
+void process_thread_exit(int32_t exit_code) {
+    process_exit(current_process, exit_code);
+}
+
 // Kill a process by PID
 int process_kill(uint32_t pid, int32_t signal) {
     process_t* process = process_find_by_pid(pid);
@@ -242,18 +438,25 @@ int process_kill(uint32_t pid, int32_t signal) {
 
 // Set process state
 void process_set_state(process_t* process, process_state_t new_state) {
-    if (!process || process->state == new_state) return;
+    if (!process) return;
+    
+    uint32_t flags = spin_lock_irqsave(&proc_lock);
+    if (process->state == new_state) {
+        spin_unlock_irqrestore(&proc_lock, flags);
+        return;
+    }
     
     process_state_t old_state = process->state;
     process->state = new_state;
     
-    // Update statistics
+    // Update statistics and unlink from the queue of the old state
     switch (old_state) {
         case PROCESS_RUNNING:
             proc_stats.running_processes--;
             break;
         case PROCESS_BLOCKED:
             proc_stats.blocked_processes--;
+            queue_remove(&blocked_queue, process);
             break;
         default:
             break;
@@ -265,9 +468,7 @@ void process_set_state(process_t* process, process_state_t new_state) {
             break;
         case PROCESS_BLOCKED:
             proc_stats.blocked_processes++;
-            break;
-        case PROCESS_READY:
-            scheduler_add_process(process);
+            queue_add_tail(&blocked_queue, process);
             break;
         case PROCESS_TERMINATED:
             queue_add_tail(&terminated_queue, process);
@@ -275,15 +476,26 @@ void process_set_state(process_t* process, process_state_t new_state) {
         default:
             break;
     }
+    spin_unlock_irqrestore(&proc_lock, flags);
+    
+    // Ready queues are per CPU and locked separately
+    if (old_state == PROCESS_READY) {
+        scheduler_remove_process(process);
+    }
+    if (new_state == PROCESS_READY) {
+        if (old_state == PROCESS_BLOCKED || old_state == PROCESS_SLEEPING) {
+            sched_trace_wakeup(process, old_state);
+        }
+        scheduler_add_process(process);
+    }
 }
 
 // Block a process
 void process_block(process_t* process) {
     if (!process) return;
     
-    scheduler_remove_process(process);
+    // Leaving PROCESS_READY drops it from its ready queue
     process_set_state(process, PROCESS_BLOCKED);
-    queue_add_tail(&blocked_queue, process);
     
     if (process == current_process) {
         scheduler_yield();
@@ -294,23 +506,68 @@ void process_block(process_t* process) {
 void process_unblock(process_t* process) {
     if (!process || process->state != PROCESS_BLOCKED) return;
     
-    queue_remove(&blocked_queue, process);
     process_set_state(process, PROCESS_READY);
 }
 
 // Sleep process for specified milliseconds
 void process_sleep(process_t* process, uint32_t ms) {
-    (void)ms;  // Suppress unused parameter warning - TODO: implement timer-based sleep
-    if (!process) return;
+    if (!process || process->state == PROCESS_SLEEPING) return;
+    
+    process->wake_time = get_current_time_ms() + ms;
+    process_set_state(process, PROCESS_SLEEPING);
+    
+    // The timer wheel reprograms the boot CPU's tick if this comes first
+    timer_arm(&process->timer, process->wake_time);
     
-    // For now, just block the process
-    // In a full implementation, we'd set a timer
-    process_block(process);
+    if (process == current_process) {
+        scheduler_yield();
+    }
 }
 
-// Set process priority
+// Sleep and timed-block timer: wake the process if it is still waiting
+static void process_timer_expired(void* data) {
+    process_t* process = (process_t*)data;
+    if (process->state == PROCESS_SLEEPING || process->state == PROCESS_BLOCKED) {
+        process_set_state(process, PROCESS_READY);
+    }
+}
+
+// Block until unblocked or 'ms' have passed. Returns true if something
+// else woke the process before the timeout. A caller that must not miss a
+// wakeup marks itself PROCESS_BLOCKED first, checks its condition, and
+// then calls this; if it was unblocked in between it only yields.
+bool process_block_timeout(process_t* process, uint32_t ms) {
+    if (!process) return false;
+    
+    if (process->state == PROCESS_RUNNING) {
+        process_set_state(process, PROCESS_BLOCKED);
+    }
+    bool armed = process->state == PROCESS_BLOCKED;
+    if (armed) {
+        timer_arm(&process->timer, get_current_time_ms() + ms);
+    }
+    
+    if (process == current_process) {
+        scheduler_yield();
+    }
+    return armed ? timer_cancel(&process->timer) : true;
+}
+
+// Set process priority (a lock waiter may still lend it a better one)
 void process_set_priority(process_t* process, process_priority_t priority) {
-    if (!process) return;
+    if (!process || (uint32_t)priority >= NUM_PRIORITY_LEVELS) return;
+    
+    process->base_priority = priority;
+    pi_priority_changed(process);
+}
+
+// Run at the better of the base and the inherited priority
+void process_update_priority(process_t* process) {
+    process_priority_t priority = process->base_priority;
+    if (process->inherited_priority < (uint32_t)priority) {
+        priority = (process_priority_t)process->inherited_priority;
+    }
+    if (priority == process->priority) return;
     
     // Remove from current queue
     if (process->state == PROCESS_READY) {
@@ -318,6 +575,9 @@ void process_set_priority(process_t* process, process_priority_t priority) {
     }
     
     process->priority = priority;
+    if (process->state == PROCESS_RUNNING) {
+        vdso_set_current(process->cpu, process);
+    }
     
     // Add back to appropriate queue
     if (process->state == PROCESS_READY) {
@@ -328,7 +588,7 @@ void process_set_priority(process_t* process, process_priority_t priority) {
 void process_show_all_processes(void) {
     for (int i = 0; i < MAX_PROCESSES; i++) {
         if (process_table[i].state != PROCESS_NEW) {
-            // Format: PID  PPID PRIO STATE    CPU%  MEMORY  NAME
+            // Format: PID  PPID PRIO STATE    CPU%  MEMORY  FAULTS NAME
             print_number(process_table[i].pid);
             vga_write_string("   ");
             print_number(process_table[i].ppid);
@@ -350,6 +610,8 @@ void process_show_all_processes(void) {
             vga_write_string("   ");
             print_number(process_table[i].memory_used);
             vga_write_string("  ");
+            print_number(process_table[i].page_faults);
+            vga_write_string(process_table[i].mlock_flags ? " L " : "   "); // L = mlockall
             vga_write_string(process_table[i].name);
             vga_write_string("\n");
         }
@@ -358,21 +620,22 @@ void process_show_all_processes(void) {
 
 // Get current system time in milliseconds
 uint32_t get_current_time_ms(void) {
-    return system_time_ms;
+    // In tickless mode time accrues between interrupts; fold it in first
+    tick_sync();
+    return tick_get_time_ms();
 }
 
-// Update system time (called from timer interrupt)
-void system_tick(void) {
-    system_time_ms += (1000 / SCHEDULER_FREQUENCY); // Assuming 100Hz timer
-    scheduler_ticks++;
+// Per-tick housekeeping (called from the tick code with the elapsed tick count)
+void system_tick(uint32_t ticks) {
+    scheduler_ticks += ticks;
     
     // Update load average calculation
-    load_calculation_timer++;
+    load_calculation_timer += ticks;
     if (load_calculation_timer >= SCHEDULER_FREQUENCY) { // Every second
-        load_calculation_timer = 0;
+        load_calculation_timer %= SCHEDULER_FREQUENCY;
         // Simple load average calculation
-        proc_stats.load_average = (proc_stats.running_processes + ready_queues[PRIORITY_REALTIME].count + 
-                                   ready_queues[PRIORITY_HIGH].count) * 100;
+        proc_stats.load_average = (proc_stats.running_processes +
+                                   scheduler_count_ready(PRIORITY_REALTIME, PRIORITY_NORMAL - 1)) * 100;
     }
 }
 
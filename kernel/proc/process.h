@@ -2,6 +2,12 @@
 #define PROCESS_H
 
 #include "../types.h"
+#include "../arch/smp.h"
+#include "../arch/spinlock.h"
+#include "../arch/pmu.h"
+#include "wsdeque.h"
+#include "timer.h"
+#include "syscalls.h"
 
 // Process states
 typedef enum {
@@ -15,19 +21,25 @@ typedef enum {
 } process_state_t;
 
 // Process priorities (lower number = higher priority)
+// The named priorities are anchors inside NUM_PRIORITY_LEVELS fine-grained
+// levels; any value in between is valid (e.g. PRIORITY_REALTIME + 3).
 typedef enum {
     PRIORITY_REALTIME = 0,  // Critical trading algorithms
-    PRIORITY_HIGH = 1,      // Important trading processes
-    PRIORITY_NORMAL = 2,    // Standard processes
-    PRIORITY_LOW = 3,       // Background tasks
-    PRIORITY_IDLE = 4       // Idle processes
+    PRIORITY_HIGH = 16,     // Important trading processes
+    PRIORITY_NORMAL = 32,   // Standard processes
+    PRIORITY_LOW = 48,      // Background tasks
+    PRIORITY_IDLE = 63      // Idle processes
 } process_priority_t;
 
+#define NUM_PRIORITY_LEVELS     64
+#define PRIORITY_BITMAP_WORDS   (NUM_PRIORITY_LEVELS / 32)
+
 // Process scheduling policies
 typedef enum {
     SCHED_FIFO = 0,         // First-In-First-Out (real-time)
     SCHED_RR,               // Round-Robin (time-sliced)
-    SCHED_NORMAL            // Standard priority-based
+    SCHED_NORMAL,           // Standard priority-based
+    SCHED_DEADLINE          // Earliest deadline first with a CBS budget
 } sched_policy_t;
 
 // CPU context structure for context switching
@@ -41,6 +53,16 @@ typedef struct cpu_context {
     uint32_t cr3;                   // Page directory (if paging enabled)
 } __attribute__((packed)) cpu_context_t;
 
+// Shared memory attached by a process (see ipc_shmat)
+#define MAX_SHM_ATTACH          8
+
+struct shm_segment;
+
+typedef struct {
+    struct shm_segment* segment;    // NULL = slot free
+    uint32_t addr;                  // Where it is mapped in this process
+} shm_attachment_t;
+
 // Process Control Block (PCB)
 typedef struct process {
     uint32_t pid;                   // Process ID
@@ -69,11 +91,10 @@ typedef struct process {
     uint32_t remaining_slice;       // Remaining time in current slice
     
     // File descriptors and I/O
-    int32_t fd_table[32];           // File descriptor table
+    proc_file_descriptor_t files[PROC_MAX_FILES];   // Zeroed = all closed
     
     // IPC resources
-    uint32_t* shared_memory[8];     // Shared memory segments
-    int32_t pipes[16];              // Pipe file descriptors
+    shm_attachment_t shm[MAX_SHM_ATTACH];   // Attached shared memory segments
     
     // Process relationships
     struct process* parent;         // Parent process
@@ -91,8 +112,62 @@ typedef struct process {
     // Statistics for trading analysis
     uint32_t context_switches;     // Number of context switches
     uint32_t page_faults;          // Number of page faults
+    uint32_t mlock_faults;         // Page faults while mlockall was in force
+    uint32_t mlock_flags;          // MCL_* from process_mlockall
     uint32_t syscalls;             // Number of system calls
     uint32_t io_operations;        // Number of I/O operations
+    uint64_t pmu_counts[PMU_EVENTS];    // Hardware counters over its slices (arch/pmu.h)
+    
+    // Scheduler bookkeeping
+    bool on_runqueue;               // Linked into ready_queues[priority]
+    uint32_t wake_time;             // Wakeup time (ms) while PROCESS_SLEEPING
+    
+    // SMP placement
+    uint32_t cpu;                   // CPU it last ran on / is queued on
+    int32_t pinned_cpu;             // CPU it must run on, or -1 for any
+    volatile bool on_cpu;           // Still executing (until its switch-out completes)
+    bool migrate_pending;           // Requeue once the switch-out completes
+    uint32_t steal_gen;             // Bumped per enqueue, stale steal entries mismatch
+    
+    // SCHED_DEADLINE reservation (ns) and constant bandwidth server state
+    uint32_t dl_runtime;            // Budget per period
+    uint32_t dl_deadline;           // Relative deadline
+    uint32_t dl_period;             // Release period
+    uint32_t dl_bw;                 // Reserved bandwidth, DL_BW_UNIT = one CPU
+    uint64_t dl_abs_deadline;       // Scheduling deadline (EDF key)
+    uint64_t dl_job_deadline;       // Deadline of the job in progress
+    uint64_t dl_since;              // Last budget charge while running, 0 = off CPU
+    int64_t dl_budget;              // Budget left in the current period
+    bool dl_throttled;              // Budget spent: waits for the next period
+    sched_policy_t dl_prev_policy;  // Policy restored when the reservation ends
+    uint32_t dl_jobs;               // Jobs completed (yield or block)
+    uint32_t dl_misses;             // Jobs completed after their deadline
+    uint32_t dl_overruns;           // Periods whose budget ran out
+    
+    // Lazily switched x87/SSE state (see arch/fpu.h)
+    void* fpu_state;                // Save area, allocated on first FP use
+    volatile int32_t fpu_cpu;       // CPU whose registers hold it, or -1
+    
+    struct process* pid_hash_next;  // PID hash bucket chain
+    ktimer_t timer;                 // Sleep / timed block wakeup
+    
+    // Latency tracing stamps (raw TSC, 0 = none), see sched_trace.h
+    uint64_t trace_wakeup_tsc;      // Left BLOCKED/SLEEPING
+    uint64_t trace_enqueue_tsc;     // Joined a ready queue
+    
+    // Priority inheritance (see mutex.h); 'priority' is the effective one
+    process_priority_t base_priority;   // Set by process_set_priority
+    uint32_t inherited_priority;    // Best waiter priority, NUM_PRIORITY_LEVELS = none
+    struct pi_object* pi_blocked_on;    // Object it waits on
+    struct pi_object* pi_held;      // Objects it owns
+    struct process* pi_wait_next;   // Waiter list link
+    
+    // Futex wait queue membership (see futex.h)
+    volatile uint32_t* volatile futex_key;  // Word waited on, NULL = not queued
+    struct process* futex_next;     // Hash bucket chain
+    
+    struct uring* uring;            // Batched system call rings (see uring.h)
+    struct coro_sched* coro_sched;  // Coroutines it is running (see coro.h)
 } process_t;
 
 // Process statistics
@@ -113,6 +188,47 @@ typedef struct scheduler_queue {
     uint32_t count;                 // Number of processes in queue
 } scheduler_queue_t;
 
+// Per-CPU scheduler state, one cache line aligned block per processor.
+// 'self' must stay the first member: this_cpu() reads it through GS.
+typedef struct cpu {
+    struct cpu* self;
+    uint32_t id;                    // Logical CPU number (BOOT_CPU = 0)
+    uint32_t apic_id;               // Local APIC ID
+    volatile bool online;
+    volatile bool isolated;         // Only pinned tasks, no tick or balancing
+    volatile bool need_resched;     // Reschedule at the next scheduler check
+    process_t* current;             // Process running on this CPU
+    process_t* idle;                // This CPU's idle process
+    
+    spinlock_t rq_lock;             // Protects the ready queues and bitmap
+    scheduler_queue_t ready_queues[NUM_PRIORITY_LEVELS];
+    uint32_t ready_bitmap[PRIORITY_BITMAP_WORDS]; // Bit set = queue non-empty
+    uint32_t nr_ready;              // Processes on this CPU's ready queues
+    scheduler_queue_t dl_queue;     // SCHED_DEADLINE processes by deadline
+    uint32_t dl_bw;                 // Admitted deadline bandwidth
+    wsdeque_t steal_queue;          // Stealable ready processes, see STEAL_ENTRY
+    
+    uint32_t context_switches;      // Switches performed on this CPU
+    uint32_t resched_ipis;          // Reschedule IPIs received
+    uint32_t steals;                // Processes taken from other CPUs
+    uint32_t steal_attempts;        // Times this CPU went looking for work
+    
+    process_t* fpu_owner;           // Process whose state is in the FP registers
+    volatile bool fpu_flush;        // Another CPU asked for that state back
+} __cacheline_aligned cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+
+static inline cpu_t* this_cpu(void) {
+    cpu_t* cpu;
+    __asm__ volatile ("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+// The running and idle process are per CPU
+#define current_process         (this_cpu()->current)
+#define idle_process            (this_cpu()->idle)
+
 // System call numbers defined in syscalls.h
 
 // Constants
@@ -121,8 +237,18 @@ typedef struct scheduler_queue {
 #define DEFAULT_TIME_SLICE      10              // 10ms time slice
 #define SCHEDULER_FREQUENCY     100             // 100Hz scheduler
 #define IDLE_PROCESS_PID        0
+#define PID_HASH_SIZE           512             // Buckets, power of two
 #define INIT_PROCESS_PID        1
 
+// Work stealing: an idle CPU may take a queued process from a busy one if
+// it is unpinned, not SCHED_FIFO/DEADLINE and no more important than this. A steal
+// queue entry is a process table slot plus the low bits of its steal_gen.
+#define STEAL_MIN_PRIORITY      PRIORITY_NORMAL
+#define STEAL_ENTRY(slot, gen)  (((uint32_t)(slot) << 16) | ((gen) & 0xFFFF))
+#define STEAL_ENTRY_SLOT(e)     ((e) >> 16)
+#define STEAL_ENTRY_GEN(e)      ((e) & 0xFFFF)
+#define STEAL_RETRIES           4       // CAS races tolerated per victim
+
 // Function prototypes
 
 // Process management core
@@ -132,10 +258,25 @@ int process_destroy(process_t* process);
 process_t* process_find_by_pid(uint32_t pid);
 uint32_t process_get_next_pid(void);
 
+// Memory locking (process_mlockall flags)
+#define MCL_CURRENT     0x1     // Populate and lock everything mapped now
+#define MCL_FUTURE      0x2     // Lock what is mapped later, before each fork
+
 // Process lifecycle
 int process_fork(process_t* parent);
 int process_exec(process_t* process, void* entry_point);
 void process_exit(process_t* process, int32_t exit_code);
+
+// Pre-fault and pin memory so a realtime process takes no page faults once
+// it is running: mlock populates the range (zeroed pages where nothing is
+// mapped) and breaks copy-on-write sharing up front; locked pages stay
+// private across fork. Any fault taken after mlockall counts in
+// mlock_faults. Without an address space of its own a process only ever
+// runs on the identity map, which cannot fault, so these succeed trivially.
+int process_mlock(process_t* process, uint32_t addr, uint32_t size);
+int process_munlock(process_t* process, uint32_t addr, uint32_t size);
+int process_mlockall(process_t* process, uint32_t flags);
+int process_munlockall(process_t* process);
 int process_wait(process_t* parent, uint32_t child_pid, int32_t* exit_code);
 int process_kill(uint32_t pid, int32_t signal);
 
@@ -147,9 +288,19 @@ void scheduler_add_process(process_t* process);
 void scheduler_remove_process(process_t* process);
 void scheduler_yield(void);             // Voluntary yield
 void scheduler_preempt(void);           // Forced preemption
+uint32_t scheduler_count_ready(int first_priority, int last_priority);
+void scheduler_account_ticks(uint32_t ticks);   // Charge elapsed ticks to current
+uint32_t scheduler_next_event_us(uint32_t pending_us); // Time until a slice decision is due
+void scheduler_init_cpu(cpu_t* cpu);
+void scheduler_finish_switch(process_t* prev);  // Runs on the new stack after a switch
+int scheduler_set_affinity(process_t* process, int32_t cpu); // -1 unpins
+void scheduler_evict_unpinned(cpu_t* cpu);      // Move unpinned work off a CPU
+int scheduler_set_deadline(process_t* process, uint32_t runtime_us,
+                           uint32_t deadline_us, uint32_t period_us);
+int scheduler_clear_deadline(process_t* process);
 
-// Context switching
-void context_switch(process_t* old_process, process_t* new_process);
+// Context switching (returns the process switched away from)
+process_t* context_switch(process_t* old_process, process_t* new_process);
 void save_context(process_t* process);
 void restore_context(process_t* process);
 
@@ -168,9 +319,11 @@ void process_set_state(process_t* process, process_state_t new_state);
 void process_block(process_t* process);
 void process_unblock(process_t* process);
 void process_sleep(process_t* process, uint32_t ms);
+bool process_block_timeout(process_t* process, uint32_t ms);  // True if woken early
 
 // Priority and scheduling
 void process_set_priority(process_t* process, process_priority_t priority);
+void process_update_priority(process_t* process);   // Re-apply base and inherited priority
 void process_show_all_processes(void);
 
 void process_boost_priority(process_t* process);    // Temporary priority boost
@@ -182,21 +335,40 @@ void print_process_list(void);
 void print_scheduler_info(void);
 uint32_t get_system_load(void);
 
+// File descriptors (syscalls.c): install returns the lowest free number
+// or -1. Fork shares pipe ends with the child; sockets and files stay the
+// parent's. Exit closes everything.
+int process_fd_install(process_t* process, fd_type_t type, void* data);
+int process_fd_close(process_t* process, int fd);
+void process_fd_fork(process_t* parent, process_t* child);
+void process_fd_exit(process_t* process);
+
 // Inter-process communication
-int ipc_create_pipe(int32_t* read_fd, int32_t* write_fd);
+
+// Shared memory (System V style). Attaching maps the segment's frames
+// PAGE_SHARED into the process's directory in [SHM_VIRTUAL_BASE,
+// SHM_VIRTUAL_END), with 4MB pages for 4MB segments; without a directory
+// the address is the identity one. Attachments are inherited by fork and
+// dropped at exit. The key-based calls are for kernel users.
+int ipc_shmget(uint32_t key, uint32_t size, uint32_t flags);   // Id, or -1
+void* ipc_shmat(process_t* process, int shmid, uint32_t flags);
+int ipc_shmdt(process_t* process, void* addr);
+int ipc_shmctl(int shmid, uint32_t cmd);               // IPC_RMID only
+void ipc_shm_fork(process_t* parent, process_t* child);
+void ipc_shm_exit(process_t* process);
 void* ipc_create_shared_memory(uint32_t size, uint32_t key);
 int ipc_destroy_shared_memory(uint32_t key);
 void* ipc_attach_shared_memory(process_t* process, uint32_t key);
 
 // Utility functions
 uint32_t get_current_time_ms(void);
+void system_tick(uint32_t ticks);       // Housekeeping for elapsed ticks
 void process_dump_info(process_t* process);
+process_t* process_create_idle(uint32_t cpu);
+void process_thread_exit(int32_t exit_code);    // Entry point returned
 
 // Global variables
-extern process_t* current_process;      // Currently running process
-extern process_t* idle_process;         // Idle process
 extern process_stats_t proc_stats;      // Global process statistics
-extern scheduler_queue_t ready_queues[5]; // Ready queues for each priority
 extern bool scheduler_enabled;          // Scheduler enable flag
 
 #endif // PROCESS_H
\ No newline at end of file
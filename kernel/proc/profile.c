@@ -0,0 +1,195 @@
+#include "profile.h"
+#include "process.h"
+#include "../arch/cpu.h"
+#include "../arch/smp.h"
+#include "../mm/memory.h"
+#include "../drivers/vga.h"
+
+// Bounds of the generated table and of kernel text (kernel.ld)
+extern const ksym_t __ksyms_start[];
+extern const ksym_t __ksyms_end[];
+extern const char _text_end[];
+
+typedef struct {
+    volatile uint32_t count;        // Samples written; entries below are complete
+    uint32_t dropped;
+    profile_sample_t samples[PROFILE_SAMPLES];
+} __cacheline_aligned profile_cpu_t;
+
+static profile_cpu_t profile_cpus[MAX_CPUS];
+static volatile uint32_t profiling = 0;
+
+void profile_start(void) {
+    store_release(&profiling, 0);
+    for (uint32_t c = 0; c < MAX_CPUS; c++) {
+        profile_cpus[c].count = 0;
+        profile_cpus[c].dropped = 0;
+    }
+    store_release(&profiling, 1);
+}
+
+void profile_stop(void) {
+    store_release(&profiling, 0);
+}
+
+bool profile_running(void) {
+    return load_acquire(&profiling) != 0;
+}
+
+void profile_sample(uint32_t eip) {
+    if (!profiling) return;
+
+    profile_cpu_t* pc = &profile_cpus[this_cpu()->id];
+    if (pc->count >= PROFILE_SAMPLES) {
+        pc->dropped++;
+        return;
+    }
+    profile_sample_t* sample = &pc->samples[pc->count];
+    sample->eip = eip;
+    sample->pid = current_process ? current_process->pid : 0;
+    compiler_barrier();
+    pc->count++;
+}
+
+uint32_t ksym_count(void) {
+    return (uint32_t)(__ksyms_end - __ksyms_start);
+}
+
+// Last symbol at or below 'addr', by binary search over the sorted table
+static int ksym_index(uint32_t addr) {
+    uint32_t count = ksym_count();
+    if (count == 0 || addr < __ksyms_start[0].addr || addr >= (uint32_t)_text_end) return -1;
+
+    uint32_t lo = 0, hi = count;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (__ksyms_start[mid].addr <= addr) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return (int)lo;
+}
+
+const char* ksym_lookup(uint32_t addr, uint32_t* start) {
+    int i = ksym_index(addr);
+    if (i < 0) return NULL;
+    if (start) *start = __ksyms_start[i].addr;
+    return __ksyms_start[i].name;
+}
+
+// A share of the samples, as a whole percentage
+static void print_share(uint32_t count, uint32_t total) {
+    uint32_t percent = (count * 100 + total / 2) / total;
+    vga_write_string(" ");
+    if (percent < 10) vga_write_string(" ");
+    if (percent < 100) vga_write_string(" ");
+    print_dec(percent);
+    vga_write_string("%  ");
+}
+
+// Right-aligned in 7 columns
+static void print_count(uint32_t count) {
+    uint32_t digits = 1;
+    for (uint32_t v = count; v >= 10; v /= 10) digits++;
+    while (digits++ < 7) vga_write_string(" ");
+    print_dec(count);
+    vga_write_string("  ");
+}
+
+#define PROFILE_PIDS 8
+
+void profile_print_report(uint32_t top) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Profile ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    uint32_t symbols = ksym_count();
+    if (symbols == 0) {
+        vga_write_string("No symbol table in this kernel\n");
+    }
+
+    uint32_t* counts = symbols ? (uint32_t*)kmalloc(symbols * sizeof(uint32_t)) : NULL;
+    if (counts) memset(counts, 0, symbols * sizeof(uint32_t));
+
+    uint32_t total = 0, dropped = 0, outside = 0;
+    uint32_t pids[PROFILE_PIDS], pid_counts[PROFILE_PIDS], pid_slots = 0, pid_other = 0;
+    for (uint32_t c = 0; c < MAX_CPUS; c++) {
+        profile_cpu_t* pc = &profile_cpus[c];
+        uint32_t count = load_acquire(&pc->count);
+        total += count;
+        dropped += pc->dropped;
+
+        for (uint32_t i = 0; i < count; i++) {
+            const profile_sample_t* sample = &pc->samples[i];
+            int sym = ksym_index(sample->eip);
+            if (sym < 0) {
+                outside++;
+            } else if (counts) {
+                counts[sym]++;
+            }
+
+            uint32_t p = 0;
+            while (p < pid_slots && pids[p] != sample->pid) p++;
+            if (p == pid_slots && pid_slots < PROFILE_PIDS) {
+                pids[pid_slots] = sample->pid;
+                pid_counts[pid_slots++] = 0;
+            }
+            if (p < pid_slots) {
+                pid_counts[p]++;
+            } else {
+                pid_other++;
+            }
+        }
+    }
+
+    vga_write_string(profile_running() ? "Running, " : "Stopped, ");
+    print_dec(total);
+    vga_write_string(" samples");
+    if (dropped) {
+        vga_write_string(", ");
+        print_dec(dropped);
+        vga_write_string(" dropped (buffers full)");
+    }
+    vga_write_string("\n");
+    if (total == 0) {
+        vga_write_string("Nothing sampled yet (profile start)\n");
+        kfree(counts);
+        return;
+    }
+
+    vga_write_string("SAMPLES  SHARE  FUNCTION\n");
+    for (uint32_t shown = 0; counts && shown < top; shown++) {
+        uint32_t best = 0;
+        for (uint32_t i = 1; i < symbols; i++) {
+            if (counts[i] > counts[best]) best = i;
+        }
+        if (counts[best] == 0) break;
+
+        print_count(counts[best]);
+        print_share(counts[best], total);
+        vga_write_string(__ksyms_start[best].name);
+        vga_write_string("\n");
+        counts[best] = 0;
+    }
+    if (outside) {
+        print_count(outside);
+        print_share(outside, total);
+        vga_write_string("(outside kernel text)\n");
+    }
+
+    vga_write_string("By process:");
+    for (uint32_t p = 0; p < pid_slots; p++) {
+        vga_write_string(" pid ");
+        print_dec(pids[p]);
+        vga_write_string(" ");
+        print_dec(pid_counts[p]);
+    }
+    if (pid_other) {
+        vga_write_string(", others ");
+        print_dec(pid_other);
+    }
+    vga_write_string("\n");
+    kfree(counts);
+}
@@ -0,0 +1,43 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "../types.h"
+
+// Sampling profiler. While it runs, every timer interrupt (PIT or local
+// APIC, SCHEDULER_FREQUENCY on a periodic CPU) records the interrupted EIP
+// and the running PID into its CPU's buffer; only that CPU writes it, with
+// interrupts off, so a sample takes no lock. A full buffer stops taking
+// samples and counts the dropped ones. A nohz CPU is only sampled at the
+// ticks it does take, an isolated one hardly at all.
+//
+// The report folds samples into functions with the kernel's own symbol
+// table: the Makefile links the kernel once, turns its text symbols (nm,
+// sorted by address) into ksym_table in section .ksyms, and links again.
+// The table sits after .data, so no function moves between the two links.
+#define PROFILE_SAMPLES         2048        // Per CPU
+#define PROFILE_TOP             15          // Functions in a report by default
+
+typedef struct {
+    uint32_t eip;
+    uint32_t pid;
+} profile_sample_t;
+
+typedef struct {
+    uint32_t addr;
+    const char* name;
+} ksym_t;
+
+void profile_start(void);       // Clears the buffers
+void profile_stop(void);
+bool profile_running(void);
+
+// From the timer handlers
+void profile_sample(uint32_t eip);
+
+// The function holding 'addr' and its start, or NULL outside kernel text
+const char* ksym_lookup(uint32_t addr, uint32_t* start);
+uint32_t ksym_count(void);
+
+void profile_print_report(uint32_t top);
+
+#endif // PROFILE_H
@@ -0,0 +1,332 @@
+#include "replay.h"
+#include "process.h"
+#include "scheduler.h"
+#include "futex.h"
+#include "../fs/fs.h"
+#include "../mm/memory.h"
+#include "../arch/cpu.h"
+#include "../arch/tsc.h"
+#include "../arch/div64.h"
+#include "../drivers/vga.h"
+
+#define REPLAY_CHUNK_RECORDS    (REPLAY_CHUNK_SIZE / sizeof(replay_record_t))
+#define REPLAY_YIELD_NS         200000          // Paced waits longer than this let others run
+#define REPLAY_WAIT_MS          10
+
+#define REPLAY_BUF_EMPTY        0
+#define REPLAY_BUF_FULL         1
+
+typedef struct {
+    uint8_t* data;
+    uint32_t length;            // Bytes read; short means the file ended
+    volatile uint32_t state;
+} replay_buffer_t;
+
+// The reader task takes no argument: the one replay in progress
+static struct {
+    bool active;
+    int fd;
+    replay_buffer_t buffers[REPLAY_BUFFERS];
+    volatile uint32_t stop;
+    volatile uint32_t done;     // Reader has returned
+} replay_io;
+
+int replay_writer_open(replay_writer_t* writer, const char* path) {
+    if (!writer || !path) return FS_ERROR_INVALID;
+
+    // A fresh file, so appends start at 0 and nothing stale is left past them
+    if (fs_exists(path)) {
+        int result = fs_delete_file(path);
+        if (result != FS_SUCCESS) return result;
+    }
+    int result = fs_create_file(path, FILE_TYPE_REGULAR);
+    if (result != FS_SUCCESS) return result;
+
+    memset(writer, 0, sizeof(replay_writer_t));
+    writer->path = path;
+    writer->chunk = (replay_record_t*)kmalloc(REPLAY_CHUNK_SIZE);
+    if (!writer->chunk) return FS_ERROR_NO_MEMORY;
+    writer->fd = fs_open(path, FS_OPEN_WRITE | FS_OPEN_APPEND);
+    if (writer->fd < 0) {
+        kfree(writer->chunk);
+        writer->chunk = NULL;
+        return writer->fd;
+    }
+
+    writer->header.magic = REPLAY_MAGIC;
+    writer->header.version = REPLAY_VERSION;
+    writer->header.record_size = sizeof(replay_record_t);
+    memset(writer->chunk, 0, sizeof(replay_record_t));
+    writer->used = 1;           // Header slot, written on close
+    return FS_SUCCESS;
+}
+
+static int replay_writer_flush(replay_writer_t* writer) {
+    uint32_t bytes = writer->used * sizeof(replay_record_t);
+    writer->used = 0;
+    // Reserve the next stretch before this chunk runs past the last; if
+    // there is no room for it, the write allocates what it can
+    if (writer->written + bytes > writer->reserved) {
+        uint32_t reserve = writer->reserved + REPLAY_PREALLOC_SIZE;
+        if (fs_preallocate(writer->fd, reserve) == FS_SUCCESS) {
+            writer->reserved = reserve;
+        }
+    }
+    if (fs_write(writer->fd, writer->chunk, bytes) != (int)bytes) {
+        return FS_ERROR_NO_SPACE;
+    }
+    writer->written += bytes;
+    return FS_SUCCESS;
+}
+
+int replay_writer_add(replay_writer_t* writer, const market_data_t* record) {
+    if (!writer || !writer->chunk || !record) return FS_ERROR_INVALID;
+
+    replay_record_t* out = &writer->chunk[writer->used++];
+    out->timestamp = record->timestamp;
+    out->price = record->price;
+    out->volume = record->volume;
+    out->symbol_id = record->symbol_id;
+    out->side = record->side;
+    out->flags = record->flags;
+    out->reserved = 0;
+
+    if (writer->header.count++ == 0) {
+        writer->header.first_ns = record->timestamp;
+    }
+    writer->header.last_ns = record->timestamp;
+
+    return writer->used == REPLAY_CHUNK_RECORDS ? replay_writer_flush(writer) : FS_SUCCESS;
+}
+
+int replay_writer_close(replay_writer_t* writer) {
+    if (!writer || !writer->chunk) return FS_ERROR_INVALID;
+
+    int result = writer->used ? replay_writer_flush(writer) : FS_SUCCESS;
+    fs_preallocate(writer->fd, 0);          // Back to the size
+    if (fs_close(writer->fd) != FS_SUCCESS && result == FS_SUCCESS) {
+        result = FS_ERROR_INVALID;
+    }
+    if (result == FS_SUCCESS) {
+        // Appends cannot go back to the header slot
+        int fd = fs_open(writer->path, FS_OPEN_WRITE);
+        if (fd < 0 || fs_write(fd, &writer->header, sizeof(replay_header_t)) != (int)sizeof(replay_header_t)) {
+            result = FS_ERROR_INVALID;
+        }
+        if (fd >= 0) fs_close(fd);
+    }
+    kfree(writer->chunk);
+    writer->chunk = NULL;
+    return result;
+}
+
+// One large sequential read into an empty buffer
+static void replay_fill(replay_buffer_t* buffer) {
+    int bytes = fs_read(replay_io.fd, buffer->data, REPLAY_CHUNK_SIZE);
+    buffer->length = bytes > 0 ? (uint32_t)bytes : 0;
+    store_release(&buffer->state, REPLAY_BUF_FULL);
+    futex_wake(&buffer->state, FUTEX_WAKE_ALL);
+}
+
+static void replay_reader_task(void) {
+    for (uint32_t b = 0; !replay_io.stop; b ^= 1) {
+        replay_buffer_t* buffer = &replay_io.buffers[b];
+        while (load_acquire(&buffer->state) == REPLAY_BUF_FULL && !replay_io.stop) {
+            futex_wait(&buffer->state, REPLAY_BUF_FULL, FUTEX_WAIT_FOREVER);
+        }
+        if (replay_io.stop) break;
+
+        replay_fill(buffer);
+        if (buffer->length < REPLAY_CHUNK_SIZE) break;
+    }
+    store_release(&replay_io.done, 1);
+    futex_wake(&replay_io.done, FUTEX_WAKE_ALL);
+}
+
+static void replay_wait(volatile uint32_t* word, uint32_t value) {
+    while (load_acquire(word) == value) {
+        futex_wait_or_yield(word, value, REPLAY_WAIT_MS);
+    }
+}
+
+static void replay_wait_until(uint64_t due) {
+    uint64_t now;
+    while ((now = ktime_ns()) < due) {
+        if (due - now > REPLAY_YIELD_NS) {
+            scheduler_yield();
+        } else {
+            cpu_relax();
+        }
+    }
+}
+
+static void replay_publish(lockfree_ringbuf_t* ring, const replay_record_t* records, uint32_t count,
+                           replay_stats_t* stats) {
+    stats->records += count;
+    if (!ring) return;
+
+    while (count) {
+        uint32_t avail;
+        market_data_t* slots = (market_data_t*)ringbuf_reserve(ring, count, &avail);
+        if (!slots) {
+            stats->ring_full++;
+            scheduler_yield();
+            continue;
+        }
+
+        uint64_t now = ktime_ns();
+        for (uint32_t i = 0; i < avail; i++) {
+            slots[i].price = records[i].price;
+            slots[i].volume = records[i].volume;
+            slots[i].timestamp = now;
+            slots[i].symbol_id = records[i].symbol_id;
+            slots[i].side = records[i].side;
+            slots[i].flags = records[i].flags;
+        }
+        ringbuf_commit(ring, avail);
+        records += avail;
+        count -= avail;
+    }
+}
+
+static inline uint64_t replay_due(const replay_record_t* record, uint64_t first_ns, uint64_t start,
+                                  uint32_t speed) {
+    uint64_t offset = record->timestamp > first_ns ? record->timestamp - first_ns : 0;
+    return start + (speed == 1 ? offset : div_u64_u32(offset, speed, NULL));
+}
+
+// Inject the records of one chunk, up to the 'left' the header promised
+static void replay_chunk(const replay_record_t* records, uint32_t count, uint32_t* left,
+                         const replay_header_t* header, uint64_t start, lockfree_ringbuf_t* ring,
+                         uint32_t speed, replay_stats_t* stats) {
+    uint32_t i = 0;
+    while (i < count && *left) {
+        uint32_t run = count - i;
+        if (run > *left) run = *left;
+
+        if (speed) {
+            uint64_t due = replay_due(&records[i], header->first_ns, start, speed);
+            replay_wait_until(due);
+            uint64_t now = ktime_ns();
+            if (now - due > REPLAY_LATE_NS) stats->late++;
+
+            // Everything due by now goes in together
+            uint32_t ready = 1;
+            while (ready < run && replay_due(&records[i + ready], header->first_ns, start, speed) <= now) {
+                ready++;
+            }
+            run = ready;
+        }
+        replay_publish(ring, &records[i], run, stats);
+        i += run;
+        *left -= run;
+    }
+}
+
+int replay_run(const char* path, lockfree_ringbuf_t* ring, uint32_t speed, replay_stats_t* stats) {
+    if (!path || !stats || (ring && ring->element_size != sizeof(market_data_t))) {
+        return FS_ERROR_INVALID;
+    }
+    if (replay_io.active) return FS_ERROR_EXISTS;
+
+    memset(stats, 0, sizeof(replay_stats_t));
+    int fd = fs_open(path, 0);
+    if (fd < 0) return fd;
+
+    memset(&replay_io, 0, sizeof(replay_io));
+    replay_io.active = true;
+    replay_io.fd = fd;
+    int result = FS_SUCCESS;
+    for (uint32_t b = 0; b < REPLAY_BUFFERS; b++) {
+        replay_io.buffers[b].data = (uint8_t*)kmalloc_aligned(REPLAY_CHUNK_SIZE, CACHE_LINE_SIZE);
+        if (!replay_io.buffers[b].data) result = FS_ERROR_NO_MEMORY;
+    }
+
+    // Without a reader task the chunks are read inline, with no overlap
+    process_t* reader = NULL;
+    if (result == FS_SUCCESS) {
+        reader = process_create("replay_read", replay_reader_task, PRIORITY_LOW);
+        if (reader) scheduler_add_process(reader);
+    }
+
+    replay_header_t header;
+    memset(&header, 0, sizeof(header));
+    uint32_t left = 0;
+    uint64_t start = ktime_ns();
+    for (uint32_t b = 0; result == FS_SUCCESS; b ^= 1) {
+        replay_buffer_t* buffer = &replay_io.buffers[b];
+        if (!reader) {
+            replay_fill(buffer);
+        } else if (load_acquire(&buffer->state) == REPLAY_BUF_EMPTY) {
+            stats->stalls++;
+            replay_wait(&buffer->state, REPLAY_BUF_EMPTY);
+        }
+
+        const replay_record_t* records = (const replay_record_t*)buffer->data;
+        uint32_t count = buffer->length / sizeof(replay_record_t);
+        if (stats->chunks++ == 0) {
+            // The header leads the first chunk
+            memcpy(&header, records, sizeof(header));
+            if (count == 0 || header.magic != REPLAY_MAGIC || header.version != REPLAY_VERSION ||
+                header.record_size != sizeof(replay_record_t)) {
+                result = FS_ERROR_INVALID;
+                break;
+            }
+            left = header.count;
+            start = ktime_ns();
+            records++;
+            count--;
+        }
+        stats->bytes += buffer->length;
+
+        replay_chunk(records, count, &left, &header, start, ring, speed, stats);
+        bool more = left != 0 && buffer->length == REPLAY_CHUNK_SIZE;
+        store_release(&buffer->state, REPLAY_BUF_EMPTY);
+        futex_wake(&buffer->state, FUTEX_WAKE_ALL);
+        if (!more) break;
+    }
+    stats->elapsed_ns = ktime_ns() - start;
+
+    // The reader may still be ahead or waiting for a buffer
+    if (reader) {
+        store_release(&replay_io.stop, 1);
+        for (uint32_t b = 0; b < REPLAY_BUFFERS; b++) {
+            futex_wake(&replay_io.buffers[b].state, FUTEX_WAKE_ALL);
+        }
+        replay_wait(&replay_io.done, 0);
+    }
+
+    for (uint32_t b = 0; b < REPLAY_BUFFERS; b++) {
+        kfree_aligned(replay_io.buffers[b].data);
+    }
+    fs_close(fd);
+    replay_io.active = false;
+    return result;
+}
+
+void replay_print_stats(const replay_stats_t* stats) {
+    if (!stats) return;
+
+    vga_write_string("Replay: ");
+    print_dec(stats->records);
+    vga_write_string(" records in ");
+    print_dec(stats->chunks);
+    vga_write_string(" chunks, ");
+    print_dec((uint32_t)div_u64_u32(stats->bytes, 1024, NULL));
+    vga_write_string(" KB in ");
+    uint32_t elapsed_us = (uint32_t)div_u64_u32(stats->elapsed_ns, NSEC_PER_USEC, NULL);
+    print_dec(elapsed_us);
+    vga_write_string(" us");
+    if (elapsed_us) {
+        vga_write_string(" (");
+        print_dec((uint32_t)div_u64_u32((stats->bytes * 1000000) >> 10, elapsed_us, NULL));
+        vga_write_string(" KB/s)");
+    }
+    vga_write_string("\n  ");
+    print_dec(stats->stalls);
+    vga_write_string(" read stalls, ");
+    print_dec(stats->ring_full);
+    vga_write_string(" ring full waits, ");
+    print_dec(stats->late);
+    vga_write_string(" late\n");
+}
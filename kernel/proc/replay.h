@@ -0,0 +1,83 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "../types.h"
+#include "ipc.h"
+
+// Market data capture and replay for backtests. A capture file is a
+// header followed by fixed 32-byte records (a market_data_t as it was
+// published), header included, so chunks of whole sectors always hold
+// whole records; writers buffer a chunk and write it in one go. The
+// writer appends to space preallocated REPLAY_PREALLOC_SIZE at a time,
+// so a chunk goes straight to disk blocks already reserved with no
+// allocation or inode update, and gives back what it did not use on
+// close.
+//
+// Replay streams the file in REPLAY_CHUNK_SIZE reads into two buffers: a
+// low priority reader task fills one with a single sequential read while
+// the caller injects from the other, so the per-record cost is a store
+// into a reserved ring slot and, when paced, the wait until it is due.
+// Records go in at their recorded spacing divided by 'speed' (1 = real
+// time), or back to back with speed 0. A full ring holds the replay back
+// rather than dropping; injected records carry the time they went in,
+// like records fresh off the feed. One replay at a time.
+#define REPLAY_MAGIC            0x594C5052      // "RPLY"
+#define REPLAY_VERSION          1
+#define REPLAY_CHUNK_SIZE       (64 * 1024)     // Per read, whole sectors
+#define REPLAY_PREALLOC_SIZE    (1024 * 1024)   // Writer reservations, whole chunks
+#define REPLAY_BUFFERS          2
+#define REPLAY_LATE_NS          50000           // Paced records later than this count as late
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t count;
+    uint64_t first_ns;          // Publish times of the first and last record
+    uint64_t last_ns;
+} __attribute__((packed)) replay_header_t;
+
+typedef struct {
+    uint64_t timestamp;         // Published, ns
+    double price;
+    uint64_t volume;
+    uint16_t symbol_id;
+    uint8_t side;
+    uint8_t flags;
+    uint32_t reserved;
+} __attribute__((packed)) replay_record_t;
+
+typedef struct {
+    int fd;                     // Append only
+    const char* path;           // Reopened for the header: must outlive the writer
+    replay_record_t* chunk;     // REPLAY_CHUNK_SIZE, the header in slot 0 of the first
+    uint32_t used;              // Slots filled in the chunk
+    uint32_t written;           // Bytes
+    uint32_t reserved;          // Bytes preallocated
+    replay_header_t header;
+} replay_writer_t;
+
+typedef struct {
+    uint32_t records;           // Injected
+    uint32_t chunks;
+    uint32_t stalls;            // Waits for a chunk not read ahead in time
+    uint32_t ring_full;         // Waits for ring space
+    uint32_t late;              // Paced records over REPLAY_LATE_NS past due
+    uint64_t bytes;
+    uint64_t elapsed_ns;
+} replay_stats_t;
+
+// Create (or overwrite) a capture file and append records to it. Close
+// writes the last chunk and the header; FS_SUCCESS or an FS_ERROR code.
+int replay_writer_open(replay_writer_t* writer, const char* path);
+int replay_writer_add(replay_writer_t* writer, const market_data_t* record);
+int replay_writer_close(replay_writer_t* writer);
+
+// Replay a capture into a market_data_t ring whose consumer runs
+// elsewhere; ring NULL reads and paces without publishing, which measures
+// the read path alone. FS_SUCCESS or an FS_ERROR code.
+int replay_run(const char* path, lockfree_ringbuf_t* ring, uint32_t speed, replay_stats_t* stats);
+
+void replay_print_stats(const replay_stats_t* stats);
+
+#endif // REPLAY_H
@@ -0,0 +1,174 @@
+#include "risk.h"
+#include "portfolio.h"
+#include "journal.h"
+#include "../mm/memory.h"
+#include "../arch/tsc.h"
+#include "../drivers/vga.h"
+
+// Rate windows run on ktime_ns() in units of 2^20 ns (about a millisecond),
+// which fit a word that can be swapped atomically
+#define RISK_TIME_SHIFT         20
+#define RISK_WINDOW             (1000000000u >> RISK_TIME_SHIFT)
+
+static risk_symbol_t risk_table[RISK_MAX_SYMBOLS];
+
+void risk_init(void) {
+    memset(risk_table, 0, sizeof(risk_table));
+    for (uint32_t i = 0; i < RISK_MAX_SYMBOLS; i++) {
+        risk_table[i].fills.position_id = i;
+        risk_table[i].fills.symbol_id = (uint16_t)i;
+    }
+}
+
+int risk_set_limits(uint16_t symbol_id, const risk_limits_t* limits) {
+    if (symbol_id >= RISK_MAX_SYMBOLS) return -1;
+
+    risk_symbol_t* risk = &risk_table[symbol_id];
+    risk->enabled = 0;
+    if (!limits) return 0;
+
+    risk->limits = *limits;
+    risk->band = limits->band_bps / 10000.0;
+    compiler_barrier();
+    risk->enabled = 1;
+    return 0;
+}
+
+// Each test is a compare turned into its reason bit, so the only branches
+// are the rare window roll-over and the reject path
+uint32_t risk_check(const order_t* order) {
+    if (order->status != 0) return RISK_OK;
+    if (order->symbol_id >= RISK_MAX_SYMBOLS) return RISK_REJECT_SYMBOL;
+
+    risk_symbol_t* risk = &risk_table[order->symbol_id];
+    uint32_t side = order->side != 0;
+    int32_t quantity = order->quantity <= RISK_MAX_QUANTITY ? (int32_t)order->quantity : 0;
+
+    // Counters are kept for unchecked symbols too, so limits can be set later
+    int32_t working = __sync_add_and_fetch(&risk->open[side], quantity);
+    if (!risk->enabled) return RISK_OK;
+
+    uint32_t reject = (quantity == 0) * RISK_REJECT_QUANTITY;
+
+    // Worst case if everything working on this side fills
+    int32_t exposure = side ? working - risk->position : working + risk->position;
+    reject |= (exposure > risk->limits.max_position) * RISK_REJECT_POSITION;
+
+    // Market orders are priced at the reference
+    double reference = risk->reference;
+    double price = order->type == 0 ? reference : order->price;
+    reject |= (price * quantity > risk->limits.max_notional) * RISK_REJECT_NOTIONAL;
+
+    double distance = price - reference;
+    double band = reference * risk->band;
+    reject |= (risk->limits.band_bps != 0 && (reference == 0 || distance * distance > band * band)) *
+              RISK_REJECT_PRICE;
+
+    uint32_t now = (uint32_t)(ktime_ns() >> RISK_TIME_SHIFT);
+    uint32_t start = risk->window_start;
+    if (now - start >= RISK_WINDOW) {
+        // Whoever swaps the start resets the count; the others count in the new window
+        if (__sync_bool_compare_and_swap(&risk->window_start, start, now)) {
+            risk->window_orders = 0;
+        }
+    }
+    uint32_t sent = __sync_add_and_fetch(&risk->window_orders, 1);
+    reject |= (sent > risk->limits.max_orders_per_sec) * RISK_REJECT_RATE;
+
+    risk->checks++;
+    if (reject) {
+        __sync_fetch_and_sub(&risk->open[side], quantity);
+        __sync_fetch_and_sub(&risk->window_orders, 1);
+        for (uint32_t i = 0; i < RISK_REASONS; i++) {
+            risk->rejects[i] += (reject >> i) & 1;
+        }
+    }
+    return reject;
+}
+
+static inline int32_t risk_quantity(uint64_t quantity) {
+    return quantity <= RISK_MAX_QUANTITY ? (int32_t)quantity : RISK_MAX_QUANTITY;
+}
+
+void risk_on_fill(uint16_t symbol_id, uint8_t side, uint64_t quantity, double price) {
+    if (symbol_id >= RISK_MAX_SYMBOLS || quantity == 0) return;
+
+    risk_symbol_t* risk = &risk_table[symbol_id];
+    int32_t filled = risk_quantity(quantity);
+    int32_t delta = side ? -filled : filled;
+    int32_t before = risk->position;
+
+    // Position first: a check racing the fill counts it twice, never zero times
+    __sync_fetch_and_add(&risk->position, delta);
+    __sync_fetch_and_sub(&risk->open[side != 0], filled);
+
+    // Average price and realised P&L, closing against the average
+    position_t* position = &risk->fills;
+    int32_t after = before + delta;
+    if (before == 0 || (before > 0) == (delta > 0)) {
+        int32_t held = before < 0 ? -before : before;
+        int32_t total = after < 0 ? -after : after;
+        position->avg_price = (position->avg_price * held + price * filled) / total;
+    } else {
+        int32_t held = before < 0 ? -before : before;
+        int32_t closed = filled < held ? filled : held;
+        double gain = (price - position->avg_price) * closed;
+        position->realized_pnl += before > 0 ? gain : -gain;
+        if (after == 0) {
+            position->avg_price = 0;
+        } else if ((after > 0) != (before > 0)) {
+            position->avg_price = price;    // Flipped through flat
+        }
+    }
+    position->quantity = after;
+    position->unrealized_pnl = risk->reference ? (risk->reference - position->avg_price) * after : 0;
+    position->timestamp = ktime_ns();
+
+    portfolio_on_fill(symbol_id, side, (uint32_t)filled, price);
+    journal_log_fill(0, symbol_id, side, (uint64_t)filled, price);
+}
+
+void risk_on_cancel(uint16_t symbol_id, uint8_t side, uint64_t quantity) {
+    if (symbol_id >= RISK_MAX_SYMBOLS) return;
+
+    __sync_fetch_and_sub(&risk_table[symbol_id].open[side != 0], risk_quantity(quantity));
+}
+
+void risk_mark(uint16_t symbol_id, double price) {
+    if (symbol_id < RISK_MAX_SYMBOLS) {
+        risk_table[symbol_id].reference = price;
+    }
+}
+
+const position_t* risk_position(uint16_t symbol_id) {
+    return symbol_id < RISK_MAX_SYMBOLS ? &risk_table[symbol_id].fills : NULL;
+}
+
+void risk_print_info(uint16_t symbol_id) {
+    if (symbol_id >= RISK_MAX_SYMBOLS) return;
+
+    static const char* reasons[RISK_REASONS] = {
+        "position", "notional", "rate", "price", "quantity", "symbol"
+    };
+    risk_symbol_t* risk = &risk_table[symbol_id];
+    vga_write_string("Risk for symbol ");
+    print_dec(symbol_id);
+    vga_write_string(risk->enabled ? ": position " : " (unchecked): position ");
+    if (risk->position < 0) vga_write_string("-");
+    print_dec(risk->position < 0 ? -risk->position : risk->position);
+    vga_write_string(", working ");
+    print_dec(risk->open[0]);
+    vga_write_string(" buy / ");
+    print_dec(risk->open[1]);
+    vga_write_string(" sell, ");
+    print_dec(risk->checks);
+    vga_write_string(" checks\n");
+    for (uint32_t i = 0; i < RISK_REASONS; i++) {
+        if (!risk->rejects[i]) continue;
+        vga_write_string("  rejected for ");
+        vga_write_string(reasons[i]);
+        vga_write_string(": ");
+        print_dec(risk->rejects[i]);
+        vga_write_string("\n");
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef RISK_H
+#define RISK_H
+
+#include "../types.h"
+#include "ipc.h"
+
+// Pre-trade risk checks, run inline from send_order. Each symbol has a
+// position limit (net position plus everything working on the order's side,
+// so a burst of orders cannot overshoot it), a notional limit per order, a
+// rate limit of new orders per second and a fat-finger band around the last
+// trade price. The counters are kept up to date as orders go out, fill and
+// are cancelled, never recomputed, and checking is a handful of loads and
+// compares folded into one reject mask: no locks, no allocation.
+//
+// A new order reserves its quantity on its side before it is checked, so
+// concurrent senders see each other; a rejected one gives it back. Symbols
+// without limits pass unchecked but are still counted. Only new orders
+// (status pending) are checked; cancels always go through.
+#define RISK_MAX_SYMBOLS        1024
+
+// Reject reasons, or'ed
+#define RISK_OK                 0
+#define RISK_REJECT_POSITION    0x01
+#define RISK_REJECT_NOTIONAL    0x02
+#define RISK_REJECT_RATE        0x04
+#define RISK_REJECT_PRICE       0x08
+#define RISK_REJECT_QUANTITY    0x10        // Zero or over RISK_MAX_QUANTITY
+#define RISK_REJECT_SYMBOL      0x20
+#define RISK_REASONS            6
+
+#define RISK_MAX_QUANTITY       0x10000000
+
+typedef struct {
+    int32_t max_position;       // Absolute net shares, working orders included
+    uint32_t max_orders_per_sec;
+    double max_notional;        // Price times quantity of one order
+    uint32_t band_bps;          // Fat-finger band around the last trade, 0 = none
+} risk_limits_t;
+
+// Check side and fill side on lines of their own
+typedef struct {
+    volatile int32_t open[2];   // Working quantity: buys, sells
+    volatile int32_t position;  // Net filled
+    volatile uint32_t window_orders;
+    volatile uint32_t window_start; // ms
+    uint32_t enabled;
+    risk_limits_t limits;
+    double band;                // band_bps as a fraction
+    volatile double reference;  // Last trade price, 0 = none yet
+    uint32_t checks;
+    uint32_t rejects[RISK_REASONS];
+    position_t fills __cacheline_aligned;   // Fill side only
+} __cacheline_aligned risk_symbol_t;
+
+void risk_init(void);
+
+// Limits for a symbol, enabling its checks (NULL disables them)
+int risk_set_limits(uint16_t symbol_id, const risk_limits_t* limits);
+
+// RISK_OK or the reasons an order is rejected. An accepted order stays
+// reserved until risk_on_fill or risk_on_cancel releases it.
+uint32_t risk_check(const order_t* order);
+
+// Fill side: 'quantity' of a working order filled at 'price', or left the
+// book unfilled (cancelled, expired, or never sent)
+void risk_on_fill(uint16_t symbol_id, uint8_t side, uint64_t quantity, double price);
+void risk_on_cancel(uint16_t symbol_id, uint8_t side, uint64_t quantity);
+
+// Last trade price for the fat-finger band
+void risk_mark(uint16_t symbol_id, double price);
+
+const position_t* risk_position(uint16_t symbol_id);
+void risk_print_info(uint16_t symbol_id);
+
+#endif // RISK_H
@@ -0,0 +1,299 @@
+#include "sched_trace.h"
+#include "../arch/cpu.h"
+#include "../arch/tsc.h"
+#include "../arch/div64.h"
+#include "../mm/paging.h"
+#include "../drivers/vga.h"
+
+typedef struct {
+    volatile uint32_t head;     // Total events written; next slot is head & MASK
+    uint32_t mm_switches;       // Switches that reloaded CR3
+    uint32_t mm_kept;           // Switches within one address space
+    sched_trace_entry_t entries[SCHED_TRACE_ENTRIES];
+} __cacheline_aligned sched_trace_ring_t;
+
+static sched_trace_ring_t trace_rings[MAX_CPUS];
+static sched_lat_hist_t lat_hist[MAX_CPUS][SCHED_LAT_KINDS][SCHED_TRACE_BANDS];
+static volatile bool trace_enabled = false;
+
+static const char* trace_type_names[TRACE_EVENT_TYPES] = {
+    "wakeup", "in", "out", "pi-boost", "pi-restore"
+};
+
+static const char* lat_kind_names[SCHED_LAT_KINDS] = {
+    "Wakeup-to-run", "Run queue"
+};
+
+void sched_trace_init(void) {
+    sched_trace_reset();
+    trace_enabled = true;
+}
+
+void sched_trace_enable(bool enabled) {
+    trace_enabled = enabled;
+}
+
+bool sched_trace_enabled(void) {
+    return trace_enabled;
+}
+
+// Clears the rings and histograms; events racing with it may survive
+void sched_trace_reset(void) {
+    for (uint32_t c = 0; c < MAX_CPUS; c++) {
+        trace_rings[c].head = 0;
+        trace_rings[c].mm_switches = 0;
+        trace_rings[c].mm_kept = 0;
+        for (uint32_t k = 0; k < SCHED_LAT_KINDS; k++) {
+            for (uint32_t b = 0; b < SCHED_TRACE_BANDS; b++) {
+                sched_lat_hist_t* hist = &lat_hist[c][k][b];
+                hist->count = 0;
+                hist->max_ns = 0;
+                hist->total_ns = 0;
+                for (uint32_t i = 0; i < SCHED_TRACE_BUCKETS; i++) {
+                    hist->buckets[i] = 0;
+                }
+            }
+        }
+    }
+}
+
+// Append to this CPU's ring (interrupts off, so this CPU is the only writer)
+static void trace_record(uint32_t cpu, uint64_t tsc, sched_trace_type_t type,
+                         process_t* process, uint32_t arg) {
+    sched_trace_ring_t* ring = &trace_rings[cpu];
+    uint32_t head = ring->head;
+    sched_trace_entry_t* entry = &ring->entries[head & SCHED_TRACE_MASK];
+
+    entry->tsc = tsc;
+    entry->pid = process->pid;
+    entry->arg = arg;
+    entry->type = (uint8_t)type;
+    entry->cpu = (uint8_t)cpu;
+    entry->priority = (uint8_t)process->priority;
+    entry->reserved = 0;
+
+    // Publish the entry before the slot counts as written
+    __sync_synchronize();
+    ring->head = head + 1;
+}
+
+static inline uint32_t lat_bucket(uint64_t ns) {
+    if (ns == 0) return 0;
+    if (ns >> 32) return SCHED_TRACE_BUCKETS - 1;
+    uint32_t bucket = 32 - __builtin_clz((uint32_t)ns);
+    return bucket < SCHED_TRACE_BUCKETS ? bucket : SCHED_TRACE_BUCKETS - 1;
+}
+
+static void lat_record(uint32_t cpu, sched_lat_kind_t kind, process_t* process,
+                       uint64_t cycles) {
+    uint32_t band = (uint32_t)process->priority >> SCHED_TRACE_BAND_SHIFT;
+    if (band >= SCHED_TRACE_BANDS) band = SCHED_TRACE_BANDS - 1;
+
+    sched_lat_hist_t* hist = &lat_hist[cpu][kind][band];
+    uint64_t ns = tsc_cycles_to_ns(cycles);
+    uint32_t ns32 = (ns >> 32) ? 0xFFFFFFFF : (uint32_t)ns;
+
+    hist->count++;
+    hist->total_ns += ns;
+    if (ns32 > hist->max_ns) {
+        hist->max_ns = ns32;
+    }
+    hist->buckets[lat_bucket(ns)]++;
+}
+
+// Called from process_set_state when a blocked or sleeping process becomes
+// ready, before it is queued
+void sched_trace_wakeup(process_t* process, process_state_t from) {
+    if (!trace_enabled || !tsc_available()) return;
+
+    uint32_t flags = irq_save();
+    uint64_t now = rdtsc();
+    process->trace_wakeup_tsc = now;
+    trace_record(this_cpu()->id, now, TRACE_WAKEUP, process, (uint32_t)from);
+    irq_restore(flags);
+}
+
+// Called by the priority inheritance code after it changed a process's
+// effective priority
+void sched_trace_pi(process_t* process, uint32_t old_priority) {
+    if (!trace_enabled || !tsc_available()) return;
+
+    uint32_t flags = irq_save();
+    sched_trace_type_t type = (uint32_t)process->priority < old_priority ?
+                              TRACE_PI_BOOST : TRACE_PI_RESTORE;
+    trace_record(this_cpu()->id, rdtsc(), type, process, old_priority);
+    irq_restore(flags);
+}
+
+// Called from scheduler_switch on 'cpu' with interrupts off, right before
+// the stacks are switched
+void sched_trace_switch(cpu_t* cpu, process_t* prev, process_t* next) {
+    uint64_t wakeup = next->trace_wakeup_tsc;
+    uint64_t enqueue = next->trace_enqueue_tsc;
+    next->trace_wakeup_tsc = 0;
+    next->trace_enqueue_tsc = 0;
+
+    if (!trace_enabled || !tsc_available()) return;
+
+    // context_switch reloads CR3 only when the address space changes
+    uint32_t cr3 = next->context.cr3;
+    if (cr3 && cr3 != read_cr3()) {
+        trace_rings[cpu->id].mm_switches++;
+    } else {
+        trace_rings[cpu->id].mm_kept++;
+    }
+
+    uint64_t now = rdtsc();
+    trace_record(cpu->id, now, TRACE_SWITCH_OUT, prev, (uint32_t)prev->state);
+    trace_record(cpu->id, now, TRACE_SWITCH_IN, next, prev->pid);
+
+    // Idle processes are never queued, so they carry no stamps
+    if (wakeup && (int64_t)(now - wakeup) >= 0) {
+        lat_record(cpu->id, SCHED_LAT_WAKEUP, next, now - wakeup);
+    }
+    if (enqueue && (int64_t)(now - enqueue) >= 0) {
+        lat_record(cpu->id, SCHED_LAT_RUNQUEUE, next, now - enqueue);
+    }
+}
+
+uint32_t sched_trace_snapshot(uint32_t cpu, sched_trace_entry_t* out, uint32_t max) {
+    if (cpu >= MAX_CPUS || !out || max == 0) return 0;
+    sched_trace_ring_t* ring = &trace_rings[cpu];
+
+    if (max > SCHED_TRACE_ENTRIES) max = SCHED_TRACE_ENTRIES;
+    uint32_t head = ring->head;
+    __sync_synchronize();
+    uint32_t count = head < max ? head : max;
+    uint32_t first = head - count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        out[i] = ring->entries[(first + i) & SCHED_TRACE_MASK];
+    }
+
+    // Slots the writer has reused (or is writing) since we read head are
+    // torn: everything up to index head - ENTRIES is dropped
+    __sync_synchronize();
+    uint32_t lapped = ring->head - SCHED_TRACE_ENTRIES + 1;
+    uint32_t skip = 0;
+    if ((int32_t)(lapped - first) > 0) {
+        skip = lapped - first;
+        if (skip > count) skip = count;
+    }
+    for (uint32_t i = skip; i < count; i++) {
+        out[i - skip] = out[i];
+    }
+    return count - skip;
+}
+
+void sched_trace_get_hist(sched_lat_kind_t kind, uint32_t band, sched_lat_hist_t* out) {
+    if (!out) return;
+    out->count = 0;
+    out->max_ns = 0;
+    out->total_ns = 0;
+    for (uint32_t i = 0; i < SCHED_TRACE_BUCKETS; i++) {
+        out->buckets[i] = 0;
+    }
+    if ((uint32_t)kind >= SCHED_LAT_KINDS || band >= SCHED_TRACE_BANDS) return;
+
+    for (uint32_t c = 0; c < MAX_CPUS; c++) {
+        sched_lat_hist_t* hist = &lat_hist[c][kind][band];
+        out->count += hist->count;
+        out->total_ns += hist->total_ns;
+        if (hist->max_ns > out->max_ns) {
+            out->max_ns = hist->max_ns;
+        }
+        for (uint32_t i = 0; i < SCHED_TRACE_BUCKETS; i++) {
+            out->buckets[i] += hist->buckets[i];
+        }
+    }
+}
+
+uint64_t sched_trace_percentile_ns(const sched_lat_hist_t* hist, uint32_t per_mille) {
+    return log2_hist_percentile(hist->buckets, SCHED_TRACE_BUCKETS, hist->count, per_mille);
+}
+
+void sched_trace_print_latency(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Scheduler Latency ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    if (!tsc_available()) {
+        vga_write_string("Needs a calibrated TSC\n");
+        return;
+    }
+    if (!trace_enabled) {
+        vga_write_string("Tracing is off (schedlat on)\n");
+    }
+
+    for (uint32_t k = 0; k < SCHED_LAT_KINDS; k++) {
+        vga_write_string(lat_kind_names[k]);
+        vga_write_string(":\nPRIO   COUNT    AVG    P50    P99    MAX\n");
+        for (uint32_t b = 0; b < SCHED_TRACE_BANDS; b++) {
+            sched_lat_hist_t hist;
+            sched_trace_get_hist((sched_lat_kind_t)k, b, &hist);
+            if (hist.count == 0) continue;
+
+            print_dec(b << SCHED_TRACE_BAND_SHIFT);
+            vga_write_string("-");
+            print_dec(((b + 1) << SCHED_TRACE_BAND_SHIFT) - 1);
+            vga_write_string("  ");
+            print_dec(hist.count);
+            vga_write_string("  ");
+            print_duration_ns(div_u64_u32(hist.total_ns, hist.count, NULL));
+            vga_write_string("  <");
+            print_duration_ns(sched_trace_percentile_ns(&hist, 500));
+            vga_write_string("  <");
+            print_duration_ns(sched_trace_percentile_ns(&hist, 990));
+            vga_write_string("  ");
+            print_duration_ns(hist.max_ns);
+            vga_write_string("\n");
+        }
+    }
+
+    // Each CR3 reload drops every non-global TLB entry (tlbbench: the cost)
+    uint32_t reloads = 0, kept = 0;
+    for (uint32_t c = 0; c < MAX_CPUS; c++) {
+        reloads += trace_rings[c].mm_switches;
+        kept += trace_rings[c].mm_kept;
+    }
+    vga_write_string("Address space: ");
+    print_dec(reloads);
+    vga_write_string(" CR3 reloads, ");
+    print_dec(kept);
+    vga_write_string(" switches kept the TLB; kernel pages ");
+    vga_write_string(paging_global_pages_available() ? "global\n" : "not global (no PGE)\n");
+}
+
+void sched_trace_print_events(uint32_t cpu, uint32_t max) {
+    static sched_trace_entry_t events[SCHED_TRACE_ENTRIES];
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Scheduler Trace CPU ");
+    print_dec(cpu);
+    vga_write_string(" ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    uint32_t count = sched_trace_snapshot(cpu, events, max);
+    if (count == 0) {
+        vga_write_string("No events\n");
+        return;
+    }
+
+    // Timestamps relative to the newest event
+    uint64_t last = events[count - 1].tsc;
+    vga_write_string("AGO      EVENT   PID  PRIO  ARG\n");
+    for (uint32_t i = 0; i < count; i++) {
+        sched_trace_entry_t* e = &events[i];
+        vga_write_string("-");
+        print_duration_ns(tsc_cycles_to_ns(last - e->tsc));
+        vga_write_string("  ");
+        vga_write_string(e->type < TRACE_EVENT_TYPES ? trace_type_names[e->type] : "?");
+        vga_write_string("  ");
+        print_dec(e->pid);
+        vga_write_string("  ");
+        print_dec(e->priority);
+        vga_write_string("  ");
+        print_dec(e->arg);
+        vga_write_string("\n");
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef SCHED_TRACE_H
+#define SCHED_TRACE_H
+
+#include "../types.h"
+#include "process.h"
+
+// Scheduler tracing. Every CPU logs wakeup and switch events with raw TSC
+// timestamps into its own ring; only that CPU ever writes it (interrupts
+// off), so recording takes no lock. Readers copy the ring and drop whatever
+// the writer lapped in the meantime.
+//
+// On the switch path each CPU also folds two latencies into log2 histograms
+// per priority band:
+//   wakeup:   leaving BLOCKED/SLEEPING until the process is switched in
+//   runqueue: any enqueue (wakeup or preemption) until it is switched in
+#define SCHED_TRACE_ENTRIES     256     // Per CPU, power of two
+#define SCHED_TRACE_MASK        (SCHED_TRACE_ENTRIES - 1)
+#define SCHED_TRACE_BAND_SHIFT  4       // 16 priority levels per band
+#define SCHED_TRACE_BANDS       (NUM_PRIORITY_LEVELS >> SCHED_TRACE_BAND_SHIFT)
+#define SCHED_TRACE_BUCKETS     32      // Bucket b: latency < 2^b ns
+
+typedef enum {
+    TRACE_WAKEUP = 0,           // arg: state it was woken from
+    TRACE_SWITCH_IN,            // arg: PID it replaced
+    TRACE_SWITCH_OUT,           // arg: state it left in
+    TRACE_PI_BOOST,             // Priority raised by a lock waiter; arg: old priority
+    TRACE_PI_RESTORE,           // Inherited priority dropped; arg: old priority
+    TRACE_EVENT_TYPES
+} sched_trace_type_t;
+
+typedef struct {
+    uint64_t tsc;
+    uint32_t pid;
+    uint32_t arg;
+    uint8_t type;               // sched_trace_type_t
+    uint8_t cpu;
+    uint8_t priority;
+    uint8_t reserved;
+} sched_trace_entry_t;
+
+typedef enum {
+    SCHED_LAT_WAKEUP = 0,
+    SCHED_LAT_RUNQUEUE,
+    SCHED_LAT_KINDS
+} sched_lat_kind_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_ns;            // Saturates at 0xFFFFFFFF
+    uint64_t total_ns;
+    uint32_t buckets[SCHED_TRACE_BUCKETS];
+} sched_lat_hist_t;
+
+void sched_trace_init(void);
+void sched_trace_enable(bool enabled);
+bool sched_trace_enabled(void);
+void sched_trace_reset(void);
+
+// Hooks: process_set_state reports wakeups, scheduler_switch switches
+// and the mutex code priority inheritance (rq_enqueue stamps
+// process->trace_enqueue_tsc itself)
+void sched_trace_wakeup(process_t* process, process_state_t from);
+void sched_trace_switch(cpu_t* cpu, process_t* prev, process_t* next);
+void sched_trace_pi(process_t* process, uint32_t old_priority);
+
+// Copy up to 'max' of a CPU's most recent events, oldest first
+uint32_t sched_trace_snapshot(uint32_t cpu, sched_trace_entry_t* out, uint32_t max);
+
+// Histogram summed over all CPUs
+void sched_trace_get_hist(sched_lat_kind_t kind, uint32_t band, sched_lat_hist_t* out);
+
+// Upper edge of the bucket holding the given fraction (per mille)
+uint64_t sched_trace_percentile_ns(const sched_lat_hist_t* hist, uint32_t per_mille);
+
+void sched_trace_print_latency(void);
+void sched_trace_print_events(uint32_t cpu, uint32_t max);
+
+#endif // SCHED_TRACE_H
@@ -1,64 +1,346 @@
 #include "process.h"
+#include "scheduler.h"
 #include "../mm/memory.h"
 #include "../drivers/vga.h"
+#include "../arch/tsc.h"
+#include "../arch/div64.h"
+#include "../arch/fpu.h"
+#include "tick.h"
+#include "sched_trace.h"
+#include "klog.h"
+#include "vdso.h"
 
 // External variables
-extern process_t* current_process;
-extern process_t* idle_process;
 extern process_stats_t proc_stats;
-extern scheduler_queue_t ready_queues[5];
 extern bool scheduler_enabled;
+extern process_t process_table[MAX_PROCESSES];
+
+static spinlock_t dl_admit_lock = SPINLOCK_INIT;   // Serialises cpu->dl_bw updates
+static scheduler_dl_stats_t dl_stats;
+
+// Priority bitmap helpers - one bit per ready queue, lowest bit = highest priority
+static inline void ready_bitmap_set(cpu_t* cpu, uint32_t priority) {
+    cpu->ready_bitmap[priority >> 5] |= (1u << (priority & 31));
+}
+
+static inline void ready_bitmap_clear(cpu_t* cpu, uint32_t priority) {
+    cpu->ready_bitmap[priority >> 5] &= ~(1u << (priority & 31));
+}
+
+// Highest priority with a ready process, or -1 if all queues are empty
+static inline int ready_bitmap_first(cpu_t* cpu) {
+    for (int w = 0; w < PRIORITY_BITMAP_WORDS; w++) {
+        uint32_t word = cpu->ready_bitmap[w];
+        if (word) {
+            return (w << 5) + __builtin_ctz(word);
+        }
+    }
+    return -1;
+}
+
+// True if something strictly more important than 'priority' is ready.
+// Lockless: a stale answer only delays or repeats a scheduling decision.
+static inline bool higher_priority_ready(cpu_t* cpu, uint32_t priority) {
+    int first = ready_bitmap_first(cpu);
+    return first >= 0 && (uint32_t)first < priority;
+}
+
+// Whether another CPU may take this process off 'cpu'. Realtime and
+// pinned work stays put, and isolated CPUs neither give nor take.
+static inline bool process_stealable(cpu_t* cpu, process_t* process) {
+    return process->pinned_cpu < 0 &&
+           process->policy != SCHED_FIFO &&
+           process->policy != SCHED_DEADLINE &&
+           process->priority >= STEAL_MIN_PRIORITY &&
+           !cpu->isolated;
+}
+
+static inline uint32_t steal_entry(process_t* process) {
+    return STEAL_ENTRY(process - process_table, process->steal_gen);
+}
+
+// An entry is live while its process is still queued on 'cpu' from the
+// enqueue that pushed it
+static bool steal_entry_live(cpu_t* cpu, uint32_t entry) {
+    uint32_t slot = STEAL_ENTRY_SLOT(entry);
+    if (slot >= MAX_PROCESSES) return false;
+    
+    process_t* process = &process_table[slot];
+    return process->on_runqueue && process->cpu == cpu->id && !process->on_cpu &&
+           STEAL_ENTRY_GEN(process->steal_gen) == STEAL_ENTRY_GEN(entry) &&
+           process_stealable(cpu, process);
+}
+
+// Drop dead entries from the owner end of the steal queue (cpu->rq_lock held).
+// Dead entries further up are discarded by whoever steals them.
+static void steal_queue_trim(cpu_t* cpu) {
+    uint32_t entry;
+    while ((entry = wsdeque_peek(&cpu->steal_queue)) != WSDEQUE_EMPTY &&
+           !steal_entry_live(cpu, entry)) {
+        wsdeque_pop(&cpu->steal_queue);
+    }
+}
+
+static inline bool is_deadline(process_t* process) {
+    return process->policy == SCHED_DEADLINE;
+}
+
+// Insert into the deadline queue, earliest absolute deadline first
+// (cpu->rq_lock held)
+static void dl_queue_insert(cpu_t* cpu, process_t* process) {
+    scheduler_queue_t* queue = &cpu->dl_queue;
+    process_t* pos = queue->head;
+    while (pos && pos->dl_abs_deadline <= process->dl_abs_deadline) {
+        pos = pos->next;
+    }
+    
+    if (!pos) {
+        queue_add_tail(queue, process);
+        return;
+    }
+    process->next = pos;
+    process->prev = pos->prev;
+    if (pos->prev) {
+        pos->prev->next = process;
+    } else {
+        queue->head = process;
+    }
+    pos->prev = process;
+    queue->count++;
+}
+
+// Earliest deadline process allowed to run now, or NULL. Throttled ones
+// whose next period has begun get their budget back on the way; their
+// deadline was already advanced, so the queue order holds (cpu->rq_lock held).
+static process_t* dl_first_runnable(cpu_t* cpu, uint64_t now) {
+    for (process_t* process = cpu->dl_queue.head; process; process = process->next) {
+        if (process->dl_throttled &&
+            now >= process->dl_abs_deadline - process->dl_deadline) {
+            process->dl_throttled = false;
+            process->dl_budget = process->dl_runtime;
+        }
+        if (!process->dl_throttled) {
+            return process;
+        }
+    }
+    return NULL;
+}
+
+// Charge the running deadline process for the time since its last charge
+static void dl_charge(process_t* process, uint64_t now) {
+    if (process->dl_since) {
+        process->dl_budget -= (int64_t)(now - process->dl_since);
+    }
+    process->dl_since = now;
+}
+
+// Advance a reservation by one period with a full budget. It may not run
+// again until that period starts (hard CBS reservation), unless it has
+// fallen so far behind that the period already began.
+static void dl_next_period(process_t* process, uint64_t now) {
+    process->dl_abs_deadline += process->dl_period;
+    process->dl_budget = process->dl_runtime;
+    if (process->dl_abs_deadline - process->dl_deadline <= now) {
+        process->dl_abs_deadline = now + process->dl_deadline;
+        process->dl_throttled = false;
+    } else {
+        process->dl_throttled = true;
+    }
+}
+
+// CBS wakeup rule: keep the current deadline only if the leftover budget
+// fits before it at the reserved bandwidth, otherwise start a fresh one
+static void dl_wakeup(process_t* process, uint64_t now) {
+    if (process->dl_throttled) {
+        return;     // Replenished when its period starts
+    }
+    
+    bool keep = false;
+    if (process->dl_abs_deadline > now && process->dl_budget > 0) {
+        uint64_t laxity = process->dl_abs_deadline - now;
+        keep = (uint64_t)process->dl_budget * process->dl_deadline <=
+               laxity * process->dl_runtime;
+    }
+    if (!keep) {
+        process->dl_abs_deadline = now + process->dl_deadline;
+        process->dl_budget = process->dl_runtime;
+    }
+    process->dl_job_deadline = process->dl_abs_deadline;
+}
+
+// Account a deadline process leaving the CPU, before it is requeued.
+// Yielding or blocking completes the current job; a yield also waits for
+// the next period. Being preempted with the budget spent is an overrun.
+static void dl_put_prev(process_t* process, bool job_done) {
+    uint64_t now = ktime_ns();
+    dl_charge(process, now);
+    process->dl_since = 0;
+    
+    if (job_done) {
+        process->dl_jobs++;
+        if (now > process->dl_job_deadline) {
+            process->dl_misses++;
+            __sync_fetch_and_add(&dl_stats.misses, 1);
+        }
+        if (process->state == PROCESS_RUNNING) {
+            dl_next_period(process, now);
+            process->dl_job_deadline = process->dl_abs_deadline;
+        }
+    } else if (process->dl_budget <= 0) {
+        process->dl_overruns++;
+        __sync_fetch_and_add(&dl_stats.overruns, 1);
+        dl_next_period(process, now);
+    }
+}
+
+static inline uint32_t ns_to_us_ceil(uint64_t ns) {
+    uint64_t us = div_u64_u32(ns + NSEC_PER_USEC - 1, NSEC_PER_USEC, NULL);
+    return (us >= TICK_NO_EVENT) ? TICK_NO_EVENT - 1 : (uint32_t)us;
+}
+
+// Microseconds until deadline scheduling needs this CPU to reschedule:
+// 0 if an earlier deadline is runnable or the running budget is spent
+// (cpu->rq_lock held)
+static uint32_t dl_next_event_us(cpu_t* cpu, process_t* current, uint64_t now) {
+    process_t* first = dl_first_runnable(cpu, now);
+    if (first && (!is_deadline(current) ||
+                  first->dl_abs_deadline < current->dl_abs_deadline)) {
+        return 0;
+    }
+    
+    uint32_t event = TICK_NO_EVENT;
+    if (is_deadline(current)) {
+        int64_t left = current->dl_budget;
+        if (current->dl_since) {
+            left -= (int64_t)(now - current->dl_since);
+        }
+        if (left <= 0) {
+            return 0;
+        }
+        event = ns_to_us_ceil((uint64_t)left);
+    }
+    
+    // Throttled reservations need a wakeup when their period starts
+    for (process_t* process = cpu->dl_queue.head; process; process = process->next) {
+        if (!process->dl_throttled) continue;
+        uint32_t us = ns_to_us_ceil(process->dl_abs_deadline - process->dl_deadline - now);
+        if (us < event) {
+            event = us;
+        }
+    }
+    return event;
+}
+
+static uint32_t dl_check(cpu_t* cpu, process_t* current) {
+    if (cpu->dl_queue.count == 0 && !is_deadline(current)) {
+        return TICK_NO_EVENT;
+    }
+    uint32_t flags = spin_lock_irqsave(&cpu->rq_lock);
+    uint32_t event = dl_next_event_us(cpu, current, ktime_ns());
+    spin_unlock_irqrestore(&cpu->rq_lock, flags);
+    return event;
+}
+
+// Run queue primitives (cpu->rq_lock held)
+static void rq_enqueue(cpu_t* cpu, process_t* process) {
+    if (is_deadline(process)) {
+        dl_queue_insert(cpu, process);
+    } else {
+        queue_add_tail(&cpu->ready_queues[process->priority], process);
+        ready_bitmap_set(cpu, process->priority);
+    }
+    process->on_runqueue = true;
+    process->cpu = cpu->id;
+    process->steal_gen++;
+    process->trace_enqueue_tsc = tsc_available() ? rdtsc() : 0;
+    cpu->nr_ready++;
+    
+    // A full steal queue only means this process is not offered this time
+    if (process_stealable(cpu, process)) {
+        if (!wsdeque_push(&cpu->steal_queue, steal_entry(process))) {
+            steal_queue_trim(cpu);
+            wsdeque_push(&cpu->steal_queue, steal_entry(process));
+        }
+    }
+}
+
+static void rq_dequeue(cpu_t* cpu, process_t* process) {
+    // A queued process always sits in the queue of its own priority
+    // (policy changes requeue, so the policy tells which set it is in)
+    if (is_deadline(process)) {
+        queue_remove(&cpu->dl_queue, process);
+    } else {
+        queue_remove(&cpu->ready_queues[process->priority], process);
+        if (cpu->ready_queues[process->priority].count == 0) {
+            ready_bitmap_clear(cpu, process->priority);
+        }
+    }
+    process->on_runqueue = false;
+    cpu->nr_ready--;
+}
 
 // Initialize scheduler
 void scheduler_init(void) {
-    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
-    vga_write_string("Initializing scheduler...\n");
+    klog(KLOG_INFO, "Initializing scheduler...\n");
     
     scheduler_enabled = true;
+    sched_trace_init();
     
-    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
-    vga_write_string("Priority-based scheduler initialized\n");
+    klog(KLOG_INFO, "Priority-based scheduler initialized\n");
 }
 
-// Main scheduler tick - called from timer interrupt
+// Empty run queues for one CPU
+void scheduler_init_cpu(cpu_t* cpu) {
+    spin_lock_init(&cpu->rq_lock);
+    for (int i = 0; i < NUM_PRIORITY_LEVELS; i++) {
+        queue_init(&cpu->ready_queues[i]);
+    }
+    memset(cpu->ready_bitmap, 0, sizeof(cpu->ready_bitmap));
+    queue_init(&cpu->dl_queue);
+    cpu->dl_bw = 0;
+    cpu->nr_ready = 0;
+    cpu->need_resched = false;
+    wsdeque_init(&cpu->steal_queue);
+}
+
+// Main scheduler tick - one timer period elapsed
 void scheduler_tick(void) {
-    if (!scheduler_enabled || !current_process) {
+    scheduler_account_ticks(1);
+}
+
+// Charge elapsed ticks to the current process and preempt if needed. In
+// tickless mode several ticks may have passed since the last interrupt.
+void scheduler_account_ticks(uint32_t ticks) {
+    cpu_t* cpu = this_cpu();
+    process_t* current = cpu->current;
+    if (!scheduler_enabled || !current) {
         return;
     }
     
     // Update current process CPU time
-    current_process->cpu_time++;
+    current->cpu_time += ticks;
     
     // Decrease remaining time slice for round-robin processes
-    if (current_process->policy == SCHED_RR && current_process->remaining_slice > 0) {
-        current_process->remaining_slice--;
+    if (current->policy == SCHED_RR) {
+        current->remaining_slice = (ticks >= current->remaining_slice) ?
+                                   0 : current->remaining_slice - ticks;
     }
     
-    // Check if current process should be preempted
-    bool should_preempt = false;
+    // Check if current process should be preempted (pinning and isolation
+    // changes ask for it explicitly). Deadline work outranks every fixed
+    // priority, and a spent budget ends the slot.
+    bool should_preempt = cpu->need_resched || dl_check(cpu, current) == 0;
     
     // Real-time processes run until completion or blocking
-    if (current_process->policy == SCHED_FIFO) {
+    if (current->policy == SCHED_FIFO) {
         // Check if higher priority process is ready
-        for (int i = 0; i < (int)current_process->priority; i++) {
-            if (ready_queues[i].count > 0) {
-                should_preempt = true;
-                break;
-            }
-        }
+        should_preempt |= higher_priority_ready(cpu, current->priority);
     }
     // Round-robin processes are preempted when time slice expires
-    else if (current_process->policy == SCHED_RR) {
-        if (current_process->remaining_slice == 0) {
-            should_preempt = true;
-        }
+    else if (current->policy == SCHED_RR) {
         // Also check for higher priority processes
-        for (int i = 0; i < (int)current_process->priority; i++) {
-            if (ready_queues[i].count > 0) {
-                should_preempt = true;
-                break;
-            }
-        }
+        should_preempt |= current->remaining_slice == 0 ||
+                          higher_priority_ready(cpu, current->priority);
     }
     
     if (should_preempt) {
@@ -66,45 +348,328 @@ void scheduler_tick(void) {
     }
 }
 
+// Microseconds until the scheduler needs to look at the current process
+// again: 0 if a preemption is already due, TICK_NO_EVENT if nothing can
+// change until some other event (wakeup, blocking) happens. pending_us is
+// time already elapsed but not yet charged through scheduler_account_ticks.
+uint32_t scheduler_next_event_us(uint32_t pending_us) {
+    cpu_t* cpu = this_cpu();
+    process_t* current = cpu->current;
+    if (!scheduler_enabled || !current) {
+        return TICK_NO_EVENT;
+    }
+    
+    if (cpu->need_resched ||
+        (!is_deadline(current) && higher_priority_ready(cpu, current->priority))) {
+        return 0;
+    }
+    
+    // Budget expiry, replenishments and earlier deadlines
+    uint32_t event = dl_check(cpu, current);
+    if (event == 0) {
+        return 0;
+    }
+    
+    // A slice only matters if someone of equal priority is waiting for it
+    if (current->policy == SCHED_RR &&
+        cpu->ready_queues[current->priority].count > 0) {
+        uint32_t slice_us = current->remaining_slice * TICK_PERIOD_US;
+        slice_us = (slice_us > pending_us) ? slice_us - pending_us : 0;
+        return (slice_us < event) ? slice_us : event;
+    }
+    
+    // SCHED_FIFO, or alone at its priority: only deadline events matter
+    return event;
+}
+
+// Take one live entry from a victim's steal queue and dequeue its process
+// there. Only the victim's lock is held, so two CPUs stealing from each
+// other cannot deadlock.
+static process_t* scheduler_steal_from(cpu_t* cpu, cpu_t* victim) {
+    int retries = STEAL_RETRIES;
+    
+    while (retries > 0) {
+        uint32_t entry = wsdeque_steal(&victim->steal_queue);
+        if (entry == WSDEQUE_EMPTY) {
+            return NULL;
+        }
+        if (entry == WSDEQUE_ABORT) {
+            retries--;
+            cpu_relax();
+            continue;
+        }
+        
+        uint32_t flags = spin_lock_irqsave(&victim->rq_lock);
+        process_t* process = NULL;
+        if (steal_entry_live(victim, entry)) {
+            process = &process_table[STEAL_ENTRY_SLOT(entry)];
+            rq_dequeue(victim, process);
+            process->cpu = cpu->id;
+        }
+        spin_unlock_irqrestore(&victim->rq_lock, flags);
+        
+        if (process) {
+            return process;
+        }
+        // Stale entry: it has been run, requeued or repinned since
+    }
+    return NULL;
+}
+
+// Look for work on the other CPUs, starting after our own so thieves
+// spread over different victims
+static process_t* scheduler_steal(cpu_t* cpu) {
+    if (cpu->isolated) {
+        return NULL;
+    }
+    cpu->steal_attempts++;
+    
+    for (uint32_t i = 1; i < MAX_CPUS; i++) {
+        cpu_t* victim = &cpus[(cpu->id + i) % MAX_CPUS];
+        if (!victim->online || victim->isolated ||
+            wsdeque_size(&victim->steal_queue) <= 0) {
+            continue;
+        }
+        
+        process_t* process = scheduler_steal_from(cpu, victim);
+        if (process) {
+            cpu->steals++;
+            return process;
+        }
+    }
+    return NULL;
+}
+
 // Pick next process to run using priority-based scheduling
 process_t* scheduler_pick_next(void) {
-    // First check real-time and high priority processes
-    for (int priority = PRIORITY_REALTIME; priority <= PRIORITY_IDLE; priority++) {
-        if (ready_queues[priority].count > 0) {
-            process_t* next = queue_remove_head(&ready_queues[priority]);
-            if (next) {
-                return next;
-            }
-        }
+    cpu_t* cpu = this_cpu();
+    process_t* next = NULL;
+    
+    uint32_t flags = spin_lock_irqsave(&cpu->rq_lock);
+    // Earliest runnable deadline first, then find-first-set on the ready
+    // bitmap gives the best fixed-priority queue directly
+    int priority = ready_bitmap_first(cpu);
+    if (cpu->dl_queue.count > 0 && (next = dl_first_runnable(cpu, ktime_ns())) != NULL) {
+        rq_dequeue(cpu, next);
+    } else if (priority >= 0) {
+        next = cpu->ready_queues[priority].head;
+        rq_dequeue(cpu, next);
+        steal_queue_trim(cpu);
+    }
+    spin_unlock_irqrestore(&cpu->rq_lock, flags);
+    
+    // Nothing local: help a busy CPU before falling back to idle
+    if (!next) {
+        next = scheduler_steal(cpu);
+    }
+    
+    return next ? next : cpu->idle;
+}
+
+// CPU whose run queue a runnable process belongs on. Pinned processes go
+// to their CPU; others stay where they last ran unless that CPU has been
+// isolated, and new ones start on the least loaded non-isolated CPU.
+static cpu_t* scheduler_select_cpu(process_t* process) {
+    if (process->pinned_cpu >= 0) {
+        return &cpus[process->pinned_cpu];
     }
     
-    // If no processes are ready, return idle process
-    return idle_process;
+    cpu_t* last = &cpus[process->cpu];
+    if (process->context_switches > 0 && last->online && !last->isolated) {
+        return last;
+    }
+    
+    cpu_t* best = NULL;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        cpu_t* cpu = &cpus[i];
+        if (!cpu->online || cpu->isolated) continue;
+        if (!best || cpu->nr_ready < best->nr_ready) {
+            best = cpu;
+        }
+    }
+    return best ? best : &cpus[BOOT_CPU];
+}
+
+// Ask a CPU to run the scheduler as soon as possible
+static void scheduler_kick_cpu(cpu_t* cpu) {
+    cpu->need_resched = true;
+    if (cpu == this_cpu()) {
+        tick_reprogram();
+    } else {
+        smp_send_resched(cpu->id);
+    }
+}
+
+// An idle CPU that could take stealable work queued behind a busy one
+static cpu_t* scheduler_find_idle_cpu(cpu_t* busy) {
+    for (uint32_t i = 1; i < MAX_CPUS; i++) {
+        cpu_t* cpu = &cpus[(busy->id + i) % MAX_CPUS];
+        if (cpu->online && !cpu->isolated && !cpu->need_resched &&
+            cpu->current == cpu->idle && cpu->nr_ready == 0) {
+            return cpu;
+        }
+    }
+    return NULL;
 }
 
 // Add process to appropriate ready queue
 void scheduler_add_process(process_t* process) {
-    if (!process || process->state != PROCESS_READY) {
+    if (!process || process->state != PROCESS_READY || process->on_runqueue) {
         return;
     }
     
+    // Idle processes are picked when the queues are empty, never queued
+    if (process == cpus[process->cpu].idle) {
+        return;
+    }
+    
+    if ((uint32_t)process->priority >= NUM_PRIORITY_LEVELS) {
+        process->priority = PRIORITY_IDLE;
+    }
+    
     // Reset time slice for round-robin processes
     if (process->policy == SCHED_RR) {
         process->remaining_slice = process->time_slice;
     }
     
+    cpu_t* target = scheduler_select_cpu(process);
+    cpu_t* home = &cpus[process->cpu];
+    
+    // A process still switching out may only be queued on its own CPU:
+    // anywhere else it could be resumed before its context is saved.
+    // Its CPU requeues it from scheduler_finish_switch instead.
+    uint32_t flags = spin_lock_irqsave(&home->rq_lock);
+    if (process->on_cpu && target != home) {
+        process->migrate_pending = true;
+        spin_unlock_irqrestore(&home->rq_lock, flags);
+        return;
+    }
+    if (target != home) {
+        spin_unlock(&home->rq_lock);
+        spin_lock(&target->rq_lock);
+    }
+    
+    // Anything not coming straight off a CPU is a wakeup for CBS
+    if (is_deadline(process) && !process->on_cpu) {
+        dl_wakeup(process, ktime_ns());
+    }
+    
     // Add to priority queue
-    queue_add_tail(&ready_queues[process->priority], process);
+    rq_enqueue(target, process);
+    process_t* running = target->current;
+    bool kick = !running || running == target->idle || is_deadline(process) ||
+                process->priority <= running->priority;
+    bool waiting = running && running != target->idle && process_stealable(target, process);
+    spin_unlock_irqrestore(&target->rq_lock, flags);
+    
+    // Queued behind a running process: let an idle CPU steal it instead
+    if (waiting) {
+        cpu_t* idle = scheduler_find_idle_cpu(target);
+        if (idle) {
+            scheduler_kick_cpu(idle);
+        }
+    }
+    
+    // A newly runnable process may need an earlier preemption or slice tick
+    if (target == this_cpu()) {
+        if (process != current_process) {
+            tick_reprogram();
+        }
+    } else if (kick) {
+        smp_send_resched(target->id);
+    }
 }
 
 // Remove process from scheduler queues
 void scheduler_remove_process(process_t* process) {
     if (!process) return;
     
-    // Remove from ready queues
-    for (int i = 0; i < 5; i++) {
-        queue_remove(&ready_queues[i], process);
+    // process->cpu only changes under the lock of the queue it joins
+    while (process->on_runqueue) {
+        cpu_t* cpu = &cpus[process->cpu];
+        uint32_t flags = spin_lock_irqsave(&cpu->rq_lock);
+        bool queued_here = process->on_runqueue && process->cpu == cpu->id;
+        if (queued_here) {
+            rq_dequeue(cpu, process);
+        }
+        spin_unlock_irqrestore(&cpu->rq_lock, flags);
+        if (queued_here) break;
+    }
+}
+
+// Count ready processes with priority in [first_priority, last_priority]
+// across all CPUs (lockless snapshot)
+uint32_t scheduler_count_ready(int first_priority, int last_priority) {
+    uint32_t count = 0;
+    
+    if (first_priority < 0) first_priority = 0;
+    if (last_priority >= NUM_PRIORITY_LEVELS) last_priority = NUM_PRIORITY_LEVELS - 1;
+    
+    for (uint32_t c = 0; c < MAX_CPUS; c++) {
+        if (!cpus[c].online) continue;
+        for (int i = first_priority; i <= last_priority; i++) {
+            count += cpus[c].ready_queues[i].count;
+        }
     }
+    return count;
+}
+
+// Runs on the incoming stack once the previous process's context is saved
+// (also the first thing a new process does, via process_entry_trampoline)
+void scheduler_finish_switch(process_t* prev) {
+    if (!prev) return;
+    
+    cpu_t* cpu = &cpus[prev->cpu];
+    uint32_t flags = spin_lock_irqsave(&cpu->rq_lock);
+    prev->on_cpu = false;
+    bool migrate = prev->migrate_pending;
+    prev->migrate_pending = false;
+    spin_unlock_irqrestore(&cpu->rq_lock, flags);
+    
+    // Its new home CPU can take it now
+    if (migrate) {
+        scheduler_add_process(prev);
+    }
+}
+
+// Switch to the best ready process. The caller has already requeued the
+// old process if it is still runnable; interrupts are off.
+static void scheduler_switch(process_t* old_process) {
+    cpu_t* cpu = this_cpu();
+    cpu->need_resched = false;
+    
+    // Pick next process
+    process_t* next_process = scheduler_pick_next();
+    if (is_deadline(next_process)) {
+        next_process->dl_since = ktime_ns();
+    }
+    if (next_process == old_process) {
+        // Nobody better to run: keep going with a fresh slice
+        process_set_state(old_process, PROCESS_RUNNING);
+        tick_reprogram();
+        return;
+    }
+    
+    process_set_state(next_process, PROCESS_RUNNING);
+    next_process->on_cpu = true;
+    next_process->cpu = cpu->id;
+    cpu->current = next_process;
+    vdso_set_current(cpu->id, next_process);
+    next_process->last_run_time = get_current_time_ms();
+    tick_reprogram();
+    
+    // Update statistics
+    cpu->context_switches++;
+    __sync_fetch_and_add(&proc_stats.context_switches, 1);
+    old_process->context_switches++;
+    next_process->context_switches++;
+    
+    // Perform context switch; we resume here when switched back to
+    sched_trace_switch(cpu, old_process, next_process);
+    pmu_switch(old_process);
+    fpu_switch(old_process, next_process);
+    process_t* prev = context_switch(old_process, next_process);
+    scheduler_finish_switch(prev);
 }
 
 // Voluntary yield - process gives up CPU
@@ -113,28 +678,21 @@ void scheduler_yield(void) {
         return;
     }
     
+    uint32_t flags = irq_save();
     process_t* old_process = current_process;
     
+    // A deadline process yielding or blocking has finished its job
+    if (is_deadline(old_process)) {
+        dl_put_prev(old_process, true);
+    }
+    
     // If current process is still ready, add it back to queue
     if (old_process->state == PROCESS_RUNNING) {
         process_set_state(old_process, PROCESS_READY);
     }
     
-    // Pick next process
-    process_t* next_process = scheduler_pick_next();
-    if (next_process && next_process != old_process) {
-        process_set_state(next_process, PROCESS_RUNNING);
-        current_process = next_process;
-        next_process->last_run_time = get_current_time_ms();
-        
-        // Perform context switch
-        context_switch(old_process, next_process);
-        
-        // Update statistics
-        proc_stats.context_switches++;
-        old_process->context_switches++;
-        next_process->context_switches++;
-    }
+    scheduler_switch(old_process);
+    irq_restore(flags);
 }
 
 // Forced preemption - scheduler forces context switch
@@ -143,27 +701,239 @@ void scheduler_preempt(void) {
         return;
     }
     
+    uint32_t flags = irq_save();
     process_t* old_process = current_process;
     
+    if (is_deadline(old_process)) {
+        dl_put_prev(old_process, false);
+    }
+    
     // Move current process back to ready queue if still runnable
     if (old_process->state == PROCESS_RUNNING) {
         process_set_state(old_process, PROCESS_READY);
     }
     
-    // Pick next process
-    process_t* next_process = scheduler_pick_next();
-    if (next_process) {
-        process_set_state(next_process, PROCESS_RUNNING);
-        current_process = next_process;
-        next_process->last_run_time = get_current_time_ms();
+    scheduler_switch(old_process);
+    irq_restore(flags);
+}
+
+// Pin a process to one CPU, or let it run anywhere with cpu = -1
+int scheduler_set_affinity(process_t* process, int32_t cpu) {
+    if (!process || process == cpus[process->cpu].idle) return -1;
+    if (cpu >= 0 && ((uint32_t)cpu >= MAX_CPUS || !cpus[cpu].online)) return -1;
+    
+    // A deadline reservation lives on one CPU; moving it needs room there
+    if (is_deadline(process) && cpu != process->pinned_cpu) {
+        if (cpu < 0) return -1;
         
-        // Perform context switch
-        context_switch(old_process, next_process);
+        uint32_t flags = spin_lock_irqsave(&dl_admit_lock);
+        bool fits = cpus[cpu].dl_bw + process->dl_bw <= DL_BW_LIMIT;
+        if (fits) {
+            cpus[process->pinned_cpu].dl_bw -= process->dl_bw;
+            cpus[cpu].dl_bw += process->dl_bw;
+        }
+        spin_unlock_irqrestore(&dl_admit_lock, flags);
+        if (!fits) return -1;
+    }
+    
+    process->pinned_cpu = cpu;
+    
+    if (process->on_runqueue) {
+        // Requeue through placement
+        scheduler_remove_process(process);
+        scheduler_add_process(process);
+    } else if (process->state == PROCESS_RUNNING && cpu >= 0 && process->cpu != (uint32_t)cpu) {
+        // Its switch-out will send it to the new CPU
+        scheduler_kick_cpu(&cpus[process->cpu]);
+    }
+    return 0;
+}
+
+// Send every queued process that is not pinned to 'cpu' elsewhere, and
+// kick the running one if it does not belong there either
+void scheduler_evict_unpinned(cpu_t* cpu) {
+    scheduler_queue_t evicted;
+    queue_init(&evicted);
+    
+    uint32_t flags = spin_lock_irqsave(&cpu->rq_lock);
+    for (int i = 0; i < NUM_PRIORITY_LEVELS; i++) {
+        process_t* process = cpu->ready_queues[i].head;
+        while (process) {
+            process_t* next = process->next;
+            if (process->pinned_cpu != (int32_t)cpu->id) {
+                rq_dequeue(cpu, process);
+                queue_add_tail(&evicted, process);
+            }
+            process = next;
+        }
+    }
+    process_t* running = cpu->current;
+    bool kick = running && running != cpu->idle && running->pinned_cpu != (int32_t)cpu->id;
+    spin_unlock_irqrestore(&cpu->rq_lock, flags);
+    
+    process_t* process;
+    while ((process = queue_remove_head(&evicted)) != NULL) {
+        scheduler_add_process(process);
+    }
+    
+    if (kick) {
+        scheduler_kick_cpu(cpu);
+    }
+}
+
+// Reserve 'runtime_us' of CPU time every 'period_us', due 'deadline_us'
+// after each release (0 = the period). The reservation is bound to one CPU:
+// the one the process is pinned to, else it is pinned to the first CPU
+// that passes admission control. Calling it again changes the parameters.
+int scheduler_set_deadline(process_t* process, uint32_t runtime_us,
+                           uint32_t deadline_us, uint32_t period_us) {
+    if (!process || process == cpus[process->cpu].idle) return -1;
+    if (deadline_us == 0) deadline_us = period_us;
+    if (runtime_us == 0 || runtime_us > deadline_us || deadline_us > period_us ||
+        period_us < DL_MIN_PERIOD_US || period_us > DL_MAX_PERIOD_US) {
+        return -1;
+    }
+    
+    uint32_t runtime = runtime_us * NSEC_PER_USEC;
+    uint32_t deadline = deadline_us * NSEC_PER_USEC;
+    uint32_t bw = (uint32_t)div_u64_u32((uint64_t)runtime << DL_BW_SHIFT, deadline, NULL);
+    bool was_deadline = is_deadline(process);
+    
+    // Admission control: the CPU's reservations must stay under the limit
+    uint32_t flags = spin_lock_irqsave(&dl_admit_lock);
+    cpu_t* target = NULL;
+    for (uint32_t i = 0; i < MAX_CPUS && !target; i++) {
+        cpu_t* cpu = &cpus[i];
+        if (process->pinned_cpu >= 0 && i != (uint32_t)process->pinned_cpu) continue;
+        if (!cpu->online || (cpu->isolated && process->pinned_cpu < 0)) continue;
         
-        // Update statistics
-        proc_stats.context_switches++;
-        old_process->context_switches++;
-        next_process->context_switches++;
+        uint32_t used = cpu->dl_bw;
+        if (was_deadline && i == (uint32_t)process->pinned_cpu) {
+            used -= process->dl_bw;     // Replacing its own reservation
+        }
+        if (used + bw <= DL_BW_LIMIT) {
+            target = cpu;
+        }
+    }
+    if (target) {
+        if (was_deadline) {
+            cpus[process->pinned_cpu].dl_bw -= process->dl_bw;
+        }
+        target->dl_bw += bw;
+        dl_stats.admitted++;
+    } else {
+        dl_stats.rejected++;
+    }
+    spin_unlock_irqrestore(&dl_admit_lock, flags);
+    if (!target) return -1;
+    
+    // Policy decides which queue a process is in: take it off first
+    bool queued = process->on_runqueue;
+    scheduler_remove_process(process);
+    
+    if (!was_deadline) {
+        process->dl_prev_policy = process->policy;
+    }
+    process->dl_runtime = runtime;
+    process->dl_deadline = deadline;
+    process->dl_period = period_us * NSEC_PER_USEC;
+    process->dl_bw = bw;
+    process->dl_throttled = false;
+    process->dl_jobs = 0;
+    process->dl_misses = 0;
+    process->dl_overruns = 0;
+    
+    // First job is released now
+    uint64_t now = ktime_ns();
+    process->dl_abs_deadline = now + deadline;
+    process->dl_job_deadline = process->dl_abs_deadline;
+    process->dl_budget = runtime;
+    process->dl_since = (process == current_process) ? now : 0;
+    process->policy = SCHED_DEADLINE;
+    
+    process->pinned_cpu = target->id;
+    if (queued) {
+        scheduler_add_process(process);
+    } else if (process->state == PROCESS_RUNNING && process->cpu != target->id) {
+        // Its switch-out will send it to the reservation's CPU
+        scheduler_kick_cpu(&cpus[process->cpu]);
+    }
+    return 0;
+}
+
+// Drop a deadline reservation and return to the previous policy. The
+// process stays pinned where the reservation was.
+int scheduler_clear_deadline(process_t* process) {
+    if (!process || !is_deadline(process)) return -1;
+    
+    uint32_t flags = spin_lock_irqsave(&dl_admit_lock);
+    cpus[process->pinned_cpu].dl_bw -= process->dl_bw;
+    spin_unlock_irqrestore(&dl_admit_lock, flags);
+    
+    bool queued = process->on_runqueue;
+    scheduler_remove_process(process);
+    process->policy = process->dl_prev_policy;
+    process->dl_bw = 0;
+    process->dl_throttled = false;
+    process->dl_since = 0;
+    if (queued) {
+        scheduler_add_process(process);
+    }
+    return 0;
+}
+
+void scheduler_get_dl_stats(scheduler_dl_stats_t* stats) {
+    if (!stats) return;
+    *stats = dl_stats;
+}
+
+// Print deadline reservations and their miss counters
+void scheduler_print_deadline_info(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Deadline Scheduling ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    
+    vga_write_string("Admitted: ");
+    print_dec(dl_stats.admitted);
+    vga_write_string("  Rejected: ");
+    print_dec(dl_stats.rejected);
+    vga_write_string("  Misses: ");
+    print_dec(dl_stats.misses);
+    vga_write_string("  Overruns: ");
+    print_dec(dl_stats.overruns);
+    vga_write_string("\n");
+    
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (!cpus[i].online || cpus[i].dl_bw == 0) continue;
+        vga_write_string("CPU ");
+        print_dec(i);
+        vga_write_string(" bandwidth: ");
+        print_dec((uint32_t)(((uint64_t)cpus[i].dl_bw * 100) >> DL_BW_SHIFT));
+        vga_write_string("%\n");
+    }
+    
+    vga_write_string("PID  RUNTIME  DEADLINE  PERIOD (us)  JOBS  MISSES  OVERRUNS  NAME\n");
+    for (int i = 0; i < MAX_PROCESSES; i++) {
+        process_t* process = &process_table[i];
+        if (!is_deadline(process) || process->state == PROCESS_TERMINATED) continue;
+        print_dec(process->pid);
+        vga_write_string("    ");
+        print_dec(process->dl_runtime / NSEC_PER_USEC);
+        vga_write_string("       ");
+        print_dec(process->dl_deadline / NSEC_PER_USEC);
+        vga_write_string("        ");
+        print_dec(process->dl_period / NSEC_PER_USEC);
+        vga_write_string("          ");
+        print_dec(process->dl_jobs);
+        vga_write_string("     ");
+        if (process->dl_misses) vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        print_dec(process->dl_misses);
+        vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+        vga_write_string("       ");
+        print_dec(process->dl_overruns);
+        vga_write_string("         ");
+        vga_write_string(process->name);
+        vga_write_string("\n");
     }
 }
 
@@ -185,15 +955,15 @@ void print_scheduler_info(void) {
     
     vga_write_string("Ready queue counts:\n");
     vga_write_string("  Real-time: ");
-    print_number(ready_queues[PRIORITY_REALTIME].count);
+    print_number(scheduler_count_ready(PRIORITY_REALTIME, PRIORITY_HIGH - 1));
     vga_write_string("\n  High:      ");
-    print_number(ready_queues[PRIORITY_HIGH].count);
+    print_number(scheduler_count_ready(PRIORITY_HIGH, PRIORITY_NORMAL - 1));
     vga_write_string("\n  Normal:    ");
-    print_number(ready_queues[PRIORITY_NORMAL].count);
+    print_number(scheduler_count_ready(PRIORITY_NORMAL, PRIORITY_LOW - 1));
     vga_write_string("\n  Low:       ");
-    print_number(ready_queues[PRIORITY_LOW].count);
+    print_number(scheduler_count_ready(PRIORITY_LOW, PRIORITY_IDLE - 1));
     vga_write_string("\n  Idle:      ");
-    print_number(ready_queues[PRIORITY_IDLE].count);
+    print_number(scheduler_count_ready(PRIORITY_IDLE, PRIORITY_IDLE));
     vga_write_string("\n");
     
     vga_write_string("Total context switches: ");
@@ -305,11 +1075,13 @@ void scheduler_show_stats(void) {
     vga_write_string("N/A\n");
     vga_write_string("Active processes per priority:\n");
     
-    for (int i = 0; i < 5; i++) {
+    for (int i = 0; i < NUM_PRIORITY_LEVELS; i++) {
+        uint32_t count = scheduler_count_ready(i, i);
+        if (count == 0) continue;
         vga_write_string("Priority ");
         print_dec(i);
         vga_write_string(": ");
-        print_dec(ready_queues[i].count);
+        print_dec(count);
         vga_write_string(" processes\n");
     }
 }
\ No newline at end of file
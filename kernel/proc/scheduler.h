@@ -4,28 +4,40 @@
 #include "../types.h"
 #include "process.h"
 
-// Scheduling policies
-#define SCHED_FIFO      0   // First In, First Out (non-preemptive within priority)
-#define SCHED_RR        1   // Round Robin (preemptive)
-#define SCHED_CFS       2   // Completely Fair Scheduler (not implemented)
+// Scheduling policies are sched_policy_t in process.h
+
+// Deadline scheduling. Bandwidth is runtime / relative deadline, fixed
+// point with DL_BW_UNIT = one CPU; admission keeps each CPU's sum below
+// DL_BW_LIMIT_PERCENT so fixed-priority work is never starved outright.
+#define DL_BW_SHIFT             20
+#define DL_BW_UNIT              (1u << DL_BW_SHIFT)
+#define DL_BW_LIMIT_PERCENT     95
+#define DL_BW_LIMIT             (DL_BW_UNIT / 100 * DL_BW_LIMIT_PERCENT)
+#define DL_MIN_PERIOD_US        10
+#define DL_MAX_PERIOD_US        1000000
 
 // Time slice configuration
 #define DEFAULT_TIME_SLICE  10  // 10 timer ticks
 #define MIN_TIME_SLICE      1   
 #define MAX_TIME_SLICE      100
 
-// Load balancing
-#define LOAD_BALANCE_INTERVAL   100  // Timer ticks between load balancing
-
 // Scheduler statistics
 typedef struct {
     uint32_t total_switches;
     uint32_t preemptions;
     uint32_t idle_time;
-    uint32_t load_balance_runs;
-    uint32_t queue_lengths[5]; // NUM_PRIORITY_LEVELS from process.h
+    uint32_t steals;             // Work stolen by idle CPUs
+    uint32_t queue_lengths[NUM_PRIORITY_LEVELS];
 } scheduler_stats_t;
 
+// Deadline scheduling statistics
+typedef struct {
+    uint32_t admitted;          // Reservations accepted
+    uint32_t rejected;          // Reservations refused by admission control
+    uint32_t misses;            // Jobs completed after their deadline
+    uint32_t overruns;          // Budgets exhausted before the job completed
+} scheduler_dl_stats_t;
+
 // Use scheduler_queue_t from process.h
 
 // Scheduler functions
@@ -40,12 +52,13 @@ void scheduler_disable(void);
 process_t* scheduler_pick_next(void);
 void scheduler_update_load_average(void);
 void scheduler_show_stats(void);
+void scheduler_get_dl_stats(scheduler_dl_stats_t* stats);
+void scheduler_print_deadline_info(void);
 
 // Queue management functions are in process.h
 
-// Load balancing functions
-void balance_queues(void);
-void migrate_process(process_t* process, int new_priority);
+// Load balancing is done by idle CPUs stealing from busy ones in
+// scheduler_pick_next (see STEAL_MIN_PRIORITY in process.h)
 
 // Real-time scheduling support
 void scheduler_set_realtime_mode(int enabled);
@@ -0,0 +1,252 @@
+#include "sequencer.h"
+#include "futex.h"
+#include "process.h"
+#include "../mm/memory.h"
+#include "../arch/cpu.h"
+#include "../drivers/vga.h"
+
+sequencer_t* seq_create(const char* name, uint32_t slots, uint32_t slot_size) {
+    if (slots == 0 || slots > 0x10000000 || slot_size == 0) return NULL;
+
+    uint32_t size = 1;
+    while (size < slots) {
+        size <<= 1;
+    }
+    slot_size = (slot_size + CACHE_LINE_SIZE - 1) & ~(uint32_t)(CACHE_LINE_SIZE - 1);
+
+    sequencer_t* seq = kmalloc_aligned(sizeof(sequencer_t), CACHE_LINE_SIZE);
+    if (!seq) return NULL;
+    memset(seq, 0, sizeof(sequencer_t));
+
+    seq->slots = kmalloc_coloured(size * slot_size);
+    if (!seq->slots) {
+        kfree_aligned(seq);
+        return NULL;
+    }
+    seq->size = size;
+    seq->mask = size - 1;
+    seq->slot_size = slot_size;
+    seq->name = name;
+    spin_lock_init(&seq->lock);
+    return seq;
+}
+
+void seq_destroy(sequencer_t* seq) {
+    if (!seq) return;
+    kfree_aligned(seq->slots);
+    kfree_aligned(seq);
+}
+
+// Wait while *word == seen, until the deadline (-1 once it has passed).
+// The spin comes before the sleeper count, so wakers skip futex_wake while
+// the waiter is only spinning. Wakers store the word, fence and then look
+// at sleepers, so either they see the count or futex_wait sees the new
+// value.
+static int seq_sleep(sequencer_t* seq, volatile uint32_t* word, uint32_t seen,
+                     uint32_t timeout_ms, uint32_t deadline) {
+    uint32_t wait = FUTEX_WAIT_FOREVER;
+    if (timeout_ms != FUTEX_WAIT_FOREVER) {
+        int32_t remaining = (int32_t)(deadline - get_current_time_ms());
+        if (remaining <= 0) return -1;
+        wait = (uint32_t)remaining;
+    }
+    if (futex_spin(word, seen)) return 0;
+    __sync_fetch_and_add(&seq->sleepers, 1);
+    int result = futex_wait(word, seen, wait);
+    __sync_fetch_and_sub(&seq->sleepers, 1);
+    return result;
+}
+
+static void seq_wake(sequencer_t* seq, volatile uint32_t* word) {
+    __sync_synchronize();
+    if (seq->sleepers) {
+        futex_wake(word, FUTEX_WAKE_ALL);
+    }
+}
+
+// The consumer furthest behind 'from' among 'mask', or NULL if none is
+// behind 'bound' (distances are taken from 'from', so wrap is harmless)
+static seq_consumer_t* seq_slowest(sequencer_t* seq, uint32_t mask, uint32_t from,
+                                   uint32_t* bound) {
+    seq_consumer_t* slowest = NULL;
+    for (uint32_t i = 0; mask; i++, mask >>= 1) {
+        if (!(mask & 1)) continue;
+        uint32_t sequence = load_acquire(&seq->consumer[i].sequence);
+        if (*bound - from > sequence - from) {
+            *bound = sequence;
+            slowest = &seq->consumer[i];
+        }
+    }
+    return slowest;
+}
+
+int seq_subscribe(sequencer_t* seq, uint32_t depends) {
+    uint32_t flags = spin_lock_irqsave(&seq->lock);
+    if (depends & ~seq->active) {
+        spin_unlock_irqrestore(&seq->lock, flags);
+        return -1;
+    }
+
+    int id = -1;
+    for (int i = 0; i < SEQ_MAX_CONSUMERS; i++) {
+        if (!(seq->active & (1u << i))) {
+            id = i;
+            break;
+        }
+    }
+    if (id >= 0) {
+        // Start at the next slot published, or where the slowest
+        // dependency is, since slots before it are still its to finish
+        seq_consumer_t* consumer = &seq->consumer[id];
+        uint32_t start = load_acquire(&seq->cursor);
+        uint32_t from = start - seq->size;
+        seq_slowest(seq, depends, from, &start);
+        consumer->sequence = start;
+        consumer->limit_cache = start;
+        consumer->depends = depends;
+        consumer->reads = 0;
+        consumer->waits = 0;
+        store_release(&seq->active, seq->active | (1u << id));
+    }
+    spin_unlock_irqrestore(&seq->lock, flags);
+    return id;
+}
+
+void seq_unsubscribe(sequencer_t* seq, int consumer) {
+    if (consumer < 0 || consumer >= SEQ_MAX_CONSUMERS) return;
+
+    uint32_t flags = spin_lock_irqsave(&seq->lock);
+    uint32_t bit = 1u << consumer;
+    store_release(&seq->active, seq->active & ~bit);
+    for (int i = 0; i < SEQ_MAX_CONSUMERS; i++) {
+        seq->consumer[i].depends &= ~bit;
+    }
+    spin_unlock_irqrestore(&seq->lock, flags);
+
+    // A producer or dependent may be asleep on its sequence: move it, so
+    // one about to sleep does not either
+    seq->consumer[consumer].sequence++;
+    seq_wake(seq, &seq->consumer[consumer].sequence);
+}
+
+// Producer's gate: the slowest consumer, or the cursor with none
+static uint32_t seq_gate(sequencer_t* seq, seq_consumer_t** slowest) {
+    uint32_t gate = seq->cursor;
+    *slowest = seq_slowest(seq, seq->active, seq->next - seq->size, &gate);
+    return gate;
+}
+
+void* seq_claim(sequencer_t* seq, uint32_t* sequence) {
+    uint32_t next = seq->next;
+    if (next - seq->gate_cache >= seq->size) {
+        seq_consumer_t* slowest;
+        seq->gate_cache = seq_gate(seq, &slowest);
+        if (next - seq->gate_cache >= seq->size) {
+            seq->gated++;
+            return NULL;
+        }
+    }
+    seq->next = next + 1;
+    *sequence = next;
+    return seq_slot(seq, next);
+}
+
+void* seq_claim_wait(sequencer_t* seq, uint32_t* sequence, uint32_t timeout_ms) {
+    uint32_t deadline = get_current_time_ms() + timeout_ms;
+    while (1) {
+        void* slot = seq_claim(seq, sequence);
+        if (slot) return slot;
+
+        seq_consumer_t* slowest;
+        uint32_t gate = seq_gate(seq, &slowest);
+        if (seq->next - gate < seq->size) continue;     // Moved meanwhile
+        if (!slowest) return NULL;      // Full of our own unpublished claims
+        if (seq_sleep(seq, &slowest->sequence, gate, timeout_ms, deadline) != 0) {
+            return NULL;
+        }
+    }
+}
+
+void seq_publish(sequencer_t* seq, uint32_t sequence) {
+    store_release(&seq->cursor, sequence + 1);
+    seq->published++;
+    seq_wake(seq, &seq->cursor);
+}
+
+// What holds this consumer back: the cursor, or its slowest dependency
+static uint32_t seq_limit(sequencer_t* seq, seq_consumer_t* consumer,
+                          volatile uint32_t** word) {
+    uint32_t limit = load_acquire(&seq->cursor);
+    seq_consumer_t* slowest = seq_slowest(seq, consumer->depends & seq->active,
+                                          consumer->sequence, &limit);
+    *word = slowest ? &slowest->sequence : &seq->cursor;
+    return limit;
+}
+
+uint32_t seq_available(sequencer_t* seq, int consumer, uint32_t* sequence) {
+    seq_consumer_t* self = &seq->consumer[consumer];
+    uint32_t next = self->sequence;
+    if (self->limit_cache == next) {
+        volatile uint32_t* word;
+        self->limit_cache = seq_limit(seq, self, &word);
+    }
+    *sequence = next;
+    return self->limit_cache - next;
+}
+
+uint32_t seq_wait(sequencer_t* seq, int consumer, uint32_t* sequence, uint32_t timeout_ms) {
+    seq_consumer_t* self = &seq->consumer[consumer];
+    uint32_t deadline = get_current_time_ms() + timeout_ms;
+    while (1) {
+        uint32_t count = seq_available(seq, consumer, sequence);
+        if (count) return count;
+
+        volatile uint32_t* word;
+        uint32_t limit = seq_limit(seq, self, &word);
+        if (limit != self->sequence) continue;
+        self->waits++;
+        if (seq_sleep(seq, word, limit, timeout_ms, deadline) != 0) {
+            return 0;
+        }
+    }
+}
+
+void seq_release(sequencer_t* seq, int consumer, uint32_t count) {
+    seq_consumer_t* self = &seq->consumer[consumer];
+    store_release(&self->sequence, self->sequence + count);
+    self->reads += count;
+    seq_wake(seq, &self->sequence);
+}
+
+void seq_print_info(sequencer_t* seq) {
+    if (!seq) return;
+
+    vga_write_string(seq->name);
+    vga_write_string(": ");
+    print_dec(seq->size);
+    vga_write_string(" slots of ");
+    print_dec(seq->slot_size);
+    vga_write_string(" B  Published ");
+    print_dec(seq->published);
+    vga_write_string("  Gated ");
+    print_dec(seq->gated);
+    vga_write_string("\n");
+
+    for (int i = 0; i < SEQ_MAX_CONSUMERS; i++) {
+        if (!(seq->active & (1u << i))) continue;
+        seq_consumer_t* consumer = &seq->consumer[i];
+        vga_write_string("  Consumer ");
+        print_dec(i);
+        vga_write_string(": behind ");
+        print_dec(seq->cursor - consumer->sequence);
+        vga_write_string("  Read ");
+        print_dec(consumer->reads);
+        vga_write_string("  Waits ");
+        print_dec(consumer->waits);
+        if (consumer->depends) {
+            vga_write_string("  After ");
+            print_hex(consumer->depends);
+        }
+        vga_write_string("\n");
+    }
+}
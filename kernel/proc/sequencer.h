@@ -0,0 +1,79 @@
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include "../types.h"
+#include "../arch/spinlock.h"
+
+// Single-writer, multi-reader ring in the style of the LMAX Disruptor. The
+// producer claims a slot, fills it in place and publishes it by moving the
+// cursor; every consumer reads the same slot in place and moves its own
+// sequence past it, so a message is written once whatever the fan-out.
+// Sequences run freely and are masked on use.
+//
+// Gating: the producer may run at most 'size' slots ahead of the slowest
+// consumer. Dependencies: a consumer subscribed after others (say the
+// gateway after risk) only sees a slot once all of them are done with it.
+// Each index sits on its own cache line next to the copy its owner keeps of
+// the indices it waits on, so the hot path reads other lines only when the
+// copy says there is nothing to do. Waiting spins briefly (futex_spin's
+// adaptive budget, before the waiter counts as a sleeper), then sleeps on
+// the futex of the index waited on.
+#define SEQ_MAX_CONSUMERS       8
+
+typedef struct {
+    volatile uint32_t sequence __cacheline_aligned;     // Slots below it are done
+    uint32_t limit_cache;       // Slots below it are known readable
+    uint32_t depends;           // Consumers that must finish a slot first
+    uint32_t reads;
+    uint32_t waits;
+} seq_consumer_t;
+
+typedef struct {
+    volatile uint32_t cursor __cacheline_aligned;       // Slots below it are published
+    uint32_t next;              // Next slot to claim
+    uint32_t gate_cache;        // Slowest consumer, as last seen
+    uint32_t published;
+    uint32_t gated;             // Claims that found the ring full
+    volatile uint32_t sleepers __cacheline_aligned;     // Anyone in futex_wait
+    seq_consumer_t consumer[SEQ_MAX_CONSUMERS];
+    volatile uint32_t active __cacheline_aligned;       // Bit per subscribed consumer
+    uint32_t size;
+    uint32_t mask;
+    uint32_t slot_size;
+    uint8_t* slots;
+    spinlock_t lock;            // Subscription changes
+    const char* name;
+} sequencer_t;
+
+// 'slots' is rounded up to a power of two; slots start on cache lines
+sequencer_t* seq_create(const char* name, uint32_t slots, uint32_t slot_size);
+void seq_destroy(sequencer_t* seq);
+
+// New consumer reading from the next slot published, after every consumer
+// in the 'depends' mask (bit n = consumer n). Returns its number, or -1
+// when all are taken or a dependency does not exist. Unsubscribing drops
+// the consumer from the others' dependencies.
+int seq_subscribe(sequencer_t* seq, uint32_t depends);
+void seq_unsubscribe(sequencer_t* seq, int consumer);
+
+static inline void* seq_slot(sequencer_t* seq, uint32_t sequence) {
+    return seq->slots + (sequence & seq->mask) * seq->slot_size;
+}
+
+// Producer (one at a time): claim the next slot, NULL when the slowest
+// consumer is a whole ring behind, or wait up to timeout_ms for it to move
+// (FUTEX_WAIT_FOREVER for no limit). Claims are published in order.
+void* seq_claim(sequencer_t* seq, uint32_t* sequence);
+void* seq_claim_wait(sequencer_t* seq, uint32_t* sequence, uint32_t timeout_ms);
+void seq_publish(sequencer_t* seq, uint32_t sequence);
+
+// Consumer: how many slots from *sequence on can be read in place, and
+// seq_wait for at least one (0 on timeout). seq_release hands 'count' of
+// them on to dependent consumers and the producer.
+uint32_t seq_available(sequencer_t* seq, int consumer, uint32_t* sequence);
+uint32_t seq_wait(sequencer_t* seq, int consumer, uint32_t* sequence, uint32_t timeout_ms);
+void seq_release(sequencer_t* seq, int consumer, uint32_t count);
+
+void seq_print_info(sequencer_t* seq);
+
+#endif // SEQUENCER_H
@@ -0,0 +1,100 @@
+#include "snapshot.h"
+#include "../arch/tsc.h"
+
+_Static_assert(sizeof(md_snapshot_t) == CACHE_LINE_SIZE, "md_snapshot_t is one line");
+
+static inline uint32_t line_align(uint32_t size) {
+    return (size + CACHE_LINE_SIZE - 1) & ~(uint32_t)(CACHE_LINE_SIZE - 1);
+}
+
+uint32_t md_table_size(uint32_t symbols) {
+    uint32_t groups = (symbols + SNAPSHOT_GROUP - 1) / SNAPSHOT_GROUP;
+    return line_align(sizeof(md_table_t)) + line_align(groups * sizeof(uint32_t)) +
+           symbols * sizeof(md_snapshot_t);
+}
+
+md_table_t* md_table_init(void* memory, uint32_t symbols) {
+    if (!memory || symbols == 0 || symbols > 0x10000) return NULL;
+
+    uint32_t groups = (symbols + SNAPSHOT_GROUP - 1) / SNAPSHOT_GROUP;
+    md_table_t* table = memory;
+    table->stamp = 0;
+    table->symbols = symbols;
+    table->groups_offset = line_align(sizeof(md_table_t));
+    table->entries_offset = table->groups_offset + line_align(groups * sizeof(uint32_t));
+    return table;
+}
+
+md_snapshot_t* md_write_begin(md_table_t* table, uint16_t symbol) {
+    if (symbol >= table->symbols) return NULL;
+
+    md_snapshot_t* entry = md_entry(table, symbol);
+    write_seqcount_begin(&entry->seq);
+    return entry;
+}
+
+// The group stamp goes out before the table stamp, so a reader that has
+// seen the table stamp finds the group marked
+void md_write_end(md_table_t* table, md_snapshot_t* entry) {
+    uint32_t stamp = table->stamp + 1;
+    entry->stamp = stamp;
+    entry->timestamp = ktime_ns();
+    write_seqcount_end(&entry->seq);
+
+    uint32_t symbol = (uint32_t)(entry - md_entry(table, 0));
+    store_release(md_group_stamp(table, symbol), stamp);
+    store_release(&table->stamp, stamp);
+}
+
+static void md_copy(md_snapshot_t* entry, md_snapshot_t* out) {
+    uint32_t start;
+    do {
+        start = read_seqcount_begin(&entry->seq);
+        out->stamp = entry->stamp;
+        out->bid = entry->bid;
+        out->ask = entry->ask;
+        out->last = entry->last;
+        out->bid_size = entry->bid_size;
+        out->ask_size = entry->ask_size;
+        out->volume = entry->volume;
+        out->timestamp = entry->timestamp;
+    } while (read_seqcount_retry(&entry->seq, start));
+    out->seq.sequence = start;
+}
+
+int md_read(md_table_t* table, uint16_t symbol, md_snapshot_t* out) {
+    if (symbol >= table->symbols) return -1;
+
+    md_copy(md_entry(table, symbol), out);
+    return out->stamp ? 0 : -1;
+}
+
+// Stamps are compared by distance, so they may wrap
+static inline bool md_newer(uint32_t stamp, uint32_t since) {
+    return (int32_t)(stamp - since) > 0;
+}
+
+uint32_t md_conflate(md_table_t* table, uint32_t* cursor, md_conflate_fn_t fn, void* ctx) {
+    uint32_t since = *cursor;
+    uint32_t now = load_acquire(&table->stamp);
+    if (now == since) return 0;
+
+    uint32_t visited = 0;
+    md_snapshot_t snapshot;
+    for (uint32_t group = 0; group < table->symbols; group += SNAPSHOT_GROUP) {
+        if (!md_newer(*md_group_stamp(table, group), since)) continue;
+
+        uint32_t end = group + SNAPSHOT_GROUP;
+        if (end > table->symbols) end = table->symbols;
+        for (uint32_t symbol = group; symbol < end; symbol++) {
+            md_snapshot_t* entry = md_entry(table, symbol);
+            if (!md_newer(entry->stamp, since)) continue;
+
+            md_copy(entry, &snapshot);
+            fn((uint16_t)symbol, &snapshot, ctx);
+            visited++;
+        }
+    }
+    *cursor = now;
+    return visited;
+}
@@ -0,0 +1,70 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "../types.h"
+#include "../arch/seqlock.h"
+
+// Latest top of book per symbol, for readers that want the current quote
+// rather than every update. One writer (the feed handler) updates a
+// symbol's line in place under its sequence count; readers copy the line
+// and retry if the writer was in it (arch/seqlock.h), so no one takes a
+// lock and nothing is queued. Each symbol has a cache line to itself, so
+// updating one symbol does not disturb readers of another.
+//
+// The table holds offsets, not pointers, and can sit in a shared memory
+// segment attached anywhere.
+//
+// Conflation: every update takes the next table stamp, kept in the
+// symbol's line and in a summary word per SNAPSHOT_GROUP symbols. A reader
+// that cannot keep up passes the stamp it got to and visits each symbol
+// changed since once, at its latest value, however many updates it missed.
+#define SNAPSHOT_GROUP          32
+
+typedef struct {
+    seqcount_t seq;
+    uint32_t stamp;             // Table stamp of the last update, 0 = never
+    double bid;
+    double ask;
+    double last;                // Last trade
+    uint64_t bid_size;
+    uint64_t ask_size;
+    uint64_t volume;            // Traded since the table was created
+    uint64_t timestamp;         // ktime_ns() of the last update
+} __cacheline_aligned md_snapshot_t;
+
+typedef struct {
+    volatile uint32_t stamp __cacheline_aligned;   // Last update published
+    uint32_t symbols;
+    uint32_t groups_offset;     // uint32_t stamp per group
+    uint32_t entries_offset;    // md_snapshot_t per symbol
+} md_table_t;
+
+// Called per changed symbol with a consistent copy
+typedef void (*md_conflate_fn_t)(uint16_t symbol, const md_snapshot_t* snapshot, void* ctx);
+
+// Bytes a table for 'symbols' takes; md_table_init lays it out in zeroed,
+// cache-line-aligned memory of that size
+uint32_t md_table_size(uint32_t symbols);
+md_table_t* md_table_init(void* memory, uint32_t symbols);
+
+static inline md_snapshot_t* md_entry(md_table_t* table, uint32_t symbol) {
+    return (md_snapshot_t*)((uint8_t*)table + table->entries_offset) + symbol;
+}
+
+static inline volatile uint32_t* md_group_stamp(md_table_t* table, uint32_t symbol) {
+    return (volatile uint32_t*)((uint8_t*)table + table->groups_offset) + symbol / SNAPSHOT_GROUP;
+}
+
+// Writer: fill the returned line in place between the two calls (NULL for
+// a symbol out of range). Only the price and size fields are the caller's.
+md_snapshot_t* md_write_begin(md_table_t* table, uint16_t symbol);
+void md_write_end(md_table_t* table, md_snapshot_t* entry);
+
+// Readers: a consistent copy of one symbol (-1 out of range or never
+// updated), or every symbol changed since *cursor (0 = all of them), which
+// is then moved on. A symbol updated during the walk may be visited again
+// on the next call. Returns how many were visited.
+int md_read(md_table_t* table, uint16_t symbol, md_snapshot_t* out);
+uint32_t md_conflate(md_table_t* table, uint32_t* cursor, md_conflate_fn_t fn, void* ctx);
+
+#endif // SNAPSHOT_H
@@ -1,8 +1,13 @@
 #include "syscalls.h"
 #include "../proc/process.h"
 #include "../proc/scheduler.h"
+#include "../proc/uring.h"
+#include "../proc/ipc.h"
 #include "../mm/memory.h"
 #include "../drivers/vga.h"
+#include "../net/socket.h"
+#include "../net/nicmap.h"
+#include "../fs/fs.h"
 #include "../arch/interrupts.h"
 
 // Remove static memcpy/memset implementations - use the ones from memory.h
@@ -11,9 +16,6 @@
 static syscall_handler_t syscall_table[MAX_SYSCALLS];
 static uint32_t num_syscalls = 0;
 
-// Current process pointer (will be set by scheduler)
-extern process_t* current_process;
-
 void syscalls_init(void) {
     memset(syscall_table, 0, sizeof(syscall_table));
     
@@ -24,19 +26,31 @@ void syscalls_init(void) {
     register_syscall(SYS_KILL, sys_kill);
     register_syscall(SYS_GETPID, sys_getpid);
     register_syscall(SYS_YIELD, sys_yield);
+    register_syscall(SYS_URING_SETUP, sys_uring_setup);
+    register_syscall(SYS_URING_ENTER, sys_uring_enter);
+    register_syscall(SYS_MLOCK, sys_mlock);
+    register_syscall(SYS_MUNLOCK, sys_munlock);
+    register_syscall(SYS_MLOCKALL, sys_mlockall);
+    register_syscall(SYS_MUNLOCKALL, sys_munlockall);
+    register_syscall(SYS_PAGEFAULTS, sys_pagefaults);
+    register_syscall(SYS_SHMGET, sys_shmget);
+    register_syscall(SYS_SHMAT, sys_shmat);
+    register_syscall(SYS_SHMDT, sys_shmdt);
+    register_syscall(SYS_SHMCTL, sys_shmctl);
+    register_syscall(SYS_PIPE, sys_pipe);
+    register_syscall(SYS_READ, sys_read);
+    register_syscall(SYS_WRITE, sys_write);
+    register_syscall(SYS_CLOSE, sys_close);
+    register_syscall(SYS_SPLICE, sys_splice);
+    register_syscall(SYS_POLL_CREATE, sys_poll_create);
+    register_syscall(SYS_POLL_CTL, sys_poll_ctl);
+    register_syscall(SYS_POLL_WAIT, sys_poll_wait);
+    register_syscall(SYS_NICMAP, sys_nicmap);
     
     // TODO: Enable these when process structure is updated
     // register_syscall(SYS_GETPPID, sys_getppid);
     // register_syscall(SYS_SLEEP, sys_sleep);
     // register_syscall(SYS_EXEC, sys_exec);
-    // register_syscall(SYS_PIPE, sys_pipe);
-    // register_syscall(SYS_READ, sys_read);
-    // register_syscall(SYS_WRITE, sys_write);
-    // register_syscall(SYS_CLOSE, sys_close);
-    // register_syscall(SYS_SHMGET, sys_shmget);
-    // register_syscall(SYS_SHMAT, sys_shmat);
-    // register_syscall(SYS_SHMDT, sys_shmdt);
-    // register_syscall(SYS_SHMCTL, sys_shmctl);
     // register_syscall(SYS_SETPRIORITY, sys_setpriority);
     // register_syscall(SYS_GETPRIORITY, sys_getpriority);
     
@@ -69,25 +83,8 @@ uint32_t sys_fork(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
         return -1;
     }
     
-    // Create child process with same priority as parent
-    char child_name[32] = "child";
-    process_t* child = process_create(child_name, NULL, current_process->priority);
-    if (!child) {
-        return -1;
-    }
-    
-    // Copy parent's context (simplified fork)
-    memcpy(&child->context, &current_process->context, sizeof(cpu_context_t));
-    
-    // Set return values: parent gets child PID, child gets 0
-    child->context.eax = 0;
-    current_process->context.eax = child->pid;
-    
-    // Set up parent-child relationship
-    child->ppid = current_process->pid;
-    child->parent = current_process;
-    
-    return child->pid;
+    // Copy-on-write: the child shares the parent's frames until either writes
+    return (uint32_t)process_fork(current_process);
 }
 
 // TODO: Implement when exec functionality is added
@@ -162,6 +159,35 @@ uint32_t sys_getpid(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4)
     return current_process ? current_process->pid : 0;
 }
 
+uint32_t sys_mlock(uint32_t addr, uint32_t size, uint32_t arg3, uint32_t arg4) {
+    (void)arg3; (void)arg4;
+    return (uint32_t)process_mlock(current_process, addr, size);
+}
+
+uint32_t sys_munlock(uint32_t addr, uint32_t size, uint32_t arg3, uint32_t arg4) {
+    (void)arg3; (void)arg4;
+    return (uint32_t)process_munlock(current_process, addr, size);
+}
+
+uint32_t sys_mlockall(uint32_t flags, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+    (void)arg2; (void)arg3; (void)arg4;
+    return (uint32_t)process_mlockall(current_process, flags);
+}
+
+uint32_t sys_munlockall(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+    (void)arg1; (void)arg2; (void)arg3; (void)arg4;
+    return (uint32_t)process_munlockall(current_process);
+}
+
+uint32_t sys_pagefaults(uint32_t pid, uint32_t locked, uint32_t arg3, uint32_t arg4) {
+    (void)arg3; (void)arg4;
+    process_t* process = pid ? process_find_by_pid(pid) : current_process;
+    if (!process) {
+        return -1;
+    }
+    return locked ? process->mlock_faults : process->page_faults;
+}
+
 // TODO: Implement when parent_pid field is added to process structure
 // uint32_t sys_getppid(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
 //     return current_process ? current_process->parent_pid : 0;
@@ -186,215 +212,267 @@ uint32_t sys_yield(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
     return 0;
 }
 
-// TODO: Implement when file descriptors are added to process structure
-// uint32_t sys_pipe(uint32_t pipefd, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
-//     if (!current_process || !pipefd) {
-//         return -1;
-//     }
-    
-//     // Create pipe - simplified implementation
-//     pipe_t* pipe = kmalloc(sizeof(pipe_t));
-//     if (!pipe) {
-//         return -1;
-//     }
-    
-//     pipe->read_pos = 0;
-//     pipe->write_pos = 0;
-//     pipe->size = 0;
-//     pipe->capacity = PIPE_BUFFER_SIZE;
-    
-//     // Find two free file descriptors
-//     int read_fd = -1, write_fd = -1;
-//     for (int i = 0; i < MAX_OPEN_FILES; i++) {
-//         if (!current_process->open_files[i].in_use) {
-//             if (read_fd == -1) {
-//                 read_fd = i;
-//             } else if (write_fd == -1) {
-//                 write_fd = i;
-//                 break;
-//             }
-//         }
-//     }
-    
-//     if (read_fd == -1 || write_fd == -1) {
-//         kfree(pipe);
-//         return -1;
-//     }
-    
-//     // Set up file descriptors
-//     current_process->open_files[read_fd].in_use = 1;
-//     current_process->open_files[read_fd].type = FD_PIPE_READ;
-//     current_process->open_files[read_fd].data = pipe;
-    
-//     current_process->open_files[write_fd].in_use = 1;
-//     current_process->open_files[write_fd].type = FD_PIPE_WRITE;
-//     current_process->open_files[write_fd].data = pipe;
-    
-//     // Return file descriptors to user
-//     ((int*)pipefd)[0] = read_fd;
-//     ((int*)pipefd)[1] = write_fd;
-    
-//     return 0;
-// }
+// File descriptor tables
+static proc_file_descriptor_t* fd_get(process_t* process, uint32_t fd) {
+    if (!process || fd >= PROC_MAX_FILES || !process->files[fd].in_use) {
+        return NULL;
+    }
+    return &process->files[fd];
+}
 
-// TODO: Implement when file descriptors are added to process structure
-// uint32_t sys_read(uint32_t fd, uint32_t buffer, uint32_t count, uint32_t arg4) {
-//     if (!current_process || fd >= MAX_OPEN_FILES || !current_process->open_files[fd].in_use) {
-//         return -1;
-//     }
-    
-//     file_descriptor_t* file_desc = &current_process->open_files[fd];
-    
-//     if (file_desc->type == FD_PIPE_READ) {
-//         pipe_t* pipe = (pipe_t*)file_desc->data;
-//         uint32_t bytes_read = 0;
-//         uint8_t* buf = (uint8_t*)buffer;
-        
-//         while (bytes_read < count && pipe->size > 0) {
-//             buf[bytes_read] = pipe->buffer[pipe->read_pos];
-//             pipe->read_pos = (pipe->read_pos + 1) % pipe->capacity;
-//             pipe->size--;
-//             bytes_read++;
-//         }
-        
-//         return bytes_read;
-//     }
-    
-//     return -1;
-// }
+int process_fd_install(process_t* process, fd_type_t type, void* data) {
+    if (!process) {
+        return -1;
+    }
+    for (int i = 0; i < PROC_MAX_FILES; i++) {
+        proc_file_descriptor_t* desc = &process->files[i];
+        if (!desc->in_use) {
+            desc->in_use = 1;
+            desc->type = type;
+            desc->data = data;
+            desc->flags = 0;
+            desc->offset = 0;
+            return i;
+        }
+    }
+    return -1;
+}
 
-// TODO: Implement when file descriptors are added to process structure
-// uint32_t sys_write(uint32_t fd, uint32_t buffer, uint32_t count, uint32_t arg4) {
-//     if (!current_process || fd >= MAX_OPEN_FILES || !current_process->open_files[fd].in_use) {
-//         return -1;
-//     }
+int process_fd_close(process_t* process, int fd) {
+    proc_file_descriptor_t* desc = fd_get(process, (uint32_t)fd);
+    if (!desc) {
+        return -1;
+    }
     
-//     file_descriptor_t* file_desc = &current_process->open_files[fd];
-    
-//     if (file_desc->type == FD_PIPE_WRITE) {
-//         pipe_t* pipe = (pipe_t*)file_desc->data;
-//         uint32_t bytes_written = 0;
-//         uint8_t* buf = (uint8_t*)buffer;
-        
-//         while (bytes_written < count && pipe->size < pipe->capacity) {
-//             pipe->buffer[pipe->write_pos] = buf[bytes_written];
-//             pipe->write_pos = (pipe->write_pos + 1) % pipe->capacity;
-//             pipe->size++;
-//             bytes_written++;
-//         }
-        
-//         return bytes_written;
-//     } else if (fd == 1) { // stdout
-//         for (uint32_t i = 0; i < count; i++) {
-//             vga_print_char(((char*)buffer)[i]);
-//         }
-//         return count;
-//     }
+    int result = 0;
+    pipe_t* pipe = (pipe_t*)desc->data;
+    if (desc->type == FD_PIPE_READ) {
+        if (pipe_close_read(pipe)) pipe_destroy(pipe);
+    } else if (desc->type == FD_PIPE_WRITE) {
+        if (pipe_close_write(pipe)) pipe_destroy(pipe);
+    } else if (desc->type == FD_SOCKET) {
+        result = socket_close((int)(uint32_t)desc->data);
+    } else if (desc->type == FD_FILE) {
+        result = fs_close((int)(uint32_t)desc->data);
+    } else if (desc->type == FD_POLL) {
+        pollset_destroy((pollset_t*)desc->data);
+    }
     
-//     return -1;
-// }
+    desc->in_use = 0;
+    desc->type = FD_UNUSED;
+    desc->data = NULL;
+    return result;
+}
 
-// TODO: Implement when file descriptors are added to process structure
-// uint32_t sys_close(uint32_t fd, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
-//     if (!current_process || fd >= MAX_OPEN_FILES || !current_process->open_files[fd].in_use) {
-//         return -1;
-//     }
-    
-//     file_descriptor_t* file_desc = &current_process->open_files[fd];
-    
-//     if (file_desc->type == FD_PIPE_READ || file_desc->type == FD_PIPE_WRITE) {
-//         // For pipes, would need reference counting in full implementation
-//         if (file_desc->data) {
-//             kfree(file_desc->data);
-//         }
-//     }
-    
-//     file_desc->in_use = 0;
-//     file_desc->type = FD_UNUSED;
-//     file_desc->data = NULL;
-    
-//     return 0;
-// }
+void process_fd_fork(process_t* parent, process_t* child) {
+    for (int i = 0; i < PROC_MAX_FILES; i++) {
+        proc_file_descriptor_t* desc = &parent->files[i];
+        if (desc->in_use && (desc->type == FD_PIPE_READ || desc->type == FD_PIPE_WRITE)) {
+            pipe_ref((pipe_t*)desc->data, desc->type == FD_PIPE_WRITE);
+            child->files[i] = *desc;
+        }
+    }
+}
 
-// TODO: Implement when shared memory is added to process structure
-// uint32_t sys_shmget(uint32_t key, uint32_t size, uint32_t flags, uint32_t arg4) {
-//     // Simplified shared memory implementation
-//     shm_segment_t* segment = kmalloc(sizeof(shm_segment_t));
-//     if (!segment) {
-//         return -1;
-//     }
-    
-//     segment->key = key;
-//     segment->size = size;
-//     segment->data = kmalloc(size);
-//     segment->ref_count = 0;
+void process_fd_exit(process_t* process) {
+    for (int i = 0; i < PROC_MAX_FILES; i++) {
+        if (process->files[i].in_use) {
+            process_fd_close(process, i);
+        }
+    }
+}
+
+uint32_t sys_pipe(uint32_t pipefd, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+    (void)arg2; (void)arg3; (void)arg4;
+    if (!current_process || !pipefd) {
+        return -1;
+    }
     
-//     if (!segment->data) {
-//         kfree(segment);
-//         return -1;
-//     }
+    pipe_t* pipe = pipe_create();
+    if (!pipe) {
+        return -1;
+    }
+    int read_fd = process_fd_install(current_process, FD_PIPE_READ, pipe);
+    int write_fd = read_fd >= 0 ? process_fd_install(current_process, FD_PIPE_WRITE, pipe) : -1;
+    if (write_fd < 0) {
+        if (read_fd >= 0) {
+            current_process->files[read_fd].in_use = 0;
+        }
+        pipe_destroy(pipe);
+        return -1;
+    }
     
-//     // Return segment ID (simplified)
-//     return (uint32_t)segment;
-// }
+    ((int*)pipefd)[0] = read_fd;
+    ((int*)pipefd)[1] = write_fd;
+    return 0;
+}
 
-// uint32_t sys_shmat(uint32_t shmid, uint32_t addr, uint32_t flags, uint32_t arg4) {
-//     shm_segment_t* segment = (shm_segment_t*)shmid;
-//     if (!segment || !current_process) {
-//         return -1;
-//     }
-    
-//     // Find free shared memory slot
-//     for (int i = 0; i < MAX_SHARED_MEMORY; i++) {
-//         if (!current_process->shared_memory[i].in_use) {
-//             current_process->shared_memory[i].in_use = 1;
-//             current_process->shared_memory[i].segment = segment;
-//             current_process->shared_memory[i].addr = segment->data;
-//             segment->ref_count++;
-//             return (uint32_t)segment->data;
-//         }
-//     }
+uint32_t sys_read(uint32_t fd, uint32_t buffer, uint32_t count, uint32_t arg4) {
+    (void)arg4;
+    proc_file_descriptor_t* desc = fd_get(current_process, fd);
+    if (!desc || !buffer) {
+        return -1;
+    }
     
-//     return -1;
-// }
+    switch (desc->type) {
+    case FD_PIPE_READ:
+        return (uint32_t)pipe_read((pipe_t*)desc->data, (void*)buffer, count, desc->flags);
+    case FD_SOCKET:
+        return (uint32_t)socket_recv((int)(uint32_t)desc->data, (void*)buffer, count);
+    case FD_FILE:
+        return (uint32_t)fs_read((int)(uint32_t)desc->data, (void*)buffer, count);
+    default:
+        return -1;
+    }
+}
 
-// uint32_t sys_shmdt(uint32_t addr, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
-//     if (!current_process) {
-//         return -1;
-//     }
+uint32_t sys_write(uint32_t fd, uint32_t buffer, uint32_t count, uint32_t arg4) {
+    (void)arg4;
+    if (!buffer) {
+        return -1;
+    }
+    proc_file_descriptor_t* desc = fd_get(current_process, fd);
+    if (!desc) {
+        if (fd != 1) {
+            return -1;
+        }
+        // stdout when nothing is open on it
+        for (uint32_t i = 0; i < count; i++) {
+            vga_putchar(((const char*)buffer)[i]);
+        }
+        return count;
+    }
     
-//     // Find and detach shared memory
-//     for (int i = 0; i < MAX_SHARED_MEMORY; i++) {
-//         if (current_process->shared_memory[i].in_use && 
-//             current_process->shared_memory[i].addr == (void*)addr) {
-            
-//             current_process->shared_memory[i].segment->ref_count--;
-//             current_process->shared_memory[i].in_use = 0;
-//             current_process->shared_memory[i].segment = NULL;
-//             current_process->shared_memory[i].addr = NULL;
-//             return 0;
-//         }
-//     }
+    switch (desc->type) {
+    case FD_PIPE_WRITE:
+        return (uint32_t)pipe_write((pipe_t*)desc->data, (const void*)buffer, count, desc->flags);
+    case FD_SOCKET:
+        return (uint32_t)socket_send((int)(uint32_t)desc->data, (const void*)buffer, count);
+    case FD_FILE:
+        return (uint32_t)fs_write((int)(uint32_t)desc->data, (const void*)buffer, count);
+    default:
+        return -1;
+    }
+}
+
+uint32_t sys_close(uint32_t fd, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+    (void)arg2; (void)arg3; (void)arg4;
+    return (uint32_t)process_fd_close(current_process, (int)fd);
+}
+
+// One side must be a pipe: pages move to another pipe, and a socket or
+// file reads into or writes from them in place
+uint32_t sys_splice(uint32_t fd_in, uint32_t fd_out, uint32_t count, uint32_t flags) {
+    proc_file_descriptor_t* in = fd_get(current_process, fd_in);
+    proc_file_descriptor_t* out = fd_get(current_process, fd_out);
+    if (!in || !out) {
+        return -1;
+    }
     
-//     return -1;
-// }
+    if (in->type == FD_PIPE_READ) {
+        pipe_t* pipe = (pipe_t*)in->data;
+        int fd = (int)(uint32_t)out->data;
+        switch (out->type) {
+        case FD_PIPE_WRITE:
+            return (uint32_t)pipe_splice(pipe, (pipe_t*)out->data, count, flags);
+        case FD_SOCKET:
+            return (uint32_t)pipe_splice_to(pipe, socket_send, fd, count, flags);
+        case FD_FILE:
+            return (uint32_t)pipe_splice_to(pipe, fs_write, fd, count, flags);
+        default:
+            return -1;
+        }
+    }
+    if (out->type == FD_PIPE_WRITE) {
+        pipe_t* pipe = (pipe_t*)out->data;
+        int fd = (int)(uint32_t)in->data;
+        switch (in->type) {
+        case FD_SOCKET:
+            return (uint32_t)pipe_splice_from(pipe, socket_recv, fd, count, flags);
+        case FD_FILE:
+            return (uint32_t)pipe_splice_from(pipe, fs_read, fd, count, flags);
+        default:
+            return -1;
+        }
+    }
+    return -1;
+}
 
-// uint32_t sys_shmctl(uint32_t shmid, uint32_t cmd, uint32_t buf, uint32_t arg4) {
-//     shm_segment_t* segment = (shm_segment_t*)shmid;
-//     if (!segment) {
-//         return -1;
-//     }
+uint32_t sys_poll_create(uint32_t flags, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+    (void)arg2; (void)arg3; (void)arg4;
+    pollset_t* set = current_process ? pollset_create(flags) : NULL;
+    if (!set) {
+        return -1;
+    }
+    int fd = process_fd_install(current_process, FD_POLL, set);
+    if (fd < 0) {
+        pollset_destroy(set);
+    }
+    return (uint32_t)fd;
+}
+
+// Pipes and sockets are named by their descriptor in the caller's table
+uint32_t sys_poll_ctl(uint32_t pfd, uint32_t op, uint32_t ctl, uint32_t arg4) {
+    (void)arg4;
+    proc_file_descriptor_t* desc = fd_get(current_process, pfd);
+    const poll_ctl_t* request = (const poll_ctl_t*)ctl;
+    if (!desc || desc->type != FD_POLL || !request) {
+        return -1;
+    }
+    pollset_t* set = (pollset_t*)desc->data;
     
-//     if (cmd == 0) { // IPC_RMID - remove segment
-//         if (segment->ref_count == 0) {
-//             kfree(segment->data);
-//             kfree(segment);
-//             return 0;
-//         }
-//     }
+    if (op == POLL_CTL_DEL) {
+        return (uint32_t)pollset_del(set, pollset_find(set, request->cookie));
+    }
+    if (op != POLL_CTL_ADD) {
+        return -1;
+    }
     
-//     return -1;
-// }
+    int item = -1;
+    if (request->source == POLL_SRC_MSGQ) {
+        item = msgq_poll_add(set, request->target, request->events, request->cookie);
+    } else if (request->source == POLL_SRC_TIMER) {
+        item = pollset_add_timer(set, request->target, request->cookie);
+    } else if (request->source == POLL_SRC_FD) {
+        proc_file_descriptor_t* target = fd_get(current_process, request->target);
+        if (target && (target->type == FD_PIPE_READ || target->type == FD_PIPE_WRITE)) {
+            item = pipe_poll_add(set, (pipe_t*)target->data, request->events, request->cookie);
+        } else if (target && target->type == FD_SOCKET) {
+            item = socket_poll_add(set, (int)(uint32_t)target->data, request->events, request->cookie);
+        }
+    }
+    return item < 0 ? (uint32_t)-1 : 0;
+}
+
+uint32_t sys_poll_wait(uint32_t pfd, uint32_t events, uint32_t max, uint32_t timeout_ms) {
+    proc_file_descriptor_t* desc = fd_get(current_process, pfd);
+    if (!desc || desc->type != FD_POLL) {
+        return -1;
+    }
+    return (uint32_t)pollset_wait((pollset_t*)desc->data, (poll_event_t*)events, max, timeout_ms);
+}
+
+uint32_t sys_shmget(uint32_t key, uint32_t size, uint32_t flags, uint32_t arg4) {
+    (void)arg4;
+    return (uint32_t)ipc_shmget(key, size, flags);
+}
+
+// The address hint is ignored: segments go in the process's SHM window
+uint32_t sys_shmat(uint32_t shmid, uint32_t addr, uint32_t flags, uint32_t arg4) {
+    (void)addr; (void)arg4;
+    void* mapped = ipc_shmat(current_process, (int)shmid, flags);
+    return mapped ? (uint32_t)mapped : (uint32_t)-1;
+}
+
+uint32_t sys_shmdt(uint32_t addr, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+    (void)arg2; (void)arg3; (void)arg4;
+    return (uint32_t)ipc_shmdt(current_process, (void*)addr);
+}
+
+uint32_t sys_shmctl(uint32_t shmid, uint32_t cmd, uint32_t buf, uint32_t arg4) {
+    (void)buf; (void)arg4;
+    return (uint32_t)ipc_shmctl((int)shmid, cmd);
+}
 
 // TODO: Implement when priority scheduling is added
 // uint32_t sys_setpriority(uint32_t pid, uint32_t priority, uint32_t arg3, uint32_t arg4) {
@@ -2,6 +2,8 @@
 #define SYSCALLS_H
 
 #include "../types.h"
+#include "../arch/spinlock.h"
+#include "poll.h"
 
 // System call numbers
 #define SYS_FORK        0
@@ -23,6 +25,18 @@
 #define SYS_SHMCTL      16
 #define SYS_SETPRIORITY 17
 #define SYS_GETPRIORITY 18
+#define SYS_URING_SETUP 19
+#define SYS_URING_ENTER 20
+#define SYS_MLOCK       21
+#define SYS_MUNLOCK     22
+#define SYS_MLOCKALL    23
+#define SYS_MUNLOCKALL  24
+#define SYS_PAGEFAULTS  25
+#define SYS_SPLICE      26
+#define SYS_POLL_CREATE 27
+#define SYS_POLL_CTL    28
+#define SYS_POLL_WAIT   29
+#define SYS_NICMAP      30
 
 #define MAX_SYSCALLS    32
 
@@ -32,10 +46,15 @@ typedef enum {
     FD_FILE,
     FD_PIPE_READ,
     FD_PIPE_WRITE,
-    FD_SOCKET
+    FD_SOCKET,
+    FD_POLL
 } fd_type_t;
 
-// Process file descriptor structure  
+// Process file descriptor: 'data' is the pipe_t of a pipe end, the
+// pollset_t of FD_POLL, or the socket or fs descriptor number of
+// FD_SOCKET and FD_FILE
+#define PROC_MAX_FILES  32
+
 typedef struct {
     uint8_t in_use;
     fd_type_t type;
@@ -44,35 +63,53 @@ typedef struct {
     uint32_t offset;
 } proc_file_descriptor_t;
 
-// Pipe structure for IPC
-#define PIPE_BUFFER_SIZE 4096
+// Pipe: a ring of page buffers. Writes copy into the newest page while it
+// has room and is the pipe's alone; splice moves whole pages from pipe to
+// pipe, and has sockets and files read into or write from the pages in
+// place, so forwarded data is not copied through a caller's buffer.
+#define PIPE_BUFFERS        16
+#define PIPE_BUFFER_SIZE    (PIPE_BUFFERS * 4096)   // Bytes a pipe holds at most
 
 typedef struct {
-    uint8_t buffer[PIPE_BUFFER_SIZE];
-    uint32_t read_pos;
-    uint32_t write_pos;
-    uint32_t size;
-    uint32_t capacity;
+    uint32_t page;          // Frame holding the data
+    uint16_t offset;        // First unread byte in it
+    uint16_t len;
+} pipe_buffer_t;
+
+typedef struct {
+    pipe_buffer_t bufs[PIPE_BUFFERS];
+    uint32_t head;          // Oldest buffer (free-running, masked on use)
+    uint32_t tail;          // One past the newest
+    uint32_t size;          // Bytes held
+    uint32_t spare;         // Emptied page kept for the next write, 0 = none
+    uint16_t readers;       // Descriptors open on each end
+    uint16_t writers;
     uint8_t closed_for_writing;
     uint8_t closed_for_reading;
+    spinlock_t lock;
+    volatile uint32_t write_seq;    // Bumped per write or close (readers wait on it)
+    volatile uint32_t read_seq;     // Bumped per read or close (writers wait on it)
+    poll_head_t poll;               // Poll sets watching either end
 } pipe_t;
 
-// Shared memory segment
-typedef struct {
+// System V IPC flags and commands
+#define IPC_PRIVATE     0           // Key: always a new segment
+#define IPC_CREAT       0x200
+#define IPC_NOWAIT      0x800
+#define IPC_RMID        0
+#define SHM_RDONLY      0x1000      // shmat: map read-only
+
+// Shared memory segment: physically contiguous frames
+typedef struct shm_segment {
+    uint32_t id;
     uint32_t key;
     uint32_t size;
-    void* data;
-    uint32_t ref_count;
-    uint32_t permissions;
+    void* data;             // Identity address of the frames, NULL = slot free
+    uint32_t ref_count;     // Attachments
+    uint32_t permissions;   // Page flags for mapping it
+    uint8_t removed;        // IPC_RMID: freed with the last detach
 } shm_segment_t;
 
-// Shared memory attachment
-typedef struct {
-    uint8_t in_use;
-    shm_segment_t* segment;
-    void* addr;
-} shm_attachment_t;
-
 // System call handler function pointer
 typedef uint32_t (*syscall_handler_t)(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
 
@@ -96,24 +133,49 @@ uint32_t sys_pipe(uint32_t pipefd, uint32_t arg2, uint32_t arg3, uint32_t arg4);
 uint32_t sys_read(uint32_t fd, uint32_t buffer, uint32_t count, uint32_t arg4);
 uint32_t sys_write(uint32_t fd, uint32_t buffer, uint32_t count, uint32_t arg4);
 uint32_t sys_close(uint32_t fd, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+uint32_t sys_splice(uint32_t fd_in, uint32_t fd_out, uint32_t count, uint32_t flags);
+uint32_t sys_poll_create(uint32_t flags, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+uint32_t sys_poll_ctl(uint32_t pfd, uint32_t op, uint32_t ctl, uint32_t arg4);
+uint32_t sys_poll_wait(uint32_t pfd, uint32_t events, uint32_t max, uint32_t timeout_ms);
 uint32_t sys_shmget(uint32_t key, uint32_t size, uint32_t flags, uint32_t arg4);
 uint32_t sys_shmat(uint32_t shmid, uint32_t addr, uint32_t flags, uint32_t arg4);
 uint32_t sys_shmdt(uint32_t addr, uint32_t arg2, uint32_t arg3, uint32_t arg4);
 uint32_t sys_shmctl(uint32_t shmid, uint32_t cmd, uint32_t buf, uint32_t arg4);
 uint32_t sys_setpriority(uint32_t pid, uint32_t priority, uint32_t arg3, uint32_t arg4);
 uint32_t sys_getpriority(uint32_t pid, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+uint32_t sys_mlock(uint32_t addr, uint32_t size, uint32_t arg3, uint32_t arg4);
+uint32_t sys_munlock(uint32_t addr, uint32_t size, uint32_t arg3, uint32_t arg4);
+uint32_t sys_mlockall(uint32_t flags, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+uint32_t sys_munlockall(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+uint32_t sys_pagefaults(uint32_t pid, uint32_t locked, uint32_t arg3, uint32_t arg4);
 
 // Assembly system call interface
 extern void syscall_interrupt_handler(void);
+extern void sysenter_call(void);
+extern bool syscall_sysenter_enabled;
 
-// Helper functions for user space
+// Helper functions for user space. Ring 0 callers (every process today)
+// skip the trap; ring 3 takes SYSENTER when the CPU has it.
 static inline uint32_t syscall(uint32_t num, uint32_t arg1, uint32_t arg2, 
                               uint32_t arg3, uint32_t arg4) {
+    uint16_t cs;
+    asm volatile("movw %%cs, %0" : "=r" (cs));
+    if ((cs & 3) == 0) {
+        return syscall_handler(num, arg1, arg2, arg3, arg4);
+    }
+
     uint32_t result;
-    asm volatile("int $0x80"
-                : "=a" (result)
-                : "a" (num), "b" (arg1), "c" (arg2), "d" (arg3), "S" (arg4)
-                : "memory");
+    if (syscall_sysenter_enabled) {
+        asm volatile("call sysenter_call"
+                    : "=a" (result)
+                    : "a" (num), "b" (arg1), "c" (arg2), "d" (arg3), "S" (arg4)
+                    : "memory");
+    } else {
+        asm volatile("int $0x80"
+                    : "=a" (result)
+                    : "a" (num), "b" (arg1), "c" (arg2), "d" (arg3), "S" (arg4)
+                    : "memory");
+    }
     return result;
 }
 
@@ -123,7 +185,7 @@ static inline int fork(void) {
 }
 
 static inline int exec(void* program) {
-    return syscall(SYS_EXEC, (uint32_t)program, 0, 0, 0);
+    return syscall(SYS_EXEC, (uintptr_t)program, 0, 0, 0);
 }
 
 static inline void exit(int code) {
@@ -131,7 +193,7 @@ static inline void exit(int code) {
 }
 
 static inline int wait(int* status) {
-    return syscall(SYS_WAIT, 0, (uint32_t)status, 0, 0);
+    return syscall(SYS_WAIT, 0, (uintptr_t)status, 0, 0);
 }
 
 static inline int kill(int pid, int signal) {
@@ -155,21 +217,39 @@ static inline void yield(void) {
 }
 
 static inline int pipe(int pipefd[2]) {
-    return syscall(SYS_PIPE, (uint32_t)pipefd, 0, 0, 0);
+    return syscall(SYS_PIPE, (uintptr_t)pipefd, 0, 0, 0);
 }
 
 static inline int read(int fd, void* buffer, int count) {
-    return syscall(SYS_READ, fd, (uint32_t)buffer, count, 0);
+    return syscall(SYS_READ, fd, (uintptr_t)buffer, count, 0);
 }
 
 static inline int write(int fd, const void* buffer, int count) {
-    return syscall(SYS_WRITE, fd, (uint32_t)buffer, count, 0);
+    return syscall(SYS_WRITE, fd, (uintptr_t)buffer, count, 0);
 }
 
 static inline int close(int fd) {
     return syscall(SYS_CLOSE, fd, 0, 0, 0);
 }
 
+// Move up to 'count' bytes from fd_in to fd_out, one of them a pipe
+static inline int splice(int fd_in, int fd_out, uint32_t count, uint32_t flags) {
+    return syscall(SYS_SPLICE, fd_in, fd_out, count, flags);
+}
+
+// Poll sets (poll.h): one wait for pipes, sockets, queues and timers
+static inline int poll_create(uint32_t flags) {
+    return syscall(SYS_POLL_CREATE, flags, 0, 0, 0);
+}
+
+static inline int poll_ctl(int pfd, uint32_t op, const poll_ctl_t* ctl) {
+    return syscall(SYS_POLL_CTL, pfd, op, (uintptr_t)ctl, 0);
+}
+
+static inline int poll_wait(int pfd, poll_event_t* events, uint32_t max, uint32_t timeout_ms) {
+    return syscall(SYS_POLL_WAIT, pfd, (uintptr_t)events, max, timeout_ms);
+}
+
 static inline int setpriority(int pid, int priority) {
     return syscall(SYS_SETPRIORITY, pid, priority, 0, 0);
 }
@@ -178,4 +258,44 @@ static inline int getpriority(int pid) {
     return syscall(SYS_GETPRIORITY, pid, 0, 0, 0);
 }
 
+static inline int mlock(const void* addr, uint32_t size) {
+    return syscall(SYS_MLOCK, (uintptr_t)addr, size, 0, 0);
+}
+
+static inline int munlock(const void* addr, uint32_t size) {
+    return syscall(SYS_MUNLOCK, (uintptr_t)addr, size, 0, 0);
+}
+
+static inline int mlockall(int flags) {
+    return syscall(SYS_MLOCKALL, flags, 0, 0, 0);
+}
+
+static inline int munlockall(void) {
+    return syscall(SYS_MUNLOCKALL, 0, 0, 0, 0);
+}
+
+// Page faults taken by a process (0 = self); with 'locked' set, only those
+// since mlockall, which should stay 0 for a realtime process
+static inline int pagefaults(int pid, int locked) {
+    return syscall(SYS_PAGEFAULTS, pid, locked, 0, 0);
+}
+
+// Shared memory: shmat maps the segment, after which access is plain loads
+// and stores; shmctl(IPC_RMID) frees it once everyone has detached
+static inline int shmget(uint32_t key, uint32_t size, int flags) {
+    return syscall(SYS_SHMGET, key, size, flags, 0);
+}
+
+static inline void* shmat(int shmid, int flags) {
+    return (void*)(uintptr_t)syscall(SYS_SHMAT, shmid, 0, flags, 0);
+}
+
+static inline int shmdt(const void* addr) {
+    return syscall(SYS_SHMDT, (uintptr_t)addr, 0, 0, 0);
+}
+
+static inline int shmctl(int shmid, int cmd) {
+    return syscall(SYS_SHMCTL, shmid, cmd, 0, 0);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,437 @@
+#include "tick.h"
+#include "../arch/apic.h"
+#include "../arch/pit.h"
+#include "../arch/cpu.h"
+#include "../arch/interrupts.h"
+#include "../arch/tsc.h"
+#include "../arch/div64.h"
+#include "../drivers/vga.h"
+#include "../mm/memory.h"
+#include "../proc/vdso.h"
+
+// Per-CPU tick state: each CPU arms its own LAPIC timer and charges its
+// own current process
+typedef struct {
+    uint32_t frac_us;               // Time not yet worth a whole tick
+    uint32_t pending_ticks;         // Ticks not yet charged to the scheduler
+    uint32_t armed_count;           // LAPIC count baseline of the current shot
+    uint64_t last_ns;               // ktime of the last harvest on this CPU
+    bool in_handler;
+    tick_stats_t stats;
+} __cacheline_aligned tick_cpu_t;
+
+// Tick state
+static tick_mode_t tick_mode = TICK_MODE_PERIODIC;     // Mode of non-isolated CPUs
+static tick_cpu_t tick_cpus[MAX_CPUS];
+static bool tsc_timekeeping = false;        // Time comes from ktime_ns(), not the timer
+
+// Global clock, advanced by whichever CPU harvests time first
+static spinlock_t clock_lock = SPINLOCK_INIT;
+static volatile uint32_t jiffies = 0;       // Scheduler ticks since boot
+static volatile uint32_t time_ms = 0;       // Time since boot
+static uint32_t time_frac_us = 0;           // Sub-millisecond part of time_ms
+static uint32_t jiffies_frac_us = 0;        // Time not yet worth a whole jiffy
+static uint64_t clock_last_ns = 0;          // ktime of the last clock update
+
+static inline tick_cpu_t* tick_this_cpu(void) {
+    return &tick_cpus[this_cpu()->id];
+}
+
+uint32_t get_ticks(void) {
+    return jiffies;
+}
+
+uint32_t tick_get_time_ms(void) {
+    return time_ms;
+}
+
+tick_mode_t tick_get_mode(void) {
+    return tick_mode;
+}
+
+tick_mode_t tick_cpu_mode(uint32_t cpu) {
+    return (cpu < MAX_CPUS && cpus[cpu].isolated) ? TICK_MODE_NOHZ_FULL : tick_mode;
+}
+
+// Advance the global clock (clock_lock held); housekeeping runs once per
+// elapsed jiffy no matter which CPU noticed it
+static void tick_clock_add_us(uint32_t elapsed_us) {
+    time_frac_us += elapsed_us;
+    time_ms += time_frac_us / 1000;
+    time_frac_us %= 1000;
+    vdso_update_clock(time_ms);
+
+    jiffies_frac_us += elapsed_us;
+    uint32_t ticks = jiffies_frac_us / TICK_PERIOD_US;
+    if (ticks) {
+        jiffies_frac_us -= ticks * TICK_PERIOD_US;
+        jiffies += ticks;
+        system_tick(ticks);
+    }
+}
+
+// Turn whole periods of this CPU's time into scheduler ticks
+static void tick_cpu_add_us(tick_cpu_t* tc, uint32_t elapsed_us) {
+    tc->frac_us += elapsed_us;
+    uint32_t ticks = tc->frac_us / TICK_PERIOD_US;
+    if (ticks) {
+        tc->frac_us -= ticks * TICK_PERIOD_US;
+        tc->pending_ticks += ticks;
+    }
+}
+
+// Whole microseconds between *last_ns and now; *last_ns moves up by exactly
+// that much so rounding never drifts
+static uint64_t tick_harvest_us(uint64_t* last_ns, uint64_t now) {
+    if (now <= *last_ns) return 0;
+    uint64_t elapsed_us = div_u64_u32(now - *last_ns, NSEC_PER_USEC, NULL);
+    *last_ns += elapsed_us * NSEC_PER_USEC;
+    return elapsed_us;
+}
+
+static void tick_clock_update_tsc(uint64_t now) {
+    uint32_t flags = spin_lock_irqsave(&clock_lock);
+    uint64_t elapsed_us = tick_harvest_us(&clock_last_ns, now);
+    while (elapsed_us > TICK_ACCOUNT_CHUNK_US) {
+        tick_clock_add_us(TICK_ACCOUNT_CHUNK_US);
+        elapsed_us -= TICK_ACCOUNT_CHUNK_US;
+    }
+    if (elapsed_us) {
+        tick_clock_add_us((uint32_t)elapsed_us);
+    }
+    spin_unlock_irqrestore(&clock_lock, flags);
+}
+
+// Harvest the time elapsed since the last call. With the TSC as the
+// clocksource this works in every mode and the timer can stop entirely.
+// Otherwise (uniprocessor only) time is read off the running LAPIC
+// one-shot: the LAPIC keeps counting down, so the current count simply
+// becomes the new baseline.
+static void tick_advance(void) {
+    tick_cpu_t* tc = tick_this_cpu();
+
+    if (tsc_timekeeping) {
+        uint64_t now = ktime_ns();
+        uint64_t elapsed_us = tick_harvest_us(&tc->last_ns, now);
+        while (elapsed_us > TICK_ACCOUNT_CHUNK_US) {
+            tick_cpu_add_us(tc, TICK_ACCOUNT_CHUNK_US);
+            elapsed_us -= TICK_ACCOUNT_CHUNK_US;
+        }
+        if (elapsed_us) {
+            tick_cpu_add_us(tc, (uint32_t)elapsed_us);
+        }
+        tick_clock_update_tsc(now);
+        return;
+    }
+
+    if (tick_mode == TICK_MODE_PERIODIC) return;
+
+    uint32_t elapsed_us = lapic_ticks_to_us(tc->armed_count - lapic_timer_remaining());
+    if (elapsed_us == 0) return;
+
+    // Only consume whole microseconds so rounding does not drift the clock
+    tc->armed_count -= lapic_us_to_ticks(elapsed_us);
+    tick_cpu_add_us(tc, elapsed_us);
+    uint32_t flags = spin_lock_irqsave(&clock_lock);
+    tick_clock_add_us(elapsed_us);
+    spin_unlock_irqrestore(&clock_lock, flags);
+}
+
+// Microseconds until the timer wheel's next expiry (boot CPU only)
+static uint32_t tick_next_wakeup_us(void) {
+    uint32_t wake_time;
+    if (!timer_next_expiry(&wake_time)) {
+        return TICK_NO_EVENT;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&clock_lock);
+    uint32_t now_ms = time_ms;
+    uint32_t now_frac_us = time_frac_us;
+    spin_unlock_irqrestore(&clock_lock, flags);
+
+    int32_t wait_ms = (int32_t)(wake_time - now_ms);
+    if (wait_ms <= 0) return 0;
+    if ((uint32_t)wait_ms >= TICK_NO_EVENT / 1000) return TICK_NO_EVENT - 1;
+    return (uint32_t)wait_ms * 1000 - now_frac_us;
+}
+
+// Arm this CPU's LAPIC for the nearest real event
+static void tick_program_next(void) {
+    cpu_t* cpu = this_cpu();
+    tick_cpu_t* tc = &tick_cpus[cpu->id];
+    tick_mode_t mode = tick_cpu_mode(cpu->id);
+
+    uint32_t uncharged_us = tc->pending_ticks * TICK_PERIOD_US + tc->frac_us;
+    uint32_t delta = scheduler_next_event_us(uncharged_us);
+    bool slice_event = delta != TICK_NO_EVENT;
+    bool wakeup_event = false;
+
+    // Timers (sleepers, IPC timeouts) run on the boot CPU only, so the
+    // other CPUs never take an interrupt on their behalf
+    if (cpu->id == BOOT_CPU) {
+        uint32_t wait_us = tick_next_wakeup_us();
+        if (wait_us < delta) {
+            delta = wait_us;
+            wakeup_event = true;
+            slice_event = false;
+        }
+    }
+
+    if (delta == TICK_NO_EVENT) {
+        tc->stats.idle_stops++;
+    } else if (wakeup_event) {
+        tc->stats.wakeup_events++;
+    } else if (slice_event) {
+        tc->stats.slice_events++;
+    }
+
+    // Realtime CPUs with nothing pending stop the timer outright. Without
+    // the TSC the one-shot counter is also the clock, so it has to keep
+    // running and we only defer as far as it can reach.
+    if (delta == TICK_NO_EVENT && mode == TICK_MODE_NOHZ_FULL && tsc_timekeeping) {
+        lapic_timer_stop();
+        tc->stats.timer_stops++;
+        return;
+    }
+
+    // Ordinary CPUs still wake for housekeeping; application processors
+    // emulate the periodic tick with back-to-back one-shots
+    if (mode == TICK_MODE_NOHZ_IDLE && delta > TICK_MAX_DEFER_US) {
+        delta = TICK_MAX_DEFER_US;
+    } else if (mode == TICK_MODE_PERIODIC && delta > TICK_PERIOD_US) {
+        delta = TICK_PERIOD_US;
+    }
+    if (delta < TICK_MIN_EVENT_US) {
+        delta = TICK_MIN_EVENT_US;
+    }
+
+    if (tsc_timekeeping && lapic_timer_has_tsc_deadline()) {
+        lapic_timer_arm_deadline(rdtsc() + tsc_ns_to_cycles((uint64_t)delta * NSEC_PER_USEC));
+    } else {
+        tc->armed_count = lapic_us_to_ticks(delta);
+        if (tc->armed_count == 0) tc->armed_count = 1;
+        lapic_timer_arm(tc->armed_count);
+    }
+    tc->stats.reprograms++;
+}
+
+// The PIT drives only the boot CPU's periodic tick; everything else runs
+// off its own LAPIC
+static bool tick_uses_lapic(uint32_t cpu) {
+    return cpu != BOOT_CPU || tick_cpu_mode(cpu) != TICK_MODE_PERIODIC;
+}
+
+void tick_sync(void) {
+    uint32_t flags = irq_save();
+    tick_advance();
+    irq_restore(flags);
+}
+
+void tick_reprogram(void) {
+    uint32_t flags = irq_save();
+    tick_cpu_t* tc = tick_this_cpu();
+    if (tick_uses_lapic(this_cpu()->id) && !tc->in_handler) {
+        tick_advance();
+        tick_program_next();
+    }
+    irq_restore(flags);
+}
+
+// Re-evaluate another CPU's next event: the reschedule IPI makes it run
+// through its own tick path
+void tick_reprogram_cpu(uint32_t cpu) {
+    if (cpu == this_cpu()->id) {
+        tick_reprogram();
+    } else {
+        smp_send_resched(cpu);
+    }
+}
+
+// Common tail of the timer interrupt and the reschedule IPI
+static void tick_run(bool periodic_tick) {
+    cpu_t* cpu = this_cpu();
+    tick_cpu_t* tc = &tick_cpus[cpu->id];
+
+    tc->in_handler = true;
+    if (periodic_tick && !tsc_timekeeping) {
+        tick_cpu_add_us(tc, TICK_PERIOD_US);
+        uint32_t flags = spin_lock_irqsave(&clock_lock);
+        tick_clock_add_us(TICK_PERIOD_US);
+        spin_unlock_irqrestore(&clock_lock, flags);
+    } else {
+        tick_advance();
+    }
+    if (cpu->id == BOOT_CPU) {
+        timer_run(time_ms);
+    }
+    tc->in_handler = false;
+
+    // Arm before charging the scheduler: a preemption switches away from
+    // here and the switch path re-arms for the incoming process
+    if (tick_uses_lapic(cpu->id)) {
+        tick_program_next();
+    }
+
+    uint32_t ticks = tc->pending_ticks;
+    tc->pending_ticks = 0;
+    scheduler_account_ticks(ticks);
+}
+
+// Timer interrupt entry for both the PIT (periodic) and LAPIC (one-shot)
+void tick_handle_interrupt(void) {
+    tick_this_cpu()->stats.interrupts++;
+    tick_run(tick_cpu_mode(this_cpu()->id) == TICK_MODE_PERIODIC);
+}
+
+void tick_handle_resched(void) {
+    tick_run(false);
+}
+
+int tick_set_mode(tick_mode_t mode) {
+    if (mode != TICK_MODE_PERIODIC && !lapic_available()) {
+        return -1;
+    }
+
+    uint32_t flags = irq_save();
+    tick_advance();
+
+    if (mode == TICK_MODE_PERIODIC) {
+        lapic_timer_stop();
+        irq_unmask(IRQ_TIMER);
+        tick_mode = mode;
+    } else {
+        irq_mask(IRQ_TIMER);
+        tick_mode = mode;
+        tick_program_next();
+    }
+
+    irq_restore(flags);
+
+    // The other CPUs pick the new mode up on their next reprogram
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (cpu != this_cpu()->id && cpus[cpu].online) {
+            smp_send_resched(cpu);
+        }
+    }
+    return 0;
+}
+
+void tick_init(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("Initializing tick source...\n");
+
+    memset(tick_cpus, 0, sizeof(tick_cpus));
+
+    // PIT drives the periodic tick until (and unless) the LAPIC takes over
+    pit_init(SCHEDULER_FREQUENCY);
+    
+    if (tsc_init()) {
+        uint32_t flags = irq_save();
+        tick_advance(); // Settle any pending periodic time first
+        clock_last_ns = ktime_ns();
+        tick_this_cpu()->last_ns = clock_last_ns;
+        tsc_timekeeping = true;
+        irq_restore(flags);
+    }
+
+    if (lapic_init() && tick_set_mode(TICK_MODE_NOHZ_IDLE) == 0) {
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        if (tsc_timekeeping && lapic_timer_has_tsc_deadline()) {
+            vga_write_string("Tickless mode enabled (TSC-deadline LAPIC timer)\n");
+        } else {
+            vga_write_string("Tickless mode enabled (one-shot LAPIC timer)\n");
+        }
+    } else {
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_write_string("Periodic tick at ");
+        print_dec(SCHEDULER_FREQUENCY);
+        vga_write_string(" Hz\n");
+    }
+}
+
+// Application processors only come up with a TSC clocksource, so they
+// need no clock of their own: just a baseline and the first shot
+void tick_init_ap(void) {
+    uint32_t flags = irq_save();
+    tick_cpu_t* tc = tick_this_cpu();
+    memset(tc, 0, sizeof(*tc));
+    tc->last_ns = ktime_ns();
+    tick_program_next();
+    irq_restore(flags);
+}
+
+void tick_get_stats(tick_stats_t* stats) {
+    if (!stats) return;
+
+    memset(stats, 0, sizeof(*stats));
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        const tick_stats_t* s = &tick_cpus[cpu].stats;
+        stats->interrupts += s->interrupts;
+        stats->reprograms += s->reprograms;
+        stats->wakeup_events += s->wakeup_events;
+        stats->slice_events += s->slice_events;
+        stats->idle_stops += s->idle_stops;
+        stats->timer_stops += s->timer_stops;
+    }
+}
+
+static void tick_print_mode(tick_mode_t mode) {
+    switch (mode) {
+        case TICK_MODE_PERIODIC: vga_write_string("periodic"); break;
+        case TICK_MODE_NOHZ_IDLE: vga_write_string("nohz idle"); break;
+        case TICK_MODE_NOHZ_FULL: vga_write_string("nohz full"); break;
+    }
+}
+
+void tick_print_info(void) {
+    tick_stats_t stats;
+    tick_get_stats(&stats);
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Tick Information ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string("Mode: ");
+    tick_print_mode(tick_mode);
+    vga_write_string("\n");
+
+    vga_write_string("Clocksource: ");
+    if (tsc_timekeeping) {
+        vga_write_string("TSC ");
+        print_dec(tsc_get_khz());
+        vga_write_string(" kHz\n");
+    } else {
+        vga_write_string("timer interrupts\n");
+    }
+
+    vga_write_string("Uptime: ");
+    print_dec(time_ms);
+    vga_write_string(" ms (");
+    print_dec(jiffies);
+    vga_write_string(" ticks)\n");
+
+    vga_write_string("Timer interrupts: ");
+    print_dec(stats.interrupts);
+    vga_write_string("\nOne-shot reprograms: ");
+    print_dec(stats.reprograms);
+    vga_write_string("\n  slice expiry: ");
+    print_dec(stats.slice_events);
+    vga_write_string("\n  sleeper wakeup: ");
+    print_dec(stats.wakeup_events);
+    vga_write_string("\n  no event: ");
+    print_dec(stats.idle_stops);
+    vga_write_string("\nTimer fully stopped: ");
+    print_dec(stats.timer_stops);
+    vga_write_string("\n");
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!cpus[cpu].online) continue;
+        vga_write_string("  CPU ");
+        print_dec(cpu);
+        vga_write_string(": ");
+        tick_print_mode(tick_cpu_mode(cpu));
+        vga_write_string(", ");
+        print_dec(tick_cpus[cpu].stats.interrupts);
+        vga_write_string(" interrupts\n");
+    }
+}
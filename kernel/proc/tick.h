@@ -0,0 +1,48 @@
+#ifndef TICK_H
+#define TICK_H
+
+#include "../types.h"
+#include "process.h"
+
+// Tick modes
+typedef enum {
+    TICK_MODE_PERIODIC = 0,     // PIT interrupt every tick (fallback without LAPIC)
+    TICK_MODE_NOHZ_IDLE,        // One-shot LAPIC timer, deferment bounded for housekeeping
+    TICK_MODE_NOHZ_FULL         // Realtime CPU: no interrupt unless an event is due
+} tick_mode_t;
+
+#define TICK_PERIOD_US      (1000000 / SCHEDULER_FREQUENCY)
+#define TICK_NO_EVENT       0xFFFFFFFF
+#define TICK_MAX_DEFER_US   1000000     // NOHZ_IDLE still wakes once a second (load average)
+#define TICK_MIN_EVENT_US   2           // Shortest one-shot we program
+#define TICK_ACCOUNT_CHUNK_US 1000000000 // Largest step fed to the tick accounting
+
+// Tick statistics (kept per CPU, summed by tick_get_stats)
+typedef struct {
+    uint32_t interrupts;        // Timer interrupts taken
+    uint32_t reprograms;        // One-shot programming operations
+    uint32_t wakeup_events;     // Shots armed for a sleeper wakeup
+    uint32_t slice_events;      // Shots armed for a time slice expiry
+    uint32_t idle_stops;        // Shots armed with no pending event at all
+    uint32_t timer_stops;       // Times the timer was stopped outright (nohz full)
+} tick_stats_t;
+
+// Tick management
+void tick_init(void);
+void tick_init_ap(void);            // Start the tick on an application processor
+void tick_handle_interrupt(void);   // Called from the PIT and LAPIC timer handlers
+void tick_handle_resched(void);     // Called from the reschedule IPI
+void tick_reprogram(void);          // Re-evaluate this CPU's next event (e.g. after a wakeup)
+void tick_reprogram_cpu(uint32_t cpu);
+void tick_sync(void);               // Fold time elapsed since the last interrupt
+int tick_set_mode(tick_mode_t mode);
+tick_mode_t tick_get_mode(void);
+tick_mode_t tick_cpu_mode(uint32_t cpu);   // Isolated CPUs always run nohz full
+uint32_t tick_get_time_ms(void);
+void tick_get_stats(tick_stats_t* stats);
+void tick_print_info(void);
+
+// Elapsed scheduler ticks since boot
+uint32_t get_ticks(void);
+
+#endif // TICK_H
@@ -0,0 +1,300 @@
+#include "timer.h"
+#include "tick.h"
+#include "../arch/spinlock.h"
+#include "../arch/smp.h"
+#include "../arch/cpu.h"
+#include "process.h"
+#include "../drivers/vga.h"
+
+// wheel[level][slot] lists, with one occupancy bit per slot
+static ktimer_t* wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+static uint32_t wheel_bitmap[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS / 32];
+static uint32_t wheel_clock;        // Next millisecond to process
+static spinlock_t timer_lock = SPINLOCK_INIT;
+static timer_stats_t timer_stats;
+static ktimer_t* volatile timer_running;    // Callback the boot CPU is in
+
+static inline uint32_t level_shift(uint32_t level) {
+    return level * TIMER_WHEEL_BITS;
+}
+
+// Distance from 'start' to the first occupied slot at or after it,
+// wrapping around, or -1 if the level is empty
+static int wheel_next_slot(uint32_t level, uint32_t start) {
+    for (uint32_t d = 0; d < TIMER_WHEEL_SLOTS; ) {
+        uint32_t slot = (start + d) & TIMER_WHEEL_MASK;
+        uint32_t word = wheel_bitmap[level][slot >> 5] >> (slot & 31);
+        if (word) {
+            return (int)(d + __builtin_ctz(word));
+        }
+        d += 32 - (slot & 31);
+    }
+    return -1;
+}
+
+// Link a timer into the slot its expiry falls in (timer_lock held)
+static void wheel_insert(ktimer_t* timer) {
+    uint32_t expires = timer->expires;
+    uint32_t delta = expires - wheel_clock;
+    if ((int32_t)delta < 0) {
+        expires = wheel_clock;      // Already due: next run picks it up
+        delta = 0;
+    } else if (delta > TIMER_MAX_DELAY_MS) {
+        expires = wheel_clock + TIMER_MAX_DELAY_MS;     // Re-cascaded until due
+        delta = TIMER_MAX_DELAY_MS;
+    }
+
+    uint32_t level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= (1u << level_shift(level + 1))) {
+        level++;
+    }
+    uint32_t slot = (expires >> level_shift(level)) & TIMER_WHEEL_MASK;
+
+    timer->level = (uint8_t)level;
+    timer->slot = (uint8_t)slot;
+    timer->prev = NULL;
+    timer->next = wheel[level][slot];
+    if (timer->next) {
+        timer->next->prev = timer;
+    }
+    wheel[level][slot] = timer;
+    wheel_bitmap[level][slot >> 5] |= 1u << (slot & 31);
+}
+
+static void wheel_unlink(ktimer_t* timer) {
+    uint32_t level = timer->level;
+    uint32_t slot = timer->slot;
+
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        wheel[level][slot] = timer->next;
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    timer->next = NULL;
+    timer->prev = NULL;
+
+    if (!wheel[level][slot]) {
+        wheel_bitmap[level][slot >> 5] &= ~(1u << (slot & 31));
+    }
+}
+
+// Earliest time anything on the wheel can expire (timer_lock held).
+// Level 0 is exact; a higher level answers with the time its next
+// occupied slot cascades, which is never later than its expiries.
+static bool wheel_next_expiry(uint32_t* expires) {
+    bool found = false;
+    uint32_t best = 0;
+
+    for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint32_t shift = level_shift(level);
+        uint32_t index = (wheel_clock >> shift) & TIMER_WHEEL_MASK;
+        uint32_t when;
+
+        if (level == 0) {
+            int d = wheel_next_slot(0, index);
+            if (d < 0) continue;
+            when = wheel_clock + (uint32_t)d;
+        } else {
+            // The current slot of a higher level cascaded already, so its
+            // entries are a full turn away
+            int d = wheel_next_slot(level, (index + 1) & TIMER_WHEEL_MASK);
+            if (d < 0) continue;
+            when = ((wheel_clock >> shift) + (uint32_t)d + 1) << shift;
+        }
+
+        if (!found || (int32_t)(when - best) < 0) {
+            best = when;
+            found = true;
+        }
+    }
+
+    if (found) {
+        *expires = best;
+    }
+    return found;
+}
+
+// Move the timers of the slot that has come round at each higher level
+// down the wheel (timer_lock held, wheel_clock on a level 0 boundary)
+static void wheel_cascade(void) {
+    for (uint32_t level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        uint32_t index = (wheel_clock >> level_shift(level)) & TIMER_WHEEL_MASK;
+
+        ktimer_t* timer = wheel[level][index];
+        wheel[level][index] = NULL;
+        wheel_bitmap[level][index >> 5] &= ~(1u << (index & 31));
+        while (timer) {
+            ktimer_t* next = timer->next;
+            wheel_insert(timer);
+            timer_stats.cascaded++;
+            timer = next;
+        }
+
+        // Only a wrap at this level reaches the next one
+        if (index != 0) break;
+    }
+}
+
+void timer_init(void) {
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (uint32_t slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            wheel[level][slot] = NULL;
+        }
+        for (uint32_t w = 0; w < TIMER_WHEEL_SLOTS / 32; w++) {
+            wheel_bitmap[level][w] = 0;
+        }
+    }
+    wheel_clock = tick_get_time_ms();
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+void timer_setup(ktimer_t* timer, ktimer_fn_t fn, void* data) {
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->fn = fn;
+    timer->data = data;
+    timer->pending = false;
+}
+
+void timer_arm(ktimer_t* timer, uint32_t expires_ms) {
+    if (!timer || !timer->fn) return;
+
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    if (timer->pending) {
+        wheel_unlink(timer);
+    } else {
+        timer_stats.pending++;
+    }
+
+    uint32_t earliest;
+    bool had_next = wheel_next_expiry(&earliest);
+
+    timer->expires = expires_ms;
+    timer->pending = true;
+    wheel_insert(timer);
+    timer_stats.armed++;
+    spin_unlock_irqrestore(&timer_lock, flags);
+
+    // The boot CPU runs the wheel; its tick may have to come sooner
+    if (!had_next || (int32_t)(expires_ms - earliest) < 0) {
+        tick_reprogram_cpu(BOOT_CPU);
+    }
+}
+
+bool timer_cancel(ktimer_t* timer) {
+    if (!timer) return false;
+
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    bool was_pending = timer->pending;
+    if (was_pending) {
+        wheel_unlink(timer);
+        timer->pending = false;
+        timer_stats.pending--;
+        timer_stats.cancelled++;
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return was_pending;
+}
+
+// Callbacks run from the boot CPU's tick, so on it none can be mid-run
+// here unless this is one: only the other CPUs wait
+bool timer_cancel_sync(ktimer_t* timer) {
+    bool was_pending = timer_cancel(timer);
+    if (timer && this_cpu()->id != BOOT_CPU) {
+        while (timer_running == timer) {
+            cpu_relax();
+        }
+    }
+    return was_pending;
+}
+
+// Run every timer due by 'now_ms'. Empty stretches of level 0 are skipped
+// a whole turn at a time, so a long tickless sleep costs little to catch up.
+void timer_run(uint32_t now_ms) {
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+
+    while ((int32_t)(now_ms - wheel_clock) >= 0) {
+        uint32_t index = wheel_clock & TIMER_WHEEL_MASK;
+        if (index == 0) {
+            wheel_cascade();
+        }
+
+        // Nothing due before the next cascade: jump to it
+        int d = wheel_next_slot(0, index);
+        if (d < 0 || index + (uint32_t)d > TIMER_WHEEL_MASK) {
+            uint32_t boundary = (wheel_clock | TIMER_WHEEL_MASK) + 1;
+            wheel_clock = ((int32_t)(boundary - now_ms) > 0) ? now_ms + 1 : boundary;
+            continue;
+        }
+        if (d > 0) {
+            // Never past now + 1: anything armed later must still land ahead
+            uint32_t next = wheel_clock + (uint32_t)d;
+            wheel_clock = ((int32_t)(next - now_ms) > 0) ? now_ms + 1 : next;
+            continue;
+        }
+
+        // Callbacks may re-arm into this slot, so drain it until empty
+        ktimer_t* timer;
+        while ((timer = wheel[0][index]) != NULL) {
+            wheel_unlink(timer);
+            timer->pending = false;
+            timer_stats.pending--;
+            timer_stats.fired++;
+
+            ktimer_fn_t fn = timer->fn;
+            void* data = timer->data;
+            timer_running = timer;
+            spin_unlock_irqrestore(&timer_lock, flags);
+            fn(data);
+            flags = spin_lock_irqsave(&timer_lock);
+            timer_running = NULL;
+        }
+        wheel_clock++;
+    }
+
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+bool timer_next_expiry(uint32_t* expires_ms) {
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    bool found = wheel_next_expiry(expires_ms);
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return found;
+}
+
+void timer_get_stats(timer_stats_t* stats) {
+    if (!stats) return;
+    *stats = timer_stats;
+}
+
+void timer_print_info(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Timer Wheel ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string("Pending: ");
+    print_dec(timer_stats.pending);
+    vga_write_string("  Armed: ");
+    print_dec(timer_stats.armed);
+    vga_write_string("  Fired: ");
+    print_dec(timer_stats.fired);
+    vga_write_string("  Cancelled: ");
+    print_dec(timer_stats.cancelled);
+    vga_write_string("  Cascaded: ");
+    print_dec(timer_stats.cascaded);
+    vga_write_string("\n");
+
+    uint32_t next;
+    if (timer_next_expiry(&next)) {
+        vga_write_string("Next expiry at ");
+        print_dec(next);
+        vga_write_string(" ms (now ");
+        print_dec(tick_get_time_ms());
+        vga_write_string(" ms)\n");
+    }
+}
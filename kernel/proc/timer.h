@@ -0,0 +1,49 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "../types.h"
+
+// Hierarchical timer wheel at millisecond resolution (the tick clock).
+// Level 0 holds timers due within TIMER_WHEEL_SLOTS ms, every further level
+// covers TIMER_WHEEL_SLOTS times the range of the one below and is cascaded
+// down as the wheel turns. Arming and cancelling are O(1); the boot CPU
+// runs expired timers from its tick, and the tickless code programs the
+// one-shot timer for the next expiry.
+#define TIMER_WHEEL_BITS        6
+#define TIMER_WHEEL_SLOTS       (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK        (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS      4
+#define TIMER_MAX_DELAY_MS      ((1u << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+typedef void (*ktimer_fn_t)(void* data);
+
+typedef struct ktimer {
+    struct ktimer* next;
+    struct ktimer* prev;
+    uint32_t expires;           // Absolute time (ms)
+    ktimer_fn_t fn;             // Runs on the boot CPU, from the tick
+    void* data;
+    uint8_t level;              // Wheel position while pending
+    uint8_t slot;
+    volatile bool pending;
+} ktimer_t;
+
+typedef struct {
+    uint32_t armed;             // timer_arm calls
+    uint32_t fired;             // Callbacks run
+    uint32_t cancelled;         // Pending timers cancelled
+    uint32_t cascaded;          // Timers moved to a lower level
+    uint32_t pending;           // Currently armed
+} timer_stats_t;
+
+void timer_init(void);
+void timer_setup(ktimer_t* timer, ktimer_fn_t fn, void* data);
+void timer_arm(ktimer_t* timer, uint32_t expires_ms);  // Re-arms if pending
+bool timer_cancel(ktimer_t* timer);                         // True if it was pending
+bool timer_cancel_sync(ktimer_t* timer);                    // And its callback not running
+void timer_run(uint32_t now_ms);                            // Boot CPU tick
+bool timer_next_expiry(uint32_t* expires_ms);               // Lower bound on the next expiry
+void timer_get_stats(timer_stats_t* stats);
+void timer_print_info(void);
+
+#endif // TIMER_H
@@ -0,0 +1,415 @@
+#include "uring.h"
+#include "process.h"
+#include "futex.h"
+#include "ipc.h"
+#include "syscalls.h"
+#include "../net/socket.h"
+#include "../arch/smp.h"
+#include "../arch/tsc.h"
+#include "../arch/div64.h"
+#include "../mm/memory.h"
+#include "../drivers/vga.h"
+
+typedef struct {
+    uint32_t rings;                 // Rings set up
+    uint32_t enters;                // SYS_URING_ENTER calls
+    uint32_t entries;               // Submissions consumed
+    uint32_t poller_wakeups;        // Doorbells that woke the poller
+} uring_stats_t;
+
+static uring_stats_t uring_stats;
+
+// Poller state; poll_mutex covers the ring list and starting the poller.
+// A poll pass drops it while a ring drains, holding that ring's lock, so
+// lock order is poll_mutex, then ring->lock.
+static kmutex_t poll_mutex = KMUTEX_INIT("uring_poll");
+static uring_t* poll_list = NULL;
+static process_t* poller = NULL;
+static volatile uint32_t poller_seq = 0;    // Futex word the idle poller sleeps on
+static volatile bool poller_asleep = false;
+
+// Neither blocking nor touching the process's life: exit, kill, fork,
+// exec and wait would free or outlive the ring being drained, and the
+// rings themselves would deadlock re-entered
+static bool uring_syscall_allowed(uint32_t num) {
+    switch (num) {
+    case SYS_GETPID:
+    case SYS_PAGEFAULTS:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static int32_t uring_execute(const uring_sqe_t* sqe, uint32_t nowait) {
+    switch (sqe->opcode) {
+    case URING_OP_NOP:
+        return 0;
+    case URING_OP_SYSCALL:
+        if (!uring_syscall_allowed(sqe->num)) return -1;
+        return (int32_t)syscall_handler(sqe->num, sqe->args[0], sqe->args[1], sqe->args[2], sqe->args[3]);
+    case URING_OP_MSGSND:
+        return msgsnd(sqe->args[0], (const message_t*)sqe->args[1], sqe->args[2], sqe->args[3] | nowait);
+    case URING_OP_SEND_ORDER:
+        return send_order_flags(sqe->args[0], (const order_t*)sqe->args[1], nowait);
+    case URING_OP_PIPE_WRITE:
+        return pipe_write((pipe_t*)sqe->args[0], (const void*)sqe->args[1], sqe->args[2], sqe->args[3] | nowait);
+    case URING_OP_SOCKET_SEND: {
+        socket_t* sock = socket_get((int)sqe->args[0]);
+        if (nowait && sock && sock->type == SOCK_STREAM) return -1;
+        return socket_send((int)sqe->args[0], (const void*)sqe->args[1], sqe->args[2]);
+    }
+    default:
+        return -1;
+    }
+}
+
+// Consume up to 'limit' submissions (ring->lock held). Only as many as
+// the completion ring has room for are taken. 'nowait': IPC_NOWAIT or 0.
+static uint32_t uring_drain(uring_t* ring, uint32_t limit, uint32_t nowait) {
+    uint32_t head = ring->sq_head;
+    uint32_t tail = ring->sq_tail;
+    __sync_synchronize();           // Entries read after the tail
+    uint32_t room = (ring->cq_mask + 1) - (ring->cq_tail - ring->cq_head);
+    uint32_t done = 0;
+
+    while (head != tail && done < limit && done < room) {
+        uring_sqe_t sqe = ring->sqes[head & ring->sq_mask];
+        head++;
+        ring->sq_head = head;       // Slot free as soon as it is copied
+
+        uring_cqe_t* cqe = &ring->cqes[ring->cq_tail & ring->cq_mask];
+        cqe->user_data = sqe.user_data;
+        cqe->result = uring_execute(&sqe, nowait);
+        __sync_synchronize();       // Completion visible before the tail
+        ring->cq_tail++;
+        done++;
+    }
+
+    if (done) {
+        ring->submitted += done;
+        __sync_fetch_and_add(&uring_stats.entries, done);
+        if (ring->cq_waiters) {
+            futex_wake(&ring->cq_tail, FUTEX_WAKE_ALL);
+        }
+    }
+    return done;
+}
+
+static void uring_free(uring_t* ring) {
+    if (ring->sqes) kfree(ring->sqes);
+    if (ring->cqes) kfree(ring->cqes);
+    kfree(ring);
+}
+
+uring_t* uring_setup(process_t* process, uint32_t entries, uint32_t flags) {
+    if (!process || process->uring || entries == 0 || entries > URING_MAX_ENTRIES) return NULL;
+
+    uint32_t size = 1;
+    while (size < entries) size <<= 1;
+
+    if ((flags & URING_SETUP_SQPOLL) && uring_start_poller() < 0) return NULL;
+
+    uring_t* ring = (uring_t*)kmalloc(sizeof(uring_t));
+    if (!ring) return NULL;
+    memset(ring, 0, sizeof(uring_t));
+    ring->sqes = (uring_sqe_t*)kmalloc(size * sizeof(uring_sqe_t));
+    ring->cqes = (uring_cqe_t*)kmalloc(2 * size * sizeof(uring_cqe_t));
+    if (!ring->sqes || !ring->cqes) {
+        uring_free(ring);
+        return NULL;
+    }
+    memset(ring->sqes, 0, size * sizeof(uring_sqe_t));
+    memset(ring->cqes, 0, 2 * size * sizeof(uring_cqe_t));
+
+    ring->sq_mask = size - 1;
+    ring->cq_mask = 2 * size - 1;
+    kmutex_init(&ring->lock, "uring");
+    ring->owner = process;
+    ring->sqpoll = (flags & URING_SETUP_SQPOLL) != 0;
+    process->uring = ring;
+    __sync_fetch_and_add(&uring_stats.rings, 1);
+
+    if (ring->sqpoll) {
+        kmutex_lock(&poll_mutex);
+        ring->sq_flags = poller_asleep ? URING_SQ_NEED_WAKEUP : 0;
+        ring->poll_next = poll_list;
+        poll_list = ring;
+        kmutex_unlock(&poll_mutex);
+    }
+    return ring;
+}
+
+static void uring_wake_poller(void) {
+    __sync_fetch_and_add(&poller_seq, 1);
+    if (futex_wake(&poller_seq, 1)) {
+        __sync_fetch_and_add(&uring_stats.poller_wakeups, 1);
+    }
+}
+
+int uring_enter(uring_t* ring, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    if (!ring) return -1;
+    ring->doorbells++;
+    __sync_fetch_and_add(&uring_stats.enters, 1);
+
+    int submitted = 0;
+    if (ring->sqpoll) {
+        if ((flags & URING_ENTER_SQ_WAKEUP) || (ring->sq_flags & URING_SQ_NEED_WAKEUP)) {
+            uring_wake_poller();
+        }
+    } else if (to_submit) {
+        if (kmutex_lock(&ring->lock) < 0) return -1;
+        submitted = (int)uring_drain(ring, to_submit, 0);
+        kmutex_unlock(&ring->lock);
+    }
+
+    if (flags & URING_ENTER_GETEVENTS) {
+        __sync_fetch_and_add(&ring->cq_waiters, 1);
+        while (ring->cq_tail - ring->cq_head < min_complete) {
+            uint32_t seen = ring->cq_tail;
+            if (ring->cq_tail - ring->cq_head >= min_complete) break;
+            if (futex_wait(&ring->cq_tail, seen, FUTEX_WAIT_FOREVER) < 0) break;
+        }
+        __sync_fetch_and_sub(&ring->cq_waiters, 1);
+    }
+    return submitted;
+}
+
+void uring_release(process_t* process) {
+    uring_t* ring = process->uring;
+    if (!ring) return;
+    process->uring = NULL;
+
+    // Off the list no poll pass can pick it again; its lock waits out
+    // one draining it now
+    if (ring->sqpoll) {
+        kmutex_lock(&poll_mutex);
+        for (uring_t** link = &poll_list; *link; link = &(*link)->poll_next) {
+            if (*link == ring) {
+                *link = ring->poll_next;
+                break;
+            }
+        }
+        kmutex_unlock(&poll_mutex);
+        kmutex_lock(&ring->lock);
+        kmutex_unlock(&ring->lock);
+    }
+    uring_free(ring);
+}
+
+// Set or clear the doorbell request on every polled ring (poll_mutex held)
+static void uring_poll_flag(bool need_wakeup) {
+    for (uring_t* ring = poll_list; ring; ring = ring->poll_next) {
+        ring->sq_flags = need_wakeup ? URING_SQ_NEED_WAKEUP : 0;
+    }
+}
+
+static bool uring_poll_pending(void) {
+    for (uring_t* ring = poll_list; ring; ring = ring->poll_next) {
+        if (ring->sq_head != ring->sq_tail) return true;
+    }
+    return false;
+}
+
+// A ring with submissions this pass has not drained yet (poll_mutex held)
+static uring_t* uring_poll_next(uint32_t pass) {
+    for (uring_t* ring = poll_list; ring; ring = ring->poll_next) {
+        if (ring->poll_pass != pass && ring->sq_head != ring->sq_tail) {
+            ring->poll_pass = pass;
+            return ring;
+        }
+    }
+    return NULL;
+}
+
+static void uring_poll_task(void) {
+    uint64_t idle_limit = tsc_ns_to_cycles((uint64_t)URING_SQPOLL_IDLE_US * NSEC_PER_USEC);
+    uint64_t idle_since = rdtsc();
+    uint32_t pass = 0;
+
+    while (1) {
+        uint32_t work = 0;
+        uring_t* ring;
+        pass++;
+        kmutex_lock(&poll_mutex);
+        while ((ring = uring_poll_next(pass)) != NULL) {
+            kmutex_lock(&ring->lock);
+            kmutex_unlock(&poll_mutex);
+            uint32_t done = uring_drain(ring, 0xFFFFFFFF, IPC_NOWAIT);
+            ring->polled += done;
+            work += done;
+            kmutex_unlock(&ring->lock);
+            kmutex_lock(&poll_mutex);
+        }
+        kmutex_unlock(&poll_mutex);
+
+        if (work || rdtsc() - idle_since < idle_limit) {
+            if (work) idle_since = rdtsc();
+            cpu_relax();
+            continue;
+        }
+
+        // Ask for doorbells, then look once more: a submitter either sees
+        // the flag or its tail is seen here
+        uint32_t seq = poller_seq;
+        kmutex_lock(&poll_mutex);
+        poller_asleep = true;
+        uring_poll_flag(true);
+        __sync_synchronize();
+        bool pending = uring_poll_pending();
+        kmutex_unlock(&poll_mutex);
+
+        if (!pending) {
+            futex_wait(&poller_seq, seq, FUTEX_WAIT_FOREVER);
+        }
+
+        kmutex_lock(&poll_mutex);
+        poller_asleep = false;
+        uring_poll_flag(false);
+        kmutex_unlock(&poll_mutex);
+        idle_since = rdtsc();
+    }
+}
+
+// poll_mutex held, so two SQPOLL setups cannot both start one
+static int uring_start_poller_locked(void) {
+    if (poller) return (int)poller->pinned_cpu;
+    if (!tsc_available()) return -1;
+
+    int32_t cpu = -1;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (smp_cpu_online(i) && smp_cpu_isolated(i)) {
+            cpu = (int32_t)i;
+            break;
+        }
+    }
+    if (cpu < 0) return -1;
+
+    process_t* task = process_create("uring_poll", uring_poll_task, PRIORITY_REALTIME);
+    if (!task) return -1;
+    task->policy = SCHED_FIFO;
+    if (scheduler_set_affinity(task, cpu) < 0) {
+        process_destroy(task);
+        return -1;
+    }
+    poller = task;
+    scheduler_add_process(task);
+    return cpu;
+}
+
+int uring_start_poller(void) {
+    kmutex_lock(&poll_mutex);
+    int cpu = uring_start_poller_locked();
+    kmutex_unlock(&poll_mutex);
+    return cpu;
+}
+
+uint32_t sys_uring_setup(uint32_t entries, uint32_t flags, uint32_t arg3, uint32_t arg4) {
+    (void)arg3; (void)arg4;
+    uring_t* ring = uring_setup(current_process, entries, flags);
+    return ring ? (uint32_t)ring : (uint32_t)-1;
+}
+
+uint32_t sys_uring_enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags, uint32_t arg4) {
+    (void)arg4;
+    if (!current_process) return (uint32_t)-1;
+    return (uint32_t)uring_enter(current_process->uring, to_submit, min_complete, flags);
+}
+
+void uring_print_info(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Syscall Rings ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string("Rings: ");
+    print_dec(uring_stats.rings);
+    vga_write_string("  Enters: ");
+    print_dec(uring_stats.enters);
+    vga_write_string("  Entries: ");
+    print_dec(uring_stats.entries);
+    vga_write_string("\nPoller: ");
+    if (poller) {
+        vga_write_string("CPU ");
+        print_dec(poller->pinned_cpu);
+        vga_write_string(poller_asleep ? " (asleep)" : " (polling)");
+        vga_write_string("  Wakeups: ");
+        print_dec(uring_stats.poller_wakeups);
+        vga_write_string("\n");
+    } else {
+        vga_write_string("none (needs an isolated CPU)\n");
+    }
+
+    kmutex_lock(&poll_mutex);
+    for (uring_t* ring = poll_list; ring; ring = ring->poll_next) {
+        vga_write_string("  PID ");
+        print_dec(ring->owner->pid);
+        vga_write_string(": polled ");
+        print_dec(ring->polled);
+        vga_write_string(" doorbells ");
+        print_dec(ring->doorbells);
+        vga_write_string("\n");
+    }
+    kmutex_unlock(&poll_mutex);
+}
+
+// Trap per call against one doorbell per full ring of the same calls
+void uring_bench(uint32_t iterations) {
+    process_t* self = current_process;
+    if (!self || !tsc_available()) {
+        vga_write_string("uring bench needs a process and a calibrated TSC\n");
+        return;
+    }
+    if (self->uring) {
+        vga_write_string("This process already has a ring\n");
+        return;
+    }
+    uring_t* ring = uring_setup(self, URING_MAX_ENTRIES, 0);
+    if (!ring) {
+        vga_write_string("Ring setup failed\n");
+        return;
+    }
+
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint32_t result;
+        __asm__ volatile ("int $0x80" : "=a"(result) : "a"(SYS_GETPID), "b"(0), "c"(0), "d"(0), "S"(0) : "memory");
+    }
+    uint64_t single = rdtsc() - start;
+
+    uint32_t traps = 0;
+    start = rdtsc();
+    for (uint32_t done = 0; done < iterations; ) {
+        uint32_t batch = 0;
+        uring_sqe_t* sqe;
+        while (done + batch < iterations && (sqe = uring_get_sqe(ring, batch)) != NULL) {
+            sqe->opcode = URING_OP_SYSCALL;
+            sqe->num = SYS_GETPID;
+            sqe->user_data = done + batch;
+            batch++;
+        }
+        uring_submit_sqes(ring, batch);
+
+        uint32_t result;
+        __asm__ volatile ("int $0x80" : "=a"(result) : "a"(SYS_URING_ENTER), "b"(batch), "c"(0), "d"(0), "S"(0) : "memory");
+        traps++;
+        while (uring_peek_cqe(ring)) {
+            uring_cqe_seen(ring);
+        }
+        done += batch;
+    }
+    uint64_t batched = rdtsc() - start;
+    uring_release(self);
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== SYS_GETPID x ");
+    print_dec(iterations);
+    vga_write_string(" ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("One trap each:    ");
+    print_dec((uint32_t)div_u64_u32(single, iterations, NULL));
+    vga_write_string(" cycles/call\nRing, ");
+    print_dec(traps);
+    vga_write_string(" traps: ");
+    print_dec((uint32_t)div_u64_u32(batched, iterations, NULL));
+    vga_write_string(" cycles/call\n");
+}
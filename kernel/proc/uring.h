@@ -0,0 +1,128 @@
+#ifndef URING_H
+#define URING_H
+
+#include "../types.h"
+#include "mutex.h"
+
+struct process;
+
+// Batched system calls through a pair of rings shared between a process
+// and the kernel. The process fills submission entries and publishes them
+// by moving sq_tail; one SYS_URING_ENTER drains the whole batch and posts a
+// completion per entry. A ring set up with URING_SETUP_SQPOLL is instead
+// drained by a kernel poller pinned to an isolated CPU, so submitting
+// costs no trap at all while the poller is awake.
+//
+// Head and tail indices run freely; entry i lives at slot i & mask. The
+// kernel only consumes submissions it has room to complete, so the
+// completion ring never overflows; entries wait in the submission ring.
+//
+// A batch runs inside the kernel on behalf of the ring, so it only takes
+// calls that neither end nor create a process: URING_OP_SYSCALL is limited
+// to the queries uring_syscall_allowed lists. Entries the poller drains
+// run IPC_NOWAIT, a blocking call failing instead of stalling every polled
+// ring; a TCP send is refused there, it waits for window room.
+#define URING_MAX_ENTRIES       256
+#define URING_SQPOLL_IDLE_US    1000        // Poller spin before it sleeps
+
+// uring_sqe_t.opcode
+#define URING_OP_NOP            0
+#define URING_OP_SYSCALL        1           // num, args[0..3] as for syscall()
+#define URING_OP_MSGSND         2           // msgid, message_t*, size, flags
+#define URING_OP_SEND_ORDER     3           // queue_id, order_t*
+#define URING_OP_PIPE_WRITE     4           // pipe_t*, buffer, count, flags
+#define URING_OP_SOCKET_SEND    5           // sockfd, buffer, length
+
+// Setup flags
+#define URING_SETUP_SQPOLL      0x01
+
+// uring.sq_flags (written by the kernel)
+#define URING_SQ_NEED_WAKEUP    0x01        // Poller asleep: ring the doorbell
+
+// SYS_URING_ENTER flags
+#define URING_ENTER_GETEVENTS   0x01        // Wait for min_complete completions
+#define URING_ENTER_SQ_WAKEUP   0x02        // Wake a sleeping poller
+
+typedef struct {
+    uint16_t opcode;
+    uint16_t reserved0;
+    uint32_t num;                   // System call number (URING_OP_SYSCALL)
+    uint32_t args[4];
+    uint32_t user_data;             // Copied to the completion
+    uint32_t reserved[2];
+} uring_sqe_t;
+
+typedef struct {
+    uint32_t user_data;
+    int32_t result;
+} uring_cqe_t;
+
+typedef struct uring {
+    // Submission ring: the process produces, the kernel consumes
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    uint32_t sq_mask;
+    volatile uint32_t sq_flags;
+    uring_sqe_t* sqes;
+
+    // Completion ring (twice the size): the kernel produces
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;      // Also the futex word completion waiters sleep on
+    uint32_t cq_mask;
+    uring_cqe_t* cqes;
+
+    // Kernel side
+    kmutex_t lock;                  // One consumer at a time: doorbell or poller
+    struct process* owner;
+    struct uring* poll_next;
+    uint32_t poll_pass;             // Last poller pass that drained it
+    bool sqpoll;
+    volatile uint32_t cq_waiters;
+    uint32_t submitted;
+    uint32_t doorbells;
+    uint32_t polled;                // Entries the poller consumed
+} uring_t;
+
+// Kernel side
+uring_t* uring_setup(struct process* process, uint32_t entries, uint32_t flags);
+int uring_enter(uring_t* ring, uint32_t to_submit, uint32_t min_complete, uint32_t flags);
+void uring_release(struct process* process);
+int uring_start_poller(void);       // On the first isolated CPU, once
+void uring_print_info(void);
+void uring_bench(uint32_t iterations);
+
+uint32_t sys_uring_setup(uint32_t entries, uint32_t flags, uint32_t arg3, uint32_t arg4);
+uint32_t sys_uring_enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags, uint32_t arg4);
+
+// Process side: claim a submission slot (NULL when full) ...
+static inline uring_sqe_t* uring_get_sqe(uring_t* ring, uint32_t index) {
+    uint32_t tail = ring->sq_tail + index;
+    if (tail - ring->sq_head > ring->sq_mask) return NULL;
+    return &ring->sqes[tail & ring->sq_mask];
+}
+
+// ... publish the first 'count' claimed slots ...
+static inline void uring_submit_sqes(uring_t* ring, uint32_t count) {
+    __sync_synchronize();           // Entries visible before the tail
+    ring->sq_tail += count;
+}
+
+// Whether publishing needs SYS_URING_ENTER: always without a poller
+static inline bool uring_needs_enter(uring_t* ring) {
+    __sync_synchronize();           // Tail visible before the flag is read
+    return !ring->sqpoll || (ring->sq_flags & URING_SQ_NEED_WAKEUP);
+}
+
+// ... and reap completions
+static inline uring_cqe_t* uring_peek_cqe(uring_t* ring) {
+    if (ring->cq_head == ring->cq_tail) return NULL;
+    __sync_synchronize();
+    return &ring->cqes[ring->cq_head & ring->cq_mask];
+}
+
+static inline void uring_cqe_seen(uring_t* ring) {
+    __sync_synchronize();           // Done reading before the slot is reused
+    ring->cq_head++;
+}
+
+#endif // URING_H
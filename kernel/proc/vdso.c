@@ -0,0 +1,122 @@
+#include "vdso.h"
+#include "process.h"
+#include "tick.h"
+#include "../arch/cpu.h"
+#include "../drivers/vga.h"
+
+vdso_page_t vdso_page;
+static bool vdso_rdtscp = false;
+
+static bool rdtscp_supported(void) {
+    uint32_t eax, edx;
+    cpuid(0x80000000, &eax, NULL, NULL, NULL);
+    if (eax < 0x80000001) return false;
+    cpuid(0x80000001, NULL, NULL, NULL, &edx);
+    return (edx & CPUID_EXT_EDX_RDTSCP) != 0;
+}
+
+void vdso_init_cpu(void) {
+    if (vdso_rdtscp) {
+        wrmsr(MSR_IA32_TSC_AUX, this_cpu()->id);
+    }
+    __sync_fetch_and_add(&vdso_page.data.cpu_count, 1);
+}
+
+void vdso_init(void) {
+    vdso_data_t* data = &vdso_page.data;
+    vdso_rdtscp = rdtscp_supported();
+    data->version = VDSO_VERSION;
+    vdso_init_cpu();
+
+    data->seq++;
+    __sync_synchronize();
+    uint32_t flags = 0;
+    if (tsc_available()) {
+        tsc_get_calibration(&data->tsc_base, &data->tsc_mult, &data->tsc_shift);
+        data->tsc_khz = tsc_get_khz();
+        flags |= VDSO_TSC;
+        if (tsc_is_invariant()) flags |= VDSO_TSC_INVARIANT;
+    }
+    if (vdso_rdtscp) flags |= VDSO_RDTSCP;
+    data->flags = flags;
+    data->coarse_ms = tick_get_time_ms();
+    __sync_synchronize();
+    data->seq++;
+
+    vdso_set_current(this_cpu()->id, current_process);
+    if (kernel_page_directory) {
+        map_page(kernel_page_directory, VDSO_USER_ADDR, (uint32_t)&vdso_page, PAGE_PRESENT | PAGE_USER);
+    }
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    vga_write_string("Kernel data page at 0x");
+    print_hex((uint32_t)&vdso_page);
+    vga_write_string((flags & VDSO_TSC) ? " (TSC time" : " (tick time");
+    vga_write_string(vdso_rdtscp ? ", RDTSCP cpu id)\n" : ")\n");
+}
+
+// Read-only for the process: PAGE_WRITABLE stays clear
+int vdso_map(process_t* process) {
+    if (!process || !process->page_directory) return 0;
+    return map_page((page_directory_t*)process->page_directory, VDSO_USER_ADDR,
+                    (uint32_t)&vdso_page, PAGE_PRESENT | PAGE_USER);
+}
+
+void vdso_set_current(uint32_t cpu, process_t* process) {
+    if (cpu >= MAX_CPUS) return;
+    vdso_page.data.cpu[cpu].pid = process ? process->pid : 0;
+    vdso_page.data.cpu[cpu].priority = process ? (uint32_t)process->priority : 0;
+}
+
+void vdso_update_clock(uint32_t time_ms) {
+    vdso_page.data.coarse_ms = time_ms;
+}
+
+void vdso_print_info(void) {
+    const vdso_data_t* data = &vdso_page.data;
+
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Kernel Data Page ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    vga_write_string("Address: 0x");
+    print_hex((uint32_t)&vdso_page);
+    vga_write_string("  User address: 0x");
+    print_hex(VDSO_USER_ADDR);
+    vga_write_string("  Version: ");
+    print_dec(data->version);
+    vga_write_string("\nTSC: ");
+    if (data->flags & VDSO_TSC) {
+        print_dec(data->tsc_khz);
+        vga_write_string(" kHz  mult ");
+        print_dec(data->tsc_mult);
+        vga_write_string(" shift ");
+        print_dec(data->tsc_shift);
+        vga_write_string((data->flags & VDSO_TSC_INVARIANT) ? " (invariant)\n" : "\n");
+    } else {
+        vga_write_string("none, tick clock only\n");
+    }
+
+    vga_write_string("Now: ");
+    print_dec((uint32_t)div_u64_u32(vdso_time_ns(), NSEC_PER_USEC, NULL));
+    vga_write_string(" us  CPU: ");
+    print_dec(vdso_getcpu());
+    vga_write_string(" (");
+    vga_write_string((data->flags & VDSO_RDTSCP) ? "RDTSCP" : "GS selector");
+    vga_write_string(")  PID: ");
+    print_dec(vdso_getpid());
+    vga_write_string("  Priority: ");
+    print_dec(vdso_getpriority());
+    vga_write_string("\n");
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!smp_cpu_online(cpu)) continue;
+        vga_write_string("  CPU ");
+        print_dec(cpu);
+        vga_write_string(": pid ");
+        print_dec(data->cpu[cpu].pid);
+        vga_write_string(" priority ");
+        print_dec(data->cpu[cpu].priority);
+        vga_write_string("\n");
+    }
+}
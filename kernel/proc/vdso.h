@@ -0,0 +1,116 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include "../types.h"
+#include "../arch/smp.h"
+#include "../arch/gdt.h"
+#include "../arch/tsc.h"
+#include "../arch/div64.h"
+#include "../mm/paging.h"
+
+struct process;
+
+// Read-only kernel data page for trap-free queries: the TSC calibration
+// and coarse clock for timestamps, and per CPU what is running there.
+// The kernel is the only writer; readers use the inline helpers below.
+// Process address spaces get the page mapped read-only at VDSO_USER_ADDR
+// (see vdso_map); while paging is off every process reaches it directly.
+#define VDSO_USER_ADDR      0xBFFFF000      // Last page of user space
+#define VDSO_VERSION        1
+
+// vdso_data_t.flags
+#define VDSO_TSC            0x01            // tsc_* fields are valid
+#define VDSO_TSC_INVARIANT  0x02
+#define VDSO_RDTSCP         0x04            // TSC_AUX holds the CPU id
+
+typedef struct {
+    volatile uint32_t pid;
+    volatile uint32_t priority;
+} __attribute__((aligned(8))) vdso_cpu_t;
+
+typedef struct {
+    volatile uint32_t seq;          // Odd while the clock fields change
+    uint32_t version;
+    volatile uint32_t flags;
+    uint32_t tsc_khz;
+    uint32_t tsc_mult;              // ns = ((tsc - tsc_base) * tsc_mult) >> tsc_shift
+    uint32_t tsc_shift;
+    uint64_t tsc_base;
+    volatile uint32_t coarse_ms;    // Tick clock, for CPUs without a TSC
+    uint32_t cpu_count;
+    vdso_cpu_t cpu[MAX_CPUS];
+} vdso_data_t;
+
+// Padded to a whole page so mapping it exposes nothing else
+typedef union {
+    vdso_data_t data;
+    uint8_t bytes[PAGE_SIZE];
+} __attribute__((aligned(PAGE_SIZE))) vdso_page_t;
+
+extern vdso_page_t vdso_page;
+
+void vdso_init(void);               // Boot CPU, after tsc_init
+void vdso_init_cpu(void);           // Every CPU: TSC_AUX
+int vdso_map(struct process* process);
+void vdso_set_current(uint32_t cpu, struct process* process);
+void vdso_update_clock(uint32_t time_ms);
+void vdso_print_info(void);
+
+static inline uint64_t vdso_time_ns(void) {
+    const volatile vdso_data_t* page = &vdso_page.data;
+    uint32_t seq;
+    uint64_t ns;
+    do {
+        seq = page->seq;
+        __asm__ volatile ("" : : : "memory");
+        if (page->flags & VDSO_TSC) {
+            ns = mul_u64_u32_shr(rdtsc() - page->tsc_base, page->tsc_mult, page->tsc_shift);
+        } else {
+            ns = (uint64_t)page->coarse_ms * NSEC_PER_MSEC;
+        }
+        __asm__ volatile ("" : : : "memory");
+    } while ((seq & 1) || page->seq != seq);
+    return ns;
+}
+
+static inline uint32_t vdso_time_ms(void) {
+    return vdso_page.data.coarse_ms;
+}
+
+// RDTSCP reports TSC_AUX; without it a ring 0 caller's GS selector names
+// its per-CPU segment
+static inline uint32_t vdso_getcpu(void) {
+    if (vdso_page.data.flags & VDSO_RDTSCP) {
+        uint32_t low, high, aux;
+        __asm__ volatile ("rdtscp" : "=a"(low), "=d"(high), "=c"(aux));
+        return aux % MAX_CPUS;
+    }
+    uint16_t gs;
+    __asm__ volatile ("movw %%gs, %0" : "=r"(gs));
+    uint32_t index = gs >> 3;
+    if ((gs & 3) || index < GDT_PERCPU_FIRST || index >= GDT_PERCPU_FIRST + MAX_CPUS) {
+        return BOOT_CPU;
+    }
+    return index - GDT_PERCPU_FIRST;
+}
+
+// Same CPU before and after the read: the slot was ours while we read it
+static inline uint32_t vdso_getpid(void) {
+    uint32_t cpu, pid;
+    do {
+        cpu = vdso_getcpu();
+        pid = vdso_page.data.cpu[cpu].pid;
+    } while (vdso_getcpu() != cpu);
+    return pid;
+}
+
+static inline uint32_t vdso_getpriority(void) {
+    uint32_t cpu, priority;
+    do {
+        cpu = vdso_getcpu();
+        priority = vdso_page.data.cpu[cpu].priority;
+    } while (vdso_getcpu() != cpu);
+    return priority;
+}
+
+#endif // VDSO_H
@@ -0,0 +1,94 @@
+#ifndef WSDEQUE_H
+#define WSDEQUE_H
+
+#include "../types.h"
+
+// Chase-Lev work-stealing deque of 32-bit entries. The owner end (bottom)
+// is single-producer: callers serialise push/pop with the owning CPU's run
+// queue lock. Thieves take from the top with a compare-and-swap and never
+// block each other or the owner.
+#define WSDEQUE_SIZE            256         // Power of two
+#define WSDEQUE_MASK            (WSDEQUE_SIZE - 1)
+#define WSDEQUE_EMPTY           0xFFFFFFFF
+#define WSDEQUE_ABORT           0xFFFFFFFE  // Lost a race, try again
+
+typedef struct {
+    volatile int32_t top __cacheline_aligned;       // Thief end
+    volatile int32_t bottom __cacheline_aligned;    // Owner end
+    volatile uint32_t entries[WSDEQUE_SIZE];
+} wsdeque_t;
+
+static inline void wsdeque_init(wsdeque_t* dq) {
+    dq->top = 0;
+    dq->bottom = 0;
+}
+
+static inline int32_t wsdeque_size(wsdeque_t* dq) {
+    return dq->bottom - dq->top;
+}
+
+// Owner: append at the bottom, false if full
+static inline bool wsdeque_push(wsdeque_t* dq, uint32_t entry) {
+    int32_t b = dq->bottom;
+    int32_t t = dq->top;
+    if (b - t >= WSDEQUE_SIZE) {
+        return false;
+    }
+    dq->entries[b & WSDEQUE_MASK] = entry;
+    __asm__ volatile ("" : : : "memory");   // Entry before bottom (x86 keeps store order)
+    dq->bottom = b + 1;
+    return true;
+}
+
+// Owner: look at the bottom entry without taking it
+static inline uint32_t wsdeque_peek(wsdeque_t* dq) {
+    int32_t b = dq->bottom;
+    if (b - dq->top <= 0) {
+        return WSDEQUE_EMPTY;
+    }
+    return dq->entries[(b - 1) & WSDEQUE_MASK];
+}
+
+// Owner: take the bottom entry
+static inline uint32_t wsdeque_pop(wsdeque_t* dq) {
+    int32_t b = dq->bottom - 1;
+    dq->bottom = b;
+    __sync_synchronize();                   // Publish bottom before reading top
+    int32_t t = dq->top;
+    
+    if (b - t < 0) {
+        dq->bottom = t;                     // Already empty
+        return WSDEQUE_EMPTY;
+    }
+    
+    uint32_t entry = dq->entries[b & WSDEQUE_MASK];
+    if (b != t) {
+        return entry;                       // More than one left, no race possible
+    }
+    
+    // Last entry: race the thieves for it
+    if (!__sync_bool_compare_and_swap(&dq->top, t, t + 1)) {
+        entry = WSDEQUE_EMPTY;
+    }
+    dq->bottom = t + 1;
+    return entry;
+}
+
+// Thief: take the top entry
+static inline uint32_t wsdeque_steal(wsdeque_t* dq) {
+    int32_t t = dq->top;
+    __sync_synchronize();                   // Read top before bottom
+    int32_t b = dq->bottom;
+    
+    if (b - t <= 0) {
+        return WSDEQUE_EMPTY;
+    }
+    
+    uint32_t entry = dq->entries[t & WSDEQUE_MASK];
+    if (!__sync_bool_compare_and_swap(&dq->top, t, t + 1)) {
+        return WSDEQUE_ABORT;
+    }
+    return entry;
+}
+
+#endif // WSDEQUE_H
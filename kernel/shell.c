@@ -1,15 +1,51 @@
 #include "shell.h"
 #include "drivers/vga.h"
 #include "mm/memory.h"
+#include "mm/memprof.h"
 #include "mm/paging.h"
 #include "fs/fs.h"
+#include "fs/bcache.h"
+#include "fs/dcache.h"
+#include "fs/disk.h"
 #include "proc/process.h"
 #include "proc/scheduler.h"
 #include "proc/syscalls.h" // System calls enabled
 #include "proc/ipc.h" // IPC enabled
+#include "proc/book.h"
+#include "proc/risk.h"
+#include "proc/price.h"
+#include "net/feed.h"
+#include "net/ip.h"
+#include "net/udp.h"
+#include "net/gateway.h"
+#include "net/tcp.h"
+#include "net/eth.h"
+#include "net/virtio_net.h"
+#include "net/nicmap.h"
+#include "net/pbuf.h"
+#include "net/arp.h"
+#include "net/igmp.h"
+#include "proc/bench.h"
+#include "proc/replay.h"
+#include "proc/portfolio.h"
+#include "proc/journal.h"
 #include "net/websocket.h"
 #include "gui.h"
 #include "gfx/framebuffer.h"
+#include "proc/tick.h"
+#include "proc/sched_trace.h"
+#include "proc/mutex.h"
+#include "proc/futex.h"
+#include "arch/smp.h"
+#include "arch/interrupts.h"
+#include "arch/sysenter.h"
+#include "proc/vdso.h"
+#include "proc/uring.h"
+#include "proc/coro.h"
+#include "proc/klog.h"
+#include "proc/profile.h"
+#include "arch/pmu.h"
+#include "bootgraph.h"
 
 static char command_buffer[MAX_COMMAND_LENGTH];
 static int buffer_pos = 0;
@@ -22,10 +58,36 @@ void cmd_mem(int argc, char* argv[]);
 void cmd_memstats(int argc, char* argv[]);
 void cmd_memleak(int argc, char* argv[]);
 void cmd_memcheck(int argc, char* argv[]);
+void cmd_memprof(int argc, char* argv[]);
+void cmd_profile(int argc, char* argv[]);
+void cmd_membench(int argc, char* argv[]);
+void cmd_tlbbench(int argc, char* argv[]);
 void cmd_pgstats(int argc, char* argv[]);
 void cmd_ps(int argc, char* argv[]);
 void cmd_schedstat(int argc, char* argv[]);
+void cmd_schedlat(int argc, char* argv[]);
+void cmd_sysbench(int argc, char* argv[]);
+void cmd_bench(int argc, char* argv[]);
+void cmd_replay(int argc, char* argv[]);
+void cmd_portfolio(int argc, char* argv[]);
+void cmd_journal(int argc, char* argv[]);
+void cmd_nic(int argc, char* argv[]);
+void cmd_tcp(int argc, char* argv[]);
+void cmd_arp(int argc, char* argv[]);
+void cmd_igmp(int argc, char* argv[]);
+void cmd_vdso(int argc, char* argv[]);
+void cmd_uring(int argc, char* argv[]);
+void cmd_coro(int argc, char* argv[]);
+void cmd_tick(int argc, char* argv[]);
+void cmd_cpus(int argc, char* argv[]);
+void cmd_pin(int argc, char* argv[]);
+void cmd_isolate(int argc, char* argv[]);
+void cmd_irq(int argc, char* argv[]);
+void cmd_irqstat(int argc, char* argv[]);
+void cmd_dl(int argc, char* argv[]);
 void cmd_procinfo(int argc, char* argv[]);
+void cmd_pmu(int argc, char* argv[]);
+void cmd_boot(int argc, char* argv[]);
 void cmd_testfork(int argc, char* argv[]);
 void cmd_testipc(int argc, char* argv[]);
 void cmd_msgtest(int argc, char* argv[]);
@@ -36,6 +98,9 @@ void cmd_rm(int argc, char* argv[]);
 void cmd_cat(int argc, char* argv[]);
 void cmd_cp(int argc, char* argv[]);
 void cmd_mv(int argc, char* argv[]);
+void cmd_sync(int argc, char* argv[]);
+void cmd_klog(int argc, char* argv[]);
+void cmd_disk(int argc, char* argv[]);
 void cmd_reboot(int argc, char* argv[]);
 void cmd_websocket_test(int argc, char* argv[]);
 void cmd_desktop(int argc, char* argv[]);
@@ -51,10 +116,36 @@ static shell_command_t commands[] = {
     {"memstats", "Show detailed heap statistics", cmd_memstats},
     {"memleak", "Detect memory leaks", cmd_memleak},
     {"memcheck", "Check heap integrity", cmd_memcheck},
+    {"memprof", "Sampled heap profile (memprof [on [bytes] | off | reset])", cmd_memprof},
+    {"profile", "Sampling CPU profile (profile [start | stop | <top>])", cmd_profile},
+    {"membench", "memcpy/memset/memcmp throughput by size", cmd_membench},
+    {"tlbbench", "Kernel page touch cost after CR3 reload vs full flush", cmd_tlbbench},
     {"pgstats", "Show paging statistics", cmd_pgstats},
     {"ps", "Show running processes", cmd_ps},
     {"schedstat", "Show scheduler statistics", cmd_schedstat},
+    {"schedlat", "Scheduler latency (schedlat [trace [cpu] [n] | on | off | reset])", cmd_schedlat},
+    {"sysbench", "System call entry cost (sysbench [iterations])", cmd_sysbench},
+    {"bench", "Tick-to-trade latency (bench [samples])", cmd_bench},
+    {"replay", "Market data replay (replay <file> [speed] | synth <file> <records>)", cmd_replay},
+    {"portfolio", "Positions and P&L (portfolio [revalue])", cmd_portfolio},
+    {"journal", "Order event journal (journal [sync|reset])", cmd_journal},
+    {"nic", "Network card counters (nic [bypass <port> | bypass off])", cmd_nic},
+    {"tcp", "TCP counters and connections", cmd_tcp},
+    {"arp", "ARP cache (arp [add <ip> <mac> | del <ip>])", cmd_arp},
+    {"igmp", "Multicast groups (igmp [join <group> | leave <group>])", cmd_igmp},
+    {"vdso", "Show the kernel data page", cmd_vdso},
+    {"uring", "Syscall rings (uring [bench [iterations] | poll])", cmd_uring},
+    {"coro", "Coroutines (coro [bench [switches]])", cmd_coro},
+    {"tick", "Show/set tick mode (periodic|idle|full)", cmd_tick},
+    {"cpus", "Show per-CPU scheduler state", cmd_cpus},
+    {"pin", "Pin a process to a CPU (pin <pid> <cpu|any>)", cmd_pin},
+    {"isolate", "Isolate a CPU for pinned tasks (isolate <cpu> [off])", cmd_isolate},
+    {"irq", "Interrupt routing (irq [<irq> <cpu>])", cmd_irq},
+    {"irqstat", "Interrupt handler latency (irqstat [<cpu>|reset])", cmd_irqstat},
+    {"dl", "Deadline reservations (dl <pid> <runtime> <period> [deadline] | off, us)", cmd_dl},
     {"procinfo", "Show detailed process information", cmd_procinfo},
+    {"pmu", "Hardware counters (pmu [<pid>])", cmd_pmu},
+    {"boot", "Boot stages and timing", cmd_boot},
     {"testfork", "Test fork() system call", cmd_testfork},
     {"testipc", "Test inter-process communication", cmd_testipc},
     {"msgtest", "Test message queues", cmd_msgtest},
@@ -65,6 +156,9 @@ static shell_command_t commands[] = {
     {"cat", "Display file contents", cmd_cat},
     {"cp", "Copy file", cmd_cp},
     {"mv", "Move/rename file", cmd_mv},
+    {"sync", "Write cached blocks to disk (sync [stats])", cmd_sync},
+    {"klog", "Kernel log (klog [level <0-3> | console on|off | file <path>|off])", cmd_klog},
+    {"disk", "ATA disk transfer modes and statistics", cmd_disk},
     {"desktop", "Open desktop launcher (F2 to return)", cmd_desktop},
     {"fbinfo", "Show framebuffer scaffold status", cmd_fbinfo},
     {"fbdemo", "Run framebuffer gradient demo (Mode13 scaffold)", cmd_fbdemo},
@@ -109,6 +203,19 @@ static void shell_strcpy(char* dest, const char* src) {
     *dest = '\0';
 }
 
+// Parse an unsigned decimal number, rejecting empty or trailing garbage
+static bool shell_parse_uint(const char* str, uint32_t* value) {
+    uint32_t result = 0;
+    if (!*str) return false;
+    while (*str >= '0' && *str <= '9') {
+        result = result * 10 + (*str - '0');
+        str++;
+    }
+    if (*str) return false;
+    *value = result;
+    return true;
+}
+
 // Parse command line into arguments
 static int parse_args(char* command_line, char* argv[]) {
     int argc = 0;
@@ -265,6 +372,7 @@ void cmd_memleak(int argc, char* argv[]) {
 void cmd_memcheck(int argc, char* argv[]) {
     (void)argc; (void)argv;
     int errors = check_heap_integrity();
+    klog_drain();           // What it found, before the verdict
     
     if (errors == 0) {
         vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
@@ -277,6 +385,76 @@ void cmd_memcheck(int argc, char* argv[]) {
     }
 }
 
+void cmd_memprof(int argc, char* argv[]) {
+    if (argc < 2) {
+        memprof_print();
+        return;
+    }
+    
+    if (strcmp(argv[1], "off") == 0) {
+        memprof_enable(0);
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_write_string("Heap sampling off\n");
+        return;
+    }
+    
+    if (strcmp(argv[1], "reset") == 0) {
+        memprof_reset();
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_write_string("Heap profile cleared\n");
+        return;
+    }
+    
+    uint32_t rate = MEMPROF_DEFAULT_RATE;
+    if (strcmp(argv[1], "on") != 0 ||
+        (argc >= 3 && (!shell_parse_uint(argv[2], &rate) || rate == 0 || rate > 0x10000000))) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: memprof [on [bytes] | off | reset]\n");
+        return;
+    }
+    memprof_enable(rate);
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    vga_write_string("Sampling 1 in ");
+    print_dec(rate);
+    vga_write_string(" bytes\n");
+}
+
+void cmd_profile(int argc, char* argv[]) {
+    uint32_t top = PROFILE_TOP;
+    if (argc >= 2 && strcmp(argv[1], "start") == 0) {
+        profile_start();
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_write_string("Sampling at every timer interrupt, ");
+        print_dec(PROFILE_SAMPLES);
+        vga_write_string(" samples per CPU\n");
+        return;
+    }
+    
+    if (argc >= 2 && strcmp(argv[1], "stop") == 0) {
+        profile_stop();
+    } else if (argc >= 2 && (!shell_parse_uint(argv[1], &top) || top == 0)) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: profile [start | stop | <top>]\n");
+        return;
+    }
+    profile_print_report(top);
+}
+
+void cmd_membench(int argc, char* argv[]) {
+    (void)argc; (void)argv;
+    mem_bench();
+}
+
+void cmd_tlbbench(int argc, char* argv[]) {
+    uint32_t pages = TLB_BENCH_PAGES;
+    if (argc >= 2 && (!shell_parse_uint(argv[1], &pages) || pages == 0)) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: tlbbench [pages]\n");
+        return;
+    }
+    paging_tlb_bench(pages);
+}
+
 void cmd_pgstats(int argc, char* argv[]) {
     (void)argc; (void)argv;
     print_memory_stats();
@@ -295,6 +473,7 @@ void cmd_reboot(int argc, char* argv[]) {
     
     vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
     vga_write_string("Rebooting system...\n");
+    fs_sync();
     
     // Simple reboot via keyboard controller
     uint8_t temp = 0xFE;
@@ -302,6 +481,7 @@ void cmd_reboot(int argc, char* argv[]) {
     
     // If that doesn't work, halt
     vga_write_string("Reboot failed. System halted.\n");
+    vga_flush();
     while (1) {
         __asm__ volatile ("hlt");
     }
@@ -760,6 +940,52 @@ void cmd_mv(int argc, char* argv[]) {
     }
 }
 
+void cmd_sync(int argc, char* argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "stats") == 0) {
+        bcache_print_info();
+        dcache_print_info();
+        return;
+    }
+    if (fs_sync() != FS_SUCCESS) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Sync failed\n");
+        return;
+    }
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    vga_write_string("Filesystem synced to disk\n");
+}
+
+void cmd_klog(int argc, char* argv[]) {
+    uint32_t level;
+    if (argc < 2) {
+        klog_print_info();
+        return;
+    }
+    if (argc >= 3 && strcmp(argv[1], "level") == 0 && shell_parse_uint(argv[2], &level) && level <= KLOG_DEBUG) {
+        klog_set_level(level);
+    } else if (argc >= 3 && strcmp(argv[1], "console") == 0 &&
+               (strcmp(argv[2], "on") == 0 || strcmp(argv[2], "off") == 0)) {
+        uint32_t sinks = klog_get_sinks() & ~KLOG_SINK_VGA;
+        klog_set_sinks(strcmp(argv[2], "on") == 0 ? sinks | KLOG_SINK_VGA : sinks);
+    } else if (argc >= 3 && strcmp(argv[1], "file") == 0) {
+        if (klog_set_file(strcmp(argv[2], "off") == 0 ? NULL : argv[2]) != FS_SUCCESS) {
+            vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+            vga_write_string("Cannot open the log file\n");
+            return;
+        }
+    } else {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: klog [level <0-3> | console on|off | file <path>|off]\n");
+        return;
+    }
+    klog_print_info();
+}
+
+void cmd_disk(int argc, char* argv[]) {
+    (void)argc; (void)argv;
+    disk_print_info();
+}
+
 void cmd_desktop(int argc, char* argv[]) {
     (void)argc; (void)argv;
     gui_enter_desktop();
@@ -835,8 +1061,8 @@ void cmd_ps(int argc, char* argv[]) {
     vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
     vga_write_string("Process List:\n");
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
-    vga_write_string("PID  PPID PRIO STATE    CPU%  MEMORY  NAME\n");
-    vga_write_string("---  ---- ---- -------- ----  ------  ----\n");
+    vga_write_string("PID  PPID PRIO STATE    CPU%  MEMORY  FAULTS NAME\n");
+    vga_write_string("---  ---- ---- -------- ----  ------  ------ ----\n");
     
     // Display process information
     process_show_all_processes();
@@ -851,6 +1077,487 @@ void cmd_schedstat(int argc, char* argv[]) {
     scheduler_show_stats();
 }
 
+void cmd_schedlat(int argc, char* argv[]) {
+    if (argc < 2) {
+        sched_trace_print_latency();
+        pi_print_info();
+        futex_print_info();
+        return;
+    }
+    
+    if (strcmp(argv[1], "on") == 0 || strcmp(argv[1], "off") == 0) {
+        sched_trace_enable(strcmp(argv[1], "on") == 0);
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_write_string(sched_trace_enabled() ? "Scheduler tracing on\n" : "Scheduler tracing off\n");
+        return;
+    }
+    
+    if (strcmp(argv[1], "reset") == 0) {
+        sched_trace_reset();
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_write_string("Scheduler trace and histograms cleared\n");
+        return;
+    }
+    
+    uint32_t cpu = this_cpu()->id, count = 16;
+    if (strcmp(argv[1], "trace") != 0 ||
+        (argc >= 3 && (!shell_parse_uint(argv[2], &cpu) || cpu >= MAX_CPUS)) ||
+        (argc >= 4 && !shell_parse_uint(argv[3], &count))) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: schedlat [trace [cpu] [count] | on | off | reset]\n");
+        return;
+    }
+    sched_trace_print_events(cpu, count);
+}
+
+void cmd_sysbench(int argc, char* argv[]) {
+    uint32_t iterations = SYSCALL_BENCH_ITERATIONS;
+    if (argc >= 2 && (!shell_parse_uint(argv[1], &iterations) || iterations == 0)) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: sysbench [iterations]\n");
+        return;
+    }
+    syscall_bench(iterations);
+}
+
+void cmd_bench(int argc, char* argv[]) {
+    uint32_t samples = BENCH_DEFAULT_SAMPLES;
+    if (argc >= 2 && (!shell_parse_uint(argv[1], &samples) || samples == 0)) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: bench [samples]\n");
+        return;
+    }
+    
+    bench_result_t* result = (bench_result_t*)kmalloc(sizeof(bench_result_t));
+    if (!result || bench_tick_to_trade(samples, result) != 0) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("bench needs a calibrated TSC and memory\n");
+    } else {
+        bench_print(result);
+    }
+    kfree(result);
+}
+
+// Synthetic session: quotes and trades 10us apart, prices walking
+static int replay_synth(const char* path, uint32_t records) {
+    replay_writer_t writer;
+    int result = replay_writer_open(&writer, path);
+    if (result != FS_SUCCESS) return result;
+    
+    for (uint32_t i = 0; i < records && result == FS_SUCCESS; i++) {
+        market_data_t md = { 100.0 + (i & 255) * 0.01, 100 + (i & 7) * 100, (uint64_t)i * 10000,
+                             (uint16_t)(i & 15), (uint8_t)(i % 3), 0 };
+        result = replay_writer_add(&writer, &md);
+    }
+    int closed = replay_writer_close(&writer);
+    return result == FS_SUCCESS ? closed : result;
+}
+
+void cmd_replay(int argc, char* argv[]) {
+    uint32_t value = 0;
+    if (argc >= 4 && strcmp(argv[1], "synth") == 0 && shell_parse_uint(argv[3], &value) && value > 0) {
+        int result = replay_synth(argv[2], value);
+        vga_set_color(result == FS_SUCCESS ? VGA_COLOR_LIGHT_GREEN : VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string(result == FS_SUCCESS ? "Capture written\n" : "Capture failed\n");
+        return;
+    }
+    if (argc < 2 || strcmp(argv[1], "synth") == 0 || (argc >= 3 && !shell_parse_uint(argv[2], &value))) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: replay <file> [speed, 0 = flat out] | synth <file> <records>\n");
+        return;
+    }
+    
+    // No consumer here: the read path alone, at the requested pace
+    replay_stats_t stats;
+    int result = replay_run(argv[1], NULL, value, &stats);
+    if (result != FS_SUCCESS) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Replay failed (not a capture file?)\n");
+        return;
+    }
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    replay_print_stats(&stats);
+}
+
+void cmd_portfolio(int argc, char* argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "revalue") == 0) {
+        uint64_t start = ktime_ns();
+        portfolio_revalue_all(NULL);
+        uint32_t elapsed = (uint32_t)(ktime_ns() - start);
+        uint32_t sent = portfolio_publish();
+        vga_write_string("Revalued in ");
+        print_dec(elapsed);
+        vga_write_string(" ns, ");
+        print_dec(sent);
+        vga_write_string(" updates broadcast\n");
+    }
+    portfolio_print_info();
+}
+
+void cmd_journal(int argc, char* argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "sync") == 0) {
+        uint64_t start = ktime_ns();
+        int result = journal_sync();
+        uint32_t elapsed = (uint32_t)(ktime_ns() - start) / 1000;
+        vga_set_color(result == 0 ? VGA_COLOR_LIGHT_GREEN : VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string(result == 0 ? "On disk after " : "Not durable after ");
+        print_dec(elapsed);
+        vga_write_string(" us\n");
+    } else if (argc >= 2 && strcmp(argv[1], "reset") == 0) {
+        if (journal_reset() != 0) {
+            vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+            vga_write_string("Journal reset failed\n");
+            return;
+        }
+    } else if (argc >= 2) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: journal [sync|reset]\n");
+        return;
+    }
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    journal_print_info();
+}
+
+void cmd_nic(int argc, char* argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "bypass") == 0) {
+        uint32_t port = 0;
+        if (argc >= 3 && strcmp(argv[2], "off") == 0) {
+            nicmap_echo_stop();
+            vga_write_string("Echo stopping, bypass released\n");
+            return;
+        }
+        if (argc < 3 || !shell_parse_uint(argv[2], &port) || port == 0 || port > 0xFFFF) {
+            vga_write_string("Usage: nic bypass <udp port> | off\n");
+            return;
+        }
+        if (nicmap_echo_start((uint16_t)port) < 0) {
+            vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+            vga_write_string("Bypass taken or no memory\n");
+            return;
+        }
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_write_string("Echoing UDP port ");
+        print_dec(port);
+        vga_write_string(" through the bypass rings\n");
+        return;
+    }
+
+    if (virtio_net_present()) {
+        virtio_net_print_info();
+    } else {
+        rtl8139_print_info();
+    }
+    pbuf_print_info();
+    net_busy_poll_stats_t busy;
+    net_busy_poll_get_stats(&busy);
+    if (busy.waits || busy.passes) {
+        net_busy_poll_print_info();
+    }
+    nicmap_stats_t stats;
+    nicmap_get_stats(&stats);
+    if (stats.attaches) {
+        nicmap_print_info();
+    }
+}
+
+void cmd_tcp(int argc, char* argv[]) {
+    (void)argc; (void)argv;
+    tcp_print_info();
+}
+
+void cmd_arp(int argc, char* argv[]) {
+    ipv4_addr_t ip;
+    mac_addr_t mac;
+    if (argc >= 2 && strcmp(argv[1], "add") == 0) {
+        if (argc < 4 || net_string_to_ip(argv[2], &ip) != NET_SUCCESS ||
+            net_string_to_mac(argv[3], &mac) != NET_SUCCESS) {
+            vga_write_string("Usage: arp add <a.b.c.d> <xx:xx:xx:xx:xx:xx>\n");
+            return;
+        }
+        if (arp_add_static(&ip, &mac) != NET_SUCCESS) {
+            vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+            vga_write_string("ARP cache full of static entries\n");
+            return;
+        }
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_write_string("Pinned ");
+        vga_write_string(argv[2]);
+        vga_write_string(" at ");
+        vga_write_string(net_mac_to_string(&mac));
+        vga_write_string("\n");
+        return;
+    }
+    if (argc >= 2 && strcmp(argv[1], "del") == 0) {
+        if (argc < 3 || net_string_to_ip(argv[2], &ip) != NET_SUCCESS) {
+            vga_write_string("Usage: arp del <a.b.c.d>\n");
+            return;
+        }
+        vga_write_string(arp_remove(&ip) == NET_SUCCESS ? "Removed\n" : "No entry\n");
+        return;
+    }
+    arp_print_info();
+}
+
+void cmd_igmp(int argc, char* argv[]) {
+    ipv4_addr_t group;
+    if (argc >= 2 && (strcmp(argv[1], "join") == 0 || strcmp(argv[1], "leave") == 0)) {
+        if (argc < 3 || net_string_to_ip(argv[2], &group) != NET_SUCCESS ||
+            !ipv4_is_multicast(&group)) {
+            vga_write_string("Usage: igmp join|leave <224.0.0.0-239.255.255.255>\n");
+            return;
+        }
+        if (argv[1][0] == 'l') {
+            ipv4_leave_group(&group);
+            vga_write_string("Left one join of ");
+            vga_write_string(argv[2]);
+            vga_write_string("\n");
+            return;
+        }
+        if (ipv4_join_group(&group) != NET_SUCCESS) {
+            vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+            vga_write_string("Group table full\n");
+            return;
+        }
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_write_string("Joined ");
+        vga_write_string(argv[2]);
+        vga_write_string("\n");
+        return;
+    }
+    igmp_print_info();
+}
+
+void cmd_vdso(int argc, char* argv[]) {
+    (void)argc; (void)argv;
+    vdso_print_info();
+}
+
+void cmd_uring(int argc, char* argv[]) {
+    if (argc < 2) {
+        uring_print_info();
+        return;
+    }
+    
+    if (strcmp(argv[1], "poll") == 0) {
+        int cpu = uring_start_poller();
+        if (cpu < 0) {
+            vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+            vga_write_string("No poller: isolate a CPU first\n");
+            return;
+        }
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_write_string("Ring poller on CPU ");
+        print_dec(cpu);
+        vga_write_string("\n");
+        return;
+    }
+    
+    uint32_t iterations = SYSCALL_BENCH_ITERATIONS;
+    if (strcmp(argv[1], "bench") != 0 ||
+        (argc >= 3 && (!shell_parse_uint(argv[2], &iterations) || iterations == 0))) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: uring [bench [iterations] | poll]\n");
+        return;
+    }
+    uring_bench(iterations);
+}
+
+void cmd_coro(int argc, char* argv[]) {
+    if (argc < 2) {
+        coro_print_info();
+        return;
+    }
+    
+    uint32_t switches = SYSCALL_BENCH_ITERATIONS;
+    if (strcmp(argv[1], "bench") != 0 ||
+        (argc >= 3 && (!shell_parse_uint(argv[2], &switches) || switches < 2))) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: coro [bench [switches]]\n");
+        return;
+    }
+    coro_bench(switches);
+}
+
+void cmd_tick(int argc, char* argv[]) {
+    if (argc >= 2) {
+        tick_mode_t mode;
+        if (strcmp(argv[1], "periodic") == 0) {
+            mode = TICK_MODE_PERIODIC;
+        } else if (strcmp(argv[1], "idle") == 0) {
+            mode = TICK_MODE_NOHZ_IDLE;
+        } else if (strcmp(argv[1], "full") == 0) {
+            mode = TICK_MODE_NOHZ_FULL;
+        } else {
+            vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+            vga_write_string("Usage: tick [periodic|idle|full]\n");
+            return;
+        }
+        
+        if (tick_set_mode(mode) != 0) {
+            vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+            vga_write_string("Tickless modes need a local APIC timer\n");
+            return;
+        }
+    }
+    
+    tick_print_info();
+    timer_print_info();
+}
+
+void cmd_cpus(int argc, char* argv[]) {
+    (void)argc; (void)argv;
+    smp_print_info();
+}
+
+void cmd_pin(int argc, char* argv[]) {
+    uint32_t pid, cpu = 0;
+    bool any = argc >= 3 && strcmp(argv[2], "any") == 0;
+    if (argc < 3 || !shell_parse_uint(argv[1], &pid) || (!any && !shell_parse_uint(argv[2], &cpu))) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: pin <pid> <cpu|any>\n");
+        return;
+    }
+    
+    process_t* process = process_find_by_pid(pid);
+    if (!process) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Process not found\n");
+        return;
+    }
+    
+    if (scheduler_set_affinity(process, any ? -1 : (int32_t)cpu) != 0) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Cannot pin to that CPU\n");
+        return;
+    }
+    
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    vga_write_string(process->name);
+    if (any) {
+        vga_write_string(" may run on any CPU\n");
+    } else {
+        vga_write_string(" pinned to CPU ");
+        print_dec(cpu);
+        vga_write_string("\n");
+    }
+}
+
+void cmd_isolate(int argc, char* argv[]) {
+    uint32_t cpu;
+    if (argc < 2 || !shell_parse_uint(argv[1], &cpu)) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: isolate <cpu> [off]\n");
+        return;
+    }
+    
+    bool isolated = !(argc >= 3 && strcmp(argv[2], "off") == 0);
+    if (smp_set_isolated(cpu, isolated) != 0) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("CPU must be online and not the boot CPU\n");
+        return;
+    }
+    
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    vga_write_string("CPU ");
+    print_dec(cpu);
+    vga_write_string(isolated ? " isolated: pinned tasks only, nohz full\n" : " returned to general use\n");
+}
+
+void cmd_irq(int argc, char* argv[]) {
+    if (argc < 2) {
+        interrupts_print_info();
+        return;
+    }
+    
+    uint32_t irq, cpu;
+    if (argc < 3 || !shell_parse_uint(argv[1], &irq) || !shell_parse_uint(argv[2], &cpu)) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: irq [<irq> <cpu>]\n");
+        return;
+    }
+    if (irq_set_affinity(irq, cpu) != 0) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("No such IRQ, or CPU not online\n");
+        return;
+    }
+    
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    vga_write_string("IRQ ");
+    print_dec(irq);
+    vga_write_string(" to CPU ");
+    print_dec(cpu);
+    vga_write_string(interrupts_apic_mode() || irq >= IRQ_MSI_BASE ? "\n" : " once the I/O APIC is in use\n");
+}
+
+void cmd_irqstat(int argc, char* argv[]) {
+    uint32_t cpu = MAX_CPUS;
+    if (argc >= 2 && strcmp(argv[1], "reset") == 0) {
+        irq_reset_stats();
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_write_string("Interrupt statistics cleared\n");
+        return;
+    }
+    if (argc >= 2 && (!shell_parse_uint(argv[1], &cpu) || !smp_cpu_online(cpu))) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: irqstat [<cpu>|reset]\n");
+        return;
+    }
+    interrupts_print_stats(cpu);
+}
+
+void cmd_dl(int argc, char* argv[]) {
+    if (argc < 2) {
+        scheduler_print_deadline_info();
+        return;
+    }
+    
+    uint32_t pid, runtime = 0, period = 0, deadline = 0;
+    bool off = argc == 3 && strcmp(argv[2], "off") == 0;
+    if (!shell_parse_uint(argv[1], &pid) ||
+        (!off && (argc < 4 || !shell_parse_uint(argv[2], &runtime) ||
+                  !shell_parse_uint(argv[3], &period) ||
+                  (argc >= 5 && !shell_parse_uint(argv[4], &deadline))))) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: dl <pid> <runtime_us> <period_us> [deadline_us] | dl <pid> off\n");
+        return;
+    }
+    
+    process_t* process = process_find_by_pid(pid);
+    if (!process) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Process not found\n");
+        return;
+    }
+    
+    if (off) {
+        if (scheduler_clear_deadline(process) != 0) {
+            vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+            vga_write_string("Process has no deadline reservation\n");
+            return;
+        }
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_write_string(process->name);
+        vga_write_string(" reservation released\n");
+        return;
+    }
+    
+    if (scheduler_set_deadline(process, runtime, deadline, period) != 0) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Invalid parameters or admission control rejected the reservation\n");
+        return;
+    }
+    
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    vga_write_string(process->name);
+    vga_write_string(": ");
+    print_dec(runtime);
+    vga_write_string(" us every ");
+    print_dec(period);
+    vga_write_string(" us on CPU ");
+    print_dec(process->pinned_cpu);
+    vga_write_string("\n");
+}
+
 void cmd_procinfo(int argc, char* argv[]) {
     if (argc < 2) {
         vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
@@ -913,6 +1620,44 @@ void cmd_procinfo(int argc, char* argv[]) {
     vga_write_string("  Memory Used: ");
     print_dec(proc->memory_used);
     vga_write_string(" bytes\n");
+    
+    vga_write_string("  Page Faults: ");
+    print_dec(proc->page_faults);
+    if (proc->mlock_flags) {
+        vga_write_string(" (memory locked, ");
+        if (proc->mlock_faults) vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        print_dec(proc->mlock_faults);
+        vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+        vga_write_string(" since mlockall)");
+    }
+    vga_write_string("\n");
+}
+
+void cmd_pmu(int argc, char* argv[]) {
+    if (argc < 2) {
+        pmu_print_info();
+        return;
+    }
+    
+    uint32_t pid;
+    process_t* proc = shell_parse_uint(argv[1], &pid) ? process_find_by_pid(pid) : NULL;
+    if (!proc) {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Usage: pmu [<pid>], an existing process\n");
+        return;
+    }
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_write_string("=== Counters: ");
+    vga_write_string(proc->name);
+    vga_write_string(" ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    pmu_print_process(proc);
+}
+
+void cmd_boot(int argc, char* argv[]) {
+    (void)argc; (void)argv;
+    boot_print_info();
 }
 
 void cmd_testfork(int argc, char* argv[]) {
@@ -943,7 +1688,89 @@ void cmd_testfork(int argc, char* argv[]) {
     }
 }
 
+static void testipc_count_quote(uint16_t symbol, const md_snapshot_t* snapshot, void* ctx) {
+    (void)symbol; (void)snapshot; (void)ctx;
+}
+
+// Ethernet frame of 'count' trades from 'sequence' on, to group:port;
+// returns its length
+static uint32_t testipc_feed_frame(uint8_t* frame, const ipv4_addr_t* group, uint16_t port,
+                                   uint32_t sequence, uint16_t count) {
+    eth_header_t* eth = (eth_header_t*)frame;
+    ipv4_header_t* ip = (ipv4_header_t*)(eth + 1);
+    udp_packet_t* udp = (udp_packet_t*)(ip + 1);
+    feed_packet_header_t* packet = (feed_packet_header_t*)udp->data;
+    feed_quote_msg_t* trades = (feed_quote_msg_t*)(packet + 1);
+    
+    uint32_t payload = sizeof(feed_packet_header_t) + count * sizeof(feed_quote_msg_t);
+    memset(frame, 0, sizeof(eth_header_t) + sizeof(ipv4_header_t) + sizeof(udp_packet_t) + payload);
+    eth->ethertype = net_htons(ETH_TYPE_IP);
+    ip->version_ihl = (4 << 4) | 5;
+    ip->total_len = net_htons(sizeof(ipv4_header_t) + sizeof(udp_packet_t) + payload);
+    ip->ttl = 1;
+    ip->protocol = IP_PROTO_UDP;
+    ip->dst_ip = *group;
+    ip->checksum = ipv4_checksum(ip);
+    udp->dst_port = net_htons(port);
+    udp->length = net_htons(sizeof(udp_packet_t) + payload);
+    
+    packet->sequence = sequence;
+    packet->count = count;
+    for (uint16_t i = 0; i < count; i++) {
+        trades[i].header.length = sizeof(feed_quote_msg_t);
+        trades[i].header.type = FEED_MSG_TRADE;
+        trades[i].symbol_id = 7;
+        trades[i].price = 1000000 + sequence + i;       // 100.0000 + sequence ticks
+        trades[i].quantity = 100;
+    }
+    return sizeof(eth_header_t) + net_ntohs(ip->total_len);
+}
+
+// A unicast datagram to us, as the card would deliver it
+static uint32_t testipc_udp_frame(uint8_t* frame, const ipv4_addr_t* src, uint16_t src_port,
+                                  uint16_t port, const void* data, uint32_t len) {
+    eth_header_t* eth = (eth_header_t*)frame;
+    ipv4_header_t* ip = (ipv4_header_t*)(eth + 1);
+    udp_packet_t* udp = (udp_packet_t*)(ip + 1);
+    
+    memset(frame, 0, sizeof(eth_header_t) + sizeof(ipv4_header_t) + sizeof(udp_packet_t));
+    eth->ethertype = net_htons(ETH_TYPE_IP);
+    ip->version_ihl = (4 << 4) | 5;
+    ip->total_len = net_htons(sizeof(ipv4_header_t) + sizeof(udp_packet_t) + len);
+    ip->ttl = 64;
+    ip->protocol = IP_PROTO_UDP;
+    ip->src_ip = *src;
+    ip->dst_ip = *ipv4_get_our_address();
+    ip->checksum = ipv4_checksum(ip);
+    udp->src_port = net_htons(src_port);
+    udp->dst_port = net_htons(port);
+    udp->length = net_htons(sizeof(udp_packet_t) + len);
+    memcpy(udp->data, data, len);
+    return sizeof(eth_header_t) + net_ntohs(ip->total_len);
+}
+
 // TODO: Re-enable when IPC is fixed
+// The testipc journal events: the last run's, by order id
+#define JOURNAL_TEST_CLIENT     0x4A54
+
+typedef struct {
+    uint32_t count;
+    uint32_t misordered;
+} journal_test_t;
+
+static void journal_test_record(const journal_record_t* record, void* ctx) {
+    journal_test_t* test = (journal_test_t*)ctx;
+    if (record->type != JOURNAL_ACK || record->client_id != JOURNAL_TEST_CLIENT) return;
+    
+    // An id of 0 starts a run; earlier runs are counted over
+    if (record->order_id == 0) {
+        test->count = 0;
+        test->misordered = 0;
+    }
+    if (record->order_id != test->count) test->misordered++;
+    test->count++;
+}
+
 void cmd_testipc(int argc, char* argv[]) {
     (void)argc; (void)argv;
     vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
@@ -953,7 +1780,7 @@ void cmd_testipc(int argc, char* argv[]) {
     vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
     vga_write_string("Creating shared memory pool...\n");
     
-    shared_pool_t* pool = create_shared_pool(sizeof(market_data_t), 100);
+    shared_pool_t* pool = create_shared_pool_aligned(sizeof(market_data_t), 100, CACHE_LINE_SIZE);
     if (pool) {
         vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
         vga_write_string("Shared memory pool created successfully\n");
@@ -979,6 +1806,423 @@ void cmd_testipc(int argc, char* argv[]) {
         vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
         vga_write_string("Failed to create shared memory pool\n");
     }
+    
+    // Test trade signal fan-out: the gateway sees a signal after risk
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("Broadcasting trade signal...\n");
+    int risk = trade_signal_subscribe(0);
+    int gateway = risk >= 0 ? trade_signal_subscribe(1u << risk) : -1;
+    uint32_t order_id = 42;
+    if (gateway >= 0 && broadcast_trade_signal(1, &order_id, sizeof(order_id)) == 0) {
+        const trade_signal_t* seen = trade_signal_next(gateway, 0);
+        vga_write_string(seen ? "Gateway saw it before risk (wrong)\n" : "Gateway held back until risk is done\n");
+        const trade_signal_t* signal = trade_signal_next(risk, 0);
+        if (signal) {
+            trade_signal_done(risk);
+            signal = trade_signal_next(gateway, 0);
+        }
+        if (signal) {
+            vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+            vga_write_string("Both read the same slot in place, order ");
+            print_dec(*(const uint32_t*)signal->data);
+            vga_write_string("\n");
+            trade_signal_done(gateway);
+        }
+        vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+        trade_signal_print_info();
+    } else {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Failed to broadcast trade signal\n");
+    }
+    trade_signal_unsubscribe(gateway);
+    trade_signal_unsubscribe(risk);
+    
+    // Test the quote snapshot: a slow reader sees three updates as one
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("Updating quote snapshot...\n");
+    uint32_t cursor = 0;
+    market_snapshot_conflate(&cursor, testipc_count_quote, NULL);
+    market_data_t quote = { 100.25, 500, 0, 7, 0, 0 };
+    market_snapshot_update(&quote);
+    quote.price = 100.50;
+    quote.side = 1;
+    market_snapshot_update(&quote);
+    quote.price = 100.25;
+    quote.side = MD_SIDE_TRADE;
+    market_snapshot_update(&quote);
+    
+    md_snapshot_t snapshot;
+    uint32_t changed = market_snapshot_conflate(&cursor, testipc_count_quote, NULL);
+    if (market_snapshot_read(7, &snapshot) == 0 && changed == 1) {
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_write_string("Symbol 7 conflated to one update, volume ");
+        print_dec((uint32_t)snapshot.volume);
+        vga_write_string("\n");
+    } else {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Quote snapshot not available\n");
+    }
+    
+    // Test page-moving pipes: feed -> decoder pipe -> journal pipe
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("Splicing between pipes...\n");
+    pipe_t* decoded = pipe_create();
+    pipe_t* journal = pipe_create();
+    char line[16];
+    int moved = -1;
+    if (decoded && journal && pipe_write(decoded, "AAPL 101.25", 11, IPC_NOWAIT) == 11) {
+        moved = pipe_splice(decoded, journal, PIPE_BUFFER_SIZE, IPC_NOWAIT);
+    }
+    if (moved == 11 && pipe_read(journal, line, sizeof(line) - 1, IPC_NOWAIT) == 11) {
+        line[11] = '\0';
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        vga_write_string("Journal read \"");
+        vga_write_string(line);
+        vga_write_string("\" from a page moved, not copied\n");
+    } else {
+        vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Pipe splice failed\n");
+    }
+    
+    // Test the poll set: one wait reports which pipe has data
+    pollset_t* set = pollset_create(0);
+    if (set && pipe_poll_add(set, decoded, POLL_IN, 1) >= 0 &&
+        pipe_poll_add(set, journal, POLL_IN, 2) >= 0) {
+        poll_event_t events[4];
+        pollset_wait(set, events, 4, 0);        // Nothing readable yet
+        pipe_write(journal, "MSFT", 4, IPC_NOWAIT);
+        int ready = pollset_wait(set, events, 4, 0);
+        vga_set_color(ready == 1 && events[0].cookie == 2 ? VGA_COLOR_LIGHT_GREEN : VGA_COLOR_LIGHT_RED,
+                      VGA_COLOR_BLACK);
+        vga_write_string("Poll set saw ");
+        print_dec(ready);
+        vga_write_string(" ready pipe(s) in one wait\n");
+        vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+        pollset_print_info(set);
+    }
+    pollset_destroy(set);
+    pipe_destroy(decoded);
+    pipe_destroy(journal);
+    
+    // Test the order book: order events from a feed ring, then timed churn
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("Feeding order book...\n");
+    order_book_t* book = book_create(7, 0.01, 4096);
+    lockfree_ringbuf_t feed;
+    if (book && ringbuf_init(&feed, 16, sizeof(order_t)) == 0) {
+        order_t events[] = {
+            { 1, 7, 0, 1, 100.00, 100, 0, 0, 0 },
+            { 2, 7, 0, 1, 99.99, 200, 0, 0, 0 },
+            { 3, 7, 1, 1, 100.02, 150, 0, 0, 0 },
+            { 4, 7, 1, 1, 100.02, 50, 0, 0, 0 },
+            { 5, 7, 1, 1, 110.00, 500, 0, 0, 0 },      // Far from the touch
+            { 3, 7, 1, 1, 100.02, 100, 0, 0, 1 },      // Partial fill
+            { 1, 7, 0, 1, 100.00, 0, 0, 0, 2 },        // Cancel the best bid
+        };
+        ringbuf_push_n(&feed, events, sizeof(events) / sizeof(events[0]));
+        book_feed(&feed, 16);
+        
+        uint64_t ask_size;
+        int32_t bid = book_best(book, BOOK_BID, NULL, NULL);
+        int32_t ask = book_best(book, BOOK_ASK, &ask_size, NULL);
+        bool ok = bid == book_price_to_tick(book, 99.99) && ask == book_price_to_tick(book, 100.02) &&
+                  ask_size == 100;
+        
+        uint64_t start = ktime_ns();
+        for (uint32_t i = 0; i < 1000; i++) {
+            book_add(book, 100 + i, BOOK_BID, bid - (int32_t)(i & 15), 10, 0, 0);
+        }
+        for (uint32_t i = 0; i < 1000; i++) {
+            book_cancel(book, 100 + i);
+        }
+        uint32_t elapsed = (uint32_t)(ktime_ns() - start);
+        
+        vga_set_color(ok ? VGA_COLOR_LIGHT_GREEN : VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string(ok ? "Book touch 99.99 / 100.02 x 100" : "Book touch wrong");
+        vga_write_string(", add/cancel ");
+        print_dec(elapsed / 2000);
+        vga_write_string(" ns each\n");
+        vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+        book_print(book, 3);
+        ringbuf_destroy(&feed);
+    }
+    book_destroy(book);
+    
+    // Test pre-trade risk: one order goes out, an oversized and a
+    // fat-fingered one are stopped before the queue
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("Checking orders against risk limits...\n");
+    risk_limits_t limits = { 1000, 10000, 1000000.0, 500 };
+    risk_set_limits(9, &limits);
+    risk_mark(9, 50.00);
+    uint32_t orders = msgget(0x5249534B, 0x200); // IPC_CREAT
+    order_t order = { 1, 9, 0, 1, 50.10, 500, 0, 0, 0 };
+    int sent = send_order(orders, &order);
+    order.quantity = 600;                       // 500 working + 600 > 1000
+    uint32_t oversized = risk_check(&order);
+    order.quantity = 100;
+    order.price = 60.00;                        // 20% away from the last trade
+    uint32_t fat_finger = risk_check(&order);
+    risk_on_fill(9, 0, 500, 50.10);
+    
+    order.price = 50.05;
+    uint64_t start = ktime_ns();
+    for (uint32_t i = 0; i < 1000; i++) {
+        risk_check(&order);
+        risk_on_cancel(9, 0, order.quantity);
+    }
+    uint32_t elapsed = (uint32_t)(ktime_ns() - start);
+    
+    bool stopped = sent == 0 && oversized == RISK_REJECT_POSITION && fat_finger == RISK_REJECT_PRICE;
+    vga_set_color(stopped ? VGA_COLOR_LIGHT_GREEN : VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+    vga_write_string(stopped ? "Risk passed 1 order and stopped 2" : "Risk checks wrong");
+    vga_write_string(", ");
+    print_dec(elapsed / 1000);
+    vga_write_string(" ns per check\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    risk_print_info(9);
+    
+    // Flatten again, so the next run starts from no position
+    order.side = 1;
+    order.price = 50.20;
+    order.quantity = 500;
+    if (risk_check(&order) == RISK_OK) {
+        risk_on_fill(9, 1, 500, 50.20);
+    }
+    vga_write_string("Closed out for ");
+    print_dec((uint32_t)(risk_position(9)->realized_pnl + 0.5));
+    vga_write_string(" realised\n");
+    risk_set_limits(9, NULL);
+    msgctl(orders, 0, NULL); // IPC_RMID
+    
+    // Test the batch layout: a ring of records becomes one array per field
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("Batching market data in fixed point...\n");
+    md_batch_t* batch = md_batch_create();
+    if (batch && ringbuf_init(&feed, 16, sizeof(market_data_t)) == 0) {
+        market_data_t ticks[] = {
+            { 100.00, 100, 0, 7, MD_SIDE_TRADE, 0 },
+            { 100.10, 300, 0, 7, MD_SIDE_TRADE, 0 },
+            { 99.95, 50, 0, 7, 0, 0 },
+            { 20.00, 900, 0, 8, MD_SIDE_TRADE, 0 },
+        };
+        ringbuf_push_n(&feed, ticks, sizeof(ticks) / sizeof(ticks[0]));
+        md_batch_fill(batch, &feed);
+        
+        price_t low, high;
+        price_t vwap = price_from_double(7, md_batch_vwap(batch, 7));
+        bool ok = md_batch_range(batch, 7, &low, &high) == 0 && vwap == 1000750 &&
+                  low == 999500 && high == 1001000;
+        vga_set_color(ok ? VGA_COLOR_LIGHT_GREEN : VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string("Symbol 7 VWAP ");
+        print_dec((uint32_t)vwap);
+        vga_write_string(" ticks of 10^-");
+        print_dec(price_decimals(7));
+        vga_write_string(", range ");
+        print_dec((uint32_t)low);
+        vga_write_string("..");
+        print_dec((uint32_t)high);
+        vga_write_string("\n");
+        ringbuf_destroy(&feed);
+    }
+    kfree_aligned(batch);
+    
+    // Test the feed handler: frames through the stack from both lines,
+    // duplicates dropped and a gap noticed
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("Arbitrating A/B feed lines...\n");
+    ipv4_addr_t line_a = {{239, 1, 1, 1}};
+    ipv4_addr_t line_b = {{239, 1, 1, 2}};
+    feed_handler_t* handler = (feed_handler_t*)kmalloc(sizeof(feed_handler_t));
+    uint8_t* frame = (uint8_t*)kmalloc(ETH_MTU + ETH_HEADER_SIZE);
+    if (handler && frame && ringbuf_init(&feed, 16, sizeof(market_data_t)) == 0) {
+        if (feed_open(handler, &feed, &line_a, 30001, &line_b, 30002) == NET_SUCCESS) {
+            net_handle_ethernet(frame, testipc_feed_frame(frame, &line_a, 30001, 1, 2));
+            net_handle_ethernet(frame, testipc_feed_frame(frame, &line_b, 30002, 1, 2));
+            net_handle_ethernet(frame, testipc_feed_frame(frame, &line_b, 30002, 3, 2));
+            net_handle_ethernet(frame, testipc_feed_frame(frame, &line_a, 30001, 3, 2));
+            net_handle_ethernet(frame, testipc_feed_frame(frame, &line_a, 30001, 7, 1));  // 5 and 6 lost
+            
+            market_data_t records[8];
+            uint32_t count = ringbuf_pop_n(&feed, records, 8);
+            bool ok = count == 5 && records[2].price > 100.0002 && records[4].flags == FEED_FLAG_GAP &&
+                      handler->gaps == 1;
+            vga_set_color(ok ? VGA_COLOR_LIGHT_GREEN : VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+            vga_write_string("Feed ring got ");
+            print_dec(count);
+            vga_write_string(" records from 5 packets, gap flagged\n");
+            vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+            feed_print_stats(handler);
+            feed_close(handler);
+        }
+        ringbuf_destroy(&feed);
+    }
+    kfree(frame);
+    kfree(handler);
+    
+    // Test the order encoder: frames patched in place, checksums folded in
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("Encoding orders from templates...\n");
+    ipv4_addr_t exchange = {{10, 0, 0, 9}};
+    mac_addr_t next_hop = {{0x02, 0, 0, 0, 0, 0x09}};
+    tcp_connection_t* conn = tcp_create_connection(&exchange, 9000, 40000);
+    gateway_session_t* gw = (gateway_session_t*)kmalloc(sizeof(gateway_session_t));
+    if (conn && gw && gateway_open(gw, conn, &next_hop, "TKRN01", "TKRN", GATEWAY_DRY_RUN) == NET_SUCCESS) {
+        gateway_set_symbol(7, "AAPL");
+        order_t entry = { 0x1234, 7, 0, 1, 101.25, 300, 0, 0, 0 };
+        
+        uint64_t start = ktime_ns();
+        for (uint32_t i = 0; i < 1000; i++) {
+            entry.order_id++;
+            gateway_send_order(gw, &entry);
+        }
+        uint32_t elapsed = (uint32_t)(ktime_ns() - start);
+        gateway_send_cancel(gw, entry.order_id, 0);
+        
+        bool ok = gateway_frame_valid(&gw->enter[(gw->next_slot - 2) % RTL8139_TX_SLOTS],
+                                      sizeof(gateway_enter_frame_t)) &&
+                  gateway_frame_valid(&gw->cancel[(gw->next_slot - 1) % RTL8139_TX_SLOTS],
+                                      sizeof(gateway_cancel_frame_t));
+        vga_set_color(ok ? VGA_COLOR_LIGHT_GREEN : VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string(ok ? "Order and cancel frames check out, " : "Encoded frame checksum wrong, ");
+        print_dec(elapsed / 1000);
+        vga_write_string(" ns per order\n");
+        gateway_close(gw);
+    }
+    kfree(gw);
+    tcp_close_connection(conn);
+    
+    // Test capture and replay: records come back in order through the ring
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("Replaying a capture from the filesystem...\n");
+    lockfree_ringbuf_t replayed;
+    if (replay_synth("/testipc.rpl", 3000) == FS_SUCCESS &&
+        ringbuf_init(&replayed, 4096, sizeof(market_data_t)) == 0) {
+        replay_stats_t stats;
+        int result = replay_run("/testipc.rpl", &replayed, 0, &stats);
+        market_data_t first, last;
+        bool ok = result == FS_SUCCESS && ringbuf_count(&replayed) == 3000 &&
+                  ringbuf_pop(&replayed, &first) == 0 && first.price == 100.0;
+        while (ok && ringbuf_pop(&replayed, &last) == 0) {
+        }
+        ok = ok && last.volume == 100 + (2999 & 7) * 100;
+        vga_set_color(ok ? VGA_COLOR_LIGHT_GREEN : VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string(ok ? "3000 records replayed in order\n" : "Replay lost or reordered records\n");
+        vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+        replay_print_stats(&stats);
+        ringbuf_destroy(&replayed);
+    } else {
+        vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
+        vga_write_string("No filesystem to capture to, skipped\n");
+    }
+    
+    // Test the portfolio: a fill and a quote move broadcast, a move under
+    // the threshold does not
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("Marking a position to market...\n");
+    portfolio_on_fill(11, 0, 200, 10.00);
+    uint32_t on_fill = portfolio_publish();
+    market_data_t top = { 10.25, 300, 0, 11, 0, 0 };
+    market_snapshot_update(&top);
+    top.price = 10.30;
+    top.side = 1;
+    market_snapshot_update(&top);
+    uint32_t on_quote = portfolio_publish();
+    top.price = 10.252;                         // 0.40 on 200 shares
+    top.side = 0;
+    market_snapshot_update(&top);
+    uint32_t under = portfolio_publish();
+    
+    portfolio_totals_t totals;
+    start = ktime_ns();
+    portfolio_revalue_all(&totals);
+    elapsed = (uint32_t)(ktime_ns() - start);
+    position_t held;
+    portfolio_position(11, &held);
+    bool marked = on_fill == 1 && on_quote == 1 && under == 0 && held.quantity == 200 &&
+                  held.unrealized_pnl > 50.39 && held.unrealized_pnl < 50.41 &&
+                  totals.net_exposure > 2050.39 && totals.net_exposure < 2050.41;
+    vga_set_color(marked ? VGA_COLOR_LIGHT_GREEN : VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+    vga_write_string(marked ? "Position marked, 2 of 3 changes broadcast" : "Portfolio marks wrong");
+    vga_write_string(", revalued in ");
+    print_dec(elapsed);
+    vga_write_string(" ns\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    portfolio_print_info();
+    
+    // Close out at the bid, back to flat
+    portfolio_on_fill(11, 1, 200, 10.252);
+    portfolio_publish();
+    
+    // Test the journal: acks logged on the hot path come back from disk
+    // after one group commit
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("Journaling order events...\n");
+    journal_stats_t before;
+    journal_get_stats(&before);
+    if (before.ready) {
+        order_t acked = { 0, 9, 0, 1, 50.00, 100, 0, JOURNAL_TEST_CLIENT, 0 };
+        start = ktime_ns();
+        for (uint32_t i = 0; i < 256; i++) {
+            acked.order_id = i;
+            journal_log_order(JOURNAL_ACK, &acked);
+        }
+        elapsed = (uint32_t)(ktime_ns() - start);
+        int synced = journal_sync();
+        
+        journal_test_t found = { 0, 0 };
+        journal_replay(journal_test_record, &found);
+        journal_stats_t after;
+        journal_get_stats(&after);
+        bool ok = synced == 0 && found.count == 256 && found.misordered == 0;
+        vga_set_color(ok ? VGA_COLOR_LIGHT_GREEN : VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string(ok ? "256 events durable and read back in " : "Journal lost events, in ");
+        print_dec(after.commits - before.commits);
+        vga_write_string(" commits, ");
+        print_dec(elapsed / 256);
+        vga_write_string(" ns per event\n");
+        vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+        journal_print_info();
+    } else {
+        vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
+        vga_write_string("No disk for the journal, skipped\n");
+    }
+    
+    // Test datagram sockets: a frame through the stack to a bound socket,
+    // taken without a copy into the socket and released
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_write_string("Receiving a datagram on a UDP socket...\n");
+    int udp_fd = socket_create(AF_INET, SOCK_DGRAM, 0);
+    uint8_t* udp_frame = (uint8_t*)kmalloc(ETH_MTU + ETH_HEADER_SIZE);
+    if (udp_fd >= 0 && udp_frame) {
+        sockaddr_in_t local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_port = 5000;
+        ipv4_addr_t sender = {{10, 0, 0, 5}};
+        const char payload[] = "quote AAPL 189.25";
+        udp_datagram_t dgram;
+        
+        int received = NET_ERROR;
+        if (socket_bind(udp_fd, (const sockaddr_t*)&local) == 0) {
+            net_handle_ethernet(udp_frame, testipc_udp_frame(udp_frame, &sender, 6000, 5000,
+                                                             payload, sizeof(payload)));
+            received = socket_recv_zc(udp_fd, &dgram, 0);
+        }
+        bool ok = received == NET_SUCCESS && dgram.len == sizeof(payload) &&
+                  memcmp(dgram.data, payload, sizeof(payload)) == 0 && dgram.src_port == 6000 &&
+                  memcmp(&dgram.src_ip, &sender, sizeof(ipv4_addr_t)) == 0;
+        vga_set_color(ok ? VGA_COLOR_LIGHT_GREEN : VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        vga_write_string(ok ? "Got \"" : "Datagram lost or garbled\n");
+        if (ok) {
+            vga_write_string((const char*)dgram.data);
+            vga_write_string("\" from 10.0.0.5:6000");
+            vga_write_string(dgram.hold >= 0 ? " in place\n" : " (injected, copied)\n");
+        }
+        if (received == NET_SUCCESS) socket_release_zc(udp_fd, &dgram);
+    }
+    if (udp_fd >= 0) socket_close(udp_fd);
+    kfree(udp_frame);
 }
 
 // TODO: Re-enable when IPC is fixed
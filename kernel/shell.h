@@ -27,6 +27,9 @@ void cmd_mem(int argc, char* argv[]);
 void cmd_memstats(int argc, char* argv[]);
 void cmd_memleak(int argc, char* argv[]);
 void cmd_memcheck(int argc, char* argv[]);
+void cmd_memprof(int argc, char* argv[]);
+void cmd_membench(int argc, char* argv[]);
+void cmd_tlbbench(int argc, char* argv[]);
 void cmd_pgstats(int argc, char* argv[]);
 void cmd_echo(int argc, char* argv[]);
 void cmd_reboot(int argc, char* argv[]);
@@ -34,8 +37,28 @@ void cmd_ls(int argc, char* argv[]);
 void cmd_mkdir(int argc, char* argv[]);
 void cmd_touch(int argc, char* argv[]);
 void cmd_rm(int argc, char* argv[]);
+void cmd_sync(int argc, char* argv[]);
+void cmd_disk(int argc, char* argv[]);
 void cmd_ps(int argc, char* argv[]);
 void cmd_schedstat(int argc, char* argv[]);
+void cmd_schedlat(int argc, char* argv[]);
+void cmd_sysbench(int argc, char* argv[]);
+void cmd_bench(int argc, char* argv[]);
+void cmd_replay(int argc, char* argv[]);
+void cmd_portfolio(int argc, char* argv[]);
+void cmd_journal(int argc, char* argv[]);
+void cmd_nic(int argc, char* argv[]);
+void cmd_tcp(int argc, char* argv[]);
+void cmd_arp(int argc, char* argv[]);
+void cmd_igmp(int argc, char* argv[]);
+void cmd_vdso(int argc, char* argv[]);
+void cmd_uring(int argc, char* argv[]);
+void cmd_coro(int argc, char* argv[]);
+void cmd_tick(int argc, char* argv[]);
+void cmd_cpus(int argc, char* argv[]);
+void cmd_pin(int argc, char* argv[]);
+void cmd_isolate(int argc, char* argv[]);
+void cmd_dl(int argc, char* argv[]);
 void cmd_procinfo(int argc, char* argv[]);
 void cmd_testfork(int argc, char* argv[]);
 void cmd_testipc(int argc, char* argv[]);
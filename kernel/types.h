@@ -12,12 +12,14 @@ typedef signed short       int16_t;
 typedef signed int         int32_t;
 typedef signed long long   int64_t;
 
-typedef uint32_t           size_t;
-typedef int32_t            ssize_t;
+// Pointer-sized, as the compiler has them: 32 bits for the i386 build,
+// 64 for x86_64 (make check-x86_64)
+typedef __SIZE_TYPE__      size_t;
+typedef __PTRDIFF_TYPE__   ssize_t;
 
 // Pointer types for freestanding environment
-typedef uint32_t           uintptr_t;
-typedef int32_t            intptr_t;
+typedef __UINTPTR_TYPE__   uintptr_t;
+typedef __INTPTR_TYPE__    intptr_t;
 
 // NULL definition
 #ifndef NULL
@@ -30,6 +32,10 @@ typedef enum {
     true = 1
 } bool;
 
+// Cache line size, for keeping per-CPU data from false sharing
+#define CACHE_LINE_SIZE    64
+#define __cacheline_aligned __attribute__((aligned(CACHE_LINE_SIZE)))
+
 // Kernel utility functions
 extern void print_dec(uint32_t value);
 extern void print_hex(uint32_t value);